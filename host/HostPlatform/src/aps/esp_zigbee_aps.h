@@ -0,0 +1,67 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    esp_zb_aps_address_mode_t dst_addr_mode;
+    esp_zb_addr_u dst_addr;
+    uint8_t dst_endpoint;
+    uint16_t profile_id;
+    uint16_t cluster_id;
+    uint8_t src_endpoint;
+    uint32_t asdu_length;
+    uint8_t *asdu;
+    uint8_t tx_options;
+    bool use_alias;
+    uint16_t alias_src_addr;
+    uint8_t alias_seq_num;
+    uint8_t radius;
+} esp_zb_apsde_data_req_t;
+
+typedef struct {
+    uint8_t status;
+    uint8_t dst_addr_mode;
+    uint16_t dst_short_addr;
+    uint8_t dst_endpoint;
+    uint8_t src_addr_mode;
+    uint16_t src_short_addr;
+    uint8_t src_endpoint;
+    uint16_t profile_id;
+    uint16_t cluster_id;
+    uint32_t asdu_length;
+    uint8_t *asdu;
+    uint8_t security_status;
+    int lqi;
+    int rx_time;
+} esp_zb_apsde_data_ind_t;
+
+/* Returning true marks the frame handled, so the stack does not process it further */
+typedef bool (*esp_zb_aps_data_indication_callback_t)(esp_zb_apsde_data_ind_t ind);
+
+/* The host copies the request to the hook set with HOST_ZbSetApsDataHook() and returns; nothing is transmitted */
+esp_err_t esp_zb_aps_data_request(esp_zb_apsde_data_req_t *req);
+
+/* On the host, frames only arrive through HOST_ZbInjectApsData() */
+void esp_zb_aps_data_indication_handler_register(esp_zb_aps_data_indication_callback_t cb);
+
+#ifdef __cplusplus
+}
+#endif
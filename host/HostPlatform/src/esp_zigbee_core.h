@@ -0,0 +1,71 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Host stand-in for esp_zigbee_core.h */
+#pragma once
+
+#include "esp_zigbee_attribute.h"
+#include "esp_zigbee_type.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Implemented by the application */
+void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_s);
+
+esp_err_t esp_zb_platform_config(esp_zb_platform_config_t *config);
+void esp_zb_set_trace_level_mask(uint32_t trace_level, uint32_t trace_mask);
+/* Table & buffer sizes, only before esp_zb_init() */
+esp_err_t esp_zb_overall_network_size_set(uint16_t size);
+esp_err_t esp_zb_io_buffer_size_set(uint16_t size);
+esp_err_t esp_zb_scheduler_queue_size_set(uint16_t size);
+void esp_zb_init(esp_zb_cfg_t *nwk_cfg);
+esp_err_t esp_zb_device_register(esp_zb_ep_list_t *ep_list);
+void esp_zb_core_action_handler_register(esp_zb_core_action_callback_t cb);
+void esp_zb_identify_notify_handler_register(uint8_t endpoint, esp_zb_identify_notify_callback_t cb);
+esp_err_t esp_zb_set_primary_network_channel_set(uint32_t channel_mask);
+esp_err_t esp_zb_set_secondary_network_channel_set(uint32_t channel_mask);
+esp_err_t esp_zb_start(bool autostart);
+void esp_zb_stack_main_loop(void);
+void esp_zb_factory_reset(void);
+
+esp_err_t esp_zb_bdb_start_top_level_commissioning(uint8_t mode_mask);
+bool esp_zb_bdb_is_factory_new(void);
+bool esp_zb_bdb_dev_joined(void);
+void esp_zb_scheduler_alarm(esp_zb_callback_t cb, uint8_t param, uint32_t time);
+void esp_zb_scheduler_alarm_cancel(esp_zb_callback_t cb, uint8_t param);
+const char *esp_zb_zdo_signal_to_string(esp_zb_app_signal_type_t signal);
+void *esp_zb_app_signal_get_params(uint32_t *signal_p);
+
+void esp_zb_get_extended_pan_id(esp_zb_ieee_addr_t ext_pan_id);
+uint16_t esp_zb_get_pan_id(void);
+uint8_t esp_zb_get_current_channel(void);
+uint16_t esp_zb_get_short_address(void);
+void esp_zb_get_long_address(esp_zb_ieee_addr_t addr);
+
+/* End devices: how often the parent is polled for frames held for us */
+void esp_zb_zdo_pim_set_long_poll_interval(uint32_t ms);
+
+bool esp_zb_lock_acquire(TickType_t block_ticks);
+void esp_zb_lock_release(void);
+
+esp_zb_zcl_attr_t *esp_zb_zcl_get_attribute(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role, uint16_t attr_id);
+esp_zb_zcl_status_t esp_zb_zcl_set_attribute_val(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role, uint16_t attr_id,
+                                                 void *value_p, bool check);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,417 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Host stand-in for the esp_zb_* types this project uses, laid out after the Espressif Zigbee SDK */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef uint8_t esp_zb_ieee_addr_t[8];
+typedef esp_zb_ieee_addr_t esp_zb_64bit_addr_t;
+
+/********************* Network **************************/
+typedef enum {
+    ESP_ZB_DEVICE_TYPE_COORDINATOR = 0x0,
+    ESP_ZB_DEVICE_TYPE_ROUTER = 0x1,
+    ESP_ZB_DEVICE_TYPE_ED = 0x2,
+    ESP_ZB_DEVICE_TYPE_NONE = 0x3,
+} esp_zb_nwk_device_type_t;
+
+typedef enum {
+    ESP_ZB_ED_AGING_TIMEOUT_10SEC = 0,
+    ESP_ZB_ED_AGING_TIMEOUT_2MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_4MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_8MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_16MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_32MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_64MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_128MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_256MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_512MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_1024MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_2048MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_4096MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_8192MIN,
+    ESP_ZB_ED_AGING_TIMEOUT_16384MIN,
+} esp_zb_aging_timeout_t;
+
+typedef struct {
+    uint8_t max_children;
+} esp_zb_zczr_cfg_t;
+
+typedef struct {
+    uint8_t ed_timeout;
+    uint32_t keep_alive;
+} esp_zb_zed_cfg_t;
+
+typedef struct esp_zb_cfg_s {
+    esp_zb_nwk_device_type_t esp_zb_role;
+    bool install_code_policy;
+    union {
+        esp_zb_zczr_cfg_t zczr_cfg;
+        esp_zb_zed_cfg_t zed_cfg;
+    } nwk_cfg;
+} esp_zb_cfg_t;
+
+#define ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK 0x07FFF800U
+
+typedef enum {
+    ZB_RADIO_MODE_NATIVE = 0x0,
+    ZB_RADIO_MODE_UART_RCP = 0x1,
+    ZB_RADIO_MODE_SPI_RCP = 0x2,
+} esp_zb_radio_mode_t;
+
+typedef enum {
+    ZB_HOST_CONNECTION_MODE_NONE = 0x0,
+    ZB_HOST_CONNECTION_MODE_CLI_UART = 0x1,
+    ZB_HOST_CONNECTION_MODE_RCP_UART = 0x2,
+} esp_zb_host_connection_mode_t;
+
+typedef struct {
+    esp_zb_radio_mode_t radio_mode;
+} esp_zb_radio_config_t;
+
+typedef struct {
+    esp_zb_host_connection_mode_t host_connection_mode;
+} esp_zb_host_config_t;
+
+typedef struct {
+    esp_zb_radio_config_t radio_config;
+    esp_zb_host_config_t host_config;
+} esp_zb_platform_config_t;
+
+#define ESP_ZB_TRACE_LEVEL_CRITICAL 0
+#define ESP_ZB_TRACE_LEVEL_ERROR 1
+#define ESP_ZB_TRACE_LEVEL_WARN 2
+#define ESP_ZB_TRACE_LEVEL_INFO 3
+#define ESP_ZB_TRACE_SUBSYSTEM_MAC 0x0002
+#define ESP_ZB_TRACE_SUBSYSTEM_APP 0x0800
+
+/********************* BDB / ZDO signals **************************/
+typedef enum {
+    ESP_ZB_BDB_MODE_INITIALIZATION = 0,
+    ESP_ZB_BDB_MODE_TOUCHLINK_COMMISSIONING = 1,
+    ESP_ZB_BDB_MODE_NETWORK_STEERING = 2,
+    ESP_ZB_BDB_MODE_NETWORK_FORMATION = 4,
+} esp_zb_bdb_commissioning_mode_t;
+
+typedef enum {
+    ESP_ZB_ZDO_SIGNAL_DEFAULT_START = 0x00,
+    ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP = 0x01,
+    ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE = 0x02,
+    ESP_ZB_ZDO_SIGNAL_LEAVE = 0x03,
+    ESP_ZB_ZDO_SIGNAL_ERROR = 0x04,
+    ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START = 0x05,
+    ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT = 0x06,
+    ESP_ZB_BDB_SIGNAL_STEERING = 0x0a,
+    ESP_ZB_BDB_SIGNAL_FORMATION = 0x0b,
+    ESP_ZB_BDB_SIGNAL_FINDING_AND_BINDING_TARGET_FINISHED = 0x0c,
+    ESP_ZB_BDB_SIGNAL_FINDING_AND_BINDING_INITIATOR_FINISHED = 0x0d,
+    ESP_ZB_NWK_SIGNAL_DEVICE_ASSOCIATED = 0x12,
+    ESP_ZB_ZDO_SIGNAL_LEAVE_INDICATION = 0x13,
+    ESP_ZB_COMMON_SIGNAL_CAN_SLEEP = 0x16,
+    ESP_ZB_ZDO_SIGNAL_PRODUCTION_CONFIG_READY = 0x17,
+    ESP_ZB_NWK_SIGNAL_NO_ACTIVE_LINKS_LEFT = 0x18,
+    ESP_ZB_ZDO_SIGNAL_DEVICE_AUTHORIZED = 0x2f,
+    ESP_ZB_ZDO_SIGNAL_DEVICE_UPDATE = 0x30,
+    ESP_ZB_NWK_SIGNAL_PANID_CONFLICT_DETECTED = 0x31,
+    ESP_ZB_NLME_STATUS_INDICATION = 0x32,
+    ESP_ZB_BDB_SIGNAL_TC_REJOIN_DONE = 0x35,
+    ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS = 0x36,
+    ESP_ZB_BDB_SIGNAL_STEERING_CANCELLED = 0x37,
+    ESP_ZB_BDB_SIGNAL_FORMATION_CANCELLED = 0x38,
+    ESP_ZB_ZDO_DEVICE_UNAVAILABLE = 0x3c,
+    ESP_ZB_SIGNAL_END = 0x3d,
+} esp_zb_app_signal_type_t;
+
+typedef struct {
+    uint32_t *p_app_signal;
+    esp_err_t esp_err_status;
+} esp_zb_app_signal_t;
+
+typedef enum {
+    ESP_ZB_NWK_LEAVE_TYPE_RESET = 0x00,
+    ESP_ZB_NWK_LEAVE_TYPE_REJOIN = 0x01,
+} esp_zb_nwk_leave_type_t;
+
+/* Params of ESP_ZB_ZDO_SIGNAL_LEAVE */
+typedef struct {
+    uint8_t leave_type;
+} esp_zb_zdo_signal_leave_params_t;
+
+typedef enum {
+    ESP_ZB_NWK_COMMAND_STATUS_NO_ROUTE_AVAILABLE = 0x00,
+    ESP_ZB_NWK_COMMAND_STATUS_TREE_LINK_FAILURE = 0x01,
+    ESP_ZB_NWK_COMMAND_STATUS_NONE_TREE_LINK_FAILURE = 0x02,
+    ESP_ZB_NWK_COMMAND_STATUS_LOW_BATTERY_LEVEL = 0x03,
+    ESP_ZB_NWK_COMMAND_STATUS_NO_ROUTING_CAPACITY = 0x04,
+    ESP_ZB_NWK_COMMAND_STATUS_NO_INDIRECT_CAPACITY = 0x05,
+    ESP_ZB_NWK_COMMAND_STATUS_INDIRECT_TRANSACTION_EXPIRY = 0x06,
+    ESP_ZB_NWK_COMMAND_STATUS_TARGET_DEVICE_UNAVAILABLE = 0x07,
+    ESP_ZB_NWK_COMMAND_STATUS_TARGET_ADDRESS_UNALLOCATED = 0x08,
+    ESP_ZB_NWK_COMMAND_STATUS_PARENT_LINK_FAILURE = 0x09,
+    ESP_ZB_NWK_COMMAND_STATUS_VALIDATE_ROUTE = 0x0a,
+    ESP_ZB_NWK_COMMAND_STATUS_SOURCE_ROUTE_FAILURE = 0x0b,
+    ESP_ZB_NWK_COMMAND_STATUS_MANY_TO_ONE_ROUTE_FAILURE = 0x0c,
+    ESP_ZB_NWK_COMMAND_STATUS_ADDRESS_CONFLICT = 0x0d,
+    ESP_ZB_NWK_COMMAND_STATUS_VERIFY_ADDRESS = 0x0e,
+    ESP_ZB_NWK_COMMAND_STATUS_PAN_IDENTIFIER_UPDATE = 0x0f,
+    ESP_ZB_NWK_COMMAND_STATUS_NETWORK_ADDRESS_UPDATE = 0x10,
+    ESP_ZB_NWK_COMMAND_STATUS_BAD_FRAME_COUNTER = 0x11,
+    ESP_ZB_NWK_COMMAND_STATUS_BAD_KEY_SEQUENCE_NUMBER = 0x12,
+    ESP_ZB_NWK_COMMAND_STATUS_UNKNOWN_COMMAND = 0x13,
+} esp_zb_nwk_command_status_t;
+
+/* Params of ESP_ZB_NLME_STATUS_INDICATION */
+typedef struct {
+    uint8_t status;
+    uint16_t network_addr;
+    uint8_t unknown_command_id;
+} esp_zb_zdo_signal_nwk_status_indication_params_t;
+
+typedef void (*esp_zb_callback_t)(uint8_t param);
+
+/********************* ZCL **************************/
+#define ESP_ZB_AF_HA_PROFILE_ID 0x0104U
+#define ESP_ZB_HA_ON_OFF_OUTPUT_DEVICE_ID 0x0002U
+#define ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID 0xfff0U
+#define ESP_ZB_HA_TEMPERATURE_SENSOR_DEVICE_ID 0x0302U
+
+typedef enum {
+    ESP_ZB_ZCL_STATUS_SUCCESS = 0x00,
+    ESP_ZB_ZCL_STATUS_FAIL = 0x01,
+    ESP_ZB_ZCL_STATUS_NOT_AUTHORIZED = 0x7e,
+    ESP_ZB_ZCL_STATUS_MALFORMED_CMD = 0x80,
+    ESP_ZB_ZCL_STATUS_UNSUP_CMD = 0x81,
+    ESP_ZB_ZCL_STATUS_INVALID_FIELD = 0x85,
+    ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB = 0x86,
+    ESP_ZB_ZCL_STATUS_INVALID_VALUE = 0x87,
+    ESP_ZB_ZCL_STATUS_READ_ONLY = 0x88,
+    ESP_ZB_ZCL_STATUS_INSUFF_SPACE = 0x89,
+    ESP_ZB_ZCL_STATUS_INVALID_TYPE = 0x8d,
+} esp_zb_zcl_status_t;
+
+typedef enum {
+    ESP_ZB_ZCL_ATTR_TYPE_NULL = 0x00,
+    ESP_ZB_ZCL_ATTR_TYPE_8BIT = 0x08,
+    ESP_ZB_ZCL_ATTR_TYPE_16BIT = 0x09,
+    ESP_ZB_ZCL_ATTR_TYPE_32BIT = 0x0b,
+    ESP_ZB_ZCL_ATTR_TYPE_BOOL = 0x10,
+    ESP_ZB_ZCL_ATTR_TYPE_8BITMAP = 0x18,
+    ESP_ZB_ZCL_ATTR_TYPE_16BITMAP = 0x19,
+    ESP_ZB_ZCL_ATTR_TYPE_32BITMAP = 0x1b,
+    ESP_ZB_ZCL_ATTR_TYPE_U8 = 0x20,
+    ESP_ZB_ZCL_ATTR_TYPE_U16 = 0x21,
+    ESP_ZB_ZCL_ATTR_TYPE_U24 = 0x22,
+    ESP_ZB_ZCL_ATTR_TYPE_U32 = 0x23,
+    ESP_ZB_ZCL_ATTR_TYPE_U48 = 0x25,
+    ESP_ZB_ZCL_ATTR_TYPE_U64 = 0x27,
+    ESP_ZB_ZCL_ATTR_TYPE_S8 = 0x28,
+    ESP_ZB_ZCL_ATTR_TYPE_S16 = 0x29,
+    ESP_ZB_ZCL_ATTR_TYPE_S24 = 0x2a,
+    ESP_ZB_ZCL_ATTR_TYPE_S32 = 0x2b,
+    ESP_ZB_ZCL_ATTR_TYPE_S64 = 0x2f,
+    ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM = 0x30,
+    ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM = 0x31,
+    ESP_ZB_ZCL_ATTR_TYPE_SINGLE = 0x39,
+    ESP_ZB_ZCL_ATTR_TYPE_DOUBLE = 0x3a,
+    ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING = 0x41,
+    ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING = 0x42,
+    ESP_ZB_ZCL_ATTR_TYPE_ARRAY = 0x48,
+    ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME = 0xe2,
+    ESP_ZB_ZCL_ATTR_TYPE_IEEE_ADDR = 0xf0,
+    ESP_ZB_ZCL_ATTR_TYPE_INVALID = 0xff,
+} esp_zb_zcl_attr_type_t;
+
+typedef enum {
+    ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY = 0x01,
+    ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY = 0x02,
+    ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE = 0x03,
+    ESP_ZB_ZCL_ATTR_ACCESS_REPORTING = 0x04,
+    ESP_ZB_ZCL_ATTR_MANUF_SPEC = 0x08,
+} esp_zb_zcl_attr_access_t;
+
+typedef enum {
+    ESP_ZB_ZCL_CLUSTER_ID_BASIC = 0x0000,
+    ESP_ZB_ZCL_CLUSTER_ID_POWER_CONFIG = 0x0001,
+    ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY = 0x0003,
+    ESP_ZB_ZCL_CLUSTER_ID_GROUPS = 0x0004,
+    ESP_ZB_ZCL_CLUSTER_ID_SCENES = 0x0005,
+    ESP_ZB_ZCL_CLUSTER_ID_ON_OFF = 0x0006,
+    ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL = 0x0008,
+    ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE = 0x0019,
+    ESP_ZB_ZCL_CLUSTER_ID_POLL_CONTROL = 0x0020,
+    ESP_ZB_ZCL_CLUSTER_ID_FAN_CONTROL = 0x0202,
+    ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT = 0x0402,
+    ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT = 0x0405,
+    ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS = 0x0b05,
+} esp_zb_zcl_cluster_id_t;
+
+typedef enum {
+    ESP_ZB_ZCL_CLUSTER_SERVER_ROLE = 0x01,
+    ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE = 0x02,
+} esp_zb_zcl_cluster_role_t;
+
+typedef enum {
+    ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV = 0x00,
+    ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI = 0x01,
+} esp_zb_zcl_cmd_direction_t;
+
+typedef enum {
+    ESP_ZB_ZCL_ADDR_TYPE_SHORT = 0,
+    ESP_ZB_ZCL_ADDR_TYPE_IEEE_GPD = 1,
+    ESP_ZB_ZCL_ADDR_TYPE_SRC_ID_GPD = 2,
+    ESP_ZB_ZCL_ADDR_TYPE_IEEE = 3,
+} esp_zb_zcl_address_type_t;
+
+typedef enum {
+    ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT = 0x00,
+    ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT = 0x01,
+    ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT = 0x02,
+    ESP_ZB_APS_ADDR_MODE_64_ENDP_PRESENT = 0x03,
+} esp_zb_aps_address_mode_t;
+
+typedef struct {
+    esp_zb_zcl_address_type_t addr_type;
+    union {
+        uint16_t addr_short;
+        esp_zb_ieee_addr_t addr_long;
+        uint32_t src_id;
+    } u;
+} esp_zb_zcl_addr_t;
+
+typedef union {
+    uint16_t addr_short;
+    esp_zb_ieee_addr_t addr_long;
+} esp_zb_addr_u;
+
+typedef struct {
+    uint8_t fc;
+    uint16_t manuf_code;
+    uint8_t tsn;
+    int8_t rssi;
+} esp_zb_zcl_frame_header_t;
+
+typedef struct {
+    uint8_t id;
+    uint8_t direction;
+    uint8_t is_common;
+} esp_zb_zcl_command_t;
+
+typedef struct {
+    esp_zb_zcl_attr_type_t type;
+    uint16_t size;
+    void *value;
+} esp_zb_zcl_attribute_data_t;
+
+typedef struct {
+    uint16_t id;
+    esp_zb_zcl_attribute_data_t data;
+} esp_zb_zcl_attribute_t;
+
+typedef struct {
+    esp_zb_zcl_status_t status;
+    uint8_t dst_endpoint;
+    uint16_t cluster;
+} esp_zb_device_cb_common_info_t;
+
+typedef struct {
+    esp_zb_zcl_status_t status;
+    esp_zb_zcl_frame_header_t header;
+    esp_zb_zcl_addr_t src_address;
+    uint16_t dst_address;
+    uint8_t src_endpoint;
+    uint8_t dst_endpoint;
+    uint16_t cluster;
+    uint16_t profile;
+    esp_zb_zcl_command_t command;
+} esp_zb_zcl_cmd_info_t;
+
+typedef struct {
+    esp_zb_device_cb_common_info_t info;
+    esp_zb_zcl_attribute_t attribute;
+} esp_zb_zcl_set_attr_value_message_t;
+
+typedef struct {
+    esp_zb_zcl_cmd_info_t info;
+    struct {
+        esp_zb_zcl_attr_type_t type;
+        uint16_t size;
+        void *value;
+    } data;
+} esp_zb_zcl_custom_cluster_command_message_t;
+
+typedef struct {
+    esp_zb_zcl_status_t status;
+    esp_zb_zcl_addr_t src_address;
+    uint8_t src_endpoint;
+    uint8_t dst_endpoint;
+    uint16_t cluster;
+    esp_zb_zcl_attribute_t attribute;
+} esp_zb_zcl_report_attr_message_t;
+
+typedef enum {
+    ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID = 0x0000,
+    ESP_ZB_CORE_SCENES_STORE_SCENE_CB_ID = 0x0001,
+    ESP_ZB_CORE_SCENES_RECALL_SCENE_CB_ID = 0x0002,
+    ESP_ZB_CORE_IAS_ZONE_ENROLL_RESPONSE_VALUE_CB_ID = 0x0003,
+    ESP_ZB_CORE_OTA_UPGRADE_VALUE_CB_ID = 0x0004,
+    ESP_ZB_CORE_OTA_UPGRADE_SRV_STATUS_CB_ID = 0x0005,
+    ESP_ZB_CORE_OTA_UPGRADE_SRV_QUERY_IMAGE_CB_ID = 0x0006,
+    ESP_ZB_CORE_THERMOSTAT_WEEKLY_SCHEDULE_SET_CB_ID = 0x0007,
+    ESP_ZB_CORE_METERING_GET_PROFILE_CB_ID = 0x0008,
+    ESP_ZB_CORE_OTA_UPGRADE_QUERY_IMAGE_RESP_CB_ID = 0x000a,
+    ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID = 0x1000,
+    ESP_ZB_CORE_CMD_WRITE_ATTR_RESP_CB_ID = 0x1001,
+    ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID = 0x1002,
+    ESP_ZB_CORE_CMD_READ_REPORT_CFG_RESP_CB_ID = 0x1003,
+    ESP_ZB_CORE_CMD_DISC_ATTR_RESP_CB_ID = 0x1004,
+    ESP_ZB_CORE_CMD_DEFAULT_RESP_CB_ID = 0x1005,
+    ESP_ZB_CORE_CMD_OPERATE_GROUP_RESP_CB_ID = 0x1010,
+    ESP_ZB_CORE_CMD_VIEW_GROUP_RESP_CB_ID = 0x1011,
+    ESP_ZB_CORE_CMD_GET_GROUP_MEMBERSHIP_RESP_CB_ID = 0x1012,
+    ESP_ZB_CORE_CMD_OPERATE_SCENE_RESP_CB_ID = 0x1020,
+    ESP_ZB_CORE_CMD_VIEW_SCENE_RESP_CB_ID = 0x1021,
+    ESP_ZB_CORE_CMD_GET_SCENE_MEMBERSHIP_RESP_CB_ID = 0x1022,
+    ESP_ZB_CORE_REPORT_ATTR_CB_ID = 0x2000,
+    ESP_ZB_CORE_CMD_PRIVILEGE_COMMAND_REQ_CB_ID = 0x3000,
+    ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID = 0x4000,
+    ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_RESP_CB_ID = 0x4001,
+} esp_zb_core_action_callback_id_t;
+
+typedef esp_err_t (*esp_zb_core_action_callback_t)(esp_zb_core_action_callback_id_t callback_id, const void *message);
+typedef void (*esp_zb_identify_notify_callback_t)(uint8_t identify_on);
+
+/* Opaque cluster/attribute/endpoint lists; the host keeps them in host_zigbee.cpp */
+typedef struct esp_zb_attribute_list_s esp_zb_attribute_list_t;
+typedef struct esp_zb_cluster_list_s esp_zb_cluster_list_t;
+typedef struct esp_zb_ep_list_s esp_zb_ep_list_t;
+
+typedef struct {
+    uint16_t id;
+    uint8_t type;
+    uint8_t access;
+    uint16_t manuf_code;
+    void *data_p;
+} esp_zb_zcl_attr_t;
+
+typedef struct {
+    uint8_t endpoint;
+    uint16_t app_profile_id;
+    uint16_t app_device_id;
+    uint32_t app_device_version : 4;
+} esp_zb_endpoint_config_t;
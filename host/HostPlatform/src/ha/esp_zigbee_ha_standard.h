@@ -0,0 +1,60 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Host stand-in for ha/esp_zigbee_ha_standard.h */
+#pragma once
+
+#include "esp_zigbee_attribute.h"
+#include "esp_zigbee_type.h"
+
+#define ESP_ZB_ZCL_BASIC_ZCL_VERSION_DEFAULT_VALUE ((uint8_t)0x08)
+#define ESP_ZB_ZCL_BASIC_POWER_SOURCE_DEFAULT_VALUE ((uint8_t)0x00)
+#define ESP_ZB_ZCL_BASIC_POWER_SOURCE_MAINS_SINGLE_PHASE ((uint8_t)0x01)
+#define ESP_ZB_ZCL_IDENTIFY_IDENTIFY_TIME_DEFAULT_VALUE ((uint16_t)0x0000)
+
+#define ESP_ZB_ZCL_ATTR_BASIC_ZCL_VERSION_ID 0x0000
+#define ESP_ZB_ZCL_ATTR_BASIC_APPLICATION_VERSION_ID 0x0001
+#define ESP_ZB_ZCL_ATTR_BASIC_STACK_VERSION_ID 0x0002
+#define ESP_ZB_ZCL_ATTR_BASIC_HW_VERSION_ID 0x0003
+#define ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID 0x0004
+#define ESP_ZB_ZCL_ATTR_BASIC_MODEL_IDENTIFIER_ID 0x0005
+#define ESP_ZB_ZCL_ATTR_BASIC_DATE_CODE_ID 0x0006
+#define ESP_ZB_ZCL_ATTR_BASIC_POWER_SOURCE_ID 0x0007
+#define ESP_ZB_ZCL_ATTR_BASIC_SW_BUILD_ID 0x4000
+#define ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID 0x0000
+#define ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID 0x0000
+
+typedef struct {
+    uint8_t zcl_version;
+    uint8_t power_source;
+} esp_zb_basic_cluster_cfg_t;
+
+typedef struct {
+    uint16_t identify_time;
+} esp_zb_identify_cluster_cfg_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_zb_attribute_list_t *esp_zb_basic_cluster_create(esp_zb_basic_cluster_cfg_t *basic_cfg);
+esp_zb_attribute_list_t *esp_zb_identify_cluster_create(esp_zb_identify_cluster_cfg_t *identify_cfg);
+esp_err_t esp_zb_basic_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p);
+esp_err_t esp_zb_cluster_list_add_basic_cluster(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_identify_cluster(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+esp_err_t esp_zb_cluster_list_add_diagnostics_cluster(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list, uint8_t role_mask);
+
+#ifdef __cplusplus
+}
+#endif
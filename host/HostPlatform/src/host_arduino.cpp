@@ -0,0 +1,385 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "Arduino.h"
+#include "esp_heap_caps.h"
+#include "esp_ota_ops.h"
+#include "host_internal.h"
+#include "host_platform.h"
+
+HardwareSerial Serial;
+
+/********************* Time **************************/
+static const std::chrono::steady_clock::time_point hostEpoch = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostEpoch).count();
+}
+
+unsigned long millis(void) {
+    return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros(void) {
+    return (unsigned long)esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+/********************* Logging **************************/
+static std::atomic<bool> logEnabled(true);
+static std::mutex logMutex;
+
+void HOST_SetLogEnabled(bool enabled) {
+    logEnabled = enabled;
+}
+
+void host_log_printf(char level, const char *file, int line, const char *func, const char *format, ...) {
+    if (!logEnabled) {
+        return;
+    }
+
+    const char *base = strrchr(file, '/');
+    std::lock_guard<std::mutex> lock(logMutex);
+    fprintf(stderr, "[%8lu][%c][%s:%d] %s(): ", millis(), level, base ? base + 1 : file, line, func);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+int log_printf(const char *format, ...) {
+    if (!logEnabled) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(logMutex);
+    va_list args;
+    va_start(args, format);
+    int len = vfprintf(stderr, format, args);
+    va_end(args);
+    return len;
+}
+
+size_t HardwareSerial::printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vfprintf(stdout, format, args);
+    va_end(args);
+    return len < 0 ? 0 : (size_t)len;
+}
+
+size_t HardwareSerial::println(const char *line) {
+    return (size_t)fprintf(stdout, "%s\n", line);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_OTA_VALIDATE_FAILED: return "ESP_ERR_OTA_VALIDATE_FAILED";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+/********************* ADC **************************/
+#define HOST_ADC_MAX_PINS 8
+#define HOST_ADC_FULL_SCALE_MV 3300             /* 12 bits at 11dB attenuation */
+
+static std::mutex &adcMutex = *new std::mutex();
+static std::atomic<int> adcMillivolts[HOST_GPIO_COUNT];
+static adc_continuous_data_t adcResults[HOST_ADC_MAX_PINS];
+static size_t adcPinCount = 0;
+static void (*adcCallback)(void) = NULL;
+static bool adcStarted = false;
+static bool adcFrameReady = false;
+
+bool analogContinuous(const uint8_t pins[], size_t pins_count, uint32_t conversions_per_pin, uint32_t sampling_freq_hz, void (*userFunc)(void)) {
+    if (pins_count == 0 || pins_count > HOST_ADC_MAX_PINS || conversions_per_pin == 0 || sampling_freq_hz == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(adcMutex);
+    for (size_t i = 0; i < pins_count; i++) {
+        if (pins[i] >= HOST_GPIO_COUNT) {
+            return false;
+        }
+        adcResults[i] = {pins[i], pins[i], 0, 0};
+    }
+    adcPinCount = pins_count;
+    adcCallback = userFunc;
+    adcFrameReady = false;
+    return true;
+}
+
+bool analogContinuousRead(adc_continuous_data_t **buffer, uint32_t timeout_ms) {
+    std::lock_guard<std::mutex> lock(adcMutex);
+    if (!adcFrameReady) {
+        return false;
+    }
+
+    adcFrameReady = false;
+    *buffer = adcResults;
+    return true;
+}
+
+bool analogContinuousStart() {
+    std::lock_guard<std::mutex> lock(adcMutex);
+    adcStarted = adcPinCount > 0;
+    return adcStarted;
+}
+
+bool analogContinuousStop() {
+    std::lock_guard<std::mutex> lock(adcMutex);
+    adcStarted = false;
+    return true;
+}
+
+bool analogContinuousDeinit() {
+    std::lock_guard<std::mutex> lock(adcMutex);
+    adcStarted = false;
+    adcPinCount = 0;
+    adcCallback = NULL;
+    return true;
+}
+
+void HOST_AdcSetMillivolts(uint8_t pin, int millivolts) {
+    if (pin < HOST_GPIO_COUNT) {
+        adcMillivolts[pin] = millivolts;
+    }
+}
+
+bool HOST_AdcConvert() {
+    void (*callback)(void);
+    {
+        std::lock_guard<std::mutex> lock(adcMutex);
+        if (!adcStarted) {
+            return false;
+        }
+
+        for (size_t i = 0; i < adcPinCount; i++) {
+            int millivolts = std::min(std::max(adcMillivolts[adcResults[i].pin].load(), 0), HOST_ADC_FULL_SCALE_MV);
+            adcResults[i].avg_read_mvolts = millivolts;
+            adcResults[i].avg_read_raw = millivolts * 4095 / HOST_ADC_FULL_SCALE_MV;
+        }
+        adcFrameReady = true;
+        callback = adcCallback;
+    }
+
+    if (callback) {
+        callback();
+    }
+    return true;
+}
+
+/********************* System **************************/
+static std::function<void()> restartHook;
+
+void HOST_SetRestartHook(std::function<void()> hook) {
+    restartHook = hook;
+}
+
+#define SHUTDOWN_HANDLERS_MAX 5
+static shutdown_handler_t shutdownHandlers[SHUTDOWN_HANDLERS_MAX];
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle) {
+    for (int i = 0; i < SHUTDOWN_HANDLERS_MAX; i++) {
+        if (shutdownHandlers[i] == handle) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (shutdownHandlers[i] == NULL) {
+            shutdownHandlers[i] = handle;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_unregister_shutdown_handler(shutdown_handler_t handle) {
+    for (int i = 0; i < SHUTDOWN_HANDLERS_MAX; i++) {
+        if (shutdownHandlers[i] == handle) {
+            shutdownHandlers[i] = NULL;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_STATE;
+}
+
+void esp_restart(void) {
+    log_w("esp_restart() called");
+    for (int i = SHUTDOWN_HANDLERS_MAX - 1; i >= 0; i--) {
+        if (shutdownHandlers[i]) {
+            shutdownHandlers[i]();
+        }
+    }
+    if (restartHook) {
+        restartHook();
+    }
+    throw HostTaskExit();
+}
+
+uint32_t esp_random(void) {
+    static std::mutex &randomMutex = *new std::mutex();
+    static std::mt19937 generator{std::random_device{}()};
+
+    std::lock_guard<std::mutex> lock(randomMutex);
+    return generator();
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return 256 * 1024;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return 256 * 1024;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    return esp_get_free_heap_size();
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    return esp_get_minimum_free_heap_size();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return esp_get_free_heap_size();
+}
+
+/********************* GPIO **************************/
+typedef struct {
+    std::atomic<int> level;
+    uint8_t mode;
+    voidFuncPtrArg isr;
+    void *isrArg;
+    int isrMode;
+    std::atomic<bool> isrEnabled;
+} host_gpio_t;
+
+static host_gpio_t gpios[HOST_GPIO_COUNT];
+static std::mutex gpioIsrMutex;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin >= HOST_GPIO_COUNT) {
+        return;
+    }
+
+    gpios[pin].mode = mode;
+    if ((mode & PULLUP) == PULLUP) {
+        gpios[pin].level = HIGH;
+    } else if ((mode & PULLDOWN) == PULLDOWN) {
+        gpios[pin].level = LOW;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < HOST_GPIO_COUNT ? gpios[pin].level.load() : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin < HOST_GPIO_COUNT) {
+        gpios[pin].level = val ? HIGH : LOW;
+    }
+}
+
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg userFunc, void *arg, int mode) {
+    if (pin >= HOST_GPIO_COUNT) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(gpioIsrMutex);
+    gpios[pin].isr = userFunc;
+    gpios[pin].isrArg = arg;
+    gpios[pin].isrMode = mode;
+    gpios[pin].isrEnabled = true;
+}
+
+void detachInterrupt(uint8_t pin) {
+    if (pin >= HOST_GPIO_COUNT) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(gpioIsrMutex);
+    gpios[pin].isr = NULL;
+    gpios[pin].isrEnabled = false;
+}
+
+void enableInterrupt(uint8_t pin) {
+    if (pin < HOST_GPIO_COUNT) {
+        gpios[pin].isrEnabled = true;
+    }
+}
+
+void disableInterrupt(uint8_t pin) {
+    if (pin < HOST_GPIO_COUNT) {
+        gpios[pin].isrEnabled = false;
+    }
+}
+
+void HOST_GpioSetLevel(uint8_t pin, int level) {
+    if (pin >= HOST_GPIO_COUNT) {
+        return;
+    }
+
+    host_gpio_t *gpio = &gpios[pin];
+    int previous = gpio->level.exchange(level ? HIGH : LOW);
+
+    // Interrupt handlers run inline on the caller, serialised like a single interrupt core
+    std::lock_guard<std::mutex> lock(gpioIsrMutex);
+    if (!gpio->isr || !gpio->isrEnabled) {
+        return;
+    }
+
+    bool fire = false;
+    switch (gpio->isrMode) {
+        case RISING: fire = previous == LOW && level; break;
+        case FALLING: fire = previous == HIGH && !level; break;
+        case CHANGE: fire = previous != (level ? HIGH : LOW); break;
+        case ONLOW: fire = !level; break;
+        case ONHIGH: fire = level; break;
+    }
+
+    if (fire) {
+        gpio->isr(gpio->isrArg);
+    }
+}
+
+int HOST_GpioGetLevel(uint8_t pin) {
+    return digitalRead(pin);
+}
@@ -0,0 +1,262 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <mutex>
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include "Arduino.h"
+#include "aps/esp_zigbee_aps.h"
+#include "esp_zigbee_core.h"
+#include "host_platform.h"
+#include "Zigbee/zigbee_bulk.h"
+#include "Zigbee/zigbee_commands.h"
+
+#define BULK_REQUEST_FRAME_CONTROL (ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC | ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE)
+#define BULK_HEADER_SIZE 5
+
+typedef ZbPayload<uint8_t, uint32_t, uint8_t> start_request_t;
+typedef ZbPayload<uint8_t, uint32_t, uint32_t> ack_t;
+typedef ZbPayload<uint8_t> abort_t;
+typedef ZbPayload<uint8_t, uint8_t, uint32_t, uint8_t, uint8_t> start_response_t;
+typedef ZbPayload<uint8_t, uint32_t, zb_bytes_t> data_t;
+typedef ZbPayload<uint8_t, uint8_t, uint32_t> end_t;
+
+// Frames arrive on the stack task, the rest from the test
+static std::mutex &collectorMutex = *new std::mutex();
+static host_bulk_collector_config_t collectorConfig;
+static host_bulk_collector_stats_t collectorStats;
+static std::vector<uint8_t> collectorData;
+static std::vector<bool> collectorReceived;     /* per chunk of the current transfer */
+static std::mt19937 jitterGenerator;
+static uint8_t deviceEndpoint = 0;
+static uint8_t transfer = 0;
+static uint8_t chunkSize = 0;
+static uint32_t startOffset = 0;               /* of the current transfer, which its chunks are counted from */
+static uint32_t dataFrames = 0;
+static uint32_t accepted = 0;             /* data frames taken in, which acks are paced by */
+static uint8_t sequence = 0;
+
+static uint32_t linkDelayMs() {
+    return collectorConfig.latencyMs + (collectorConfig.jitterMs ? jitterGenerator() % (collectorConfig.jitterMs + 1) : 0);
+}
+
+static void send(uint8_t commandId, const uint8_t *payload, size_t length, uint32_t delayMs) {
+    std::vector<uint8_t> asdu = {BULK_REQUEST_FRAME_CONTROL, ZB_BULK_MANUFACTURER_CODE & 0xff, ZB_BULK_MANUFACTURER_CODE >> 8, sequence++, commandId};
+    asdu.insert(asdu.end(), payload, payload + length);
+
+    esp_zb_apsde_data_ind_t ind = {};
+    ind.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    ind.dst_short_addr = esp_zb_get_short_address();
+    ind.dst_endpoint = deviceEndpoint;
+    ind.src_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    ind.src_short_addr = collectorConfig.shortAddress;
+    ind.src_endpoint = collectorConfig.endpoint;
+    ind.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    ind.cluster_id = ZB_CLUSTER_ID_BULK_TRANSFER;
+    ind.asdu_length = asdu.size();
+    ind.asdu = asdu.data();
+    HOST_ZbInjectApsData(&ind, delayMs);
+}
+
+// Everything from the start offset up to the first missing chunk, then which of the next 32 have arrived
+static void sendAck() {
+    size_t first = 0;
+    while (first < collectorReceived.size() && collectorReceived[first]) {
+        first++;
+    }
+
+    uint32_t offset = startOffset + first * chunkSize;
+    if (offset > collectorStats.size) {
+        offset = collectorStats.size;
+    }
+
+    uint32_t received = 0;
+    for (size_t bit = 0; bit < 32 && first + bit < collectorReceived.size(); bit++) {
+        if (collectorReceived[first + bit]) {
+            received |= 1u << bit;
+        }
+    }
+
+    uint8_t payload[16];
+    size_t length;
+    ack_t::encode(payload, sizeof(payload), &length, transfer, offset, received);
+
+    collectorStats.acksSent++;
+    if (collectorConfig.ackLossEvery && collectorStats.acksSent % collectorConfig.ackLossEvery == 0) {
+        collectorStats.acksLost++;
+        return;
+    }
+    // Data takes the link latency to arrive and the ack as long again to get back
+    send(ZB_BULK_CMD_ACK, payload, length, linkDelayMs() + linkDelayMs());
+}
+
+static void onStartResponse(const uint8_t *payload, size_t length) {
+    start_response_t::values_t response;
+
+    if (!start_response_t::parse(payload, length, &response)) {
+        return;
+    }
+
+    collectorStats.startStatus = std::get<0>(response);
+    collectorStats.transfer = transfer = std::get<1>(response);
+    collectorStats.size = std::get<2>(response);
+    collectorStats.chunkSize = chunkSize = std::get<3>(response);
+    collectorStats.window = std::get<4>(response);
+    collectorStats.started = true;
+
+    if (collectorStats.startStatus != ZB_BULK_STATUS_SUCCESS || chunkSize == 0) {
+        return;
+    }
+
+    // Data from an earlier transfer of the same source stays, so a resumed one only fills in the rest
+    collectorData.resize(collectorStats.size);
+    collectorReceived.assign((collectorStats.size - startOffset + chunkSize - 1) / chunkSize, false);
+}
+
+static void onData(const uint8_t *payload, size_t length) {
+    data_t::values_t data;
+
+    if (!data_t::parse(payload, length, &data) || !collectorStats.started || std::get<0>(data) != transfer) {
+        return;
+    }
+
+    uint32_t offset = std::get<1>(data);
+    zb_bytes_t bytes = std::get<2>(data);
+
+    dataFrames++;
+    if (collectorConfig.lossEvery && dataFrames % collectorConfig.lossEvery == 0) {
+        collectorStats.lost++;
+        return;
+    }
+    if (collectorConfig.silentAfterBytes && collectorStats.bytesReceived >= collectorConfig.silentAfterBytes) {
+        collectorStats.ignored++;
+        return;
+    }
+    if (offset < startOffset || (offset - startOffset) % chunkSize != 0 || offset + bytes.length > collectorStats.size) {
+        collectorStats.malformed++;
+        return;
+    }
+
+    size_t chunk = (offset - startOffset) / chunkSize;
+    if (collectorReceived[chunk]) {
+        collectorStats.duplicates++;
+    } else {
+        collectorReceived[chunk] = true;
+        memcpy(&collectorData[offset], bytes.data, bytes.length);
+        collectorStats.chunksReceived++;
+        collectorStats.bytesReceived += bytes.length;
+    }
+
+    accepted++;
+    if (collectorConfig.ackEvery <= 1 || accepted % collectorConfig.ackEvery == 0 || offset + bytes.length == collectorStats.size) {
+        sendAck();
+    }
+}
+
+static void onEnd(const uint8_t *payload, size_t length) {
+    end_t::values_t end;
+
+    if (!end_t::parse(payload, length, &end) || std::get<0>(end) != transfer) {
+        return;
+    }
+
+    collectorStats.ended = true;
+    collectorStats.endStatus = std::get<1>(end);
+    collectorStats.endOffset = std::get<2>(end);
+}
+
+static void onApsData(const esp_zb_apsde_data_req_t *req) {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+
+    if (req->cluster_id != ZB_CLUSTER_ID_BULK_TRANSFER || req->dst_addr.addr_short != collectorConfig.shortAddress || req->asdu_length < BULK_HEADER_SIZE ||
+        (req->asdu[0] & (ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC | ZCL_FRAME_CONTROL_SERVER_TO_CLIENT)) !=
+            (ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC | ZCL_FRAME_CONTROL_SERVER_TO_CLIENT)) {
+        return;
+    }
+
+    const uint8_t *payload = req->asdu + BULK_HEADER_SIZE;
+    size_t length = req->asdu_length - BULK_HEADER_SIZE;
+
+    switch (req->asdu[BULK_HEADER_SIZE - 1]) {
+        case ZB_BULK_CMD_START_RESPONSE:
+            onStartResponse(payload, length);
+            break;
+        case ZB_BULK_CMD_DATA:
+            onData(payload, length);
+            break;
+        case ZB_BULK_CMD_END:
+            onEnd(payload, length);
+            break;
+    }
+}
+
+void HOST_BulkCollectorStart(const host_bulk_collector_config_t *config) {
+    {
+        std::lock_guard<std::mutex> lock(collectorMutex);
+        collectorConfig = *config;
+        collectorStats = {};
+        collectorData.clear();
+        collectorReceived.clear();
+        jitterGenerator.seed(1);
+        dataFrames = 0;
+        accepted = 0;
+    }
+    HOST_ZbSetApsDataHook(onApsData);
+}
+
+void HOST_BulkCollectorSetConfig(const host_bulk_collector_config_t *config) {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    collectorConfig = *config;
+}
+
+void HOST_BulkCollectorStop() {
+    HOST_ZbSetApsDataHook(nullptr);
+}
+
+void HOST_BulkCollectorRequest(uint8_t endpoint, uint8_t source, uint32_t offset, uint8_t window) {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    uint8_t payload[16];
+    size_t length;
+
+    // Counters run on across requests; the per-transfer state is refilled by the response
+    deviceEndpoint = endpoint;
+    startOffset = offset;
+    collectorStats.started = false;
+    collectorStats.ended = false;
+    collectorStats.requests++;
+
+    start_request_t::encode(payload, sizeof(payload), &length, source, offset, window);
+    send(ZB_BULK_CMD_START_REQUEST, payload, length, collectorConfig.latencyMs);
+}
+
+void HOST_BulkCollectorAbort() {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    uint8_t payload[4];
+    size_t length;
+
+    abort_t::encode(payload, sizeof(payload), &length, transfer);
+    send(ZB_BULK_CMD_ABORT, payload, length, collectorConfig.latencyMs);
+}
+
+void HOST_BulkCollectorGetStats(host_bulk_collector_stats_t *stats) {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    *stats = collectorStats;
+}
+
+std::vector<uint8_t> HOST_BulkCollectorGetData() {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    return collectorData;
+}
@@ -0,0 +1,231 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "host_platform.h"
+
+#define HOST_FLASH_SIZE 0x400000
+
+// Mirrors partitions.csv
+static const esp_partition_t partitions[] = {
+    {NULL, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, 0x9000, 0x5000, SPI_FLASH_SEC_SIZE, "nvs", false, false},
+    {NULL, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_OTA, 0xe000, 0x2000, SPI_FLASH_SEC_SIZE, "otadata", false, false},
+    {NULL, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0x140000, SPI_FLASH_SEC_SIZE, "app0", false, false},
+    {NULL, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x150000, 0x140000, SPI_FLASH_SEC_SIZE, "app1", false, false},
+    {NULL, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000, 0x15B000, SPI_FLASH_SEC_SIZE, "spiffs", false, false},
+    {NULL, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, 0x3EB000, 0x4000, SPI_FLASH_SEC_SIZE, "zb_storage", false, false},
+    {NULL, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, 0x3EF000, 0x1000, SPI_FLASH_SEC_SIZE, "zb_fct", false, false},
+    {NULL, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, 0x3F0000, 0x10000, SPI_FLASH_SEC_SIZE, "coredump", false, false},
+};
+
+static std::mutex &flashMutex = *new std::mutex();
+static std::vector<uint8_t> &image = *new std::vector<uint8_t>(HOST_FLASH_SIZE, 0xff);
+static std::vector<uint32_t> &sectorErases = *new std::vector<uint32_t>(HOST_FLASH_SIZE / SPI_FLASH_SEC_SIZE, 0);
+static FILE *imageFile = NULL;
+static host_flash_stats_t stats;
+static bool powerCutArmed = false;
+static uint32_t powerCutBytes = 0;
+static bool powerLost = false;
+static std::atomic<uint32_t> eraseTimeMs(0);
+static const esp_partition_t *bootPartition = &partitions[2];
+
+// Write a range of the image through to the backing file, if there is one
+static void persist(uint32_t address, size_t size) {
+    if (imageFile) {
+        fseek(imageFile, address, SEEK_SET);
+        fwrite(&image[address], 1, size, imageFile);
+        fflush(imageFile);
+    }
+}
+
+void HOST_FlashSetImagePath(const char *path) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+
+    if (imageFile) {
+        fclose(imageFile);
+        imageFile = NULL;
+    }
+    std::fill(image.begin(), image.end(), 0xff);
+
+    if (path) {
+        imageFile = fopen(path, "r+b");
+        if (imageFile) {
+            size_t loaded = fread(image.data(), 1, image.size(), imageFile);
+            (void)loaded;
+        } else {
+            imageFile = fopen(path, "w+b");
+        }
+        persist(0, image.size());
+    }
+}
+
+void HOST_FlashErase() {
+    std::lock_guard<std::mutex> lock(flashMutex);
+
+    std::fill(image.begin(), image.end(), 0xff);
+    std::fill(sectorErases.begin(), sectorErases.end(), 0);
+    stats = {};
+    powerCutArmed = false;
+    powerLost = false;
+    bootPartition = &partitions[2];
+    persist(0, image.size());
+}
+
+void HOST_FlashSetPowerCut(uint32_t bytes) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    powerCutArmed = bytes != 0;
+    powerCutBytes = bytes;
+    powerLost = false;
+}
+
+void HOST_FlashGetStats(host_flash_stats_t *flashStats) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    *flashStats = stats;
+}
+
+void HOST_FlashSetEraseTime(uint32_t ms) {
+    eraseTimeMs = ms;
+}
+
+uint32_t HOST_FlashGetSectorErases(uint32_t address) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    return address < HOST_FLASH_SIZE ? sectorErases[address / SPI_FLASH_SEC_SIZE] : 0;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    for (const esp_partition_t &partition : partitions) {
+        if ((type == ESP_PARTITION_TYPE_ANY || partition.type == type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || partition.subtype == subtype) &&
+            (label == NULL || strcmp(partition.label, label) == 0)) {
+            return &partition;
+        }
+    }
+    return NULL;
+}
+
+static bool inRange(const esp_partition_t *partition, size_t offset, size_t size) {
+    return partition && offset <= partition->size && size <= partition->size - offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (!inRange(partition, src_offset, size) || !dst) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    std::lock_guard<std::mutex> lock(flashMutex);
+    memcpy(dst, &image[partition->address + src_offset], size);
+    stats.reads++;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    if (!inRange(partition, dst_offset, size) || !src) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    std::lock_guard<std::mutex> lock(flashMutex);
+    if (powerLost) {
+        return ESP_FAIL;
+    }
+
+    // A power cut lands part way through this write, leaving the bytes before it programmed
+    size_t programmed = size;
+    if (powerCutArmed && powerCutBytes < size) {
+        programmed = powerCutBytes;
+        powerCutArmed = false;
+        powerLost = true;
+    } else if (powerCutArmed) {
+        powerCutBytes -= size;
+        powerLost = powerCutBytes == 0;
+        powerCutArmed = !powerLost;
+    }
+
+    uint32_t address = partition->address + dst_offset;
+    const uint8_t *bytes = (const uint8_t *)src;
+    for (size_t i = 0; i < programmed; i++) {
+        image[address + i] &= bytes[i];
+    }
+    persist(address, programmed);
+
+    stats.writes++;
+    stats.bytesWritten += programmed;
+    return programmed == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (!inRange(partition, offset, size) || offset % partition->erase_size || size % partition->erase_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The caller is held up for as long as the chip would take, the image itself stays free for other callers
+    uint32_t ms = eraseTimeMs;
+    if (ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms * (size / partition->erase_size)));
+    }
+
+    std::lock_guard<std::mutex> lock(flashMutex);
+    if (powerLost) {
+        return ESP_FAIL;
+    }
+
+    uint32_t address = partition->address + offset;
+    memset(&image[address], 0xff, size);
+    for (uint32_t sector = address / SPI_FLASH_SEC_SIZE; sector < (address + size) / SPI_FLASH_SEC_SIZE; sector++) {
+        sectorErases[sector]++;
+    }
+    persist(address, size);
+
+    stats.erases++;
+    return ESP_OK;
+}
+
+/********************* OTA **************************/
+const esp_partition_t *esp_ota_get_running_partition(void) {
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from) {
+    const esp_partition_t *from = start_from ? start_from : esp_ota_get_running_partition();
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, from->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_0 ? ESP_PARTITION_SUBTYPE_APP_OTA_1 : ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition) {
+    if (partition == NULL || partition->type != ESP_PARTITION_TYPE_APP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    std::lock_guard<std::mutex> lock(flashMutex);
+    if (image[partition->address] != 0xE9) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    bootPartition = partition;
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void) {
+    std::lock_guard<std::mutex> lock(flashMutex);
+    return bootPartition;
+}
@@ -0,0 +1,490 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+#include "host_internal.h"
+
+/********************* Tasks **************************/
+struct tskTaskControlBlock {
+    std::string name;
+    uint32_t stackDepth;
+    UBaseType_t priority;
+    std::mutex notifyMutex;
+    std::condition_variable notifyCondition;
+    uint32_t notifyValue;
+    bool notifyPending;
+};
+
+static thread_local tskTaskControlBlock *currentTask = NULL;
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char *pcName, uint32_t usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask) {
+    tskTaskControlBlock *tcb = new tskTaskControlBlock();
+    tcb->name = pcName ? pcName : "";
+    tcb->stackDepth = usStackDepth;
+    tcb->priority = uxPriority;
+    tcb->notifyValue = 0;
+    tcb->notifyPending = false;
+
+    if (pxCreatedTask) {
+        *pxCreatedTask = tcb;
+    }
+
+    std::thread([tcb, pxTaskCode, pvParameters]() {
+        currentTask = tcb;
+        try {
+            pxTaskCode(pvParameters);
+        } catch (const HostTaskExit &) {
+        }
+    }).detach();
+
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t pxTaskCode, const char *pcName, uint32_t ulStackDepth, void *pvParameters,
+                               UBaseType_t uxPriority, StackType_t *puxStackBuffer, StaticTask_t *pxTaskBuffer) {
+    TaskHandle_t task = NULL;
+
+    // FreeRTOS returns NULL rather than falling back to the heap when the storage is missing
+    if (puxStackBuffer == NULL || pxTaskBuffer == NULL) {
+        return NULL;
+    }
+
+    xTaskCreate(pxTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, &task);
+    return task;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+    if (xTaskToDelete == NULL || xTaskToDelete == currentTask) {
+        throw HostTaskExit();
+    }
+
+    // Threads cannot be stopped from outside; host tasks are expected to delete themselves
+    log_e("Deleting another task is not supported on the host (%s)", xTaskToDelete->name.c_str());
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(pdTICKS_TO_MS(xTicksToDelay)));
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)millis();
+}
+
+TickType_t xTaskGetTickCountFromISR(void) {
+    return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return currentTask;
+}
+
+const char *pcTaskGetName(TaskHandle_t xTaskToQuery) {
+    TaskHandle_t task = xTaskToQuery ? xTaskToQuery : currentTask;
+    return task ? task->name.c_str() : "main";
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask) {
+    // Host threads have no bounded stack to measure against; report the whole allocation as unused
+    TaskHandle_t task = xTask ? xTask : currentTask;
+    return task ? task->stackDepth : 0;
+}
+
+/********************* Task notifications **************************/
+static tskTaskControlBlock *notifyTarget(TaskHandle_t task) {
+    // Threads that were not created through xTaskCreate (the test runner's main thread) get a TCB on first use
+    if (task == NULL) {
+        if (currentTask == NULL) {
+            currentTask = new tskTaskControlBlock();
+            currentTask->name = "main";
+            currentTask->notifyValue = 0;
+            currentTask->notifyPending = false;
+        }
+        task = currentTask;
+    }
+    return task;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction) {
+    tskTaskControlBlock *task = notifyTarget(xTaskToNotify);
+    BaseType_t ret = pdPASS;
+
+    {
+        std::lock_guard<std::mutex> lock(task->notifyMutex);
+        switch (eAction) {
+            case eNoAction: break;
+            case eSetBits: task->notifyValue |= ulValue; break;
+            case eIncrement: task->notifyValue++; break;
+            case eSetValueWithOverwrite: task->notifyValue = ulValue; break;
+            case eSetValueWithoutOverwrite:
+                if (task->notifyPending) {
+                    ret = pdFAIL;
+                } else {
+                    task->notifyValue = ulValue;
+                }
+                break;
+        }
+        task->notifyPending = true;
+    }
+
+    task->notifyCondition.notify_all();
+    return ret;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, BaseType_t *pxHigherPriorityTaskWoken) {
+    if (pxHigherPriorityTaskWoken) {
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    }
+    return xTaskNotify(xTaskToNotify, ulValue, eAction);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue, TickType_t xTicksToWait) {
+    tskTaskControlBlock *task = notifyTarget(NULL);
+    std::unique_lock<std::mutex> lock(task->notifyMutex);
+
+    if (!task->notifyPending) {
+        task->notifyValue &= ~ulBitsToClearOnEntry;
+    }
+
+    bool notified;
+    if (xTicksToWait == portMAX_DELAY) {
+        task->notifyCondition.wait(lock, [task] { return task->notifyPending; });
+        notified = true;
+    } else {
+        notified = task->notifyCondition.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(xTicksToWait)), [task] { return task->notifyPending; });
+    }
+
+    if (pulNotificationValue) {
+        *pulNotificationValue = task->notifyValue;
+    }
+    if (notified) {
+        task->notifyValue &= ~ulBitsToClearOnExit;
+        task->notifyPending = false;
+    }
+    return notified ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify) {
+    return xTaskNotify(xTaskToNotify, 0, eIncrement);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken) {
+    xTaskNotifyFromISR(xTaskToNotify, 0, eIncrement, pxHigherPriorityTaskWoken);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait) {
+    tskTaskControlBlock *task = notifyTarget(NULL);
+    std::unique_lock<std::mutex> lock(task->notifyMutex);
+
+    auto ready = [task] { return task->notifyValue != 0; };
+    if (xTicksToWait == portMAX_DELAY) {
+        task->notifyCondition.wait(lock, ready);
+    } else {
+        task->notifyCondition.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(xTicksToWait)), ready);
+    }
+
+    uint32_t value = task->notifyValue;
+    if (value != 0) {
+        task->notifyValue = xClearCountOnExit ? 0 : value - 1;
+    }
+    task->notifyPending = false;
+    return value;
+}
+
+/********************* Queues **************************/
+struct QueueDefinition {
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+    std::vector<uint8_t> storage;
+};
+
+template <typename Predicate>
+static bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t ticks, Predicate ready) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+
+    return cv.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(ticks)), ready);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize) {
+    QueueHandle_t queue = new QueueDefinition();
+    queue->length = uxQueueLength;
+    queue->itemSize = uxItemSize;
+    queue->head = 0;
+    queue->count = 0;
+    queue->storage.resize((size_t)uxQueueLength * uxItemSize);
+    return queue;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize, uint8_t *pucQueueStorage, StaticQueue_t *pxQueueBuffer) {
+    if (pxQueueBuffer == NULL || (pucQueueStorage == NULL && uxItemSize > 0)) {
+        return NULL;
+    }
+
+    return xQueueCreate(uxQueueLength, uxItemSize);
+}
+
+void vQueueDelete(QueueHandle_t xQueue) {
+    delete xQueue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait) {
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+
+    if (!waitFor(xQueue->notFull, lock, xTicksToWait, [xQueue] { return xQueue->count < xQueue->length; })) {
+        return errQUEUE_FULL;
+    }
+
+    UBaseType_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+    memcpy(&xQueue->storage[(size_t)tail * xQueue->itemSize], pvItemToQueue, xQueue->itemSize);
+    xQueue->count++;
+    lock.unlock();
+
+    xQueue->notEmpty.notify_one();
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t xQueue, const void *pvItemToQueue, BaseType_t *pxHigherPriorityTaskWoken) {
+    if (pxHigherPriorityTaskWoken) {
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    }
+
+    return xQueueSend(xQueue, pvItemToQueue, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait) {
+    std::unique_lock<std::mutex> lock(xQueue->mutex);
+
+    if (!waitFor(xQueue->notEmpty, lock, xTicksToWait, [xQueue] { return xQueue->count > 0; })) {
+        return pdFALSE;
+    }
+
+    memcpy(pvBuffer, &xQueue->storage[(size_t)xQueue->head * xQueue->itemSize], xQueue->itemSize);
+    xQueue->head = (xQueue->head + 1) % xQueue->length;
+    xQueue->count--;
+    lock.unlock();
+
+    xQueue->notFull.notify_one();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue) {
+    std::lock_guard<std::mutex> lock(xQueue->mutex);
+    return xQueue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t xQueue) {
+    std::lock_guard<std::mutex> lock(xQueue->mutex);
+    return xQueue->length - xQueue->count;
+}
+
+/********************* Critical sections **************************/
+static std::recursive_mutex &criticalLock = *new std::recursive_mutex();
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    criticalLock.lock();
+    mux->count++;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    mux->count--;
+    criticalLock.unlock();
+}
+
+/********************* Timers **************************/
+struct tmrTimerControl {
+    std::string name;
+    TickType_t period;
+    bool autoReload;
+    void *id;
+    TimerCallbackFunction_t callback;
+    bool active;
+    int64_t expiry;
+};
+
+// Never destroyed: the timer thread is still blocked on these when the process exits
+static std::mutex &timerMutex = *new std::mutex();
+static std::condition_variable &timerCondition = *new std::condition_variable();
+static std::vector<TimerHandle_t> &timers = *new std::vector<TimerHandle_t>();
+static bool timerTaskStarted = false;
+static std::atomic<uint32_t> timerCommandsToFail(0);
+
+static void timerTask() {
+    std::unique_lock<std::mutex> lock(timerMutex);
+
+    while (true) {
+        TimerHandle_t next = NULL;
+        for (TimerHandle_t timer : timers) {
+            if (timer->active && (!next || timer->expiry < next->expiry)) {
+                next = timer;
+            }
+        }
+
+        if (!next) {
+            timerCondition.wait(lock);
+            continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (next->expiry > now) {
+            timerCondition.wait_for(lock, std::chrono::microseconds(next->expiry - now));
+            continue;
+        }
+
+        if (next->autoReload) {
+            next->expiry += (int64_t)pdTICKS_TO_MS(next->period) * 1000;
+        } else {
+            next->active = false;
+        }
+
+        lock.unlock();
+        next->callback(next);
+        lock.lock();
+    }
+}
+
+static BaseType_t armTimer(TimerHandle_t xTimer, TickType_t period) {
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        xTimer->period = period;
+        xTimer->active = true;
+        xTimer->expiry = esp_timer_get_time() + (int64_t)pdTICKS_TO_MS(period) * 1000;
+    }
+    timerCondition.notify_all();
+    return pdPASS;
+}
+
+TimerHandle_t xTimerCreate(const char *pcTimerName, TickType_t xTimerPeriodInTicks, UBaseType_t uxAutoReload, void *pvTimerID,
+                           TimerCallbackFunction_t pxCallbackFunction) {
+    TimerHandle_t timer = new tmrTimerControl{pcTimerName ? pcTimerName : "", xTimerPeriodInTicks, uxAutoReload != pdFALSE, pvTimerID,
+                                              pxCallbackFunction, false, 0};
+
+    std::lock_guard<std::mutex> lock(timerMutex);
+    timers.push_back(timer);
+    if (!timerTaskStarted) {
+        timerTaskStarted = true;
+        std::thread(timerTask).detach();
+    }
+    return timer;
+}
+
+TimerHandle_t xTimerCreateStatic(const char *pcTimerName, TickType_t xTimerPeriodInTicks, UBaseType_t uxAutoReload, void *pvTimerID,
+                                 TimerCallbackFunction_t pxCallbackFunction, StaticTimer_t *pxTimerBuffer) {
+    if (pxTimerBuffer == NULL) {
+        return NULL;
+    }
+
+    return xTimerCreate(pcTimerName, xTimerPeriodInTicks, uxAutoReload, pvTimerID, pxCallbackFunction);
+}
+
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+    return armTimer(xTimer, xTimer->period);
+}
+
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    xTimer->active = false;
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+    return armTimer(xTimer, xTimer->period);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t xTimer, TickType_t xNewPeriod, TickType_t xTicksToWait) {
+    return armTimer(xTimer, xNewPeriod);
+}
+
+BaseType_t xTimerDelete(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    for (auto timer = timers.begin(); timer != timers.end(); ++timer) {
+        if (*timer == xTimer) {
+            timers.erase(timer);
+            break;
+        }
+    }
+    delete xTimer;
+    return pdPASS;
+}
+
+void HOST_TimerFailFromISR(uint32_t count) {
+    timerCommandsToFail = count;
+}
+
+// True if a timer command sent from an ISR should find the command queue full
+static bool failFromISR() {
+    uint32_t remaining = timerCommandsToFail.load();
+    while (remaining > 0) {
+        if (timerCommandsToFail.compare_exchange_weak(remaining, remaining - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+BaseType_t xTimerStartFromISR(TimerHandle_t xTimer, BaseType_t *pxHigherPriorityTaskWoken) {
+    if (failFromISR()) {
+        return pdFAIL;
+    }
+    return xTimerStart(xTimer, 0);
+}
+
+BaseType_t xTimerStopFromISR(TimerHandle_t xTimer, BaseType_t *pxHigherPriorityTaskWoken) {
+    if (failFromISR()) {
+        return pdFAIL;
+    }
+    return xTimerStop(xTimer, 0);
+}
+
+BaseType_t xTimerResetFromISR(TimerHandle_t xTimer, BaseType_t *pxHigherPriorityTaskWoken) {
+    if (failFromISR()) {
+        return pdFAIL;
+    }
+    return xTimerReset(xTimer, 0);
+}
+
+BaseType_t xTimerChangePeriodFromISR(TimerHandle_t xTimer, TickType_t xNewPeriod, BaseType_t *pxHigherPriorityTaskWoken) {
+    if (failFromISR()) {
+        return pdFAIL;
+    }
+    return xTimerChangePeriod(xTimer, xNewPeriod, 0);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t xTimer) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    return xTimer->active ? pdTRUE : pdFALSE;
+}
+
+TickType_t xTimerGetPeriod(TimerHandle_t xTimer) {
+    return xTimer->period;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t xTimer) {
+    return xTimer->id;
+}
@@ -0,0 +1,37 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Arduino-style entry point for `pio run -e native`. Only linked when nothing else (e.g. a test suite) defines main() */
+#include <stdlib.h>
+
+#include "Arduino.h"
+#include "host_platform.h"
+
+void setup();
+void loop();
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    // Keep flash between runs, so persisted state is there on the next start as it would be on the device
+    const char *image = getenv("HOST_FLASH_IMAGE");
+    HOST_FlashSetImagePath(image ? image : "host_flash.bin");
+
+    setup();
+
+    while (true) {
+        loop();
+    }
+}
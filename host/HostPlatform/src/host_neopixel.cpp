@@ -0,0 +1,150 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <math.h>
+#include <string.h>
+
+#include "Adafruit_NeoPixel.h"
+#include "host_platform.h"
+
+static std::function<void(const uint32_t *pixels, uint16_t count)> showHook;
+
+void HOST_NeoPixelSetShowHook(std::function<void(const uint32_t *pixels, uint16_t count)> hook) {
+    showHook = hook;
+}
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t n, int16_t pin, neoPixelType type) : numLEDs(n), brightness(255) {
+    (void)pin;
+    (void)type;
+    pixels = new uint32_t[n]();
+    shown = new uint32_t[n]();
+}
+
+Adafruit_NeoPixel::~Adafruit_NeoPixel() {
+    delete[] pixels;
+    delete[] shown;
+}
+
+void Adafruit_NeoPixel::show(void) {
+    // Scale by brightness on the way out, as the real driver does when latching the strip
+    for (uint16_t i = 0; i < numLEDs; i++) {
+        uint32_t c = pixels[i];
+        uint32_t scale = (uint32_t)brightness + 1;
+        shown[i] = ((((c >> 16) & 0xff) * scale >> 8) << 16) | ((((c >> 8) & 0xff) * scale >> 8) << 8) | ((c & 0xff) * scale >> 8);
+    }
+
+    if (showHook) {
+        showHook(shown, numLEDs);
+    }
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
+    setPixelColor(n, Color(r, g, b));
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint32_t c) {
+    if (n < numLEDs) {
+        pixels[n] = c & 0xffffff;
+    }
+}
+
+void Adafruit_NeoPixel::fill(uint32_t c, uint16_t first, uint16_t count) {
+    uint16_t end = (count == 0 || first + count > numLEDs) ? numLEDs : first + count;
+    for (uint16_t i = first; i < end; i++) {
+        setPixelColor(i, c);
+    }
+}
+
+void Adafruit_NeoPixel::clear(void) {
+    memset(pixels, 0, numLEDs * sizeof(uint32_t));
+}
+
+void Adafruit_NeoPixel::rainbow(uint16_t first_hue, int8_t reps, uint8_t saturation, uint8_t brightness, bool gammify) {
+    for (uint16_t i = 0; i < numLEDs; i++) {
+        uint16_t hue = first_hue + (i * reps * 65536) / numLEDs;
+        uint32_t color = ColorHSV(hue, saturation, brightness);
+        if (gammify) {
+            color = gamma32(color);
+        }
+        setPixelColor(i, color);
+    }
+}
+
+// Same integer HSV conversion as the Adafruit library, so host render cost tracks the device
+uint32_t Adafruit_NeoPixel::ColorHSV(uint16_t hue, uint8_t sat, uint8_t val) {
+    uint8_t r, g, b;
+
+    hue = (hue * 1530L + 32768) / 65536;
+
+    if (hue < 510) {
+        b = 0;
+        if (hue < 255) {
+            r = 255;
+            g = hue;
+        } else {
+            r = 510 - hue;
+            g = 255;
+        }
+    } else if (hue < 1020) {
+        r = 0;
+        if (hue < 765) {
+            g = 255;
+            b = hue - 510;
+        } else {
+            g = 1020 - hue;
+            b = 255;
+        }
+    } else if (hue < 1530) {
+        g = 0;
+        if (hue < 1275) {
+            r = hue - 1020;
+            b = 255;
+        } else {
+            r = 255;
+            b = 1530 - hue;
+        }
+    } else {
+        r = 255;
+        g = b = 0;
+    }
+
+    uint32_t v1 = 1 + val;
+    uint16_t s1 = 1 + sat;
+    uint8_t s2 = 255 - sat;
+
+    return ((((((r * s1) >> 8) + s2) * v1) & 0xff00) << 8) | (((((g * s1) >> 8) + s2) * v1) & 0xff00) |
+           (((((b * s1) >> 8) + s2) * v1) >> 8);
+}
+
+uint8_t Adafruit_NeoPixel::gamma8(uint8_t x) {
+    static uint8_t table[256];
+    static bool initialised = false;
+
+    if (!initialised) {
+        for (int i = 0; i < 256; i++) {
+            table[i] = (uint8_t)(pow(i / 255.0, 2.6) * 255.0 + 0.5);
+        }
+        initialised = true;
+    }
+
+    return table[x];
+}
+
+uint32_t Adafruit_NeoPixel::gamma32(uint32_t x) {
+    uint8_t *y = (uint8_t *)&x;
+    for (uint8_t i = 0; i < 4; i++) {
+        y[i] = gamma8(y[i]);
+    }
+    return x;
+}
@@ -0,0 +1,280 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <mutex>
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include "Arduino.h"
+#include "aps/esp_zigbee_aps.h"
+#include "esp_timer.h"
+#include "esp_zigbee_core.h"
+#include "host_platform.h"
+#include "Zigbee/zigbee_commands.h"
+#include "Zigbee/zigbee_ota.h"
+
+#define OTA_RESPONSE_FRAME_CONTROL (ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_SERVER_TO_CLIENT | ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE)
+#define OTA_HEADER_VERSION 0x0100
+#define OTA_STACK_VERSION 0x0002                /* Zigbee PRO */
+
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t> query_request_t;
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t, uint32_t> query_response_t;
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t, uint32_t, uint8_t> block_request_t;
+typedef ZbPayload<uint8_t, uint32_t, uint32_t, uint16_t> block_wait_t;
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t> end_request_t;
+typedef ZbPayload<uint16_t, uint16_t, uint32_t, uint32_t, uint32_t> end_response_t;
+
+// Requests arrive on the stack task, the rest from the test
+static std::mutex &serverMutex = *new std::mutex();
+static host_ota_server_config_t serverConfig;
+static std::vector<uint8_t> serverFile;
+static host_ota_server_stats_t serverStats;
+static std::vector<int64_t> arrivals;       /* of block responses still on their way, in microseconds */
+static std::mt19937 jitterGenerator;
+static bool waitSent = false;
+static bool firstRequest = true;
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, value);
+    put16(p + 2, value >> 16);
+}
+
+static uint32_t responseDelayMs() {
+    return serverConfig.latencyMs + (serverConfig.jitterMs ? jitterGenerator() % (serverConfig.jitterMs + 1) : 0);
+}
+
+static void respond(uint8_t endpoint, uint8_t tsn, uint8_t commandId, const uint8_t *payload, size_t length, uint32_t delayMs) {
+    std::vector<uint8_t> asdu = {OTA_RESPONSE_FRAME_CONTROL, tsn, commandId};
+    asdu.insert(asdu.end(), payload, payload + length);
+
+    esp_zb_apsde_data_ind_t ind = {};
+    ind.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    ind.dst_short_addr = esp_zb_get_short_address();
+    ind.dst_endpoint = endpoint;
+    ind.src_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    ind.src_short_addr = serverConfig.shortAddress;
+    ind.src_endpoint = serverConfig.endpoint;
+    ind.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    ind.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE;
+    ind.asdu_length = asdu.size();
+    ind.asdu = asdu.data();
+    HOST_ZbInjectApsData(&ind, delayMs);
+}
+
+static void onQuery(uint8_t endpoint, uint8_t tsn, const uint8_t *payload, size_t length) {
+    query_request_t::values_t request;
+    uint8_t response[16];
+    size_t responseLength;
+
+    if (!query_request_t::parse(payload, length, &request)) {
+        return;
+    }
+    serverStats.queries++;
+
+    if (serverFile.empty() || std::get<1>(request) != serverConfig.manufacturer || std::get<2>(request) != serverConfig.imageType) {
+        response[0] = ZB_OTA_STATUS_NO_IMAGE_AVAILABLE;
+        responseLength = 1;
+    } else {
+        query_response_t::encode(response, sizeof(response), &responseLength, ZB_OTA_STATUS_SUCCESS, serverConfig.manufacturer, serverConfig.imageType,
+                                 serverConfig.fileVersion, (uint32_t)serverFile.size());
+    }
+    respond(endpoint, tsn, ZB_OTA_CMD_QUERY_NEXT_IMAGE_RESPONSE, response, responseLength, responseDelayMs());
+}
+
+static void onBlockRequest(uint8_t endpoint, uint8_t tsn, const uint8_t *payload, size_t length) {
+    block_request_t::values_t request;
+    uint8_t response[16 + 255];
+    size_t responseLength;
+
+    if (!block_request_t::parse(payload, length, &request)) {
+        return;
+    }
+
+    uint32_t offset = std::get<4>(request);
+    uint8_t size = std::get<5>(request);
+    int64_t now = esp_timer_get_time();
+
+    if (firstRequest) {
+        serverStats.firstRequestOffset = offset;
+        firstRequest = false;
+    }
+    serverStats.blockRequests++;
+    if (size > serverStats.largestRequest) {
+        serverStats.largestRequest = size;
+    }
+
+    // Responses already on their way when this request was made
+    for (auto arrival = arrivals.begin(); arrival != arrivals.end();) {
+        arrival = *arrival <= now ? arrivals.erase(arrival) : arrival + 1;
+    }
+    if (arrivals.size() + 1 > serverStats.peakInFlight) {
+        serverStats.peakInFlight = arrivals.size() + 1;
+    }
+
+    if (serverConfig.waitForDataS && !waitSent) {
+        waitSent = true;
+        block_wait_t::encode(response, sizeof(response), &responseLength, ZB_OTA_STATUS_WAIT_FOR_DATA, 0, serverConfig.waitForDataS, 0);
+        respond(endpoint, tsn, ZB_OTA_CMD_IMAGE_BLOCK_RESPONSE, response, responseLength, serverConfig.latencyMs);
+        return;
+    }
+
+    if (std::get<1>(request) != serverConfig.manufacturer || std::get<2>(request) != serverConfig.imageType ||
+        std::get<3>(request) != serverConfig.fileVersion || offset >= serverFile.size()) {
+        response[0] = ZB_OTA_STATUS_ABORT;
+        respond(endpoint, tsn, ZB_OTA_CMD_IMAGE_BLOCK_RESPONSE, response, 1, serverConfig.latencyMs);
+        return;
+    }
+
+    if (serverConfig.stopAfterBytes && serverStats.bytesSent >= serverConfig.stopAfterBytes) {
+        return;
+    }
+
+    if (serverConfig.maxBlockSize && size > serverConfig.maxBlockSize) {
+        size = serverConfig.maxBlockSize;
+    }
+    if (size > serverFile.size() - offset) {
+        size = serverFile.size() - offset;
+    }
+
+    response[0] = ZB_OTA_STATUS_SUCCESS;
+    put16(&response[1], serverConfig.manufacturer);
+    put16(&response[3], serverConfig.imageType);
+    put32(&response[5], serverConfig.fileVersion);
+    put32(&response[9], offset);
+    response[13] = size;
+    memcpy(&response[14], &serverFile[offset], size);
+    responseLength = 14 + size;
+
+    uint32_t delayMs = responseDelayMs();
+    arrivals.push_back(now + (int64_t)delayMs * 1000);
+    serverStats.blocksSent++;
+    serverStats.bytesSent += size;
+
+    if ((serverConfig.lossEvery && serverStats.blocksSent % serverConfig.lossEvery == 0) ||
+        (serverConfig.linkMaxBlockSize && size > serverConfig.linkMaxBlockSize)) {
+        serverStats.lost++;
+        return;
+    }
+    respond(endpoint, tsn, ZB_OTA_CMD_IMAGE_BLOCK_RESPONSE, response, responseLength, delayMs);
+}
+
+static void onUpgradeEnd(uint8_t endpoint, uint8_t tsn, const uint8_t *payload, size_t length) {
+    end_request_t::values_t request;
+    uint8_t response[16];
+    size_t responseLength;
+
+    if (!end_request_t::parse(payload, length, &request)) {
+        return;
+    }
+    serverStats.endRequests++;
+    serverStats.endStatus = std::get<0>(request);
+
+    if (serverStats.endStatus == ZB_OTA_STATUS_SUCCESS) {
+        end_response_t::encode(response, sizeof(response), &responseLength, serverConfig.manufacturer, serverConfig.imageType, serverConfig.fileVersion, 0,
+                               serverConfig.upgradeDelayS);
+        respond(endpoint, tsn, ZB_OTA_CMD_UPGRADE_END_RESPONSE, response, responseLength, responseDelayMs());
+    }
+}
+
+static void onApsData(const esp_zb_apsde_data_req_t *req) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+
+    if (req->cluster_id != ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE || req->dst_addr.addr_short != serverConfig.shortAddress || req->asdu_length < 3 ||
+        (req->asdu[0] & (ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_SERVER_TO_CLIENT)) != ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC) {
+        return;
+    }
+
+    uint8_t tsn = req->asdu[1];
+    const uint8_t *payload = req->asdu + 3;
+    size_t length = req->asdu_length - 3;
+
+    switch (req->asdu[2]) {
+        case ZB_OTA_CMD_QUERY_NEXT_IMAGE_REQUEST:
+            onQuery(req->src_endpoint, tsn, payload, length);
+            break;
+        case ZB_OTA_CMD_IMAGE_BLOCK_REQUEST:
+            onBlockRequest(req->src_endpoint, tsn, payload, length);
+            break;
+        case ZB_OTA_CMD_UPGRADE_END_REQUEST:
+            onUpgradeEnd(req->src_endpoint, tsn, payload, length);
+            break;
+    }
+}
+
+void HOST_OtaServerStart(const host_ota_server_config_t *config, const uint8_t *file, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        serverConfig = *config;
+        serverFile.assign(file, file + size);
+        serverStats = {};
+        arrivals.clear();
+        jitterGenerator.seed(1);
+        waitSent = false;
+        firstRequest = true;
+    }
+    HOST_ZbSetApsDataHook(onApsData);
+}
+
+void HOST_OtaServerSetConfig(const host_ota_server_config_t *config) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    serverConfig = *config;
+}
+
+void HOST_OtaServerStop() {
+    HOST_ZbSetApsDataHook(nullptr);
+
+    std::lock_guard<std::mutex> lock(serverMutex);
+    serverFile.clear();
+}
+
+void HOST_OtaServerNotify(uint8_t endpoint) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    const uint8_t payload[] = {0x00, 100};      /* query jitter only, every client to query */
+
+    respond(endpoint, 0, ZB_OTA_CMD_IMAGE_NOTIFY, payload, sizeof(payload), serverConfig.latencyMs);
+}
+
+void HOST_OtaServerGetStats(host_ota_server_stats_t *stats) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    *stats = serverStats;
+}
+
+std::vector<uint8_t> HOST_OtaBuildFile(const host_ota_server_config_t *config, const uint8_t *image, size_t size) {
+    std::vector<uint8_t> file(ZB_OTA_HEADER_MIN_SIZE + ZB_OTA_ELEMENT_HEADER_SIZE + size);
+    uint8_t *header = file.data();
+
+    put32(&header[0], ZB_OTA_FILE_IDENTIFIER);
+    put16(&header[4], OTA_HEADER_VERSION);
+    put16(&header[6], ZB_OTA_HEADER_MIN_SIZE);
+    put16(&header[8], 0);                       /* no optional fields */
+    put16(&header[10], config->manufacturer);
+    put16(&header[12], config->imageType);
+    put32(&header[14], config->fileVersion);
+    put16(&header[18], OTA_STACK_VERSION);
+    strncpy((char *)&header[20], "host OTA image", 32);
+    put32(&header[52], file.size());
+
+    uint8_t *element = header + ZB_OTA_HEADER_MIN_SIZE;
+    put16(&element[0], ZB_OTA_TAG_UPGRADE_IMAGE);
+    put32(&element[2], size);
+    memcpy(&element[ZB_OTA_ELEMENT_HEADER_SIZE], image, size);
+
+    return file;
+}
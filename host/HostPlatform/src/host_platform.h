@@ -0,0 +1,260 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Host control interface for the stand-in platform, used by the native test suites */
+#pragma once
+
+#include <stdint.h>
+
+#include "aps/esp_zigbee_aps.h"
+#include "esp_zigbee_core.h"
+#include "nwk/esp_zigbee_nwk.h"
+
+#ifdef __cplusplus
+#include <functional>
+#include <vector>
+
+/********************* Logging **************************/
+/* Log output is written to stderr while enabled; benchmarks turn it off to time the path rather than the terminal */
+void HOST_SetLogEnabled(bool enabled);
+
+/********************* GPIO **************************/
+/* Drive a simulated input level, firing an attached, enabled interrupt handler inline as the edge occurs */
+void HOST_GpioSetLevel(uint8_t pin, int level);
+int HOST_GpioGetLevel(uint8_t pin);
+
+/********************* FreeRTOS **************************/
+/* Fail the next count timer commands sent from an ISR with pdFAIL, as a full timer command queue would */
+void HOST_TimerFailFromISR(uint32_t count);
+
+/********************* ADC **************************/
+/* Set the voltage on an ADC pin, then complete one continuous mode frame: every configured pin is converted at its
+ * current voltage and the frame callback runs inline, as the DMA interrupt would. False unless the ADC is started.
+ */
+void HOST_AdcSetMillivolts(uint8_t pin, int millivolts);
+bool HOST_AdcConvert();
+
+/********************* System **************************/
+void HOST_SetRestartHook(std::function<void()> hook);
+
+/********************* Zigbee stack **************************/
+/* Run a function on the Zigbee stack task, as the stack would before calling into the application */
+void HOST_ZbPost(std::function<void()> work);
+
+/* Deliver a ZDO/BDB signal to esp_zb_app_signal_handler() on the stack task */
+void HOST_ZbInjectSignal(esp_zb_app_signal_type_t signal, esp_err_t status);
+
+/* As HOST_ZbInjectSignal(), with params for esp_zb_app_signal_get_params(); at most 64 bytes are copied */
+void HOST_ZbInjectSignalParams(esp_zb_app_signal_type_t signal, esp_err_t status, const void *params, size_t size);
+
+/* Invoke the registered core action handler on the stack task; the message must stay valid until it has run */
+void HOST_ZbInvokeAction(esp_zb_core_action_callback_id_t callback_id, const void *message);
+
+/* Invoke the identify notify handler registered for an endpoint on the stack task */
+void HOST_ZbSetIdentify(uint8_t endpoint, bool identifying);
+
+/* Block until every piece of work posted to the stack task so far has run */
+void HOST_ZbSync();
+
+/* Deliver a received APS frame, copied, to the handler registered with esp_zb_aps_data_indication_handler_register()
+ * on the stack task once delayMs has passed. HOST_ZbSync() does not wait for delayed frames.
+ */
+void HOST_ZbInjectApsData(const esp_zb_apsde_data_ind_t *ind, uint32_t delayMs);
+
+/* Observe calls the application makes into the stack */
+void HOST_ZbSetFactoryResetHook(std::function<void()> hook);
+void HOST_ZbSetCommissioningHook(std::function<void(uint8_t modeMask)> hook);
+
+/* Observe APS data requests, e.g. attribute reports; the request and its ASDU are only valid during the call */
+void HOST_ZbSetApsDataHook(std::function<void(const esp_zb_apsde_data_req_t *req)> hook);
+
+/* Values returned by the network getters after a simulated join */
+void HOST_ZbSetNetwork(uint16_t panId, const uint8_t extendedPanId[8], uint8_t channel, uint16_t shortAddress);
+void HOST_ZbSetFactoryNew(bool factoryNew);
+
+/* Channel masks last set with esp_zb_set_primary/secondary_network_channel_set() */
+uint32_t HOST_ZbGetPrimaryChannelMask();
+uint32_t HOST_ZbGetSecondaryChannelMask();
+
+/* Times the application has taken the stack lock with esp_zb_lock_acquire() */
+uint32_t HOST_ZbGetLockCount();
+
+/* Long poll interval, from the keep alive at esp_zb_init() for end devices and then as last set with
+ * esp_zb_zdo_pim_set_long_poll_interval(); changes, if not NULL, counts the calls to it
+ */
+uint32_t HOST_ZbGetLongPollInterval(uint32_t *changes);
+
+/* Role & sizes the application configured before esp_zb_init() */
+typedef struct {
+    esp_zb_nwk_device_type_t role;
+    uint8_t maxChildren;            /* routers only */
+    uint16_t networkSize;           /* neighbor & address table entries */
+    uint16_t ioBufferSize;          /* frame buffers */
+    uint16_t schedulerQueueSize;
+} host_zb_config_t;
+
+void HOST_ZbGetConfig(host_zb_config_t *config);
+
+/* Routing table entries, fixed when the stack library is built */
+#define HOST_ZB_ROUTING_TABLE_SIZE 32
+
+/* Add or update a neighbor by short address; false when the table, or for a child the child limit, is full */
+bool HOST_ZbAddNeighbor(const esp_zb_nwk_neighbor_info_t *neighbor);
+void HOST_ZbClearNetworkTables();
+
+/* Relay frames for another device on the stack task, as a router does. The first frame to a destination without a route
+ * starts a route discovery, which succeeds at once, the oldest route making way when the table is full. Frames arrive
+ * in bursts, and those in a burst beyond the frame buffers fail to allocate and are dropped. Relayed frames, route
+ * discoveries & allocation failures are counted in the Diagnostics cluster attributes, where registered.
+ */
+void HOST_ZbForward(uint16_t destination, uint32_t frames, uint16_t burst);
+
+/********************* Preferences (NVS) **************************/
+/* Erase every namespace, as a fresh flash would be */
+void HOST_PreferencesClear();
+
+/* Number of writes, removes & clears made since the last HOST_PreferencesClear() */
+uint32_t HOST_PreferencesGetWriteCount();
+
+/********************* Flash partitions **************************/
+/* The partitions in partitions.csv share a 4 MB image kept in memory. Once a path is set, the image is loaded from that
+ * file if it exists and every write & erase is written through to it, so flash contents survive the process; with no
+ * path the image lives in memory only.
+ */
+void HOST_FlashSetImagePath(const char *path);
+
+/* Erase the whole image, as a fresh chip would be, and zero the counters below */
+void HOST_FlashErase();
+
+/* Simulate losing power: after this many more bytes are programmed the write in progress stops part way through, and
+ * every later write & erase fails with ESP_FAIL until this is called again. 0 never cuts power.
+ */
+void HOST_FlashSetPowerCut(uint32_t bytes);
+
+typedef struct {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases;
+    uint64_t bytesWritten;
+} host_flash_stats_t;
+
+void HOST_FlashGetStats(host_flash_stats_t *stats);
+
+/* Make each sector erase take this long, as a real chip's does; 0, the default, erases at once */
+void HOST_FlashSetEraseTime(uint32_t ms);
+
+/* Times the sector holding this image address has been erased, for checking wear levelling */
+uint32_t HOST_FlashGetSectorErases(uint32_t address);
+
+/********************* OTA server **************************/
+/* A stand-in OTA Upgrade server on the other end of a simulated link. Starting it takes over the APS data hook: OTA
+ * requests from the device are answered from the file given, after the link latency, and anything else is dropped.
+ */
+typedef struct {
+    uint16_t manufacturer;          /* of the image offered */
+    uint16_t imageType;
+    uint32_t fileVersion;
+    uint16_t shortAddress;          /* the server's, which responses come from */
+    uint8_t endpoint;
+    uint8_t maxBlockSize;           /* most data the server puts in a block, 0 for whatever is asked */
+    uint8_t linkMaxBlockSize;       /* blocks larger than this are lost on the way to the device, 0 for no limit */
+    uint32_t latencyMs;             /* from a request being sent to its response arriving */
+    uint32_t jitterMs;              /* random extra latency per response, which reorders them */
+    uint32_t lossEvery;             /* lose every nth block response, 0 for none */
+    uint32_t waitForDataS;          /* answer the first block request with WAIT_FOR_DATA for this long, 0 for never */
+    uint32_t stopAfterBytes;        /* stop answering block requests once this much has been sent, 0 for never */
+    uint32_t upgradeDelayS;         /* upgrade time given in the Upgrade End Response */
+} host_ota_server_config_t;
+
+typedef struct {
+    uint32_t queries;
+    uint32_t blockRequests;
+    uint32_t blocksSent;
+    uint32_t bytesSent;
+    uint32_t lost;                  /* block responses dropped by lossEvery or linkMaxBlockSize */
+    uint32_t firstRequestOffset;    /* of the first block request since the server started */
+    uint8_t largestRequest;         /* most data asked for in one block request */
+    uint8_t peakInFlight;           /* block requests whose responses had not arrived when the next was made */
+    uint32_t endRequests;
+    uint8_t endStatus;              /* of the last Upgrade End Request */
+} host_ota_server_stats_t;
+
+/* The file is copied; restarting the server resets its stats */
+void HOST_OtaServerStart(const host_ota_server_config_t *config, const uint8_t *file, size_t size);
+void HOST_OtaServerSetConfig(const host_ota_server_config_t *config);
+void HOST_OtaServerStop();
+
+/* Send an Image Notify to the device endpoint */
+void HOST_OtaServerNotify(uint8_t endpoint);
+void HOST_OtaServerGetStats(host_ota_server_stats_t *stats);
+
+/* Build an OTA file around an image: the header for this config, then the image as the upgrade image element */
+std::vector<uint8_t> HOST_OtaBuildFile(const host_ota_server_config_t *config, const uint8_t *image, size_t size);
+
+/********************* Bulk transfer collector **************************/
+/* A stand-in collector pulling bulk transfers off the device over a simulated link. Starting it takes over the APS data
+ * hook: Data frames from the device are reassembled as they arrive and acknowledged, with the offset received up to
+ * and a bitmap of the chunks past it, a round trip later; anything else is dropped.
+ */
+typedef struct {
+    uint16_t shortAddress;          /* the collector's, which requests come from */
+    uint8_t endpoint;
+    uint32_t latencyMs;             /* each way */
+    uint32_t jitterMs;              /* random extra latency per direction, which reorders acknowledgements */
+    uint32_t lossEvery;             /* lose every nth Data frame, 0 for none */
+    uint32_t ackLossEvery;          /* lose every nth acknowledgement, 0 for none */
+    uint8_t ackEvery;               /* acknowledge every nth Data frame taken in, and the last chunk; 0 or 1 for all */
+    uint32_t silentAfterBytes;      /* ignore Data frames once this much has arrived, 0 for never */
+} host_bulk_collector_config_t;
+
+typedef struct {
+    uint32_t requests;
+    bool started;                   /* a Start Response arrived for the last request */
+    uint8_t startStatus;
+    uint8_t transfer;
+    uint32_t size;                  /* of the source */
+    uint8_t chunkSize;
+    uint8_t window;
+    uint32_t chunksReceived;        /* new chunks, across requests */
+    uint32_t bytesReceived;
+    uint32_t duplicates;
+    uint32_t lost;                  /* Data frames dropped by lossEvery */
+    uint32_t ignored;               /* ...by silentAfterBytes */
+    uint32_t malformed;             /* off the chunk grid or past the end of the source */
+    uint32_t acksSent;
+    uint32_t acksLost;
+    bool ended;                     /* a Transfer End arrived for the last request */
+    uint8_t endStatus;
+    uint32_t endOffset;
+} host_bulk_collector_stats_t;
+
+/* Restarting the collector resets its stats and data */
+void HOST_BulkCollectorStart(const host_bulk_collector_config_t *config);
+void HOST_BulkCollectorSetConfig(const host_bulk_collector_config_t *config);
+void HOST_BulkCollectorStop();
+
+/* Ask the device endpoint for a source from offset, with a window of 0 for the device's own. Data gathered by earlier
+ * requests is kept, so a resumed transfer fills in the rest.
+ */
+void HOST_BulkCollectorRequest(uint8_t endpoint, uint8_t source, uint32_t offset, uint8_t window);
+void HOST_BulkCollectorAbort();
+void HOST_BulkCollectorGetStats(host_bulk_collector_stats_t *stats);
+
+/* What has been gathered so far, sized to the source */
+std::vector<uint8_t> HOST_BulkCollectorGetData();
+
+/********************* NeoPixel **************************/
+/* Called from Adafruit_NeoPixel::show() with the rendered framebuffer */
+void HOST_NeoPixelSetShowHook(std::function<void(const uint32_t *pixels, uint16_t count)> hook);
+#endif
@@ -0,0 +1,130 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Preferences.h"
+#include "host_platform.h"
+
+typedef std::map<std::string, std::vector<uint8_t>> host_namespace_t;
+
+static std::mutex &storeMutex = *new std::mutex();
+static std::map<std::string, host_namespace_t> store;
+static uint32_t writeCount = 0;
+
+void HOST_PreferencesClear() {
+    std::lock_guard<std::mutex> lock(storeMutex);
+    store.clear();
+    writeCount = 0;
+}
+
+uint32_t HOST_PreferencesGetWriteCount() {
+    std::lock_guard<std::mutex> lock(storeMutex);
+    return writeCount;
+}
+
+// NVS limits namespace and key names to 15 characters
+bool Preferences::begin(const char *nameSpace, bool isReadOnly, const char *partition_label) {
+    (void)partition_label;
+
+    if (started || !nameSpace || strlen(nameSpace) > 15) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(storeMutex);
+
+    // Like NVS, a namespace that was never written cannot be opened read-only
+    if (isReadOnly && store.find(nameSpace) == store.end()) {
+        return false;
+    }
+
+    strcpy(name, nameSpace);
+    store[name];
+    started = true;
+    readOnly = isReadOnly;
+    return true;
+}
+
+void Preferences::end() {
+    started = false;
+}
+
+bool Preferences::clear() {
+    if (!started || readOnly) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(storeMutex);
+    store[name].clear();
+    writeCount++;
+    return true;
+}
+
+bool Preferences::remove(const char *key) {
+    if (!started || readOnly || !key) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(storeMutex);
+    writeCount++;
+    return store[name].erase(key) != 0;
+}
+
+bool Preferences::isKey(const char *key) {
+    return getBytesLength(key) != 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+    if (!started || readOnly || !key || strlen(key) > 15 || !value || !len) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(storeMutex);
+    store[name][key].assign((const uint8_t *)value, (const uint8_t *)value + len);
+    writeCount++;
+    return len;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    if (!started || !key) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(storeMutex);
+    host_namespace_t &entries = store[name];
+    auto entry = entries.find(key);
+    return entry == entries.end() ? 0 : entry->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+    if (!started || !key || !buf) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(storeMutex);
+    host_namespace_t &entries = store[name];
+    auto entry = entries.find(key);
+
+    if (entry == entries.end() || entry->second.size() > maxLen) {
+        return 0;
+    }
+
+    memcpy(buf, entry->second.data(), entry->second.size());
+    return entry->second.size();
+}
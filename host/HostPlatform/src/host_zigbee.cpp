@@ -0,0 +1,793 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "Arduino.h"
+#include "aps/esp_zigbee_aps.h"
+#include "esp_zigbee_core.h"
+#include "ha/esp_zigbee_ha_standard.h"
+#include "host_platform.h"
+
+/********************* Cluster & attribute lists **************************/
+typedef struct {
+    esp_zb_zcl_attr_t attr;
+    std::vector<uint8_t> value;
+} host_attr_t;
+
+struct esp_zb_attribute_list_s {
+    uint16_t clusterId;
+    uint8_t role;
+    std::vector<host_attr_t *> attrs;
+};
+
+struct esp_zb_cluster_list_s {
+    std::vector<esp_zb_attribute_list_t *> clusters;
+};
+
+typedef struct {
+    esp_zb_endpoint_config_t config;
+    esp_zb_cluster_list_t *clusters;
+} host_endpoint_t;
+
+struct esp_zb_ep_list_s {
+    std::vector<host_endpoint_t> endpoints;
+};
+
+static size_t attrValueSize(uint8_t type, const void *value) {
+    switch (type) {
+        case ESP_ZB_ZCL_ATTR_TYPE_BOOL:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_U8:
+        case ESP_ZB_ZCL_ATTR_TYPE_S8:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM:
+            return 1;
+        case ESP_ZB_ZCL_ATTR_TYPE_16BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_16BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_U16:
+        case ESP_ZB_ZCL_ATTR_TYPE_S16:
+        case ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM:
+            return 2;
+        case ESP_ZB_ZCL_ATTR_TYPE_U24:
+        case ESP_ZB_ZCL_ATTR_TYPE_S24:
+            return 3;
+        case ESP_ZB_ZCL_ATTR_TYPE_32BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_32BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_U32:
+        case ESP_ZB_ZCL_ATTR_TYPE_S32:
+        case ESP_ZB_ZCL_ATTR_TYPE_SINGLE:
+        case ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME:
+            return 4;
+        case ESP_ZB_ZCL_ATTR_TYPE_U48:
+            return 6;
+        case ESP_ZB_ZCL_ATTR_TYPE_U64:
+        case ESP_ZB_ZCL_ATTR_TYPE_S64:
+        case ESP_ZB_ZCL_ATTR_TYPE_DOUBLE:
+        case ESP_ZB_ZCL_ATTR_TYPE_IEEE_ADDR:
+            return 8;
+        case ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING:
+        case ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING:
+            return value ? (size_t)((const uint8_t *)value)[0] + 1 : 1;
+        default:
+            return 0;
+    }
+}
+
+static bool isStringType(uint8_t type) {
+    return type == ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING || type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING;
+}
+
+static host_attr_t *findAttr(esp_zb_attribute_list_t *attrList, uint16_t attrId) {
+    for (host_attr_t *attr : attrList->attrs) {
+        if (attr->attr.id == attrId) {
+            return attr;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t addAttr(esp_zb_attribute_list_t *attrList, uint16_t attrId, uint8_t type, uint8_t access, uint16_t manufCode, const void *value) {
+    if (!attrList) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (findAttr(attrList, attrId)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    host_attr_t *attr = new host_attr_t();
+    attr->attr.id = attrId;
+    attr->attr.type = type;
+    attr->attr.access = access;
+    attr->attr.manuf_code = manufCode;
+
+    // Strings get their maximum length up front so later writes never move the storage
+    attr->value.resize(isStringType(type) ? 256 : (attrValueSize(type, value) ? attrValueSize(type, value) : 1));
+    if (value) {
+        memcpy(attr->value.data(), value, attrValueSize(type, value));
+    }
+    attr->attr.data_p = attr->value.data();
+
+    attrList->attrs.push_back(attr);
+    return ESP_OK;
+}
+
+esp_zb_cluster_list_t *esp_zb_zcl_cluster_list_create(void) {
+    return new esp_zb_cluster_list_t();
+}
+
+esp_zb_attribute_list_t *esp_zb_zcl_attr_list_create(uint16_t cluster_id) {
+    esp_zb_attribute_list_t *attrList = new esp_zb_attribute_list_t();
+    attrList->clusterId = cluster_id;
+    attrList->role = 0;
+    return attrList;
+}
+
+esp_zb_ep_list_t *esp_zb_ep_list_create(void) {
+    return new esp_zb_ep_list_t();
+}
+
+esp_err_t esp_zb_ep_list_add_ep(esp_zb_ep_list_t *ep_list, esp_zb_cluster_list_t *cluster_list, esp_zb_endpoint_config_t endpoint_config) {
+    for (const host_endpoint_t &endpoint : ep_list->endpoints) {
+        if (endpoint.config.endpoint == endpoint_config.endpoint) {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    ep_list->endpoints.push_back({endpoint_config, cluster_list});
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t cluster_id, uint16_t attr_id, uint8_t attr_type,
+                                  uint8_t attr_access, void *value_p) {
+    (void)cluster_id;
+    return addAttr(attr_list, attr_id, attr_type, attr_access, 0xffff, value_p);
+}
+
+esp_err_t esp_zb_custom_cluster_add_custom_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, uint8_t attr_type,
+                                                uint8_t attr_access, void *value_p) {
+    return addAttr(attr_list, attr_id, attr_type, attr_access, 0xffff, value_p);
+}
+
+static esp_err_t addCluster(esp_zb_cluster_list_t *list, esp_zb_attribute_list_t *attrList, uint8_t roleMask) {
+    if (!list || !attrList) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (esp_zb_attribute_list_t *cluster : list->clusters) {
+        if (cluster->clusterId == attrList->clusterId && cluster->role == roleMask) {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    attrList->role = roleMask;
+    list->clusters.push_back(attrList);
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_cluster_list_add_custom_cluster(esp_zb_cluster_list_t *list, esp_zb_attribute_list_t *attr_list, uint8_t role_mask) {
+    return addCluster(list, attr_list, role_mask);
+}
+
+esp_zb_attribute_list_t *esp_zb_basic_cluster_create(esp_zb_basic_cluster_cfg_t *basic_cfg) {
+    esp_zb_attribute_list_t *attrList = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_BASIC);
+    addAttr(attrList, ESP_ZB_ZCL_ATTR_BASIC_ZCL_VERSION_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, 0xffff, &basic_cfg->zcl_version);
+    addAttr(attrList, ESP_ZB_ZCL_ATTR_BASIC_POWER_SOURCE_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, 0xffff, &basic_cfg->power_source);
+    return attrList;
+}
+
+esp_zb_attribute_list_t *esp_zb_identify_cluster_create(esp_zb_identify_cluster_cfg_t *identify_cfg) {
+    esp_zb_attribute_list_t *attrList = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY);
+    addAttr(attrList, ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, 0xffff, &identify_cfg->identify_time);
+    return attrList;
+}
+
+esp_err_t esp_zb_basic_cluster_add_attr(esp_zb_attribute_list_t *attr_list, uint16_t attr_id, void *value_p) {
+    uint8_t type = ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING;
+    switch (attr_id) {
+        case ESP_ZB_ZCL_ATTR_BASIC_APPLICATION_VERSION_ID:
+        case ESP_ZB_ZCL_ATTR_BASIC_STACK_VERSION_ID:
+        case ESP_ZB_ZCL_ATTR_BASIC_HW_VERSION_ID:
+            type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+            break;
+    }
+
+    return addAttr(attr_list, attr_id, type, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, 0xffff, value_p);
+}
+
+esp_err_t esp_zb_cluster_list_add_basic_cluster(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list, uint8_t role_mask) {
+    return addCluster(cluster_list, attr_list, role_mask);
+}
+
+esp_err_t esp_zb_cluster_list_add_identify_cluster(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list, uint8_t role_mask) {
+    return addCluster(cluster_list, attr_list, role_mask);
+}
+
+esp_err_t esp_zb_cluster_list_add_diagnostics_cluster(esp_zb_cluster_list_t *cluster_list, esp_zb_attribute_list_t *attr_list, uint8_t role_mask) {
+    return addCluster(cluster_list, attr_list, role_mask);
+}
+
+/********************* Stack state **************************/
+// A scheduler alarm, or work posted with a delay when cb is NULL
+typedef struct {
+    esp_zb_callback_t cb;
+    uint8_t param;
+    std::function<void()> work;
+} host_alarm_t;
+
+typedef struct {
+    uint32_t signal;
+    uint8_t params[64];
+} host_signal_t;
+
+// Never destroyed: the stack task is still blocked on these when the process exits
+static std::recursive_timed_mutex &stackLock = *new std::recursive_timed_mutex();
+static std::atomic<uint32_t> lockCount(0);
+static std::mutex &workMutex = *new std::mutex();
+static std::condition_variable &workCondition = *new std::condition_variable();
+static std::deque<std::function<void()>> workQueue;
+static std::multimap<int64_t, host_alarm_t> alarms;
+static uint64_t workPosted = 0;
+static uint64_t workCompleted = 0;
+static bool mainLoopRunning = false;
+
+static esp_zb_ep_list_t *registeredEndpoints = NULL;
+static esp_zb_core_action_callback_t actionHandler = NULL;
+static esp_zb_aps_data_indication_callback_t apsIndicationHandler = NULL;
+static std::map<uint8_t, esp_zb_identify_notify_callback_t> identifyHandlers;
+static std::function<void()> factoryResetHook;
+static std::function<void(uint8_t modeMask)> commissioningHook;
+static std::function<void(const esp_zb_apsde_data_req_t *req)> apsDataHook;
+
+static bool factoryNew = true;
+static uint32_t primaryChannelMask = 0;
+static uint32_t secondaryChannelMask = 0;
+static std::atomic<uint32_t> longPollInterval(0);
+static std::atomic<uint32_t> longPollChanges(0);
+static uint16_t panId = 0xffff;
+static esp_zb_ieee_addr_t extendedPanId = {0};
+static uint8_t channel = 0;
+static uint16_t shortAddress = 0xfffe;
+static const esp_zb_ieee_addr_t longAddress = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+
+// Sizes as the stack library defaults them
+static host_zb_config_t config = {ESP_ZB_DEVICE_TYPE_NONE, 0, 64, 80, 80};
+static bool initialised = false;
+static std::vector<esp_zb_nwk_neighbor_info_t> neighbors;
+static std::vector<esp_zb_nwk_route_info_t> routes;
+
+/* Diagnostics cluster counters the stack keeps, U16 */
+#define HOST_ATTR_DIAGNOSTICS_ROUTE_DISC_INITIATED_ID 0x0109
+#define HOST_ATTR_DIAGNOSTICS_PACKET_BUFFER_ALLOCATE_FAILURES_ID 0x0117
+#define HOST_ATTR_DIAGNOSTICS_RELAYED_UCAST_ID 0x0118
+
+void HOST_ZbPost(std::function<void()> work) {
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        workQueue.push_back(work);
+        workPosted++;
+    }
+    workCondition.notify_all();
+}
+
+// Pops and runs one due item under the stack lock, returning false if there was nothing ready
+static bool runNextWork(std::unique_lock<std::mutex> &lock) {
+    std::function<void()> work;
+    bool fromQueue = false;
+
+    if (!alarms.empty() && alarms.begin()->first <= esp_timer_get_time()) {
+        host_alarm_t alarm = alarms.begin()->second;
+        alarms.erase(alarms.begin());
+        if (alarm.cb) {
+            work = [alarm] { alarm.cb(alarm.param); };
+        } else {
+            work = alarm.work;
+        }
+    } else if (!workQueue.empty()) {
+        work = workQueue.front();
+        workQueue.pop_front();
+        fromQueue = true;
+    } else {
+        return false;
+    }
+
+    lock.unlock();
+    {
+        std::lock_guard<std::recursive_timed_mutex> stack(stackLock);
+        work();
+    }
+    lock.lock();
+
+    if (fromQueue) {
+        workCompleted++;
+    }
+    return true;
+}
+
+void esp_zb_stack_main_loop(void) {
+    std::unique_lock<std::mutex> lock(workMutex);
+    mainLoopRunning = true;
+
+    while (true) {
+        if (runNextWork(lock)) {
+            workCondition.notify_all();
+            continue;
+        }
+
+        if (alarms.empty()) {
+            workCondition.wait(lock);
+        } else {
+            workCondition.wait_for(lock, std::chrono::microseconds(alarms.begin()->first - esp_timer_get_time()));
+        }
+    }
+}
+
+void HOST_ZbSync() {
+    std::unique_lock<std::mutex> lock(workMutex);
+    uint64_t target = workPosted;
+
+    if (!mainLoopRunning) {
+        // No stack task yet; drain on the caller so tests can drive the stack synchronously
+        while (!workQueue.empty()) {
+            runNextWork(lock);
+        }
+        return;
+    }
+
+    workCondition.wait(lock, [target] { return workCompleted >= target; });
+}
+
+void HOST_ZbInjectSignal(esp_zb_app_signal_type_t signal, esp_err_t status) {
+    HOST_ZbPost([signal, status] {
+        host_signal_t data = {};
+        data.signal = signal;
+        esp_zb_app_signal_t appSignal = {&data.signal, status};
+        esp_zb_app_signal_handler(&appSignal);
+    });
+}
+
+void HOST_ZbInjectSignalParams(esp_zb_app_signal_type_t signal, esp_err_t status, const void *params, size_t size) {
+    host_signal_t data = {};
+    data.signal = signal;
+    memcpy(data.params, params, std::min(size, sizeof(data.params)));
+
+    HOST_ZbPost([data, status]() mutable {
+        esp_zb_app_signal_t appSignal = {&data.signal, status};
+        esp_zb_app_signal_handler(&appSignal);
+    });
+}
+
+void HOST_ZbInvokeAction(esp_zb_core_action_callback_id_t callback_id, const void *message) {
+    HOST_ZbPost([callback_id, message] {
+        if (actionHandler) {
+            actionHandler(callback_id, message);
+        }
+    });
+}
+
+void HOST_ZbInjectApsData(const esp_zb_apsde_data_ind_t *ind, uint32_t delayMs) {
+    esp_zb_apsde_data_ind_t copy = *ind;
+    std::vector<uint8_t> asdu(ind->asdu, ind->asdu + ind->asdu_length);
+
+    std::function<void()> work = [copy, asdu]() mutable {
+        copy.asdu = asdu.data();
+        if (apsIndicationHandler) {
+            apsIndicationHandler(copy);
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        alarms.insert({esp_timer_get_time() + (int64_t)delayMs * 1000, {NULL, 0, work}});
+    }
+    workCondition.notify_all();
+}
+
+void HOST_ZbSetIdentify(uint8_t endpoint, bool identifying) {
+    HOST_ZbPost([endpoint, identifying] {
+        auto handler = identifyHandlers.find(endpoint);
+        if (handler != identifyHandlers.end()) {
+            handler->second(identifying ? 1 : 0);
+        }
+    });
+}
+
+void HOST_ZbSetFactoryResetHook(std::function<void()> hook) {
+    factoryResetHook = hook;
+}
+
+void HOST_ZbSetCommissioningHook(std::function<void(uint8_t modeMask)> hook) {
+    commissioningHook = hook;
+}
+
+void HOST_ZbSetApsDataHook(std::function<void(const esp_zb_apsde_data_req_t *req)> hook) {
+    apsDataHook = hook;
+}
+
+void HOST_ZbSetNetwork(uint16_t newPanId, const uint8_t newExtendedPanId[8], uint8_t newChannel, uint16_t newShortAddress) {
+    panId = newPanId;
+    memcpy(extendedPanId, newExtendedPanId, sizeof(extendedPanId));
+    channel = newChannel;
+    shortAddress = newShortAddress;
+}
+
+void HOST_ZbSetFactoryNew(bool isFactoryNew) {
+    factoryNew = isFactoryNew;
+}
+
+uint32_t HOST_ZbGetPrimaryChannelMask() {
+    return primaryChannelMask;
+}
+
+uint32_t HOST_ZbGetSecondaryChannelMask() {
+    return secondaryChannelMask;
+}
+
+uint32_t HOST_ZbGetLockCount() {
+    return lockCount.load();
+}
+
+uint32_t HOST_ZbGetLongPollInterval(uint32_t *changes) {
+    if (changes != NULL) {
+        *changes = longPollChanges.load();
+    }
+    return longPollInterval.load();
+}
+
+void HOST_ZbGetConfig(host_zb_config_t *current) {
+    *current = config;
+}
+
+bool HOST_ZbAddNeighbor(const esp_zb_nwk_neighbor_info_t *neighbor) {
+    std::lock_guard<std::recursive_timed_mutex> lock(stackLock);
+    size_t children = 0;
+
+    for (esp_zb_nwk_neighbor_info_t &entry : neighbors) {
+        if (entry.short_addr == neighbor->short_addr) {
+            entry = *neighbor;
+            return true;
+        }
+        children += entry.relationship == ESP_ZB_NWK_RELATIONSHIP_CHILD;
+    }
+
+    if (neighbors.size() >= config.networkSize || (neighbor->relationship == ESP_ZB_NWK_RELATIONSHIP_CHILD && children >= config.maxChildren)) {
+        return false;
+    }
+
+    neighbors.push_back(*neighbor);
+    return true;
+}
+
+void HOST_ZbClearNetworkTables() {
+    std::lock_guard<std::recursive_timed_mutex> lock(stackLock);
+    neighbors.clear();
+    routes.clear();
+}
+
+// Add to a 16-bit counter of the Diagnostics cluster on whichever endpoint carries it, wrapping as the stack's do
+static void countDiagnostic(uint16_t attrId, uint32_t count) {
+    if (!registeredEndpoints || count == 0) {
+        return;
+    }
+
+    for (const host_endpoint_t &ep : registeredEndpoints->endpoints) {
+        for (esp_zb_attribute_list_t *cluster : ep.clusters->clusters) {
+            host_attr_t *attr = cluster->clusterId == ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS ? findAttr(cluster, attrId) : NULL;
+            if (attr && attr->attr.type == ESP_ZB_ZCL_ATTR_TYPE_U16) {
+                uint16_t value;
+                memcpy(&value, attr->attr.data_p, sizeof(value));
+                value = (uint16_t)(value + count);
+                memcpy(attr->attr.data_p, &value, sizeof(value));
+            }
+        }
+    }
+}
+
+void HOST_ZbForward(uint16_t destination, uint32_t frames, uint16_t burst) {
+    HOST_ZbPost([destination, frames, burst]() {
+        bool routed = false;
+        for (const esp_zb_nwk_route_info_t &route : routes) {
+            routed |= route.dest_addr == destination;
+        }
+
+        if (!routed) {
+            if (routes.size() >= HOST_ZB_ROUTING_TABLE_SIZE) {
+                routes.erase(routes.begin());
+            }
+
+            esp_zb_nwk_route_info_t route = {};
+            route.dest_addr = destination;
+            route.next_hop_addr = destination;
+            route.flags.status = ESP_ZB_NWK_ROUTE_STATE_ACTIVE;
+            routes.push_back(route);
+            countDiagnostic(HOST_ATTR_DIAGNOSTICS_ROUTE_DISC_INITIATED_ID, 1);
+        }
+
+        uint32_t step = burst ? burst : 1;
+        uint32_t relayed = 0;
+        uint32_t failed = 0;
+        for (uint32_t sent = 0; sent < frames; sent += step) {
+            uint32_t arriving = std::min<uint32_t>(step, frames - sent);
+            uint32_t allocated = std::min<uint32_t>(arriving, config.ioBufferSize);
+            relayed += allocated;
+            failed += arriving - allocated;
+        }
+
+        countDiagnostic(HOST_ATTR_DIAGNOSTICS_RELAYED_UCAST_ID, relayed);
+        countDiagnostic(HOST_ATTR_DIAGNOSTICS_PACKET_BUFFER_ALLOCATE_FAILURES_ID, failed);
+    });
+}
+
+/********************* Stack API **************************/
+esp_err_t esp_zb_platform_config(esp_zb_platform_config_t *config) {
+    (void)config;
+    return ESP_OK;
+}
+
+void esp_zb_set_trace_level_mask(uint32_t trace_level, uint32_t trace_mask) {
+    (void)trace_level;
+    (void)trace_mask;
+}
+
+esp_err_t esp_zb_overall_network_size_set(uint16_t size) {
+    if (initialised) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    config.networkSize = size;
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_io_buffer_size_set(uint16_t size) {
+    if (initialised) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    config.ioBufferSize = size;
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_scheduler_queue_size_set(uint16_t size) {
+    if (initialised) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    config.schedulerQueueSize = size;
+    return ESP_OK;
+}
+
+void esp_zb_init(esp_zb_cfg_t *nwk_cfg) {
+    config.role = nwk_cfg->esp_zb_role;
+    config.maxChildren = nwk_cfg->esp_zb_role == ESP_ZB_DEVICE_TYPE_ED ? 0 : nwk_cfg->nwk_cfg.zczr_cfg.max_children;
+    longPollInterval = nwk_cfg->esp_zb_role == ESP_ZB_DEVICE_TYPE_ED ? nwk_cfg->nwk_cfg.zed_cfg.keep_alive : 0;
+    initialised = true;
+}
+
+esp_err_t esp_zb_device_register(esp_zb_ep_list_t *ep_list) {
+    registeredEndpoints = ep_list;
+    return ESP_OK;
+}
+
+void esp_zb_core_action_handler_register(esp_zb_core_action_callback_t cb) {
+    actionHandler = cb;
+}
+
+void esp_zb_identify_notify_handler_register(uint8_t endpoint, esp_zb_identify_notify_callback_t cb) {
+    identifyHandlers[endpoint] = cb;
+}
+
+void esp_zb_zdo_pim_set_long_poll_interval(uint32_t ms) {
+    longPollInterval = ms;
+    longPollChanges++;
+}
+
+esp_err_t esp_zb_set_primary_network_channel_set(uint32_t channel_mask) {
+    primaryChannelMask = channel_mask;
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_set_secondary_network_channel_set(uint32_t channel_mask) {
+    secondaryChannelMask = channel_mask;
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_start(bool autostart) {
+    if (!autostart) {
+        HOST_ZbInjectSignal(ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP, ESP_OK);
+    }
+    return ESP_OK;
+}
+
+void esp_zb_factory_reset(void) {
+    factoryNew = true;
+    if (factoryResetHook) {
+        factoryResetHook();
+    }
+}
+
+esp_err_t esp_zb_bdb_start_top_level_commissioning(uint8_t mode_mask) {
+    if (commissioningHook) {
+        commissioningHook(mode_mask);
+        return ESP_OK;
+    }
+
+    // Default behaviour: initialisation and steering both succeed on the next stack iteration
+    if (mode_mask == ESP_ZB_BDB_MODE_INITIALIZATION) {
+        HOST_ZbInjectSignal(factoryNew ? ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START : ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT, ESP_OK);
+    } else if (mode_mask & ESP_ZB_BDB_MODE_NETWORK_STEERING) {
+        factoryNew = false;
+        HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_STEERING, ESP_OK);
+    }
+    return ESP_OK;
+}
+
+bool esp_zb_bdb_is_factory_new(void) {
+    return factoryNew;
+}
+
+// The host has no network to lose: once commissioned, the device stays joined
+bool esp_zb_bdb_dev_joined(void) {
+    return !factoryNew;
+}
+
+void esp_zb_scheduler_alarm(esp_zb_callback_t cb, uint8_t param, uint32_t time) {
+    {
+        std::lock_guard<std::mutex> lock(workMutex);
+        alarms.insert({esp_timer_get_time() + (int64_t)time * 1000, {cb, param, {}}});
+    }
+    workCondition.notify_all();
+}
+
+void esp_zb_scheduler_alarm_cancel(esp_zb_callback_t cb, uint8_t param) {
+    std::lock_guard<std::mutex> lock(workMutex);
+    for (auto alarm = alarms.begin(); alarm != alarms.end();) {
+        if (alarm->second.cb == cb && alarm->second.param == param) {
+            alarm = alarms.erase(alarm);
+        } else {
+            ++alarm;
+        }
+    }
+}
+
+esp_err_t esp_zb_aps_data_request(esp_zb_apsde_data_req_t *req) {
+    if (!req || (req->asdu_length && !req->asdu)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (apsDataHook) {
+        apsDataHook(req);
+    }
+    return ESP_OK;
+}
+
+void esp_zb_aps_data_indication_handler_register(esp_zb_aps_data_indication_callback_t cb) {
+    apsIndicationHandler = cb;
+}
+
+const char *esp_zb_zdo_signal_to_string(esp_zb_app_signal_type_t signal) {
+    switch (signal) {
+        case ESP_ZB_ZDO_SIGNAL_DEFAULT_START: return "ZDO_SIGNAL_DEFAULT_START";
+        case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP: return "ZDO_SIGNAL_SKIP_STARTUP";
+        case ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE: return "ZDO_SIGNAL_DEVICE_ANNCE";
+        case ESP_ZB_ZDO_SIGNAL_LEAVE: return "ZDO_SIGNAL_LEAVE";
+        case ESP_ZB_ZDO_SIGNAL_ERROR: return "ZDO_SIGNAL_ERROR";
+        case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START: return "BDB_SIGNAL_DEVICE_FIRST_START";
+        case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT: return "BDB_SIGNAL_DEVICE_REBOOT";
+        case ESP_ZB_BDB_SIGNAL_STEERING: return "BDB_SIGNAL_STEERING";
+        case ESP_ZB_BDB_SIGNAL_FORMATION: return "BDB_SIGNAL_FORMATION";
+        case ESP_ZB_ZDO_SIGNAL_LEAVE_INDICATION: return "ZDO_SIGNAL_LEAVE_INDICATION";
+        case ESP_ZB_COMMON_SIGNAL_CAN_SLEEP: return "COMMON_SIGNAL_CAN_SLEEP";
+        case ESP_ZB_ZDO_SIGNAL_PRODUCTION_CONFIG_READY: return "ZDO_SIGNAL_PRODUCTION_CONFIG_READY";
+        case ESP_ZB_NWK_SIGNAL_NO_ACTIVE_LINKS_LEFT: return "NWK_SIGNAL_NO_ACTIVE_LINKS_LEFT";
+        case ESP_ZB_NLME_STATUS_INDICATION: return "NLME_STATUS_INDICATION";
+        case ESP_ZB_BDB_SIGNAL_TC_REJOIN_DONE: return "BDB_SIGNAL_TC_REJOIN_DONE";
+        case ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS: return "NWK_SIGNAL_PERMIT_JOIN_STATUS";
+        case ESP_ZB_ZDO_DEVICE_UNAVAILABLE: return "ZDO_DEVICE_UNAVAILABLE";
+        default: return "UNKNOWN_SIGNAL";
+    }
+}
+
+void *esp_zb_app_signal_get_params(uint32_t *signal_p) {
+    return ((host_signal_t *)signal_p)->params;
+}
+
+void esp_zb_get_extended_pan_id(esp_zb_ieee_addr_t ext_pan_id) {
+    memcpy(ext_pan_id, extendedPanId, sizeof(esp_zb_ieee_addr_t));
+}
+
+uint16_t esp_zb_get_pan_id(void) {
+    return panId;
+}
+
+uint8_t esp_zb_get_current_channel(void) {
+    return channel;
+}
+
+uint16_t esp_zb_get_short_address(void) {
+    return shortAddress;
+}
+
+void esp_zb_get_long_address(esp_zb_ieee_addr_t addr) {
+    memcpy(addr, longAddress, sizeof(esp_zb_ieee_addr_t));
+}
+
+bool esp_zb_lock_acquire(TickType_t block_ticks) {
+    lockCount++;
+
+    if (block_ticks == portMAX_DELAY) {
+        stackLock.lock();
+        return true;
+    }
+
+    return stackLock.try_lock_for(std::chrono::milliseconds(pdTICKS_TO_MS(block_ticks)));
+}
+
+void esp_zb_lock_release(void) {
+    stackLock.unlock();
+}
+
+esp_zb_zcl_attr_t *esp_zb_zcl_get_attribute(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role, uint16_t attr_id) {
+    if (!registeredEndpoints) {
+        return NULL;
+    }
+
+    for (const host_endpoint_t &ep : registeredEndpoints->endpoints) {
+        if (ep.config.endpoint != endpoint) {
+            continue;
+        }
+
+        for (esp_zb_attribute_list_t *cluster : ep.clusters->clusters) {
+            if (cluster->clusterId == cluster_id && (cluster->role & cluster_role)) {
+                host_attr_t *attr = findAttr(cluster, attr_id);
+                return attr ? &attr->attr : NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+esp_zb_zcl_status_t esp_zb_zcl_set_attribute_val(uint8_t endpoint, uint16_t cluster_id, uint8_t cluster_role, uint16_t attr_id,
+                                                 void *value_p, bool check) {
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(endpoint, cluster_id, cluster_role, attr_id);
+
+    if (!attr) {
+        return ESP_ZB_ZCL_STATUS_UNSUP_ATTRIB;
+    }
+    if (check && !(attr->access & ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY)) {
+        return ESP_ZB_ZCL_STATUS_READ_ONLY;
+    }
+
+    memcpy(attr->data_p, value_p, attrValueSize(attr->type, value_p));
+    return ESP_ZB_ZCL_STATUS_SUCCESS;
+}
+
+esp_err_t esp_zb_nwk_get_next_neighbor(esp_zb_nwk_info_iterator_t *iterator, esp_zb_nwk_neighbor_info_t *nbr_info) {
+    if (*iterator >= neighbors.size()) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *nbr_info = neighbors[(*iterator)++];
+    return ESP_OK;
+}
+
+esp_err_t esp_zb_nwk_get_next_route(esp_zb_nwk_info_iterator_t *iterator, esp_zb_nwk_route_info_t *route_info) {
+    if (*iterator >= routes.size()) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *route_info = routes[(*iterator)++];
+    return ESP_OK;
+}
@@ -0,0 +1,78 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Host stand-in for nwk/esp_zigbee_nwk.h */
+#pragma once
+
+#include "esp_zigbee_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t esp_zb_nwk_info_iterator_t;
+
+#define ESP_ZB_NWK_INFO_ITERATOR_INIT 0
+
+typedef enum {
+    ESP_ZB_NWK_RELATIONSHIP_PARENT = 0,
+    ESP_ZB_NWK_RELATIONSHIP_CHILD = 1,
+    ESP_ZB_NWK_RELATIONSHIP_SIBLING = 2,
+    ESP_ZB_NWK_RELATIONSHIP_NONE_OF_THE_ABOVE = 3,
+    ESP_ZB_NWK_RELATIONSHIP_PREVIOUS_CHILD = 4,
+    ESP_ZB_NWK_RELATIONSHIP_UNAUTHENTICATED_CHILD = 5,
+} esp_zb_nwk_relationship_t;
+
+typedef enum {
+    ESP_ZB_NWK_ROUTE_STATE_ACTIVE = 0,
+    ESP_ZB_NWK_ROUTE_STATE_DISCOVERY_UNDERWAY = 1,
+    ESP_ZB_NWK_ROUTE_STATE_DISCOVERY_FAILED = 2,
+    ESP_ZB_NWK_ROUTE_STATE_INACTIVE = 3,
+} esp_zb_nwk_route_state_t;
+
+typedef struct {
+    esp_zb_ieee_addr_t ieee_addr;
+    uint16_t short_addr;
+    uint8_t device_type;
+    uint8_t depth;
+    uint8_t rx_on_when_idle;
+    uint8_t relationship;
+    uint8_t lqi;
+    int8_t rssi;
+    uint8_t outgoing_cost;
+    uint8_t age;
+    uint32_t device_timeout;
+    uint32_t timeout_counter;
+} esp_zb_nwk_neighbor_info_t;
+
+typedef struct {
+    uint16_t dest_addr;
+    uint16_t next_hop_addr;
+    struct {
+        uint8_t status : 3;
+        uint8_t memory_constrained : 1;
+        uint8_t many_to_one : 1;
+        uint8_t route_record_required : 1;
+        uint8_t reserved : 2;
+    } flags;
+    uint8_t expiry;
+} esp_zb_nwk_route_info_t;
+
+/* Walk the neighbor & routing tables; ESP_ERR_NOT_FOUND past the last entry. Call with the stack lock held. */
+esp_err_t esp_zb_nwk_get_next_neighbor(esp_zb_nwk_info_iterator_t *iterator, esp_zb_nwk_neighbor_info_t *nbr_info);
+esp_err_t esp_zb_nwk_get_next_route(esp_zb_nwk_info_iterator_t *iterator, esp_zb_nwk_route_info_t *route_info);
+
+#ifdef __cplusplus
+}
+#endif
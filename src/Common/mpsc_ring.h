@@ -0,0 +1,110 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Fixed-capacity multi-producer/single-consumer ring buffer
+ * Lock-free: producers claim a slot by advancing head with a compare-and-swap, and each slot carries a sequence number
+ * that tells the consumer when its record is complete, so a producer preempted mid-write holds up only the reader,
+ * never another writer. Like SpscRing, slots are filled and drained in place.
+ */
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, size_t Capacity>
+class MpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "MpscRing capacity must be a power of two");
+
+public:
+    MpscRing() {
+        for (size_t i = 0; i < Capacity; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /* Producer: claim a slot to fill, or NULL if the ring is full; pass position on to commitWrite() */
+    T *acquireWrite(size_t *position) {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        for (;;) {
+            Cell *cell = &cells_[head & (Capacity - 1)];
+            intptr_t lag = (intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)head;
+
+            if (lag == 0) {
+                if (head_.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                    *position = head;
+                    return &cell->value;
+                }
+            } else if (lag < 0) {
+                return NULL;
+            } else {
+                head = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /* Producer: publish the slot claimed at position */
+    void commitWrite(size_t position) {
+        cells_[position & (Capacity - 1)].sequence.store(position + 1, std::memory_order_release);
+    }
+
+    /* Consumer: oldest published slot, or NULL if the ring is empty or its oldest slot is still being written */
+    T *peekRead() {
+        Cell *cell = &cells_[tail_ & (Capacity - 1)];
+        if (cell->sequence.load(std::memory_order_acquire) != tail_ + 1) {
+            return NULL;
+        }
+        return &cell->value;
+    }
+
+    /* Consumer: hand the slot returned by peekRead() back to the producers */
+    void releaseRead() {
+        cells_[tail_ & (Capacity - 1)].sequence.store(tail_ + Capacity, std::memory_order_release);
+        tail_++;
+    }
+
+    bool push(const T &item) {
+        size_t position;
+        T *slot = acquireWrite(&position);
+        if (slot == NULL) {
+            return false;
+        }
+        *slot = item;
+        commitWrite(position);
+        return true;
+    }
+
+    bool pop(T *item) {
+        T *slot = peekRead();
+        if (slot == NULL) {
+            return false;
+        }
+        *item = *slot;
+        releaseRead();
+        return true;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell cells_[Capacity];
+    std::atomic<size_t> head_{0};
+    size_t tail_ = 0;
+};
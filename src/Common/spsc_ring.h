@@ -0,0 +1,89 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Fixed-capacity single-producer/single-consumer ring buffer
+ * Lock-free: the producer only writes head and the consumer only writes tail, so neither side ever blocks the other.
+ * Slots are filled and drained in place, which lets large records be built directly in the ring without an extra copy.
+ */
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    /* Producer: slot to fill, or NULL if the ring is full */
+    T *acquireWrite() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= Capacity) {
+            return NULL;
+        }
+        return &slots_[head & (Capacity - 1)];
+    }
+
+    /* Producer: publish the slot returned by acquireWrite() */
+    void commitWrite() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /* Consumer: oldest published slot, or NULL if the ring is empty */
+    T *peekRead() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        return &slots_[tail & (Capacity - 1)];
+    }
+
+    /* Consumer: hand the slot returned by peekRead() back to the producer */
+    void releaseRead() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool push(const T &item) {
+        T *slot = acquireWrite();
+        if (slot == NULL) {
+            return false;
+        }
+        *slot = item;
+        commitWrite();
+        return true;
+    }
+
+    bool pop(T *item) {
+        T *slot = peekRead();
+        if (slot == NULL) {
+            return false;
+        }
+        *item = *slot;
+        releaseRead();
+        return true;
+    }
+
+    /* Approximate when called from a third task; exact from either end */
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    T slots_[Capacity];
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+};
@@ -0,0 +1,138 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <Adafruit_NeoPixel.h>
+
+#include "Led/led.h"
+#include "Memory/memory_pool.h"
+
+typedef struct {
+    led_effect_t effect;
+    uint32_t startMs;
+    bool active;
+} led_slot_state_t;
+
+static Adafruit_NeoPixel rgbLed(LED_PIXEL_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
+static TaskHandle_t ledTask = NULL;
+static portMUX_TYPE ledMux = portMUX_INITIALIZER_UNLOCKED;
+static led_slot_state_t ledSlots[LED_SLOT_COUNT];
+static led_stats_t ledStats;
+
+// Pick the effect to show, expiring any whose duration has run out. Call with ledMux held
+static const led_slot_state_t *currentSlot(uint32_t now) {
+    for (int i = LED_SLOT_COUNT - 1; i >= 0; i--) {
+        led_slot_state_t *slot = &ledSlots[i];
+
+        if (slot->active && slot->effect.durationMs && now - slot->startMs >= slot->effect.durationMs) {
+            slot->active = false;
+        }
+        if (slot->active) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+static void taskLedEffects(void *arg) {
+    static const led_effect_t offEffect = {LED_EFFECT_OFF, 0, 0, 0, 0};
+    uint32_t frame[LED_PIXEL_COUNT];
+    uint32_t shownFrame[LED_PIXEL_COUNT];
+    bool shown = false;
+
+    for (;;) {
+        uint32_t now = millis();
+        led_effect_t effect = offEffect;
+        uint32_t startMs = now;
+
+        portENTER_CRITICAL(&ledMux);
+        const led_slot_state_t *slot = currentSlot(now);
+        if (slot) {
+            effect = slot->effect;
+            startMs = slot->startMs;
+        }
+        portEXIT_CRITICAL(&ledMux);
+
+        uint32_t elapsed = now - startMs;
+        uint32_t delayMs = LED_RenderEffect(&effect, elapsed, frame, LED_PIXEL_COUNT);
+
+        // Wake in time to drop an effect that is about to expire
+        if (effect.durationMs && effect.durationMs - elapsed < delayMs) {
+            delayMs = effect.durationMs - elapsed;
+        }
+
+        // Only latch the strip when the frame differs, a static effect costs nothing after its first frame
+        bool changed = !shown || memcmp(frame, shownFrame, sizeof(frame)) != 0;
+        if (changed) {
+            for (uint16_t i = 0; i < LED_PIXEL_COUNT; i++) {
+                rgbLed.setPixelColor(i, frame[i]);
+            }
+            rgbLed.show();
+
+            memcpy(shownFrame, frame, sizeof(frame));
+            shown = true;
+        }
+
+        portENTER_CRITICAL(&ledMux);
+        ledStats.renders++;
+        ledStats.frames += changed;
+        portEXIT_CRITICAL(&ledMux);
+
+        // Sleep until the next frame is due, or until LED_SetEffect() changes what is shown
+        TickType_t ticks = portMAX_DELAY;
+        if (delayMs != LED_FRAME_NEVER) {
+            ticks = pdMS_TO_TICKS(delayMs);
+            ticks = ticks ? ticks : 1;
+        }
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+
+void LED_Init() {
+    rgbLed.begin();
+    rgbLed.setBrightness(LED_BRIGHTNESS);
+    rgbLed.clear();
+    rgbLed.show();
+
+    ledTask = MEM_CreateTask(taskLedEffects, LED_TASK_NAME, LED_TASK_STACK_SIZE, NULL, LED_TASK_PRIORITY);
+}
+
+void LED_SetEffect(led_slot_t slot, const led_effect_t *effect) {
+    if (slot >= LED_SLOT_COUNT) {
+        return;
+    }
+
+    portENTER_CRITICAL(&ledMux);
+    if (effect) {
+        ledSlots[slot].effect = *effect;
+        ledSlots[slot].startMs = millis();
+    }
+    ledSlots[slot].active = effect != NULL;
+    portEXIT_CRITICAL(&ledMux);
+
+    if (ledTask) {
+        xTaskNotifyGive(ledTask);
+    }
+}
+
+void LED_ClearEffect(led_slot_t slot) {
+    LED_SetEffect(slot, NULL);
+}
+
+void LED_GetStats(led_stats_t *stats) {
+    portENTER_CRITICAL(&ledMux);
+    *stats = ledStats;
+    portEXIT_CRITICAL(&ledMux);
+}
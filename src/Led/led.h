@@ -0,0 +1,49 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "Led/led_effects.h"
+
+// Onboard WS2812 LED
+#define LED_PIN GPIO_NUM_8
+#define LED_PIXEL_COUNT 1
+#define LED_BRIGHTNESS 64
+
+#define LED_TASK_NAME "LED_effects"
+#define LED_TASK_STACK_SIZE 2048
+#define LED_TASK_PRIORITY 2
+
+/* Each slot holds one effect, the highest slot with an active effect is the one shown */
+typedef enum {
+    LED_SLOT_STATUS,            /* background device state, e.g. commissioning */
+    LED_SLOT_IDENTIFY,          /* Zigbee identify, shown over the status */
+    LED_SLOT_COUNT,
+} led_slot_t;
+
+/* Start the LED task; it sleeps between frames and wakes only when an effect changes or its next frame is due */
+void LED_Init();
+
+/* Show an effect in a slot, replacing what was there; NULL clears the slot. Safe to call from any task */
+void LED_SetEffect(led_slot_t slot, const led_effect_t *effect);
+void LED_ClearEffect(led_slot_t slot);
+
+typedef struct {
+    uint32_t renders;           /* frames rendered, including ones identical to the last */
+    uint32_t frames;            /* frames pushed out to the LED */
+} led_stats_t;
+
+void LED_GetStats(led_stats_t *stats);
@@ -0,0 +1,196 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Led/led_effects.h"
+
+// Precomputed tables, generated offline and kept in flash
+
+// out = round((in / 255) ^ 2.6 * 255), the same curve as Adafruit_NeoPixel::gamma8()
+static const uint8_t gammaTable[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,   1,   1,   1,   1,
+      1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,
+      3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   5,   6,   6,   6,   6,   7,
+      7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  10,  11,  11,  11,  12,  12,
+     13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,  20,
+     20,  21,  21,  22,  22,  23,  24,  24,  25,  25,  26,  27,  27,  28,  29,  29,
+     30,  31,  31,  32,  33,  34,  34,  35,  36,  37,  38,  38,  39,  40,  41,  42,
+     42,  43,  44,  45,  46,  47,  48,  49,  50,  51,  52,  53,  54,  55,  56,  57,
+     58,  59,  60,  61,  62,  63,  64,  65,  66,  68,  69,  70,  71,  72,  73,  75,
+     76,  77,  78,  80,  81,  82,  84,  85,  86,  88,  89,  90,  92,  93,  94,  96,
+     97,  99, 100, 102, 103, 105, 106, 108, 109, 111, 112, 114, 115, 117, 119, 120,
+    122, 124, 125, 127, 129, 130, 132, 134, 136, 137, 139, 141, 143, 145, 146, 148,
+    150, 152, 154, 156, 158, 160, 162, 164, 166, 168, 170, 172, 174, 176, 178, 180,
+    182, 184, 186, 188, 191, 193, 195, 197, 199, 202, 204, 206, 209, 211, 213, 215,
+    218, 220, 223, 225, 227, 230, 232, 235, 237, 240, 242, 245, 247, 250, 252, 255,
+};
+
+// Breathe brightness over one cycle, (1 - cos(2 * pi * i / 256)) / 2 scaled to 0-255; gamma is applied afterwards
+static const uint8_t breatheTable[256] = {
+      0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
+     10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
+     37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,  70,  73,  76,
+     79,  82,  85,  88,  90,  93,  97, 100, 103, 106, 109, 112, 115, 118, 121, 124,
+    127, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+    176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+    218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+    245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+    255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+    245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+    218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+    176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+    128, 124, 121, 118, 115, 112, 109, 106, 103, 100,  97,  93,  90,  88,  85,  82,
+     79,  76,  73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,
+     37,  35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+     10,   9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,   0,
+};
+
+// Fully saturated colour wheel, red -> green -> blue -> red over 256 steps, already gamma corrected (0xRRGGBB)
+static const uint32_t hueTable[256] = {
+    0xff0000, 0xff0000, 0xff0000, 0xff0000, 0xff0100, 0xff0100, 0xff0200, 0xff0200,
+    0xff0300, 0xff0500, 0xff0600, 0xff0800, 0xff0a00, 0xff0c00, 0xff0e00, 0xff1100,
+    0xff1400, 0xff1800, 0xff1b00, 0xff1f00, 0xff2400, 0xff2900, 0xff2d00, 0xff3300,
+    0xff3900, 0xff3f00, 0xff4600, 0xff4d00, 0xff5500, 0xff5d00, 0xff6600, 0xff6f00,
+    0xff7800, 0xff8200, 0xff8d00, 0xff9800, 0xffa400, 0xffb000, 0xffbc00, 0xffca00,
+    0xffd700, 0xffe600, 0xfff500, 0xfaff00, 0xebff00, 0xdcff00, 0xceff00, 0xc1ff00,
+    0xb4ff00, 0xa8ff00, 0x9cff00, 0x91ff00, 0x86ff00, 0x7cff00, 0x72ff00, 0x69ff00,
+    0x60ff00, 0x58ff00, 0x50ff00, 0x48ff00, 0x41ff00, 0x3bff00, 0x35ff00, 0x2fff00,
+    0x2aff00, 0x26ff00, 0x21ff00, 0x1dff00, 0x19ff00, 0x15ff00, 0x12ff00, 0x0fff00,
+    0x0dff00, 0x0aff00, 0x08ff00, 0x06ff00, 0x05ff00, 0x04ff00, 0x03ff00, 0x02ff00,
+    0x01ff00, 0x01ff00, 0x00ff00, 0x00ff00, 0x00ff00, 0x00ff00, 0x00ff00, 0x00ff00,
+    0x00ff00, 0x00ff00, 0x00ff01, 0x00ff01, 0x00ff02, 0x00ff03, 0x00ff04, 0x00ff05,
+    0x00ff07, 0x00ff09, 0x00ff0b, 0x00ff0d, 0x00ff10, 0x00ff13, 0x00ff16, 0x00ff1a,
+    0x00ff1e, 0x00ff22, 0x00ff27, 0x00ff2b, 0x00ff31, 0x00ff37, 0x00ff3d, 0x00ff44,
+    0x00ff4b, 0x00ff52, 0x00ff5a, 0x00ff63, 0x00ff6c, 0x00ff75, 0x00ff7f, 0x00ff89,
+    0x00ff94, 0x00ffa0, 0x00ffac, 0x00ffb8, 0x00ffc5, 0x00ffd3, 0x00ffe1, 0x00fff0,
+    0x00ffff, 0x00f0ff, 0x00e1ff, 0x00d3ff, 0x00c5ff, 0x00b8ff, 0x00acff, 0x00a0ff,
+    0x0094ff, 0x0089ff, 0x007fff, 0x0075ff, 0x006cff, 0x0063ff, 0x005aff, 0x0052ff,
+    0x004bff, 0x0044ff, 0x003dff, 0x0037ff, 0x0031ff, 0x002bff, 0x0027ff, 0x0022ff,
+    0x001eff, 0x001aff, 0x0016ff, 0x0013ff, 0x0010ff, 0x000dff, 0x000bff, 0x0009ff,
+    0x0007ff, 0x0005ff, 0x0004ff, 0x0003ff, 0x0002ff, 0x0001ff, 0x0001ff, 0x0000ff,
+    0x0000ff, 0x0000ff, 0x0000ff, 0x0000ff, 0x0000ff, 0x0000ff, 0x0000ff, 0x0100ff,
+    0x0100ff, 0x0200ff, 0x0300ff, 0x0400ff, 0x0500ff, 0x0600ff, 0x0800ff, 0x0a00ff,
+    0x0d00ff, 0x0f00ff, 0x1200ff, 0x1500ff, 0x1900ff, 0x1d00ff, 0x2100ff, 0x2600ff,
+    0x2a00ff, 0x2f00ff, 0x3500ff, 0x3b00ff, 0x4100ff, 0x4800ff, 0x5000ff, 0x5800ff,
+    0x6000ff, 0x6900ff, 0x7200ff, 0x7c00ff, 0x8600ff, 0x9100ff, 0x9c00ff, 0xa800ff,
+    0xb400ff, 0xc100ff, 0xce00ff, 0xdc00ff, 0xeb00ff, 0xfa00ff, 0xff00f5, 0xff00e6,
+    0xff00d7, 0xff00ca, 0xff00bc, 0xff00b0, 0xff00a4, 0xff0098, 0xff008d, 0xff0082,
+    0xff0078, 0xff006f, 0xff0066, 0xff005d, 0xff0055, 0xff004d, 0xff0046, 0xff003f,
+    0xff0039, 0xff0033, 0xff002d, 0xff0029, 0xff0024, 0xff001f, 0xff001b, 0xff0018,
+    0xff0014, 0xff0011, 0xff000e, 0xff000c, 0xff000a, 0xff0008, 0xff0006, 0xff0005,
+    0xff0003, 0xff0002, 0xff0002, 0xff0001, 0xff0001, 0xff0000, 0xff0000, 0xff0000,
+};
+
+// Scale an 8-bit channel by an 8-bit level, 255 leaving it unchanged
+static inline uint8_t scale8(uint8_t value, uint8_t level) {
+    return (uint8_t)(((uint16_t)value * ((uint16_t)level + 1)) >> 8);
+}
+
+// Scale each channel of a linear colour by level, then gamma correct it for the LED
+static inline uint32_t shadeColor(uint32_t color, uint8_t level) {
+    return ((uint32_t)gammaTable[scale8((uint8_t)(color >> 16), level)] << 16) |
+           ((uint32_t)gammaTable[scale8((uint8_t)(color >> 8), level)] << 8) |
+           gammaTable[scale8((uint8_t)color, level)];
+}
+
+static inline void fillPixels(uint32_t *pixels, uint16_t count, uint32_t color) {
+    for (uint16_t i = 0; i < count; i++) {
+        pixels[i] = color;
+    }
+}
+
+// Position within the current cycle as a 0-255 table index
+static inline uint8_t cycleIndex(uint32_t elapsedMs, uint32_t periodMs) {
+    return (uint8_t)(((uint64_t)(elapsedMs % periodMs) << 8) / periodMs);
+}
+
+// Time to the next animation frame, keeping frames on a fixed grid from the start of the effect
+static inline uint32_t nextAnimationFrame(uint32_t elapsedMs) {
+    return LED_FRAME_INTERVAL_MS - elapsedMs % LED_FRAME_INTERVAL_MS;
+}
+
+uint32_t LED_RenderEffect(const led_effect_t *effect, uint32_t elapsedMs, uint32_t *pixels, uint16_t count) {
+    uint32_t period = effect->periodMs ? effect->periodMs : 1;
+
+    switch (effect->type) {
+        case LED_EFFECT_SOLID:
+            fillPixels(pixels, count, shadeColor(effect->color, 255));
+            return LED_FRAME_NEVER;
+
+        case LED_EFFECT_BLINK: {
+            uint32_t phase = elapsedMs % period;
+            uint32_t onTime = period / 2;
+            bool on = phase < onTime;
+
+            fillPixels(pixels, count, on ? shadeColor(effect->color, 255) : 0);
+            return on ? onTime - phase : period - phase;
+        }
+
+        case LED_EFFECT_BREATHE:
+            fillPixels(pixels, count, shadeColor(effect->color, breatheTable[cycleIndex(elapsedMs, period)]));
+            return nextAnimationFrame(elapsedMs);
+
+        case LED_EFFECT_RAINBOW: {
+            uint8_t hue = cycleIndex(elapsedMs, period);
+
+            // Spread one turn of the wheel along the strip
+            for (uint16_t i = 0; i < count; i++) {
+                pixels[i] = hueTable[(uint8_t)(hue + (i << 8) / count)];
+            }
+            return nextAnimationFrame(elapsedMs);
+        }
+
+        case LED_EFFECT_STATUS_CODE: {
+            if (effect->count == 0) {
+                break;
+            }
+
+            // Blink n occupies slots 2n (on) and 2n + 1 (off), the pause follows the last on slot
+            uint32_t onSlots = 2 * (uint32_t)effect->count - 1;
+            uint32_t cycle = (onSlots + LED_STATUS_CODE_PAUSE) * period;
+            uint32_t phase = elapsedMs % cycle;
+            uint32_t slot = phase / period;
+            bool on = slot < onSlots && (slot & 1) == 0;
+
+            fillPixels(pixels, count, on ? shadeColor(effect->color, 255) : 0);
+            if (slot >= onSlots) {
+                return cycle - phase;
+            }
+            return period - phase % period;
+        }
+
+        case LED_EFFECT_OFF:
+        default:
+            break;
+    }
+
+    fillPixels(pixels, count, 0);
+    return LED_FRAME_NEVER;
+}
+
+uint32_t LED_GammaColor(uint32_t color) {
+    return shadeColor(color, 255);
+}
+
+const char *LED_EffectTypeToString(led_effect_type_t type) {
+    switch (type) {
+        case LED_EFFECT_OFF: return "off";
+        case LED_EFFECT_SOLID: return "solid";
+        case LED_EFFECT_BLINK: return "blink";
+        case LED_EFFECT_BREATHE: return "breathe";
+        case LED_EFFECT_RAINBOW: return "rainbow";
+        case LED_EFFECT_STATUS_CODE: return "status code";
+        default: return "unknown";
+    }
+}
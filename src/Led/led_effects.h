@@ -0,0 +1,57 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* LED effect renderer
+ * Pure logic with no driver or task of its own: renders one frame of an effect at a given time into a framebuffer of
+ * 0xRRGGBB pixels, and returns how long that frame stays unchanged so the caller can sleep until the next one.
+ * Brightness curves and the colour wheel come from precomputed tables, so a frame costs a few table lookups and
+ * integer multiplies with no floating point.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Returned by LED_RenderEffect() when the frame will not change again */
+#define LED_FRAME_NEVER UINT32_MAX
+
+/* Shortest time between frames of the animated effects, ~50fps */
+#define LED_FRAME_INTERVAL_MS 20
+
+/* Off time after the last blink of a status code, in blink periods, so the count can be read */
+#define LED_STATUS_CODE_PAUSE 4
+
+typedef enum {
+    LED_EFFECT_OFF,
+    LED_EFFECT_SOLID,
+    LED_EFFECT_BLINK,           /* on for half of periodMs, off for the other half */
+    LED_EFFECT_BREATHE,         /* fades up and down once every periodMs */
+    LED_EFFECT_RAINBOW,         /* cycles the colour wheel once every periodMs, color is ignored */
+    LED_EFFECT_STATUS_CODE,     /* count blinks of periodMs on & periodMs off, then a pause, repeated */
+} led_effect_type_t;
+
+typedef struct {
+    led_effect_type_t type;
+    uint32_t color;             /* 0xRRGGBB before gamma correction */
+    uint32_t periodMs;
+    uint8_t count;              /* blinks in a status code */
+    uint32_t durationMs;        /* effect stops by itself after this long, 0 = runs until replaced */
+} led_effect_t;
+
+/* Render the frame elapsedMs into an effect, returning the time until the frame next changes or LED_FRAME_NEVER */
+uint32_t LED_RenderEffect(const led_effect_t *effect, uint32_t elapsedMs, uint32_t *pixels, uint16_t count);
+
+/* Gamma correct a 0xRRGGBB colour through the same table the effects use */
+uint32_t LED_GammaColor(uint32_t color);
+
+const char *LED_EffectTypeToString(led_effect_type_t type);
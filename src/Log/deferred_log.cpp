@@ -0,0 +1,261 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "Common/mpsc_ring.h"
+#include "Log/deferred_log.h"
+#include "Memory/memory_pool.h"
+#include "Trace/trace.h"
+
+static MpscRing<dlog_record_t, DLOG_RING_SIZE> logRing;
+static TaskHandle_t drainTask = NULL;
+static std::atomic_flag draining = ATOMIC_FLAG_INIT;
+
+static std::atomic<uint32_t> statWritten(0);
+static std::atomic<uint32_t> statDropped(0);
+
+dlog_record_t *DLOG_AcquireRecord(size_t *position) {
+    dlog_record_t *record = logRing.acquireWrite(position);
+    if (record == NULL) {
+        statDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return record;
+}
+
+void DLOG_CommitRecord(size_t position) {
+    logRing.commitWrite(position);
+    statWritten.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool DLOG_Read(dlog_record_t *record) {
+    return logRing.pop(record);
+}
+
+/********************* Formatting **************************/
+static inline dlog_arg_type_t argType(const dlog_record_t *record, uint8_t arg) {
+    return (dlog_arg_type_t)((record->argTypes >> (2 * arg)) & 0x3);
+}
+
+// Append to the output, tracking the full length even once the buffer has run out, as snprintf does
+static void append(char *buffer, size_t size, int *length, const char *format, ...) {
+    size_t offset = (size_t)*length < size ? (size_t)*length : size;
+    va_list args;
+
+    va_start(args, format);
+    int written = vsnprintf(buffer + offset, size - offset, format, args);
+    va_end(args);
+
+    if (written > 0) {
+        *length += written;
+    }
+}
+
+int DLOG_FormatRecord(const dlog_record_t *record, char *buffer, size_t size) {
+    const char *format = record->format;
+    int length = 0;
+    uint8_t arg = 0;
+    uint8_t word = 0;
+
+    if (size) {
+        buffer[0] = '\0';
+    }
+
+    while (*format) {
+        if (*format != '%') {
+            // Copy literal text up to the next conversion in one go
+            const char *end = strchr(format, '%');
+            end = end ? end : format + strlen(format);
+            append(buffer, size, &length, "%.*s", (int)(end - format), format);
+            format = end;
+            continue;
+        }
+
+        if (format[1] == '%') {
+            append(buffer, size, &length, "%%");
+            format += 2;
+            continue;
+        }
+
+        // Rebuild the conversion with its flags, width and precision, widening its length modifier to match what was stored
+        char spec[24];
+        const char *start = format++;
+        while (*format && strchr("-+ #0123456789.", *format) && (size_t)(format - start) < sizeof(spec) - 4) {
+            format++;
+        }
+        size_t specLength = format - start;
+        memcpy(spec, start, specLength);
+
+        uint8_t narrow = 0;
+        while (*format && strchr("hljztL", *format)) {
+            narrow = *format == 'h' ? narrow + 1 : 0;
+            format++;
+        }
+
+        char conversion = *format;
+        if (conversion == '\0') {
+            break;
+        }
+        format++;
+
+        if (arg >= record->argCount) {
+            break;
+        }
+
+        dlog_arg_type_t type = argType(record, arg);
+        int64_t integer = 0;
+        double real = 0;
+        uintptr_t pointer = 0;
+
+        switch (type) {
+            case DLOG_ARG_INT32:
+                integer = (int32_t)record->args[word];
+                word += 1;
+                break;
+            case DLOG_ARG_INT64:
+                integer = (int64_t)((uint64_t)record->args[word] | ((uint64_t)record->args[word + 1] << 32));
+                word += 2;
+                break;
+            case DLOG_ARG_DOUBLE:
+                memcpy(&real, &record->args[word], sizeof(real));
+                word += 2;
+                break;
+            case DLOG_ARG_POINTER:
+                memcpy(&pointer, &record->args[word], sizeof(pointer));
+                word += (sizeof(void *) + 3) / 4;
+                break;
+        }
+        arg++;
+
+        switch (conversion) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o': {
+                if (type == DLOG_ARG_INT32 && conversion != 'd' && conversion != 'i') {
+                    // Unsigned conversions of a 32-bit word, masked down for %hx and %hhx
+                    integer = (uint32_t)integer & (narrow == 1 ? 0xffff : narrow >= 2 ? 0xff : 0xffffffff);
+                } else if (type == DLOG_ARG_INT32 && narrow) {
+                    integer = narrow == 1 ? (int16_t)integer : (int8_t)integer;
+                }
+                spec[specLength] = 'l';
+                spec[specLength + 1] = 'l';
+                spec[specLength + 2] = conversion;
+                spec[specLength + 3] = '\0';
+                append(buffer, size, &length, spec, (long long)integer);
+                break;
+            }
+
+            case 'c':
+                spec[specLength] = conversion;
+                spec[specLength + 1] = '\0';
+                append(buffer, size, &length, spec, (int)integer);
+                break;
+
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                spec[specLength] = conversion;
+                spec[specLength + 1] = '\0';
+                append(buffer, size, &length, spec, real);
+                break;
+
+            case 's':
+            case 'p':
+                spec[specLength] = conversion;
+                spec[specLength + 1] = '\0';
+                if (type != DLOG_ARG_POINTER) {
+                    append(buffer, size, &length, "<?>");
+                } else if (conversion == 's') {
+                    append(buffer, size, &length, spec, pointer ? (const char *)pointer : "(null)");
+                } else {
+                    append(buffer, size, &length, spec, (void *)pointer);
+                }
+                break;
+
+            default:
+                append(buffer, size, &length, "<?>");
+                break;
+        }
+    }
+
+    return length;
+}
+
+/********************* Drain task **************************/
+static void printRecord(const dlog_record_t *record) {
+    char line[DLOG_LINE_SIZE];
+    const char *file = strrchr(record->file, '/');
+
+    DLOG_FormatRecord(record, line, sizeof(line));
+    log_printf("[%6lu][%c][%s:%u] %s(): %s\r\n", (unsigned long)record->timestampMs, record->level, file ? file + 1 : record->file,
+               record->line, record->func, line);
+}
+
+// The ring has a single consumer, so the drain task and DLOG_Flush() take turns
+static void drainRecords() {
+    static uint32_t reportedDrops = 0;
+    dlog_record_t record;
+
+    while (draining.test_and_set(std::memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+
+    while (DLOG_Read(&record)) {
+        printRecord(&record);
+    }
+
+    uint32_t dropped = statDropped.load(std::memory_order_relaxed);
+    if (dropped != reportedDrops) {
+        log_printf("[%6lu][W] %lu deferred log records dropped, raise DLOG_RING_SIZE\r\n", millis(), (unsigned long)(dropped - reportedDrops));
+        reportedDrops = dropped;
+    }
+
+    draining.clear(std::memory_order_release);
+}
+
+// Also writes out the trace recorder's ring, which has no task of its own
+static void taskLogDrain(void *arg) {
+    for (;;) {
+        drainRecords();
+        TRACE_Flush();
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_INTERVAL_MS));
+    }
+}
+
+void DLOG_Init() {
+    if (drainTask != NULL) {
+        return;
+    }
+
+    drainTask = MEM_CreateTask(taskLogDrain, "Log_drain", DLOG_TASK_STACK_SIZE, NULL, DLOG_TASK_PRIORITY);
+}
+
+void DLOG_Flush() {
+    drainRecords();
+}
+
+void DLOG_GetStats(dlog_stats_t *stats) {
+    stats->written = statWritten.load(std::memory_order_relaxed);
+    stats->dropped = statDropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,192 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Deferred binary logging
+ * dlog_e/w/i/d/v take the same arguments as log_e/w/i/d/v, but the calling task only copies the format string's
+ * address, the raw argument words and a timestamp into a lock-free ring. Formatting and serial output happen later on a
+ * low-priority drain task, or wherever DLOG_Read() is called from, so logging on the Zigbee stack task costs about as
+ * much as a struct copy. When the ring is full the record is dropped and counted rather than blocking the caller.
+ *
+ * Arguments are captured by value, so %s arguments must outlive the record: string literals and the static name tables
+ * behind esp_err_to_name() and the *ToString() helpers are fine, stack buffers are not.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+/* Records below this level compile away entirely, defaults to the Arduino core's level */
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL CORE_DEBUG_LEVEL
+#endif
+
+#define DLOG_RING_SIZE 64               /* records, must be a power of two */
+#define DLOG_MAX_ARG_WORDS 12           /* 32-bit words of arguments per record */
+#define DLOG_DRAIN_INTERVAL_MS 20
+#define DLOG_LINE_SIZE 256
+
+#define DLOG_TASK_STACK_SIZE 3072
+#define DLOG_TASK_PRIORITY 1
+
+typedef enum {
+    DLOG_ARG_INT32,                     /* any integer or enum of 32 bits or less, one word */
+    DLOG_ARG_INT64,                     /* two words, low word first */
+    DLOG_ARG_DOUBLE,                    /* float or double as the bits of a double, two words */
+    DLOG_ARG_POINTER,                   /* strings and pointers, as many words as a pointer takes */
+} dlog_arg_type_t;
+
+typedef struct {
+    uint32_t timestampMs;
+    const char *format;                 /* doubles as the format id, it lives in flash for the life of the firmware */
+    const char *file;
+    const char *func;
+    uint16_t line;
+    char level;                         /* 'E', 'W', 'I', 'D' or 'V' */
+    uint8_t argCount;
+    uint32_t argTypes;                  /* dlog_arg_type_t of each argument, 2 bits apiece from the low bits up */
+    uint32_t args[DLOG_MAX_ARG_WORDS];
+} dlog_record_t;
+
+typedef struct {
+    uint32_t written;
+    uint32_t dropped;                   /* ring full, record discarded */
+} dlog_stats_t;
+
+/* Start the drain task that formats records out to the serial log; safe to call more than once */
+void DLOG_Init();
+
+/* Producer side used by the dlog_* macros: claim a record, or NULL (and a drop counted) if the ring is full */
+dlog_record_t *DLOG_AcquireRecord(size_t *position);
+void DLOG_CommitRecord(size_t position);
+
+/* Consumer side, for the drain task or a host-side tool: take the oldest record, false if there is none */
+bool DLOG_Read(dlog_record_t *record);
+
+/* Format a record's message, without the level/file/line prefix, returning its length as snprintf does */
+int DLOG_FormatRecord(const dlog_record_t *record, char *buffer, size_t size);
+
+/* Format and print everything in the ring now, e.g. before a restart */
+void DLOG_Flush();
+
+void DLOG_GetStats(dlog_stats_t *stats);
+
+/********************* Argument capture **************************/
+template <typename T>
+constexpr uint8_t dlogArgWords() {
+    return std::is_floating_point<T>::value ? 2
+         : std::is_pointer<T>::value ? (uint8_t)((sizeof(void *) + 3) / 4)
+         : sizeof(T) > 4 ? 2
+         : 1;
+}
+
+template <typename... Args>
+constexpr uint8_t dlogTotalWords() {
+    return (0 + ... + dlogArgWords<Args>());
+}
+
+template <typename T>
+static inline void dlogPutArg(dlog_record_t *record, uint8_t *word, T value) {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value, "Unsupported log argument type");
+    uint32_t type;
+
+    if constexpr (std::is_floating_point<T>::value) {
+        double d = value;
+        memcpy(&record->args[*word], &d, sizeof(d));
+        type = DLOG_ARG_DOUBLE;
+    } else if constexpr (std::is_pointer<T>::value) {
+        uintptr_t p = (uintptr_t)value;
+        memcpy(&record->args[*word], &p, sizeof(p));
+        type = DLOG_ARG_POINTER;
+    } else if constexpr (sizeof(T) > 4) {
+        uint64_t v = (uint64_t)value;
+        record->args[*word] = (uint32_t)v;
+        record->args[*word + 1] = (uint32_t)(v >> 32);
+        type = DLOG_ARG_INT64;
+    } else {
+        // Sign-extend signed types, so the formatter can widen any conversion to long long
+        record->args[*word] = (uint32_t)(int32_t)value;
+        type = DLOG_ARG_INT32;
+    }
+
+    record->argTypes |= type << (2 * record->argCount);
+    record->argCount++;
+    *word += dlogArgWords<T>();
+}
+
+template <typename... Args>
+static inline void DLOG_Write(char level, const char *file, uint16_t line, const char *func, const char *format, Args... args) {
+    static_assert(dlogTotalWords<Args...>() <= DLOG_MAX_ARG_WORDS, "Too many log arguments, raise DLOG_MAX_ARG_WORDS");
+
+    size_t position;
+    dlog_record_t *record = DLOG_AcquireRecord(&position);
+    if (record == NULL) {
+        return;
+    }
+
+    record->timestampMs = millis();
+    record->format = format;
+    record->file = file;
+    record->func = func;
+    record->line = line;
+    record->level = level;
+    record->argCount = 0;
+    record->argTypes = 0;
+
+    uint8_t word = 0;
+    (dlogPutArg(record, &word, args), ...);
+
+    DLOG_CommitRecord(position);
+}
+
+/* Never called, it only lets the compiler check arguments against the format string */
+static inline void dlogCheckFormat(const char *format, ...) __attribute__((format(printf, 1, 2)));
+static inline void dlogCheckFormat(const char *format, ...) {}
+
+#define DLOG_(level, format, ...) do { \
+        if (0) { dlogCheckFormat(format, ##__VA_ARGS__); } \
+        DLOG_Write(level, __FILE__, __LINE__, __func__, format, ##__VA_ARGS__); \
+    } while (0)
+
+#if DLOG_LEVEL >= ARDUHAL_LOG_LEVEL_ERROR
+#define dlog_e(format, ...) DLOG_('E', format, ##__VA_ARGS__)
+#else
+#define dlog_e(format, ...) do {} while (0)
+#endif
+
+#if DLOG_LEVEL >= ARDUHAL_LOG_LEVEL_WARN
+#define dlog_w(format, ...) DLOG_('W', format, ##__VA_ARGS__)
+#else
+#define dlog_w(format, ...) do {} while (0)
+#endif
+
+#if DLOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+#define dlog_i(format, ...) DLOG_('I', format, ##__VA_ARGS__)
+#else
+#define dlog_i(format, ...) do {} while (0)
+#endif
+
+#if DLOG_LEVEL >= ARDUHAL_LOG_LEVEL_DEBUG
+#define dlog_d(format, ...) DLOG_('D', format, ##__VA_ARGS__)
+#else
+#define dlog_d(format, ...) do {} while (0)
+#endif
+
+#if DLOG_LEVEL >= ARDUHAL_LOG_LEVEL_VERBOSE
+#define dlog_v(format, ...) DLOG_('V', format, ##__VA_ARGS__)
+#else
+#define dlog_v(format, ...) do {} while (0)
+#endif
@@ -0,0 +1,205 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "esp_heap_caps.h"
+#include "Memory/memory_pool.h"
+
+typedef struct {
+    TaskHandle_t handle;
+    const char *name;
+    uint32_t stackSize;
+} mem_task_t;
+
+static portMUX_TYPE memMux = portMUX_INITIALIZER_UNLOCKED;
+static mem_task_t tasks[MEM_MAX_TASKS];
+static uint8_t taskCount = 0;
+static uint8_t queueCount = 0;
+static uint8_t timerCount = 0;
+
+#ifdef MEM_STATIC_ALLOCATION
+#define MEM_POOL_ALIGNMENT 16
+
+static StaticTask_t taskBuffers[MEM_MAX_TASKS];
+static StackType_t stackPool[MEM_STACK_POOL_SIZE] __attribute__((aligned(MEM_POOL_ALIGNMENT)));
+static size_t stackPoolUsed = 0;
+
+static StaticQueue_t queueBuffers[MEM_MAX_QUEUES];
+static uint8_t queueStorage[MEM_QUEUE_STORAGE_SIZE] __attribute__((aligned(MEM_POOL_ALIGNMENT)));
+static size_t queueStorageUsed = 0;
+
+static StaticTimer_t timerBuffers[MEM_MAX_TIMERS];
+
+// Bump allocation only, the project's RTOS objects live for as long as the device is up
+static void *takeFromPool(uint8_t *pool, size_t poolSize, size_t *used, size_t size) {
+    size_t start = (*used + MEM_POOL_ALIGNMENT - 1) & ~(size_t)(MEM_POOL_ALIGNMENT - 1);
+    if (start + size > poolSize) {
+        return NULL;
+    }
+
+    *used = start + size;
+    return pool + start;
+}
+#endif
+
+TaskHandle_t MEM_CreateTask(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg, UBaseType_t priority) {
+    TaskHandle_t handle = NULL;
+
+    portENTER_CRITICAL(&memMux);
+    uint8_t slot = taskCount;
+    bool available = slot < MEM_MAX_TASKS;
+#ifdef MEM_STATIC_ALLOCATION
+    StackType_t *stack = available ? (StackType_t *)takeFromPool((uint8_t *)stackPool, sizeof(stackPool), &stackPoolUsed, stackSize * sizeof(StackType_t)) : NULL;
+    available = available && stack != NULL;
+#endif
+    if (available) {
+        tasks[slot].name = name;
+        tasks[slot].stackSize = stackSize;
+        taskCount++;
+    }
+    portEXIT_CRITICAL(&memMux);
+
+    if (!available) {
+        log_e("No room for task %s (%lu bytes of stack), raise MEM_MAX_TASKS or MEM_STACK_POOL_SIZE", name, (unsigned long)stackSize);
+        return NULL;
+    }
+
+#ifdef MEM_STATIC_ALLOCATION
+    handle = xTaskCreateStatic(function, name, stackSize, arg, priority, stack, &taskBuffers[slot]);
+#else
+    if (xTaskCreate(function, name, stackSize, arg, priority, &handle) != pdPASS) {
+        handle = NULL;
+    }
+#endif
+
+    if (handle == NULL) {
+        log_e("Task %s was not created", name);
+    }
+
+    tasks[slot].handle = handle;
+    return handle;
+}
+
+QueueHandle_t MEM_CreateQueue(UBaseType_t length, UBaseType_t itemSize) {
+    QueueHandle_t queue;
+
+#ifdef MEM_STATIC_ALLOCATION
+    portENTER_CRITICAL(&memMux);
+    uint8_t slot = queueCount;
+    uint8_t *storage = slot < MEM_MAX_QUEUES ? (uint8_t *)takeFromPool(queueStorage, sizeof(queueStorage), &queueStorageUsed, (size_t)length * itemSize) : NULL;
+    if (storage != NULL) {
+        queueCount++;
+    }
+    portEXIT_CRITICAL(&memMux);
+
+    if (storage == NULL) {
+        log_e("No room for a queue of %u x %u bytes, raise MEM_MAX_QUEUES or MEM_QUEUE_STORAGE_SIZE", length, itemSize);
+        return NULL;
+    }
+
+    queue = xQueueCreateStatic(length, itemSize, storage, &queueBuffers[slot]);
+#else
+    queue = xQueueCreate(length, itemSize);
+
+    portENTER_CRITICAL(&memMux);
+    queueCount += queue != NULL;
+    portEXIT_CRITICAL(&memMux);
+#endif
+
+    return queue;
+}
+
+TimerHandle_t MEM_CreateTimer(const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback) {
+    TimerHandle_t timer;
+
+#ifdef MEM_STATIC_ALLOCATION
+    portENTER_CRITICAL(&memMux);
+    uint8_t slot = timerCount;
+    bool available = slot < MEM_MAX_TIMERS;
+    if (available) {
+        timerCount++;
+    }
+    portEXIT_CRITICAL(&memMux);
+
+    if (!available) {
+        log_e("No room for timer %s, raise MEM_MAX_TIMERS", name);
+        return NULL;
+    }
+
+    timer = xTimerCreateStatic(name, period, autoReload, id, callback, &timerBuffers[slot]);
+#else
+    timer = xTimerCreate(name, period, autoReload, id, callback);
+
+    portENTER_CRITICAL(&memMux);
+    timerCount += timer != NULL;
+    portEXIT_CRITICAL(&memMux);
+#endif
+
+    return timer;
+}
+
+TaskHandle_t MEM_FindTask(const char *name) {
+    portENTER_CRITICAL(&memMux);
+    uint8_t count = taskCount;
+    portEXIT_CRITICAL(&memMux);
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (strcmp(tasks[i].name, name) == 0) {
+            return tasks[i].handle;
+        }
+    }
+
+    return NULL;
+}
+
+void MEM_LogBudget(const char *when) {
+    uint32_t stackTotal = 0;
+    uint32_t stackPeakTotal = 0;
+
+#ifdef MEM_STATIC_ALLOCATION
+    log_i("RAM budget %s, static allocation:", when);
+#else
+    log_i("RAM budget %s, heap allocation:", when);
+#endif
+    log_i("  %-16s %6s %6s %6s", "task", "stack", "peak", "free");
+
+    portENTER_CRITICAL(&memMux);
+    uint8_t count = taskCount;
+    portEXIT_CRITICAL(&memMux);
+
+    for (uint8_t i = 0; i < count; i++) {
+        const mem_task_t *task = &tasks[i];
+        if (task->handle == NULL) {
+            continue;
+        }
+
+        // ESP-IDF reports the high-water mark in bytes, matching the stack size passed at creation
+        uint32_t unused = uxTaskGetStackHighWaterMark(task->handle);
+        uint32_t peak = task->stackSize > unused ? task->stackSize - unused : 0;
+        log_i("  %-16s %6lu %6lu %6lu", task->name, (unsigned long)task->stackSize, (unsigned long)peak, (unsigned long)unused);
+
+        stackTotal += task->stackSize;
+        stackPeakTotal += peak;
+    }
+
+    log_i("  %-16s %6lu %6lu %6lu", "(total)", (unsigned long)stackTotal, (unsigned long)stackPeakTotal, (unsigned long)(stackTotal - stackPeakTotal));
+
+#ifdef MEM_STATIC_ALLOCATION
+    log_i("  pools: tasks %u/%u, stacks %u/%u bytes, queues %u/%u (%u/%u bytes), timers %u/%u", count, MEM_MAX_TASKS, (unsigned)stackPoolUsed,
+          MEM_STACK_POOL_SIZE, queueCount, MEM_MAX_QUEUES, (unsigned)queueStorageUsed, MEM_QUEUE_STORAGE_SIZE, timerCount, MEM_MAX_TIMERS);
+#else
+    log_i("  objects: tasks %u, queues %u, timers %u", count, queueCount, timerCount);
+#endif
+    log_i("  heap: free %u, minimum free %u, largest free block %u bytes", (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+          (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
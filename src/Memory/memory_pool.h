@@ -0,0 +1,58 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Task, queue & timer creation for the project's own RTOS objects
+ * Every task, queue and timer the project creates goes through here. Built with -D MEM_STATIC_ALLOCATION, they are
+ * carved out of fixed pools sized below at boot and the heap is never touched, so months of uptime cannot fragment it
+ * and running out shows up on the first boot rather than in the field. Without it they come from the heap as before.
+ * Either way each task is tracked, so MEM_LogBudget() can report its stack high-water mark against the heap.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "freertos/timers.h"
+
+/* Pool sizes for static allocation; MEM_LogBudget() shows how much of each is used, so they can be trimmed to fit.
+ * The task pools fit the tasks main.cpp checks them against; raise them for any the application adds.
+ */
+#ifndef MEM_MAX_TASKS
+#define MEM_MAX_TASKS 8
+#endif
+
+#ifndef MEM_STACK_POOL_SIZE
+#define MEM_STACK_POOL_SIZE (23 * 1024)         /* bytes, shared by all task stacks */
+#endif
+
+#ifndef MEM_MAX_QUEUES
+#define MEM_MAX_QUEUES 2
+#endif
+
+#ifndef MEM_QUEUE_STORAGE_SIZE
+#define MEM_QUEUE_STORAGE_SIZE 256              /* bytes, shared by all queue items */
+#endif
+
+#ifndef MEM_MAX_TIMERS
+#define MEM_MAX_TIMERS 4
+#endif
+
+/* Create the project's RTOS objects; arguments as xTaskCreate/xQueueCreate/xTimerCreate, NULL if out of pool space */
+TaskHandle_t MEM_CreateTask(TaskFunction_t function, const char *name, uint32_t stackSize, void *arg, UBaseType_t priority);
+QueueHandle_t MEM_CreateQueue(UBaseType_t length, UBaseType_t itemSize);
+TimerHandle_t MEM_CreateTimer(const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback);
+
+/* Handle of a task created here, or NULL */
+TaskHandle_t MEM_FindTask(const char *name);
+
+/* Log each task's stack use, pool use and the heap; stack peaks are only meaningful once the tasks have been busy */
+void MEM_LogBudget(const char *when);
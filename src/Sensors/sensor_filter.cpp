@@ -0,0 +1,182 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "Sensors/sensor_filter.h"
+
+// Slide the median window on by one sample, keeping a sorted copy so the median is always its middle element
+static bool runMedian(const sens_stage_t *stage, sens_stage_state_t *state, int32_t sample, int32_t *output) {
+    uint8_t length = stage->length;
+    int32_t *sorted = state->median.sorted;
+    uint8_t count = state->median.count;
+    uint8_t i;
+
+    if (count == length) {
+        // Take the oldest sample out of the sorted copy
+        int32_t oldest = state->median.window[state->median.next];
+        for (i = 0; sorted[i] != oldest; i++) {
+        }
+        memmove(&sorted[i], &sorted[i + 1], (count - i - 1) * sizeof(sorted[0]));
+        count--;
+    }
+
+    for (i = count; i > 0 && sorted[i - 1] > sample; i--) {
+        sorted[i] = sorted[i - 1];
+    }
+    sorted[i] = sample;
+    count++;
+
+    state->median.window[state->median.next] = sample;
+    state->median.next = state->median.next + 1 == length ? 0 : state->median.next + 1;
+    state->median.count = count;
+
+    // Until the window fills, the median of what has arrived so far
+    *output = count & 1 ? sorted[count / 2] : (int32_t)(((int64_t)sorted[count / 2 - 1] + sorted[count / 2]) / 2);
+    return true;
+}
+
+static bool runStage(const sens_stage_t *stage, sens_stage_state_t *state, int32_t sample, int32_t *output) {
+    switch (stage->type) {
+        case SENS_FILTER_EMA: {
+            // Feeding back the rounded average, rather than the truncated one, lets it settle on the input from either side
+            int32_t half = 1 << (stage->length - 1);
+            if (!state->ema.primed) {
+                state->ema.accumulator = sample * (1 << stage->length);
+                state->ema.primed = true;
+            } else {
+                state->ema.accumulator += sample - ((state->ema.accumulator + half) >> stage->length);
+            }
+            *output = (state->ema.accumulator + half) >> stage->length;
+            return true;
+        }
+
+        case SENS_FILTER_MEDIAN:
+            return runMedian(stage, state, sample, output);
+
+        case SENS_FILTER_DECIMATE:
+            state->decimate.sum += sample;
+            if (++state->decimate.count < stage->length) {
+                return false;
+            }
+            *output = state->decimate.sum >= 0 ? (state->decimate.sum + stage->length / 2) / stage->length
+                                               : (state->decimate.sum - stage->length / 2) / stage->length;
+            state->decimate.sum = 0;
+            state->decimate.count = 0;
+            return true;
+
+        case SENS_FILTER_SCALE:
+            *output = (int32_t)(((int64_t)sample * stage->multiplier) >> 16) + stage->offset;
+            return true;
+    }
+
+    return false;
+}
+
+// External interface functions
+esp_err_t SENS_PipelineInit(sens_pipeline_t *pipeline, const sens_stage_t *stages, uint8_t stageCount, int32_t delta) {
+    if (stageCount > SENS_MAX_STAGES || (stageCount && stages == NULL) || delta < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint8_t i = 0; i < stageCount; i++) {
+        const sens_stage_t *stage = &stages[i];
+        bool valid = true;
+
+        switch (stage->type) {
+            case SENS_FILTER_EMA:
+                valid = stage->length >= 1 && stage->length <= SENS_EMA_MAX_SHIFT;
+                break;
+            case SENS_FILTER_MEDIAN:
+                valid = stage->length >= 1 && stage->length <= SENS_MEDIAN_MAX && (stage->length & 1);
+                break;
+            case SENS_FILTER_DECIMATE:
+                valid = stage->length >= 2;
+                break;
+            case SENS_FILTER_SCALE:
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    memset(pipeline, 0, sizeof(*pipeline));
+    if (stageCount) {
+        memcpy(pipeline->stages, stages, stageCount * sizeof(stages[0]));
+    }
+    pipeline->stageCount = stageCount;
+    pipeline->delta = delta;
+    return ESP_OK;
+}
+
+void SENS_PipelineReset(sens_pipeline_t *pipeline) {
+    memset(pipeline->state, 0, sizeof(pipeline->state));
+    pipeline->published = false;
+}
+
+bool SENS_PipelineFilter(sens_pipeline_t *pipeline, int32_t sample, int32_t *output) {
+    pipeline->stats.samples++;
+
+    for (uint8_t i = 0; i < pipeline->stageCount; i++) {
+        if (!runStage(&pipeline->stages[i], &pipeline->state[i], sample, &sample)) {
+            return false;
+        }
+    }
+
+    pipeline->stats.outputs++;
+    pipeline->lastOutput = sample;
+    *output = sample;
+    return true;
+}
+
+bool SENS_PipelinePush(sens_pipeline_t *pipeline, int32_t sample, int32_t *value) {
+    int32_t output;
+
+    if (!SENS_PipelineFilter(pipeline, sample, &output)) {
+        return false;
+    }
+
+    if (pipeline->published) {
+        int64_t change = (int64_t)output - pipeline->lastPublished;
+        if (change < 0) {
+            change = -change;
+        }
+        if (change == 0 || change < pipeline->delta) {
+            return false;
+        }
+    }
+
+    *value = output;
+    return true;
+}
+
+void SENS_PipelineCommit(sens_pipeline_t *pipeline, int32_t value) {
+    pipeline->published = true;
+    pipeline->lastPublished = value;
+    pipeline->stats.published++;
+}
+
+const char *SENS_FilterTypeToString(sens_filter_type_t type) {
+    switch (type) {
+        case SENS_FILTER_EMA: return "EMA";
+        case SENS_FILTER_MEDIAN: return "MEDIAN";
+        case SENS_FILTER_DECIMATE: return "DECIMATE";
+        case SENS_FILTER_SCALE: return "SCALE";
+        default: return "UNKNOWN";
+    }
+}
@@ -0,0 +1,111 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Sensor sample filtering
+ * Pure logic with no driver or task of its own: a pipeline runs each raw sample through a short chain of fixed-point
+ * filter stages, then gates the result so a value is only published once it has moved by at least a set delta from the
+ * last one published. Stages work on signed 32-bit samples in whatever unit the source produces, with integer adds,
+ * shifts and the odd multiply, and no floating point.
+ *
+ *  - EMA: exponential moving average with a weight of 1/2^shift on each new sample; |sample| must stay below 2^(31-shift)
+ *  - MEDIAN: median of the last length samples (odd, up to SENS_MEDIAN_MAX), which drops isolated spikes outright
+ *  - DECIMATE: averages each run of length samples into one output, so later stages & the gate run length times less;
+ *    the sum of a run must fit 32 bits
+ *  - SCALE: (sample * multiplier >> 16) + offset, e.g. millivolts into the attribute's unit
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define SENS_MAX_STAGES 4
+#define SENS_MEDIAN_MAX 9
+#define SENS_EMA_MAX_SHIFT 15
+
+#define SENS_Q16(value) ((int32_t)((value) * 65536.0))     /* a SCALE multiplier from a constant */
+
+typedef enum {
+    SENS_FILTER_EMA,
+    SENS_FILTER_MEDIAN,
+    SENS_FILTER_DECIMATE,
+    SENS_FILTER_SCALE,
+} sens_filter_type_t;
+
+typedef struct {
+    sens_filter_type_t type;
+    uint8_t length;                 /* EMA shift, MEDIAN window or DECIMATE factor */
+    int32_t multiplier;             /* SCALE, Q16 */
+    int32_t offset;                 /* SCALE, added after the multiply */
+} sens_stage_t;
+
+#define SENS_EMA(shift) {SENS_FILTER_EMA, (shift), 0, 0}
+#define SENS_MEDIAN(length) {SENS_FILTER_MEDIAN, (length), 0, 0}
+#define SENS_DECIMATE(factor) {SENS_FILTER_DECIMATE, (factor), 0, 0}
+#define SENS_SCALE(multiplier, offset) {SENS_FILTER_SCALE, 0, (multiplier), (offset)}
+
+typedef struct {
+    union {
+        struct {
+            int32_t accumulator;    /* average << shift */
+            bool primed;
+        } ema;
+        struct {
+            int32_t window[SENS_MEDIAN_MAX];    /* in arrival order, a ring */
+            int32_t sorted[SENS_MEDIAN_MAX];
+            uint8_t count;
+            uint8_t next;
+        } median;
+        struct {
+            int32_t sum;
+            uint8_t count;
+        } decimate;
+    };
+} sens_stage_state_t;
+
+typedef struct {
+    uint32_t samples;               /* raw samples pushed */
+    uint32_t outputs;               /* values out of the last stage */
+    uint32_t published;             /* outputs that passed the gate */
+} sens_pipeline_stats_t;
+
+typedef struct {
+    sens_stage_t stages[SENS_MAX_STAGES];
+    sens_stage_state_t state[SENS_MAX_STAGES];
+    uint8_t stageCount;
+    int32_t delta;
+    bool published;
+    int32_t lastPublished;
+    int32_t lastOutput;
+    sens_pipeline_stats_t stats;
+} sens_pipeline_t;
+
+/* ESP_ERR_INVALID_ARG for too many stages, an EMA shift of 0 or over SENS_EMA_MAX_SHIFT, an even or oversized median
+ * window, or a decimation factor under 2. A delta of 0 publishes every output that differs from the last published.
+ */
+esp_err_t SENS_PipelineInit(sens_pipeline_t *pipeline, const sens_stage_t *stages, uint8_t stageCount, int32_t delta);
+
+/* Forget the filter history and the last published value, as after the source is reconnected */
+void SENS_PipelineReset(sens_pipeline_t *pipeline);
+
+/* Run one sample through the stages; true with the output when one comes out of the last stage */
+bool SENS_PipelineFilter(sens_pipeline_t *pipeline, int32_t sample, int32_t *output);
+
+/* Filter a sample and gate the result; true with the value when it should be published. Call
+ * SENS_PipelineCommit() once it has been, so a failed write is offered again with the next output.
+ */
+bool SENS_PipelinePush(sens_pipeline_t *pipeline, int32_t sample, int32_t *value);
+void SENS_PipelineCommit(sens_pipeline_t *pipeline, int32_t value);
+
+const char *SENS_FilterTypeToString(sens_filter_type_t type);
@@ -0,0 +1,322 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Memory/memory_pool.h"
+#include "Sensors/sensors.h"
+#include "Zigbee/zigbee.h"
+
+#define SENS_NEVER UINT32_MAX
+
+typedef struct {
+    sens_channel_config_t config;
+    sens_pipeline_t pipeline;
+    uint32_t nextMs;
+    uint32_t pulses;                            /* COUNTER edges since the last sample, counted by interrupt */
+} sens_channel_t;
+
+static sens_channel_t channels[SENS_MAX_CHANNELS];
+static uint8_t channelCount = 0;
+static uint8_t adcPins[SENS_MAX_CHANNELS];     /* each once, in the order the ADC returns them */
+static uint8_t adcPinCount = 0;
+static TaskHandle_t sensorTask = NULL;
+static bool adcRunning = false;
+static portMUX_TYPE sensMux = portMUX_INITIALIZER_UNLOCKED;
+static sens_stats_t sensStats;
+
+static bool isSupportedType(uint8_t type) {
+    switch (type) {
+        case ESP_ZB_ZCL_ATTR_TYPE_U8:
+        case ESP_ZB_ZCL_ATTR_TYPE_U16:
+        case ESP_ZB_ZCL_ATTR_TYPE_U32:
+        case ESP_ZB_ZCL_ATTR_TYPE_S8:
+        case ESP_ZB_ZCL_ATTR_TYPE_S16:
+        case ESP_ZB_ZCL_ATTR_TYPE_S32:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int32_t clamp(int32_t value, int32_t min, int32_t max) {
+    return value < min ? min : value > max ? max : value;
+}
+
+// Write a value in the attribute's type, saturating short of the ZCL invalid value for that type
+static esp_err_t writeAttribute(const sens_channel_config_t *config, int32_t value) {
+    union {
+        uint8_t u8;
+        uint16_t u16;
+        uint32_t u32;
+        int8_t s8;
+        int16_t s16;
+        int32_t s32;
+    } encoded;
+
+    switch (config->attributeType) {
+        case ESP_ZB_ZCL_ATTR_TYPE_U8: encoded.u8 = clamp(value, 0, 0xfe); break;
+        case ESP_ZB_ZCL_ATTR_TYPE_U16: encoded.u16 = clamp(value, 0, 0xfffe); break;
+        case ESP_ZB_ZCL_ATTR_TYPE_U32: encoded.u32 = value < 0 ? 0 : value; break;
+        case ESP_ZB_ZCL_ATTR_TYPE_S8: encoded.s8 = clamp(value, -0x7f, 0x7f); break;
+        case ESP_ZB_ZCL_ATTR_TYPE_S16: encoded.s16 = clamp(value, -0x7fff, 0x7fff); break;
+        default: encoded.s32 = value == INT32_MIN ? INT32_MIN + 1 : value; break;
+    }
+
+    return ZB_SetAttributeValue(config->endpoint, config->cluster, config->attribute, &encoded);
+}
+
+static void pushSample(sens_channel_t *channel, int32_t sample) {
+    int32_t value;
+
+    portENTER_CRITICAL(&sensMux);
+    bool publish = SENS_PipelinePush(&channel->pipeline, sample, &value);
+    portEXIT_CRITICAL(&sensMux);
+
+    if (!publish) {
+        return;
+    }
+
+    esp_err_t err = writeAttribute(&channel->config, value);
+
+    portENTER_CRITICAL(&sensMux);
+    if (err == ESP_OK) {
+        SENS_PipelineCommit(&channel->pipeline, value);
+    } else {
+        sensStats.writeFailures++;
+    }
+    portEXIT_CRITICAL(&sensMux);
+}
+
+static void samplePolled(sens_channel_t *channel) {
+    int32_t sample;
+
+    if (channel->config.source == SENS_SOURCE_COUNTER) {
+        portENTER_CRITICAL(&sensMux);
+        sample = channel->pulses;
+        channel->pulses = 0;
+        portEXIT_CRITICAL(&sensMux);
+    } else if (channel->config.read(channel->config.context, &sample) != ESP_OK) {
+        portENTER_CRITICAL(&sensMux);
+        sensStats.readFailures++;
+        portEXIT_CRITICAL(&sensMux);
+        return;
+    }
+
+    pushSample(channel, sample);
+}
+
+// Feed each pin's average from the last completed frame to the channels on that pin
+static void drainAdc() {
+    adc_continuous_data_t *results = NULL;
+
+    if (!adcRunning || !analogContinuousRead(&results, 0)) {
+        return;
+    }
+
+    portENTER_CRITICAL(&sensMux);
+    sensStats.adcFrames++;
+    portEXIT_CRITICAL(&sensMux);
+
+    for (uint8_t i = 0; i < channelCount; i++) {
+        sens_channel_t *channel = &channels[i];
+        if (channel->config.source != SENS_SOURCE_ADC) {
+            continue;
+        }
+
+        for (uint8_t pin = 0; pin < adcPinCount; pin++) {
+            if (results[pin].pin == channel->config.pin) {
+                pushSample(channel, results[pin].avg_read_mvolts);
+                break;
+            }
+        }
+    }
+}
+
+static void IRAM_ATTR onCounterEdge(void *arg) {
+    sens_channel_t *channel = (sens_channel_t *)arg;
+
+    portENTER_CRITICAL_ISR(&sensMux);
+    channel->pulses++;
+    portEXIT_CRITICAL_ISR(&sensMux);
+}
+
+static void IRAM_ATTR onAdcFrame() {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+
+    // A frame completed before the task exists waits for its first pass
+    if (sensorTask == NULL) {
+        return;
+    }
+
+    vTaskNotifyGiveFromISR(sensorTask, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+static void taskSensors(void *arg) {
+    for (;;) {
+        uint32_t now = millis();
+        uint32_t waitMs = SENS_NEVER;
+
+        portENTER_CRITICAL(&sensMux);
+        sensStats.wakeups++;
+        portEXIT_CRITICAL(&sensMux);
+
+        drainAdc();
+
+        for (uint8_t i = 0; i < channelCount; i++) {
+            sens_channel_t *channel = &channels[i];
+            if (channel->config.source == SENS_SOURCE_ADC) {
+                continue;
+            }
+
+            if ((int32_t)(now - channel->nextMs) >= 0) {
+                samplePolled(channel);
+
+                // Keep to the period, unless sampling fell a whole period behind
+                channel->nextMs += channel->config.periodMs;
+                if ((int32_t)(now - channel->nextMs) >= 0) {
+                    channel->nextMs = now + channel->config.periodMs;
+                }
+            }
+
+            uint32_t untilMs = channel->nextMs - now;
+            if (untilMs < waitMs) {
+                waitMs = untilMs;
+            }
+        }
+
+        // Sleep until the next polled sample is due, or until the ADC completes a frame
+        TickType_t ticks = portMAX_DELAY;
+        if (waitMs != SENS_NEVER) {
+            ticks = pdMS_TO_TICKS(waitMs);
+            ticks = ticks ? ticks : 1;
+        }
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+
+// External interface functions
+esp_err_t SENS_AddChannel(const sens_channel_config_t *config, uint8_t *channel) {
+    if (sensorTask) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (channelCount == SENS_MAX_CHANNELS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    bool valid;
+    switch (config->source) {
+        case SENS_SOURCE_ADC:
+            valid = true;
+            break;
+        case SENS_SOURCE_COUNTER:
+            valid = config->periodMs > 0;
+            break;
+        case SENS_SOURCE_READ:
+            valid = config->periodMs > 0 && config->read != NULL;
+            break;
+        default:
+            valid = false;
+            break;
+    }
+    if (!valid || !isSupportedType(config->attributeType)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sens_channel_t *added = &channels[channelCount];
+    esp_err_t err = SENS_PipelineInit(&added->pipeline, config->stages, config->stageCount, config->delta);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    added->config = *config;
+    added->config.stages = NULL;                // the pipeline holds its own copy
+    added->pulses = 0;
+
+    if (channel) {
+        *channel = channelCount;
+    }
+    channelCount++;
+    return ESP_OK;
+}
+
+void SENS_Start() {
+    if (channelCount == 0 || sensorTask) {
+        return;
+    }
+
+    uint32_t now = millis();
+
+    for (uint8_t i = 0; i < channelCount; i++) {
+        sens_channel_t *channel = &channels[i];
+        channel->nextMs = now;
+
+        if (channel->config.source == SENS_SOURCE_ADC) {
+            // Channels may share a pin, e.g. to publish a fast and a slow average of it
+            bool known = false;
+            for (uint8_t pin = 0; pin < adcPinCount; pin++) {
+                known |= adcPins[pin] == channel->config.pin;
+            }
+            if (!known) {
+                adcPins[adcPinCount++] = channel->config.pin;
+            }
+        } else if (channel->config.source == SENS_SOURCE_COUNTER) {
+            pinMode(channel->config.pin, INPUT);
+            attachInterruptArg(channel->config.pin, onCounterEdge, channel, RISING);
+        }
+    }
+
+    // The ADC is running before the task is, so its first pass never reads an unconfigured one
+    if (adcPinCount) {
+        if (!analogContinuous(adcPins, adcPinCount, SENS_ADC_CONVERSIONS_PER_PIN, SENS_ADC_SAMPLE_RATE_HZ, onAdcFrame) || !analogContinuousStart()) {
+            log_e("Failed to start the ADC in continuous mode");
+        } else {
+            adcRunning = true;
+        }
+    }
+
+    sensorTask = MEM_CreateTask(taskSensors, SENS_TASK_NAME, SENS_TASK_STACK_SIZE, NULL, SENS_TASK_PRIORITY);
+    if (sensorTask == NULL) {
+        log_e("Failed to start the sensors task");
+        if (adcRunning) {
+            analogContinuousStop();
+            analogContinuousDeinit();
+            adcRunning = false;
+        }
+        return;
+    }
+
+    log_i("Sampling %d sensor channels, %d on the ADC", channelCount, adcPinCount);
+}
+
+void SENS_GetStats(sens_stats_t *stats) {
+    portENTER_CRITICAL(&sensMux);
+    *stats = sensStats;
+    portEXIT_CRITICAL(&sensMux);
+}
+
+esp_err_t SENS_GetChannelStats(uint8_t channel, sens_channel_stats_t *stats) {
+    if (channel >= channelCount) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&sensMux);
+    const sens_pipeline_t *pipeline = &channels[channel].pipeline;
+    stats->pipeline = pipeline->stats;
+    stats->lastOutput = pipeline->lastOutput;
+    stats->lastPublished = pipeline->lastPublished;
+    stats->published = pipeline->published;
+    portEXIT_CRITICAL(&sensMux);
+
+    return ESP_OK;
+}
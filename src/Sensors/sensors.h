@@ -0,0 +1,97 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Sensor sampling
+ * One low-priority task samples every channel and sleeps in between: polled sources at their own period, ADC channels
+ * whenever the ADC's continuous (DMA) mode completes a frame of averaged conversions. Each sample runs through the
+ * channel's sensor_filter.h pipeline, and a filtered value is written to its Zigbee attribute only once it has moved by
+ * the channel's delta, so a steady reading costs no attribute writes, reports or radio wakeups at all.
+ *
+ * Sources:
+ *  - SENS_SOURCE_ADC: millivolts on an ADC pin, SENS_ADC_CONVERSIONS_PER_PIN conversions averaged by the driver per frame
+ *  - SENS_SOURCE_COUNTER: rising edges counted on a GPIO by interrupt, sampled as the count over each period
+ *  - SENS_SOURCE_READ: a callback, e.g. reading an I2C sensor, called each period; a failed read skips the sample
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#include "Sensors/sensor_filter.h"
+
+#define SENS_TASK_NAME "Sensors"
+#define SENS_TASK_STACK_SIZE 2048
+#define SENS_TASK_PRIORITY 3
+
+#ifndef SENS_MAX_CHANNELS
+#define SENS_MAX_CHANNELS 8
+#endif
+
+/* ADC continuous mode: a frame every SENS_ADC_CONVERSIONS_PER_PIN * ADC pins / SENS_ADC_SAMPLE_RATE_HZ seconds */
+#ifndef SENS_ADC_SAMPLE_RATE_HZ
+#define SENS_ADC_SAMPLE_RATE_HZ 1000
+#endif
+
+#ifndef SENS_ADC_CONVERSIONS_PER_PIN
+#define SENS_ADC_CONVERSIONS_PER_PIN 64
+#endif
+
+typedef enum {
+    SENS_SOURCE_ADC,
+    SENS_SOURCE_COUNTER,
+    SENS_SOURCE_READ,
+} sens_source_type_t;
+
+/* Reads one sample; anything but ESP_OK skips it */
+typedef esp_err_t (*sens_read_callback_t)(void *context, int32_t *value);
+
+typedef struct {
+    sens_source_type_t source;
+    uint8_t pin;                                /* ADC & COUNTER */
+    uint32_t periodMs;                          /* COUNTER & READ, between samples */
+    sens_read_callback_t read;                  /* READ */
+    void *context;
+    const sens_stage_t *stages;                 /* filter chain, copied */
+    uint8_t stageCount;
+    int32_t delta;                              /* least change, after filtering, worth writing to the attribute */
+    uint8_t endpoint;
+    uint16_t cluster;
+    uint16_t attribute;                         /* a server attribute of the device descriptor */
+    uint8_t attributeType;                      /* ESP_ZB_ZCL_ATTR_TYPE_U8/16/32 or S8/16/32; values saturate to fit */
+} sens_channel_config_t;
+
+typedef struct {
+    uint32_t wakeups;                           /* times the task woke */
+    uint32_t adcFrames;
+    uint32_t readFailures;
+    uint32_t writeFailures;                     /* attribute writes refused, offered again with the next output */
+} sens_stats_t;
+
+typedef struct {
+    sens_pipeline_stats_t pipeline;
+    int32_t lastOutput;                         /* from the last stage, published or not */
+    int32_t lastPublished;
+    bool published;
+} sens_channel_stats_t;
+
+/* Add a channel before SENS_Start(), returning its index in *channel if not NULL. ESP_ERR_INVALID_ARG for a bad source,
+ * filter chain or attribute type, ESP_ERR_NO_MEM once SENS_MAX_CHANNELS are added, ESP_ERR_INVALID_STATE once started.
+ */
+esp_err_t SENS_AddChannel(const sens_channel_config_t *config, uint8_t *channel);
+
+/* Start sampling; call after ZB_StartMainTask(). Does nothing without channels */
+void SENS_Start();
+
+/* Callable from any task */
+void SENS_GetStats(sens_stats_t *stats);
+esp_err_t SENS_GetChannelStats(uint8_t channel, sens_channel_stats_t *stats);
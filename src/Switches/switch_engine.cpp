@@ -0,0 +1,191 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Switches/switch_engine.h"
+
+typedef enum {
+    SWITCH_INPUT_DOWN,          /* debounce settled with the pin low */
+    SWITCH_INPUT_UP,            /* debounce settled with the pin high */
+    SWITCH_INPUT_TIMEOUT,       /* gesture deadline reached */
+    SWITCH_INPUT_COUNT,
+} switch_input_t;
+
+typedef enum {
+    SWITCH_ACTION_NONE,         /* nothing changes, any pending deadline still stands */
+    SWITCH_ACTION_CANCEL,       /* bounce or glitch, back to idle */
+    SWITCH_ACTION_START_HOLD,   /* press settled, start timing a long press */
+    SWITCH_ACTION_SECOND_PRESS, /* pressed again inside the double-click window */
+    SWITCH_ACTION_RELEASED,     /* released before the long press timeout */
+    SWITCH_ACTION_LONG_PRESS,
+    SWITCH_ACTION_REPEAT,
+    SWITCH_ACTION_HOLD_RELEASE,
+    SWITCH_ACTION_SHORT_PRESS,  /* double-click window expired */
+} switch_action_t;
+
+typedef struct {
+    switch_state_t next;
+    switch_action_t action;
+} switch_transition_t;
+
+// Rows are indexed by switch_state_t, columns by switch_input_t
+static const switch_transition_t transitions[][SWITCH_INPUT_COUNT] = {
+    /* state                      DOWN                                                UP                                             TIMEOUT */
+    /* SWITCH_IDLE */             {{SWITCH_PRESS_DETECTED, SWITCH_ACTION_START_HOLD},   {SWITCH_IDLE, SWITCH_ACTION_NONE},             {SWITCH_IDLE, SWITCH_ACTION_NONE}},
+    /* SWITCH_PRESS_ARMED */      {{SWITCH_PRESS_DETECTED, SWITCH_ACTION_START_HOLD},   {SWITCH_IDLE, SWITCH_ACTION_CANCEL},           {SWITCH_PRESS_ARMED, SWITCH_ACTION_NONE}},
+    /* SWITCH_PRESS_DETECTED */   {{SWITCH_PRESS_DETECTED, SWITCH_ACTION_NONE},         {SWITCH_IDLE, SWITCH_ACTION_RELEASED},         {SWITCH_PRESSED, SWITCH_ACTION_LONG_PRESS}},
+    /* SWITCH_PRESSED */          {{SWITCH_PRESSED, SWITCH_ACTION_NONE},                {SWITCH_IDLE, SWITCH_ACTION_HOLD_RELEASE},     {SWITCH_PRESSED, SWITCH_ACTION_REPEAT}},
+    /* SWITCH_RELEASE_DETECTED */ {{SWITCH_PRESS_DETECTED, SWITCH_ACTION_SECOND_PRESS}, {SWITCH_RELEASE_DETECTED, SWITCH_ACTION_NONE}, {SWITCH_IDLE, SWITCH_ACTION_SHORT_PRESS}},
+};
+
+// Wrap-safe "a is before b" for millisecond tick counts
+static inline bool isBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline void emit(switch_event_t event, switch_event_t *events, uint8_t *eventCount) {
+    if (*eventCount < SWITCH_ENGINE_MAX_EVENTS) {
+        events[(*eventCount)++] = event;
+    }
+}
+
+static inline void setDeadline(switch_engine_pin_t *pin, uint32_t nowMs, uint16_t delayMs) {
+    pin->hasDeadline = delayMs != 0;
+    pin->deadline = nowMs + delayMs;
+}
+
+void SW_EngineInit(switch_engine_pin_t *pin, const switch_timing_t *timing) {
+    memset(pin, 0, sizeof(*pin));
+    pin->timing = timing;
+    pin->state = SWITCH_IDLE;
+}
+
+uint32_t IRAM_ATTR SW_EngineOnEdge(switch_engine_pin_t *pin, uint32_t nowMs) {
+    if (pin->state == SWITCH_IDLE) {
+        pin->state = SWITCH_PRESS_ARMED;
+    }
+
+    // Every edge restarts the settle time, so the level is only sampled once it has been stable for a full period
+    pin->debouncing = true;
+    pin->debounceUntil = nowMs + pin->timing->debounceMs;
+    pin->edges++;
+
+    return pin->timing->debounceMs;
+}
+
+uint32_t SW_EngineNextDelay(const switch_engine_pin_t *pin, uint32_t nowMs) {
+    uint32_t due;
+
+    // Gesture deadlines wait for the level to settle first
+    if (pin->debouncing) {
+        due = pin->debounceUntil;
+    } else if (pin->hasDeadline) {
+        due = pin->deadline;
+    } else {
+        return 0;
+    }
+
+    // Anything already due fires on the next tick
+    return isBefore(nowMs, due) ? due - nowMs : 1;
+}
+
+uint32_t SW_EngineOnTimer(switch_engine_pin_t *pin, int level, uint32_t nowMs, switch_event_t events[SWITCH_ENGINE_MAX_EVENTS], uint8_t *eventCount) {
+    const switch_timing_t *timing = pin->timing;
+    switch_input_t input;
+
+    *eventCount = 0;
+
+    if (pin->debouncing && !isBefore(nowMs, pin->debounceUntil)) {
+        pin->debouncing = false;
+        input = (level == LOW) ? SWITCH_INPUT_DOWN : SWITCH_INPUT_UP;
+    } else if (!pin->debouncing && pin->hasDeadline && !isBefore(nowMs, pin->deadline)) {
+        pin->hasDeadline = false;
+        input = SWITCH_INPUT_TIMEOUT;
+    } else {
+        return SW_EngineNextDelay(pin, nowMs);
+    }
+
+    const switch_transition_t *transition = &transitions[pin->state][input];
+    pin->state = transition->next;
+
+    switch (transition->action) {
+        case SWITCH_ACTION_NONE:
+            break;
+
+        case SWITCH_ACTION_CANCEL:
+            pin->hasDeadline = false;
+            pin->secondClick = false;
+            break;
+
+        case SWITCH_ACTION_START_HOLD:
+            setDeadline(pin, nowMs, timing->longPressMs);
+            break;
+
+        case SWITCH_ACTION_SECOND_PRESS:
+            pin->secondClick = true;
+            setDeadline(pin, nowMs, timing->longPressMs);
+            break;
+
+        case SWITCH_ACTION_RELEASED:
+            if (pin->secondClick) {
+                pin->secondClick = false;
+                pin->hasDeadline = false;
+                emit(SWITCH_EVENT_DOUBLE_CLICK, events, eventCount);
+            } else if (timing->doubleClickMs) {
+                pin->state = SWITCH_RELEASE_DETECTED;
+                setDeadline(pin, nowMs, timing->doubleClickMs);
+            } else {
+                pin->hasDeadline = false;
+                emit(SWITCH_EVENT_SHORT_PRESS, events, eventCount);
+            }
+            break;
+
+        case SWITCH_ACTION_LONG_PRESS:
+            // A click followed by a hold is a short press, then a long press
+            if (pin->secondClick) {
+                pin->secondClick = false;
+                emit(SWITCH_EVENT_SHORT_PRESS, events, eventCount);
+            }
+            emit(SWITCH_EVENT_LONG_PRESS, events, eventCount);
+            setDeadline(pin, nowMs, timing->repeatMs);
+            break;
+
+        case SWITCH_ACTION_REPEAT:
+            emit(SWITCH_EVENT_HOLD_REPEAT, events, eventCount);
+            setDeadline(pin, nowMs, timing->repeatMs);
+            break;
+
+        case SWITCH_ACTION_HOLD_RELEASE:
+            pin->hasDeadline = false;
+            emit(SWITCH_EVENT_HOLD_RELEASE, events, eventCount);
+            break;
+
+        case SWITCH_ACTION_SHORT_PRESS:
+            emit(SWITCH_EVENT_SHORT_PRESS, events, eventCount);
+            break;
+    }
+
+    return SW_EngineNextDelay(pin, nowMs);
+}
+
+const char *SW_EventToString(switch_event_t event) {
+    switch (event) {
+        case SWITCH_EVENT_SHORT_PRESS: return "short press";
+        case SWITCH_EVENT_LONG_PRESS: return "long press";
+        case SWITCH_EVENT_DOUBLE_CLICK: return "double click";
+        case SWITCH_EVENT_HOLD_REPEAT: return "hold repeat";
+        case SWITCH_EVENT_HOLD_RELEASE: return "hold release";
+        default: return "none";
+    }
+}
@@ -0,0 +1,81 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Per-pin debounce & gesture state machine
+ * Pure logic with no timers or GPIO access of its own: the caller feeds it edges and timer expiries along with the
+ * current time in milliseconds, and arms a one-shot timer for whatever delay it returns.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Default timings, in milliseconds */
+#define SWITCH_DEBOUNCE_MS 20
+#define SWITCH_LONG_PRESS_MS 1000
+#define SWITCH_DOUBLE_CLICK_MS 300
+#define SWITCH_REPEAT_MS 250
+
+typedef enum {
+    SWITCH_IDLE,                /* released and settled */
+    SWITCH_PRESS_ARMED,         /* edge seen from idle, waiting for the level to settle */
+    SWITCH_PRESS_DETECTED,      /* settled low, waiting for release or the long press timeout */
+    SWITCH_PRESSED,             /* held past the long press timeout, repeating */
+    SWITCH_RELEASE_DETECTED,    /* released after a short press, waiting out the double-click window */
+} switch_state_t;
+
+typedef enum {
+    SWITCH_EVENT_NONE,
+    SWITCH_EVENT_SHORT_PRESS,
+    SWITCH_EVENT_LONG_PRESS,
+    SWITCH_EVENT_DOUBLE_CLICK,
+    SWITCH_EVENT_HOLD_REPEAT,
+    SWITCH_EVENT_HOLD_RELEASE,
+} switch_event_t;
+
+typedef struct {
+    uint16_t debounceMs;
+    uint16_t longPressMs;       /* 0 disables long presses, so a press held any length reports as a short press on release */
+    uint16_t doubleClickMs;     /* 0 disables double-click detection, so short presses report as soon as they are released */
+    uint16_t repeatMs;          /* 0 disables hold-repeat */
+} switch_timing_t;
+
+typedef struct {
+    const switch_timing_t *timing;
+    switch_state_t state;
+    bool debouncing;
+    bool secondClick;
+    bool hasDeadline;
+    uint32_t debounceUntil;
+    uint32_t deadline;
+    uint32_t edges;
+} switch_engine_pin_t;
+
+/* Most events a single step can emit (a pending short press followed by a long press) */
+#define SWITCH_ENGINE_MAX_EVENTS 2
+
+void SW_EngineInit(switch_engine_pin_t *pin, const switch_timing_t *timing);
+
+/* Record an edge on the pin; returns the delay in ms to arm the pin's timer for */
+uint32_t SW_EngineOnEdge(switch_engine_pin_t *pin, uint32_t nowMs);
+
+/* Evaluate the pin when its timer expires, given the current (active low) pin level.
+ * Emitted events are written to events[], and the delay to re-arm the timer for is returned (0 = leave it stopped).
+ * Early or stale expiries are harmless: they re-arm for whatever is still pending.
+ */
+uint32_t SW_EngineOnTimer(switch_engine_pin_t *pin, int level, uint32_t nowMs, switch_event_t events[SWITCH_ENGINE_MAX_EVENTS], uint8_t *eventCount);
+
+/* Delay until the pin next needs evaluating, 0 if nothing is pending */
+uint32_t SW_EngineNextDelay(const switch_engine_pin_t *pin, uint32_t nowMs);
+
+const char *SW_EventToString(switch_event_t event);
@@ -13,86 +13,287 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <atomic>
+
 #include "Switches/switches.h"
+#include "Memory/memory_pool.h"
+#include "Trace/trace.h"
 #include "Zigbee/zigbee.h"
+#include "freertos/timers.h"
+
+#define SWITCH_EVENT_QUEUE_LENGTH 10
+
+typedef struct {
+    switch_func_pair_t *button;
+    switch_engine_pin_t engine;
+    TimerHandle_t timer;
+    int64_t lastEdgeUs;             /* when the input last changed, the start of press-to-transmit latency */
+    bool dimUp;                     /* direction of the next hold on a dimmer */
+    bool rearmPending;              /* the ISR could not queue the timer command, so SW_Loop() arms it instead */
+} switch_input_state_t;
+
+typedef struct {
+    switch_func_pair_t *button;
+    switch_event_t event;
+} switch_event_message_t;
+
+static const switch_timing_t defaultSwitchTiming = {SWITCH_DEBOUNCE_MS, SWITCH_LONG_PRESS_MS, SWITCH_DOUBLE_CLICK_MS, SWITCH_REPEAT_MS};
+
+/********************* Switch configuration **************************/
+// Factory reset acts on any press however long it is held, so there is no long press, and it skips the double-click
+// window to report as soon as it is released
+static const switch_timing_t resetSwitchTiming = {SWITCH_DEBOUNCE_MS, 0, 0, 0};
+
+// Light switches act on release too, rather than waiting out a double-click window on every press
+static const switch_timing_t controlSwitchTiming = {SWITCH_DEBOUNCE_MS, SWITCH_LONG_PRESS_MS / 2, 0, 0};
+
+switch_func_pair_t button_func_pair[] = {
+    {GPIO_FACTORY_RESET_SWITCH, SWITCH_RESET_CONTROL, &resetSwitchTiming, 0, 0},
+#ifdef GPIO_DIMMER_SWITCH
+    {GPIO_DIMMER_SWITCH, SWITCH_LEVEL_CONTROL, &controlSwitchTiming, 0, 0},
+#endif
+};
+const size_t button_func_pair_count = PAIR_SIZE(button_func_pair);
+
+// Callback function to main application logic
+void (*onSwitchEventCallback)(const switch_func_pair_t *button, switch_event_t event) = NULL;
 
 /********************* GPIO functions **************************/
 static QueueHandle_t gpioEventQueue = NULL;
+static switch_input_state_t switchInputs[PAIR_SIZE(button_func_pair)];
+static portMUX_TYPE switchMux = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<uint8_t> eventQueuePeak(0);
+
+static inline TickType_t switchDelayTicks(uint32_t delayMs) {
+    TickType_t ticks = pdMS_TO_TICKS(delayMs);
+    return ticks ? ticks : 1;
+}
 
 static void IRAM_ATTR gpioIsrHandler(void *arg) {
-    xQueueSendFromISR(gpioEventQueue, (switch_func_pair_t *)arg, NULL);
+    switch_input_state_t *input = (switch_input_state_t *)arg;
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+
+    portENTER_CRITICAL_ISR(&switchMux);
+    uint32_t delayMs = SW_EngineOnEdge(&input->engine, pdTICKS_TO_MS(xTaskGetTickCountFromISR()));
+    input->lastEdgeUs = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&switchMux);
+
+    // Changing the period also restarts the timer, so each edge pushes the settle time out again
+    if (xTimerChangePeriodFromISR(input->timer, switchDelayTicks(delayMs), &higherPriorityTaskWoken) != pdPASS) {
+        // The timer command queue is full; without the timer the pin would sit waiting for its debounce forever, so
+        // wake SW_Loop() to arm it. A full event queue means SW_Loop() has events to take anyway.
+        switch_event_message_t wake = {NULL, SWITCH_EVENT_NONE};
+        portENTER_CRITICAL_ISR(&switchMux);
+        input->rearmPending = true;
+        portEXIT_CRITICAL_ISR(&switchMux);
+        xQueueSendFromISR(gpioEventQueue, &wake, &higherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
 }
 
-static void setGpioInterruptEnabled(bool enabled) {
-    for (int i = 0; i < PAIR_SIZE(button_func_pair); ++i) {
-        if (enabled) {
-            enableInterrupt((button_func_pair[i]).pin);
-        } else {
-            disableInterrupt((button_func_pair[i]).pin);
+// Arm the timers whose command the ISR could not queue, for whatever their pins are still waiting on
+static void rearmDroppedTimers() {
+    for (switch_input_state_t &input : switchInputs) {
+        portENTER_CRITICAL(&switchMux);
+        bool pending = input.rearmPending;
+        input.rearmPending = false;
+        uint32_t delayMs = pending ? SW_EngineNextDelay(&input.engine, pdTICKS_TO_MS(xTaskGetTickCount())) : 0;
+        portEXIT_CRITICAL(&switchMux);
+
+        if (delayMs) {
+            xTimerChangePeriod(input.timer, switchDelayTicks(delayMs), portMAX_DELAY);
+        }
+    }
+}
+
+// The command a control switch sends for an event, if any
+static bool controlCommand(switch_input_state_t *input, switch_event_t event, zb_control_command_t *command) {
+    const switch_func_pair_t *button = input->button;
+
+    switch (button->func) {
+        case SWITCH_ONOFF_CONTROL:
+            if (event == SWITCH_EVENT_SHORT_PRESS || event == SWITCH_EVENT_DOUBLE_CLICK) {
+                command->action = ZB_CONTROL_TOGGLE;
+            } else if (event == SWITCH_EVENT_LONG_PRESS) {
+                command->action = ZB_CONTROL_OFF;
+            } else {
+                return false;
+            }
+            break;
+
+        case SWITCH_LEVEL_CONTROL:
+            if (event == SWITCH_EVENT_SHORT_PRESS || event == SWITCH_EVENT_DOUBLE_CLICK) {
+                command->action = ZB_CONTROL_TOGGLE;
+            } else if (event == SWITCH_EVENT_LONG_PRESS) {
+                command->action = input->dimUp ? ZB_CONTROL_LEVEL_MOVE_UP : ZB_CONTROL_LEVEL_MOVE_DOWN;
+                input->dimUp = !input->dimUp;
+            } else if (event == SWITCH_EVENT_HOLD_RELEASE) {
+                command->action = ZB_CONTROL_LEVEL_STOP;
+            } else {
+                return false;
+            }
+            break;
+
+        case SWITCH_SCENE_CONTROL:
+            if (event != SWITCH_EVENT_SHORT_PRESS && event != SWITCH_EVENT_DOUBLE_CLICK) {
+                return false;
+            }
+            command->action = ZB_CONTROL_SCENE_RECALL;
+            break;
+
+        default:
+            return false;
+    }
+
+    command->endpoint = HA_ESP_SENSOR_ENDPOINT;
+    command->group = button->group;
+    command->sceneId = button->sceneId;
+    command->amount = 0;
+    return true;
+}
+
+// Control switches queue their command from here, ahead of anything loop() may be busy with, then the event goes on to loop()
+static void handleEvent(switch_input_state_t *input, switch_event_t event, int64_t lastEdgeUs) {
+    switch_event_message_t message = {input->button, event};
+
+    TRACE_RecordSwitch(input->button->pin, event);
+
+    zb_control_command_t command;
+    if (controlCommand(input, event, &command)) {
+        bool fromEdge = event != SWITCH_EVENT_LONG_PRESS && event != SWITCH_EVENT_HOLD_REPEAT;
+        command.inputUs = fromEdge ? lastEdgeUs : 0;
+        if (ZB_SendControlCommand(&command) != ESP_OK) {
+            log_w("Control queue full, dropping %s on pin %d", ZB_ControlActionToString(command.action), input->button->pin);
         }
     }
+
+    if (xQueueSend(gpioEventQueue, &message, 0) != pdPASS) {
+        log_w("Switch event queue full, dropping %s on pin %d", SW_EventToString(event), input->button->pin);
+    }
+}
+
+// Runs on the FreeRTOS timer task, one timer per switch, so pins debounce independently of each other and of loop()
+static void onSwitchTimer(TimerHandle_t timer) {
+    switch_input_state_t *input = (switch_input_state_t *)pvTimerGetTimerID(timer);
+    switch_event_t events[SWITCH_ENGINE_MAX_EVENTS];
+    uint8_t eventCount;
+    int level = digitalRead(input->button->pin);
+    uint32_t now = pdTICKS_TO_MS(xTaskGetTickCount());
+
+    portENTER_CRITICAL(&switchMux);
+    uint32_t delayMs = SW_EngineOnTimer(&input->engine, level, now, events, &eventCount);
+    uint32_t edges = input->engine.edges;
+    portEXIT_CRITICAL(&switchMux);
+
+    if (delayMs) {
+        xTimerChangePeriod(timer, switchDelayTicks(delayMs), 0);
+    }
+
+    // An edge landing between the evaluation and the re-arm above had its debounce period overwritten, so restore it
+    portENTER_CRITICAL(&switchMux);
+    bool edgeRaced = input->engine.edges != edges;
+    delayMs = SW_EngineNextDelay(&input->engine, now);
+    portEXIT_CRITICAL(&switchMux);
+
+    if (edgeRaced && delayMs) {
+        xTimerChangePeriod(timer, switchDelayTicks(delayMs), 0);
+    }
+
+    // Events ending on a release count from that edge; a long press is decided by the timer, so counts from now
+    portENTER_CRITICAL(&switchMux);
+    int64_t lastEdgeUs = input->lastEdgeUs;
+    portEXIT_CRITICAL(&switchMux);
+
+    for (uint8_t i = 0; i < eventCount; i++) {
+        handleEvent(input, events[i], lastEdgeUs);
+    }
+
+    // Only the timer task fills the queue, so the peak needs no compare-and-swap
+    uint8_t waiting = (uint8_t)uxQueueMessagesWaiting(gpioEventQueue);
+    if (waiting > eventQueuePeak.load(std::memory_order_relaxed)) {
+        eventQueuePeak.store(waiting, std::memory_order_relaxed);
+    }
 }
 
-static void onButtonPress(switch_func_pair_t *button_func_pair) {
+static void onButtonEvent(switch_func_pair_t *button_func_pair, switch_event_t event) {
     switch (button_func_pair->func) {
         case SWITCH_RESET_CONTROL:
-            ZB_FactoryReset();
+            if (event == SWITCH_EVENT_SHORT_PRESS) {
+                ZB_FactoryReset();
+            }
+            break;
+
+        default:
+            // Control switches were handled on the timer task
             break;
     }
 }
 
 void SW_InitSwitches() {
+    /* create a queue to pass debounced switch events to loop() */
+    gpioEventQueue = MEM_CreateQueue(SWITCH_EVENT_QUEUE_LENGTH, sizeof(switch_event_message_t));
+    if (gpioEventQueue == 0) {
+        log_e("Queue was not created and must not be used");
+        while (1);
+    }
+
     // Init button switch
     for (int i = 0; i < PAIR_SIZE(button_func_pair); i++) {
-        pinMode(button_func_pair[i].pin, INPUT_PULLUP);
-        /* create a queue to handle gpio event from isr */
-        gpioEventQueue = xQueueCreate(10, sizeof(switch_func_pair_t));
-        if (gpioEventQueue == 0) {
-            log_e("Queue was not created and must not be used");
+        switch_input_state_t *input = &switchInputs[i];
+        input->button = &button_func_pair[i];
+        input->dimUp = true;
+        SW_EngineInit(&input->engine, input->button->timing ? input->button->timing : &defaultSwitchTiming);
+
+        input->timer = MEM_CreateTimer("switch", 1, pdFALSE, input, onSwitchTimer);
+        if (input->timer == NULL) {
+            log_e("Switch timer was not created and must not be used");
             while (1);
         }
-        attachInterruptArg(button_func_pair[i].pin, gpioIsrHandler, (void *)(button_func_pair + i), FALLING);
+
+        pinMode(input->button->pin, INPUT_PULLUP);
+        attachInterruptArg(input->button->pin, gpioIsrHandler, (void *)input, CHANGE);
     }
 }
 
-void SW_Loop() {
-    // Handle button switch in loop()
-    uint8_t pin = 0;
-    switch_func_pair_t button_func_pair;
-    static switch_state_t switch_state = SWITCH_IDLE;
-
-    /* check if there is any queue received, if yes read out the button_func_pair */
-    if (xQueueReceive(gpioEventQueue, &button_func_pair, portMAX_DELAY)) {
-        pin = button_func_pair.pin;
-        setGpioInterruptEnabled(false);
-
-        while (true) {
-            bool value = digitalRead(pin);
-
-            switch (switch_state) {
-                case SWITCH_IDLE:
-                    switch_state = (value == LOW) ? SWITCH_PRESS_DETECTED : SWITCH_IDLE;
-                    break;
-                case SWITCH_PRESS_DETECTED:
-                    switch_state = (value == LOW) ? SWITCH_PRESS_DETECTED : SWITCH_RELEASE_DETECTED;
-                    break;
-                case SWITCH_RELEASE_DETECTED:
-                    switch_state = SWITCH_IDLE;
-                    /* callback to button_handler */
-                    (*onButtonPress)(&button_func_pair);
-                    break;
-
-                default:
-                    break;
-            }
+void SW_Loop(TickType_t waitTicks) {
+    // Handle debounced switch events in loop()
+    switch_event_message_t message;
 
-            if (switch_state == SWITCH_IDLE) {
-                setGpioInterruptEnabled(true);
+    /* check if there is any event received, if yes pass it on to the button handlers */
+    if (xQueueReceive(gpioEventQueue, &message, waitTicks)) {
+        rearmDroppedTimers();
+        if (message.button == NULL) {
+            return;
+        }
 
-                break;
-            }
+        log_i("Switch on pin %d: %s", message.button->pin, SW_EventToString(message.event));
 
-            delay(10);
+#ifdef ZIGBEE_MODE_ED
+        // Someone is at the device, so whatever they pressed is likely to be answered
+        ZB_PollActivity(ZB_POLL_ACTIVITY_BUTTON);
+#endif
+        onButtonEvent(message.button, message.event);
+
+        if (onSwitchEventCallback != NULL) {
+            onSwitchEventCallback(message.button, message.event);
         }
     }
-}
\ No newline at end of file
+}
+
+esp_err_t SW_InjectEvent(uint8_t pin, switch_event_t event) {
+    for (switch_input_state_t &input : switchInputs) {
+        if (input.button != NULL && input.button->pin == pin) {
+            handleEvent(&input, event, esp_timer_get_time());
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+uint8_t SW_GetEventQueuePeak() {
+    return eventQueuePeak.load(std::memory_order_relaxed);
+}
+
+void SW_SetOnSwitchEventCallback(void (*callback)(const switch_func_pair_t *button, switch_event_t event)) {
+    onSwitchEventCallback = callback;
+}
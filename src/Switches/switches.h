@@ -15,29 +15,43 @@
 
 /* Switch configuration */
 #include <Arduino.h>
+#include "Switches/switch_engine.h"
+
 #define GPIO_FACTORY_RESET_SWITCH GPIO_NUM_9
+/* Define GPIO_DIMMER_SWITCH in platformio.ini to wire a dimmer switch to that pin */
 #define PAIR_SIZE(TYPE_STR_PAIR) (sizeof(TYPE_STR_PAIR) / sizeof(TYPE_STR_PAIR[0]))
 
+/* Control functions send On/Off, Level Control or Scenes commands to the lights bound to HA_ESP_SENSOR_ENDPOINT, or to
+ * a group, queued straight from the switch timer rather than through SW_Loop(), see Zigbee/zigbee_control.h:
+ *   SWITCH_ONOFF_CONTROL   short press toggles, long press turns off
+ *   SWITCH_LEVEL_CONTROL   short press toggles, holding dims up or down in turn until released
+ *   SWITCH_SCENE_CONTROL   short press recalls sceneId in group
+ */
 typedef enum {
-    SWITCH_RESET_CONTROL
+    SWITCH_RESET_CONTROL,
+    SWITCH_ONOFF_CONTROL,
+    SWITCH_LEVEL_CONTROL,
+    SWITCH_SCENE_CONTROL,
 } switch_func_t;
 
 typedef struct {
     uint8_t pin;
     switch_func_t func;
+    const switch_timing_t *timing;  /* NULL uses the SWITCH_*_MS defaults */
+    uint16_t group;                 /* control functions: 0 sends to the bound lights, anything else to this group */
+    uint8_t sceneId;
 } switch_func_pair_t;
 
-typedef enum {
-    SWITCH_IDLE,
-    SWITCH_PRESS_ARMED,
-    SWITCH_PRESS_DETECTED,
-    SWITCH_PRESSED,
-    SWITCH_RELEASE_DETECTED,
-} switch_state_t;
-
-static switch_func_pair_t button_func_pair[] = {
-    {GPIO_FACTORY_RESET_SWITCH, SWITCH_RESET_CONTROL},
-};
+/* The switches this device has, configured in switches.cpp */
+extern switch_func_pair_t button_func_pair[];
+extern const size_t button_func_pair_count;
 
 void SW_InitSwitches();
-void SW_Loop();
\ No newline at end of file
+void SW_Loop(TickType_t waitTicks = portMAX_DELAY);
+/* Handle an event on a switch's pin as if its debouncer had just produced it, e.g. when replaying a trace; not for use
+ * alongside a live switch on the same pin. ESP_ERR_NOT_FOUND if no switch is configured on the pin.
+ */
+esp_err_t SW_InjectEvent(uint8_t pin, switch_event_t event);
+/* Most debounced events ever waiting for SW_Loop() at once */
+uint8_t SW_GetEventQueuePeak();
+void SW_SetOnSwitchEventCallback(void (*callback)(const switch_func_pair_t *button, switch_event_t event));
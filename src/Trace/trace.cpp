@@ -0,0 +1,249 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "Common/mpsc_ring.h"
+#include "Trace/trace.h"
+
+#ifdef TRACE_RECORDER
+
+typedef struct {
+    const esp_partition_t *partition;
+    uint32_t base;                      /* of the region within the partition */
+} trace_region_t;
+
+static MpscRing<trace_record_t, TRACE_RING_SIZE> traceRing;
+static trace_region_t region;
+static trace_log_t traceLog;
+static bool mounted = false;
+
+// The ring has a single consumer and the log a single writer: the drain task, TRACE_Flush() and the shutdown handler take turns
+static std::atomic_flag flushing = ATOMIC_FLAG_INIT;
+
+static std::atomic<uint32_t> statRecorded(0);
+static std::atomic<uint32_t> statDropped(0);
+static uint32_t statFlushes = 0;
+static uint32_t reportedDrops = 0;
+
+static esp_err_t regionRead(void *context, uint32_t offset, void *data, size_t size) {
+    const trace_region_t *region = (const trace_region_t *)context;
+    return esp_partition_read(region->partition, region->base + offset, data, size);
+}
+
+static esp_err_t regionWrite(void *context, uint32_t offset, const void *data, size_t size) {
+    const trace_region_t *region = (const trace_region_t *)context;
+    return esp_partition_write(region->partition, region->base + offset, data, size);
+}
+
+static esp_err_t regionErase(void *context, uint32_t offset, size_t size) {
+    const trace_region_t *region = (const trace_region_t *)context;
+    return esp_partition_erase_range(region->partition, region->base + offset, size);
+}
+
+static void lockWriter() {
+    while (flushing.test_and_set(std::memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+}
+
+static void unlockWriter() {
+    flushing.clear(std::memory_order_release);
+}
+
+// Claim a ring slot stamped with the time of the event, or NULL (and a drop counted) if the ring is full
+static trace_record_t *acquireRecord(uint8_t type, uint32_t id, int32_t value, size_t *position) {
+    int64_t now = esp_timer_get_time();
+
+    trace_record_t *record = traceRing.acquireWrite(position);
+    if (record == NULL) {
+        statDropped.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    record->type = type;
+    record->length = 0;
+    record->timestampUs = now;
+    record->id = id;
+    record->value = value;
+    return record;
+}
+
+static void commitRecord(size_t position) {
+    traceRing.commitWrite(position);
+    statRecorded.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void record(uint8_t type, uint32_t id, int32_t value) {
+    size_t position;
+    if (acquireRecord(type, id, value, &position) != NULL) {
+        commitRecord(position);
+    }
+}
+
+void TRACE_RecordSignal(uint32_t signal, esp_err_t status, const void *params) {
+    size_t position;
+    trace_record_t *slot = acquireRecord(TRACE_RECORD_SIGNAL, signal, status, &position);
+    if (slot != NULL) {
+        slot->length = TRACE_EncodeSignal(signal, params, slot->data);
+        commitRecord(position);
+    }
+}
+
+void TRACE_RecordAction(uint32_t callbackId, const void *message) {
+    size_t position;
+    trace_record_t *slot = acquireRecord(TRACE_RECORD_ACTION, callbackId, 0, &position);
+    if (slot != NULL) {
+        slot->length = TRACE_EncodeAction(callbackId, message, slot->data);
+        commitRecord(position);
+    }
+}
+
+void TRACE_RecordSwitch(uint8_t pin, uint8_t event) {
+    record(TRACE_RECORD_SWITCH, pin, event);
+}
+
+/********************* Flushing **************************/
+static void writeBatch(uint8_t *batch, size_t *size) {
+    if (*size == 0) {
+        return;
+    }
+
+    esp_err_t err = TRACE_LogWrite(&traceLog, batch, *size);
+    if (err != ESP_OK) {
+        log_w("Trace write failed, %u bytes lost (%s)", (unsigned)*size, esp_err_to_name(err));
+    }
+    *size = 0;
+}
+
+static void appendRecord(const trace_record_t *record, uint8_t *batch, size_t *size) {
+    if (*size + TRACE_MAX_RECORD_SIZE > TRACE_BATCH_SIZE) {
+        writeBatch(batch, size);
+    }
+    *size += TRACE_LogEncode(&traceLog, record, batch + *size);
+}
+
+static void flush() {
+    uint8_t batch[TRACE_BATCH_SIZE];
+    size_t size = 0;
+    trace_record_t *record;
+
+    // Until the region is mounted the ring only fills, then counts what it drops
+    if (!mounted) {
+        return;
+    }
+
+    lockWriter();
+
+    while ((record = traceRing.peekRead()) != NULL) {
+        appendRecord(record, batch, &size);
+        traceRing.releaseRead();
+    }
+
+    uint32_t dropped = statDropped.load(std::memory_order_relaxed);
+    if (dropped != reportedDrops) {
+        trace_record_t lost = {TRACE_RECORD_DROPPED, 0, esp_timer_get_time(), dropped - reportedDrops, 0, {}};
+        appendRecord(&lost, batch, &size);
+        reportedDrops = dropped;
+    }
+
+    if (size != 0) {
+        writeBatch(batch, &size);
+        statFlushes++;
+    }
+
+    unlockWriter();
+}
+
+static void onShutdown() {
+    flush();
+}
+
+void TRACE_Init() {
+    if (mounted) {
+        return;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, TRACE_PARTITION_LABEL);
+    if (partition == NULL || partition->size < TRACE_FLASH_SIZE) {
+        log_w("No room for a trace in the '%s' partition, the trace recorder is off", TRACE_PARTITION_LABEL);
+        return;
+    }
+
+    region.partition = partition;
+    region.base = partition->size - TRACE_FLASH_SIZE;
+
+    trace_flash_t flash = {
+        .read = regionRead,
+        .write = regionWrite,
+        .erase = regionErase,
+        .context = &region,
+        .sectorSize = partition->erase_size,
+        .sectorCount = TRACE_FLASH_SIZE / partition->erase_size,
+    };
+
+    esp_err_t err = TRACE_LogMount(&traceLog, &flash);
+    if (err != ESP_OK) {
+        log_e("Trace region could not be mounted, the trace recorder is off (%s)", esp_err_to_name(err));
+        return;
+    }
+
+    // Boot records are stamped from zero rather than from the record before, as the clock restarted
+    size_t position;
+    trace_record_t *boot = traceRing.acquireWrite(&position);
+    if (boot != NULL) {
+        *boot = {TRACE_RECORD_BOOT, 0, esp_timer_get_time(), 0, 0, {}};
+        commitRecord(position);
+    }
+
+    mounted = true;
+    esp_register_shutdown_handler(onShutdown);
+
+    log_i("Recording a trace to flash 0x%06lx, %lu bytes (%lu torn records found)", (unsigned long)(partition->address + region.base),
+          (unsigned long)TRACE_FLASH_SIZE, (unsigned long)traceLog.stats.torn);
+}
+
+void TRACE_Flush() {
+    flush();
+}
+
+esp_err_t TRACE_Erase() {
+    if (!mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    lockWriter();
+    esp_err_t err = TRACE_LogErase(&traceLog);
+    unlockWriter();
+    return err;
+}
+
+const trace_flash_t *TRACE_GetFlash() {
+    return mounted ? &traceLog.flash : NULL;
+}
+
+void TRACE_GetStats(trace_stats_t *stats) {
+    lockWriter();
+    stats->recorded = statRecorded.load(std::memory_order_relaxed);
+    stats->dropped = statDropped.load(std::memory_order_relaxed);
+    stats->flushes = statFlushes;
+    stats->address = mounted ? region.partition->address + region.base : 0;
+    stats->size = mounted ? TRACE_FLASH_SIZE : 0;
+    stats->log = traceLog.stats;
+    unlockWriter();
+}
+
+#endif
@@ -0,0 +1,80 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Signal & action trace recorder
+ * Built in with -D TRACE_RECORDER (see the native-trace environment in platformio.ini); without it the hooks below
+ * compile away. Every stack signal, core action callback and switch event is stamped and copied into a lock-free RAM
+ * ring by the task it happens on, which costs about as much as a dlog_* call. The log drain task encodes the ring into
+ * a trace_log.h trace in the last TRACE_FLASH_SIZE bytes of the `spiffs` partition every DLOG_DRAIN_INTERVAL_MS, and
+ * esp_restart() writes out whatever is left first. When the ring is full records are dropped and counted, and the
+ * count lands in the trace as a dropped record.
+ *
+ * The region's flash address & size are logged at boot; read it back with `esptool.py read_flash <address> <size>`
+ * and replay it on the host with trace_replay.h.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "Trace/trace_log.h"
+
+#define TRACE_RING_SIZE 32              /* records, must be a power of two */
+#define TRACE_BATCH_SIZE 256            /* bytes encoded before each flash write */
+
+/* Taken from the end of the partition, which the attribute store gives up while the recorder is built in */
+#ifndef TRACE_FLASH_SIZE
+#define TRACE_FLASH_SIZE 0x10000
+#endif
+#define TRACE_PARTITION_LABEL "spiffs"
+
+typedef struct {
+    uint32_t recorded;                  /* into the ring */
+    uint32_t dropped;                   /* ring full, record discarded */
+    uint32_t flushes;
+    uint32_t address;                   /* of the region in flash, for esptool */
+    uint32_t size;
+    trace_log_stats_t log;
+} trace_stats_t;
+
+#ifdef TRACE_RECORDER
+
+/* Mount the region and record a boot; called from ZB_StartMainTask() before the stack starts */
+void TRACE_Init();
+
+/* Hooks, callable from any task. params are the signal's esp_zb_app_signal_get_params(), or NULL. */
+void TRACE_RecordSignal(uint32_t signal, esp_err_t status, const void *params);
+void TRACE_RecordAction(uint32_t callbackId, const void *message);
+void TRACE_RecordSwitch(uint8_t pin, uint8_t event);
+
+/* Write out everything in the ring now */
+void TRACE_Flush();
+
+/* Erase the region, starting a fresh trace */
+esp_err_t TRACE_Erase();
+
+/* The region the trace is kept in, for reading it back, or NULL if it could not be mounted */
+const trace_flash_t *TRACE_GetFlash();
+
+void TRACE_GetStats(trace_stats_t *stats);
+
+#else
+
+static inline void TRACE_Init() {}
+static inline void TRACE_RecordSignal(uint32_t signal, esp_err_t status, const void *params) {}
+static inline void TRACE_RecordAction(uint32_t callbackId, const void *message) {}
+static inline void TRACE_RecordSwitch(uint8_t pin, uint8_t event) {}
+static inline void TRACE_Flush() {}
+
+#endif
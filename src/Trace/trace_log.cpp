@@ -0,0 +1,539 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "Trace/trace_log.h"
+
+#define SECTOR_HEADER_SIZE sizeof(trace_sector_header_t)
+
+/* Fixed fields ahead of the value in each serialised action message */
+#define SET_ATTRIBUTE_FIELDS_SIZE 9
+#define CUSTOM_COMMAND_FIELDS_SIZE 21
+#define REPORT_FIELDS_SIZE 13
+
+/* Serialised signal params */
+#define LEAVE_FIELDS_SIZE 1
+#define NWK_STATUS_FIELDS_SIZE 4
+
+static_assert(sizeof(trace_sector_header_t) == 16, "trace_sector_header_t is a flash format");
+static_assert(TRACE_MAX_RECORD_SIZE - 3 <= 0xff, "record lengths are one byte");
+static_assert(TRACE_MAX_DATA_SIZE > CUSTOM_COMMAND_FIELDS_SIZE, "TRACE_MAX_DATA_SIZE must hold an action message's fields");
+
+static uint8_t crc8(const uint8_t *data, size_t size) {
+    uint8_t crc = 0;
+
+    while (size--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static inline uint32_t headerCheck(uint32_t sequence) {
+    return ~(TRACE_MAGIC ^ sequence);
+}
+
+static uint8_t *putVarint(uint8_t *out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static bool getVarint(const uint8_t **in, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *in < end; shift += 7) {
+        uint8_t byte = *(*in)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static esp_err_t flashError(trace_log_t *log, esp_err_t err) {
+    if (err != ESP_OK) {
+        log->stats.errors++;
+    }
+    return err;
+}
+
+// The sequence in a sector's header, 0 if it holds no valid header
+static uint32_t readSequence(const trace_flash_t *flash, uint32_t sector) {
+    trace_sector_header_t header;
+
+    if (flash->read(flash->context, sector * flash->sectorSize, &header, sizeof(header)) != ESP_OK) {
+        return 0;
+    }
+    return header.magic == TRACE_MAGIC && header.check == headerCheck(header.sequence) ? header.sequence : 0;
+}
+
+// Read the record at offset into buffer; its size, 0 at free space or a corrupt record (counted as torn)
+static size_t readRecord(const trace_flash_t *flash, uint32_t sector, uint32_t offset, int64_t previousUs, trace_record_t *record,
+                         uint32_t *torn) {
+    uint8_t buffer[TRACE_MAX_RECORD_SIZE];
+    size_t size = flash->sectorSize - offset;
+
+    if (size > sizeof(buffer)) {
+        size = sizeof(buffer);
+    }
+    if (size < 3 || flash->read(flash->context, sector * flash->sectorSize + offset, buffer, size) != ESP_OK || buffer[0] == TRACE_FREE) {
+        return 0;
+    }
+
+    size_t taken = TRACE_Decode(buffer, size, previousUs, record);
+    if (taken == 0) {
+        (*torn)++;
+    }
+    return taken;
+}
+
+static esp_err_t openSector(trace_log_t *log) {
+    uint32_t sector = (log->activeSector + 1) % log->flash.sectorCount;
+    trace_sector_header_t header = {TRACE_MAGIC, log->activeSequence + 1, headerCheck(log->activeSequence + 1), 0xffffffff};
+
+    esp_err_t err = flashError(log, log->flash.erase(log->flash.context, sector * log->flash.sectorSize, log->flash.sectorSize));
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->stats.erases++;
+
+    err = flashError(log, log->flash.write(log->flash.context, sector * log->flash.sectorSize, &header, sizeof(header)));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    log->activeSector = sector;
+    log->activeSequence = header.sequence;
+    log->appendOffset = SECTOR_HEADER_SIZE;
+    return ESP_OK;
+}
+
+esp_err_t TRACE_LogMount(trace_log_t *log, const trace_flash_t *flash) {
+    memset(log, 0, sizeof(*log));
+    log->flash = *flash;
+
+    if (flash->sectorCount < 2 || flash->sectorCount > TRACE_MAX_SECTORS || flash->sectorSize < SECTOR_HEADER_SIZE + TRACE_MAX_RECORD_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Nothing open yet: the first write takes sector 0
+    log->activeSector = flash->sectorCount - 1;
+    log->appendOffset = flash->sectorSize;
+
+    for (uint32_t sector = 0; sector < flash->sectorCount; sector++) {
+        uint32_t sequence = readSequence(flash, sector);
+        if (sequence > log->activeSequence) {
+            log->activeSector = sector;
+            log->activeSequence = sequence;
+        }
+    }
+
+    if (log->activeSequence != 0) {
+        trace_record_t record;
+        uint32_t offset = SECTOR_HEADER_SIZE;
+        size_t size;
+
+        while ((size = readRecord(flash, log->activeSector, offset, 0, &record, &log->stats.torn)) != 0) {
+            offset += size;
+        }
+
+        // Appending after a torn record would hide everything behind it, so start on a fresh sector instead
+        uint8_t next = TRACE_FREE;
+        if (offset < flash->sectorSize) {
+            flash->read(flash->context, log->activeSector * flash->sectorSize + offset, &next, 1);
+        }
+        log->appendOffset = next == TRACE_FREE ? offset : flash->sectorSize;
+    }
+
+    log->mounted = true;
+    return ESP_OK;
+}
+
+size_t TRACE_LogEncode(trace_log_t *log, const trace_record_t *record, uint8_t *out) {
+    int64_t previousUs = record->type == TRACE_RECORD_BOOT ? 0 : log->lastUs;
+    int64_t deltaUs = record->timestampUs > previousUs ? record->timestampUs - previousUs : 0;
+    uint8_t length = record->length > TRACE_MAX_DATA_SIZE ? TRACE_MAX_DATA_SIZE : record->length;
+
+    uint8_t *p = out + 2;
+    p = putVarint(p, (uint64_t)deltaUs);
+    p = putVarint(p, record->id);
+    p = putVarint(p, ((uint32_t)record->value << 1) ^ (uint32_t)(record->value >> 31));
+    memcpy(p, record->data, length);
+    p += length;
+
+    out[0] = record->type;
+    out[1] = (uint8_t)(p - out - 2);
+    *p = crc8(out, p - out);
+
+    log->lastUs = previousUs + deltaUs;
+    log->stats.records++;
+    return p + 1 - out;
+}
+
+size_t TRACE_Decode(const uint8_t *data, size_t size, int64_t previousUs, trace_record_t *record) {
+    if (size < 3 || data[0] == TRACE_FREE || (size_t)data[1] + 3 > size || crc8(data, data[1] + 2) != data[data[1] + 2]) {
+        return 0;
+    }
+
+    const uint8_t *p = data + 2;
+    const uint8_t *end = p + data[1];
+    uint64_t deltaUs, id, value;
+
+    if (!getVarint(&p, end, &deltaUs) || !getVarint(&p, end, &id) || !getVarint(&p, end, &value) || end - p > TRACE_MAX_DATA_SIZE) {
+        return 0;
+    }
+
+    record->type = data[0];
+    record->timestampUs = (record->type == TRACE_RECORD_BOOT ? 0 : previousUs) + (int64_t)deltaUs;
+    record->id = (uint32_t)id;
+    record->value = (int32_t)((uint32_t)(value >> 1) ^ (0 - (uint32_t)(value & 1)));
+    record->length = (uint8_t)(end - p);
+    memcpy(record->data, p, record->length);
+    return data[1] + 3;
+}
+
+esp_err_t TRACE_LogWrite(trace_log_t *log, const uint8_t *data, size_t size) {
+    size_t position = 0;
+
+    if (!log->mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    while (position < size) {
+        // As many whole records as the active sector has room for, in one write
+        size_t run = 0;
+        while (position + run < size) {
+            size_t recordSize = (size_t)data[position + run + 1] + 3;
+            if (log->appendOffset + run + recordSize > log->flash.sectorSize) {
+                break;
+            }
+            run += recordSize;
+        }
+
+        esp_err_t err;
+        if (run == 0) {
+            err = openSector(log);
+        } else {
+            err = flashError(log, log->flash.write(log->flash.context, log->activeSector * log->flash.sectorSize + log->appendOffset,
+                                                   data + position, run));
+            if (err == ESP_OK) {
+                log->appendOffset += run;
+                log->stats.bytes += run;
+                log->stats.writes++;
+                position += run;
+            }
+        }
+
+        if (err != ESP_OK) {
+            // The sector may hold part of the write; leave it closed so the next write starts clean
+            log->appendOffset = log->flash.sectorSize;
+            return err;
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t TRACE_LogErase(trace_log_t *log) {
+    esp_err_t err = flashError(log, log->flash.erase(log->flash.context, 0, log->flash.sectorCount * log->flash.sectorSize));
+
+    log->activeSector = log->flash.sectorCount - 1;
+    log->activeSequence = 0;
+    log->appendOffset = log->flash.sectorSize;
+    log->lastUs = 0;
+    if (err == ESP_OK) {
+        log->stats.erases += log->flash.sectorCount;
+    }
+    return err;
+}
+
+esp_err_t TRACE_ReaderOpen(trace_reader_t *reader, const trace_flash_t *flash) {
+    uint32_t sequences[TRACE_MAX_SECTORS];
+
+    memset(reader, 0, sizeof(*reader));
+    reader->flash = *flash;
+    reader->offset = SECTOR_HEADER_SIZE;
+
+    if (flash->sectorCount < 2 || flash->sectorCount > TRACE_MAX_SECTORS || flash->sectorSize < SECTOR_HEADER_SIZE + TRACE_MAX_RECORD_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Insertion sort by sequence; a region holds few enough sectors
+    for (uint32_t sector = 0; sector < flash->sectorCount; sector++) {
+        uint32_t sequence = readSequence(flash, sector);
+        if (sequence == 0) {
+            continue;
+        }
+
+        uint16_t i = reader->sectors++;
+        while (i > 0 && sequences[i - 1] > sequence) {
+            sequences[i] = sequences[i - 1];
+            reader->order[i] = reader->order[i - 1];
+            i--;
+        }
+        sequences[i] = sequence;
+        reader->order[i] = (uint16_t)sector;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t TRACE_ReaderNext(trace_reader_t *reader, trace_record_t *record) {
+    while (reader->index < reader->sectors) {
+        size_t size = readRecord(&reader->flash, reader->order[reader->index], reader->offset, reader->previousUs, record, &reader->torn);
+        if (size != 0) {
+            reader->offset += size;
+            reader->previousUs = record->timestampUs;
+            return ESP_OK;
+        }
+
+        reader->index++;
+        reader->offset = SECTOR_HEADER_SIZE;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+/********************* Action messages **************************/
+static inline uint8_t *put16(uint8_t *out, uint16_t value) {
+    *out++ = (uint8_t)value;
+    *out++ = (uint8_t)(value >> 8);
+    return out;
+}
+
+static inline uint16_t get16(const uint8_t **in) {
+    uint16_t value = (uint16_t)((*in)[0] | ((*in)[1] << 8));
+    *in += 2;
+    return value;
+}
+
+// The value follows the fixed fields, cut short to what is left of the record
+static uint8_t putValue(uint8_t *data, uint8_t *p, uint8_t type, uint16_t size, const void *value) {
+    size_t room = TRACE_MAX_DATA_SIZE - (p - data) - 3;
+    uint16_t kept = value == NULL ? 0 : (size > room ? (uint16_t)room : size);
+
+    *p++ = type;
+    p = put16(p, kept);
+    memcpy(p, value, kept);
+    return (uint8_t)(p + kept - data);
+}
+
+static bool getValue(const uint8_t **p, const uint8_t *end, esp_zb_zcl_attribute_data_t *attribute, uint8_t *storage) {
+    attribute->type = (esp_zb_zcl_attr_type_t) * (*p)++;
+    attribute->size = get16(p);
+    if (attribute->size > end - *p) {
+        return false;
+    }
+
+    memcpy(storage, *p, attribute->size);
+    attribute->value = attribute->size ? storage : NULL;
+    return true;
+}
+
+uint8_t TRACE_EncodeAction(uint32_t callbackId, const void *message, uint8_t *data) {
+    uint8_t *p = data;
+
+    if (message == NULL) {
+        return 0;
+    }
+
+    switch (callbackId) {
+        case ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID: {
+            const esp_zb_zcl_set_attr_value_message_t *write = (const esp_zb_zcl_set_attr_value_message_t *)message;
+            *p++ = write->info.status;
+            *p++ = write->info.dst_endpoint;
+            p = put16(p, write->info.cluster);
+            p = put16(p, write->attribute.id);
+            return putValue(data, p, write->attribute.data.type, write->attribute.data.size, write->attribute.data.value);
+        }
+
+        case ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID: {
+            const esp_zb_zcl_custom_cluster_command_message_t *command = (const esp_zb_zcl_custom_cluster_command_message_t *)message;
+            *p++ = command->info.status;
+            *p++ = command->info.src_address.addr_type;
+            p = put16(p, command->info.src_address.u.addr_short);
+            *p++ = command->info.src_endpoint;
+            *p++ = command->info.dst_endpoint;
+            p = put16(p, command->info.cluster);
+            p = put16(p, command->info.profile);
+            *p++ = command->info.command.id;
+            *p++ = command->info.command.direction;
+            *p++ = command->info.command.is_common;
+            *p++ = command->info.header.fc;
+            p = put16(p, command->info.header.manuf_code);
+            *p++ = command->info.header.tsn;
+            *p++ = (uint8_t)command->info.header.rssi;
+            return putValue(data, p, command->data.type, command->data.size, command->data.value);
+        }
+
+        case ESP_ZB_CORE_REPORT_ATTR_CB_ID: {
+            const esp_zb_zcl_report_attr_message_t *report = (const esp_zb_zcl_report_attr_message_t *)message;
+            *p++ = report->status;
+            *p++ = report->src_address.addr_type;
+            p = put16(p, report->src_address.u.addr_short);
+            *p++ = report->src_endpoint;
+            *p++ = report->dst_endpoint;
+            p = put16(p, report->cluster);
+            p = put16(p, report->attribute.id);
+            return putValue(data, p, report->attribute.data.type, report->attribute.data.size, report->attribute.data.value);
+        }
+
+        default:
+            return 0;
+    }
+}
+
+const void *TRACE_DecodeAction(uint32_t callbackId, const uint8_t *data, uint8_t length, trace_action_message_t *storage) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + length;
+
+    memset(storage, 0, sizeof(*storage));
+
+    switch (callbackId) {
+        case ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID: {
+            esp_zb_zcl_set_attr_value_message_t *write = &storage->message.setAttribute;
+            if (length < SET_ATTRIBUTE_FIELDS_SIZE) {
+                return NULL;
+            }
+            write->info.status = (esp_zb_zcl_status_t) * p++;
+            write->info.dst_endpoint = *p++;
+            write->info.cluster = get16(&p);
+            write->attribute.id = get16(&p);
+            return getValue(&p, end, &write->attribute.data, storage->value) ? write : NULL;
+        }
+
+        case ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID: {
+            esp_zb_zcl_custom_cluster_command_message_t *command = &storage->message.customCommand;
+            if (length < CUSTOM_COMMAND_FIELDS_SIZE) {
+                return NULL;
+            }
+            command->info.status = (esp_zb_zcl_status_t) * p++;
+            command->info.src_address.addr_type = (esp_zb_zcl_address_type_t) * p++;
+            command->info.src_address.u.addr_short = get16(&p);
+            command->info.src_endpoint = *p++;
+            command->info.dst_endpoint = *p++;
+            command->info.cluster = get16(&p);
+            command->info.profile = get16(&p);
+            command->info.command.id = *p++;
+            command->info.command.direction = *p++;
+            command->info.command.is_common = *p++;
+            command->info.header.fc = *p++;
+            command->info.header.manuf_code = get16(&p);
+            command->info.header.tsn = *p++;
+            command->info.header.rssi = (int8_t)*p++;
+
+            esp_zb_zcl_attribute_data_t value;
+            if (!getValue(&p, end, &value, storage->value)) {
+                return NULL;
+            }
+            command->data.type = value.type;
+            command->data.size = value.size;
+            command->data.value = value.value;
+            return command;
+        }
+
+        case ESP_ZB_CORE_REPORT_ATTR_CB_ID: {
+            esp_zb_zcl_report_attr_message_t *report = &storage->message.report;
+            if (length < REPORT_FIELDS_SIZE) {
+                return NULL;
+            }
+            report->status = (esp_zb_zcl_status_t) * p++;
+            report->src_address.addr_type = (esp_zb_zcl_address_type_t) * p++;
+            report->src_address.u.addr_short = get16(&p);
+            report->src_endpoint = *p++;
+            report->dst_endpoint = *p++;
+            report->cluster = get16(&p);
+            report->attribute.id = get16(&p);
+            return getValue(&p, end, &report->attribute.data, storage->value) ? report : NULL;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+/********************* Signal params **************************/
+uint8_t TRACE_EncodeSignal(uint32_t signal, const void *params, uint8_t *data) {
+    uint8_t *p = data;
+
+    if (params == NULL) {
+        return 0;
+    }
+
+    switch (signal) {
+        case ESP_ZB_ZDO_SIGNAL_LEAVE: {
+            const esp_zb_zdo_signal_leave_params_t *leave = (const esp_zb_zdo_signal_leave_params_t *)params;
+            *p++ = leave->leave_type;
+            return (uint8_t)(p - data);
+        }
+
+        case ESP_ZB_NLME_STATUS_INDICATION: {
+            const esp_zb_zdo_signal_nwk_status_indication_params_t *status = (const esp_zb_zdo_signal_nwk_status_indication_params_t *)params;
+            *p++ = status->status;
+            p = put16(p, status->network_addr);
+            *p++ = status->unknown_command_id;
+            return (uint8_t)(p - data);
+        }
+
+        default:
+            return 0;
+    }
+}
+
+const void *TRACE_DecodeSignal(uint32_t signal, const uint8_t *data, uint8_t length, trace_signal_params_t *storage, size_t *size) {
+    const uint8_t *p = data;
+
+    memset(storage, 0, sizeof(*storage));
+
+    switch (signal) {
+        case ESP_ZB_ZDO_SIGNAL_LEAVE:
+            if (length < LEAVE_FIELDS_SIZE) {
+                return NULL;
+            }
+            storage->leave.leave_type = *p++;
+            *size = sizeof(storage->leave);
+            return &storage->leave;
+
+        case ESP_ZB_NLME_STATUS_INDICATION:
+            if (length < NWK_STATUS_FIELDS_SIZE) {
+                return NULL;
+            }
+            storage->nwkStatus.status = *p++;
+            storage->nwkStatus.network_addr = get16(&p);
+            storage->nwkStatus.unknown_command_id = *p++;
+            *size = sizeof(storage->nwkStatus);
+            return &storage->nwkStatus;
+
+        default:
+            return NULL;
+    }
+}
+
+const char *TRACE_RecordTypeToString(uint8_t type) {
+    switch (type) {
+        case TRACE_RECORD_BOOT: return "boot";
+        case TRACE_RECORD_SIGNAL: return "signal";
+        case TRACE_RECORD_ACTION: return "action";
+        case TRACE_RECORD_SWITCH: return "switch";
+        case TRACE_RECORD_DROPPED: return "dropped";
+        default: return "unknown";
+    }
+}
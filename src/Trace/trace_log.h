@@ -0,0 +1,160 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Binary trace format
+ * Pure logic over an injected flash interface, with no clock or tasks of its own. A trace is a sequence of compact
+ * records, each a type & length byte, a varint timestamp delta in microseconds, a varint id, a zigzag varint value,
+ * up to TRACE_MAX_DATA_SIZE bytes of data and a CRC-8, so a typical signal or switch event takes 6 to 8 bytes.
+ *
+ * Records are appended to sectors used round-robin across a flash region; each sector starts with a header carrying
+ * an increasing sequence number, and a new sector is erased only when the current one cannot take the next record, so
+ * the region always holds the newest trace. Readers walk the sectors in sequence order. A record torn by power loss
+ * fails its CRC and ends its sector.
+ *
+ * Timestamps are deltas from the record before, and a boot record restarts them from zero. Records written before
+ * the oldest boot record still in the region read with times relative to the start of the region.
+ *
+ * Action messages carry pointers, so they are serialised field by field rather than copied, which also lets a trace
+ * taken on the device replay on a 64-bit host. TRACE_EncodeAction() handles the messages the application acts on;
+ * others are recorded by callback id alone. Signal params are serialised the same way by TRACE_EncodeSignal(), for the
+ * signals the application reads them for.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_zigbee_core.h"
+
+#define TRACE_MAX_DATA_SIZE 48                  /* bytes of action message per record, longer values are cut short */
+#define TRACE_MAX_RECORD_SIZE (2 + 10 + 5 + 5 + TRACE_MAX_DATA_SIZE + 1)
+#define TRACE_MAX_SECTORS 64                    /* in a region */
+#define TRACE_MAGIC 0x4543525A                  /* "ZRCE" */
+#define TRACE_FREE 0xFF                         /* type byte of erased flash, past the last record in a sector */
+
+typedef enum {
+    TRACE_RECORD_BOOT = 1,                      /* recorder started, timestamps restart */
+    TRACE_RECORD_SIGNAL = 2,                    /* id: esp_zb_app_signal_type_t, value: esp_err_t status, data: TRACE_EncodeSignal() */
+    TRACE_RECORD_ACTION = 3,                    /* id: esp_zb_core_action_callback_id_t, data: TRACE_EncodeAction() */
+    TRACE_RECORD_SWITCH = 4,                    /* id: pin, value: switch_event_t */
+    TRACE_RECORD_DROPPED = 5,                   /* id: records lost to a full RAM ring before this one */
+} trace_record_type_t;
+
+typedef struct {
+    uint8_t type;                               /* trace_record_type_t */
+    uint8_t length;                             /* bytes of data */
+    int64_t timestampUs;
+    uint32_t id;
+    int32_t value;
+    uint8_t data[TRACE_MAX_DATA_SIZE];
+} trace_record_t;
+
+/* Flash access, in region offsets. Writes may only clear bits, as on NOR flash; erases are whole sectors. */
+typedef struct {
+    esp_err_t (*read)(void *context, uint32_t offset, void *data, size_t size);
+    esp_err_t (*write)(void *context, uint32_t offset, const void *data, size_t size);
+    esp_err_t (*erase)(void *context, uint32_t offset, size_t size);
+    void *context;
+    uint32_t sectorSize;
+    uint32_t sectorCount;                       /* 2 to TRACE_MAX_SECTORS */
+} trace_flash_t;
+
+/* At the start of every sector in use, followed by records */
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;                          /* counts up from 1 as sectors are opened */
+    uint32_t check;                             /* ~(magic ^ sequence) */
+    uint32_t reserved;                          /* 0xffffffff */
+} trace_sector_header_t;
+
+typedef struct {
+    uint32_t records;                           /* encoded */
+    uint32_t bytes;                             /* written to flash */
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t errors;                            /* flash operations that failed */
+    uint32_t torn;                              /* records that failed their CRC, at mount or while reading */
+} trace_log_stats_t;
+
+typedef struct {
+    trace_flash_t flash;
+    bool mounted;
+    uint32_t activeSector;
+    uint32_t activeSequence;
+    uint32_t appendOffset;                      /* within the active sector, sectorSize once it is closed */
+    int64_t lastUs;                             /* timestamp of the last record encoded */
+    trace_log_stats_t stats;
+} trace_log_t;
+
+typedef struct {
+    trace_flash_t flash;
+    uint16_t order[TRACE_MAX_SECTORS];          /* sectors in use, oldest first */
+    uint16_t sectors;
+    uint16_t index;                             /* into order */
+    uint32_t offset;                            /* within the sector being read */
+    int64_t previousUs;
+    uint32_t torn;
+} trace_reader_t;
+
+/* Action messages rebuilt from a trace, pointing into value */
+typedef struct {
+    union {
+        esp_zb_zcl_set_attr_value_message_t setAttribute;
+        esp_zb_zcl_custom_cluster_command_message_t customCommand;
+        esp_zb_zcl_report_attr_message_t report;
+    } message;
+    uint8_t value[TRACE_MAX_DATA_SIZE];
+} trace_action_message_t;
+
+/* Signal params rebuilt from a trace */
+typedef union {
+    esp_zb_zdo_signal_leave_params_t leave;
+    esp_zb_zdo_signal_nwk_status_indication_params_t nwkStatus;
+} trace_signal_params_t;
+
+/* Find the newest sector and the end of its records; an empty or foreign region mounts empty and is taken over sector
+ * by sector as the trace grows. ESP_ERR_INVALID_SIZE for a region the format cannot hold.
+ */
+esp_err_t TRACE_LogMount(trace_log_t *log, const trace_flash_t *flash);
+
+/* Encode a record after the last one encoded, returning its size, at most TRACE_MAX_RECORD_SIZE */
+size_t TRACE_LogEncode(trace_log_t *log, const trace_record_t *record, uint8_t *out);
+
+/* Append encoded records, opening new sectors as they fill; records never straddle sectors */
+esp_err_t TRACE_LogWrite(trace_log_t *log, const uint8_t *data, size_t size);
+
+/* Erase the region, starting a fresh trace */
+esp_err_t TRACE_LogErase(trace_log_t *log);
+
+/* Read a region's records oldest first; ESP_ERR_NOT_FOUND past the last one */
+esp_err_t TRACE_ReaderOpen(trace_reader_t *reader, const trace_flash_t *flash);
+esp_err_t TRACE_ReaderNext(trace_reader_t *reader, trace_record_t *record);
+
+/* Decode one encoded record, for readers of a RAM copy; the size taken, or 0 if it is incomplete or corrupt */
+size_t TRACE_Decode(const uint8_t *data, size_t size, int64_t previousUs, trace_record_t *record);
+
+/* Serialise an action message into data, at most TRACE_MAX_DATA_SIZE bytes; 0 for callback ids recorded without one */
+uint8_t TRACE_EncodeAction(uint32_t callbackId, const void *message, uint8_t *data);
+
+/* Rebuild an action message in storage, or NULL if the trace holds none for this callback id */
+const void *TRACE_DecodeAction(uint32_t callbackId, const uint8_t *data, uint8_t length, trace_action_message_t *storage);
+
+/* Serialise a signal's params into data, at most TRACE_MAX_DATA_SIZE bytes; 0 for signals recorded without them */
+uint8_t TRACE_EncodeSignal(uint32_t signal, const void *params, uint8_t *data);
+
+/* Rebuild a signal's params in storage, writing their size, or NULL if the trace holds none for this signal */
+const void *TRACE_DecodeSignal(uint32_t signal, const uint8_t *data, uint8_t length, trace_signal_params_t *storage, size_t *size);
+
+const char *TRACE_RecordTypeToString(uint8_t type);
@@ -0,0 +1,113 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "Trace/trace_replay.h"
+
+static void replayAction(const trace_record_t *record, const trace_replay_target_t *target, trace_replay_stats_t *stats) {
+    trace_action_message_t storage;
+    const void *message = NULL;
+
+    if (record->length != 0) {
+        message = TRACE_DecodeAction(record->id, record->data, record->length, &storage);
+        if (message == NULL) {
+            stats->skipped++;
+            return;
+        }
+    }
+
+    stats->actions++;
+    if (target->action) {
+        target->action(target->context, record->id, message);
+    }
+}
+
+static void replaySignal(const trace_record_t *record, const trace_replay_target_t *target, trace_replay_stats_t *stats) {
+    trace_signal_params_t storage;
+    const void *params = NULL;
+    size_t size = 0;
+
+    if (record->length != 0) {
+        params = TRACE_DecodeSignal(record->id, record->data, record->length, &storage, &size);
+        if (params == NULL) {
+            stats->skipped++;
+            return;
+        }
+    }
+
+    stats->signals++;
+    if (target->signal) {
+        target->signal(target->context, record->id, record->value, params, size);
+    }
+}
+
+esp_err_t TRACE_Replay(const trace_flash_t *flash, float speed, const trace_replay_target_t *target, trace_replay_stats_t *stats) {
+    trace_reader_t reader;
+    trace_record_t record;
+    int64_t previousUs = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    esp_err_t err = TRACE_ReaderOpen(&reader, flash);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    while (TRACE_ReaderNext(&reader, &record) == ESP_OK) {
+        // A boot restarts the clock, and nothing is known of the gap before it
+        int64_t gapUs = record.type == TRACE_RECORD_BOOT ? 0 : record.timestampUs - previousUs;
+        previousUs = record.timestampUs;
+
+        if (gapUs > 0) {
+            stats->traceUs += gapUs;
+            if (speed > 0 && target->wait) {
+                target->wait(target->context, (uint32_t)(gapUs / speed));
+            }
+        }
+
+        stats->records++;
+        switch (record.type) {
+            case TRACE_RECORD_BOOT:
+                stats->boots++;
+                break;
+
+            case TRACE_RECORD_SIGNAL:
+                replaySignal(&record, target, stats);
+                break;
+
+            case TRACE_RECORD_ACTION:
+                replayAction(&record, target, stats);
+                break;
+
+            case TRACE_RECORD_SWITCH:
+                stats->switchEvents++;
+                if (target->switchEvent) {
+                    target->switchEvent(target->context, (uint8_t)record.id, (uint8_t)record.value);
+                }
+                break;
+
+            case TRACE_RECORD_DROPPED:
+                stats->dropped += record.id;
+                break;
+
+            default:
+                stats->skipped++;
+                break;
+        }
+    }
+
+    stats->torn = reader.torn;
+    return ESP_OK;
+}
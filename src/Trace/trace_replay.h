@@ -0,0 +1,58 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Trace replay
+ * Pure logic: walks a trace_log.h trace oldest first and hands each record to a target, which feeds it into the
+ * application the way it first arrived, e.g. on the host through HOST_ZbInjectSignalParams(), HOST_ZbInvokeAction() and
+ * SW_InjectEvent(). Replayed at full speed the trace measures handler cost over real traffic; paced in real time, or a
+ * multiple of it, timers and debounce windows see the gaps they saw on the device.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "Trace/trace_log.h"
+
+typedef struct {
+    /* params are rebuilt by TRACE_DecodeSignal(), or NULL for signals recorded without them, and are only valid
+     * during the call
+     */
+    void (*signal)(void *context, uint32_t signal, esp_err_t status, const void *params, size_t size);
+    /* message is rebuilt by TRACE_DecodeAction(), or NULL for callback ids recorded without one, and is only valid
+     * during the call
+     */
+    void (*action)(void *context, uint32_t callbackId, const void *message);
+    void (*switchEvent)(void *context, uint8_t pin, uint8_t event);
+    /* Called before a record when pacing, to wait out the gap since the one before; NULL never waits */
+    void (*wait)(void *context, uint32_t us);
+    void *context;
+} trace_replay_target_t;
+
+typedef struct {
+    uint32_t records;
+    uint32_t signals;
+    uint32_t actions;
+    uint32_t switchEvents;
+    uint32_t boots;
+    uint32_t dropped;                   /* records the recorder lost, from its dropped records */
+    uint32_t skipped;                   /* records of an unknown type, or with an action message or params that did not decode */
+    uint32_t torn;
+    uint64_t traceUs;                   /* time covered by the trace, summed across boots */
+} trace_replay_stats_t;
+
+/* Replay every record in a region. speed scales the gaps between records: 1 is real time, 2 twice as fast and 0 full
+ * speed, with no waits at all.
+ */
+esp_err_t TRACE_Replay(const trace_flash_t *flash, float speed, const trace_replay_target_t *target, trace_replay_stats_t *stats);
@@ -14,202 +14,368 @@
 // limitations under the License.
 
 #include <Arduino.h>
+#include <array>
+#include <utility>
+#include "Log/deferred_log.h"
+#include "Memory/memory_pool.h"
+#include "Trace/trace.h"
 #include "Zigbee/zigbee.h"
-
-// Callback functions to main application logic
-void (*onCreateClustersCallback)(esp_zb_cluster_list_t *clusterList) = NULL;
-esp_err_t (*onAttributeUpdatedCallback)(const esp_zb_zcl_set_attr_value_message_t *message);
-esp_err_t (*onCustomClusterCommandCallback)(const esp_zb_zcl_custom_cluster_command_message_t *message);
-void (*onIdentifyCallback)(bool isIdentifying) = NULL;
+#include "Zigbee/zigbee_commands.h"
+#include "Zigbee/zigbee_dispatch.h"
+#include "Zigbee/zigbee_join.h"
+#include "Zigbee/zigbee_poll.h"
+#include "Zigbee/zigbee_recovery.h"
+#include "Zigbee/zigbee_reporting.h"
+#include "Zigbee/zigbee_shadow.h"
+#include "Zigbee/zigbee_store.h"
+#include "Zigbee/zigbee_supervisor.h"
+
+// The device registered by taskZigbeeMain, a single endpoint unless the application sets its own
+static constexpr zb_endpoint_desc_t defaultEndpoints[] = {
+    ZB_ENDPOINT_NO_CLUSTERS(HA_ESP_SENSOR_ENDPOINT, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID),
+};
+static constexpr zb_device_desc_t defaultDevice = ZB_DEVICE(defaultEndpoints);
+ZB_ASSERT_DEVICE_VALID(defaultDevice);
+
+static const zb_device_desc_t *device = &defaultDevice;
+static zb_boot_stats_t bootStats;
 
 // Cluster Action callback
 static esp_err_t onZigbeeAction(esp_zb_core_action_callback_id_t callback_id, const void *message) {
+    TRACE_RecordAction(callback_id, message);
+
+    int64_t start = esp_timer_get_time();
     esp_err_t ret = ESP_OK;
 
     switch (callback_id) {
-        case ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID:
-            log_i("Receive Zigbee action ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID");
-
-            if (onAttributeUpdatedCallback != NULL) {
-                ret = onAttributeUpdatedCallback((esp_zb_zcl_set_attr_value_message_t *)message);
+        case ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID: {
+            dlog_i("Receive Zigbee action ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID");
+
+            const esp_zb_zcl_set_attr_value_message_t *write = (const esp_zb_zcl_set_attr_value_message_t *)message;
+            if (write->info.status == ESP_ZB_ZCL_STATUS_SUCCESS) {
+                ZB_StoreSetValue(write->info.dst_endpoint, write->info.cluster, write->attribute.id, write->attribute.data.value);
+                ZB_ShadowSetValue(write->info.dst_endpoint, write->info.cluster, write->attribute.id, write->attribute.data.value);
+                ZB_ReportingSetValue(write->info.dst_endpoint, write->info.cluster, write->attribute.id, write->attribute.data.value);
             }
+
+            ZB_DispatchAttributeUpdated(write);
             break;
+        }
 
         case ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID:
-            log_i("Receive Zigbee action ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID");
+            dlog_i("Receive Zigbee action ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID");
 
-            if (onCustomClusterCommandCallback != NULL) {
-                ret = onCustomClusterCommandCallback((esp_zb_zcl_custom_cluster_command_message_t *)message);
-            }
+            ZB_DispatchCustomClusterCommand((const esp_zb_zcl_custom_cluster_command_message_t *)message);
             break;
 
         case ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID:
-            log_i("Receive Zigbee action ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID");
+            dlog_i("Receive Zigbee action ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID");
             break;
 
         case ESP_ZB_CORE_REPORT_ATTR_CB_ID:
-            log_i("Receive Zigbee action ESP_ZB_CORE_REPORT_ATTR_CB_ID");
+            dlog_i("Receive Zigbee action ESP_ZB_CORE_REPORT_ATTR_CB_ID");
             break;
 
         case ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID:
-            log_i("Receive Zigbee action ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID");
+            dlog_i("Receive Zigbee action ESP_ZB_CORE_CMD_REPORT_CONFIG_RESP_CB_ID");
             break;
 
         default:
-            log_i("Receive Zigbee action(0x%x) callback", callback_id);
+            dlog_i("Receive Zigbee action(0x%x) callback", callback_id);
             break;
     }
 
+    ZB_DiagnosticsRecordCallback(ZB_DIAGNOSTICS_ACTION, callback_id, (uint32_t)(esp_timer_get_time() - start));
     return ret;
 }
 
-// Handle identify functionality
-void onZigbeeIdentify(uint8_t identify_on) {
-    static bool isIdentifying = false;
-    bool wasIdentifying = isIdentifying;
-    isIdentifying = identify_on;
-
-    if (onIdentifyCallback != NULL) {
-        if (isIdentifying && !wasIdentifying) {
-            onIdentifyCallback(true);
-        } else if (!isIdentifying && wasIdentifying) {
-            onIdentifyCallback(false);
+// Frames the stack has not parsed yet; returning true keeps it from handling them itself
+static bool onApsDataIndication(esp_zb_apsde_data_ind_t ind) {
+#ifdef ZIGBEE_MODE_ED
+    // Whatever the frame, the parent is likely holding more for us
+    ZB_PollOnActivity(ZB_POLL_ACTIVITY_COMMAND);
+#endif
+
+    // Commands a ZbCommandRegistry answers, so the stack adds no Default Response of its own
+    esp_zb_zcl_custom_cluster_command_message_t command;
+    if (ZB_CommandsParseIndication(&ind, &command)) {
+        onZigbeeAction(ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID, &command);
+        return true;
+    }
+
+    return ZB_OtaHandleIndication(&ind) || ZB_BulkHandleIndication(&ind);
+}
+
+// Handle identify functionality, identifying while any endpoint is
+static uint32_t identifyingEndpoints = 0;
+static_assert(ZB_MAX_ENDPOINTS <= 32, "identifyingEndpoints holds one bit per endpoint");
+
+static void onEndpointIdentify(uint8_t index, uint8_t identify_on) {
+    bool wasIdentifying = identifyingEndpoints != 0;
+
+    if (identify_on) {
+        identifyingEndpoints |= 1u << index;
+    } else {
+        identifyingEndpoints &= ~(1u << index);
+    }
+
+    if ((identifyingEndpoints != 0) != wasIdentifying) {
+        ZB_DispatchIdentify(identifyingEndpoints != 0);
+    }
+}
+
+// The stack does not say which endpoint is identifying, so each one gets its own handler
+template <uint8_t Index>
+static void onZigbeeIdentify(uint8_t identify_on) {
+    onEndpointIdentify(Index, identify_on);
+}
+
+template <size_t... Index>
+static constexpr std::array<esp_zb_identify_notify_callback_t, sizeof...(Index)> identifyHandlerTable(std::index_sequence<Index...>) {
+    return {{onZigbeeIdentify<Index>...}};
+}
+
+static constexpr auto identifyHandlers = identifyHandlerTable(std::make_index_sequence<ZB_MAX_ENDPOINTS>());
+
+// Commissioning supervisor, only touched on the Zigbee stack task or with the stack lock held
+static zb_supervisor_config_t supervisorConfig = {
+    .baseDelayMs = ZB_COMMISSIONING_BASE_DELAY_MS,
+    .maxDelayMs = ZB_COMMISSIONING_MAX_DELAY_MS,
+    .initAttempts = ZB_COMMISSIONING_INIT_ATTEMPTS,
+    .steeringAttempts = ZB_COMMISSIONING_STEERING_ATTEMPTS,
+};
+static zb_supervisor_t supervisor;
+
+static void onSupervisorTimer(uint8_t param);
+
+static void runSupervisorAction(zb_supervisor_action_t action, uint32_t delayMs) {
+    static zb_commissioning_state_t reportedState = ZB_COMMISSIONING_IDLE;
+
+    switch (action) {
+        case ZB_SUPERVISOR_ACTION_INITIALISE:
+            esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_INITIALIZATION);
+            break;
+
+        case ZB_SUPERVISOR_ACTION_STEER:
+            dlog_i("Start network steering (attempt %lu)", (unsigned long)supervisor.status.attempts + 1);
+            ZB_DiagnosticsOnSteering();
+            esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
+            break;
+
+        case ZB_SUPERVISOR_ACTION_WAIT:
+            dlog_i("Retrying %s in %lu ms (attempt %lu)", ZB_CommissioningStateToString(supervisor.retrying), (unsigned long)delayMs, (unsigned long)supervisor.status.attempts + 1);
+            esp_zb_scheduler_alarm(onSupervisorTimer, 0, delayMs);
+            break;
+
+        case ZB_SUPERVISOR_ACTION_RESTART:
+            dlog_e("Zigbee stack failed to initialise %lu times in a row, restarting", (unsigned long)supervisor.status.attempts);
+            DLOG_Flush();
+            esp_restart();
+            break;
+
+        case ZB_SUPERVISOR_ACTION_NONE:
+            break;
+    }
+
+    if (supervisor.status.state != reportedState) {
+        reportedState = supervisor.status.state;
+        if (reportedState == ZB_COMMISSIONING_FAILED) {
+            dlog_w("Network steering failed %lu times in a row, giving up until ZB_RetryCommissioning()", (unsigned long)supervisor.status.attempts);
         }
+        ZB_DispatchCommissioningState(reportedState);
     }
 }
 
-// Zigbee signal handlers
-static void bdb_start_top_level_commissioning_cb(uint8_t mode_mask) {
-    ESP_ERROR_CHECK(esp_zb_bdb_start_top_level_commissioning(mode_mask));
+static void onSupervisorTimer(uint8_t param) {
+    runSupervisorAction(ZB_SupervisorOnTimer(&supervisor), 0);
+}
+
+// Per-device jitter seed: FNV-1a over the IEEE address, mixed with a per-boot random
+static uint32_t supervisorSeed() {
+    esp_zb_ieee_addr_t address;
+    uint32_t hash = 2166136261u;
+
+    esp_zb_get_long_address(address);
+    for (size_t i = 0; i < sizeof(address); i++) {
+        hash = (hash ^ address[i]) * 16777619u;
+    }
+
+    return hash ^ esp_random();
+}
+
+// On the network, whether newly joined or back after a reboot or rejoin
+static void resumeOnNetwork() {
+    ZB_ReportingResume();
+    ZB_DiagnosticsOnJoined();
+    ZB_OtaResume();
+    ZB_RecoveryResume();
+#ifdef ZIGBEE_MODE_ZCZR
+    ZB_RouterResume();
+#else
+    ZB_PollResume();
+#endif
+}
+
+static void onParentLost(const char *reason) {
+    // Only a device that is on the network can lose it; commissioning has its own retries
+    if (supervisor.status.state != ZB_COMMISSIONING_JOINED) {
+        return;
+    }
+
+    dlog_w("Lost the network: %s", reason);
+    ZB_RecoveryParentLost();
+}
+
+static void onRecoveryRejoined(esp_err_t err_status) {
+    ZB_RecoveryOnRejoined(err_status == ESP_OK);
+    if (err_status == ESP_OK) {
+        resumeOnNetwork();
+    }
 }
 
+// Zigbee signal handlers
 void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct) {
+    int64_t start = esp_timer_get_time();
     uint32_t *p_sg_p = signal_struct->p_app_signal;
     esp_err_t err_status = signal_struct->esp_err_status;
     esp_zb_app_signal_type_t sig_type = (esp_zb_app_signal_type_t)*p_sg_p;
+    zb_supervisor_action_t action;
+    uint32_t delay_ms;
+
+    TRACE_RecordSignal(sig_type, err_status, esp_zb_app_signal_get_params(p_sg_p));
 
     switch (sig_type) {
         case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP:
-            log_i("Zigbee stack initialized");
-            esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_INITIALIZATION);
+            dlog_i("Zigbee stack initialized");
+            ZB_DiagnosticsRefresh();
+            ZB_SupervisorInit(&supervisor, &supervisorConfig, supervisorSeed());
+            runSupervisorAction(ZB_SupervisorStart(&supervisor), 0);
             break;
 
         case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
         case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
+            if (ZB_RecoveryActive()) {
+                onRecoveryRejoined(err_status);
+                break;
+            }
+
             if (err_status == ESP_OK) {
-                log_i("Start network steering");
-                log_i("Device started up in %sfactory-reset mode", esp_zb_bdb_is_factory_new() ? "" : "non ");
+                dlog_i("Device started up in %sfactory-reset mode", esp_zb_bdb_is_factory_new() ? "" : "non ");
 
-                // Attach our identify handler
-                esp_zb_identify_notify_handler_register(HA_ESP_SENSOR_ENDPOINT, &onZigbeeIdentify);
+                // Attach our identify handlers
+                for (uint8_t i = 0; i < device->endpointCount; i++) {
+                    esp_zb_identify_notify_handler_register(device->endpoints[i].endpoint, identifyHandlers[i]);
+                }
 
                 if (esp_zb_bdb_is_factory_new()) {
-                    log_i("Start network steering");
-                    esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
+                    ZB_JoinStart();
                 } else {
-                    log_i("Device rebooted");
+                    dlog_i("Device rebooted");
+                    resumeOnNetwork();
                 }
             } else {
                 /* commissioning failed */
-                log_w("Failed to initialize Zigbee stack (status: %s)", esp_err_to_name(err_status));
-
-                // restart after 5 seconds
-                delay(2000);
-                esp_restart();
+                dlog_w("Failed to initialize Zigbee stack (status: %s)", esp_err_to_name(err_status));
             }
+
+            delay_ms = 0;
+            action = ZB_SupervisorOnInitialised(&supervisor, err_status == ESP_OK, esp_zb_bdb_is_factory_new(), &delay_ms);
+            runSupervisorAction(action, delay_ms);
             break;
 
         case ESP_ZB_BDB_SIGNAL_STEERING:
             if (err_status == ESP_OK) {
                 esp_zb_ieee_addr_t extended_pan_id;
                 esp_zb_get_extended_pan_id(extended_pan_id);
-                log_i(
+                dlog_i(
                     "Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
                     extended_pan_id[7], extended_pan_id[6], extended_pan_id[5], extended_pan_id[4], extended_pan_id[3], extended_pan_id[2], extended_pan_id[1],
                     extended_pan_id[0], esp_zb_get_pan_id(), esp_zb_get_current_channel(), esp_zb_get_short_address());
+
+                ZB_JoinSucceeded();
+                resumeOnNetwork();
             } else {
-                log_i("Network steering was not successful (status: %s)", esp_err_to_name(err_status));
-                esp_zb_scheduler_alarm((esp_zb_callback_t)bdb_start_top_level_commissioning_cb, ESP_ZB_BDB_MODE_NETWORK_STEERING, 1000);
+                dlog_i("Network steering was not successful (status: %s)", esp_err_to_name(err_status));
+                ZB_JoinFailed();
             }
-            break;
 
-        default:
-            log_i("ZDO signal: %s (0x%x), status: %s", esp_zb_zdo_signal_to_string(sig_type), sig_type, esp_err_to_name(err_status));
+            delay_ms = 0;
+            action = ZB_SupervisorOnSteered(&supervisor, err_status == ESP_OK, &delay_ms);
+            runSupervisorAction(action, delay_ms);
             break;
-    }
-}
 
-// Create Basic & Identify Clusters
-static esp_zb_cluster_list_t *createBasicClusters() {
-    log_i("Creating Basic & Identify Clusters");
-    esp_zb_cluster_list_t *clusterList = esp_zb_zcl_cluster_list_create();
-
-    // Create Basic cluster
-    esp_zb_basic_cluster_cfg_t clusterConfigBasic = {
-        .zcl_version = ESP_ZB_ZCL_BASIC_ZCL_VERSION_DEFAULT_VALUE,
-        .power_source = ESP_ZB_ZCL_BASIC_POWER_SOURCE_DEFAULT_VALUE,
-    };
-
-    esp_zb_attribute_list_t *basicCluster = esp_zb_basic_cluster_create(&clusterConfigBasic);
-    ESP_ERROR_CHECK(esp_zb_basic_cluster_add_attr(basicCluster, ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID, (void *)MANUFACTURER_NAME));
-    ESP_ERROR_CHECK(esp_zb_basic_cluster_add_attr(basicCluster, ESP_ZB_ZCL_ATTR_BASIC_MODEL_IDENTIFIER_ID, (void *)MODEL_IDENTIFIER));
-    ESP_ERROR_CHECK(esp_zb_cluster_list_add_basic_cluster(clusterList, basicCluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
-
-    // Create Identify cluster
-    esp_zb_identify_cluster_cfg_t clusterConfigIdentify = {
-        .identify_time = ESP_ZB_ZCL_IDENTIFY_IDENTIFY_TIME_DEFAULT_VALUE,
-    };
+        case ESP_ZB_BDB_SIGNAL_TC_REJOIN_DONE:
+            if (ZB_RecoveryActive()) {
+                onRecoveryRejoined(err_status);
+            } else {
+                dlog_i("Trust centre rejoin done (status: %s)", esp_err_to_name(err_status));
+            }
+            break;
 
-    ESP_ERROR_CHECK(esp_zb_cluster_list_add_identify_cluster(clusterList, esp_zb_identify_cluster_create(&clusterConfigIdentify), ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
-    ESP_ERROR_CHECK(esp_zb_cluster_list_add_identify_cluster(clusterList, esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY), ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE));
+        case ESP_ZB_NLME_STATUS_INDICATION: {
+            const esp_zb_zdo_signal_nwk_status_indication_params_t *params =
+                (const esp_zb_zdo_signal_nwk_status_indication_params_t *)esp_zb_app_signal_get_params(p_sg_p);
 
-    return clusterList;
-}
+            if (params->status == ESP_ZB_NWK_COMMAND_STATUS_PARENT_LINK_FAILURE) {
+                onParentLost("parent link failure");
+            } else {
+                dlog_i("Network status 0x%02x for 0x%04hx", params->status, params->network_addr);
+            }
+            break;
+        }
 
-// Create Endpoint
-static esp_zb_ep_list_t *createSensorEndpoint(uint8_t endpoint_id) {
-    log_i("Creating Sensor Endpoint");
-    esp_zb_ep_list_t *ep_list = esp_zb_ep_list_create();
-    esp_zb_endpoint_config_t endpoint_config = {
-        .endpoint = endpoint_id,
-        .app_profile_id = ESP_ZB_AF_HA_PROFILE_ID,
-        .app_device_id = ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID,
-        .app_device_version = 1
-    };
+        case ESP_ZB_ZDO_SIGNAL_LEAVE: {
+            const esp_zb_zdo_signal_leave_params_t *params = (const esp_zb_zdo_signal_leave_params_t *)esp_zb_app_signal_get_params(p_sg_p);
 
-    esp_zb_cluster_list_t *clusterList = createBasicClusters();
+            if (params->leave_type == ESP_ZB_NWK_LEAVE_TYPE_REJOIN) {
+                onParentLost("asked to leave and rejoin");
+            } else {
+                dlog_w("Left the network (status: %s)", esp_err_to_name(err_status));
+            }
+            break;
+        }
 
-    // If our callback is set, pass our clusterlist over for further updates
-    if (onCreateClustersCallback != NULL) {
-        log_i("Calling onCreateClustersCallback");
-        onCreateClustersCallback(clusterList);
-    } else {
-        log_i("No cluster callback defined, skipping");
+        default:
+            dlog_i("ZDO signal: %s (0x%x), status: %s", esp_zb_zdo_signal_to_string(sig_type), sig_type, esp_err_to_name(err_status));
+            break;
     }
 
-    esp_zb_ep_list_add_ep(ep_list, clusterList, endpoint_config);
-
-    return ep_list;
+    ZB_DiagnosticsRecordCallback(ZB_DIAGNOSTICS_SIGNAL, sig_type, (uint32_t)(esp_timer_get_time() - start));
 }
 
 static void taskZigbeeMain(void *pvParameters) {
     esp_zb_set_trace_level_mask(ESP_ZB_TRACE_LEVEL_CRITICAL, ESP_ZB_TRACE_SUBSYSTEM_MAC | ESP_ZB_TRACE_SUBSYSTEM_APP);
 
     // Initialise our configuration
-    esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_ZED_CONFIG();
+    int64_t start = esp_timer_get_time();
+#ifdef ZIGBEE_MODE_ZCZR
+    ZB_RouterConfigure();
+#endif
+    esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_DEVICE_CONFIG();
     esp_zb_init(&zb_nwk_cfg);
-
-    /* Create customized sensor endpoint */
-    esp_zb_ep_list_t *esp_zb_sensor_ep = createSensorEndpoint(HA_ESP_SENSOR_ENDPOINT);
+    bootStats.initUs = esp_timer_get_time() - start;
+
+    /* Restore stored attribute values, then create the endpoints from our device descriptor with them */
+    ZB_StoreMount(device);
+
+    start = esp_timer_get_time();
+    esp_zb_ep_list_t *endpointList = ZB_CreateEndpoints(device);
+    bootStats.createUs = esp_timer_get_time() - start;
+    if (endpointList == NULL) {
+        // The descriptor passed its compile-time checks, so only a stack out of memory or attribute space gets here
+        log_e("Device descriptor could not be registered, restarting");
+        esp_restart();
+    }
 
     /* Register the device */
-    esp_zb_device_register(esp_zb_sensor_ep);
+    start = esp_timer_get_time();
+    esp_zb_device_register(endpointList);
+    bootStats.registerUs = esp_timer_get_time() - start;
+    ZB_ShadowPublish();
 
     /* Register our action callback */
     esp_zb_core_action_handler_register(onZigbeeAction);
-
-    /* Config the reporting info  */
-    // configureReporting(ESP_ZB_ZCL_CLUSTER_ID_FAN_CONTROL,ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,0x0,ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI);
+    esp_zb_aps_data_indication_handler_register(onApsDataIndication);
 
     esp_zb_set_primary_network_channel_set(ESP_ZB_PRIMARY_CHANNEL_MASK);
 
@@ -217,12 +383,22 @@ static void taskZigbeeMain(void *pvParameters) {
     // esp_zb_nvram_erase_at_start(true); //Comment out this line to erase NVRAM data if you are conneting to new Coordinator
 
     ESP_ERROR_CHECK(esp_zb_start(false));
+    bootStats.stackStartUs = esp_timer_get_time();
+
+    log_i("Zigbee stack started %lu us after boot: init %lu us, %d endpoints with %d clusters & %d attributes created in %lu us, registered in %lu us",
+          (unsigned long)bootStats.stackStartUs, (unsigned long)bootStats.initUs, bootStats.endpoints, bootStats.clusters, bootStats.attributes,
+          (unsigned long)bootStats.createUs, (unsigned long)bootStats.registerUs);
 
     esp_zb_stack_main_loop();
 }
 
 // External interface functions
 void ZB_StartMainTask() {
+    bootStats.startMainTaskUs = esp_timer_get_time();
+    bootStats.endpoints = device->endpointCount;
+    bootStats.clusters = ZbDeviceClusterCount(*device);
+    bootStats.attributes = ZbDeviceAttributeCount(*device);
+
     // Init Zigbee
     esp_zb_platform_config_t config = {
         .radio_config = ESP_ZB_DEFAULT_RADIO_CONFIG(),
@@ -231,26 +407,56 @@ void ZB_StartMainTask() {
 
     ESP_ERROR_CHECK(esp_zb_platform_config(&config));
 
+    // Start the trace recorder, the application event worker, the control sender and the log drain ahead of the stack, so
+    // no early event finds them missing; the drain task also writes out the trace
+    TRACE_Init();
+    ZB_DispatchInit();
+    ZB_ControlInit();
+    DLOG_Init();
+
     // Start task
-    xTaskCreate(taskZigbeeMain, "Zigbee_main", 4096, NULL, 5, NULL);
+    MEM_CreateTask(taskZigbeeMain, ZB_MAIN_TASK_NAME, ZB_MAIN_TASK_STACK_SIZE, NULL, ZB_MAIN_TASK_PRIORITY);
 }
 
 void ZB_FactoryReset() {
+    ZB_StoreErase();
     esp_zb_factory_reset();
 }
 
-void ZB_SetOnCreateClustersCallback(void (*callback)(esp_zb_cluster_list_t *clusterList)) {
-    onCreateClustersCallback = callback;
+void ZB_SetCommissioningConfig(const zb_supervisor_config_t *config) {
+    supervisorConfig = *config;
+}
+
+void ZB_RetryCommissioning() {
+    esp_zb_lock_acquire(portMAX_DELAY);
+
+    zb_supervisor_action_t action = ZB_SupervisorRetry(&supervisor);
+
+    if (action != ZB_SUPERVISOR_ACTION_NONE) {
+        esp_zb_scheduler_alarm_cancel(onSupervisorTimer, 0);
+
+        // A retried steering cycle starts again from the cached channel
+        if (action == ZB_SUPERVISOR_ACTION_STEER) {
+            ZB_JoinStart();
+        }
+        runSupervisorAction(action, 0);
+    }
+
+    esp_zb_lock_release();
 }
 
-void ZB_SetOnAttributeUpdatedCallback(esp_err_t (*callback)(const esp_zb_zcl_set_attr_value_message_t *message)) {
-    onAttributeUpdatedCallback = callback;
+void ZB_GetCommissioningStatus(zb_commissioning_status_t *status) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    *status = supervisor.status;
+    esp_zb_lock_release();
 }
 
-void ZB_SetOnCustomClusterCommandCallback(esp_err_t (*callback)(const esp_zb_zcl_custom_cluster_command_message_t *message)) {
-    onCustomClusterCommandCallback = callback;
+void ZB_SetDeviceDescriptor(const zb_device_desc_t *descriptor) {
+    device = descriptor;
 }
 
-void ZB_SetOnIdentifyCallback(void (*callback)(bool isIdentifying)) {
-    onIdentifyCallback = callback;
+void ZB_GetBootStats(zb_boot_stats_t *stats) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    *stats = bootStats;
+    esp_zb_lock_release();
 }
\ No newline at end of file
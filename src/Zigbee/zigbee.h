@@ -13,8 +13,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#ifndef ZIGBEE_MODE_ED
-    #error "Zigbee end device mode ZIGBEE_MODE_ED is not set in platformio.ini"
+#if !defined(ZIGBEE_MODE_ED) && !defined(ZIGBEE_MODE_ZCZR)
+    #error "Zigbee device mode ZIGBEE_MODE_ED or ZIGBEE_MODE_ZCZR is not set in platformio.ini"
+#elif defined(ZIGBEE_MODE_ED) && defined(ZIGBEE_MODE_ZCZR)
+    #error "Only one of ZIGBEE_MODE_ED & ZIGBEE_MODE_ZCZR can be set in platformio.ini"
 #endif
 
 #include "esp_zigbee_attribute.h"
@@ -22,6 +24,19 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "ha/esp_zigbee_ha_standard.h"
+#include "Zigbee/zigbee_bulk.h"
+#include "Zigbee/zigbee_control.h"
+#include "Zigbee/zigbee_device.h"
+#include "Zigbee/zigbee_diagnostics.h"
+#include "Zigbee/zigbee_join_plan.h"
+#include "Zigbee/zigbee_ota.h"
+#include "Zigbee/zigbee_poll_engine.h"
+#include "Zigbee/zigbee_recovery_engine.h"
+#include "Zigbee/zigbee_reporting_engine.h"
+#include "Zigbee/zigbee_router.h"
+#include "Zigbee/zigbee_shadow_cache.h"
+#include "Zigbee/zigbee_store_log.h"
+#include "Zigbee/zigbee_supervisor.h"
 
 /* Attribute values in ZCL string format
  * The string should be started with the length of its own.
@@ -32,10 +47,15 @@
 /* Zigbee configuration */
 #define INSTALLCODE_POLICY_ENABLE false                                     /* enable the install code policy for security */
 #define ED_AGING_TIMEOUT ESP_ZB_ED_AGING_TIMEOUT_64MIN
-#define ED_KEEP_ALIVE 3000                                                  /* 3000 millisecond */
+#define ED_KEEP_ALIVE 3000                                                  /* 3000 millisecond, until zigbee_poll.h takes over on joining */
 #define ESP_ZB_PRIMARY_CHANNEL_MASK ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK    /* Zigbee primary channel mask use in the example */
 
-/** Endpoint ID */
+/* Zigbee stack task */
+#define ZB_MAIN_TASK_NAME "Zigbee_main"
+#define ZB_MAIN_TASK_STACK_SIZE 4096
+#define ZB_MAIN_TASK_PRIORITY 5
+
+/** Endpoint ID of the default device, a single endpoint with no application clusters */
 #define HA_ESP_SENSOR_ENDPOINT 1
 
 /* Default End Device config */
@@ -52,6 +72,25 @@
         },                                                \
     }
 
+/* Default Router config, see zigbee_router.h for the table sizes */
+#define ESP_ZB_ZCZR_CONFIG()                                \
+    {                                                       \
+        .esp_zb_role = ESP_ZB_DEVICE_TYPE_ROUTER,           \
+        .install_code_policy = INSTALLCODE_POLICY_ENABLE,   \
+        .nwk_cfg = {                                        \
+            .zczr_cfg =                                     \
+                {                                           \
+                    .max_children = ZB_ROUTER_MAX_CHILDREN, \
+                },                                          \
+        },                                                  \
+    }
+
+#ifdef ZIGBEE_MODE_ZCZR
+#define ESP_ZB_DEVICE_CONFIG() ESP_ZB_ZCZR_CONFIG()
+#else
+#define ESP_ZB_DEVICE_CONFIG() ESP_ZB_ZED_CONFIG()
+#endif
+
 #define ESP_ZB_DEFAULT_RADIO_CONFIG()       \
     {                                       \
         .radio_mode = ZB_RADIO_MODE_NATIVE, \
@@ -63,9 +102,143 @@
     }
 
 
+/* Application event dispatch counters, see ZB_GetDispatchStats() */
+typedef struct {
+    uint32_t enqueued;
+    uint32_t dispatched;
+    uint32_t dropped;               /* ring full, or payload larger than ZB_DISPATCH_MAX_DATA_SIZE */
+    uint16_t depth;
+    uint16_t depthHighWaterMark;
+    uint32_t latencyLastUs;         /* enqueue on Zigbee_main to first subscriber called */
+    uint32_t latencyMinUs;
+    uint32_t latencyMaxUs;
+    uint64_t latencyTotalUs;
+} zb_dispatch_stats_t;
+
+/* Stack bring-up timing, all in microseconds; the timestamps count from boot, so they include setup() before them */
+typedef struct {
+    uint32_t startMainTaskUs;       /* ZB_StartMainTask() called */
+    uint32_t initUs;                /* esp_zb_init() */
+    uint32_t createUs;              /* walking the device descriptor into endpoint lists */
+    uint32_t registerUs;            /* esp_zb_device_register() */
+    uint32_t stackStartUs;          /* esp_zb_start() returned */
+    uint8_t endpoints;
+    uint16_t clusters;              /* application clusters, not counting the ones added to every endpoint */
+    uint16_t attributes;
+} zb_boot_stats_t;
+
 void ZB_StartMainTask();
 void ZB_FactoryReset();
-void ZB_SetOnCreateClustersCallback(void (*callback)(esp_zb_cluster_list_t *clusterList));
+
+/* Commissioning retries back off exponentially with per-device jitter, see zigbee_supervisor.h.
+ * Set the config before ZB_StartMainTask(). ZB_RetryCommissioning() starts a fresh cycle at once when the supervisor is
+ * backing off or has given up, e.g. from a button press; the status can be read from any task after start.
+ */
+void ZB_SetCommissioningConfig(const zb_supervisor_config_t *config);
+void ZB_RetryCommissioning();
+void ZB_GetCommissioningStatus(zb_commissioning_status_t *status);
+
+/* The endpoints, clusters & attributes this device registers, see zigbee_device.h. Set before ZB_StartMainTask(); the
+ * descriptor must outlive the stack. Without one, the device has a single HA_ESP_SENSOR_ENDPOINT.
+ */
+void ZB_SetDeviceDescriptor(const zb_device_desc_t *device);
+
+/* Valid once the stack has started, see zb_boot_stats_t */
+void ZB_GetBootStats(zb_boot_stats_t *stats);
+
+/* Attribute, command, identify and commissioning state callbacks run on the Zigbee event worker task, not the stack task.
+ * ZB_Set*Callback replaces all subscribers for that event with one; ZB_Add*Callback adds another alongside them.
+ * Register subscribers before ZB_StartMainTask(). Return values are logged but no longer reach the stack.
+ */
 void ZB_SetOnAttributeUpdatedCallback(esp_err_t (*callback)(const esp_zb_zcl_set_attr_value_message_t *message));
 void ZB_SetOnCustomClusterCommandCallback(esp_err_t (*callback)(const esp_zb_zcl_custom_cluster_command_message_t *message));
-void ZB_SetOnIdentifyCallback(void (*callback)(bool isIdentifying));
\ No newline at end of file
+void ZB_SetOnIdentifyCallback(void (*callback)(bool isIdentifying));
+void ZB_SetOnCommissioningStateCallback(void (*callback)(zb_commissioning_state_t state));
+bool ZB_AddOnAttributeUpdatedCallback(esp_err_t (*callback)(const esp_zb_zcl_set_attr_value_message_t *message));
+bool ZB_AddOnCustomClusterCommandCallback(esp_err_t (*callback)(const esp_zb_zcl_custom_cluster_command_message_t *message));
+bool ZB_AddOnIdentifyCallback(void (*callback)(bool isIdentifying));
+bool ZB_AddOnCommissioningStateCallback(void (*callback)(zb_commissioning_state_t state));
+void ZB_GetDispatchStats(zb_dispatch_stats_t *stats);
+
+/* Progress of network steering through the cached, preferred & full channel phases, valid after ZB_StartMainTask() */
+void ZB_GetJoinStats(zb_join_stats_t *stats);
+
+/* Parent-loss recovery, see zigbee_recovery.h. Set the config before ZB_StartMainTask(); without one the ZB_RECOVERY_*
+ * defaults apply. The outage stats can be read from any task after start.
+ */
+void ZB_SetRecoveryConfig(const zb_recovery_config_t *config);
+void ZB_GetRecoveryStats(zb_recovery_stats_t *stats);
+
+/* Runtime health counters, as published in the Diagnostics & performance counter clusters; callable from any task */
+void ZB_GetDiagnostics(zb_diagnostics_t *diagnostics);
+
+/* Attribute reporting, see zigbee_reporting_engine.h for the scheduling rules.
+ * Add reportable attributes before ZB_StartMainTask(); they are reported to whatever is bound to their cluster, so
+ * leave ESP_ZB_ZCL_ATTR_ACCESS_REPORTING off them to avoid the stack reporting them a second time.
+ * ZB_SetAttributeValue() updates a server attribute from any task once the clusters have been created, reporting it if
+ * it was added.
+ */
+esp_err_t ZB_AddReportableAttribute(const zb_reporting_config_t *config);
+esp_err_t ZB_SetAttributeValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value);
+
+/* Lock-free attribute reads and batched writes, see zigbee_shadow.h. Fixed-size server attributes from the device
+ * descriptor can be read from any task once the device is registered, without waiting on the stack; version, if not
+ * NULL, changes whenever the value does, so a poller can tell whether anything moved. ESP_ERR_NOT_FOUND for attributes
+ * that are not shadowed (strings, and those the stack changes itself such as Identify Time) or before registration, ESP_ERR_INVALID_SIZE if size is not the attribute's.
+ * Writes added to a zero-initialised batch with ZB_BatchAttributeValue() are applied by ZB_CommitAttributes() under a
+ * single stack lock, each as ZB_SetAttributeValue() would; the batch is emptied and the first failure returned.
+ */
+esp_err_t ZB_GetAttributeValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, void *value, uint8_t size, uint32_t *version);
+esp_err_t ZB_BatchAttributeValue(zb_attribute_batch_t *batch, uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value);
+esp_err_t ZB_CommitAttributes(zb_attribute_batch_t *batch);
+
+/* Persistent attributes, see zigbee_store.h. Changes are written to flash after a quiet period and before esp_restart();
+ * ZB_FlushAttributes() writes them out now, e.g. ahead of cutting power. Both are callable from any task.
+ */
+esp_err_t ZB_FlushAttributes();
+void ZB_GetStoreStats(zb_store_stats_t *stats);
+
+/* OTA upgrades, see zigbee_ota.h. Set the config before ZB_StartMainTask(); without one the client uses the
+ * ZB_OTA_* defaults. ZB_QueryOtaImage() asks the server for an image now, e.g. from a button press; it and the status
+ * can be called from any task after start.
+ */
+void ZB_SetOtaConfig(const zb_ota_config_t *config);
+void ZB_QueryOtaImage();
+void ZB_GetOtaStatus(zb_ota_status_t *status);
+
+/* Bulk uploads to a collector, see zigbee_bulk.h. Set the config and collector, and add sources, before
+ * ZB_StartMainTask(); the trace region in TRACE_RECORDER builds is added for you. ESP_ERR_NO_MEM once all
+ * ZB_BULK_MAX_SOURCES ids are taken. A crash dump holds whatever was in RAM, so the coredump partition is only served
+ * once added with ZB_AddBulkCoredumpSource(), which returns ESP_ERR_NOT_FOUND without one. The trust centre may always
+ * start a transfer; ZB_SetBulkCollector() names one more collector that may, ZB_BULK_NO_COLLECTOR for none. The status
+ * of the latest transfer can be read from any task after start.
+ */
+void ZB_SetBulkConfig(const zb_bulk_config_t *config);
+void ZB_SetBulkCollector(uint16_t shortAddress);
+esp_err_t ZB_AddBulkSource(uint8_t id, const zb_bulk_source_t *source);
+esp_err_t ZB_AddBulkCoredumpSource();
+void ZB_GetBulkStatus(zb_bulk_status_t *status);
+
+/* Direct control of bound or grouped lights, see zigbee_control.h. Add the On/Off, Level Control or Scenes client
+ * cluster to the source endpoint in the device descriptor so it can be bound. Callable from any task once the stack has
+ * started. Returns once the command is queued, without waiting on the stack lock; ESP_ERR_NO_MEM if the queue is full.
+ */
+esp_err_t ZB_SendControlCommand(const zb_control_command_t *command);
+void ZB_GetControlStats(zb_control_stats_t *stats);
+
+#ifdef ZIGBEE_MODE_ZCZR
+/* Router table occupancy & forwarding counters, see zigbee_router.h. Sampled when called, from any task once started. */
+void ZB_GetRouterStats(zb_router_stats_t *stats);
+#endif
+
+#ifdef ZIGBEE_MODE_ED
+/* Adaptive polling, see zigbee_poll.h & zigbee_poll_engine.h; all callable from any task once the stack has started.
+ * ZB_PollActivity() switches to fast polling for the policy's hold of that kind, e.g. ahead of a response the
+ * application is waiting on. ZB_SetPollPolicy() replaces the ZB_POLL_* defaults, taking effect at once; an application
+ * that goes into a busier phase, such as a bulk transfer, can swap policies in and out. The stats give the time spent
+ * in each mode with an estimate of the radio duty cycle.
+ */
+void ZB_PollActivity(zb_poll_activity_t activity);
+void ZB_SetPollPolicy(const zb_poll_policy_t *policy);
+void ZB_GetPollStats(zb_poll_stats_t *stats);
+#endif
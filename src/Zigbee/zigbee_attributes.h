@@ -0,0 +1,194 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Compile-time attribute handler registry
+ * An application lists its (endpoint, cluster, attribute, C++ type, handler) bindings as template arguments. The
+ * registry sorts them into a constant lookup table at compile time, rejects duplicates, and on each attribute write
+ * binary-searches the table, checks the ZCL type and size, and calls the handler with the decoded value.
+ * Strings are passed as views into the message buffer; nothing is allocated or copied beyond scalar loads.
+ *
+ *     static void onIdentifyTime(uint16_t seconds) { ... }
+ *
+ *     typedef ZbAttributeRegistry<
+ *         ZbAttributeBinding<1, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, uint16_t, onIdentifyTime>
+ *     > AppAttributes;
+ *
+ *     esp_err_t onAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message) {
+ *         return AppAttributes::dispatch(message);
+ *     }
+ */
+#pragma once
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_zigbee_core.h"
+
+/* ZCL character string: length-prefixed, not NUL terminated */
+typedef struct {
+    const char *data;
+    uint8_t length;
+} zb_char_string_t;
+
+/* ZCL octet string */
+typedef struct {
+    const uint8_t *data;
+    uint8_t length;
+} zb_octet_string_t;
+
+/* Maps a C++ type to the ZCL data types it may be decoded from */
+template <typename T>
+struct ZbAttributeType;
+
+template <typename T, uint8_t... ZclTypes>
+struct ZbScalarAttributeType {
+    static bool accepts(uint8_t type) {
+        for (uint8_t zclType : {ZclTypes...}) {
+            if (zclType == type) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool decode(const esp_zb_zcl_attribute_data_t &data, T *value) {
+        if (!accepts(data.type) || data.size != sizeof(T) || data.value == NULL) {
+            return false;
+        }
+        // The stack makes no alignment promise, so load through memcpy; it compiles to a plain load either way
+        memcpy(value, data.value, sizeof(T));
+        return true;
+    }
+};
+
+template <> struct ZbAttributeType<bool> : ZbScalarAttributeType<bool, ESP_ZB_ZCL_ATTR_TYPE_BOOL> {};
+template <> struct ZbAttributeType<uint8_t> : ZbScalarAttributeType<uint8_t, ESP_ZB_ZCL_ATTR_TYPE_U8, ESP_ZB_ZCL_ATTR_TYPE_8BIT, ESP_ZB_ZCL_ATTR_TYPE_8BITMAP, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM> {};
+template <> struct ZbAttributeType<uint16_t> : ZbScalarAttributeType<uint16_t, ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_TYPE_16BIT, ESP_ZB_ZCL_ATTR_TYPE_16BITMAP, ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM> {};
+template <> struct ZbAttributeType<uint32_t> : ZbScalarAttributeType<uint32_t, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_TYPE_32BIT, ESP_ZB_ZCL_ATTR_TYPE_32BITMAP, ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME> {};
+template <> struct ZbAttributeType<uint64_t> : ZbScalarAttributeType<uint64_t, ESP_ZB_ZCL_ATTR_TYPE_U64> {};
+template <> struct ZbAttributeType<int8_t> : ZbScalarAttributeType<int8_t, ESP_ZB_ZCL_ATTR_TYPE_S8> {};
+template <> struct ZbAttributeType<int16_t> : ZbScalarAttributeType<int16_t, ESP_ZB_ZCL_ATTR_TYPE_S16> {};
+template <> struct ZbAttributeType<int32_t> : ZbScalarAttributeType<int32_t, ESP_ZB_ZCL_ATTR_TYPE_S32> {};
+template <> struct ZbAttributeType<int64_t> : ZbScalarAttributeType<int64_t, ESP_ZB_ZCL_ATTR_TYPE_S64> {};
+template <> struct ZbAttributeType<float> : ZbScalarAttributeType<float, ESP_ZB_ZCL_ATTR_TYPE_SINGLE> {};
+template <> struct ZbAttributeType<double> : ZbScalarAttributeType<double, ESP_ZB_ZCL_ATTR_TYPE_DOUBLE> {};
+
+template <typename View, uint8_t ZclType>
+struct ZbStringAttributeType {
+    static bool decode(const esp_zb_zcl_attribute_data_t &data, View *value) {
+        const uint8_t *bytes = (const uint8_t *)data.value;
+
+        // Length prefix must fit inside what the stack handed us
+        if (data.type != ZclType || bytes == NULL || data.size < 1 || (size_t)bytes[0] + 1 > data.size) {
+            return false;
+        }
+
+        value->data = (decltype(value->data))(bytes + 1);
+        value->length = bytes[0];
+        return true;
+    }
+};
+
+template <> struct ZbAttributeType<zb_char_string_t> : ZbStringAttributeType<zb_char_string_t, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING> {};
+template <> struct ZbAttributeType<zb_octet_string_t> : ZbStringAttributeType<zb_octet_string_t, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING> {};
+
+constexpr uint64_t ZbAttributeKey(uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    return ((uint64_t)endpoint << 32) | ((uint64_t)cluster << 16) | attribute;
+}
+
+typedef esp_err_t (*zb_attribute_invoker_t)(const esp_zb_zcl_attribute_data_t &data);
+
+typedef struct {
+    uint64_t key;
+    zb_attribute_invoker_t invoke;
+} zb_attribute_entry_t;
+
+template <uint8_t Endpoint, uint16_t Cluster, uint16_t Attribute, typename T, void (*Handler)(T value)>
+struct ZbAttributeBinding {
+    static constexpr uint64_t key = ZbAttributeKey(Endpoint, Cluster, Attribute);
+
+    static esp_err_t invoke(const esp_zb_zcl_attribute_data_t &data) {
+        T value;
+        if (!ZbAttributeType<T>::decode(data, &value)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        Handler(value);
+        return ESP_OK;
+    }
+};
+
+// Insertion sort; the tables are small and this only ever runs in the compiler
+template <size_t N>
+constexpr std::array<zb_attribute_entry_t, N> ZbSortAttributeEntries(std::array<zb_attribute_entry_t, N> table) {
+    for (size_t i = 1; i < N; i++) {
+        zb_attribute_entry_t entry = table[i];
+        size_t j = i;
+        while (j > 0 && table[j - 1].key > entry.key) {
+            table[j] = table[j - 1];
+            j--;
+        }
+        table[j] = entry;
+    }
+    return table;
+}
+
+template <size_t N>
+constexpr bool ZbAttributeEntriesUnique(const std::array<zb_attribute_entry_t, N> &table) {
+    for (size_t i = 1; i < N; i++) {
+        if (table[i - 1].key == table[i].key) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename... Bindings>
+class ZbAttributeRegistry {
+    static constexpr size_t count = sizeof...(Bindings);
+    typedef std::array<zb_attribute_entry_t, count> table_t;
+
+    static_assert(count > 0, "ZbAttributeRegistry needs at least one binding");
+
+    static constexpr table_t table = ZbSortAttributeEntries<count>(table_t{{{Bindings::key, &Bindings::invoke}...}});
+    static_assert(ZbAttributeEntriesUnique<count>(table), "ZbAttributeRegistry has two bindings for the same endpoint/cluster/attribute");
+
+public:
+    /* Handler for a key, or NULL if nothing is bound to it */
+    static zb_attribute_invoker_t find(uint64_t key) {
+        size_t low = 0;
+        size_t high = count;
+
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (table[mid].key < key) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        return (low < count && table[low].key == key) ? table[low].invoke : NULL;
+    }
+
+    /* ESP_OK once a handler ran, ESP_ERR_NOT_FOUND if nothing is bound, ESP_ERR_INVALID_ARG if the value failed its type/size checks */
+    static esp_err_t dispatch(const esp_zb_zcl_set_attr_value_message_t *message) {
+        zb_attribute_invoker_t invoke = find(ZbAttributeKey(message->info.dst_endpoint, message->info.cluster, message->attribute.id));
+        return invoke ? invoke(message->attribute.data) : ESP_ERR_NOT_FOUND;
+    }
+
+    static constexpr size_t size() { return count; }
+};
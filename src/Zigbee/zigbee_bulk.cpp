@@ -0,0 +1,436 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Log/deferred_log.h"
+#include "Trace/trace.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_bulk.h"
+#include "Zigbee/zigbee_commands.h"
+
+#define ZCL_FRAME_CONTROL_BULK_RESPONSE                                                                                                    \
+    (ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC | ZCL_FRAME_CONTROL_SERVER_TO_CLIENT |                    \
+     ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE)
+#define ZCL_MANUFACTURER_HEADER_SIZE 5          /* frame control, manufacturer code, sequence number & command id */
+
+static_assert(ZB_BULK_DATA_HEADER_SIZE + ZB_BULK_MAX_CHUNK_SIZE <= ZB_COMMAND_MAX_PAYLOAD_SIZE, "Data frames must not be fragmented");
+
+/* Frame layouts, after the ZCL header */
+typedef ZbPayload<uint8_t, uint32_t, uint8_t> start_request_t;                       /* source, offset, window */
+typedef ZbPayload<uint8_t, uint32_t, uint32_t> ack_t;                                /* transfer, offset, received */
+typedef ZbPayload<uint8_t> abort_t;                                                  /* transfer */
+typedef ZbPayload<uint8_t, uint8_t, uint32_t, uint8_t, uint8_t> start_response_t;    /* status, transfer, size, chunk size, window */
+typedef ZbPayload<uint8_t, uint32_t, zb_bytes_t> data_t;                             /* transfer, offset, data */
+typedef ZbPayload<uint8_t, uint8_t, uint32_t> end_t;                                 /* transfer, status, acknowledged offset */
+
+typedef struct {
+    bool used;
+    uint8_t id;
+    zb_bulk_source_t source;
+} bulk_source_entry_t;
+
+// Only touched on the Zigbee stack task or with the stack lock held
+static zb_bulk_config_t config = {
+    .window = ZB_BULK_MAX_WINDOW,
+    .chunkSize = ZB_BULK_MAX_CHUNK_SIZE,
+    .timeoutMs = ZB_BULK_TIMEOUT_MS,
+    .maxRetries = ZB_BULK_MAX_RETRIES,
+};
+static zb_bulk_engine_t engine;
+static bulk_source_entry_t sources[ZB_BULK_MAX_SOURCES];
+static uint8_t serverEndpoint = 0;
+static uint8_t currentSource = 0;
+static uint16_t allowedCollector = ZB_BULK_NO_COLLECTOR;
+static uint16_t collectorAddress = 0;
+static uint8_t collectorEndpoint = 0;
+static uint8_t transactionSequence = 0;
+static uint8_t nextTransfer = 0;
+
+static void onBulkAlarm(uint8_t param);
+
+/********************* Sources **************************/
+static esp_err_t ramRead(void *context, uint32_t offset, void *data, size_t size) {
+    memcpy(data, (const uint8_t *)context + offset, size);
+    return ESP_OK;
+}
+
+static esp_err_t partitionRead(void *context, uint32_t offset, void *data, size_t size) {
+    return esp_partition_read((const esp_partition_t *)context, offset, data, size);
+}
+
+static esp_err_t fileRead(void *context, uint32_t offset, void *data, size_t size) {
+    FILE *file = (FILE *)context;
+
+    if (fseek(file, offset, SEEK_SET) != 0 || fread(data, 1, size, file) != size) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static const zb_bulk_source_t *findSource(uint8_t id) {
+    for (size_t i = 0; i < ZB_BULK_MAX_SOURCES; i++) {
+        if (sources[i].used && sources[i].id == id) {
+            return &sources[i].source;
+        }
+    }
+    return NULL;
+}
+
+static void addBuiltInSources() {
+#ifdef TRACE_RECORDER
+    zb_bulk_source_t source;
+
+    // Read as it stands; the log drain task may be writing to it, which the collector's decoder sees as a torn record
+    const trace_flash_t *trace = TRACE_GetFlash();
+    if (trace != NULL && findSource(ZB_BULK_SOURCE_TRACE) == NULL) {
+        source.read = trace->read;
+        source.context = trace->context;
+        source.size = trace->sectorSize * trace->sectorCount;
+        ZB_AddBulkSource(ZB_BULK_SOURCE_TRACE, &source);
+    }
+#endif
+}
+
+/********************* Frames **************************/
+static void sendFrameTo(uint16_t address, uint8_t endpoint, uint8_t commandId, const uint8_t *payload, size_t length) {
+    uint8_t asdu[ZCL_MANUFACTURER_HEADER_SIZE + ZB_COMMAND_MAX_PAYLOAD_SIZE];
+
+    asdu[0] = ZCL_FRAME_CONTROL_BULK_RESPONSE;
+    asdu[1] = ZB_BULK_MANUFACTURER_CODE & 0xff;
+    asdu[2] = ZB_BULK_MANUFACTURER_CODE >> 8;
+    asdu[3] = transactionSequence++;
+    asdu[4] = commandId;
+    memcpy(&asdu[ZCL_MANUFACTURER_HEADER_SIZE], payload, length);
+
+    esp_zb_apsde_data_req_t request = {};
+    request.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    request.dst_addr.addr_short = address;
+    request.dst_endpoint = endpoint;
+    request.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    request.cluster_id = ZB_CLUSTER_ID_BULK_TRANSFER;
+    request.src_endpoint = serverEndpoint;
+    request.asdu_length = ZCL_MANUFACTURER_HEADER_SIZE + length;
+    request.asdu = asdu;
+
+    // A chunk that cannot be sent now is sent again once it times out
+    esp_err_t err = esp_zb_aps_data_request(&request);
+    if (err != ESP_OK) {
+        dlog_w("Failed to send bulk command 0x%x to 0x%04hx (status: %s)", commandId, address, esp_err_to_name(err));
+    }
+}
+
+static void sendFrame(uint8_t commandId, const uint8_t *payload, size_t length) {
+    sendFrameTo(collectorAddress, collectorEndpoint, commandId, payload, length);
+}
+
+static void sendStartResponse(uint8_t status, uint32_t size) {
+    uint8_t payload[ZB_COMMAND_MAX_PAYLOAD_SIZE];
+    size_t length;
+
+    start_response_t::encode(payload, sizeof(payload), &length, status, engine.transfer, size, engine.config.chunkSize, engine.window);
+    sendFrame(ZB_BULK_CMD_START_RESPONSE, payload, length);
+}
+
+// Answers a request that is turned away, leaving the transfer in progress, if any, as it is
+static void rejectStart(const esp_zb_apsde_data_ind_t *ind, uint8_t status) {
+    uint8_t payload[ZB_COMMAND_MAX_PAYLOAD_SIZE];
+    size_t length;
+
+    start_response_t::encode(payload, sizeof(payload), &length, status, 0, 0, engine.config.chunkSize, engine.window);
+    sendFrameTo(ind->src_short_addr, ind->src_endpoint, ZB_BULK_CMD_START_RESPONSE, payload, length);
+}
+
+static void sendData(const zb_bulk_chunk_t *chunk) {
+    uint8_t payload[ZB_COMMAND_MAX_PAYLOAD_SIZE];
+    size_t length;
+
+    data_t::encode(payload, sizeof(payload), &length, engine.transfer, chunk->offset, zb_bytes_t{chunk->data, chunk->size});
+    sendFrame(ZB_BULK_CMD_DATA, payload, length);
+}
+
+static void sendEnd(uint8_t status) {
+    uint8_t payload[ZB_COMMAND_MAX_PAYLOAD_SIZE];
+    size_t length;
+
+    end_t::encode(payload, sizeof(payload), &length, engine.transfer, status, engine.ackedOffset);
+    sendFrame(ZB_BULK_CMD_END, payload, length);
+}
+
+/********************* Transfer **************************/
+static uint8_t endStatus(esp_err_t error) {
+    switch (error) {
+        case ESP_OK: return ZB_BULK_STATUS_SUCCESS;
+        case ESP_ERR_TIMEOUT: return ZB_BULK_STATUS_TIMEOUT;
+        default: return ZB_BULK_STATUS_ABORT;
+    }
+}
+
+static void onTransferEnded() {
+    const zb_bulk_stats_t *stats = &engine.stats;
+
+    esp_zb_scheduler_alarm_cancel(onBulkAlarm, 0);
+
+    if (engine.state == ZB_BULK_DONE) {
+        dlog_i("Bulk transfer %d of source 0x%02x done: %lu bytes from offset %lu in %lu ms (%lu B/s)", engine.transfer, currentSource,
+               (unsigned long)stats->bytes, (unsigned long)stats->resumedFrom, (unsigned long)(stats->endMs - stats->startMs),
+               (unsigned long)stats->bytesPerSecond);
+        dlog_i("Bulk transfer %d: window %d, %lu chunks, %lu sent again (%lu timed out, %lu lost)", engine.transfer, stats->window,
+               (unsigned long)stats->chunks, (unsigned long)stats->retransmits, (unsigned long)stats->timeouts, (unsigned long)stats->selective);
+    } else {
+        dlog_w("Bulk transfer %d of source 0x%02x failed at offset %lu (%s), %lu chunks, %lu sent again", engine.transfer, currentSource,
+               (unsigned long)engine.ackedOffset, esp_err_to_name(engine.error), (unsigned long)stats->chunks, (unsigned long)stats->retransmits);
+    }
+
+    sendEnd(endStatus(engine.error));
+}
+
+// Send whatever chunks are due, then wake again when the next one is
+static void pump() {
+    uint32_t now = millis();
+    zb_bulk_chunk_t chunk;
+
+    esp_zb_scheduler_alarm_cancel(onBulkAlarm, 0);
+
+    while (ZB_BulkEngineNextChunk(&engine, now, &chunk)) {
+        sendData(&chunk);
+    }
+
+    if (engine.state != ZB_BULK_SENDING) {
+        onTransferEnded();
+        return;
+    }
+
+    uint32_t delay = ZB_BulkEngineNextDelay(&engine, now);
+    if (delay != ZB_BULK_NEVER) {
+        esp_zb_scheduler_alarm(onBulkAlarm, 0, delay ? delay : 1);
+    }
+}
+
+static void onBulkAlarm(uint8_t param) {
+    pump();
+}
+
+/********************* Collector frames **************************/
+static void onStartRequest(const esp_zb_apsde_data_ind_t *ind, const uint8_t *payload, size_t length) {
+    start_request_t::values_t request;
+
+    if (!start_request_t::parse(payload, length, &request)) {
+        return;
+    }
+
+    uint8_t sourceId = std::get<0>(request);
+    uint32_t offset = std::get<1>(request);
+    const zb_bulk_source_t *source = findSource(sourceId);
+
+    if (ind->src_short_addr != 0x0000 && ind->src_short_addr != allowedCollector) {
+        dlog_w("Bulk transfer of source 0x%02x refused to 0x%04hx, not the trust centre or collector", sourceId, ind->src_short_addr);
+        rejectStart(ind, ZB_BULK_STATUS_NOT_AUTHORIZED);
+        return;
+    }
+
+    // Another collector waits its turn; the current one may start over, and what was in progress gives way
+    if (engine.state == ZB_BULK_SENDING && ind->src_short_addr != collectorAddress) {
+        dlog_i("Bulk transfer of source 0x%02x to 0x%04hx deferred, busy with 0x%04hx", sourceId, ind->src_short_addr, collectorAddress);
+        rejectStart(ind, ZB_BULK_STATUS_BUSY);
+        return;
+    }
+    if (engine.state == ZB_BULK_SENDING) {
+        dlog_i("Bulk transfer %d of source 0x%02x superseded at offset %lu", engine.transfer, currentSource, (unsigned long)engine.ackedOffset);
+        esp_zb_scheduler_alarm_cancel(onBulkAlarm, 0);
+    }
+
+    collectorAddress = ind->src_short_addr;
+    collectorEndpoint = ind->src_endpoint;
+    currentSource = sourceId;
+    engine.transfer = nextTransfer++;
+
+    if (source == NULL) {
+        engine.state = ZB_BULK_IDLE;
+        sendStartResponse(ZB_BULK_STATUS_NOT_FOUND, 0);
+        return;
+    }
+
+    if (ZB_BulkEngineBegin(&engine, source, engine.transfer, offset, std::get<2>(request), millis()) != ESP_OK) {
+        engine.state = ZB_BULK_IDLE;
+        sendStartResponse(ZB_BULK_STATUS_INVALID_VALUE, source->size);
+        return;
+    }
+
+    dlog_i("Bulk transfer %d of source 0x%02x to 0x%04hx: %lu of %lu bytes, window %d", engine.transfer, sourceId, collectorAddress,
+           (unsigned long)(source->size - offset), (unsigned long)source->size, engine.window);
+    sendStartResponse(ZB_BULK_STATUS_SUCCESS, source->size);
+    pump();
+}
+
+static void onAck(const esp_zb_apsde_data_ind_t *ind, const uint8_t *payload, size_t length) {
+    ack_t::values_t ack;
+
+    if (!ack_t::parse(payload, length, &ack) || std::get<0>(ack) != engine.transfer || ind->src_short_addr != collectorAddress ||
+        engine.state != ZB_BULK_SENDING) {
+        return;
+    }
+
+    ZB_BulkEngineOnAck(&engine, std::get<1>(ack), std::get<2>(ack), millis());
+    pump();
+}
+
+static void onAbort(const esp_zb_apsde_data_ind_t *ind, const uint8_t *payload, size_t length) {
+    abort_t::values_t request;
+
+    if (!abort_t::parse(payload, length, &request) || std::get<0>(request) != engine.transfer || ind->src_short_addr != collectorAddress ||
+        engine.state != ZB_BULK_SENDING) {
+        return;
+    }
+
+    ZB_BulkEngineAbort(&engine, millis());
+    onTransferEnded();
+}
+
+// External interface functions
+void ZB_BulkRamSource(zb_bulk_source_t *source, const void *data, uint32_t size) {
+    source->read = ramRead;
+    source->context = (void *)data;
+    source->size = size;
+}
+
+void ZB_BulkPartitionSource(zb_bulk_source_t *source, const esp_partition_t *partition) {
+    source->read = partitionRead;
+    source->context = (void *)partition;
+    source->size = partition->size;
+}
+
+esp_err_t ZB_BulkFileSource(zb_bulk_source_t *source, FILE *file) {
+    if (fseek(file, 0, SEEK_END) != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    long size = ftell(file);
+    if (size < 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    source->read = fileRead;
+    source->context = file;
+    source->size = (uint32_t)size;
+    return ESP_OK;
+}
+
+void ZB_BulkAddClusters(uint8_t endpoint, esp_zb_cluster_list_t *clusterList) {
+    ZB_BulkEngineInit(&engine, &config);
+    serverEndpoint = endpoint;
+    addBuiltInSources();
+
+    // The stack copies these into its own storage
+    esp_zb_attribute_list_t *bulkCluster = esp_zb_zcl_attr_list_create(ZB_CLUSTER_ID_BULK_TRANSFER);
+    ESP_ERROR_CHECK(esp_zb_custom_cluster_add_custom_attr(bulkCluster, ZB_ATTR_BULK_CHUNK_SIZE_ID, ESP_ZB_ZCL_ATTR_TYPE_U8,
+                                                          ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &engine.config.chunkSize));
+    ESP_ERROR_CHECK(esp_zb_custom_cluster_add_custom_attr(bulkCluster, ZB_ATTR_BULK_MAX_WINDOW_ID, ESP_ZB_ZCL_ATTR_TYPE_U8,
+                                                          ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &engine.config.window));
+    ESP_ERROR_CHECK(esp_zb_cluster_list_add_custom_cluster(clusterList, bulkCluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
+}
+
+bool ZB_BulkHandleIndication(const esp_zb_apsde_data_ind_t *ind) {
+    if (serverEndpoint == 0 || ind->cluster_id != ZB_CLUSTER_ID_BULK_TRANSFER || ind->dst_endpoint != serverEndpoint ||
+        ind->asdu_length < ZCL_MANUFACTURER_HEADER_SIZE) {
+        return false;
+    }
+
+    // Profile wide commands, such as reads of our attributes, are the stack's
+    uint8_t frameControl = ind->asdu[0];
+    uint16_t manufacturer = ind->asdu[1] | ind->asdu[2] << 8;
+    if ((frameControl & (ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC | ZCL_FRAME_CONTROL_SERVER_TO_CLIENT)) !=
+            (ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC) ||
+        manufacturer != ZB_BULK_MANUFACTURER_CODE) {
+        return false;
+    }
+
+    const uint8_t *payload = ind->asdu + ZCL_MANUFACTURER_HEADER_SIZE;
+    size_t length = ind->asdu_length - ZCL_MANUFACTURER_HEADER_SIZE;
+
+    switch (ind->asdu[ZCL_MANUFACTURER_HEADER_SIZE - 1]) {
+        case ZB_BULK_CMD_START_REQUEST:
+            onStartRequest(ind, payload, length);
+            break;
+        case ZB_BULK_CMD_ACK:
+            onAck(ind, payload, length);
+            break;
+        case ZB_BULK_CMD_ABORT:
+            onAbort(ind, payload, length);
+            break;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+void ZB_SetBulkConfig(const zb_bulk_config_t *bulkConfig) {
+    config = *bulkConfig;
+}
+
+void ZB_SetBulkCollector(uint16_t shortAddress) {
+    allowedCollector = shortAddress;
+}
+
+esp_err_t ZB_AddBulkSource(uint8_t id, const zb_bulk_source_t *source) {
+    bulk_source_entry_t *entry = NULL;
+
+    for (size_t i = 0; i < ZB_BULK_MAX_SOURCES; i++) {
+        if (sources[i].used && sources[i].id == id) {
+            entry = &sources[i];
+            break;
+        }
+        if (!sources[i].used && entry == NULL) {
+            entry = &sources[i];
+        }
+    }
+
+    if (entry == NULL) {
+        log_e("Cannot add bulk source 0x%02x, all %d in use", id, ZB_BULK_MAX_SOURCES);
+        return ESP_ERR_NO_MEM;
+    }
+
+    entry->used = true;
+    entry->id = id;
+    entry->source = *source;
+    return ESP_OK;
+}
+
+esp_err_t ZB_AddBulkCoredumpSource() {
+    zb_bulk_source_t source;
+
+    const esp_partition_t *coredump = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+    if (coredump == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ZB_BulkPartitionSource(&source, coredump);
+    return ZB_AddBulkSource(ZB_BULK_SOURCE_COREDUMP, &source);
+}
+
+void ZB_GetBulkStatus(zb_bulk_status_t *status) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+
+    const zb_bulk_source_t *source = findSource(currentSource);
+    status->state = engine.state;
+    status->error = engine.error;
+    status->source = currentSource;
+    status->transfer = engine.transfer;
+    status->size = source != NULL ? source->size : 0;
+    status->ackedOffset = engine.ackedOffset;
+    status->collectorAddress = collectorAddress;
+    status->stats = engine.stats;
+
+    esp_zb_lock_release();
+}
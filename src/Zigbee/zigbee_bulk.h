@@ -0,0 +1,99 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Bulk transfer service
+ * A manufacturer specific cluster on the first endpoint through which a collector pulls data off the device: sample
+ * histories in RAM, a flash partition such as `coredump`, the trace region, or a file. The collector asks for a source
+ * by id and the offset to start at; the device answers with the source's size and the chunk size & window it will use,
+ * then streams Data frames through a zigbee_bulk_engine.h engine, keeping up to a window of them unacknowledged. The
+ * collector acknowledges with the offset it has everything before, plus a bitmap of the chunks it holds past that, so
+ * only what went missing is sent again; a transfer that was cut short is resumed by asking again from the offset it
+ * got to. A Transfer End frame closes every transfer, and its stats are logged and kept for ZB_GetBulkStatus().
+ *
+ * Sources can hold anything in the device's memory, so only the trust centre and the collector set with
+ * ZB_SetBulkCollector() may start a transfer, and while one runs only its collector may start another. The `coredump`
+ * partition is only served once the application opts in with ZB_AddBulkCoredumpSource().
+ *
+ * Like the OTA client, frames are built and parsed here off the APS data indication rather than going through custom
+ * cluster command callbacks, so chunks go out as soon as the window has room without waiting on the event worker.
+ * All functions but the source helpers run on the Zigbee stack task.
+ */
+#pragma once
+
+#include <stdio.h>
+
+#include "aps/esp_zigbee_aps.h"
+#include "esp_partition.h"
+#include "esp_zigbee_core.h"
+#include "Zigbee/zigbee_bulk_engine.h"
+
+#define ZB_CLUSTER_ID_BULK_TRANSFER 0xFC06
+
+#ifndef ZB_BULK_MANUFACTURER_CODE
+#define ZB_BULK_MANUFACTURER_CODE 0x131B        /* Espressif */
+#endif
+
+#define ZB_BULK_MAX_SOURCES 8
+
+#define ZB_BULK_NO_COLLECTOR 0xFFFF             /* for ZB_SetBulkCollector(): the trust centre only */
+
+/* Commands, collector to device */
+#define ZB_BULK_CMD_START_REQUEST 0x00          /* source (U8), offset (U32), window (U8, 0 for the device's) */
+#define ZB_BULK_CMD_ACK 0x01                    /* transfer (U8), offset (U32), received (U32 bitmap of later chunks) */
+#define ZB_BULK_CMD_ABORT 0x02                  /* transfer (U8) */
+
+/* Commands, device to collector */
+#define ZB_BULK_CMD_START_RESPONSE 0x00         /* status (U8), transfer (U8), source size (U32), chunk size (U8), window (U8) */
+#define ZB_BULK_CMD_DATA 0x01                   /* transfer (U8), offset (U32), data to the end of the frame */
+#define ZB_BULK_CMD_END 0x02                    /* transfer (U8), status (U8), acknowledged offset (U32) */
+
+#define ZB_BULK_STATUS_SUCCESS 0x00
+#define ZB_BULK_STATUS_NOT_AUTHORIZED 0x7e      /* neither the trust centre nor the configured collector */
+#define ZB_BULK_STATUS_INVALID_VALUE 0x87       /* offset past the end of the source */
+#define ZB_BULK_STATUS_NOT_FOUND 0x8b           /* no source with that id */
+#define ZB_BULK_STATUS_TIMEOUT 0x94             /* a chunk went unacknowledged through every retry */
+#define ZB_BULK_STATUS_ABORT 0x95               /* the source could not be read, or the collector aborted */
+#define ZB_BULK_STATUS_BUSY 0x97                /* another collector's transfer is running, ask again later */
+
+/* Server attributes, read-only */
+#define ZB_ATTR_BULK_CHUNK_SIZE_ID 0x0000       /* U8 */
+#define ZB_ATTR_BULK_MAX_WINDOW_ID 0x0001       /* U8 */
+
+/* Sources the service provides, where present */
+#define ZB_BULK_SOURCE_COREDUMP 0xF0            /* the `coredump` partition, once added with ZB_AddBulkCoredumpSource() */
+#define ZB_BULK_SOURCE_TRACE 0xF1               /* the trace region, built with TRACE_RECORDER; decode it with trace_log.h */
+
+typedef struct {
+    zb_bulk_state_t state;                      /* of the last transfer */
+    esp_err_t error;
+    uint8_t source;
+    uint8_t transfer;
+    uint32_t size;                              /* of the source */
+    uint32_t ackedOffset;
+    uint16_t collectorAddress;
+    zb_bulk_stats_t stats;
+} zb_bulk_status_t;
+
+/* Sources over a RAM buffer, a partition or an open file, which must outlive the source. ESP_ERR_INVALID_SIZE for a
+ * file that cannot be sized.
+ */
+void ZB_BulkRamSource(zb_bulk_source_t *source, const void *data, uint32_t size);
+void ZB_BulkPartitionSource(zb_bulk_source_t *source, const esp_partition_t *partition);
+esp_err_t ZB_BulkFileSource(zb_bulk_source_t *source, FILE *file);
+
+/* Called while creating the first endpoint to add the bulk transfer server cluster */
+void ZB_BulkAddClusters(uint8_t endpoint, esp_zb_cluster_list_t *clusterList);
+
+/* Takes the bulk transfer frames for our endpoint out of the APS data indication, returning true if it did */
+bool ZB_BulkHandleIndication(const esp_zb_apsde_data_ind_t *ind);
@@ -0,0 +1,264 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Zigbee/zigbee_bulk_engine.h"
+
+static_assert(ZB_BULK_MAX_CHUNK_SIZE <= 0xff, "chunk sizes are one byte");
+static_assert(ZB_BULK_MIN_CHUNK_SIZE <= ZB_BULK_MAX_CHUNK_SIZE, "ZB_BULK_MIN_CHUNK_SIZE must not exceed ZB_BULK_MAX_CHUNK_SIZE");
+
+// a is earlier than b, allowing for the millisecond clock wrapping
+static inline bool isBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static void finish(zb_bulk_engine_t *engine, zb_bulk_state_t state, esp_err_t error, uint32_t nowMs) {
+    zb_bulk_stats_t *stats = &engine->stats;
+
+    engine->state = state;
+    engine->error = error;
+    stats->endMs = nowMs;
+    if (state == ZB_BULK_DONE && nowMs != stats->startMs) {
+        stats->bytesPerSecond = (uint32_t)((uint64_t)stats->bytes * 1000 / (nowMs - stats->startMs));
+    }
+
+    memset(engine->slots, 0, sizeof(engine->slots));
+}
+
+static zb_bulk_slot_t *freeSlot(zb_bulk_engine_t *engine) {
+    for (uint8_t i = 0; i < engine->window; i++) {
+        if (!engine->slots[i].inFlight) {
+            return &engine->slots[i];
+        }
+    }
+    return NULL;
+}
+
+// The chunk due again soonest: a lost one before any that timed out, the earliest sent first within each
+static zb_bulk_slot_t *resendSlot(zb_bulk_engine_t *engine, uint32_t nowMs) {
+    zb_bulk_slot_t *due = NULL;
+
+    for (uint8_t i = 0; i < engine->window; i++) {
+        zb_bulk_slot_t *slot = &engine->slots[i];
+
+        if (!slot->inFlight || (!slot->lost && isBefore(nowMs, slot->sentMs + engine->config.timeoutMs))) {
+            continue;
+        }
+        if (due == NULL || (slot->lost && !due->lost) || (slot->lost == due->lost && slot->sequence < due->sequence)) {
+            due = slot;
+        }
+    }
+
+    return due;
+}
+
+static bool send(zb_bulk_engine_t *engine, zb_bulk_slot_t *slot, uint32_t nowMs, zb_bulk_chunk_t *chunk) {
+    esp_err_t err = engine->source.read(engine->source.context, slot->offset, chunk->data, slot->size);
+    if (err != ESP_OK) {
+        finish(engine, ZB_BULK_FAILED, err, nowMs);
+        return false;
+    }
+
+    chunk->offset = slot->offset;
+    chunk->size = slot->size;
+    slot->inFlight = true;
+    slot->lost = false;
+    slot->sentMs = nowMs;
+    slot->sequence = ++engine->sequence;
+    engine->stats.chunks++;
+
+    uint8_t inFlight = ZB_BulkEngineInFlight(engine);
+    if (inFlight > engine->stats.peakInFlight) {
+        engine->stats.peakInFlight = inFlight;
+    }
+    return true;
+}
+
+void ZB_BulkEngineInit(zb_bulk_engine_t *engine, const zb_bulk_config_t *config) {
+    memset(engine, 0, sizeof(*engine));
+    engine->config = *config;
+    engine->config.window = config->window < 1 ? 1 : config->window > ZB_BULK_MAX_WINDOW ? ZB_BULK_MAX_WINDOW : config->window;
+    engine->config.chunkSize = config->chunkSize < ZB_BULK_MIN_CHUNK_SIZE   ? ZB_BULK_MIN_CHUNK_SIZE
+                               : config->chunkSize > ZB_BULK_MAX_CHUNK_SIZE ? ZB_BULK_MAX_CHUNK_SIZE
+                                                                            : config->chunkSize;
+    engine->state = ZB_BULK_IDLE;
+}
+
+esp_err_t ZB_BulkEngineBegin(zb_bulk_engine_t *engine, const zb_bulk_source_t *source, uint8_t transfer, uint32_t offset, uint8_t window,
+                             uint32_t nowMs) {
+    if (offset > source->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    engine->source = *source;
+    engine->window = window == 0 || window > engine->config.window ? engine->config.window : window;
+    engine->state = ZB_BULK_SENDING;
+    engine->error = ESP_OK;
+    engine->transfer = transfer;
+    engine->nextOffset = offset;
+    engine->ackedOffset = offset;
+    memset(engine->slots, 0, sizeof(engine->slots));
+
+    memset(&engine->stats, 0, sizeof(engine->stats));
+    engine->stats.window = engine->window;
+    engine->stats.resumedFrom = offset;
+    engine->stats.startMs = nowMs;
+
+    if (offset == source->size) {
+        finish(engine, ZB_BULK_DONE, ESP_OK, nowMs);
+    }
+    return ESP_OK;
+}
+
+bool ZB_BulkEngineNextChunk(zb_bulk_engine_t *engine, uint32_t nowMs, zb_bulk_chunk_t *chunk) {
+    if (engine->state != ZB_BULK_SENDING) {
+        return false;
+    }
+
+    zb_bulk_slot_t *slot = resendSlot(engine, nowMs);
+    if (slot != NULL) {
+        if (slot->retries >= engine->config.maxRetries) {
+            finish(engine, ZB_BULK_FAILED, ESP_ERR_TIMEOUT, nowMs);
+            return false;
+        }
+
+        slot->retries++;
+        engine->stats.retransmits++;
+        if (slot->lost) {
+            engine->stats.selective++;
+        } else {
+            engine->stats.timeouts++;
+        }
+        return send(engine, slot, nowMs, chunk);
+    }
+
+    if (engine->nextOffset >= engine->source.size || (slot = freeSlot(engine)) == NULL) {
+        return false;
+    }
+
+    uint32_t remaining = engine->source.size - engine->nextOffset;
+    slot->offset = engine->nextOffset;
+    slot->size = remaining < engine->config.chunkSize ? remaining : engine->config.chunkSize;
+    slot->retries = 0;
+    engine->nextOffset += slot->size;
+
+    return send(engine, slot, nowMs, chunk);
+}
+
+void ZB_BulkEngineOnAck(zb_bulk_engine_t *engine, uint32_t offset, uint32_t received, uint32_t nowMs) {
+    uint8_t chunkSize = engine->config.chunkSize;
+    uint32_t latestReceived = 0;
+    bool progressed = false;
+
+    // Nothing past what has been sent can have arrived
+    if (engine->state != ZB_BULK_SENDING || offset > engine->nextOffset) {
+        return;
+    }
+    engine->stats.acks++;
+
+    if (offset > engine->ackedOffset) {
+        engine->stats.bytes += offset - engine->ackedOffset;
+        engine->ackedOffset = offset;
+        progressed = true;
+    }
+
+    for (uint8_t i = 0; i < engine->window; i++) {
+        zb_bulk_slot_t *slot = &engine->slots[i];
+
+        if (!slot->inFlight) {
+            continue;
+        }
+
+        bool arrived = slot->offset + slot->size <= offset;
+        if (!arrived && slot->offset >= offset && (slot->offset - offset) % chunkSize == 0) {
+            uint32_t bit = (slot->offset - offset) / chunkSize;
+            arrived = bit < 32 && (received & (1UL << bit)) != 0;
+        }
+
+        if (arrived) {
+            latestReceived = slot->sequence > latestReceived ? slot->sequence : latestReceived;
+            slot->inFlight = false;
+            progressed = true;
+        }
+    }
+
+    // Whatever was sent before a chunk that got through, and is still missing, was lost on the way
+    for (uint8_t i = 0; i < engine->window; i++) {
+        zb_bulk_slot_t *slot = &engine->slots[i];
+
+        if (slot->inFlight && slot->sequence < latestReceived) {
+            slot->lost = true;
+        }
+    }
+
+    if (!progressed) {
+        engine->stats.staleAcks++;
+    }
+    if (engine->ackedOffset >= engine->source.size) {
+        finish(engine, ZB_BULK_DONE, ESP_OK, nowMs);
+    }
+}
+
+uint32_t ZB_BulkEngineNextDelay(const zb_bulk_engine_t *engine, uint32_t nowMs) {
+    if (engine->state != ZB_BULK_SENDING) {
+        return ZB_BULK_NEVER;
+    }
+
+    uint32_t delay = ZB_BULK_NEVER;
+    bool hasFree = false;
+
+    for (uint8_t i = 0; i < engine->window; i++) {
+        const zb_bulk_slot_t *slot = &engine->slots[i];
+
+        if (!slot->inFlight) {
+            hasFree = true;
+        } else if (slot->lost) {
+            return 0;
+        } else {
+            uint32_t due = slot->sentMs + engine->config.timeoutMs;
+            uint32_t wait = isBefore(nowMs, due) ? due - nowMs : 0;
+            delay = wait < delay ? wait : delay;
+        }
+    }
+
+    if (hasFree && engine->nextOffset < engine->source.size) {
+        delay = 0;
+    }
+    return delay;
+}
+
+void ZB_BulkEngineAbort(zb_bulk_engine_t *engine, uint32_t nowMs) {
+    if (engine->state == ZB_BULK_SENDING) {
+        finish(engine, ZB_BULK_FAILED, ESP_FAIL, nowMs);
+    }
+}
+
+uint8_t ZB_BulkEngineInFlight(const zb_bulk_engine_t *engine) {
+    uint8_t inFlight = 0;
+
+    for (uint8_t i = 0; i < engine->window; i++) {
+        inFlight += engine->slots[i].inFlight;
+    }
+    return inFlight;
+}
+
+const char *ZB_BulkStateToString(zb_bulk_state_t state) {
+    switch (state) {
+        case ZB_BULK_IDLE: return "idle";
+        case ZB_BULK_SENDING: return "sending";
+        case ZB_BULK_DONE: return "done";
+        case ZB_BULK_FAILED: return "failed";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,139 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Windowed bulk transfer
+ * Pure logic over an injected source and clock, with no radio of its own: the caller sends the chunks the engine hands
+ * out and feeds back the acknowledgements the collector returns. A source is cut into chunks from the offset the
+ * transfer starts at, and up to a window of them are kept unacknowledged. Nothing is buffered: a chunk is read from
+ * the source each time it is sent, so the window costs a few bytes of bookkeeping per chunk whatever the source.
+ *
+ * An acknowledgement carries the offset everything before which has arrived, plus a bitmap of the chunks after it
+ * that have arrived out of order. A chunk missing from the bitmap while one sent after it is present is taken as lost
+ * and sent again at once; one nobody has acknowledged within the timeout is sent again too, up to a retry budget.
+ * A transfer that was cut short resumes by starting again from the offset acknowledged last.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifndef ZB_BULK_MAX_WINDOW
+#define ZB_BULK_MAX_WINDOW 16                   /* chunks unacknowledged, at most the bits in an acknowledgement */
+#endif
+
+#define ZB_BULK_DATA_HEADER_SIZE 5              /* transfer id (U8) & offset (U32) ahead of the data in a Data frame */
+#define ZB_BULK_MAX_CHUNK_SIZE 67               /* fills a Data frame to ZB_COMMAND_MAX_PAYLOAD_SIZE, unfragmented */
+#define ZB_BULK_MIN_CHUNK_SIZE 16
+
+#define ZB_BULK_TIMEOUT_MS 2000                 /* default wait for a chunk to be acknowledged before sending it again */
+#define ZB_BULK_MAX_RETRIES 8                   /* times one chunk is sent again before the transfer fails */
+#define ZB_BULK_NEVER UINT32_MAX
+
+static_assert(ZB_BULK_MAX_WINDOW <= 32, "Chunks past the acknowledged offset are acknowledged in a 32-bit bitmap");
+
+/* Where a transfer reads from, in source offsets */
+typedef struct {
+    esp_err_t (*read)(void *context, uint32_t offset, void *data, size_t size);
+    void *context;
+    uint32_t size;
+} zb_bulk_source_t;
+
+typedef struct {
+    uint8_t window;                             /* 1..ZB_BULK_MAX_WINDOW */
+    uint8_t chunkSize;                          /* ZB_BULK_MIN_CHUNK_SIZE..ZB_BULK_MAX_CHUNK_SIZE */
+    uint32_t timeoutMs;
+    uint8_t maxRetries;
+} zb_bulk_config_t;
+
+typedef enum {
+    ZB_BULK_IDLE,
+    ZB_BULK_SENDING,
+    ZB_BULK_DONE,                               /* every byte acknowledged */
+    ZB_BULK_FAILED,                             /* see error; the acknowledged offset is where to resume */
+} zb_bulk_state_t;
+
+typedef struct {
+    bool inFlight;
+    bool lost;                                  /* a chunk sent after it was acknowledged first */
+    uint8_t size;
+    uint8_t retries;
+    uint32_t offset;
+    uint32_t sentMs;
+    uint32_t sequence;                          /* order of the last send, across all chunks */
+} zb_bulk_slot_t;
+
+typedef struct {
+    uint32_t chunks;                            /* Data frames sent, retransmissions included */
+    uint32_t retransmits;                       /* chunks sent again, for either reason below */
+    uint32_t timeouts;                          /* ...as nothing was heard in time */
+    uint32_t selective;                         /* ...as a chunk sent after it was acknowledged first */
+    uint32_t acks;
+    uint32_t staleAcks;                         /* acknowledging nothing new */
+    uint8_t peakInFlight;
+    uint8_t window;                             /* as negotiated for this transfer */
+    uint32_t resumedFrom;                       /* offset the transfer started at, 0 from the beginning */
+    uint32_t bytes;                             /* acknowledged since it started */
+    uint32_t startMs;
+    uint32_t endMs;                             /* when the transfer was done or failed */
+    uint32_t bytesPerSecond;                    /* acknowledged, once done */
+} zb_bulk_stats_t;
+
+typedef struct {
+    zb_bulk_config_t config;
+    zb_bulk_source_t source;
+    uint8_t window;
+    zb_bulk_state_t state;
+    esp_err_t error;
+    uint8_t transfer;                           /* id carried in every frame, so late frames of an old one are told apart */
+    uint32_t nextOffset;                        /* first byte not yet sent */
+    uint32_t ackedOffset;                       /* everything before it acknowledged */
+    uint32_t sequence;
+    zb_bulk_slot_t slots[ZB_BULK_MAX_WINDOW];
+    zb_bulk_stats_t stats;
+} zb_bulk_engine_t;
+
+typedef struct {
+    uint32_t offset;
+    uint8_t size;
+    uint8_t data[ZB_BULK_MAX_CHUNK_SIZE];
+} zb_bulk_chunk_t;
+
+/* The config is clamped to the limits above */
+void ZB_BulkEngineInit(zb_bulk_engine_t *engine, const zb_bulk_config_t *config);
+
+/* Start sending a source from offset, with a window of at most window chunks, 0 for the configured one.
+ * ESP_ERR_INVALID_ARG for an offset past the end of the source. Whatever transfer was in progress is dropped.
+ */
+esp_err_t ZB_BulkEngineBegin(zb_bulk_engine_t *engine, const zb_bulk_source_t *source, uint8_t transfer, uint32_t offset, uint8_t window,
+                             uint32_t nowMs);
+
+/* Next chunk to send, if one is due: a lost chunk first, then one that timed out, then the next new one while the
+ * window has room. False when nothing is due, or the transfer just failed.
+ */
+bool ZB_BulkEngineNextChunk(zb_bulk_engine_t *engine, uint32_t nowMs, zb_bulk_chunk_t *chunk);
+
+/* An acknowledgement: everything before offset arrived, and bit n of received is the nth chunk after it */
+void ZB_BulkEngineOnAck(zb_bulk_engine_t *engine, uint32_t offset, uint32_t received, uint32_t nowMs);
+
+/* Time until the next chunk is due, 0 if one is due now, or ZB_BULK_NEVER */
+uint32_t ZB_BulkEngineNextDelay(const zb_bulk_engine_t *engine, uint32_t nowMs);
+
+/* The collector gave up on the transfer */
+void ZB_BulkEngineAbort(zb_bulk_engine_t *engine, uint32_t nowMs);
+
+uint8_t ZB_BulkEngineInFlight(const zb_bulk_engine_t *engine);
+
+const char *ZB_BulkStateToString(zb_bulk_state_t state);
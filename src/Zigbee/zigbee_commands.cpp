@@ -0,0 +1,154 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Log/deferred_log.h"
+#include "Zigbee/zigbee_commands.h"
+
+#define ZCL_MAX_HEADER_SIZE 5
+#define ZCL_MIN_HEADER_SIZE 3
+
+// Only written before the stack starts
+static uint16_t claimedClusters[ZB_COMMAND_MAX_CLUSTERS];
+static uint8_t claimedCount = 0;
+
+size_t ZB_BuildResponseHeader(const esp_zb_zcl_cmd_info_t *request, bool clusterSpecific, uint8_t commandId, uint8_t *header) {
+    const esp_zb_zcl_frame_header_t *requestHeader = &request->header;
+    size_t length = 0;
+
+    // A reply goes the other way, and is never itself answered with a Default Response
+    uint8_t frameControl = ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE;
+    if (clusterSpecific) {
+        frameControl |= ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC;
+    }
+    if (request->command.direction == ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV) {
+        frameControl |= ZCL_FRAME_CONTROL_SERVER_TO_CLIENT;
+    }
+    if (requestHeader->fc & ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC) {
+        frameControl |= ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC;
+    }
+
+    header[length++] = frameControl;
+    if (frameControl & ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC) {
+        header[length++] = (uint8_t)requestHeader->manuf_code;
+        header[length++] = (uint8_t)(requestHeader->manuf_code >> 8);
+    }
+    header[length++] = requestHeader->tsn;
+    header[length++] = commandId;
+
+    return length;
+}
+
+static esp_err_t sendResponse(const esp_zb_zcl_cmd_info_t *request, bool clusterSpecific, uint8_t commandId, const uint8_t *payload, size_t length) {
+    uint8_t asdu[ZCL_MAX_HEADER_SIZE + ZB_COMMAND_MAX_PAYLOAD_SIZE];
+
+    if (length > ZB_COMMAND_MAX_PAYLOAD_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t headerLength = ZB_BuildResponseHeader(request, clusterSpecific, commandId, asdu);
+    memcpy(&asdu[headerLength], payload, length);
+
+    // Straight back to the endpoint that asked
+    esp_zb_apsde_data_req_t apsRequest = {};
+    apsRequest.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    apsRequest.dst_addr.addr_short = request->src_address.u.addr_short;
+    apsRequest.dst_endpoint = request->src_endpoint;
+    apsRequest.profile_id = request->profile;
+    apsRequest.cluster_id = request->cluster;
+    apsRequest.src_endpoint = request->dst_endpoint;
+    apsRequest.asdu_length = headerLength + length;
+    apsRequest.asdu = asdu;
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    esp_err_t err = esp_zb_aps_data_request(&apsRequest);
+    esp_zb_lock_release();
+
+    if (err != ESP_OK) {
+        dlog_w("Failed to send response 0x%x to 0x%04hx: cluster(0x%x) (status: %s)", commandId, request->src_address.u.addr_short, request->cluster, esp_err_to_name(err));
+    }
+
+    return err;
+}
+
+// External interface functions
+esp_err_t ZB_SendCommandResponse(const esp_zb_zcl_cmd_info_t *request, uint8_t commandId, const uint8_t *payload, size_t length) {
+    return sendResponse(request, true, commandId, payload, length);
+}
+
+esp_err_t ZB_SendDefaultResponse(const esp_zb_zcl_cmd_info_t *request, esp_zb_zcl_status_t status) {
+    const uint8_t payload[] = {request->command.id, (uint8_t)status};
+
+    // Nothing goes back if the sender asked not to hear about it, unless the command failed
+    if ((request->header.fc & ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE) && status == ESP_ZB_ZCL_STATUS_SUCCESS) {
+        return ESP_OK;
+    }
+
+    return sendResponse(request, false, ZCL_CMD_DEFAULT_RESPONSE, payload, sizeof(payload));
+}
+
+esp_err_t ZB_ClaimCommandCluster(uint16_t cluster) {
+    for (uint8_t i = 0; i < claimedCount; i++) {
+        if (claimedClusters[i] == cluster) {
+            return ESP_OK;
+        }
+    }
+    if (claimedCount == ZB_COMMAND_MAX_CLUSTERS) {
+        log_e("No room to claim cluster 0x%x, raise ZB_COMMAND_MAX_CLUSTERS", cluster);
+        return ESP_ERR_NO_MEM;
+    }
+
+    claimedClusters[claimedCount++] = cluster;
+    return ESP_OK;
+}
+
+bool ZB_CommandsParseIndication(const esp_zb_apsde_data_ind_t *ind, esp_zb_zcl_custom_cluster_command_message_t *message) {
+    bool claimed = false;
+    for (uint8_t i = 0; i < claimedCount && !claimed; i++) {
+        claimed = claimedClusters[i] == ind->cluster_id;
+    }
+    if (!claimed || ind->asdu_length < ZCL_MIN_HEADER_SIZE) {
+        return false;
+    }
+
+    // Profile wide commands, such as reads of the cluster's attributes, are the stack's
+    uint8_t frameControl = ind->asdu[0];
+    size_t headerLength = frameControl & ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC ? ZCL_MAX_HEADER_SIZE : ZCL_MIN_HEADER_SIZE;
+    if (!(frameControl & ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC) || ind->asdu_length < headerLength) {
+        return false;
+    }
+
+    memset(message, 0, sizeof(*message));
+    esp_zb_zcl_cmd_info_t *info = &message->info;
+    info->status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    info->header.fc = frameControl;
+    if (frameControl & ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC) {
+        info->header.manuf_code = ind->asdu[1] | ind->asdu[2] << 8;
+    }
+    info->header.tsn = ind->asdu[headerLength - 2];
+    info->src_address.addr_type = ESP_ZB_ZCL_ADDR_TYPE_SHORT;
+    info->src_address.u.addr_short = ind->src_short_addr;
+    info->dst_address = ind->dst_short_addr;
+    info->src_endpoint = ind->src_endpoint;
+    info->dst_endpoint = ind->dst_endpoint;
+    info->cluster = ind->cluster_id;
+    info->profile = ind->profile_id;
+    info->command.id = ind->asdu[headerLength - 1];
+    info->command.direction = frameControl & ZCL_FRAME_CONTROL_SERVER_TO_CLIENT ? ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI : ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV;
+
+    message->data.type = ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING;
+    message->data.size = (uint16_t)(ind->asdu_length - headerLength);
+    message->data.value = message->data.size ? ind->asdu + headerLength : NULL;
+    return true;
+}
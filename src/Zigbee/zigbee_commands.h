@@ -0,0 +1,405 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Typed custom cluster commands
+ * An application lists the commands it accepts on a cluster as (command id, handler) pairs. The parameters of each
+ * handler after the request info are the command's payload fields in wire order; the registry derives the payload
+ * layout from them, parses it in place with bounds checks, and calls the handler with the decoded fields. Strings and
+ * trailing blobs are views into the message buffer; nothing is allocated or copied beyond scalar loads.
+ * A handler answers with a ZbCommandResponse, or returns a status which is sent back as a Default Response.
+ * A registry claims its cluster before the stack starts. From then on the cluster's commands are taken off the stack as
+ * they arrive and passed to the custom cluster command callbacks, so the stack sends no automatic Default Response of
+ * its own and the registry's answer is the only one.
+ *
+ *     typedef ZbCommandResponse<0x00, uint8_t, zb_octet_string_t> ConfigResponse;
+ *
+ *     static esp_zb_zcl_status_t onSetConfig(const esp_zb_zcl_cmd_info_t &info, uint8_t slot, zb_bytes_t blob) { ... }
+ *     static esp_zb_zcl_status_t onGetConfig(const esp_zb_zcl_cmd_info_t &info, uint8_t slot) {
+ *         return ConfigResponse::send(info, slot, configs[slot]) == ESP_OK ? ZB_ZCL_STATUS_RESPONDED : ESP_ZB_ZCL_STATUS_FAIL;
+ *     }
+ *
+ *     typedef ZbCommandRegistry<0xFC10,
+ *         ZbCommand<0x00, onSetConfig>,
+ *         ZbCommand<0x01, onGetConfig>
+ *     > ConfigCommands;
+ *
+ *     esp_err_t onCustomClusterCommand(const esp_zb_zcl_custom_cluster_command_message_t *message) {
+ *         return ConfigCommands::dispatch(message);
+ *     }
+ *
+ *     ConfigCommands::claim();                 // in setup(), before ZB_StartMainTask()
+ */
+#pragma once
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "esp_zigbee_core.h"
+#include "aps/esp_zigbee_aps.h"
+#include "Zigbee/zigbee_attributes.h"
+
+#define ZB_COMMAND_MAX_PAYLOAD_SIZE 72          /* response payload, leaving room for the ZCL header in an unfragmented APS frame */
+
+#ifndef ZB_COMMAND_MAX_CLUSTERS
+#define ZB_COMMAND_MAX_CLUSTERS 4               /* clusters registries can claim */
+#endif
+
+#define ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC 0x01
+#define ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC 0x04
+#define ZCL_FRAME_CONTROL_SERVER_TO_CLIENT 0x08
+#define ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE 0x10
+#define ZCL_CMD_DEFAULT_RESPONSE 0x0b
+#define ZCL_STRING_INVALID_LENGTH 0xff          /* a string of this length is the invalid value, carried with no data */
+
+/* Returned by a handler that has sent its own response */
+#define ZB_ZCL_STATUS_RESPONDED ((esp_zb_zcl_status_t)0xff)
+
+/* Everything left in the payload, only valid as the last field */
+typedef struct {
+    const uint8_t *data;
+    uint16_t length;
+} zb_bytes_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+} zb_payload_reader_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t offset;
+} zb_payload_writer_t;
+
+/* Wire format of one payload field type */
+template <typename T>
+struct ZbPayloadField;
+
+template <typename T>
+struct ZbScalarPayloadField {
+    static constexpr size_t minSize = sizeof(T);
+
+    static bool read(zb_payload_reader_t *reader, T *value) {
+        if (reader->size - reader->offset < sizeof(T)) {
+            return false;
+        }
+        // ZCL is little endian like both targets and promises no alignment, so load through memcpy
+        memcpy(value, reader->data + reader->offset, sizeof(T));
+        reader->offset += sizeof(T);
+        return true;
+    }
+
+    static bool write(zb_payload_writer_t *writer, T value) {
+        if (writer->size - writer->offset < sizeof(T)) {
+            return false;
+        }
+        memcpy(writer->data + writer->offset, &value, sizeof(T));
+        writer->offset += sizeof(T);
+        return true;
+    }
+};
+
+template <> struct ZbPayloadField<uint8_t> : ZbScalarPayloadField<uint8_t> {};
+template <> struct ZbPayloadField<uint16_t> : ZbScalarPayloadField<uint16_t> {};
+template <> struct ZbPayloadField<uint32_t> : ZbScalarPayloadField<uint32_t> {};
+template <> struct ZbPayloadField<uint64_t> : ZbScalarPayloadField<uint64_t> {};
+template <> struct ZbPayloadField<int8_t> : ZbScalarPayloadField<int8_t> {};
+template <> struct ZbPayloadField<int16_t> : ZbScalarPayloadField<int16_t> {};
+template <> struct ZbPayloadField<int32_t> : ZbScalarPayloadField<int32_t> {};
+template <> struct ZbPayloadField<int64_t> : ZbScalarPayloadField<int64_t> {};
+template <> struct ZbPayloadField<float> : ZbScalarPayloadField<float> {};
+
+// One byte on the wire; anything but 0 or 1 is malformed
+template <>
+struct ZbPayloadField<bool> {
+    static constexpr size_t minSize = 1;
+
+    static bool read(zb_payload_reader_t *reader, bool *value) {
+        uint8_t byte;
+        if (!ZbPayloadField<uint8_t>::read(reader, &byte) || byte > 1) {
+            return false;
+        }
+        *value = byte == 1;
+        return true;
+    }
+
+    static bool write(zb_payload_writer_t *writer, bool value) {
+        return ZbPayloadField<uint8_t>::write(writer, value ? 1 : 0);
+    }
+};
+
+// Length-prefixed ZCL strings, read as views into the payload
+template <typename View>
+struct ZbStringPayloadField {
+    static constexpr size_t minSize = 1;
+
+    static bool read(zb_payload_reader_t *reader, View *value) {
+        uint8_t length;
+        if (!ZbPayloadField<uint8_t>::read(reader, &length)) {
+            return false;
+        }
+        if (length == ZCL_STRING_INVALID_LENGTH) {
+            value->data = NULL;
+            value->length = 0;
+            return true;
+        }
+        if (reader->size - reader->offset < length) {
+            return false;
+        }
+
+        value->data = (decltype(value->data))(reader->data + reader->offset);
+        value->length = length;
+        reader->offset += length;
+        return true;
+    }
+
+    static bool write(zb_payload_writer_t *writer, const View &value) {
+        if (value.length >= ZCL_STRING_INVALID_LENGTH || writer->size - writer->offset < 1 + (size_t)value.length) {
+            return false;
+        }
+        writer->data[writer->offset++] = value.length;
+        memcpy(writer->data + writer->offset, value.data, value.length);
+        writer->offset += value.length;
+        return true;
+    }
+};
+
+template <> struct ZbPayloadField<zb_char_string_t> : ZbStringPayloadField<zb_char_string_t> {};
+template <> struct ZbPayloadField<zb_octet_string_t> : ZbStringPayloadField<zb_octet_string_t> {};
+
+template <>
+struct ZbPayloadField<zb_bytes_t> {
+    static constexpr size_t minSize = 0;
+
+    static bool read(zb_payload_reader_t *reader, zb_bytes_t *value) {
+        value->data = reader->data + reader->offset;
+        value->length = (uint16_t)(reader->size - reader->offset);
+        reader->offset = reader->size;
+        return true;
+    }
+
+    static bool write(zb_payload_writer_t *writer, const zb_bytes_t &value) {
+        if (writer->size - writer->offset < value.length) {
+            return false;
+        }
+        memcpy(writer->data + writer->offset, value.data, value.length);
+        writer->offset += value.length;
+        return true;
+    }
+};
+
+/* A payload layout, the fields in wire order */
+template <typename... Fields>
+struct ZbPayload {
+    typedef std::tuple<Fields...> values_t;
+
+    static constexpr size_t minSize = (ZbPayloadField<Fields>::minSize + ... + 0);
+
+private:
+    static constexpr bool bytesLast() {
+        bool isBytes[] = {std::is_same<Fields, zb_bytes_t>::value..., false};
+        for (size_t i = 0; i + 1 < sizeof...(Fields); i++) {
+            if (isBytes[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+    static_assert(bytesLast(), "zb_bytes_t takes the rest of the payload, so it must be the last field");
+
+    template <size_t... Index>
+    static bool readFields(zb_payload_reader_t *reader, values_t *values, std::index_sequence<Index...>) {
+        (void)reader, (void)values;     // unused by commands with no fields
+        return (ZbPayloadField<Fields>::read(reader, &std::get<Index>(*values)) && ...);
+    }
+
+public:
+    /* Decode in wire order; false if any field runs past the end. Bytes left over after the last field are ignored,
+     * so newer senders can append fields.
+     */
+    static bool parse(const uint8_t *data, size_t size, values_t *values) {
+        zb_payload_reader_t reader = {data, data ? size : 0, 0};
+        return readFields(&reader, values, std::index_sequence_for<Fields...>());
+    }
+
+    /* Encode in wire order, setting the bytes written; false if the fields do not fit */
+    static bool encode(uint8_t *buffer, size_t size, size_t *length, const Fields &...fields) {
+        zb_payload_writer_t writer = {buffer, size, 0};
+        bool fits = (ZbPayloadField<Fields>::write(&writer, fields) && ...);
+        *length = writer.offset;
+        return fits;
+    }
+};
+
+/* Send a cluster specific response to a request, or a Default Response carrying a status.
+ * Callable from any task; the stack lock is taken around the send.
+ */
+esp_err_t ZB_SendCommandResponse(const esp_zb_zcl_cmd_info_t *request, uint8_t commandId, const uint8_t *payload, size_t length);
+esp_err_t ZB_SendDefaultResponse(const esp_zb_zcl_cmd_info_t *request, esp_zb_zcl_status_t status);
+
+/* ZCL header for a reply to a request: opposite direction, same manufacturer code and sequence number. Returns its length. */
+size_t ZB_BuildResponseHeader(const esp_zb_zcl_cmd_info_t *request, bool clusterSpecific, uint8_t commandId, uint8_t *header);
+
+/* Take a cluster's commands off the stack, for a registry to answer; see ZbCommandRegistry::claim().
+ * ESP_ERR_NO_MEM once ZB_COMMAND_MAX_CLUSTERS are claimed.
+ */
+esp_err_t ZB_ClaimCommandCluster(uint16_t cluster);
+
+/* On the Zigbee stack task: true if the frame is a cluster specific command for a claimed cluster, filling in the
+ * message as the stack would, with the data pointing into the frame
+ */
+bool ZB_CommandsParseIndication(const esp_zb_apsde_data_ind_t *ind, esp_zb_zcl_custom_cluster_command_message_t *message);
+
+template <uint8_t CommandId, typename... Fields>
+struct ZbCommandResponse {
+    typedef ZbPayload<Fields...> payload_t;
+    static_assert(payload_t::minSize <= ZB_COMMAND_MAX_PAYLOAD_SIZE, "ZbCommandResponse fields can never fit in ZB_COMMAND_MAX_PAYLOAD_SIZE");
+
+    static esp_err_t send(const esp_zb_zcl_cmd_info_t &request, const Fields &...fields) {
+        uint8_t payload[ZB_COMMAND_MAX_PAYLOAD_SIZE];
+        size_t length;
+
+        if (!payload_t::encode(payload, sizeof(payload), &length, fields...)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        return ZB_SendCommandResponse(&request, CommandId, payload, length);
+    }
+};
+
+template <typename Handler>
+struct ZbCommandHandlerTraits;
+
+template <typename... Fields>
+struct ZbCommandHandlerTraits<esp_zb_zcl_status_t (*)(const esp_zb_zcl_cmd_info_t &info, Fields...)> {
+    typedef ZbPayload<typename std::decay<Fields>::type...> payload_t;
+};
+
+typedef esp_zb_zcl_status_t (*zb_command_invoker_t)(const esp_zb_zcl_cmd_info_t &info, const uint8_t *data, size_t size);
+
+typedef struct {
+    uint8_t id;
+    zb_command_invoker_t invoke;
+} zb_command_entry_t;
+
+template <uint8_t Id, auto Handler>
+struct ZbCommand {
+    typedef typename ZbCommandHandlerTraits<decltype(Handler)>::payload_t payload_t;
+    static constexpr uint8_t id = Id;
+
+    static esp_zb_zcl_status_t invoke(const esp_zb_zcl_cmd_info_t &info, const uint8_t *data, size_t size) {
+        typename payload_t::values_t values;
+        if (!payload_t::parse(data, size, &values)) {
+            return ESP_ZB_ZCL_STATUS_MALFORMED_CMD;
+        }
+
+        return std::apply([&info](const auto &...fields) { return Handler(info, fields...); }, values);
+    }
+};
+
+// Insertion sort; the tables are small and this only ever runs in the compiler
+template <size_t N>
+constexpr std::array<zb_command_entry_t, N> ZbSortCommandEntries(std::array<zb_command_entry_t, N> table) {
+    for (size_t i = 1; i < N; i++) {
+        zb_command_entry_t entry = table[i];
+        size_t j = i;
+        while (j > 0 && table[j - 1].id > entry.id) {
+            table[j] = table[j - 1];
+            j--;
+        }
+        table[j] = entry;
+    }
+    return table;
+}
+
+template <size_t N>
+constexpr bool ZbCommandEntriesUnique(const std::array<zb_command_entry_t, N> &table) {
+    for (size_t i = 1; i < N; i++) {
+        if (table[i - 1].id == table[i].id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <uint16_t Cluster, typename... Commands>
+class ZbCommandRegistry {
+    static constexpr size_t count = sizeof...(Commands);
+    typedef std::array<zb_command_entry_t, count> table_t;
+
+    static_assert(count > 0, "ZbCommandRegistry needs at least one command");
+
+    static constexpr table_t table = ZbSortCommandEntries<count>(table_t{{{Commands::id, &Commands::invoke}...}});
+    static_assert(ZbCommandEntriesUnique<count>(table), "ZbCommandRegistry has two handlers for the same command id");
+
+public:
+    /* Handler for a command id, or NULL if nothing is bound to it */
+    static zb_command_invoker_t find(uint8_t id) {
+        size_t low = 0;
+        size_t high = count;
+
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (table[mid].id < id) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        return (low < count && table[low].id == id) ? table[low].invoke : NULL;
+    }
+
+    /* Parse & run a command, answering with a Default Response unless the handler sent its own response. A success
+     * is only answered when the sender has not disabled the Default Response.
+     * ESP_ERR_NOT_FOUND for another cluster, so registries can be chained; ESP_ERR_NOT_SUPPORTED for an unknown
+     * command; ESP_ERR_INVALID_ARG for a malformed payload; ESP_FAIL if the handler failed it; otherwise ESP_OK.
+     */
+    static esp_err_t dispatch(const esp_zb_zcl_custom_cluster_command_message_t *message) {
+        const esp_zb_zcl_cmd_info_t &info = message->info;
+
+        if (info.cluster != Cluster) {
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        zb_command_invoker_t invoke = find(info.command.id);
+        if (invoke == NULL) {
+            ZB_SendDefaultResponse(&info, ESP_ZB_ZCL_STATUS_UNSUP_CMD);
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+
+        esp_zb_zcl_status_t status = invoke(info, (const uint8_t *)message->data.value, message->data.size);
+        if (status == ZB_ZCL_STATUS_RESPONDED) {
+            return ESP_OK;
+        }
+
+        ZB_SendDefaultResponse(&info, status);
+        if (status == ESP_ZB_ZCL_STATUS_SUCCESS) {
+            return ESP_OK;
+        }
+        return status == ESP_ZB_ZCL_STATUS_MALFORMED_CMD ? ESP_ERR_INVALID_ARG : ESP_FAIL;
+    }
+
+    /* Take the cluster's commands off the stack, so this registry's answer is the only one. Call before the stack
+     * starts, and dispatch() the commands from a custom cluster command callback.
+     */
+    static esp_err_t claim() { return ZB_ClaimCommandCluster(Cluster); }
+
+    static constexpr size_t size() { return count; }
+};
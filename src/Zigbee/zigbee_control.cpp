@@ -0,0 +1,219 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <atomic>
+#include "aps/esp_zigbee_aps.h"
+#include "Common/mpsc_ring.h"
+#include "Log/deferred_log.h"
+#include "Memory/memory_pool.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_control.h"
+
+static MpscRing<zb_control_command_t, ZB_CONTROL_QUEUE_LENGTH> queue;
+static TaskHandle_t controlTask = NULL;
+static uint8_t transactionSequence = 0;
+
+// Counted by callers on their own tasks; the rest only change with the stack lock held
+static std::atomic<uint32_t> statQueued(0);
+static std::atomic<uint32_t> statOverflowed(0);
+static zb_control_stats_t stats = {0, 0, 0, 0, 0, UINT32_MAX, 0, 0};
+
+size_t ZB_ControlEncode(const zb_control_command_t *command, uint8_t transactionSequence, uint16_t *cluster, uint8_t *frame) {
+    uint8_t amount = command->amount;
+    size_t length = 3;
+
+    frame[0] = ZCL_FRAME_CONTROL_CLUSTER_COMMAND;
+    frame[1] = transactionSequence;
+
+    switch (command->action) {
+        case ZB_CONTROL_OFF:
+        case ZB_CONTROL_ON:
+        case ZB_CONTROL_TOGGLE:
+            *cluster = ESP_ZB_ZCL_CLUSTER_ID_ON_OFF;
+            frame[2] = command->action == ZB_CONTROL_OFF ? ZCL_CMD_ON_OFF_OFF : command->action == ZB_CONTROL_ON ? ZCL_CMD_ON_OFF_ON : ZCL_CMD_ON_OFF_TOGGLE;
+            break;
+
+        case ZB_CONTROL_LEVEL_STEP_UP:
+        case ZB_CONTROL_LEVEL_STEP_DOWN:
+            // Step mode, step size, then the transition time in tenths of a second: as fast as the light allows
+            *cluster = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL;
+            frame[2] = ZCL_CMD_LEVEL_STEP_WITH_ON_OFF;
+            frame[length++] = command->action == ZB_CONTROL_LEVEL_STEP_UP ? 0x00 : 0x01;
+            frame[length++] = amount ? amount : ZB_CONTROL_LEVEL_STEP;
+            frame[length++] = 0x00;
+            frame[length++] = 0x00;
+            break;
+
+        case ZB_CONTROL_LEVEL_MOVE_UP:
+        case ZB_CONTROL_LEVEL_MOVE_DOWN:
+            *cluster = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL;
+            frame[2] = ZCL_CMD_LEVEL_MOVE_WITH_ON_OFF;
+            frame[length++] = command->action == ZB_CONTROL_LEVEL_MOVE_UP ? 0x00 : 0x01;
+            frame[length++] = amount ? amount : ZB_CONTROL_LEVEL_RATE;
+            break;
+
+        case ZB_CONTROL_LEVEL_STOP:
+            *cluster = ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL;
+            frame[2] = ZCL_CMD_LEVEL_STOP_WITH_ON_OFF;
+            break;
+
+        case ZB_CONTROL_SCENE_RECALL:
+            *cluster = ESP_ZB_ZCL_CLUSTER_ID_SCENES;
+            frame[2] = ZCL_CMD_SCENES_RECALL_SCENE;
+            frame[length++] = command->group & 0xff;
+            frame[length++] = command->group >> 8;
+            frame[length++] = command->sceneId;
+            break;
+
+        default:
+            return 0;
+    }
+
+    return length;
+}
+
+const char *ZB_ControlActionToString(zb_control_action_t action) {
+    switch (action) {
+        case ZB_CONTROL_OFF: return "off";
+        case ZB_CONTROL_ON: return "on";
+        case ZB_CONTROL_TOGGLE: return "toggle";
+        case ZB_CONTROL_LEVEL_STEP_UP: return "step up";
+        case ZB_CONTROL_LEVEL_STEP_DOWN: return "step down";
+        case ZB_CONTROL_LEVEL_MOVE_UP: return "move up";
+        case ZB_CONTROL_LEVEL_MOVE_DOWN: return "move down";
+        case ZB_CONTROL_LEVEL_STOP: return "stop";
+        case ZB_CONTROL_SCENE_RECALL: return "recall scene";
+        default: return "unknown";
+    }
+}
+
+// With the stack lock held
+static void send(const zb_control_command_t *command) {
+    uint8_t asdu[ZB_CONTROL_MAX_FRAME_SIZE];
+    uint16_t cluster;
+
+    size_t length = ZB_ControlEncode(command, transactionSequence, &cluster, asdu);
+    if (length == 0) {
+        stats.failed++;
+        return;
+    }
+
+    // With no destination the APS layer delivers to every binding of the source endpoint & cluster
+    esp_zb_apsde_data_req_t request = {};
+    if (command->group) {
+        request.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT;
+        request.dst_addr.addr_short = command->group;
+    } else {
+        request.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
+    }
+    request.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    request.cluster_id = cluster;
+    request.src_endpoint = command->endpoint;
+    request.asdu_length = length;
+    request.asdu = asdu;
+
+    esp_err_t err = esp_zb_aps_data_request(&request);
+    int64_t now = esp_timer_get_time();
+    transactionSequence++;
+
+    if (err != ESP_OK) {
+        stats.failed++;
+        dlog_w("Failed to send %s: endpoint(%d), group(0x%04x) (status: %s)", ZB_ControlActionToString(command->action), command->endpoint,
+               command->group, esp_err_to_name(err));
+        return;
+    }
+
+    uint32_t latency = command->inputUs && now > command->inputUs ? (uint32_t)(now - command->inputUs) : 0;
+    stats.sent++;
+    stats.latencyLastUs = latency;
+    stats.latencyTotalUs += latency;
+    if (latency < stats.latencyMinUs) {
+        stats.latencyMinUs = latency;
+    }
+    if (latency > stats.latencyMaxUs) {
+        stats.latencyMaxUs = latency;
+    }
+
+    dlog_d("Sent %s: endpoint(%d), group(0x%04x), %lu us after input", ZB_ControlActionToString(command->action), command->endpoint, command->group,
+           (unsigned long)latency);
+}
+
+static void sendQueued() {
+    // The send task is the one consumer, so an empty queue needs no lock
+    if (queue.peekRead() == NULL) {
+        return;
+    }
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+
+    bool joined = esp_zb_bdb_dev_joined();
+    for (zb_control_command_t *queued = queue.peekRead(); queued != NULL; queued = queue.peekRead()) {
+        if (joined) {
+            send(queued);
+        } else {
+            stats.dropped++;
+        }
+        queue.releaseRead();
+    }
+
+    esp_zb_lock_release();
+}
+
+static void taskControl(void *pvParameters) {
+    while (true) {
+        sendQueued();
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+void ZB_ControlInit() {
+    if (controlTask == NULL) {
+        controlTask = MEM_CreateTask(taskControl, ZB_CONTROL_TASK_NAME, ZB_CONTROL_TASK_STACK_SIZE, NULL, ZB_CONTROL_TASK_PRIORITY);
+    }
+}
+
+// External interface functions
+esp_err_t ZB_SendControlCommand(const zb_control_command_t *command) {
+    size_t position;
+    zb_control_command_t *slot = queue.acquireWrite(&position);
+    if (slot == NULL) {
+        statOverflowed++;
+        return ESP_ERR_NO_MEM;
+    }
+
+    *slot = *command;
+    if (slot->inputUs == 0) {
+        slot->inputUs = esp_timer_get_time();
+    }
+    queue.commitWrite(position);
+    statQueued++;
+
+    if (controlTask != NULL) {
+        xTaskNotifyGive(controlTask);
+    }
+    return ESP_OK;
+}
+
+void ZB_GetControlStats(zb_control_stats_t *controlStats) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    *controlStats = stats;
+    esp_zb_lock_release();
+
+    controlStats->queued = statQueued;
+    controlStats->dropped += statOverflowed;
+    if (controlStats->sent == 0) {
+        controlStats->latencyMinUs = 0;
+    }
+}
@@ -0,0 +1,97 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Direct device-to-device control
+ * On/Off, Level Control & Scenes client commands sent straight to whatever the source endpoint's client cluster is
+ * bound to, or groupcast, so a switch controls lights without a round trip through the coordinator. Commands are built
+ * by the caller's task and pushed onto a lock-free queue, and the caller returns without waiting on the stack lock, so
+ * the switch timer never stalls the other software timers. A task of its own, above the Zigbee_events worker so no
+ * slow application subscriber holds a light up, then sends everything queued so far under one lock acquisition. Each
+ * command carries the time of the input that caused it, and the delay from there
+ * to the APS data request is kept as press-to-transmit latency.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifndef ZB_CONTROL_QUEUE_LENGTH
+#define ZB_CONTROL_QUEUE_LENGTH 8               /* power of two */
+#endif
+
+#define ZB_CONTROL_TASK_NAME "Zigbee_control"
+#define ZB_CONTROL_TASK_STACK_SIZE 2560
+#define ZB_CONTROL_TASK_PRIORITY 5              /* above Zigbee_events; it waits on the stack lock, so Zigbee_main still runs */
+
+#define ZB_CONTROL_MAX_FRAME_SIZE 8             /* ZCL header and the largest payload, Step with On/Off */
+
+/* Defaults for level commands that leave them at 0 */
+#define ZB_CONTROL_LEVEL_STEP 32                /* of 254 */
+#define ZB_CONTROL_LEVEL_RATE 80                /* units per second, so a full sweep takes about three seconds */
+
+/* ZCL frame control: cluster specific, client to server, no Default Response so nothing comes back on success */
+#define ZCL_FRAME_CONTROL_CLUSTER_COMMAND 0x11
+
+/* On/Off, Level Control & Scenes cluster commands */
+#define ZCL_CMD_ON_OFF_OFF 0x00
+#define ZCL_CMD_ON_OFF_ON 0x01
+#define ZCL_CMD_ON_OFF_TOGGLE 0x02
+#define ZCL_CMD_LEVEL_MOVE_WITH_ON_OFF 0x05
+#define ZCL_CMD_LEVEL_STEP_WITH_ON_OFF 0x06
+#define ZCL_CMD_LEVEL_STOP_WITH_ON_OFF 0x07
+#define ZCL_CMD_SCENES_RECALL_SCENE 0x05
+
+typedef enum {
+    ZB_CONTROL_OFF,
+    ZB_CONTROL_ON,
+    ZB_CONTROL_TOGGLE,
+    ZB_CONTROL_LEVEL_STEP_UP,
+    ZB_CONTROL_LEVEL_STEP_DOWN,
+    ZB_CONTROL_LEVEL_MOVE_UP,
+    ZB_CONTROL_LEVEL_MOVE_DOWN,
+    ZB_CONTROL_LEVEL_STOP,
+    ZB_CONTROL_SCENE_RECALL,
+} zb_control_action_t;
+
+typedef struct {
+    zb_control_action_t action;
+    uint8_t endpoint;                           /* source endpoint, carrying the client cluster */
+    uint16_t group;                             /* 0 sends to the client cluster's bindings, anything else groupcasts */
+    uint8_t sceneId;                            /* scene recall */
+    uint8_t amount;                             /* level step size or move rate, 0 for the default */
+    int64_t inputUs;                            /* esp_timer_get_time() of the input that caused it, 0 for now */
+} zb_control_command_t;
+
+typedef struct {
+    uint32_t queued;
+    uint32_t sent;
+    uint32_t dropped;                           /* queue full, or not on a network when its turn came */
+    uint32_t failed;                            /* rejected by the APS layer */
+    uint32_t latencyLastUs;                     /* input to APS data request */
+    uint32_t latencyMinUs;
+    uint32_t latencyMaxUs;
+    uint64_t latencyTotalUs;
+} zb_control_stats_t;
+
+/* Build the ZCL frame for a command: writes the cluster to send it on and returns the frame length, 0 for an unknown
+ * action. frame must hold ZB_CONTROL_MAX_FRAME_SIZE bytes.
+ */
+size_t ZB_ControlEncode(const zb_control_command_t *command, uint8_t transactionSequence, uint16_t *cluster, uint8_t *frame);
+
+const char *ZB_ControlActionToString(zb_control_action_t action);
+
+/* Start the send task; called from ZB_StartMainTask(). Commands queued before it go out as soon as it runs. */
+void ZB_ControlInit();
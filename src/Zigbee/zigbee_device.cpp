@@ -0,0 +1,141 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_device.h"
+#include "Zigbee/zigbee_shadow.h"
+#include "Zigbee/zigbee_store.h"
+
+// Basic & Identify, added to every endpoint ahead of the application's clusters
+static constexpr uint8_t zclVersion = ESP_ZB_ZCL_BASIC_ZCL_VERSION_DEFAULT_VALUE;
+#ifdef ZIGBEE_MODE_ZCZR
+static constexpr uint8_t powerSource = ESP_ZB_ZCL_BASIC_POWER_SOURCE_MAINS_SINGLE_PHASE;   /* a router must stay powered */
+#else
+static constexpr uint8_t powerSource = ESP_ZB_ZCL_BASIC_POWER_SOURCE_DEFAULT_VALUE;
+#endif
+static constexpr uint16_t identifyTime = ESP_ZB_ZCL_IDENTIFY_IDENTIFY_TIME_DEFAULT_VALUE;
+
+static constexpr zb_attribute_desc_t basicAttributes[] = {
+    {ESP_ZB_ZCL_ATTR_BASIC_ZCL_VERSION_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &zclVersion},
+    {ESP_ZB_ZCL_ATTR_BASIC_POWER_SOURCE_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &powerSource},
+    {ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, MANUFACTURER_NAME},
+    {ESP_ZB_ZCL_ATTR_BASIC_MODEL_IDENTIFIER_ID, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, MODEL_IDENTIFIER},
+};
+
+static constexpr zb_attribute_desc_t identifyAttributes[] = {
+    {ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &identifyTime},
+};
+
+static constexpr zb_cluster_desc_t frameworkClusters[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_BASIC, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, basicAttributes),
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, identifyAttributes),
+    ZB_CLUSTER_NO_ATTRIBUTES(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE),
+};
+
+static esp_err_t addCluster(esp_zb_cluster_list_t *clusterList, uint8_t endpoint, const zb_cluster_desc_t *cluster) {
+    esp_zb_attribute_list_t *attributeList = esp_zb_zcl_attr_list_create(cluster->id);
+    bool custom = cluster->id >= ZB_CLUSTER_ID_MANUFACTURER_MIN;
+    esp_err_t ret = ESP_OK;
+
+    for (uint8_t i = 0; i < cluster->attributeCount && ret == ESP_OK; i++) {
+        const zb_attribute_desc_t *attribute = &cluster->attributes[i];
+
+        const void *stored = NULL;
+        if ((attribute->access & ZB_ATTR_ACCESS_PERSISTENT) && cluster->role == ESP_ZB_ZCL_CLUSTER_SERVER_ROLE) {
+            stored = ZB_StoreGetValue(endpoint, cluster->id, attribute->id);
+        }
+
+        // The stack copies the default into its own storage and never writes through this pointer
+        void *value = (void *)(stored ? stored : attribute->value);
+        uint8_t access = attribute->access & ~ZB_ATTR_ACCESS_PERSISTENT;
+        if (custom) {
+            ret = esp_zb_custom_cluster_add_custom_attr(attributeList, attribute->id, attribute->type, access, value);
+        } else {
+            ret = esp_zb_cluster_add_attr(attributeList, cluster->id, attribute->id, attribute->type, access, value);
+        }
+
+        if (ret != ESP_OK) {
+            log_e("Endpoint %d cluster 0x%04x: attribute 0x%04x rejected (%s)", endpoint, cluster->id, attribute->id, esp_err_to_name(ret));
+        } else {
+            ZB_ShadowAddAttribute(endpoint, cluster->id, cluster->role, attribute, value);
+        }
+    }
+
+    if (ret == ESP_OK) {
+        switch (cluster->id) {
+            case ESP_ZB_ZCL_CLUSTER_ID_BASIC:
+                ret = esp_zb_cluster_list_add_basic_cluster(clusterList, attributeList, cluster->role);
+                break;
+            case ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY:
+                ret = esp_zb_cluster_list_add_identify_cluster(clusterList, attributeList, cluster->role);
+                break;
+            default:
+                ret = esp_zb_cluster_list_add_custom_cluster(clusterList, attributeList, cluster->role);
+                break;
+        }
+
+        if (ret != ESP_OK) {
+            log_e("Endpoint %d: cluster 0x%04x rejected (%s)", endpoint, cluster->id, esp_err_to_name(ret));
+        }
+    }
+
+    return ret;
+}
+
+static esp_err_t addClusters(esp_zb_cluster_list_t *clusterList, uint8_t endpoint, const zb_cluster_desc_t *clusters, uint8_t count) {
+    esp_err_t ret = ESP_OK;
+
+    for (uint8_t i = 0; i < count && ret == ESP_OK; i++) {
+        ret = addCluster(clusterList, endpoint, &clusters[i]);
+    }
+
+    return ret;
+}
+
+esp_zb_ep_list_t *ZB_CreateEndpoints(const zb_device_desc_t *device) {
+    esp_zb_ep_list_t *endpointList = esp_zb_ep_list_create();
+
+    for (uint8_t i = 0; i < device->endpointCount; i++) {
+        const zb_endpoint_desc_t *endpoint = &device->endpoints[i];
+        esp_zb_cluster_list_t *clusterList = esp_zb_zcl_cluster_list_create();
+        esp_zb_endpoint_config_t endpointConfig = {
+            .endpoint = endpoint->endpoint,
+            .app_profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+            .app_device_id = endpoint->deviceId,
+            .app_device_version = endpoint->deviceVersion,
+        };
+
+        esp_err_t ret = addClusters(clusterList, endpoint->endpoint, frameworkClusters, ZB_DESC_COUNT(frameworkClusters));
+        if (ret == ESP_OK) {
+            ret = addClusters(clusterList, endpoint->endpoint, endpoint->clusters, endpoint->clusterCount);
+        }
+        if (ret == ESP_OK && i == 0) {
+            // One set of device-wide counters, the OTA client & the bulk transfer server, on the first endpoint
+            ZB_DiagnosticsAddClusters(endpoint->endpoint, clusterList);
+            ZB_OtaAddClusters(endpoint->endpoint, clusterList);
+            ZB_BulkAddClusters(endpoint->endpoint, clusterList);
+        }
+        if (ret == ESP_OK) {
+            ret = esp_zb_ep_list_add_ep(endpointList, clusterList, endpointConfig);
+        }
+
+        if (ret != ESP_OK) {
+            log_e("Endpoint %d could not be created (%s)", endpoint->endpoint, esp_err_to_name(ret));
+            return NULL;
+        }
+    }
+
+    return endpointList;
+}
@@ -0,0 +1,223 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Declarative device description
+ * A device is a constant table of endpoints, each listing its clusters, and each cluster its attributes with their
+ * default value and access flags. The framework walks the table once on the stack task to build and register every
+ * endpoint, adding Basic & Identify to each, and Diagnostics & the OTA Upgrade client to the first. Server attributes flagged
+ * ZB_ATTR_ACCESS_PERSISTENT are created with their stored value instead of the default, see zigbee_store.h. Keep the tables constexpr so they stay in
+ * flash and can be checked by the compiler:
+ *
+ *     static constexpr bool off = false;
+ *     static constexpr zb_attribute_desc_t onOffAttributes[] = {
+ *         {ESP_ZB_ZCL_ATTR_ON_OFF_ON_OFF_ID, ESP_ZB_ZCL_ATTR_TYPE_BOOL, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &off},
+ *     };
+ *     static constexpr zb_cluster_desc_t gangClusters[] = {
+ *         ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, onOffAttributes),
+ *     };
+ *     static constexpr zb_endpoint_desc_t endpoints[] = {
+ *         ZB_ENDPOINT(1, ESP_ZB_HA_ON_OFF_OUTPUT_DEVICE_ID, gangClusters),
+ *         ZB_ENDPOINT(2, ESP_ZB_HA_ON_OFF_OUTPUT_DEVICE_ID, gangClusters),
+ *     };
+ *     static constexpr zb_device_desc_t device = ZB_DEVICE(endpoints);
+ *     ZB_ASSERT_DEVICE_VALID(device);
+ *
+ *     ZB_SetDeviceDescriptor(&device);
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_zigbee_core.h"
+#include "Zigbee/zigbee_store_log.h"
+
+#define ZB_MAX_ENDPOINTS 8
+#define ZB_ENDPOINT_ID_MIN 1
+#define ZB_ENDPOINT_ID_MAX 240
+#define ZB_CLUSTER_ID_MANUFACTURER_MIN 0xFC00     /* manufacturer specific clusters take custom attributes */
+
+/* Framework access flag, stripped before the stack sees it: keep the attribute's value across restarts, see zigbee_store.h.
+ * Server attributes of scalar or short string types only.
+ */
+#define ZB_ATTR_ACCESS_PERSISTENT 0x80
+
+typedef struct {
+    uint16_t id;
+    uint8_t type;                   /* esp_zb_zcl_attr_type_t */
+    uint8_t access;                 /* esp_zb_zcl_attr_access_t flags, plus ZB_ATTR_ACCESS_PERSISTENT */
+    const void *value;              /* default, copied by the stack; strings in ZCL format, length byte first */
+} zb_attribute_desc_t;
+
+typedef struct {
+    uint16_t id;
+    uint8_t role;                   /* esp_zb_zcl_cluster_role_t */
+    uint8_t attributeCount;
+    const zb_attribute_desc_t *attributes;
+} zb_cluster_desc_t;
+
+typedef struct {
+    uint8_t endpoint;
+    uint16_t deviceId;
+    uint8_t deviceVersion;
+    uint8_t clusterCount;
+    const zb_cluster_desc_t *clusters;
+} zb_endpoint_desc_t;
+
+typedef struct {
+    uint8_t endpointCount;
+    const zb_endpoint_desc_t *endpoints;
+} zb_device_desc_t;
+
+#define ZB_DESC_COUNT(table) ((uint8_t)(sizeof(table) / sizeof((table)[0])))
+
+#define ZB_CLUSTER(id, role, attributes) {(id), (role), ZB_DESC_COUNT(attributes), (attributes)}
+#define ZB_CLUSTER_NO_ATTRIBUTES(id, role) {(id), (role), 0, NULL}
+#define ZB_ENDPOINT(endpoint, deviceId, clusters) {(endpoint), (deviceId), 1, ZB_DESC_COUNT(clusters), (clusters)}
+#define ZB_ENDPOINT_NO_CLUSTERS(endpoint, deviceId) {(endpoint), (deviceId), 1, 0, NULL}
+#define ZB_DEVICE(endpoints) {ZB_DESC_COUNT(endpoints), (endpoints)}
+
+/* Clusters the framework adds itself, which a descriptor must leave out */
+constexpr bool ZbFrameworkCluster(uint16_t id) {
+    return id == ESP_ZB_ZCL_CLUSTER_ID_BASIC || id == ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY || id == ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS ||
+           id == ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE;
+}
+
+constexpr bool ZbDeviceEndpointsValid(const zb_device_desc_t &device) {
+    if (device.endpointCount == 0 || device.endpointCount > ZB_MAX_ENDPOINTS || device.endpoints == NULL) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < device.endpointCount; i++) {
+        const zb_endpoint_desc_t &endpoint = device.endpoints[i];
+
+        if (endpoint.endpoint < ZB_ENDPOINT_ID_MIN || endpoint.endpoint > ZB_ENDPOINT_ID_MAX || endpoint.deviceVersion > 15) {
+            return false;
+        }
+        for (uint8_t j = 0; j < i; j++) {
+            if (device.endpoints[j].endpoint == endpoint.endpoint) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+constexpr bool ZbDeviceClustersValid(const zb_device_desc_t &device) {
+    for (uint8_t i = 0; i < device.endpointCount; i++) {
+        const zb_endpoint_desc_t &endpoint = device.endpoints[i];
+
+        if (endpoint.clusterCount > 0 && endpoint.clusters == NULL) {
+            return false;
+        }
+        for (uint8_t j = 0; j < endpoint.clusterCount; j++) {
+            const zb_cluster_desc_t &cluster = endpoint.clusters[j];
+
+            if (ZbFrameworkCluster(cluster.id) ||
+                (cluster.role != ESP_ZB_ZCL_CLUSTER_SERVER_ROLE && cluster.role != ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE)) {
+                return false;
+            }
+            for (uint8_t k = 0; k < j; k++) {
+                if (endpoint.clusters[k].id == cluster.id && endpoint.clusters[k].role == cluster.role) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+constexpr bool ZbDeviceAttributesValid(const zb_device_desc_t &device) {
+    for (uint8_t i = 0; i < device.endpointCount; i++) {
+        const zb_endpoint_desc_t &endpoint = device.endpoints[i];
+
+        for (uint8_t j = 0; j < endpoint.clusterCount; j++) {
+            const zb_cluster_desc_t &cluster = endpoint.clusters[j];
+
+            if (cluster.attributeCount > 0 && cluster.attributes == NULL) {
+                return false;
+            }
+            for (uint8_t k = 0; k < cluster.attributeCount; k++) {
+                const zb_attribute_desc_t &attribute = cluster.attributes[k];
+
+                if (attribute.value == NULL || attribute.type == ESP_ZB_ZCL_ATTR_TYPE_NULL || attribute.type == ESP_ZB_ZCL_ATTR_TYPE_INVALID ||
+                    (attribute.access & ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE) == 0) {
+                    return false;
+                }
+                for (uint8_t l = 0; l < k; l++) {
+                    if (cluster.attributes[l].id == attribute.id) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+constexpr bool ZbDevicePersistenceValid(const zb_device_desc_t &device) {
+    uint16_t count = 0;
+
+    for (uint8_t i = 0; i < device.endpointCount; i++) {
+        for (uint8_t j = 0; j < device.endpoints[i].clusterCount; j++) {
+            const zb_cluster_desc_t &cluster = device.endpoints[i].clusters[j];
+
+            for (uint8_t k = 0; k < cluster.attributeCount; k++) {
+                if (!(cluster.attributes[k].access & ZB_ATTR_ACCESS_PERSISTENT)) {
+                    continue;
+                }
+                if (cluster.role != ESP_ZB_ZCL_CLUSTER_SERVER_ROLE || !ZbStoreTypeSupported(cluster.attributes[k].type)) {
+                    return false;
+                }
+                count++;
+            }
+        }
+    }
+    return count <= ZB_STORE_MAX_ATTRIBUTES;
+}
+
+constexpr bool ZbDeviceValid(const zb_device_desc_t &device) {
+    return ZbDeviceEndpointsValid(device) && ZbDeviceClustersValid(device) && ZbDeviceAttributesValid(device) && ZbDevicePersistenceValid(device);
+}
+
+/* One assertion per rule, so the compiler says which one a descriptor broke */
+#define ZB_ASSERT_DEVICE_VALID(device)                                                                                               \
+    static_assert(ZbDeviceEndpointsValid(device), #device ": needs 1 to ZB_MAX_ENDPOINTS endpoints with unique ids from 1 to 240"); \
+    static_assert(ZbDeviceClustersValid(device), #device ": a cluster is listed twice for one role, or is Basic/Identify/Diagnostics/OTA Upgrade"); \
+    static_assert(ZbDeviceAttributesValid(device), #device ": an attribute is listed twice, or has no default, type or access"); \
+    static_assert(ZbDevicePersistenceValid(device), #device ": a persistent attribute is client side, of a type that cannot be stored, or over ZB_STORE_MAX_ATTRIBUTES")
+
+/* Totals over a descriptor, for logging and boot statistics */
+constexpr uint16_t ZbDeviceClusterCount(const zb_device_desc_t &device) {
+    uint16_t count = 0;
+    for (uint8_t i = 0; i < device.endpointCount; i++) {
+        count += device.endpoints[i].clusterCount;
+    }
+    return count;
+}
+
+constexpr uint16_t ZbDeviceAttributeCount(const zb_device_desc_t &device) {
+    uint16_t count = 0;
+    for (uint8_t i = 0; i < device.endpointCount; i++) {
+        for (uint8_t j = 0; j < device.endpoints[i].clusterCount; j++) {
+            count += device.endpoints[i].clusters[j].attributeCount;
+        }
+    }
+    return count;
+}
+
+/* Build the endpoint list for a descriptor, with the framework's own clusters added to each endpoint.
+ * Returns NULL if the stack rejected any part of it.
+ */
+esp_zb_ep_list_t *ZB_CreateEndpoints(const zb_device_desc_t *device);
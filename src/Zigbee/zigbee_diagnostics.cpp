@@ -0,0 +1,271 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "esp_heap_caps.h"
+#include "Led/led.h"
+#include "Memory/memory_pool.h"
+#include "Switches/switches.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_diagnostics.h"
+
+#define DIAGNOSTICS_NVS_NAMESPACE "zb_diag"
+#define DIAGNOSTICS_NVS_RESETS_KEY "resets"
+
+// Only touched on the Zigbee stack task, or with the stack lock held
+static zb_diagnostics_t diagnostics;
+static uint8_t diagnosticsEndpoint = HA_ESP_SENSOR_ENDPOINT;
+static uint32_t joinedAtMs = 0;
+static bool joined = false;
+
+// Attribute storage, the stack keeps a copy of each value
+static uint8_t callbackStats[ZB_DIAGNOSTICS_CALLBACK_STATS_SIZE];
+
+static void onDiagnosticsAlarm(uint8_t param);
+
+// Count this boot, so a device that keeps resetting stands out
+static uint16_t countReset() {
+    Preferences preferences;
+    uint16_t resets = 0;
+
+    if (preferences.begin(DIAGNOSTICS_NVS_NAMESPACE, false)) {
+        resets = preferences.getUShort(DIAGNOSTICS_NVS_RESETS_KEY, 0);
+        if (resets < UINT16_MAX) {
+            resets++;
+        }
+        preferences.putUShort(DIAGNOSTICS_NVS_RESETS_KEY, resets);
+        preferences.end();
+    }
+
+    return resets;
+}
+
+static uint32_t stackFree(const char *taskName) {
+    TaskHandle_t task = MEM_FindTask(taskName);
+    return task ? uxTaskGetStackHighWaterMark(task) : 0;
+}
+
+static inline uint16_t saturate16(uint64_t value) {
+    return value > UINT16_MAX ? UINT16_MAX : (uint16_t)value;
+}
+
+static inline uint8_t *putLittleEndian(uint8_t *out, uint32_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        *out++ = (uint8_t)(value >> (8 * i));
+    }
+    return out;
+}
+
+// Gather the counters that are sampled rather than counted
+static void sampleDiagnostics() {
+    diagnostics.switchQueuePeak = SW_GetEventQueuePeak();
+    diagnostics.zigbeeStackFree = stackFree(ZB_MAIN_TASK_NAME);
+    diagnostics.ledStackFree = stackFree(LED_TASK_NAME);
+    diagnostics.freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    diagnostics.minFreeHeap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    diagnostics.secondsSinceJoin = joined ? (millis() - joinedAtMs) / 1000 : ZB_DIAGNOSTICS_NOT_JOINED;
+}
+
+static void setPerfAttribute(uint16_t attribute, void *value) {
+    esp_zb_zcl_set_attribute_val(diagnosticsEndpoint, ZB_CLUSTER_ID_PERF_COUNTERS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attribute, value, false);
+}
+
+void ZB_DiagnosticsAddClusters(uint8_t endpoint, esp_zb_cluster_list_t *clusterList) {
+    diagnosticsEndpoint = endpoint;
+    diagnostics.resets = countReset();
+    diagnostics.secondsSinceJoin = ZB_DIAGNOSTICS_NOT_JOINED;
+    callbackStats[0] = 0;
+
+    // Standard Diagnostics cluster
+    esp_zb_attribute_list_t *diagnosticsCluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS);
+    ESP_ERROR_CHECK(esp_zb_cluster_add_attr(diagnosticsCluster, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, ZB_ATTR_DIAGNOSTICS_NUMBER_OF_RESETS_ID,
+                                            ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &diagnostics.resets));
+#ifdef ZIGBEE_MODE_ZCZR
+    ZB_RouterAddDiagnostics(endpoint, diagnosticsCluster);
+#endif
+    ESP_ERROR_CHECK(esp_zb_cluster_list_add_diagnostics_cluster(clusterList, diagnosticsCluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
+
+    // Performance counters the standard cluster has no attributes for
+    esp_zb_attribute_list_t *perfCluster = esp_zb_zcl_attr_list_create(ZB_CLUSTER_ID_PERF_COUNTERS);
+    const struct {
+        uint16_t id;
+        uint8_t type;
+        void *value;
+    } perfAttributes[] = {
+        {ZB_ATTR_PERF_ACTION_COUNT_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &diagnostics.actions},
+        {ZB_ATTR_PERF_SIGNAL_COUNT_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &diagnostics.signals},
+        {ZB_ATTR_PERF_CALLBACK_MAX_US_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &diagnostics.callbackMaxUs},
+        {ZB_ATTR_PERF_CALLBACK_STATS_ID, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, callbackStats},
+        {ZB_ATTR_PERF_SWITCH_QUEUE_PEAK_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, &diagnostics.switchQueuePeak},
+        {ZB_ATTR_PERF_ZIGBEE_STACK_FREE_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, NULL},
+        {ZB_ATTR_PERF_LED_STACK_FREE_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, NULL},
+        {ZB_ATTR_PERF_FREE_HEAP_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &diagnostics.freeHeap},
+        {ZB_ATTR_PERF_MIN_FREE_HEAP_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &diagnostics.minFreeHeap},
+        {ZB_ATTR_PERF_STEERING_ATTEMPTS_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &diagnostics.steeringAttempts},
+        {ZB_ATTR_PERF_SECONDS_SINCE_JOIN_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &diagnostics.secondsSinceJoin},
+    };
+    uint16_t zero = 0;
+
+    for (size_t i = 0; i < sizeof(perfAttributes) / sizeof(perfAttributes[0]); i++) {
+        ESP_ERROR_CHECK(esp_zb_custom_cluster_add_custom_attr(perfCluster, perfAttributes[i].id, perfAttributes[i].type, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY,
+                                                              perfAttributes[i].value ? perfAttributes[i].value : &zero));
+    }
+    ESP_ERROR_CHECK(esp_zb_cluster_list_add_custom_cluster(clusterList, perfCluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
+}
+
+void ZB_DiagnosticsRecordCallback(zb_diagnostics_kind_t kind, uint16_t id, uint32_t durationUs) {
+    zb_diagnostics_callback_t *entry = NULL;
+
+    for (uint8_t i = 0; i < diagnostics.callbackCount; i++) {
+        if (diagnostics.callbacks[i].kind == kind && diagnostics.callbacks[i].id == id) {
+            entry = &diagnostics.callbacks[i];
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        // The last slot is kept back for everything that did not get one of its own
+        uint8_t slot = diagnostics.callbackCount;
+        if (slot >= ZB_DIAGNOSTICS_MAX_CALLBACK_IDS - 1) {
+            slot = ZB_DIAGNOSTICS_MAX_CALLBACK_IDS - 1;
+            id = ZB_DIAGNOSTICS_OTHER_ID;
+        }
+
+        entry = &diagnostics.callbacks[slot];
+        if (slot == diagnostics.callbackCount) {
+            entry->kind = kind;
+            entry->id = id;
+            diagnostics.callbackCount++;
+        }
+    }
+
+    entry->count++;
+    entry->totalUs += durationUs;
+    if (durationUs > entry->maxUs) {
+        entry->maxUs = durationUs;
+    }
+
+    if (kind == ZB_DIAGNOSTICS_ACTION) {
+        diagnostics.actions++;
+    } else {
+        diagnostics.signals++;
+    }
+    if (durationUs > diagnostics.callbackMaxUs) {
+        diagnostics.callbackMaxUs = durationUs;
+    }
+}
+
+void ZB_DiagnosticsOnSteering() {
+    diagnostics.steeringAttempts++;
+}
+
+void ZB_DiagnosticsOnJoined() {
+    joinedAtMs = millis();
+    joined = true;
+}
+
+static uint8_t *putCallbackRecord(uint8_t *out, uint8_t kind, const zb_diagnostics_callback_t *entry) {
+    *out++ = kind;
+    out = putLittleEndian(out, entry->id, 2);
+    out = putLittleEndian(out, entry->count, 4);
+    out = putLittleEndian(out, saturate16(entry->count ? entry->totalUs / entry->count : 0), 2);
+    out = putLittleEndian(out, saturate16(entry->maxUs), 2);
+    return out;
+}
+
+size_t ZB_DiagnosticsEncodeCallbacks(const zb_diagnostics_t *diagnostics, uint8_t *buffer, size_t size) {
+    uint8_t *out = buffer + 1;
+
+    if (size < 1) {
+        return 0;
+    }
+
+    size_t records = (size - 1) / ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE;
+    if (records > ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS) {
+        records = ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS;
+    }
+
+    if (diagnostics->callbackCount <= records) {
+        for (uint8_t i = 0; i < diagnostics->callbackCount; i++) {
+            const zb_diagnostics_callback_t *entry = &diagnostics->callbacks[i];
+            out = putCallbackRecord(out, entry->id == ZB_DIAGNOSTICS_OTHER_ID ? ZB_DIAGNOSTICS_OTHER_KIND : (uint8_t)entry->kind, entry);
+        }
+    } else if (records > 0) {
+        // Too many to send: pick the slowest ids for records of their own, in table order, and fold the rest into one
+        bool kept[ZB_DIAGNOSTICS_MAX_CALLBACK_IDS] = {};
+        for (size_t picked = 0; picked < records - 1; picked++) {
+            int slowest = -1;
+            for (uint8_t i = 0; i < diagnostics->callbackCount; i++) {
+                const zb_diagnostics_callback_t *entry = &diagnostics->callbacks[i];
+                if (!kept[i] && entry->id != ZB_DIAGNOSTICS_OTHER_ID && (slowest < 0 || entry->maxUs > diagnostics->callbacks[slowest].maxUs)) {
+                    slowest = i;
+                }
+            }
+            kept[slowest] = true;
+        }
+
+        zb_diagnostics_callback_t other = {ZB_DIAGNOSTICS_ACTION, ZB_DIAGNOSTICS_OTHER_ID, 0, 0, 0};
+        for (uint8_t i = 0; i < diagnostics->callbackCount; i++) {
+            const zb_diagnostics_callback_t *entry = &diagnostics->callbacks[i];
+            if (kept[i]) {
+                out = putCallbackRecord(out, (uint8_t)entry->kind, entry);
+            } else {
+                other.count += entry->count;
+                other.totalUs += entry->totalUs;
+                if (entry->maxUs > other.maxUs) {
+                    other.maxUs = entry->maxUs;
+                }
+            }
+        }
+        out = putCallbackRecord(out, ZB_DIAGNOSTICS_OTHER_KIND, &other);
+    }
+
+    buffer[0] = (uint8_t)(out - buffer - 1);
+    return out - buffer;
+}
+
+void ZB_DiagnosticsRefresh() {
+    sampleDiagnostics();
+    ZB_DiagnosticsEncodeCallbacks(&diagnostics, callbackStats, sizeof(callbackStats));
+
+    uint16_t zigbeeStackFree = saturate16(diagnostics.zigbeeStackFree);
+    uint16_t ledStackFree = saturate16(diagnostics.ledStackFree);
+
+    setPerfAttribute(ZB_ATTR_PERF_ACTION_COUNT_ID, &diagnostics.actions);
+    setPerfAttribute(ZB_ATTR_PERF_SIGNAL_COUNT_ID, &diagnostics.signals);
+    setPerfAttribute(ZB_ATTR_PERF_CALLBACK_MAX_US_ID, &diagnostics.callbackMaxUs);
+    setPerfAttribute(ZB_ATTR_PERF_CALLBACK_STATS_ID, callbackStats);
+    setPerfAttribute(ZB_ATTR_PERF_SWITCH_QUEUE_PEAK_ID, &diagnostics.switchQueuePeak);
+    setPerfAttribute(ZB_ATTR_PERF_ZIGBEE_STACK_FREE_ID, &zigbeeStackFree);
+    setPerfAttribute(ZB_ATTR_PERF_LED_STACK_FREE_ID, &ledStackFree);
+    setPerfAttribute(ZB_ATTR_PERF_FREE_HEAP_ID, &diagnostics.freeHeap);
+    setPerfAttribute(ZB_ATTR_PERF_MIN_FREE_HEAP_ID, &diagnostics.minFreeHeap);
+    setPerfAttribute(ZB_ATTR_PERF_STEERING_ATTEMPTS_ID, &diagnostics.steeringAttempts);
+    setPerfAttribute(ZB_ATTR_PERF_SECONDS_SINCE_JOIN_ID, &diagnostics.secondsSinceJoin);
+
+    esp_zb_scheduler_alarm_cancel(onDiagnosticsAlarm, 0);
+    esp_zb_scheduler_alarm(onDiagnosticsAlarm, 0, ZB_DIAGNOSTICS_REFRESH_MS);
+}
+
+static void onDiagnosticsAlarm(uint8_t param) {
+    ZB_DiagnosticsRefresh();
+}
+
+void ZB_GetDiagnostics(zb_diagnostics_t *stats) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    sampleDiagnostics();
+    *stats = diagnostics;
+    esp_zb_lock_release();
+}
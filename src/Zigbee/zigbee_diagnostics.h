@@ -0,0 +1,106 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Runtime health counters, published over Zigbee
+ * The standard Diagnostics cluster (0x0B05) carries the reset count, and a custom cluster next to it carries counters
+ * the standard one has no attributes for: action & signal counts and execution times per callback id, stack & heap
+ * headroom, the switch event queue high-water mark, steering attempts and time since join. The counters are kept on
+ * the Zigbee stack task and copied into the attributes periodically, so a coordinator can read them at any time.
+ */
+#pragma once
+
+#include "esp_zigbee_core.h"
+
+#define ZB_DIAGNOSTICS_REFRESH_MS 30000
+#define ZB_DIAGNOSTICS_MAX_CALLBACK_IDS 16      /* distinct action/signal ids tracked, the rest share one entry */
+
+/* Standard Diagnostics cluster attributes */
+#define ZB_ATTR_DIAGNOSTICS_NUMBER_OF_RESETS_ID 0x0000
+
+/* Counted by the stack on routers, U16, see zigbee_router.h */
+#define ZB_ATTR_DIAGNOSTICS_ROUTE_DISC_INITIATED_ID 0x0109
+#define ZB_ATTR_DIAGNOSTICS_PACKET_BUFFER_ALLOCATE_FAILURES_ID 0x0117
+#define ZB_ATTR_DIAGNOSTICS_RELAYED_UCAST_ID 0x0118
+
+/* Custom performance counter cluster, read-only attributes */
+#define ZB_CLUSTER_ID_PERF_COUNTERS 0xFC05
+#define ZB_ATTR_PERF_ACTION_COUNT_ID 0x0000         /* U32 */
+#define ZB_ATTR_PERF_SIGNAL_COUNT_ID 0x0001         /* U32 */
+#define ZB_ATTR_PERF_CALLBACK_MAX_US_ID 0x0002      /* U32, slowest single action or signal */
+#define ZB_ATTR_PERF_CALLBACK_STATS_ID 0x0003       /* octet string of zb_diagnostics_callback_t records, see below */
+#define ZB_ATTR_PERF_SWITCH_QUEUE_PEAK_ID 0x0004    /* U8, most switch events ever waiting for loop() */
+#define ZB_ATTR_PERF_ZIGBEE_STACK_FREE_ID 0x0005    /* U16, bytes of Zigbee_main stack never used */
+#define ZB_ATTR_PERF_LED_STACK_FREE_ID 0x0006       /* U16, bytes of LED (identify) task stack never used */
+#define ZB_ATTR_PERF_FREE_HEAP_ID 0x0007            /* U32 */
+#define ZB_ATTR_PERF_MIN_FREE_HEAP_ID 0x0008        /* U32 */
+#define ZB_ATTR_PERF_STEERING_ATTEMPTS_ID 0x0009    /* U32 */
+#define ZB_ATTR_PERF_SECONDS_SINCE_JOIN_ID 0x000A   /* U32, 0xFFFFFFFF while not joined */
+
+/* Each callback stats record is 11 bytes, little endian: kind (U8), id (U16), count (U32), mean us (U16), max us (U16).
+ * Entries beyond ZB_DIAGNOSTICS_MAX_CALLBACK_IDS are folded into one with id ZB_DIAGNOSTICS_OTHER_ID. The attribute
+ * carries at most ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS records, so a Read Attributes Response for it is not fragmented:
+ * past that, the slowest ids by max us keep their own records and the rest go into the last one, with kind
+ * ZB_DIAGNOSTICS_OTHER_KIND and id ZB_DIAGNOSTICS_OTHER_ID. ZB_GetDiagnostics() still has every tracked id.
+ */
+#define ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE 11
+#define ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS 5
+#define ZB_DIAGNOSTICS_CALLBACK_STATS_SIZE (1 + ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS * ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE)
+#define ZB_DIAGNOSTICS_OTHER_KIND 0xFF
+#define ZB_DIAGNOSTICS_OTHER_ID 0xFFFF
+#define ZB_DIAGNOSTICS_NOT_JOINED 0xFFFFFFFF
+
+typedef enum {
+    ZB_DIAGNOSTICS_ACTION,              /* core action handler, by esp_zb_core_action_callback_id_t */
+    ZB_DIAGNOSTICS_SIGNAL,              /* app signal handler, by esp_zb_app_signal_type_t */
+} zb_diagnostics_kind_t;
+
+typedef struct {
+    zb_diagnostics_kind_t kind;
+    uint16_t id;
+    uint32_t count;
+    uint64_t totalUs;
+    uint32_t maxUs;
+} zb_diagnostics_callback_t;
+
+typedef struct {
+    uint16_t resets;
+    uint32_t actions;
+    uint32_t signals;
+    uint32_t callbackMaxUs;
+    uint8_t callbackCount;
+    zb_diagnostics_callback_t callbacks[ZB_DIAGNOSTICS_MAX_CALLBACK_IDS];
+    uint8_t switchQueuePeak;
+    uint32_t zigbeeStackFree;
+    uint32_t ledStackFree;
+    uint32_t freeHeap;
+    uint32_t minFreeHeap;
+    uint32_t steeringAttempts;
+    uint32_t secondsSinceJoin;
+} zb_diagnostics_t;
+
+/* Called from ZB_CreateEndpoints() to add the Diagnostics and performance counter server clusters to the first endpoint */
+void ZB_DiagnosticsAddClusters(uint8_t endpoint, esp_zb_cluster_list_t *clusterList);
+
+/* The rest are called on the Zigbee stack task */
+void ZB_DiagnosticsRecordCallback(zb_diagnostics_kind_t kind, uint16_t id, uint32_t durationUs);
+void ZB_DiagnosticsOnSteering();
+void ZB_DiagnosticsOnJoined();
+
+/* Copy the counters into the cluster attributes, then again every ZB_DIAGNOSTICS_REFRESH_MS */
+void ZB_DiagnosticsRefresh();
+
+/* Pack callback stats as the octet string attribute carries them (length byte first), returning the bytes written. Entries
+ * that do not fit in size, or in ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS records, are folded into the last record.
+ */
+size_t ZB_DiagnosticsEncodeCallbacks(const zb_diagnostics_t *diagnostics, uint8_t *buffer, size_t size);
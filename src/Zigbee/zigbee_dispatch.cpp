@@ -0,0 +1,270 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "Common/spsc_ring.h"
+#include "Log/deferred_log.h"
+#include "Memory/memory_pool.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_dispatch.h"
+
+typedef enum {
+    ZB_EVENT_ATTRIBUTE_UPDATED,
+    ZB_EVENT_CUSTOM_CLUSTER_COMMAND,
+    ZB_EVENT_IDENTIFY,
+    ZB_EVENT_COMMISSIONING_STATE,
+} zb_event_type_t;
+
+// One ring slot; message pointers are re-aimed at the slot's own copy of the payload before subscribers see it
+typedef struct {
+    zb_event_type_t type;
+    int64_t enqueuedAt;
+    union {
+        esp_zb_zcl_set_attr_value_message_t attribute;
+        esp_zb_zcl_custom_cluster_command_message_t command;
+        bool isIdentifying;
+        zb_commissioning_state_t commissioningState;
+    } message;
+    uint8_t data[ZB_DISPATCH_MAX_DATA_SIZE];
+} zb_event_t;
+
+typedef esp_err_t (*attribute_updated_callback_t)(const esp_zb_zcl_set_attr_value_message_t *message);
+typedef esp_err_t (*custom_cluster_command_callback_t)(const esp_zb_zcl_custom_cluster_command_message_t *message);
+typedef void (*identify_callback_t)(bool isIdentifying);
+typedef void (*commissioning_state_callback_t)(zb_commissioning_state_t state);
+
+// Subscribers to main application logic
+static attribute_updated_callback_t onAttributeUpdatedCallbacks[ZB_DISPATCH_MAX_SUBSCRIBERS] = {NULL};
+static custom_cluster_command_callback_t onCustomClusterCommandCallbacks[ZB_DISPATCH_MAX_SUBSCRIBERS] = {NULL};
+static identify_callback_t onIdentifyCallbacks[ZB_DISPATCH_MAX_SUBSCRIBERS] = {NULL};
+static commissioning_state_callback_t onCommissioningStateCallbacks[ZB_DISPATCH_MAX_SUBSCRIBERS] = {NULL};
+
+static SpscRing<zb_event_t, ZB_DISPATCH_QUEUE_LENGTH> eventRing;
+static TaskHandle_t dispatchTask = NULL;
+
+// Producer-side counters are only written by the one producer, consumer-side ones only on the worker
+static std::atomic<uint32_t> statEnqueued(0);
+static std::atomic<uint32_t> statDropped(0);
+static std::atomic<uint16_t> statDepthHighWaterMark(0);
+static std::atomic<uint32_t> statDispatched(0);
+static std::atomic<uint32_t> statLatencyLastUs(0);
+static std::atomic<uint32_t> statLatencyMinUs(UINT32_MAX);
+static std::atomic<uint32_t> statLatencyMaxUs(0);
+static uint64_t statLatencyTotalUs = 0;
+
+template <typename T>
+static bool addSubscriber(T *subscribers, T callback) {
+    for (int i = 0; i < ZB_DISPATCH_MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i] == NULL || subscribers[i] == callback) {
+            subscribers[i] = callback;
+            return true;
+        }
+    }
+
+    log_e("No free subscriber slot, raise ZB_DISPATCH_MAX_SUBSCRIBERS");
+    return false;
+}
+
+template <typename T>
+static void setSubscriber(T *subscribers, T callback) {
+    subscribers[0] = callback;
+    for (int i = 1; i < ZB_DISPATCH_MAX_SUBSCRIBERS; i++) {
+        subscribers[i] = NULL;
+    }
+}
+
+static zb_event_t *beginEvent(zb_event_type_t type, size_t dataSize) {
+    zb_event_t *event = dataSize <= ZB_DISPATCH_MAX_DATA_SIZE ? eventRing.acquireWrite() : NULL;
+
+    if (event == NULL) {
+        statDropped++;
+        dlog_w("Dropping Zigbee event %d (%s)", type, dataSize > ZB_DISPATCH_MAX_DATA_SIZE ? "payload too large" : "queue full");
+        return NULL;
+    }
+
+    event->type = type;
+    return event;
+}
+
+static void commitEvent(zb_event_t *event) {
+    event->enqueuedAt = esp_timer_get_time();
+    eventRing.commitWrite();
+    statEnqueued++;
+
+    uint16_t depth = eventRing.size();
+    if (depth > statDepthHighWaterMark.load(std::memory_order_relaxed)) {
+        statDepthHighWaterMark = depth;
+    }
+
+    xTaskNotifyGive(dispatchTask);
+}
+
+void ZB_DispatchAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message) {
+    uint16_t size = message->attribute.data.value ? message->attribute.data.size : 0;
+    zb_event_t *event = beginEvent(ZB_EVENT_ATTRIBUTE_UPDATED, size);
+
+    if (event != NULL) {
+        event->message.attribute = *message;
+        memcpy(event->data, message->attribute.data.value, size);
+        commitEvent(event);
+    }
+}
+
+void ZB_DispatchCustomClusterCommand(const esp_zb_zcl_custom_cluster_command_message_t *message) {
+    uint16_t size = message->data.value ? message->data.size : 0;
+    zb_event_t *event = beginEvent(ZB_EVENT_CUSTOM_CLUSTER_COMMAND, size);
+
+    if (event != NULL) {
+        event->message.command = *message;
+        memcpy(event->data, message->data.value, size);
+        commitEvent(event);
+    }
+}
+
+void ZB_DispatchIdentify(bool isIdentifying) {
+    zb_event_t *event = beginEvent(ZB_EVENT_IDENTIFY, 0);
+
+    if (event != NULL) {
+        event->message.isIdentifying = isIdentifying;
+        commitEvent(event);
+    }
+}
+
+void ZB_DispatchCommissioningState(zb_commissioning_state_t state) {
+    zb_event_t *event = beginEvent(ZB_EVENT_COMMISSIONING_STATE, 0);
+
+    if (event != NULL) {
+        event->message.commissioningState = state;
+        commitEvent(event);
+    }
+}
+
+static void recordLatency(int64_t enqueuedAt) {
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - enqueuedAt);
+
+    statLatencyLastUs = latency;
+    statLatencyTotalUs += latency;
+    if (latency < statLatencyMinUs.load(std::memory_order_relaxed)) {
+        statLatencyMinUs = latency;
+    }
+    if (latency > statLatencyMaxUs.load(std::memory_order_relaxed)) {
+        statLatencyMaxUs = latency;
+    }
+}
+
+static void deliverEvent(zb_event_t *event) {
+    esp_err_t ret = ESP_OK;
+
+    switch (event->type) {
+        case ZB_EVENT_ATTRIBUTE_UPDATED:
+            event->message.attribute.attribute.data.value = event->message.attribute.attribute.data.value ? event->data : NULL;
+            for (int i = 0; i < ZB_DISPATCH_MAX_SUBSCRIBERS && onAttributeUpdatedCallbacks[i] != NULL; i++) {
+                ret = onAttributeUpdatedCallbacks[i](&event->message.attribute);
+                if (ret != ESP_OK) {
+                    log_w("Attribute update subscriber %d failed (status: %s)", i, esp_err_to_name(ret));
+                }
+            }
+            break;
+
+        case ZB_EVENT_CUSTOM_CLUSTER_COMMAND:
+            event->message.command.data.value = event->message.command.data.value ? event->data : NULL;
+            for (int i = 0; i < ZB_DISPATCH_MAX_SUBSCRIBERS && onCustomClusterCommandCallbacks[i] != NULL; i++) {
+                ret = onCustomClusterCommandCallbacks[i](&event->message.command);
+                if (ret != ESP_OK) {
+                    log_w("Custom cluster command subscriber %d failed (status: %s)", i, esp_err_to_name(ret));
+                }
+            }
+            break;
+
+        case ZB_EVENT_IDENTIFY:
+            for (int i = 0; i < ZB_DISPATCH_MAX_SUBSCRIBERS && onIdentifyCallbacks[i] != NULL; i++) {
+                onIdentifyCallbacks[i](event->message.isIdentifying);
+            }
+            break;
+
+        case ZB_EVENT_COMMISSIONING_STATE:
+            for (int i = 0; i < ZB_DISPATCH_MAX_SUBSCRIBERS && onCommissioningStateCallbacks[i] != NULL; i++) {
+                onCommissioningStateCallbacks[i](event->message.commissioningState);
+            }
+            break;
+    }
+}
+
+// Worker task draining the event ring
+static void taskZigbeeDispatch(void *pvParameters) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        zb_event_t *event;
+        while ((event = eventRing.peekRead()) != NULL) {
+            recordLatency(event->enqueuedAt);
+            deliverEvent(event);
+            eventRing.releaseRead();
+            statDispatched++;
+        }
+    }
+}
+
+void ZB_DispatchInit() {
+    if (dispatchTask == NULL) {
+        dispatchTask = MEM_CreateTask(taskZigbeeDispatch, "Zigbee_events", ZB_DISPATCH_TASK_STACK, NULL, ZB_DISPATCH_TASK_PRIORITY);
+    }
+}
+
+// External interface functions
+void ZB_SetOnAttributeUpdatedCallback(esp_err_t (*callback)(const esp_zb_zcl_set_attr_value_message_t *message)) {
+    setSubscriber(onAttributeUpdatedCallbacks, callback);
+}
+
+void ZB_SetOnCustomClusterCommandCallback(esp_err_t (*callback)(const esp_zb_zcl_custom_cluster_command_message_t *message)) {
+    setSubscriber(onCustomClusterCommandCallbacks, callback);
+}
+
+void ZB_SetOnIdentifyCallback(void (*callback)(bool isIdentifying)) {
+    setSubscriber(onIdentifyCallbacks, callback);
+}
+
+void ZB_SetOnCommissioningStateCallback(void (*callback)(zb_commissioning_state_t state)) {
+    setSubscriber(onCommissioningStateCallbacks, callback);
+}
+
+bool ZB_AddOnAttributeUpdatedCallback(esp_err_t (*callback)(const esp_zb_zcl_set_attr_value_message_t *message)) {
+    return addSubscriber(onAttributeUpdatedCallbacks, callback);
+}
+
+bool ZB_AddOnCustomClusterCommandCallback(esp_err_t (*callback)(const esp_zb_zcl_custom_cluster_command_message_t *message)) {
+    return addSubscriber(onCustomClusterCommandCallbacks, callback);
+}
+
+bool ZB_AddOnIdentifyCallback(void (*callback)(bool isIdentifying)) {
+    return addSubscriber(onIdentifyCallbacks, callback);
+}
+
+bool ZB_AddOnCommissioningStateCallback(void (*callback)(zb_commissioning_state_t state)) {
+    return addSubscriber(onCommissioningStateCallbacks, callback);
+}
+
+void ZB_GetDispatchStats(zb_dispatch_stats_t *stats) {
+    stats->enqueued = statEnqueued;
+    stats->dispatched = statDispatched;
+    stats->dropped = statDropped;
+    stats->depth = eventRing.size();
+    stats->depthHighWaterMark = statDepthHighWaterMark;
+    stats->latencyLastUs = statLatencyLastUs;
+    stats->latencyMinUs = statDispatched ? statLatencyMinUs.load() : 0;
+    stats->latencyMaxUs = statLatencyMaxUs;
+    stats->latencyTotalUs = statLatencyTotalUs;
+}
@@ -0,0 +1,46 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Hands application callbacks off the Zigbee stack task
+ * Events are copied into a preallocated lock-free ring as they happen and delivered to every subscriber on a separate
+ * worker task, so a slow application handler can no longer stall esp_zb_stack_main_loop().
+ * There is one producer at a time: events are only dispatched from the Zigbee stack task, or from a task holding the
+ * Zigbee lock (ZB_RetryCommissioning() reports its commissioning state that way), which the stack task also holds while
+ * it runs.
+ */
+#pragma once
+
+#include "esp_zigbee_core.h"
+#include "Zigbee/zigbee_supervisor.h"
+
+#ifndef ZB_DISPATCH_QUEUE_LENGTH
+#define ZB_DISPATCH_QUEUE_LENGTH 16             /* must be a power of two */
+#endif
+
+#ifndef ZB_DISPATCH_MAX_DATA_SIZE
+#define ZB_DISPATCH_MAX_DATA_SIZE 128           /* largest attribute value or command payload carried, larger ones are dropped */
+#endif
+
+#ifndef ZB_DISPATCH_MAX_SUBSCRIBERS
+#define ZB_DISPATCH_MAX_SUBSCRIBERS 4           /* per event type */
+#endif
+
+#define ZB_DISPATCH_TASK_STACK 4096
+#define ZB_DISPATCH_TASK_PRIORITY 4             /* below Zigbee_main, so the stack always wins */
+
+void ZB_DispatchInit();
+void ZB_DispatchAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message);
+void ZB_DispatchCustomClusterCommand(const esp_zb_zcl_custom_cluster_command_message_t *message);
+void ZB_DispatchIdentify(bool isIdentifying);
+void ZB_DispatchCommissioningState(zb_commissioning_state_t state);
@@ -0,0 +1,100 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "Log/deferred_log.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_join.h"
+
+static zb_join_plan_t plan;
+
+static bool loadNetworkCache(zb_network_cache_t *cache) {
+    Preferences preferences;
+
+    if (!preferences.begin(ZB_JOIN_NVS_NAMESPACE, true)) {
+        return false;
+    }
+
+    bool loaded = preferences.getBytes(ZB_JOIN_NVS_KEY, cache, sizeof(*cache)) == sizeof(*cache) && cache->version == ZB_JOIN_CACHE_VERSION;
+    preferences.end();
+
+    return loaded;
+}
+
+static void saveNetworkCache(const zb_network_cache_t *cache) {
+    zb_network_cache_t stored;
+
+    // Rejoining the same network is the common case, and needs no flash write
+    if (loadNetworkCache(&stored) && memcmp(&stored, cache, sizeof(stored)) == 0) {
+        return;
+    }
+
+    Preferences preferences;
+    if (!preferences.begin(ZB_JOIN_NVS_NAMESPACE, false) || preferences.putBytes(ZB_JOIN_NVS_KEY, cache, sizeof(*cache)) != sizeof(*cache)) {
+        dlog_w("Failed to save network to NVS");
+    }
+    preferences.end();
+}
+
+static void setChannels(uint32_t mask) {
+    dlog_i("Steering on %s channels (mask: 0x%08lx)", ZB_JoinPhaseToString(plan.stats.phase), (unsigned long)mask);
+
+    // The plan decides when to widen the scan, so keep BDB from falling back to a secondary set of its own
+    esp_zb_set_primary_network_channel_set(mask);
+    esp_zb_set_secondary_network_channel_set(0);
+}
+
+void ZB_JoinStart() {
+    zb_network_cache_t cache;
+    uint8_t cachedChannel = 0;
+
+    if (loadNetworkCache(&cache)) {
+        cachedChannel = cache.channel;
+        dlog_i("Last joined PAN ID 0x%04hx on channel %d", cache.panId, cache.channel);
+    }
+
+    ZB_JoinPlanInit(&plan, cachedChannel, ZB_JOIN_PREFERRED_CHANNEL_MASK, ESP_ZB_PRIMARY_CHANNEL_MASK);
+    setChannels(ZB_JoinPlanStart(&plan, millis()));
+}
+
+void ZB_JoinFailed() {
+    setChannels(ZB_JoinPlanOnFailed(&plan, millis()));
+}
+
+void ZB_JoinSucceeded() {
+    const zb_join_stats_t *stats = &plan.stats;
+    ZB_JoinPlanOnJoined(&plan, millis());
+
+    // Two records, as all of it is more arguments than one deferred record carries
+    dlog_i("Joined on %s channels in %lu ms", ZB_JoinPhaseToString(stats->phase), (unsigned long)stats->totalMs);
+    dlog_i("Join phases: cached %lu ms/%lu, preferred %lu ms/%lu, full %lu ms/%lu", (unsigned long)stats->phaseMs[ZB_JOIN_PHASE_CACHED],
+           (unsigned long)stats->attempts[ZB_JOIN_PHASE_CACHED], (unsigned long)stats->phaseMs[ZB_JOIN_PHASE_PREFERRED],
+           (unsigned long)stats->attempts[ZB_JOIN_PHASE_PREFERRED], (unsigned long)stats->phaseMs[ZB_JOIN_PHASE_FULL],
+           (unsigned long)stats->attempts[ZB_JOIN_PHASE_FULL]);
+
+    zb_network_cache_t cache = {};
+    cache.version = ZB_JOIN_CACHE_VERSION;
+    cache.channel = esp_zb_get_current_channel();
+    cache.panId = esp_zb_get_pan_id();
+    esp_zb_get_extended_pan_id(cache.extendedPanId);
+
+    saveNetworkCache(&cache);
+}
+
+void ZB_GetJoinStats(zb_join_stats_t *stats) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    *stats = plan.stats;
+    esp_zb_lock_release();
+}
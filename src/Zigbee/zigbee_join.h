@@ -0,0 +1,42 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Network steering with a remembered channel
+ * The channel, PAN ID and extended PAN ID of the last network joined are kept in NVS, and steering works through the
+ * zigbee_join_plan phases starting from that channel. All functions run on the Zigbee stack task.
+ */
+#pragma once
+
+#include "esp_zigbee_core.h"
+
+#define ZB_JOIN_NVS_NAMESPACE "zb_join"
+#define ZB_JOIN_NVS_KEY "network"
+#define ZB_JOIN_CACHE_VERSION 1
+
+/* Layout stored under ZB_JOIN_NVS_KEY */
+typedef struct {
+    uint8_t version;
+    uint8_t channel;
+    uint16_t panId;
+    esp_zb_ieee_addr_t extendedPanId;
+} zb_network_cache_t;
+
+/* Set the channels for the first steering attempt of a new cycle; the caller starts steering */
+void ZB_JoinStart();
+
+/* Set the channels for the next steering attempt; the caller starts it */
+void ZB_JoinFailed();
+
+/* Record time-to-join and remember the network for next time */
+void ZB_JoinSucceeded();
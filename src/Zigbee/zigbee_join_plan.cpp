@@ -0,0 +1,71 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Zigbee/zigbee_join_plan.h"
+
+// Close the current phase's timing and move on to the next one with channels left to scan
+static void enterPhase(zb_join_plan_t *plan, zb_join_phase_t phase, uint32_t nowMs) {
+    plan->stats.phaseMs[plan->stats.phase] += nowMs - plan->phaseStartedAt;
+    plan->phaseStartedAt = nowMs;
+
+    while (phase < ZB_JOIN_PHASE_FULL && plan->masks[phase] == 0) {
+        phase = (zb_join_phase_t)(phase + 1);
+    }
+
+    plan->stats.phase = phase;
+    plan->stats.attempts[phase]++;
+}
+
+void ZB_JoinPlanInit(zb_join_plan_t *plan, uint8_t cachedChannel, uint32_t preferredMask, uint32_t fullMask) {
+    memset(plan, 0, sizeof(*plan));
+
+    uint32_t cachedMask = cachedChannel < 32 ? (1UL << cachedChannel) & fullMask : 0;
+
+    plan->masks[ZB_JOIN_PHASE_CACHED] = cachedMask;
+    plan->masks[ZB_JOIN_PHASE_PREFERRED] = preferredMask & fullMask & ~cachedMask;
+    plan->masks[ZB_JOIN_PHASE_FULL] = fullMask;
+}
+
+uint32_t ZB_JoinPlanStart(zb_join_plan_t *plan, uint32_t nowMs) {
+    memset(&plan->stats, 0, sizeof(plan->stats));
+    plan->startedAt = nowMs;
+    plan->phaseStartedAt = nowMs;
+
+    enterPhase(plan, ZB_JOIN_PHASE_CACHED, nowMs);
+    return plan->masks[plan->stats.phase];
+}
+
+uint32_t ZB_JoinPlanOnFailed(zb_join_plan_t *plan, uint32_t nowMs) {
+    zb_join_phase_t next = plan->stats.phase < ZB_JOIN_PHASE_FULL ? (zb_join_phase_t)(plan->stats.phase + 1) : ZB_JOIN_PHASE_FULL;
+
+    enterPhase(plan, next, nowMs);
+    return plan->masks[plan->stats.phase];
+}
+
+void ZB_JoinPlanOnJoined(zb_join_plan_t *plan, uint32_t nowMs) {
+    plan->stats.phaseMs[plan->stats.phase] += nowMs - plan->phaseStartedAt;
+    plan->phaseStartedAt = nowMs;
+    plan->stats.totalMs = nowMs - plan->startedAt;
+    plan->stats.joined = true;
+}
+
+const char *ZB_JoinPhaseToString(zb_join_phase_t phase) {
+    switch (phase) {
+        case ZB_JOIN_PHASE_CACHED: return "cached";
+        case ZB_JOIN_PHASE_PREFERRED: return "preferred";
+        case ZB_JOIN_PHASE_FULL: return "full";
+        default: return "unknown";
+    }
+}
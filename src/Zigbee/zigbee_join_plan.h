@@ -0,0 +1,60 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Channel plan for network steering
+ * Pure logic with no stack calls or clock of its own. Steering first scans the channel the device was last joined
+ * on, then a short list of preferred channels, and only then the full channel mask, which it keeps retrying.
+ * Time spent and attempts made in each phase are kept so time-to-join can be reported.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Zigbee channels 11, 15, 20 & 25 sit clear of Wi-Fi channels 1, 6 & 11, so most coordinators pick one of them */
+#define ZB_JOIN_PREFERRED_CHANNEL_MASK ((1UL << 11) | (1UL << 15) | (1UL << 20) | (1UL << 25))
+
+typedef enum {
+    ZB_JOIN_PHASE_CACHED,           /* the channel of the last network joined */
+    ZB_JOIN_PHASE_PREFERRED,        /* ZB_JOIN_PREFERRED_CHANNEL_MASK, less the cached channel */
+    ZB_JOIN_PHASE_FULL,             /* the whole channel mask, repeated until steering succeeds */
+    ZB_JOIN_PHASE_COUNT,
+} zb_join_phase_t;
+
+typedef struct {
+    zb_join_phase_t phase;          /* current phase, or the one that joined */
+    bool joined;
+    uint32_t attempts[ZB_JOIN_PHASE_COUNT];    /* the full phase repeats for as long as steering fails */
+    uint32_t phaseMs[ZB_JOIN_PHASE_COUNT];
+    uint32_t totalMs;
+} zb_join_stats_t;
+
+typedef struct {
+    uint32_t masks[ZB_JOIN_PHASE_COUNT];
+    uint32_t startedAt;
+    uint32_t phaseStartedAt;
+    zb_join_stats_t stats;
+} zb_join_plan_t;
+
+/* cachedChannel is 0 when no network has been joined before; phases left with no channels are skipped */
+void ZB_JoinPlanInit(zb_join_plan_t *plan, uint8_t cachedChannel, uint32_t preferredMask, uint32_t fullMask);
+
+/* Channel mask for the first steering attempt */
+uint32_t ZB_JoinPlanStart(zb_join_plan_t *plan, uint32_t nowMs);
+
+/* Channel mask for the next steering attempt after one failed */
+uint32_t ZB_JoinPlanOnFailed(zb_join_plan_t *plan, uint32_t nowMs);
+
+void ZB_JoinPlanOnJoined(zb_join_plan_t *plan, uint32_t nowMs);
+
+const char *ZB_JoinPhaseToString(zb_join_phase_t phase);
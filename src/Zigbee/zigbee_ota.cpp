@@ -0,0 +1,742 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "Log/deferred_log.h"
+#include "Memory/memory_pool.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_commands.h"
+#include "Zigbee/zigbee_ota.h"
+
+#define ZCL_FRAME_CONTROL_OTA_REQUEST (ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE)
+#define ZCL_OTA_MAX_FRAME_SIZE 24               /* the largest request, Image Block Request, with its header */
+
+/* Scheduler alarms, one callback told apart by its parameter */
+#define OTA_ALARM_PUMP 0                        /* next block request or timeout due */
+#define OTA_ALARM_QUERY 1
+#define OTA_ALARM_UPGRADE 2
+
+/* Flash queue: each block in flight can add an erase and a write, and the download a checkpoint, so new requests are
+ * held back while fewer slots than that are free
+ */
+#define OTA_FLASH_HEADROOM (2 * ZB_OTA_MAX_WINDOW + 2)
+#define OTA_FLASH_BACKOFF_MS 10
+
+typedef enum {
+    OTA_FLASH_ERASE,
+    OTA_FLASH_WRITE,
+    OTA_FLASH_SAVE_CHECKPOINT,
+    OTA_FLASH_CLEAR_CHECKPOINT,
+} ota_flash_op_type_t;
+
+typedef struct {
+    uint8_t type;                               /* ota_flash_op_type_t */
+    uint32_t offset;
+    uint32_t size;
+    union {
+        uint8_t data[ZB_OTA_MAX_BLOCK_SIZE];
+        zb_ota_checkpoint_t checkpoint;
+    };
+} ota_flash_op_t;
+
+/* Frame layouts, after the ZCL header */
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t> query_next_image_request_t;         /* field control, manufacturer, type, version */
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t, uint32_t> query_next_image_response_t; /* status, manufacturer, type, version, size */
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t, uint32_t, uint8_t> image_block_request_t; /* field control, ..., offset, max size */
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t, uint32_t, zb_octet_string_t> image_block_response_t; /* status, ..., offset, data */
+typedef ZbPayload<uint8_t, uint32_t, uint32_t, uint16_t> image_block_wait_t;                /* status, current time, request time, block period */
+typedef ZbPayload<uint8_t, uint16_t, uint16_t, uint32_t> upgrade_end_request_t;             /* status, manufacturer, type, version */
+typedef ZbPayload<uint16_t, uint16_t, uint32_t, uint32_t, uint32_t> upgrade_end_response_t; /* manufacturer, type, version, current & upgrade time */
+typedef ZbPayload<uint8_t, uint8_t> image_notify_t;                                          /* payload type, query jitter */
+
+// Only touched on the Zigbee stack task or with the stack lock held
+static zb_ota_config_t config = {
+    .manufacturer = ZB_OTA_MANUFACTURER_CODE,
+    .imageType = ZB_OTA_IMAGE_TYPE,
+    .fileVersion = ZB_OTA_FILE_VERSION,
+    .queryIntervalMs = ZB_OTA_QUERY_INTERVAL_MS,
+    .window = ZB_OTA_MAX_WINDOW,
+    .maxBlockSize = ZB_OTA_MAX_BLOCK_SIZE,
+    .blockTimeoutMs = ZB_OTA_BLOCK_TIMEOUT_MS,
+};
+static zb_ota_engine_t engine;
+static const esp_partition_t *partition = NULL;
+static uint8_t clientEndpoint = 0;
+static uint16_t serverAddress = ZB_OTA_DEFAULT_SERVER_ADDRESS;
+static uint8_t serverEndpoint = ZB_OTA_DEFAULT_SERVER_ENDPOINT;
+static uint8_t transactionSequence = 0;
+static bool upgradePending = false;
+static uint32_t reportedOffset = 0;
+
+// The last checkpoint queued for NVS, so the stack task never has to read it back
+static zb_ota_checkpoint_t savedCheckpoint;
+static bool haveSavedCheckpoint = false;
+
+// Shared with the flash task, under flashMux
+static ota_flash_op_t flashOps[ZB_OTA_FLASH_QUEUE_LENGTH];
+static uint8_t flashHead = 0;
+static uint8_t flashCount = 0;                  /* the operation in progress included */
+static esp_err_t flashError = ESP_OK;
+static TaskHandle_t flashTask = NULL;
+static portMUX_TYPE flashMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void onOtaAlarm(uint8_t param);
+
+/********************* Flash task **************************/
+static void saveCheckpoint(const zb_ota_checkpoint_t *checkpoint) {
+    Preferences preferences;
+
+    if (!preferences.begin(ZB_OTA_NVS_NAMESPACE, false) || preferences.putBytes(ZB_OTA_NVS_KEY, checkpoint, sizeof(*checkpoint)) != sizeof(*checkpoint)) {
+        log_w("Failed to save OTA checkpoint to NVS");
+    }
+    preferences.end();
+}
+
+static void clearCheckpoint() {
+    Preferences preferences;
+
+    if (preferences.begin(ZB_OTA_NVS_NAMESPACE, false)) {
+        if (preferences.isKey(ZB_OTA_NVS_KEY)) {
+            preferences.remove(ZB_OTA_NVS_KEY);
+        }
+        preferences.end();
+    }
+}
+
+static esp_err_t runFlashOp(const ota_flash_op_t *op) {
+    switch (op->type) {
+        case OTA_FLASH_ERASE:
+            return esp_partition_erase_range(partition, op->offset, op->size);
+        case OTA_FLASH_WRITE:
+            return esp_partition_write(partition, op->offset, op->data, op->size);
+        case OTA_FLASH_SAVE_CHECKPOINT:
+            saveCheckpoint(&op->checkpoint);
+            return ESP_OK;
+        case OTA_FLASH_CLEAR_CHECKPOINT:
+            clearCheckpoint();
+            return ESP_OK;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+}
+
+// Operations run in the order they were queued, so a checkpoint is only saved once the blocks before it are written
+static void taskOtaFlash(void *arg) {
+    static ota_flash_op_t op;
+
+    for (;;) {
+        portENTER_CRITICAL(&flashMux);
+        bool pending = flashCount != 0;
+        if (pending) {
+            op = flashOps[flashHead];
+        }
+        portEXIT_CRITICAL(&flashMux);
+
+        if (!pending) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        esp_err_t err = runFlashOp(&op);
+
+        portENTER_CRITICAL(&flashMux);
+        if (err != ESP_OK && flashError == ESP_OK) {
+            flashError = err;
+        }
+        flashHead = (flashHead + 1) % ZB_OTA_FLASH_QUEUE_LENGTH;
+        flashCount--;
+        portEXIT_CRITICAL(&flashMux);
+    }
+}
+
+static uint8_t flashFree() {
+    portENTER_CRITICAL(&flashMux);
+    uint8_t count = flashCount;
+    portEXIT_CRITICAL(&flashMux);
+
+    return ZB_OTA_FLASH_QUEUE_LENGTH - count;
+}
+
+static esp_err_t takeFlashError() {
+    portENTER_CRITICAL(&flashMux);
+    esp_err_t err = flashError;
+    flashError = ESP_OK;
+    portEXIT_CRITICAL(&flashMux);
+
+    return err;
+}
+
+// Waits only if the queue is full, which the headroom kept by pump() leaves to a flash that has stopped answering
+static void queueFlashOp(uint8_t type, uint32_t offset, const void *data, uint32_t size) {
+    for (;;) {
+        portENTER_CRITICAL(&flashMux);
+        bool queued = flashCount < ZB_OTA_FLASH_QUEUE_LENGTH;
+        if (queued) {
+            ota_flash_op_t *op = &flashOps[(flashHead + flashCount) % ZB_OTA_FLASH_QUEUE_LENGTH];
+            op->type = type;
+            op->offset = offset;
+            op->size = size;
+            if (type == OTA_FLASH_SAVE_CHECKPOINT) {
+                op->checkpoint = *(const zb_ota_checkpoint_t *)data;
+            } else if (data != NULL) {
+                memcpy(op->data, data, size);
+            }
+            flashCount++;
+        }
+        portEXIT_CRITICAL(&flashMux);
+
+        if (queued) {
+            xTaskNotifyGive(flashTask);
+            return;
+        }
+        vTaskDelay(1);
+    }
+}
+
+// Before the boot partition switch reads the image back
+static void waitForFlash() {
+    while (flashFree() < ZB_OTA_FLASH_QUEUE_LENGTH) {
+        vTaskDelay(1);
+    }
+}
+
+// The engine's flash interface: writes and erases are queued for the flash task, failures surface on a later pump()
+static esp_err_t partitionWrite(void *context, uint32_t offset, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    while (size) {
+        uint32_t take = size < ZB_OTA_MAX_BLOCK_SIZE ? size : ZB_OTA_MAX_BLOCK_SIZE;
+        queueFlashOp(OTA_FLASH_WRITE, offset, bytes, take);
+        offset += take;
+        bytes += take;
+        size -= take;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t partitionErase(void *context, uint32_t offset, size_t size) {
+    queueFlashOp(OTA_FLASH_ERASE, offset, NULL, size);
+    return ESP_OK;
+}
+
+/********************* Checkpoints **************************/
+static bool loadCheckpoint(zb_ota_checkpoint_t *checkpoint) {
+    Preferences preferences;
+
+    if (!preferences.begin(ZB_OTA_NVS_NAMESPACE, true)) {
+        return false;
+    }
+
+    bool loaded = preferences.getBytes(ZB_OTA_NVS_KEY, checkpoint, sizeof(*checkpoint)) == sizeof(*checkpoint);
+    preferences.end();
+
+    return loaded;
+}
+
+static void queueSaveCheckpoint(const zb_ota_checkpoint_t *checkpoint) {
+    savedCheckpoint = *checkpoint;
+    haveSavedCheckpoint = true;
+    queueFlashOp(OTA_FLASH_SAVE_CHECKPOINT, 0, checkpoint, 0);
+}
+
+static void queueClearCheckpoint() {
+    haveSavedCheckpoint = false;
+    queueFlashOp(OTA_FLASH_CLEAR_CHECKPOINT, 0, NULL, 0);
+}
+
+/********************* Frames **************************/
+static void setAttribute(uint16_t attribute, const void *value) {
+    esp_zb_zcl_set_attribute_val(clientEndpoint, ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE, attribute, (void *)value, false);
+}
+
+static void setUpgradeStatus(uint8_t status) {
+    setAttribute(ZB_ATTR_OTA_IMAGE_UPGRADE_STATUS_ID, &status);
+}
+
+static void sendRequest(uint8_t commandId, const uint8_t *payload, size_t length) {
+    uint8_t asdu[ZCL_OTA_MAX_FRAME_SIZE];
+
+    asdu[0] = ZCL_FRAME_CONTROL_OTA_REQUEST;
+    asdu[1] = transactionSequence++;
+    asdu[2] = commandId;
+    memcpy(&asdu[3], payload, length);
+
+    esp_zb_apsde_data_req_t request = {};
+    request.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    request.dst_addr.addr_short = serverAddress;
+    request.dst_endpoint = serverEndpoint;
+    request.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    request.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE;
+    request.src_endpoint = clientEndpoint;
+    request.asdu_length = 3 + length;
+    request.asdu = asdu;
+
+    esp_err_t err = esp_zb_aps_data_request(&request);
+    if (err != ESP_OK) {
+        dlog_w("Failed to send OTA command 0x%x to 0x%04hx (status: %s)", commandId, serverAddress, esp_err_to_name(err));
+    }
+}
+
+static void sendQuery() {
+    uint8_t payload[ZCL_OTA_MAX_FRAME_SIZE];
+    size_t length;
+
+    query_next_image_request_t::encode(payload, sizeof(payload), &length, 0, config.manufacturer, config.imageType, config.fileVersion);
+    sendRequest(ZB_OTA_CMD_QUERY_NEXT_IMAGE_REQUEST, payload, length);
+}
+
+static void sendBlockRequest(const zb_ota_block_request_t *block) {
+    uint8_t payload[ZCL_OTA_MAX_FRAME_SIZE];
+    size_t length;
+
+    image_block_request_t::encode(payload, sizeof(payload), &length, 0, engine.image.manufacturer, engine.image.imageType, engine.image.fileVersion,
+                                  block->offset, block->size);
+    sendRequest(ZB_OTA_CMD_IMAGE_BLOCK_REQUEST, payload, length);
+}
+
+static void sendUpgradeEnd(uint8_t status) {
+    uint8_t payload[ZCL_OTA_MAX_FRAME_SIZE];
+    size_t length;
+
+    upgrade_end_request_t::encode(payload, sizeof(payload), &length, status, engine.image.manufacturer, engine.image.imageType, engine.image.fileVersion);
+    sendRequest(ZB_OTA_CMD_UPGRADE_END_REQUEST, payload, length);
+}
+
+/********************* Download **************************/
+static void scheduleQuery(uint32_t delayMs) {
+    esp_zb_scheduler_alarm_cancel(onOtaAlarm, OTA_ALARM_QUERY);
+    if (delayMs != ZB_OTA_NEVER) {
+        esp_zb_scheduler_alarm(onOtaAlarm, OTA_ALARM_QUERY, delayMs);
+    }
+}
+
+static void applyUpgrade() {
+    upgradePending = false;
+
+    // The hash was checked as the image streamed past; the last blocks may still be on their way to flash
+    waitForFlash();
+    esp_err_t err = takeFlashError();
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(partition);
+    }
+    if (err != ESP_OK) {
+        dlog_e("Downloaded image %08lx rejected at boot partition switch (%s)", (unsigned long)engine.image.fileVersion, esp_err_to_name(err));
+        setUpgradeStatus(ZB_OTA_UPGRADE_STATUS_NORMAL);
+        scheduleQuery(config.queryIntervalMs ? config.queryIntervalMs : ZB_OTA_NEVER);
+        return;
+    }
+
+    dlog_i("Restarting into image %08lx from '%s'", (unsigned long)engine.image.fileVersion, partition->label);
+    DLOG_Flush();
+    esp_restart();
+}
+
+// Status reported back to the server for a failed download; the server's own abort is not answered
+static uint8_t upgradeEndStatus(esp_err_t error) {
+    switch (error) {
+        case ESP_ERR_INVALID_RESPONSE:
+        case ESP_ERR_INVALID_VERSION:
+        case ESP_ERR_INVALID_SIZE:
+        case ESP_ERR_INVALID_CRC:
+        case ESP_ERR_NOT_SUPPORTED:
+            return ZB_OTA_STATUS_INVALID_IMAGE;
+        default:
+            return ZB_OTA_STATUS_ABORT;         // flash errors
+    }
+}
+
+// React to the engine finishing, one way or the other
+static void onDownloadEnded() {
+    uint32_t elapsedMs = engine.stats.endMs - engine.stats.startMs;
+
+    if (engine.state == ZB_OTA_VERIFIED) {
+        // Two records, as all of it is more arguments than one deferred record carries
+        dlog_i("OTA image %08lx verified: %lu bytes in %lu ms (%lu B/s)", (unsigned long)engine.image.fileVersion, (unsigned long)engine.image.fileSize,
+               (unsigned long)elapsedMs, (unsigned long)(elapsedMs ? (uint64_t)engine.stats.bytes * 1000 / elapsedMs : 0));
+        dlog_i("OTA image %08lx took %lu requests, %lu retries, block size %d", (unsigned long)engine.image.fileVersion, (unsigned long)engine.stats.requests,
+               (unsigned long)engine.stats.retries, engine.blockSize);
+
+        queueClearCheckpoint();
+        setUpgradeStatus(ZB_OTA_UPGRADE_STATUS_DOWNLOADED);
+        upgradePending = true;
+        sendUpgradeEnd(ZB_OTA_STATUS_SUCCESS);
+        esp_zb_scheduler_alarm(onOtaAlarm, OTA_ALARM_UPGRADE, ZB_OTA_UPGRADE_END_TIMEOUT_MS);
+        return;
+    }
+
+    setUpgradeStatus(ZB_OTA_UPGRADE_STATUS_NORMAL);
+
+    if (engine.error == ESP_ERR_TIMEOUT) {
+        // The server went quiet; the checkpoint stands, so the next offer of this image picks up from it
+        dlog_w("OTA download stalled at %lu of %lu bytes, retrying later", (unsigned long)engine.consumed, (unsigned long)engine.image.fileSize);
+        scheduleQuery(ZB_OTA_QUERY_DELAY_MS);
+        return;
+    }
+
+    dlog_w("OTA image %08lx failed at %lu of %lu bytes (%s)", (unsigned long)engine.image.fileVersion, (unsigned long)engine.consumed,
+           (unsigned long)engine.image.fileSize, esp_err_to_name(engine.error));
+    queueClearCheckpoint();
+    if (engine.error != ESP_ERR_INVALID_STATE) {
+        sendUpgradeEnd(upgradeEndStatus(engine.error));
+    }
+    scheduleQuery(config.queryIntervalMs ? config.queryIntervalMs : ZB_OTA_NEVER);
+}
+
+// Send whatever requests are due, then wake again when the next one is
+static void pump() {
+    uint32_t now = millis();
+    zb_ota_block_request_t block;
+
+    esp_zb_scheduler_alarm_cancel(onOtaAlarm, OTA_ALARM_PUMP);
+
+    esp_err_t err = takeFlashError();
+    if (err != ESP_OK) {
+        ZB_OtaEngineAbort(&engine, err, now);
+    }
+
+    // Only ask for more while the flash task has room for everything that could come back
+    bool flashReady = flashFree() >= OTA_FLASH_HEADROOM;
+    while (flashReady && ZB_OtaEngineNextRequest(&engine, now, &block)) {
+        sendBlockRequest(&block);
+    }
+
+    if (engine.state == ZB_OTA_FAILED) {
+        onDownloadEnded();
+        return;
+    }
+
+    uint32_t delay = ZB_OtaEngineNextDelay(&engine, now);
+    if (!flashReady && delay < OTA_FLASH_BACKOFF_MS) {
+        delay = OTA_FLASH_BACKOFF_MS;
+    }
+    if (delay != ZB_OTA_NEVER) {
+        esp_zb_scheduler_alarm(onOtaAlarm, OTA_ALARM_PUMP, delay ? delay : 1);
+    }
+}
+
+static void beginDownload(const zb_ota_image_t *image) {
+    bool haveCheckpoint = haveSavedCheckpoint;
+
+    // A flash error belongs to the download it failed
+    takeFlashError();
+
+    esp_err_t err = ZB_OtaEngineBegin(&engine, image, haveCheckpoint ? &savedCheckpoint : NULL, millis());
+    if (err != ESP_OK) {
+        dlog_w("OTA image %08lx of %lu bytes refused (%s)", (unsigned long)image->fileVersion, (unsigned long)image->fileSize, esp_err_to_name(err));
+        return;
+    }
+
+    if (engine.stats.resumedFrom) {
+        dlog_i("Resuming OTA image %08lx at %lu of %lu bytes", (unsigned long)image->fileVersion, (unsigned long)engine.stats.resumedFrom, (unsigned long)image->fileSize);
+    } else {
+        // A checkpoint for some other image is no use any more
+        if (haveCheckpoint) {
+            queueClearCheckpoint();
+        }
+        dlog_i("Downloading OTA image %08lx, %lu bytes into '%s'", (unsigned long)image->fileVersion, (unsigned long)image->fileSize, partition->label);
+    }
+
+    reportedOffset = engine.consumed;
+    setAttribute(ZB_ATTR_OTA_FILE_OFFSET_ID, &reportedOffset);
+    setUpgradeStatus(ZB_OTA_UPGRADE_STATUS_DOWNLOADING);
+    pump();
+}
+
+/********************* Server frames **************************/
+static void onImageNotify(const esp_zb_apsde_data_ind_t *ind, const uint8_t *payload, size_t length) {
+    image_notify_t::values_t notify;
+
+    if (!image_notify_t::parse(payload, length, &notify) || engine.state == ZB_OTA_DOWNLOADING || upgradePending) {
+        return;
+    }
+
+    // Broadcast notifications ask only a share of the clients to query, spreading the load on the server
+    uint8_t jitter = std::get<1>(notify);
+    if (ind->dst_short_addr >= 0xfff8 && esp_random() % 100 >= jitter) {
+        return;
+    }
+
+    serverAddress = ind->src_short_addr;
+    serverEndpoint = ind->src_endpoint;
+    scheduleQuery(0);
+}
+
+static void onQueryNextImageResponse(const uint8_t *payload, size_t length) {
+    query_next_image_response_t::values_t response;
+
+    if (engine.state == ZB_OTA_DOWNLOADING || upgradePending) {
+        return;
+    }
+    if (!query_next_image_response_t::parse(payload, length, &response) || std::get<0>(response) != ZB_OTA_STATUS_SUCCESS) {
+        dlog_d("No OTA image available (status: 0x%x)", length ? payload[0] : 0);
+        return;
+    }
+
+    zb_ota_image_t image = {
+        .manufacturer = std::get<1>(response),
+        .imageType = std::get<2>(response),
+        .fileVersion = std::get<3>(response),
+        .fileSize = std::get<4>(response),
+    };
+
+    if (image.manufacturer != config.manufacturer || image.imageType != config.imageType || image.fileVersion == config.fileVersion) {
+        dlog_w("Ignoring OTA image %04x-%04x-%08lx, not an update for this device", image.manufacturer, image.imageType, (unsigned long)image.fileVersion);
+        return;
+    }
+
+    beginDownload(&image);
+}
+
+static void onImageBlockResponse(const uint8_t *payload, size_t length) {
+    if (length == 0 || engine.state != ZB_OTA_DOWNLOADING) {
+        return;
+    }
+
+    uint32_t now = millis();
+
+    switch (payload[0]) {
+        case ZB_OTA_STATUS_SUCCESS: {
+            image_block_response_t::values_t block;
+            if (!image_block_response_t::parse(payload, length, &block) || std::get<1>(block) != engine.image.manufacturer ||
+                std::get<2>(block) != engine.image.imageType || std::get<3>(block) != engine.image.fileVersion) {
+                dlog_w("Malformed OTA image block ignored");
+                return;
+            }
+
+            const zb_octet_string_t &data = std::get<5>(block);
+            ZB_OtaEngineOnBlock(&engine, std::get<4>(block), data.data, data.length, now);
+            break;
+        }
+
+        case ZB_OTA_STATUS_WAIT_FOR_DATA: {
+            image_block_wait_t::values_t wait;
+            if (!image_block_wait_t::parse(payload, length, &wait)) {
+                return;
+            }
+
+            // With no current time, the request time is an offset in seconds
+            uint32_t currentTime = std::get<1>(wait);
+            uint32_t requestTime = std::get<2>(wait);
+            uint32_t waitS = currentTime == 0 ? requestTime : requestTime > currentTime ? requestTime - currentTime : 0;
+            uint16_t blockPeriodMs = std::get<3>(wait);
+
+            ZB_OtaEngineOnWait(&engine, waitS * 1000, blockPeriodMs, now);
+            setAttribute(ZB_ATTR_OTA_MINIMUM_BLOCK_PERIOD_ID, &blockPeriodMs);
+            break;
+        }
+
+        case ZB_OTA_STATUS_ABORT:
+            dlog_w("OTA server aborted the download");
+            ZB_OtaEngineAbort(&engine, ESP_ERR_INVALID_STATE, now);
+            break;
+
+        default:
+            return;
+    }
+
+    zb_ota_checkpoint_t checkpoint;
+    if (ZB_OtaEngineTakeCheckpoint(&engine, &checkpoint)) {
+        queueSaveCheckpoint(&checkpoint);
+        reportedOffset = checkpoint.fileOffset;
+        setAttribute(ZB_ATTR_OTA_FILE_OFFSET_ID, &reportedOffset);
+    }
+
+    if (engine.state == ZB_OTA_DOWNLOADING) {
+        pump();
+    } else {
+        reportedOffset = engine.consumed;
+        setAttribute(ZB_ATTR_OTA_FILE_OFFSET_ID, &reportedOffset);
+        esp_zb_scheduler_alarm_cancel(onOtaAlarm, OTA_ALARM_PUMP);
+        onDownloadEnded();
+    }
+}
+
+static void onUpgradeEndResponse(const uint8_t *payload, size_t length) {
+    upgrade_end_response_t::values_t response;
+
+    if (!upgradePending || !upgrade_end_response_t::parse(payload, length, &response) || std::get<2>(response) != engine.image.fileVersion) {
+        return;
+    }
+
+    // An upgrade time of all ones means wait for the server to send another response later
+    uint32_t currentTime = std::get<3>(response);
+    uint32_t upgradeTime = std::get<4>(response);
+    esp_zb_scheduler_alarm_cancel(onOtaAlarm, OTA_ALARM_UPGRADE);
+    if (upgradeTime == 0xffffffff) {
+        return;
+    }
+
+    uint32_t delayS = currentTime == 0 ? upgradeTime : upgradeTime > currentTime ? upgradeTime - currentTime : 0;
+    dlog_i("Upgrading to image %08lx in %lu s", (unsigned long)engine.image.fileVersion, (unsigned long)delayS);
+    setUpgradeStatus(ZB_OTA_UPGRADE_STATUS_WAITING);
+
+    if (delayS == 0) {
+        applyUpgrade();
+    } else {
+        esp_zb_scheduler_alarm(onOtaAlarm, OTA_ALARM_UPGRADE, delayS * 1000);
+    }
+}
+
+static void onOtaAlarm(uint8_t param) {
+    switch (param) {
+        case OTA_ALARM_PUMP:
+            pump();
+            break;
+
+        case OTA_ALARM_QUERY:
+            if (engine.state != ZB_OTA_DOWNLOADING && !upgradePending && esp_zb_bdb_dev_joined()) {
+                sendQuery();
+            }
+            if (config.queryIntervalMs) {
+                esp_zb_scheduler_alarm(onOtaAlarm, OTA_ALARM_QUERY, config.queryIntervalMs);
+            }
+            break;
+
+        case OTA_ALARM_UPGRADE:
+            applyUpgrade();
+            break;
+    }
+}
+
+// External interface functions
+void ZB_OtaAddClusters(uint8_t endpoint, esp_zb_cluster_list_t *clusterList) {
+    partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL) {
+        log_w("No OTA update partition, OTA upgrades disabled");
+        return;
+    }
+
+    if (flashTask == NULL) {
+        flashTask = MEM_CreateTask(taskOtaFlash, ZB_OTA_TASK_NAME, ZB_OTA_TASK_STACK_SIZE, NULL, ZB_OTA_TASK_PRIORITY);
+    }
+    if (flashTask == NULL) {
+        log_e("OTA flash task could not be created, OTA upgrades disabled");
+        partition = NULL;
+        return;
+    }
+
+    // Read once here; from now on the stack task keeps its own copy of what it queues for NVS
+    haveSavedCheckpoint = loadCheckpoint(&savedCheckpoint);
+
+    zb_ota_flash_t flash = {
+        .write = partitionWrite,
+        .erase = partitionErase,
+        .context = (void *)partition,
+        .sectorSize = partition->erase_size,
+        .size = partition->size,
+    };
+    ZB_OtaEngineInit(&engine, &flash, config.window, config.maxBlockSize, config.blockTimeoutMs);
+    clientEndpoint = endpoint;
+
+    // The stack copies these defaults into its own storage
+    uint32_t fileOffset = 0xffffffff;
+    uint8_t upgradeStatus = ZB_OTA_UPGRADE_STATUS_NORMAL;
+    uint16_t blockPeriod = 0;
+    const struct {
+        uint16_t id;
+        uint8_t type;
+        const void *value;
+    } otaAttributes[] = {
+        {ZB_ATTR_OTA_FILE_OFFSET_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &fileOffset},
+        {ZB_ATTR_OTA_CURRENT_FILE_VERSION_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &config.fileVersion},
+        {ZB_ATTR_OTA_IMAGE_UPGRADE_STATUS_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, &upgradeStatus},
+        {ZB_ATTR_OTA_MANUFACTURER_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &config.manufacturer},
+        {ZB_ATTR_OTA_IMAGE_TYPE_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &config.imageType},
+        {ZB_ATTR_OTA_MINIMUM_BLOCK_PERIOD_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &blockPeriod},
+    };
+
+    esp_zb_attribute_list_t *otaCluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE);
+    for (size_t i = 0; i < sizeof(otaAttributes) / sizeof(otaAttributes[0]); i++) {
+        ESP_ERROR_CHECK(esp_zb_cluster_add_attr(otaCluster, ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE, otaAttributes[i].id, otaAttributes[i].type,
+                                                ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, (void *)otaAttributes[i].value));
+    }
+
+    // Added as a plain client cluster, so the stack leaves the upgrade itself to us
+    ESP_ERROR_CHECK(esp_zb_cluster_list_add_custom_cluster(clusterList, otaCluster, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE));
+}
+
+void ZB_OtaResume() {
+    if (partition == NULL || engine.state == ZB_OTA_DOWNLOADING || upgradePending) {
+        return;
+    }
+
+    scheduleQuery(ZB_OTA_QUERY_DELAY_MS);
+}
+
+bool ZB_OtaHandleIndication(const esp_zb_apsde_data_ind_t *ind) {
+    if (partition == NULL || ind->cluster_id != ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE || ind->dst_endpoint != clientEndpoint || ind->asdu_length < 3) {
+        return false;
+    }
+
+    // Profile wide commands, such as reads of our attributes, are the stack's
+    uint8_t frameControl = ind->asdu[0];
+    size_t headerLength = frameControl & ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC ? 5 : 3;
+    if (!(frameControl & ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC) || !(frameControl & ZCL_FRAME_CONTROL_SERVER_TO_CLIENT) || ind->asdu_length < headerLength) {
+        return false;
+    }
+
+    const uint8_t *payload = ind->asdu + headerLength;
+    size_t length = ind->asdu_length - headerLength;
+
+    switch (ind->asdu[headerLength - 1]) {
+        case ZB_OTA_CMD_IMAGE_NOTIFY:
+            onImageNotify(ind, payload, length);
+            break;
+        case ZB_OTA_CMD_QUERY_NEXT_IMAGE_RESPONSE:
+            onQueryNextImageResponse(payload, length);
+            break;
+        case ZB_OTA_CMD_IMAGE_BLOCK_RESPONSE:
+            onImageBlockResponse(payload, length);
+            break;
+        case ZB_OTA_CMD_UPGRADE_END_RESPONSE:
+            onUpgradeEndResponse(payload, length);
+            break;
+        default:
+            break;
+    }
+
+    return true;
+}
+
+void ZB_SetOtaConfig(const zb_ota_config_t *otaConfig) {
+    config = *otaConfig;
+}
+
+void ZB_QueryOtaImage() {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    if (partition != NULL) {
+        scheduleQuery(0);
+    }
+    esp_zb_lock_release();
+}
+
+void ZB_GetOtaStatus(zb_ota_status_t *status) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+
+    status->state = engine.state;
+    status->error = engine.error;
+    status->upgradePending = upgradePending;
+    status->image = engine.image;
+    status->fileOffset = engine.consumed;
+    status->blockSize = engine.blockSize;
+    status->serverAddress = serverAddress;
+    status->stats = engine.stats;
+
+    esp_zb_lock_release();
+}
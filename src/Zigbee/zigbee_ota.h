@@ -0,0 +1,124 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* OTA Upgrade client
+ * The first endpoint carries an OTA Upgrade client cluster whose frames are built and parsed here rather than by the
+ * stack, so image blocks can be kept several in flight and streamed straight into the update partition by a
+ * zigbee_ota_engine.h engine. The client queries its server ZB_OTA_QUERY_DELAY_MS after joining, then every query
+ * interval, and at once on an Image Notify. Checkpoints go to NVS as the image streams in, so a download cut short by a
+ * restart or a silent server resumes from the last one when the server next offers the same image. Once the image is
+ * on flash and its hash verified, the client sends Upgrade End Request, sets the boot partition and restarts at the
+ * time the server answers with.
+ *
+ * Frames are handled on the stack task, but flash erases and writes and the NVS checkpoints are queued, in order, for
+ * the ZB_OTA_TASK_NAME task, so a sector erase never holds up the stack. Block requests are held back while the queue
+ * is short of room for the blocks they would bring in.
+ */
+#pragma once
+
+#include "aps/esp_zigbee_aps.h"
+#include "esp_zigbee_core.h"
+#include "Zigbee/zigbee_ota_engine.h"
+
+/* Identity of the running firmware, matched against the images a server offers; override in platformio.ini */
+#ifndef ZB_OTA_MANUFACTURER_CODE
+#define ZB_OTA_MANUFACTURER_CODE 0x131B         /* Espressif */
+#endif
+
+#ifndef ZB_OTA_IMAGE_TYPE
+#define ZB_OTA_IMAGE_TYPE 0x0000
+#endif
+
+#ifndef ZB_OTA_FILE_VERSION
+#define ZB_OTA_FILE_VERSION 0x00000001
+#endif
+
+/* Default timings, in milliseconds */
+#define ZB_OTA_QUERY_DELAY_MS 30000             /* first query after joining */
+#define ZB_OTA_QUERY_INTERVAL_MS 86400000       /* one day */
+#define ZB_OTA_UPGRADE_END_TIMEOUT_MS 60000     /* apply a verified image anyway if Upgrade End Request goes unanswered */
+
+#define ZB_OTA_TASK_NAME "Zigbee_ota"
+#define ZB_OTA_TASK_STACK_SIZE 2560
+#define ZB_OTA_TASK_PRIORITY 1
+
+#ifndef ZB_OTA_FLASH_QUEUE_LENGTH
+#define ZB_OTA_FLASH_QUEUE_LENGTH 16            /* erases, writes & checkpoints waiting for the flash task */
+#endif
+
+#define ZB_OTA_NVS_NAMESPACE "zb_ota"
+#define ZB_OTA_NVS_KEY "checkpoint"
+
+/* OTA Upgrade cluster commands */
+#define ZB_OTA_CMD_IMAGE_NOTIFY 0x00
+#define ZB_OTA_CMD_QUERY_NEXT_IMAGE_REQUEST 0x01
+#define ZB_OTA_CMD_QUERY_NEXT_IMAGE_RESPONSE 0x02
+#define ZB_OTA_CMD_IMAGE_BLOCK_REQUEST 0x03
+#define ZB_OTA_CMD_IMAGE_BLOCK_RESPONSE 0x05
+#define ZB_OTA_CMD_UPGRADE_END_REQUEST 0x06
+#define ZB_OTA_CMD_UPGRADE_END_RESPONSE 0x07
+
+#define ZB_OTA_STATUS_SUCCESS 0x00
+#define ZB_OTA_STATUS_ABORT 0x95
+#define ZB_OTA_STATUS_INVALID_IMAGE 0x96
+#define ZB_OTA_STATUS_WAIT_FOR_DATA 0x97
+#define ZB_OTA_STATUS_NO_IMAGE_AVAILABLE 0x98
+
+/* Client attributes, read-only */
+#define ZB_ATTR_OTA_FILE_OFFSET_ID 0x0001           /* U32, bytes of the file received in order */
+#define ZB_ATTR_OTA_CURRENT_FILE_VERSION_ID 0x0002  /* U32 */
+#define ZB_ATTR_OTA_IMAGE_UPGRADE_STATUS_ID 0x0006  /* 8-bit enum, below */
+#define ZB_ATTR_OTA_MANUFACTURER_ID 0x0007          /* U16 */
+#define ZB_ATTR_OTA_IMAGE_TYPE_ID 0x0008            /* U16 */
+#define ZB_ATTR_OTA_MINIMUM_BLOCK_PERIOD_ID 0x0009  /* U16, milliseconds, as last set by the server */
+
+#define ZB_OTA_UPGRADE_STATUS_NORMAL 0x00
+#define ZB_OTA_UPGRADE_STATUS_DOWNLOADING 0x01
+#define ZB_OTA_UPGRADE_STATUS_DOWNLOADED 0x02
+#define ZB_OTA_UPGRADE_STATUS_WAITING 0x03
+
+#define ZB_OTA_DEFAULT_SERVER_ADDRESS 0x0000    /* the coordinator, until an Image Notify names another server */
+#define ZB_OTA_DEFAULT_SERVER_ENDPOINT 1
+
+typedef struct {
+    uint16_t manufacturer;
+    uint16_t imageType;
+    uint32_t fileVersion;                       /* of the running firmware */
+    uint32_t queryIntervalMs;                   /* 0 to query only when notified or asked to */
+    uint8_t window;                             /* block requests kept in flight, 1 to ZB_OTA_MAX_WINDOW */
+    uint8_t maxBlockSize;                       /* largest block asked for, ZB_OTA_MIN_BLOCK_SIZE to ZB_OTA_MAX_BLOCK_SIZE */
+    uint32_t blockTimeoutMs;
+} zb_ota_config_t;
+
+typedef struct {
+    zb_ota_state_t state;
+    esp_err_t error;
+    bool upgradePending;                        /* verified and waiting for the upgrade time */
+    zb_ota_image_t image;
+    uint32_t fileOffset;
+    uint8_t blockSize;
+    uint16_t serverAddress;
+    zb_ota_stats_t stats;
+} zb_ota_status_t;
+
+/* Called from ZB_CreateEndpoints() to add the OTA Upgrade client cluster to the first endpoint */
+void ZB_OtaAddClusters(uint8_t endpoint, esp_zb_cluster_list_t *clusterList);
+
+/* The rest are called on the Zigbee stack task */
+
+/* Once joined: schedule the first query */
+void ZB_OtaResume();
+
+/* Take OTA Upgrade frames from the server; false for anything else, which the stack then handles */
+bool ZB_OtaHandleIndication(const esp_zb_apsde_data_ind_t *ind);
@@ -0,0 +1,698 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "Zigbee/zigbee_ota_engine.h"
+
+/* Offsets of the OTA file header fields used, all little endian */
+#define HEADER_IDENTIFIER 0
+#define HEADER_LENGTH 6
+#define HEADER_MANUFACTURER 10
+#define HEADER_IMAGE_TYPE 12
+#define HEADER_FILE_VERSION 14
+#define HEADER_TOTAL_SIZE 52
+#define HEADER_PREFIX_SIZE 8                    /* enough to read the header length */
+
+static_assert(ZB_OTA_MAX_BLOCK_SIZE <= 0xff, "block sizes are one byte");
+static_assert(ZB_OTA_MIN_BLOCK_SIZE <= ZB_OTA_MAX_BLOCK_SIZE, "ZB_OTA_MIN_BLOCK_SIZE must not exceed ZB_OTA_MAX_BLOCK_SIZE");
+static_assert(ZB_OTA_CHECKPOINT_SIZE % 64 == 0, "checkpoints fall on SHA-256 block boundaries");
+
+// Wrap-safe "a is before b" for millisecond tick counts
+static inline bool isBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline uint16_t readU16(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8;
+}
+
+static inline uint32_t readU32(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/********************* SHA-256 **************************/
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be,
+    0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa,
+    0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+    0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+    0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256Block(uint32_t state[8], const uint8_t *block) {
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void ZB_OtaSha256Init(zb_ota_sha256_t *sha) {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+}
+
+void ZB_OtaSha256Update(zb_ota_sha256_t *sha, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    size_t used = sha->length % 64;
+
+    sha->length += size;
+
+    if (used) {
+        size_t take = size < 64 - used ? size : 64 - used;
+        memcpy(&sha->buffer[used], bytes, take);
+        bytes += take;
+        size -= take;
+        if (used + take < 64) {
+            return;
+        }
+        sha256Block(sha->state, sha->buffer);
+    }
+
+    for (; size >= 64; bytes += 64, size -= 64) {
+        sha256Block(sha->state, bytes);
+    }
+    memcpy(sha->buffer, bytes, size);
+}
+
+void ZB_OtaSha256Final(zb_ota_sha256_t *sha, uint8_t digest[ZB_OTA_HASH_SIZE]) {
+    uint64_t bits = sha->length * 8;
+    size_t used = sha->length % 64;
+
+    sha->buffer[used++] = 0x80;
+    if (used > 56) {
+        memset(&sha->buffer[used], 0, 64 - used);
+        sha256Block(sha->state, sha->buffer);
+        used = 0;
+    }
+    memset(&sha->buffer[used], 0, 56 - used);
+    for (int i = 0; i < 8; i++) {
+        sha->buffer[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256Block(sha->state, sha->buffer);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = sha->state[i] >> 24;
+        digest[i * 4 + 1] = sha->state[i] >> 16;
+        digest[i * 4 + 2] = sha->state[i] >> 8;
+        digest[i * 4 + 3] = sha->state[i];
+    }
+}
+
+/********************* Parsing & writing **************************/
+static void fail(zb_ota_engine_t *engine, esp_err_t error, uint32_t nowMs) {
+    engine->state = ZB_OTA_FAILED;
+    engine->error = error;
+    engine->stats.endMs = nowMs;
+}
+
+// Bytes of the image covered by the hash: all but the hash appended to it
+static inline uint32_t hashedSize(const zb_ota_engine_t *engine) {
+    return engine->imageSize - ZB_OTA_HASH_SIZE;
+}
+
+static void takeCheckpoint(zb_ota_engine_t *engine) {
+    zb_ota_checkpoint_t *checkpoint = &engine->checkpoint;
+
+    checkpoint->image = engine->image;
+    checkpoint->fileOffset = engine->consumed;
+    checkpoint->imageOffset = engine->imageOffset;
+    checkpoint->imageSize = engine->imageSize;
+    memcpy(checkpoint->hash, engine->hash.state, sizeof(checkpoint->hash));
+
+    engine->checkpointReady = true;
+    engine->stats.checkpoints++;
+}
+
+static esp_err_t checkHeader(zb_ota_engine_t *engine) {
+    const uint8_t *header = engine->header;
+
+    if (readU16(&header[HEADER_MANUFACTURER]) != engine->image.manufacturer || readU16(&header[HEADER_IMAGE_TYPE]) != engine->image.imageType ||
+        readU32(&header[HEADER_FILE_VERSION]) != engine->image.fileVersion || readU32(&header[HEADER_TOTAL_SIZE]) != engine->image.fileSize) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t beginElement(zb_ota_engine_t *engine) {
+    uint16_t tag = readU16(engine->header);
+    uint32_t length = readU32(&engine->header[2]);
+
+    if (length > engine->image.fileSize - engine->consumed) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    engine->remaining = length;
+    engine->have = 0;
+
+    if (tag != ZB_OTA_TAG_UPGRADE_IMAGE || engine->imageSeen) {
+        engine->phase = ZB_OTA_PARSE_SKIP;
+        return ESP_OK;
+    }
+
+    // The app image header alone is 24 bytes, and the hash follows the image
+    if (length < ZB_OTA_APP_HASH_APPENDED_OFFSET + 1 + ZB_OTA_HASH_SIZE) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (length > engine->flash.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    engine->phase = ZB_OTA_PARSE_IMAGE;
+    engine->imageSeen = true;
+    engine->imageOffset = 0;
+    engine->imageSize = length;
+    engine->erasedTo = 0;
+    ZB_OtaSha256Init(&engine->hash);
+    return ESP_OK;
+}
+
+// Hash image bytes, stopping at each checkpoint boundary to offer a checkpoint there
+static void hashImage(zb_ota_engine_t *engine, const uint8_t *data, uint32_t size) {
+    uint32_t end = engine->imageOffset + size;
+
+    while (engine->imageOffset < end) {
+        uint32_t position = engine->imageOffset;
+        uint32_t stop = end;
+
+        if (position >= hashedSize(engine)) {
+            // The appended hash itself, kept to compare against
+            memcpy(&engine->appendedHash[position - hashedSize(engine)], data, stop - position);
+        } else {
+            uint32_t boundary = (position / engine->checkpointSize + 1) * engine->checkpointSize;
+            if (stop > hashedSize(engine)) {
+                stop = hashedSize(engine);
+            }
+            if (stop > boundary) {
+                stop = boundary;
+            }
+            ZB_OtaSha256Update(&engine->hash, data, stop - position);
+
+            if (stop == boundary) {
+                engine->imageOffset = stop;
+                engine->consumed += stop - position;
+                takeCheckpoint(engine);
+                data += stop - position;
+                continue;
+            }
+        }
+
+        engine->consumed += stop - position;
+        engine->imageOffset = stop;
+        data += stop - position;
+    }
+}
+
+static esp_err_t writeImage(zb_ota_engine_t *engine, const uint8_t *data, uint32_t size) {
+    uint32_t offset = engine->imageOffset;
+
+    // The app image header arrives first; refuse anything that is not an app image carrying its own hash
+    if (offset <= ZB_OTA_APP_HASH_APPENDED_OFFSET) {
+        if (offset == 0 && data[0] != ZB_OTA_APP_IMAGE_MAGIC) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (offset + size > ZB_OTA_APP_HASH_APPENDED_OFFSET && data[ZB_OTA_APP_HASH_APPENDED_OFFSET - offset] != 1) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+
+    while (engine->erasedTo < offset + size) {
+        esp_err_t err = engine->flash.erase(engine->flash.context, engine->erasedTo, engine->flash.sectorSize);
+        if (err != ESP_OK) {
+            return err;
+        }
+        engine->erasedTo += engine->flash.sectorSize;
+    }
+
+    esp_err_t err = engine->flash.write(engine->flash.context, offset, data, size);
+    if (err == ESP_OK) {
+        hashImage(engine, data, size);
+    }
+    return err;
+}
+
+// Feed the next bytes of the file, in order
+static esp_err_t parse(zb_ota_engine_t *engine, const uint8_t *data, uint32_t size) {
+    while (size > 0) {
+        uint32_t take;
+        esp_err_t err = ESP_OK;
+
+        switch (engine->phase) {
+            case ZB_OTA_PARSE_HEADER: {
+                uint8_t need = engine->have < HEADER_PREFIX_SIZE ? HEADER_PREFIX_SIZE : engine->headerLength;
+                take = (uint32_t)(need - engine->have) < size ? need - engine->have : size;
+                memcpy(&engine->header[engine->have], data, take);
+                engine->have += take;
+                engine->consumed += take;
+
+                if (engine->have == HEADER_PREFIX_SIZE && need == HEADER_PREFIX_SIZE) {
+                    uint16_t length = readU16(&engine->header[HEADER_LENGTH]);
+                    if (readU32(&engine->header[HEADER_IDENTIFIER]) != ZB_OTA_FILE_IDENTIFIER || length < ZB_OTA_HEADER_MIN_SIZE ||
+                        length > ZB_OTA_HEADER_MAX_SIZE) {
+                        return ESP_ERR_INVALID_RESPONSE;
+                    }
+                    engine->headerLength = length;
+                } else if (engine->have == engine->headerLength) {
+                    err = checkHeader(engine);
+                    engine->phase = ZB_OTA_PARSE_ELEMENT_HEADER;
+                    engine->have = 0;
+                }
+                break;
+            }
+
+            case ZB_OTA_PARSE_ELEMENT_HEADER:
+                take = (uint32_t)(ZB_OTA_ELEMENT_HEADER_SIZE - engine->have) < size ? ZB_OTA_ELEMENT_HEADER_SIZE - engine->have : size;
+                memcpy(&engine->header[engine->have], data, take);
+                engine->have += take;
+                engine->consumed += take;
+
+                if (engine->have == ZB_OTA_ELEMENT_HEADER_SIZE) {
+                    err = beginElement(engine);
+                }
+                break;
+
+            case ZB_OTA_PARSE_IMAGE:
+                take = engine->remaining < size ? engine->remaining : size;
+                err = writeImage(engine, data, take);
+                engine->remaining -= take;
+                break;
+
+            case ZB_OTA_PARSE_SKIP:
+                take = engine->remaining < size ? engine->remaining : size;
+                engine->remaining -= take;
+                engine->consumed += take;
+                break;
+
+            default:
+                return ESP_ERR_INVALID_STATE;
+        }
+
+        if (err != ESP_OK) {
+            return err;
+        }
+        if ((engine->phase == ZB_OTA_PARSE_IMAGE || engine->phase == ZB_OTA_PARSE_SKIP) && engine->remaining == 0) {
+            engine->phase = ZB_OTA_PARSE_ELEMENT_HEADER;
+            engine->have = 0;
+        }
+
+        data += take;
+        size -= take;
+    }
+
+    return ESP_OK;
+}
+
+// The whole file has been parsed: check it held a complete image, and that the image matches its hash
+static void finish(zb_ota_engine_t *engine, uint32_t nowMs) {
+    uint8_t digest[ZB_OTA_HASH_SIZE];
+
+    if (engine->phase != ZB_OTA_PARSE_ELEMENT_HEADER || engine->have != 0 || !engine->imageSeen || engine->imageOffset != engine->imageSize) {
+        fail(engine, ESP_ERR_INVALID_RESPONSE, nowMs);
+        return;
+    }
+
+    ZB_OtaSha256Final(&engine->hash, digest);
+    if (memcmp(digest, engine->appendedHash, sizeof(digest)) != 0) {
+        fail(engine, ESP_ERR_INVALID_CRC, nowMs);
+        return;
+    }
+
+    engine->state = ZB_OTA_VERIFIED;
+    engine->stats.endMs = nowMs;
+}
+
+/********************* Block requests **************************/
+// First byte at or after the parse position that no slot covers, and how far the gap from it runs
+static bool findGap(const zb_ota_engine_t *engine, uint32_t *offset, uint32_t *size) {
+    uint32_t cursor = engine->consumed;
+    bool advanced;
+
+    do {
+        advanced = false;
+        for (uint8_t i = 0; i < engine->window; i++) {
+            const zb_ota_slot_t *slot = &engine->slots[i];
+            if (slot->state != ZB_OTA_SLOT_FREE && slot->offset <= cursor && slot->offset + slot->size > cursor) {
+                cursor = slot->offset + slot->size;
+                advanced = true;
+            }
+        }
+    } while (advanced);
+
+    if (cursor >= engine->image.fileSize) {
+        return false;
+    }
+
+    uint32_t end = engine->image.fileSize;
+    for (uint8_t i = 0; i < engine->window; i++) {
+        const zb_ota_slot_t *slot = &engine->slots[i];
+        if (slot->state != ZB_OTA_SLOT_FREE && slot->offset > cursor && slot->offset < end) {
+            end = slot->offset;
+        }
+    }
+
+    *offset = cursor;
+    *size = end - cursor;
+    return true;
+}
+
+static zb_ota_slot_t *freeSlot(zb_ota_engine_t *engine) {
+    for (uint8_t i = 0; i < engine->window; i++) {
+        if (engine->slots[i].state == ZB_OTA_SLOT_FREE) {
+            return &engine->slots[i];
+        }
+    }
+    return NULL;
+}
+
+// The oldest request that has gone unanswered for the timeout
+static zb_ota_slot_t *timedOutSlot(zb_ota_engine_t *engine, uint32_t nowMs) {
+    zb_ota_slot_t *oldest = NULL;
+
+    for (uint8_t i = 0; i < engine->window; i++) {
+        zb_ota_slot_t *slot = &engine->slots[i];
+        if (slot->state == ZB_OTA_SLOT_REQUESTED && !isBefore(nowMs, slot->sentMs + engine->timeoutMs) &&
+            (oldest == NULL || isBefore(slot->sentMs, oldest->sentMs))) {
+            oldest = slot;
+        }
+    }
+    return oldest;
+}
+
+void ZB_OtaEngineInit(zb_ota_engine_t *engine, const zb_ota_flash_t *flash, uint8_t window, uint8_t maxBlockSize, uint32_t timeoutMs) {
+    memset(engine, 0, sizeof(*engine));
+    engine->flash = *flash;
+    engine->window = window < 1 ? 1 : window > ZB_OTA_MAX_WINDOW ? ZB_OTA_MAX_WINDOW : window;
+    engine->maxBlockSize = maxBlockSize < ZB_OTA_MIN_BLOCK_SIZE ? ZB_OTA_MIN_BLOCK_SIZE : maxBlockSize > ZB_OTA_MAX_BLOCK_SIZE ? ZB_OTA_MAX_BLOCK_SIZE : maxBlockSize;
+    engine->timeoutMs = timeoutMs;
+
+    // Resuming erases the sector a checkpoint starts, so checkpoints must fall on sector boundaries
+    engine->checkpointSize = (ZB_OTA_CHECKPOINT_SIZE + flash->sectorSize - 1) / flash->sectorSize * flash->sectorSize;
+}
+
+esp_err_t ZB_OtaEngineBegin(zb_ota_engine_t *engine, const zb_ota_image_t *image, const zb_ota_checkpoint_t *checkpoint, uint32_t nowMs) {
+    if (engine->state == ZB_OTA_DOWNLOADING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (image->fileSize < ZB_OTA_HEADER_MIN_SIZE + ZB_OTA_ELEMENT_HEADER_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    engine->state = ZB_OTA_DOWNLOADING;
+    engine->error = ESP_OK;
+    engine->image = *image;
+    engine->consumed = 0;
+    engine->blockSize = engine->maxBlockSize;
+    engine->blockPeriodMs = 0;
+    engine->holding = false;
+    engine->requested = false;
+    memset(engine->slots, 0, sizeof(engine->slots));
+
+    engine->phase = ZB_OTA_PARSE_HEADER;
+    engine->have = 0;
+    engine->imageSeen = false;
+    engine->imageOffset = 0;
+    engine->imageSize = 0;
+    engine->erasedTo = 0;
+    engine->checkpointReady = false;
+
+    memset(&engine->stats, 0, sizeof(engine->stats));
+    engine->stats.startMs = nowMs;
+
+    bool resumable = checkpoint != NULL && memcmp(&checkpoint->image, image, sizeof(*image)) == 0 && checkpoint->imageOffset > 0 &&
+                     checkpoint->imageOffset % engine->checkpointSize == 0 && checkpoint->imageSize <= engine->flash.size &&
+                     checkpoint->imageOffset <= checkpoint->imageSize - ZB_OTA_HASH_SIZE &&
+                     checkpoint->fileOffset >= checkpoint->imageOffset && checkpoint->fileOffset - checkpoint->imageOffset + checkpoint->imageSize <= image->fileSize;
+
+    if (resumable) {
+        // Everything before the checkpoint is on flash; the sector it starts is erased again before being written
+        engine->consumed = checkpoint->fileOffset;
+        engine->phase = ZB_OTA_PARSE_IMAGE;
+        engine->imageSeen = true;
+        engine->imageOffset = checkpoint->imageOffset;
+        engine->imageSize = checkpoint->imageSize;
+        engine->remaining = checkpoint->imageSize - checkpoint->imageOffset;
+        engine->erasedTo = checkpoint->imageOffset;
+        memcpy(engine->hash.state, checkpoint->hash, sizeof(checkpoint->hash));
+        engine->hash.length = checkpoint->imageOffset;
+        engine->stats.resumedFrom = checkpoint->fileOffset;
+    }
+
+    return ESP_OK;
+}
+
+bool ZB_OtaEngineNextRequest(zb_ota_engine_t *engine, uint32_t nowMs, zb_ota_block_request_t *request) {
+    if (engine->state != ZB_OTA_DOWNLOADING) {
+        return false;
+    }
+    if (engine->holding) {
+        if (isBefore(nowMs, engine->holdUntilMs)) {
+            return false;
+        }
+        engine->holding = false;
+    }
+    if (engine->requested && engine->blockPeriodMs && isBefore(nowMs, engine->lastRequestMs + engine->blockPeriodMs)) {
+        return false;
+    }
+
+    zb_ota_slot_t *slot = timedOutSlot(engine, nowMs);
+    if (slot) {
+        if (++slot->retries > ZB_OTA_MAX_RETRIES) {
+            fail(engine, ESP_ERR_TIMEOUT, nowMs);
+            return false;
+        }
+
+        // Lost twice at this size: the route may not carry frames this large
+        if (slot->retries >= 2 && slot->size == engine->blockSize && engine->blockSize > ZB_OTA_MIN_BLOCK_SIZE) {
+            engine->blockSize = engine->blockSize / 2 < ZB_OTA_MIN_BLOCK_SIZE ? ZB_OTA_MIN_BLOCK_SIZE : engine->blockSize / 2;
+        }
+        if (slot->size > engine->blockSize) {
+            slot->size = engine->blockSize;         // the rest of its range is asked for separately
+            slot->retries = 1;                      // losses are counted afresh at the new size
+        }
+        engine->stats.retries++;
+    } else {
+        uint32_t offset, size;
+
+        slot = freeSlot(engine);
+        if (slot == NULL || !findGap(engine, &offset, &size)) {
+            return false;
+        }
+
+        slot->state = ZB_OTA_SLOT_REQUESTED;
+        slot->offset = offset;
+        slot->size = size < engine->blockSize ? size : engine->blockSize;
+        slot->retries = 0;
+    }
+
+    slot->sentMs = nowMs;
+    engine->requested = true;
+    engine->lastRequestMs = nowMs;
+    engine->stats.requests++;
+
+    uint8_t inFlight = ZB_OtaEngineInFlight(engine);
+    if (inFlight > engine->stats.peakInFlight) {
+        engine->stats.peakInFlight = inFlight;
+    }
+
+    request->offset = slot->offset;
+    request->size = slot->size;
+    return true;
+}
+
+uint32_t ZB_OtaEngineNextDelay(const zb_ota_engine_t *engine, uint32_t nowMs) {
+    if (engine->state != ZB_OTA_DOWNLOADING) {
+        return ZB_OTA_NEVER;
+    }
+    if (engine->holding) {
+        return isBefore(nowMs, engine->holdUntilMs) ? engine->holdUntilMs - nowMs : 0;
+    }
+
+    uint32_t offset, size;
+    uint32_t delay = ZB_OTA_NEVER;
+    bool hasFree = false;
+
+    for (uint8_t i = 0; i < engine->window; i++) {
+        const zb_ota_slot_t *slot = &engine->slots[i];
+
+        if (slot->state == ZB_OTA_SLOT_FREE) {
+            hasFree = true;
+        } else if (slot->state == ZB_OTA_SLOT_REQUESTED) {
+            uint32_t due = slot->sentMs + engine->timeoutMs;
+            uint32_t wait = isBefore(nowMs, due) ? due - nowMs : 0;
+            delay = wait < delay ? wait : delay;
+        }
+    }
+
+    if (hasFree && findGap(engine, &offset, &size)) {
+        delay = 0;
+    }
+
+    // Whatever is due still waits out the server's block period
+    if (delay != ZB_OTA_NEVER && engine->requested && engine->blockPeriodMs) {
+        uint32_t allowed = engine->lastRequestMs + engine->blockPeriodMs;
+        uint32_t wait = isBefore(nowMs, allowed) ? allowed - nowMs : 0;
+        delay = wait > delay ? wait : delay;
+    }
+
+    return delay;
+}
+
+esp_err_t ZB_OtaEngineOnBlock(zb_ota_engine_t *engine, uint32_t offset, const uint8_t *data, uint8_t size, uint32_t nowMs) {
+    if (engine->state != ZB_OTA_DOWNLOADING) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    zb_ota_slot_t *slot = NULL;
+    for (uint8_t i = 0; i < engine->window; i++) {
+        if (engine->slots[i].state == ZB_OTA_SLOT_REQUESTED && engine->slots[i].offset == offset) {
+            slot = &engine->slots[i];
+            break;
+        }
+    }
+
+    // A late answer to a request already answered, or asked for again at a different offset
+    if (slot == NULL || size == 0) {
+        engine->stats.duplicates++;
+        return ESP_OK;
+    }
+
+    if (size > slot->size) {
+        size = slot->size;
+    } else if (size < slot->size && offset + size < engine->image.fileSize && size < engine->blockSize) {
+        // The server sends no more than it can; ask for no more than that from now on
+        engine->blockSize = size;
+    }
+
+    memcpy(slot->data, data, size);
+    slot->size = size;
+    slot->state = ZB_OTA_SLOT_RECEIVED;
+    engine->stats.blocks++;
+    engine->stats.bytes += size;
+    if (offset != engine->consumed) {
+        engine->stats.reordered++;
+    }
+
+    // Parse every block that now follows on from the last
+    for (bool parsed = true; parsed;) {
+        parsed = false;
+        for (uint8_t i = 0; i < engine->window; i++) {
+            zb_ota_slot_t *ready = &engine->slots[i];
+            if (ready->state != ZB_OTA_SLOT_RECEIVED || ready->offset != engine->consumed) {
+                continue;
+            }
+
+            ready->state = ZB_OTA_SLOT_FREE;
+            esp_err_t err = parse(engine, ready->data, ready->size);
+            if (err != ESP_OK) {
+                fail(engine, err, nowMs);
+                return err;
+            }
+            parsed = true;
+        }
+    }
+
+    if (engine->consumed == engine->image.fileSize) {
+        finish(engine, nowMs);
+        return engine->error;
+    }
+    return ESP_OK;
+}
+
+void ZB_OtaEngineOnWait(zb_ota_engine_t *engine, uint32_t waitMs, uint16_t blockPeriodMs, uint32_t nowMs) {
+    if (engine->state != ZB_OTA_DOWNLOADING) {
+        return;
+    }
+
+    engine->holding = true;
+    engine->holdUntilMs = nowMs + waitMs;
+    engine->blockPeriodMs = blockPeriodMs;
+    engine->stats.waits++;
+
+    // The response does not say which request it answers, so ask for every outstanding range again afterwards
+    for (uint8_t i = 0; i < engine->window; i++) {
+        if (engine->slots[i].state == ZB_OTA_SLOT_REQUESTED) {
+            engine->slots[i].state = ZB_OTA_SLOT_FREE;
+        }
+    }
+}
+
+void ZB_OtaEngineAbort(zb_ota_engine_t *engine, esp_err_t error, uint32_t nowMs) {
+    if (engine->state == ZB_OTA_DOWNLOADING) {
+        fail(engine, error, nowMs);
+    }
+}
+
+bool ZB_OtaEngineTakeCheckpoint(zb_ota_engine_t *engine, zb_ota_checkpoint_t *checkpoint) {
+    if (!engine->checkpointReady) {
+        return false;
+    }
+
+    *checkpoint = engine->checkpoint;
+    engine->checkpointReady = false;
+    return true;
+}
+
+uint8_t ZB_OtaEngineInFlight(const zb_ota_engine_t *engine) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < engine->window; i++) {
+        count += engine->slots[i].state != ZB_OTA_SLOT_FREE;
+    }
+    return count;
+}
+
+const char *ZB_OtaStateToString(zb_ota_state_t state) {
+    switch (state) {
+        case ZB_OTA_IDLE: return "idle";
+        case ZB_OTA_DOWNLOADING: return "downloading";
+        case ZB_OTA_VERIFIED: return "verified";
+        case ZB_OTA_FAILED: return "failed";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,230 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Streaming OTA image download
+ * Pure logic over an injected flash interface and clock, with no radio of its own: the caller sends the block requests
+ * the engine asks for and hands it the block responses. Up to a window of requests are kept in flight; blocks may
+ * arrive in any order and are parsed strictly in file order, so only the window is ever buffered. The Zigbee OTA file
+ * header and sub-elements are parsed as they stream past, and the upgrade image element is written straight into the
+ * update partition, erasing each sector just ahead of the first write into it.
+ *
+ * The image must be an ESP-IDF app image with its SHA-256 appended: the hash is computed over the image as it is
+ * written and compared with the trailing 32 bytes once the last block arrives, so the download is verified without
+ * reading the partition back.
+ *
+ * Every ZB_OTA_CHECKPOINT_SIZE bytes of image the engine offers a checkpoint (offset and hash state) for the caller to
+ * persist; beginning the same image again from a checkpoint resumes at that offset instead of starting over.
+ *
+ * Block size starts at the configured maximum and only shrinks: to what the server actually sends when it sends less,
+ * and by half when the same request times out twice, as happens when the route to the device cannot carry the frame.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ZB_OTA_FILE_IDENTIFIER 0x0BEEF11E
+#define ZB_OTA_HEADER_MIN_SIZE 56               /* OTA file header without any optional fields */
+#define ZB_OTA_HEADER_MAX_SIZE 69               /* with security credential, upgrade destination & hardware versions */
+#define ZB_OTA_ELEMENT_HEADER_SIZE 6            /* tag id (U16) & length (U32) */
+#define ZB_OTA_TAG_UPGRADE_IMAGE 0x0000
+
+#define ZB_OTA_APP_IMAGE_MAGIC 0xE9             /* first byte of an ESP-IDF app image */
+#define ZB_OTA_APP_HASH_APPENDED_OFFSET 23      /* esp_image_header_t.hash_appended */
+#define ZB_OTA_HASH_SIZE 32
+
+#ifndef ZB_OTA_MAX_WINDOW
+#define ZB_OTA_MAX_WINDOW 4                     /* block requests in flight */
+#endif
+
+#ifndef ZB_OTA_MAX_BLOCK_SIZE
+#define ZB_OTA_MAX_BLOCK_SIZE 64                /* bytes, what fits an unfragmented Image Block Response */
+#endif
+
+#define ZB_OTA_MIN_BLOCK_SIZE 16
+
+#ifndef ZB_OTA_CHECKPOINT_SIZE
+#define ZB_OTA_CHECKPOINT_SIZE 8192             /* bytes of image between checkpoints, rounded up to whole sectors */
+#endif
+
+#define ZB_OTA_BLOCK_TIMEOUT_MS 3000            /* default wait for a block response before asking again */
+#define ZB_OTA_MAX_RETRIES 8                    /* times one block is asked for again before the download stalls */
+#define ZB_OTA_NEVER UINT32_MAX
+
+/* Flash access, in partition offsets. Writes may only clear bits, as on NOR flash; erases are whole sectors. */
+typedef struct {
+    esp_err_t (*write)(void *context, uint32_t offset, const void *data, size_t size);
+    esp_err_t (*erase)(void *context, uint32_t offset, size_t size);
+    void *context;
+    uint32_t sectorSize;
+    uint32_t size;
+} zb_ota_flash_t;
+
+/* As offered in a Query Next Image Response */
+typedef struct {
+    uint16_t manufacturer;
+    uint16_t imageType;
+    uint32_t fileVersion;
+    uint32_t fileSize;                          /* of the whole OTA file, header included */
+} zb_ota_image_t;
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[64];
+} zb_ota_sha256_t;
+
+/* Where a download can resume from: everything before imageOffset is on flash and hashed */
+typedef struct {
+    zb_ota_image_t image;
+    uint32_t fileOffset;                        /* of imageOffset within the OTA file */
+    uint32_t imageOffset;                       /* a multiple of the checkpoint size */
+    uint32_t imageSize;                         /* length of the upgrade image element */
+    uint32_t hash[8];                           /* SHA-256 state after imageOffset bytes */
+} zb_ota_checkpoint_t;
+
+typedef enum {
+    ZB_OTA_IDLE,
+    ZB_OTA_DOWNLOADING,
+    ZB_OTA_VERIFIED,                            /* the whole image is on flash and its hash matched */
+    ZB_OTA_FAILED,                              /* see error; ESP_ERR_TIMEOUT leaves the last checkpoint usable */
+} zb_ota_state_t;
+
+typedef enum {
+    ZB_OTA_SLOT_FREE,
+    ZB_OTA_SLOT_REQUESTED,
+    ZB_OTA_SLOT_RECEIVED,                       /* waiting for an earlier block before it can be parsed */
+} zb_ota_slot_state_t;
+
+typedef struct {
+    uint8_t state;                              /* zb_ota_slot_state_t */
+    uint8_t size;                               /* requested, then received */
+    uint8_t retries;
+    uint32_t offset;                            /* within the OTA file */
+    uint32_t sentMs;
+    uint8_t data[ZB_OTA_MAX_BLOCK_SIZE];
+} zb_ota_slot_t;
+
+typedef enum {
+    ZB_OTA_PARSE_HEADER,
+    ZB_OTA_PARSE_ELEMENT_HEADER,
+    ZB_OTA_PARSE_IMAGE,
+    ZB_OTA_PARSE_SKIP,                          /* an element other than the upgrade image */
+} zb_ota_parse_phase_t;
+
+typedef struct {
+    uint32_t requests;                          /* block requests asked for, retries included */
+    uint32_t retries;                           /* requests repeated after a timeout */
+    uint32_t blocks;                            /* block responses accepted */
+    uint32_t bytes;
+    uint32_t duplicates;                        /* responses for blocks no longer wanted */
+    uint32_t reordered;                         /* blocks that arrived ahead of an earlier one */
+    uint32_t waits;                             /* times the server asked the client to wait */
+    uint32_t checkpoints;
+    uint32_t resumedFrom;                       /* file offset the download started at, 0 from the beginning */
+    uint8_t peakInFlight;
+    uint32_t startMs;
+    uint32_t endMs;                             /* when the download was verified or failed */
+} zb_ota_stats_t;
+
+typedef struct {
+    zb_ota_flash_t flash;
+    uint8_t window;
+    uint8_t maxBlockSize;
+    uint32_t timeoutMs;
+    uint32_t checkpointSize;
+
+    zb_ota_state_t state;
+    esp_err_t error;
+    zb_ota_image_t image;
+
+    /* Transfer */
+    uint32_t consumed;                          /* file bytes parsed, all in order */
+    uint8_t blockSize;
+    uint16_t blockPeriodMs;                     /* least time between requests, as set by the server */
+    bool holding;
+    uint32_t holdUntilMs;
+    bool requested;
+    uint32_t lastRequestMs;
+    zb_ota_slot_t slots[ZB_OTA_MAX_WINDOW];
+
+    /* Parser */
+    zb_ota_parse_phase_t phase;
+    uint8_t headerLength;
+    uint8_t have;                               /* bytes of the header being collected */
+    uint8_t header[ZB_OTA_HEADER_MAX_SIZE];
+    uint32_t remaining;                         /* of the element being written or skipped */
+    bool imageSeen;
+    uint32_t imageOffset;
+    uint32_t imageSize;
+    uint32_t erasedTo;                          /* partition offset up to which sectors are erased */
+    zb_ota_sha256_t hash;
+    uint8_t appendedHash[ZB_OTA_HASH_SIZE];
+
+    bool checkpointReady;
+    zb_ota_checkpoint_t checkpoint;
+    zb_ota_stats_t stats;
+} zb_ota_engine_t;
+
+typedef struct {
+    uint32_t offset;
+    uint8_t size;
+} zb_ota_block_request_t;
+
+/* SHA-256, with its state exposed so a checkpoint can carry it */
+void ZB_OtaSha256Init(zb_ota_sha256_t *sha);
+void ZB_OtaSha256Update(zb_ota_sha256_t *sha, const void *data, size_t size);
+void ZB_OtaSha256Final(zb_ota_sha256_t *sha, uint8_t digest[ZB_OTA_HASH_SIZE]);
+
+/* window is clamped to 1..ZB_OTA_MAX_WINDOW and maxBlockSize to ZB_OTA_MIN_BLOCK_SIZE..ZB_OTA_MAX_BLOCK_SIZE */
+void ZB_OtaEngineInit(zb_ota_engine_t *engine, const zb_ota_flash_t *flash, uint8_t window, uint8_t maxBlockSize, uint32_t timeoutMs);
+
+/* Start downloading an image, from the checkpoint if one is given and it belongs to this image.
+ * ESP_ERR_INVALID_SIZE for a file too small to hold an image, ESP_ERR_INVALID_STATE while a download is in progress.
+ */
+esp_err_t ZB_OtaEngineBegin(zb_ota_engine_t *engine, const zb_ota_image_t *image, const zb_ota_checkpoint_t *checkpoint, uint32_t nowMs);
+
+/* Next block to ask for, if one is due: a request that timed out first, then the lowest range not yet asked for while
+ * the window has room. Gives up with ESP_ERR_TIMEOUT once one block has been asked for ZB_OTA_MAX_RETRIES times more at
+ * the same size.
+ */
+bool ZB_OtaEngineNextRequest(zb_ota_engine_t *engine, uint32_t nowMs, zb_ota_block_request_t *request);
+
+/* Delay until NextRequest has something to send, 0 if it does now, ZB_OTA_NEVER unless downloading */
+uint32_t ZB_OtaEngineNextDelay(const zb_ota_engine_t *engine, uint32_t nowMs);
+
+/* A successful Image Block Response. Blocks nobody is waiting for are ignored; a block that cannot be parsed or written
+ * fails the download: ESP_ERR_INVALID_RESPONSE for a malformed file, ESP_ERR_INVALID_VERSION for one that does not match
+ * the offer, ESP_ERR_NOT_SUPPORTED for an image without an appended hash, ESP_ERR_INVALID_SIZE for one larger than the
+ * partition, ESP_ERR_INVALID_CRC if the hash does not match, or the flash error.
+ */
+esp_err_t ZB_OtaEngineOnBlock(zb_ota_engine_t *engine, uint32_t offset, const uint8_t *data, uint8_t size, uint32_t nowMs);
+
+/* A WAIT_FOR_DATA response: hold off every request for waitMs, then keep blockPeriodMs between them. Requests in flight
+ * are asked for again afterwards, without counting as retries.
+ */
+void ZB_OtaEngineOnWait(zb_ota_engine_t *engine, uint32_t waitMs, uint16_t blockPeriodMs, uint32_t nowMs);
+
+/* Stop the download, e.g. when the server aborts it */
+void ZB_OtaEngineAbort(zb_ota_engine_t *engine, esp_err_t error, uint32_t nowMs);
+
+/* Copy out the checkpoint reached since the last call, if any */
+bool ZB_OtaEngineTakeCheckpoint(zb_ota_engine_t *engine, zb_ota_checkpoint_t *checkpoint);
+
+/* Requests in flight, and received blocks waiting on them */
+uint8_t ZB_OtaEngineInFlight(const zb_ota_engine_t *engine);
+
+const char *ZB_OtaStateToString(zb_ota_state_t state);
@@ -0,0 +1,106 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Log/deferred_log.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_poll.h"
+
+#ifdef ZIGBEE_MODE_ED
+
+// Only touched on the Zigbee stack task, or with the stack lock held
+static zb_poll_policy_t policy = {
+    .fastIntervalMs = ZB_POLL_FAST_INTERVAL_MS,
+    .slowIntervalMs = ZB_POLL_SLOW_INTERVAL_MS,
+    .holdMs = {ZB_POLL_JOIN_HOLD_MS, ZB_POLL_COMMAND_HOLD_MS, ZB_POLL_REPORT_HOLD_MS, ZB_POLL_BUTTON_HOLD_MS, ZB_POLL_APP_HOLD_MS},
+    .radioOnMs = ZB_POLL_RADIO_ON_MS,
+};
+static zb_poll_engine_t engine;
+static bool initialised = false;
+
+static void onPollAlarm(uint8_t param);
+
+// Hand a new interval to the stack, then wake for the next step, if there is one
+static void apply(bool changed) {
+    uint32_t now = millis();
+
+    if (changed) {
+        esp_zb_zdo_pim_set_long_poll_interval(engine.intervalMs);
+        dlog_d("Polling %s, every %lu ms", ZB_PollModeToString(engine.mode), (unsigned long)engine.intervalMs);
+    }
+
+    esp_zb_scheduler_alarm_cancel(onPollAlarm, 0);
+    uint32_t delay = ZB_PollEngineNextDelay(&engine, now);
+    if (delay != ZB_POLL_NEVER) {
+        esp_zb_scheduler_alarm(onPollAlarm, 0, delay ? delay : 1);
+    }
+}
+
+static void onPollAlarm(uint8_t param) {
+    apply(ZB_PollEngineOnTimer(&engine, millis()));
+}
+
+void ZB_PollResume() {
+    if (!initialised) {
+        ZB_PollEngineInit(&engine, &policy, millis());
+        esp_zb_zdo_pim_set_long_poll_interval(engine.intervalMs);
+        initialised = true;
+    }
+
+    apply(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_JOIN, millis()));
+}
+
+void ZB_PollOnActivity(zb_poll_activity_t activity) {
+    if (!initialised) {
+        return;
+    }
+
+    // A burst of frames lands here once per frame; while already fast, the alarm armed for the old hold finds the new one
+    zb_poll_mode_t mode = engine.mode;
+    bool changed = ZB_PollEngineOnActivity(&engine, activity, millis());
+    if (changed || mode != engine.mode) {
+        apply(changed);
+    }
+}
+
+void ZB_PollActivity(zb_poll_activity_t activity) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    ZB_PollOnActivity(activity);
+    esp_zb_lock_release();
+}
+
+void ZB_SetPollPolicy(const zb_poll_policy_t *pollPolicy) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+
+    policy = *pollPolicy;
+    if (initialised) {
+        apply(ZB_PollEngineSetPolicy(&engine, &policy, millis()));
+    }
+
+    esp_zb_lock_release();
+}
+
+void ZB_GetPollStats(zb_poll_stats_t *stats) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+
+    if (initialised) {
+        ZB_PollEngineGetStats(&engine, millis(), stats);
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+
+    esp_zb_lock_release();
+}
+
+#endif
@@ -0,0 +1,31 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Adaptive polling on the stack
+ * End devices only. From joining the network, zigbee_poll_engine picks the long poll interval the stack polls its
+ * parent at: fast after activity, then decaying back to the slow interval. Every frame that arrives through the APS
+ * data indication counts as a command, every report zigbee_reporting sends as a report, and every switch event that
+ * reaches SW_Loop() as a button press; the application can add its own with ZB_PollActivity(). Until the device first
+ * joins, the stack polls at ED_KEEP_ALIVE.
+ * All functions run on the Zigbee stack task.
+ */
+#pragma once
+
+#include "Zigbee/zigbee_poll_engine.h"
+
+/* On joining the network, or rejoining it: poll fast for the join hold */
+void ZB_PollResume();
+
+/* Activity seen on the stack task, ignored until the device has joined */
+void ZB_PollOnActivity(zb_poll_activity_t activity);
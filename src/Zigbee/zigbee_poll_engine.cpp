@@ -0,0 +1,188 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Zigbee/zigbee_poll_engine.h"
+
+// a is earlier than b, allowing for the millisecond clock wrapping
+static inline bool isBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+// Count the time since the stats were last brought up to date against the mode & interval it was spent in
+static void account(zb_poll_engine_t *engine, uint32_t nowMs) {
+    uint32_t elapsed = nowMs - engine->accountedMs;
+
+    engine->stats.modes[engine->mode].timeMs += elapsed;
+    engine->milliPolls[engine->mode] += (uint64_t)elapsed * 1000 / engine->intervalMs;
+    engine->accountedMs = nowMs;
+}
+
+static bool setInterval(zb_poll_engine_t *engine, zb_poll_mode_t mode, uint32_t intervalMs, uint32_t nowMs) {
+    account(engine, nowMs);
+    engine->mode = mode;
+
+    if (intervalMs == engine->intervalMs) {
+        return false;
+    }
+    engine->intervalMs = intervalMs;
+    engine->stats.intervalChanges++;
+    return true;
+}
+
+static void clampPolicy(zb_poll_policy_t *policy) {
+    if (policy->fastIntervalMs < ZB_POLL_MIN_INTERVAL_MS) {
+        policy->fastIntervalMs = ZB_POLL_MIN_INTERVAL_MS;
+    }
+    if (policy->slowIntervalMs < policy->fastIntervalMs) {
+        policy->slowIntervalMs = policy->fastIntervalMs;
+    }
+}
+
+void ZB_PollEngineInit(zb_poll_engine_t *engine, const zb_poll_policy_t *policy, uint32_t nowMs) {
+    memset(engine, 0, sizeof(*engine));
+    engine->policy = *policy;
+    clampPolicy(&engine->policy);
+
+    engine->mode = ZB_POLL_MODE_SLOW;
+    engine->intervalMs = engine->policy.slowIntervalMs;
+    engine->startMs = nowMs;
+    engine->accountedMs = nowMs;
+}
+
+bool ZB_PollEngineSetPolicy(zb_poll_engine_t *engine, const zb_poll_policy_t *policy, uint32_t nowMs) {
+    account(engine, nowMs);
+    engine->policy = *policy;
+    clampPolicy(&engine->policy);
+
+    // A decay in progress carries on from within the new bounds
+    uint32_t interval = engine->intervalMs;
+    switch (engine->mode) {
+        case ZB_POLL_MODE_FAST:
+            interval = engine->policy.fastIntervalMs;
+            break;
+        case ZB_POLL_MODE_DECAY:
+            interval = interval < engine->policy.fastIntervalMs ? engine->policy.fastIntervalMs : interval;
+            if (interval >= engine->policy.slowIntervalMs) {
+                return setInterval(engine, ZB_POLL_MODE_SLOW, engine->policy.slowIntervalMs, nowMs);
+            }
+            break;
+        default:
+            interval = engine->policy.slowIntervalMs;
+            break;
+    }
+
+    return setInterval(engine, engine->mode, interval, nowMs);
+}
+
+bool ZB_PollEngineOnActivity(zb_poll_engine_t *engine, zb_poll_activity_t activity, uint32_t nowMs) {
+    uint32_t holdMs = engine->policy.holdMs[activity];
+
+    engine->stats.activities[activity]++;
+    if (holdMs == 0) {
+        return false;
+    }
+
+    // Holds overlap rather than add up: the longest one still running decides when fast polling ends
+    if (engine->mode != ZB_POLL_MODE_FAST) {
+        engine->stats.fastEntries++;
+        engine->fastUntilMs = nowMs + holdMs;
+    } else if (isBefore(engine->fastUntilMs, nowMs + holdMs)) {
+        engine->fastUntilMs = nowMs + holdMs;
+    }
+
+    return setInterval(engine, ZB_POLL_MODE_FAST, engine->policy.fastIntervalMs, nowMs);
+}
+
+bool ZB_PollEngineOnTimer(zb_poll_engine_t *engine, uint32_t nowMs) {
+    uint32_t interval = engine->intervalMs;
+    zb_poll_mode_t mode = engine->mode;
+
+    if (mode == ZB_POLL_MODE_FAST && !isBefore(nowMs, engine->fastUntilMs)) {
+        mode = ZB_POLL_MODE_DECAY;
+        engine->nextStepMs = engine->fastUntilMs;
+    }
+
+    // Double once per poll at the current interval, catching up on steps a late timer missed
+    while (mode == ZB_POLL_MODE_DECAY && !isBefore(nowMs, engine->nextStepMs)) {
+        interval = interval * 2 < engine->policy.slowIntervalMs ? interval * 2 : engine->policy.slowIntervalMs;
+        engine->nextStepMs += interval;
+        if (interval == engine->policy.slowIntervalMs) {
+            mode = ZB_POLL_MODE_SLOW;
+        }
+    }
+
+    if (mode == engine->mode && interval == engine->intervalMs) {
+        return false;
+    }
+    return setInterval(engine, mode, interval, nowMs);
+}
+
+uint32_t ZB_PollEngineNextDelay(const zb_poll_engine_t *engine, uint32_t nowMs) {
+    uint32_t due;
+
+    switch (engine->mode) {
+        case ZB_POLL_MODE_FAST:
+            due = engine->fastUntilMs;
+            break;
+        case ZB_POLL_MODE_DECAY:
+            due = engine->nextStepMs;
+            break;
+        default:
+            return ZB_POLL_NEVER;
+    }
+
+    return isBefore(nowMs, due) ? due - nowMs : 0;
+}
+
+void ZB_PollEngineGetStats(const zb_poll_engine_t *engine, uint32_t nowMs, zb_poll_stats_t *stats) {
+    uint32_t pending = nowMs - engine->accountedMs;
+    uint64_t radioOnMs = 0;
+
+    *stats = engine->stats;
+    stats->modes[engine->mode].timeMs += pending;
+    stats->elapsedMs = nowMs - engine->startMs;
+
+    for (int mode = 0; mode < ZB_POLL_MODE_COUNT; mode++) {
+        uint64_t milliPolls = engine->milliPolls[mode];
+        if (mode == engine->mode) {
+            milliPolls += (uint64_t)pending * 1000 / engine->intervalMs;
+        }
+        stats->modes[mode].polls = (uint32_t)(milliPolls / 1000);
+        radioOnMs += milliPolls * engine->policy.radioOnMs / 1000;
+    }
+
+    stats->radioOnMs = (uint32_t)radioOnMs;
+    stats->dutyPpm = stats->elapsedMs ? (uint32_t)(radioOnMs * 1000000 / stats->elapsedMs) : 0;
+}
+
+const char *ZB_PollModeToString(zb_poll_mode_t mode) {
+    switch (mode) {
+        case ZB_POLL_MODE_FAST: return "fast";
+        case ZB_POLL_MODE_DECAY: return "decay";
+        case ZB_POLL_MODE_SLOW: return "slow";
+        default: return "unknown";
+    }
+}
+
+const char *ZB_PollActivityToString(zb_poll_activity_t activity) {
+    switch (activity) {
+        case ZB_POLL_ACTIVITY_JOIN: return "join";
+        case ZB_POLL_ACTIVITY_COMMAND: return "command";
+        case ZB_POLL_ACTIVITY_REPORT: return "report";
+        case ZB_POLL_ACTIVITY_BUTTON: return "button";
+        case ZB_POLL_ACTIVITY_APP: return "app";
+        default: return "unknown";
+    }
+}
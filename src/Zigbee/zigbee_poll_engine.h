@@ -0,0 +1,109 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Adaptive poll rate
+ * Pure logic with no stack calls or clock of its own, deciding how often a sleepy end device polls its parent for
+ * frames held for it. Activity, such as a command arriving, a report going out or a button being pressed, switches
+ * to fast polling for a hold time that depends on the kind of activity, since each makes more traffic likely soon.
+ * Once every hold has run out, the interval doubles with each poll until it is back at the slow long-poll interval,
+ * so a reply that comes a little late still finds the device listening often.
+ * The time spent in each mode is accounted, with the polls made in it and an estimate of the radio's duty cycle.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Defaults, see zb_poll_policy_t */
+#define ZB_POLL_FAST_INTERVAL_MS 250
+#define ZB_POLL_SLOW_INTERVAL_MS 15000
+#define ZB_POLL_JOIN_HOLD_MS 30000              /* while the coordinator interviews & configures a new device */
+#define ZB_POLL_COMMAND_HOLD_MS 3000
+#define ZB_POLL_REPORT_HOLD_MS 1000             /* for the default response or a read that follows */
+#define ZB_POLL_BUTTON_HOLD_MS 5000             /* for the light's state coming back, or another press */
+#define ZB_POLL_APP_HOLD_MS 5000
+#define ZB_POLL_RADIO_ON_MS 10                  /* data request, its MAC ack & the wait for a frame */
+
+#define ZB_POLL_MIN_INTERVAL_MS 50
+#define ZB_POLL_NEVER UINT32_MAX
+
+typedef enum {
+    ZB_POLL_ACTIVITY_JOIN,                      /* joined or rejoined the network */
+    ZB_POLL_ACTIVITY_COMMAND,                   /* a frame arrived */
+    ZB_POLL_ACTIVITY_REPORT,                    /* an attribute report went out */
+    ZB_POLL_ACTIVITY_BUTTON,                    /* a switch event reached SW_Loop() */
+    ZB_POLL_ACTIVITY_APP,                       /* the application expects traffic */
+    ZB_POLL_ACTIVITY_COUNT,
+} zb_poll_activity_t;
+
+typedef enum {
+    ZB_POLL_MODE_FAST,                          /* within the hold of some activity */
+    ZB_POLL_MODE_DECAY,                         /* interval doubling back towards slow */
+    ZB_POLL_MODE_SLOW,                          /* idle, long polling */
+    ZB_POLL_MODE_COUNT,
+} zb_poll_mode_t;
+
+typedef struct {
+    uint32_t fastIntervalMs;
+    uint32_t slowIntervalMs;
+    uint32_t holdMs[ZB_POLL_ACTIVITY_COUNT];    /* fast polling after each kind of activity, 0 to ignore it */
+    uint32_t radioOnMs;                         /* per poll, for the duty cycle estimate */
+} zb_poll_policy_t;
+
+typedef struct {
+    uint32_t timeMs;
+    uint32_t polls;                             /* estimated from the time spent at each interval */
+} zb_poll_mode_stats_t;
+
+typedef struct {
+    zb_poll_mode_stats_t modes[ZB_POLL_MODE_COUNT];
+    uint32_t activities[ZB_POLL_ACTIVITY_COUNT];
+    uint32_t fastEntries;                       /* times fast polling started from decay or slow */
+    uint32_t intervalChanges;
+    uint32_t elapsedMs;
+    uint32_t radioOnMs;                         /* estimated, across every mode */
+    uint32_t dutyPpm;                           /* radio on, in parts per million of the elapsed time */
+} zb_poll_stats_t;
+
+typedef struct {
+    zb_poll_policy_t policy;
+    zb_poll_mode_t mode;
+    uint32_t intervalMs;
+    uint32_t fastUntilMs;                       /* end of the longest hold running */
+    uint32_t nextStepMs;                        /* when the decaying interval next doubles */
+    uint32_t startMs;
+    uint32_t accountedMs;                       /* time up to which the stats are counted */
+    uint64_t milliPolls[ZB_POLL_MODE_COUNT];
+    zb_poll_stats_t stats;
+} zb_poll_engine_t;
+
+/* Starts slow. The policy is copied, and clamped so fast is at least ZB_POLL_MIN_INTERVAL_MS and slow no faster. */
+void ZB_PollEngineInit(zb_poll_engine_t *engine, const zb_poll_policy_t *policy, uint32_t nowMs);
+
+/* Replace the policy, keeping the mode; true if the interval changed */
+bool ZB_PollEngineSetPolicy(zb_poll_engine_t *engine, const zb_poll_policy_t *policy, uint32_t nowMs);
+
+/* Activity of some kind; true if the interval changed */
+bool ZB_PollEngineOnActivity(zb_poll_engine_t *engine, zb_poll_activity_t activity, uint32_t nowMs);
+
+/* Step the mode & interval on once ZB_PollEngineNextDelay() has passed; true if the interval changed */
+bool ZB_PollEngineOnTimer(zb_poll_engine_t *engine, uint32_t nowMs);
+
+/* Time until the next step, 0 if one is due now, or ZB_POLL_NEVER while slow */
+uint32_t ZB_PollEngineNextDelay(const zb_poll_engine_t *engine, uint32_t nowMs);
+
+/* Stats counted up to now */
+void ZB_PollEngineGetStats(const zb_poll_engine_t *engine, uint32_t nowMs, zb_poll_stats_t *stats);
+
+const char *ZB_PollModeToString(zb_poll_mode_t mode);
+const char *ZB_PollActivityToString(zb_poll_activity_t activity);
@@ -0,0 +1,172 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Log/deferred_log.h"
+#include "nwk/esp_zigbee_nwk.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_recovery.h"
+
+// A neighbor's age counts link status periods without hearing from it
+#define NEIGHBOR_AGE_PERIOD_MS 15000
+
+static zb_recovery_config_t config = {
+    .targetedAttempts = ZB_RECOVERY_TARGETED_ATTEMPTS,
+    .targetedDelayMs = ZB_RECOVERY_TARGETED_DELAY_MS,
+    .wideDelayMs = ZB_RECOVERY_WIDE_DELAY_MS,
+    .maxDelayMs = ZB_RECOVERY_MAX_DELAY_MS,
+    .candidateTtlMs = ZB_RECOVERY_CANDIDATE_TTL_MS,
+    .minLqi = ZB_RECOVERY_MIN_LQI,
+};
+static zb_recovery_t recovery;
+static bool initialised = false;
+
+// The neighbor table holds no channel, so each neighbor is put on the channel the device was on when it was last heard
+// from. A channel change is only seen here at a refresh, so it is taken to have happened just after the one before.
+static uint8_t currentChannel = 0;
+static uint8_t previousChannel = 0;
+static uint32_t channelSinceMs = 0;
+static uint32_t lastRefreshMs = 0;
+
+static void onRecoveryTimer(uint8_t param);
+
+static uint8_t channelHeardOn(uint32_t heardMs) {
+    return (int32_t)(heardMs - channelSinceMs) >= 0 ? currentChannel : previousChannel;
+}
+
+static void refreshCandidates() {
+    esp_zb_nwk_info_iterator_t iterator = ESP_ZB_NWK_INFO_ITERATOR_INIT;
+    esp_zb_nwk_neighbor_info_t neighbor;
+    uint8_t channel = esp_zb_get_current_channel();
+    uint32_t now = millis();
+
+    if (channel != currentChannel) {
+        previousChannel = currentChannel != 0 ? currentChannel : channel;
+        currentChannel = channel;
+        channelSinceMs = lastRefreshMs;
+    }
+    lastRefreshMs = now;
+
+    while (esp_zb_nwk_get_next_neighbor(&iterator, &neighbor) == ESP_OK) {
+        if (neighbor.device_type == ESP_ZB_DEVICE_TYPE_ED) {
+            continue;
+        }
+
+        uint32_t heardMs = now - neighbor.age * NEIGHBOR_AGE_PERIOD_MS;
+        ZB_RecoveryOnCandidate(&recovery, neighbor.ieee_addr, neighbor.short_addr, channelHeardOn(heardMs), neighbor.lqi,
+                               neighbor.relationship == ESP_ZB_NWK_RELATIONSHIP_PARENT, heardMs);
+    }
+}
+
+static void onRefreshAlarm(uint8_t param) {
+    refreshCandidates();
+    esp_zb_scheduler_alarm(onRefreshAlarm, 0, ZB_RECOVERY_REFRESH_MS);
+}
+
+static void runAction(zb_recovery_action_t action, uint32_t channelMask, uint32_t delayMs) {
+    const zb_recovery_candidate_t *target;
+
+    switch (action) {
+        case ZB_RECOVERY_ACTION_REJOIN:
+            target = ZB_RecoveryTarget(&recovery);
+            if (target != NULL) {
+                dlog_i("Rejoining towards 0x%04hx on channel %d (LQI %d, attempt %lu)", target->shortAddress, target->channel, target->lqi,
+                       (unsigned long)recovery.attempts);
+            } else {
+                dlog_i("Rejoining on %s channels (mask: 0x%08lx, attempt %lu)", ZB_JoinPhaseToString(recovery.plan.stats.phase),
+                       (unsigned long)channelMask, (unsigned long)recovery.attempts);
+            }
+
+            // As in network steering, keep BDB from falling back to a secondary channel set of its own
+            esp_zb_set_primary_network_channel_set(channelMask);
+            esp_zb_set_secondary_network_channel_set(0);
+            esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_INITIALIZATION);
+            break;
+
+        case ZB_RECOVERY_ACTION_WAIT:
+            esp_zb_scheduler_alarm(onRecoveryTimer, 0, delayMs);
+            break;
+
+        case ZB_RECOVERY_ACTION_NONE:
+            break;
+    }
+}
+
+static void onRecoveryTimer(uint8_t param) {
+    uint32_t channelMask = 0;
+    zb_recovery_action_t action = ZB_RecoveryOnTimer(&recovery, &channelMask);
+
+    runAction(action, channelMask, 0);
+}
+
+void ZB_RecoveryResume() {
+    if (!initialised) {
+        ZB_RecoveryInit(&recovery, &config, ESP_ZB_PRIMARY_CHANNEL_MASK);
+        initialised = true;
+    }
+
+    refreshCandidates();
+    esp_zb_scheduler_alarm_cancel(onRefreshAlarm, 0);
+    esp_zb_scheduler_alarm(onRefreshAlarm, 0, ZB_RECOVERY_REFRESH_MS);
+}
+
+void ZB_RecoveryParentLost() {
+    uint32_t channelMask = 0;
+
+    if (!initialised || ZB_RecoveryActive()) {
+        return;
+    }
+
+    dlog_w("Parent lost, %d rejoin candidates cached", recovery.candidateCount);
+
+    // The neighbor table is going stale from here on, so stop taking candidates from it until the network is back
+    esp_zb_scheduler_alarm_cancel(onRefreshAlarm, 0);
+    zb_recovery_action_t action = ZB_RecoveryOnParentLost(&recovery, millis(), &channelMask);
+    runAction(action, channelMask, 0);
+}
+
+bool ZB_RecoveryActive() {
+    return initialised && recovery.stage != ZB_RECOVERY_STAGE_IDLE;
+}
+
+void ZB_RecoveryOnRejoined(bool success) {
+    uint32_t channelMask = 0;
+    uint32_t delayMs = 0;
+    zb_recovery_stage_t stage = recovery.stage;
+    uint32_t attempts = recovery.attempts;
+    zb_recovery_action_t action = ZB_RecoveryOnRejoin(&recovery, success, millis(), &channelMask, &delayMs);
+
+    if (success) {
+        dlog_i("Rejoined after %lu ms (%s, %lu attempts)", (unsigned long)recovery.stats.lastOutageMs, ZB_RecoveryStageToString(stage),
+               (unsigned long)attempts);
+
+        // Leave no narrowed mask behind for rejoins the stack starts on its own; the candidates are refreshed when the
+        // caller resumes the application
+        esp_zb_set_primary_network_channel_set(ESP_ZB_PRIMARY_CHANNEL_MASK);
+    } else {
+        dlog_i("Rejoin failed, retrying in %lu ms on %s channels", (unsigned long)delayMs, ZB_RecoveryStageToString(recovery.stage));
+    }
+
+    runAction(action, channelMask, delayMs);
+}
+
+void ZB_SetRecoveryConfig(const zb_recovery_config_t *recoveryConfig) {
+    config = *recoveryConfig;
+}
+
+void ZB_GetRecoveryStats(zb_recovery_stats_t *stats) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    *stats = recovery.stats;
+    esp_zb_lock_release();
+}
@@ -0,0 +1,39 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Parent-loss recovery on the stack
+ * While on the network, the routers & coordinator in the neighbor table are fed to zigbee_recovery_engine as rejoin
+ * candidates, on joining and every ZB_RECOVERY_REFRESH_MS after. A parent link failure, or a leave-and-rejoin request,
+ * starts an outage: the stored network is rejoined by BDB initialisation on the channels the engine picks, until it
+ * is back. The stack has no way to be told which parent to rejoin through, so a targeted rejoin narrows the channel
+ * mask to the best candidate's channel and leaves picking the parent on it, by link quality, to the stack.
+ * All functions run on the Zigbee stack task.
+ */
+#pragma once
+
+#include "Zigbee/zigbee_recovery_engine.h"
+
+#define ZB_RECOVERY_REFRESH_MS 60000
+
+/* Refresh the candidates and keep them fresh; on joining the network, or rejoining it */
+void ZB_RecoveryResume();
+
+/* Start an outage, if one is not already in progress */
+void ZB_RecoveryParentLost();
+
+/* True while rejoining after the parent was lost, when rejoin outcomes belong to ZB_RecoveryOnRejoined() */
+bool ZB_RecoveryActive();
+
+/* Outcome of a rejoin started during an outage; the caller resumes the application when it succeeded */
+void ZB_RecoveryOnRejoined(bool success);
@@ -0,0 +1,240 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Zigbee/zigbee_recovery_engine.h"
+
+// base * 2^(failures - 1), capped at the maximum
+static uint32_t backoffDelay(const zb_recovery_config_t *config, uint32_t baseMs, uint32_t failures) {
+    uint32_t delay = baseMs;
+
+    for (uint32_t i = 1; i < failures && delay < config->maxDelayMs; i++) {
+        delay *= 2;
+    }
+
+    return delay > config->maxDelayMs ? config->maxDelayMs : delay;
+}
+
+// Fewer failed rejoins through it first, then the stronger link, then the one heard from most recently
+static bool isBetter(const zb_recovery_candidate_t *a, const zb_recovery_candidate_t *b, uint32_t nowMs) {
+    if (a->failures != b->failures) {
+        return a->failures < b->failures;
+    }
+    if (a->lqi != b->lqi) {
+        return a->lqi > b->lqi;
+    }
+    return nowMs - a->lastSeenMs < nowMs - b->lastSeenMs;
+}
+
+static int8_t bestCandidate(const zb_recovery_t *recovery, uint32_t nowMs) {
+    const zb_recovery_config_t *config = recovery->config;
+    int8_t best = -1;
+
+    for (uint8_t i = 0; i < recovery->candidateCount; i++) {
+        const zb_recovery_candidate_t *candidate = &recovery->candidates[i];
+
+        if (nowMs - candidate->lastSeenMs > config->candidateTtlMs || candidate->lqi < config->minLqi) {
+            continue;
+        }
+        if (best < 0 || isBetter(candidate, &recovery->candidates[best], nowMs)) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static zb_recovery_action_t startTargeted(zb_recovery_t *recovery, int8_t target, uint32_t *channelMask) {
+    recovery->stage = ZB_RECOVERY_STAGE_TARGETED;
+    recovery->target = target;
+    recovery->attempts++;
+    recovery->stats.attempts++;
+    *channelMask = 1UL << recovery->candidates[target].channel;
+
+    return ZB_RECOVERY_ACTION_REJOIN;
+}
+
+// The widened search starts from the preferred channels; the full mask takes in the channel just targeted again
+static uint32_t startWide(zb_recovery_t *recovery, uint32_t nowMs) {
+    recovery->stage = ZB_RECOVERY_STAGE_WIDE;
+    recovery->target = -1;
+    recovery->attempts = 0;
+
+    ZB_JoinPlanInit(&recovery->plan, 0, ZB_JOIN_PREFERRED_CHANNEL_MASK, recovery->fullMask);
+    return ZB_JoinPlanStart(&recovery->plan, nowMs);
+}
+
+static void endOutage(zb_recovery_t *recovery, uint32_t nowMs) {
+    zb_recovery_stats_t *stats = &recovery->stats;
+    uint32_t outageMs = nowMs - recovery->outageStartedAt;
+
+    if (recovery->stage == ZB_RECOVERY_STAGE_TARGETED) {
+        stats->targetedRejoins++;
+    } else {
+        stats->wideRejoins++;
+        ZB_JoinPlanOnJoined(&recovery->plan, nowMs);
+    }
+
+    if (stats->targetedRejoins + stats->wideRejoins == 1 || outageMs < stats->minOutageMs) {
+        stats->minOutageMs = outageMs;
+    }
+    if (outageMs > stats->maxOutageMs) {
+        stats->maxOutageMs = outageMs;
+    }
+    stats->lastOutageMs = outageMs;
+    stats->totalOutageMs += outageMs;
+
+    recovery->stage = ZB_RECOVERY_STAGE_IDLE;
+    recovery->target = -1;
+    recovery->attempts = 0;
+}
+
+void ZB_RecoveryInit(zb_recovery_t *recovery, const zb_recovery_config_t *config, uint32_t fullMask) {
+    memset(recovery, 0, sizeof(*recovery));
+    recovery->config = config;
+    recovery->stage = ZB_RECOVERY_STAGE_IDLE;
+    recovery->target = -1;
+    recovery->fullMask = fullMask;
+}
+
+void ZB_RecoveryOnCandidate(zb_recovery_t *recovery, const uint8_t ieeeAddress[8], uint16_t shortAddress, uint8_t channel, uint8_t lqi,
+                            bool parent, uint32_t seenMs) {
+    zb_recovery_candidate_t *candidate = NULL;
+
+    for (uint8_t i = 0; i < recovery->candidateCount && candidate == NULL; i++) {
+        if (memcmp(recovery->candidates[i].ieeeAddress, ieeeAddress, sizeof(candidate->ieeeAddress)) == 0) {
+            candidate = &recovery->candidates[i];
+        }
+    }
+
+    if (candidate == NULL) {
+        if (recovery->candidateCount < ZB_RECOVERY_MAX_CANDIDATES) {
+            candidate = &recovery->candidates[recovery->candidateCount++];
+        } else {
+            candidate = &recovery->candidates[0];
+            for (uint8_t i = 1; i < recovery->candidateCount; i++) {
+                if (seenMs - recovery->candidates[i].lastSeenMs > seenMs - candidate->lastSeenMs) {
+                    candidate = &recovery->candidates[i];
+                }
+            }
+        }
+        memcpy(candidate->ieeeAddress, ieeeAddress, sizeof(candidate->ieeeAddress));
+    }
+
+    if (parent) {
+        for (uint8_t i = 0; i < recovery->candidateCount; i++) {
+            recovery->candidates[i].parent = false;
+        }
+    }
+
+    candidate->shortAddress = shortAddress;
+    candidate->channel = channel;
+    candidate->lqi = lqi;
+    candidate->parent = parent;
+    candidate->failures = 0;
+    candidate->lastSeenMs = seenMs;
+}
+
+zb_recovery_action_t ZB_RecoveryOnParentLost(zb_recovery_t *recovery, uint32_t nowMs, uint32_t *channelMask) {
+    if (recovery->stage != ZB_RECOVERY_STAGE_IDLE) {
+        return ZB_RECOVERY_ACTION_NONE;
+    }
+
+    recovery->stats.outages++;
+    recovery->outageStartedAt = nowMs;
+    recovery->attempts = 0;
+
+    // The parent is the likeliest to have gone, so it goes to the back of the queue
+    for (uint8_t i = 0; i < recovery->candidateCount; i++) {
+        if (recovery->candidates[i].parent) {
+            recovery->candidates[i].failures++;
+        }
+    }
+
+    int8_t target = recovery->config->targetedAttempts > 0 ? bestCandidate(recovery, nowMs) : -1;
+    if (target >= 0) {
+        return startTargeted(recovery, target, channelMask);
+    }
+
+    *channelMask = startWide(recovery, nowMs);
+    recovery->attempts++;
+    recovery->stats.attempts++;
+    return ZB_RECOVERY_ACTION_REJOIN;
+}
+
+zb_recovery_action_t ZB_RecoveryOnRejoin(zb_recovery_t *recovery, bool success, uint32_t nowMs, uint32_t *channelMask, uint32_t *delayMs) {
+    const zb_recovery_config_t *config = recovery->config;
+
+    if (recovery->stage == ZB_RECOVERY_STAGE_IDLE) {
+        return ZB_RECOVERY_ACTION_NONE;
+    }
+
+    if (success) {
+        endOutage(recovery, nowMs);
+        return ZB_RECOVERY_ACTION_NONE;
+    }
+
+    if (recovery->stage == ZB_RECOVERY_STAGE_TARGETED) {
+        uint32_t failures = recovery->attempts;
+        int8_t target = -1;
+
+        if (recovery->target >= 0) {
+            recovery->candidates[recovery->target].failures++;
+        }
+        if (recovery->attempts < config->targetedAttempts) {
+            target = bestCandidate(recovery, nowMs);
+        }
+
+        if (target >= 0) {
+            recovery->target = target;
+            recovery->nextMask = 1UL << recovery->candidates[target].channel;
+        } else {
+            recovery->nextMask = startWide(recovery, nowMs);
+        }
+        *delayMs = backoffDelay(config, config->targetedDelayMs, failures);
+    } else {
+        recovery->nextMask = ZB_JoinPlanOnFailed(&recovery->plan, nowMs);
+        *delayMs = backoffDelay(config, config->wideDelayMs, recovery->attempts);
+    }
+
+    *channelMask = recovery->nextMask;
+    return ZB_RECOVERY_ACTION_WAIT;
+}
+
+zb_recovery_action_t ZB_RecoveryOnTimer(zb_recovery_t *recovery, uint32_t *channelMask) {
+    if (recovery->stage == ZB_RECOVERY_STAGE_IDLE) {
+        return ZB_RECOVERY_ACTION_NONE;
+    }
+
+    recovery->attempts++;
+    recovery->stats.attempts++;
+    *channelMask = recovery->nextMask;
+    return ZB_RECOVERY_ACTION_REJOIN;
+}
+
+const zb_recovery_candidate_t *ZB_RecoveryTarget(const zb_recovery_t *recovery) {
+    if (recovery->stage != ZB_RECOVERY_STAGE_TARGETED || recovery->target < 0) {
+        return NULL;
+    }
+    return &recovery->candidates[recovery->target];
+}
+
+const char *ZB_RecoveryStageToString(zb_recovery_stage_t stage) {
+    switch (stage) {
+        case ZB_RECOVERY_STAGE_IDLE: return "idle";
+        case ZB_RECOVERY_STAGE_TARGETED: return "targeted";
+        case ZB_RECOVERY_STAGE_WIDE: return "wide";
+        default: return "unknown";
+    }
+}
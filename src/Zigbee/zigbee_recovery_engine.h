@@ -0,0 +1,115 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Parent-loss recovery
+ * Pure logic with no stack calls or clock of its own. The caller feeds in the routers & coordinator it hears from,
+ * with their link quality, while the device is on the network. When the parent is lost the engine plans the rejoin:
+ * first targeted rejoins on the channel of the best cached candidate, the lost parent last as it is likely the one
+ * that went away, retried after short delays; then, once those are spent or no candidate is fresh enough, the
+ * zigbee_join_plan widening from the preferred channels out to the full mask, backing off up to a cap. The length of
+ * every outage, from the loss to the rejoin that ended it, is kept.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "Zigbee/zigbee_join_plan.h"
+
+#define ZB_RECOVERY_MAX_CANDIDATES 8
+
+/* Defaults, see zb_recovery_config_t */
+#define ZB_RECOVERY_TARGETED_ATTEMPTS 4
+#define ZB_RECOVERY_TARGETED_DELAY_MS 250
+#define ZB_RECOVERY_WIDE_DELAY_MS 2000
+#define ZB_RECOVERY_MAX_DELAY_MS 60000
+#define ZB_RECOVERY_CANDIDATE_TTL_MS (30 * 60 * 1000UL)
+#define ZB_RECOVERY_MIN_LQI 40
+
+typedef struct {
+    uint8_t targetedAttempts;           /* targeted rejoins before widening, 0 widens at once */
+    uint32_t targetedDelayMs;           /* before the second targeted rejoin, doubling with each after */
+    uint32_t wideDelayMs;               /* before the second widened rejoin, doubling with each after; the first follows
+                                           on from the targeted backoff */
+    uint32_t maxDelayMs;
+    uint32_t candidateTtlMs;            /* candidates not heard from for longer are not targeted */
+    uint8_t minLqi;                     /* nor are those with a weaker link */
+} zb_recovery_config_t;
+
+typedef struct {
+    uint8_t ieeeAddress[8];
+    uint16_t shortAddress;
+    uint8_t channel;
+    uint8_t lqi;
+    bool parent;
+    uint32_t failures;                  /* targeted rejoins through it that failed since it was last heard from */
+    uint32_t lastSeenMs;
+} zb_recovery_candidate_t;
+
+typedef enum {
+    ZB_RECOVERY_STAGE_IDLE,             /* on the network */
+    ZB_RECOVERY_STAGE_TARGETED,         /* rejoining on a cached candidate's channel */
+    ZB_RECOVERY_STAGE_WIDE,             /* rejoining across the join plan's widening channel masks */
+} zb_recovery_stage_t;
+
+typedef enum {
+    ZB_RECOVERY_ACTION_NONE,
+    ZB_RECOVERY_ACTION_REJOIN,          /* rejoin on the returned channel mask */
+    ZB_RECOVERY_ACTION_WAIT,            /* arm a timer for the returned delay, then call ZB_RecoveryOnTimer() */
+} zb_recovery_action_t;
+
+typedef struct {
+    uint32_t outages;
+    uint32_t targetedRejoins;           /* outages ended by a targeted rejoin */
+    uint32_t wideRejoins;               /* ended once widened */
+    uint32_t attempts;                  /* rejoins started, across all outages */
+    uint32_t lastOutageMs;
+    uint32_t minOutageMs;
+    uint32_t maxOutageMs;
+    uint64_t totalOutageMs;             /* of the outages that have ended */
+} zb_recovery_stats_t;
+
+typedef struct {
+    const zb_recovery_config_t *config;
+    zb_recovery_candidate_t candidates[ZB_RECOVERY_MAX_CANDIDATES];
+    uint8_t candidateCount;
+    zb_recovery_stage_t stage;
+    uint32_t attempts;                  /* rejoins in the current stage, unbounded in the wide stage */
+    int8_t target;                      /* candidate of the targeted rejoin in progress, -1 for none */
+    uint32_t nextMask;                  /* for the rejoin after the current wait */
+    uint32_t outageStartedAt;
+    uint32_t fullMask;
+    zb_join_plan_t plan;
+    zb_recovery_stats_t stats;
+} zb_recovery_t;
+
+void ZB_RecoveryInit(zb_recovery_t *recovery, const zb_recovery_config_t *config, uint32_t fullMask);
+
+/* A router or coordinator heard from on channel. Once the table is full the stalest candidate makes way, and reporting
+ * one as the parent clears the flag on the others.
+ */
+void ZB_RecoveryOnCandidate(zb_recovery_t *recovery, const uint8_t ieeeAddress[8], uint16_t shortAddress, uint8_t channel, uint8_t lqi,
+                            bool parent, uint32_t seenMs);
+
+/* The parent was lost: start an outage and plan its first rejoin. NONE if an outage is already in progress. */
+zb_recovery_action_t ZB_RecoveryOnParentLost(zb_recovery_t *recovery, uint32_t nowMs, uint32_t *channelMask);
+
+/* Outcome of a rejoin; a success ends the outage */
+zb_recovery_action_t ZB_RecoveryOnRejoin(zb_recovery_t *recovery, bool success, uint32_t nowMs, uint32_t *channelMask, uint32_t *delayMs);
+
+zb_recovery_action_t ZB_RecoveryOnTimer(zb_recovery_t *recovery, uint32_t *channelMask);
+
+/* The candidate the targeted rejoin in progress is aimed at, or NULL */
+const zb_recovery_candidate_t *ZB_RecoveryTarget(const zb_recovery_t *recovery);
+
+const char *ZB_RecoveryStageToString(zb_recovery_stage_t stage);
@@ -0,0 +1,175 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "aps/esp_zigbee_aps.h"
+#include "Log/deferred_log.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_poll.h"
+#include "Zigbee/zigbee_reporting.h"
+#include "Zigbee/zigbee_shadow.h"
+#include "Zigbee/zigbee_store.h"
+
+static zb_reporting_engine_t engine;
+static bool engineInitialised = false;
+static uint8_t transactionSequence = 0;
+
+static void onReportingAlarm(uint8_t param);
+
+static void initEngine() {
+    if (!engineInitialised) {
+        ZB_ReportingEngineInit(&engine, ZB_REPORTING_BATCH_DELAY_MS, ZB_REPORTING_COALESCE_WINDOW_MS);
+        engineInitialised = true;
+    }
+}
+
+// Must be called on the stack task, or with the stack lock held
+static void scheduleNextReport() {
+    esp_zb_scheduler_alarm_cancel(onReportingAlarm, 0);
+
+    uint32_t delay = ZB_ReportingEngineNextDelay(&engine, millis());
+    if (delay != ZB_REPORTING_NEVER) {
+        esp_zb_scheduler_alarm(onReportingAlarm, 0, delay);
+    }
+}
+
+static void sendReport(const zb_reporting_frame_t *frame) {
+    uint8_t asdu[3 + ZB_REPORTING_MAX_FRAME_SIZE];
+
+    asdu[0] = ZCL_FRAME_CONTROL_REPORT;
+    asdu[1] = transactionSequence++;
+    asdu[2] = ZCL_CMD_REPORT_ATTRIBUTES;
+    memcpy(&asdu[3], frame->payload, frame->length);
+
+    // No destination address, so the APS layer delivers to every binding of the source endpoint & cluster
+    esp_zb_apsde_data_req_t request = {};
+    request.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
+    request.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    request.cluster_id = frame->cluster;
+    request.src_endpoint = frame->endpoint;
+    request.asdu_length = 3 + frame->length;
+    request.asdu = asdu;
+
+    esp_err_t err = esp_zb_aps_data_request(&request);
+    if (err != ESP_OK) {
+        dlog_w("Failed to send report: endpoint(%d), cluster(0x%x), attributes(%d) (status: %s)", frame->endpoint, frame->cluster, frame->recordCount, esp_err_to_name(err));
+    } else {
+        dlog_d("Sent report: endpoint(%d), cluster(0x%x), attributes(%d)", frame->endpoint, frame->cluster, frame->recordCount);
+#ifdef ZIGBEE_MODE_ED
+        ZB_PollOnActivity(ZB_POLL_ACTIVITY_REPORT);
+#endif
+    }
+}
+
+static void onReportingAlarm(uint8_t param) {
+    // Values keep accumulating while off the network; ZB_ReportingResume() picks them up after joining
+    if (!esp_zb_bdb_dev_joined()) {
+        return;
+    }
+
+    zb_reporting_frame_t frame;
+    uint32_t now = millis();
+
+    while (ZB_ReportingEngineNextFrame(&engine, now, &frame)) {
+        sendReport(&frame);
+    }
+
+    scheduleNextReport();
+}
+
+void ZB_ReportingResume() {
+    initEngine();
+    scheduleNextReport();
+}
+
+void ZB_ReportingSetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value) {
+    initEngine();
+    if (ZB_ReportingEngineSetValue(&engine, endpoint, cluster, attribute, value, millis()) == ESP_OK) {
+        scheduleNextReport();
+    }
+}
+
+// With the stack lock held: the stack, store, shadow and reporting engine all take the new value
+static esp_err_t setAttributeValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value, uint32_t nowMs, bool *reported) {
+    esp_zb_zcl_status_t status = esp_zb_zcl_set_attribute_val(endpoint, cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attribute, (void *)value, false);
+
+    if (status != ESP_ZB_ZCL_STATUS_SUCCESS) {
+        dlog_w("Failed to set attribute: endpoint(%d), cluster(0x%x), attribute(0x%x) (status: 0x%x)", endpoint, cluster, attribute, status);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ZB_StoreSetValue(endpoint, cluster, attribute, value);
+    ZB_ShadowSetValue(endpoint, cluster, attribute, value);
+
+    if (ZB_ReportingEngineSetValue(&engine, endpoint, cluster, attribute, value, nowMs) == ESP_OK) {
+        *reported = true;
+    }
+    return ESP_OK;
+}
+
+// External interface functions
+esp_err_t ZB_AddReportableAttribute(const zb_reporting_config_t *config) {
+    initEngine();
+
+    esp_err_t err = ZB_ReportingEngineAdd(&engine, config);
+    if (err != ESP_OK) {
+        log_e("Cannot report attribute: endpoint(%d), cluster(0x%x), attribute(0x%x) (status: %s)", config->endpoint, config->cluster, config->attribute, esp_err_to_name(err));
+    }
+
+    return err;
+}
+
+esp_err_t ZB_SetAttributeValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value) {
+    bool reported = false;
+
+    // Under the lock, so a first write cannot set the engine up again while the stack task is resuming it
+    esp_zb_lock_acquire(portMAX_DELAY);
+    initEngine();
+
+    esp_err_t err = setAttributeValue(endpoint, cluster, attribute, value, millis(), &reported);
+    if (reported) {
+        scheduleNextReport();
+    }
+
+    esp_zb_lock_release();
+    return err;
+}
+
+esp_err_t ZB_CommitAttributes(zb_attribute_batch_t *batch) {
+    esp_err_t err = ESP_OK;
+    bool reported = false;
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    initEngine();
+
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < batch->count; i++) {
+        const zb_attribute_write_t *write = &batch->writes[i];
+
+        esp_err_t writeErr = setAttributeValue(write->endpoint, write->cluster, write->attribute, write->value, now, &reported);
+        if (err == ESP_OK) {
+            err = writeErr;
+        }
+    }
+
+    // One reschedule for the whole batch, which the engine then reports as one change
+    if (reported) {
+        scheduleNextReport();
+    }
+
+    esp_zb_lock_release();
+
+    batch->count = 0;
+    return err;
+}
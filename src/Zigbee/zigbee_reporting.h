@@ -0,0 +1,30 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Sends attribute reports on behalf of the application
+ * Values set through ZB_SetAttributeValue(), or written remotely, are handed to the reporting engine, and due frames are
+ * sent from a stack scheduler alarm as Report Attributes commands to whatever is bound to the attribute's cluster.
+ */
+#pragma once
+
+#include "esp_zigbee_core.h"
+
+#define ZCL_FRAME_CONTROL_REPORT 0x18           /* profile wide, server to client, default response disabled */
+#define ZCL_CMD_REPORT_ATTRIBUTES 0x0a
+
+/* Called on the Zigbee stack task once the device is on a network, to send anything held back while it was not */
+void ZB_ReportingResume();
+
+/* Called on the Zigbee stack task when a remote write has changed an attribute, so a reportable one is reported */
+void ZB_ReportingSetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value);
@@ -0,0 +1,325 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <math.h>
+#include "Zigbee/zigbee_reporting_engine.h"
+
+// Wrap-safe "a is before b" for millisecond tick counts
+static inline bool isBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+// Value size of the attribute types we can report, 0 for the rest
+static uint8_t typeSize(esp_zb_zcl_attr_type_t type) {
+    switch (type) {
+        case ESP_ZB_ZCL_ATTR_TYPE_BOOL:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM:
+        case ESP_ZB_ZCL_ATTR_TYPE_U8:
+        case ESP_ZB_ZCL_ATTR_TYPE_S8:
+            return 1;
+        case ESP_ZB_ZCL_ATTR_TYPE_16BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_16BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM:
+        case ESP_ZB_ZCL_ATTR_TYPE_U16:
+        case ESP_ZB_ZCL_ATTR_TYPE_S16:
+            return 2;
+        case ESP_ZB_ZCL_ATTR_TYPE_U24:
+        case ESP_ZB_ZCL_ATTR_TYPE_S24:
+            return 3;
+        case ESP_ZB_ZCL_ATTR_TYPE_32BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_32BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_U32:
+        case ESP_ZB_ZCL_ATTR_TYPE_S32:
+        case ESP_ZB_ZCL_ATTR_TYPE_SINGLE:
+        case ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME:
+            return 4;
+        case ESP_ZB_ZCL_ATTR_TYPE_U48:
+            return 6;
+        case ESP_ZB_ZCL_ATTR_TYPE_U64:
+        case ESP_ZB_ZCL_ATTR_TYPE_S64:
+        case ESP_ZB_ZCL_ATTR_TYPE_DOUBLE:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// Analog types honour the reportable change threshold, discrete ones (bool, bitmap, enum) report any change
+static bool isAnalog(esp_zb_zcl_attr_type_t type) {
+    return (type >= ESP_ZB_ZCL_ATTR_TYPE_U8 && type <= ESP_ZB_ZCL_ATTR_TYPE_S64) || type == ESP_ZB_ZCL_ATTR_TYPE_SINGLE ||
+           type == ESP_ZB_ZCL_ATTR_TYPE_DOUBLE || type == ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME;
+}
+
+static bool isSigned(esp_zb_zcl_attr_type_t type) {
+    return type >= ESP_ZB_ZCL_ATTR_TYPE_S8 && type <= ESP_ZB_ZCL_ATTR_TYPE_S64;
+}
+
+static uint64_t toInteger(const uint8_t *raw, uint8_t size, bool sign) {
+    uint64_t value = 0;
+
+    for (uint8_t i = 0; i < size; i++) {
+        value |= (uint64_t)raw[i] << (8 * i);
+    }
+
+    // Sign-extend the narrower types so they compare as int64_t
+    if (sign && size < 8 && (raw[size - 1] & 0x80)) {
+        value |= ~(uint64_t)0 << (8 * size);
+    }
+
+    return value;
+}
+
+static bool reportableChangeReached(const zb_reporting_attr_t *attr) {
+    const zb_reporting_config_t *config = &attr->config;
+
+    bool anyChange = memcmp(attr->value, attr->reported, attr->size) != 0;
+
+    if (!attr->analog) {
+        return anyChange;
+    }
+
+    if (config->type == ESP_ZB_ZCL_ATTR_TYPE_SINGLE) {
+        float value, reported;
+        memcpy(&value, attr->value, sizeof(value));
+        memcpy(&reported, attr->reported, sizeof(reported));
+        return config->reportableChange.single == 0.0f ? anyChange : fabsf(value - reported) >= config->reportableChange.single;
+    }
+
+    if (config->type == ESP_ZB_ZCL_ATTR_TYPE_DOUBLE) {
+        double value, reported;
+        memcpy(&value, attr->value, sizeof(value));
+        memcpy(&reported, attr->reported, sizeof(reported));
+        return config->reportableChange.real == 0.0 ? anyChange : fabs(value - reported) >= config->reportableChange.real;
+    }
+
+    if (config->reportableChange.integer == 0) {
+        return anyChange;
+    }
+
+    bool sign = isSigned(config->type);
+    uint64_t value = toInteger(attr->value, attr->size, sign);
+    uint64_t reported = toInteger(attr->reported, attr->size, sign);
+    bool increased = sign ? (int64_t)value > (int64_t)reported : value > reported;
+
+    // The unsigned difference of the larger minus the smaller is exact for both signednesses
+    return (increased ? value - reported : reported - value) >= config->reportableChange.integer;
+}
+
+// When the attribute must next be reported on its own account, false if never
+static bool dueAt(const zb_reporting_engine_t *engine, const zb_reporting_attr_t *attr, uint32_t *due) {
+    bool hasDue = false;
+
+    if (attr->pending) {
+        *due = attr->changedAt + engine->batchDelayMs;
+        hasDue = true;
+
+        uint32_t minimumAt = attr->reportedAt + attr->config.minIntervalS * 1000;
+        if (attr->hasReported && isBefore(*due, minimumAt)) {
+            *due = minimumAt;
+        }
+    }
+
+    if (attr->hasReported && attr->config.maxIntervalS) {
+        uint32_t maximumAt = attr->reportedAt + attr->config.maxIntervalS * 1000;
+        if (!hasDue || isBefore(maximumAt, *due)) {
+            *due = maximumAt;
+        }
+        hasDue = true;
+    }
+
+    return hasDue;
+}
+
+static bool isDue(const zb_reporting_engine_t *engine, const zb_reporting_attr_t *attr, uint32_t nowMs) {
+    uint32_t due;
+    return dueAt(engine, attr, &due) && !isBefore(nowMs, due);
+}
+
+// Worth sending early because a frame for its cluster is going out anyway
+static bool canRideAlong(const zb_reporting_engine_t *engine, const zb_reporting_attr_t *attr, uint32_t nowMs) {
+    if (!attr->hasValue) {
+        return false;
+    }
+    if (!attr->hasReported) {
+        return true;
+    }
+    if (isBefore(nowMs, attr->reportedAt + attr->config.minIntervalS * 1000)) {
+        return false;
+    }
+    if (attr->changed) {
+        return true;
+    }
+
+    return attr->config.maxIntervalS && isBefore(attr->reportedAt + attr->config.maxIntervalS * 1000, nowMs + engine->coalesceWindowMs + 1);
+}
+
+static bool appendRecord(zb_reporting_engine_t *engine, zb_reporting_attr_t *attr, uint32_t nowMs, zb_reporting_frame_t *frame) {
+    uint16_t recordSize = 3 + attr->size;
+
+    if (frame->length + recordSize > ZB_REPORTING_MAX_FRAME_SIZE) {
+        return false;
+    }
+
+    uint8_t *record = &frame->payload[frame->length];
+    record[0] = attr->config.attribute & 0xff;
+    record[1] = attr->config.attribute >> 8;
+    record[2] = attr->config.type;
+    memcpy(&record[3], attr->value, attr->size);
+
+    frame->length += recordSize;
+    frame->recordCount++;
+    engine->records++;
+
+    memcpy(attr->reported, attr->value, attr->size);
+    attr->hasReported = true;
+    attr->changed = false;
+    attr->pending = false;
+    attr->reportedAt = nowMs;
+
+    return true;
+}
+
+static zb_reporting_attr_t *findAttr(zb_reporting_engine_t *engine, uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    for (uint8_t i = 0; i < engine->count; i++) {
+        zb_reporting_attr_t *attr = &engine->attrs[i];
+        if (attr->config.endpoint == endpoint && attr->config.cluster == cluster && attr->config.attribute == attribute) {
+            return attr;
+        }
+    }
+    return NULL;
+}
+
+void ZB_ReportingEngineInit(zb_reporting_engine_t *engine, uint16_t batchDelayMs, uint16_t coalesceWindowMs) {
+    memset(engine, 0, sizeof(*engine));
+    engine->batchDelayMs = batchDelayMs;
+    engine->coalesceWindowMs = coalesceWindowMs;
+}
+
+esp_err_t ZB_ReportingEngineAdd(zb_reporting_engine_t *engine, const zb_reporting_config_t *config) {
+    uint8_t size = typeSize(config->type);
+
+    if (size == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (findAttr(engine, config->endpoint, config->cluster, config->attribute)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (engine->count >= ZB_REPORTING_MAX_ATTRIBUTES) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    zb_reporting_attr_t *attr = &engine->attrs[engine->count++];
+    memset(attr, 0, sizeof(*attr));
+    attr->config = *config;
+    attr->size = size;
+    attr->analog = isAnalog(config->type);
+
+    return ESP_OK;
+}
+
+esp_err_t ZB_ReportingEngineSetValue(zb_reporting_engine_t *engine, uint8_t endpoint, uint16_t cluster, uint16_t attribute,
+                                     const void *value, uint32_t nowMs) {
+    zb_reporting_attr_t *attr = findAttr(engine, endpoint, cluster, attribute);
+
+    if (!attr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    memcpy(attr->value, value, attr->size);
+
+    if (!attr->hasValue) {
+        attr->hasValue = true;
+        attr->changed = true;
+        attr->pending = true;
+        attr->changedAt = nowMs;
+        return ESP_OK;
+    }
+
+    // The first report is already pending
+    if (!attr->hasReported) {
+        return ESP_OK;
+    }
+
+    // Thresholds are measured from the last reported value, so a value that drifts back cancels a pending report.
+    // The batch delay runs from the first reportable change, so a value that keeps changing cannot postpone it forever.
+    attr->changed = memcmp(attr->value, attr->reported, attr->size) != 0;
+    bool reached = attr->changed && reportableChangeReached(attr);
+
+    if (reached && !attr->pending) {
+        attr->changedAt = nowMs;
+    }
+    attr->pending = reached;
+
+    return ESP_OK;
+}
+
+bool ZB_ReportingEngineNextFrame(zb_reporting_engine_t *engine, uint32_t nowMs, zb_reporting_frame_t *frame) {
+    zb_reporting_attr_t *trigger = NULL;
+    uint32_t triggerDue = 0;
+
+    // The most overdue attribute decides which cluster goes out next
+    for (uint8_t i = 0; i < engine->count; i++) {
+        uint32_t due;
+        if (dueAt(engine, &engine->attrs[i], &due) && !isBefore(nowMs, due) && (!trigger || isBefore(due, triggerDue))) {
+            trigger = &engine->attrs[i];
+            triggerDue = due;
+        }
+    }
+
+    if (!trigger) {
+        return false;
+    }
+
+    frame->endpoint = trigger->config.endpoint;
+    frame->cluster = trigger->config.cluster;
+    frame->recordCount = 0;
+    frame->length = 0;
+
+    appendRecord(engine, trigger, nowMs, frame);
+
+    for (uint8_t i = 0; i < engine->count; i++) {
+        zb_reporting_attr_t *attr = &engine->attrs[i];
+
+        if (attr == trigger || attr->config.endpoint != frame->endpoint || attr->config.cluster != frame->cluster) {
+            continue;
+        }
+
+        // Anything due that does not fit goes out in the next frame
+        if (isDue(engine, attr, nowMs) || canRideAlong(engine, attr, nowMs)) {
+            appendRecord(engine, attr, nowMs, frame);
+        }
+    }
+
+    engine->frames++;
+    return true;
+}
+
+uint32_t ZB_ReportingEngineNextDelay(const zb_reporting_engine_t *engine, uint32_t nowMs) {
+    uint32_t delay = ZB_REPORTING_NEVER;
+
+    for (uint8_t i = 0; i < engine->count; i++) {
+        uint32_t due;
+        if (dueAt(engine, &engine->attrs[i], &due)) {
+            uint32_t remaining = isBefore(nowMs, due) ? due - nowMs : 0;
+            if (remaining < delay) {
+                delay = remaining;
+            }
+        }
+    }
+
+    return delay;
+}
@@ -0,0 +1,107 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Attribute reporting scheduler
+ * Pure logic with no stack calls or clock of its own: the caller records attribute values along with the current time
+ * in milliseconds, asks for the frames that are due and arms a timer for whatever delay is left.
+ * Each reportable attribute has ZCL style minimum/maximum intervals and a reportable change threshold. Whenever one
+ * attribute of a cluster is due, every other attribute of that cluster that has changed, or whose maximum interval is
+ * close, is folded into the same Report Attributes frame so they share one transmission.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_zigbee_type.h"
+
+#ifndef ZB_REPORTING_MAX_ATTRIBUTES
+#define ZB_REPORTING_MAX_ATTRIBUTES 16
+#endif
+
+#ifndef ZB_REPORTING_MAX_FRAME_SIZE
+#define ZB_REPORTING_MAX_FRAME_SIZE 64          /* attribute record bytes per frame, larger batches are split */
+#endif
+
+/* Default timings, in milliseconds */
+#define ZB_REPORTING_BATCH_DELAY_MS 50          /* hold a change this long so updates made together go out together */
+#define ZB_REPORTING_COALESCE_WINDOW_MS 5000    /* periodic reports this close to due ride along with another report */
+
+#define ZB_REPORTING_NEVER UINT32_MAX
+
+/* Reportable change in the attribute's own type, so float thresholds below 1.0 are possible */
+typedef union {
+    uint64_t integer;                           /* integer types, in attribute units */
+    float single;                               /* ESP_ZB_ZCL_ATTR_TYPE_SINGLE */
+    double real;                                /* ESP_ZB_ZCL_ATTR_TYPE_DOUBLE */
+} zb_reporting_change_t;
+
+typedef struct {
+    uint8_t endpoint;
+    uint16_t cluster;
+    uint16_t attribute;
+    esp_zb_zcl_attr_type_t type;                /* integer, float, bool, bitmap & enum types of up to 8 bytes */
+    uint16_t minIntervalS;                      /* 0 = no minimum */
+    uint16_t maxIntervalS;                      /* 0 = report on change only */
+    zb_reporting_change_t reportableChange;     /* 0 = any change; discrete types report any change */
+} zb_reporting_config_t;
+
+typedef struct {
+    zb_reporting_config_t config;
+    uint8_t size;
+    bool analog;
+    bool hasValue;
+    bool hasReported;
+    bool changed;                               /* differs from the last reported value */
+    bool pending;                               /* changed by at least the reportable change */
+    uint32_t changedAt;
+    uint32_t reportedAt;
+    uint8_t value[8];
+    uint8_t reported[8];
+} zb_reporting_attr_t;
+
+typedef struct {
+    zb_reporting_attr_t attrs[ZB_REPORTING_MAX_ATTRIBUTES];
+    uint8_t count;
+    uint16_t batchDelayMs;
+    uint16_t coalesceWindowMs;
+    uint32_t frames;
+    uint32_t records;
+} zb_reporting_engine_t;
+
+/* A Report Attributes (0x0a) payload: attribute id, type and value per record, little endian */
+typedef struct {
+    uint8_t endpoint;
+    uint16_t cluster;
+    uint8_t recordCount;
+    uint16_t length;
+    uint8_t payload[ZB_REPORTING_MAX_FRAME_SIZE];
+} zb_reporting_frame_t;
+
+void ZB_ReportingEngineInit(zb_reporting_engine_t *engine, uint16_t batchDelayMs, uint16_t coalesceWindowMs);
+
+/* ESP_ERR_NOT_SUPPORTED for types that cannot be reported, ESP_ERR_NO_MEM when full, ESP_ERR_INVALID_STATE if added twice */
+esp_err_t ZB_ReportingEngineAdd(zb_reporting_engine_t *engine, const zb_reporting_config_t *config);
+
+/* Record the attribute's current value, in its native layout; ESP_ERR_NOT_FOUND if it was never added.
+ * The first value recorded is always reported.
+ */
+esp_err_t ZB_ReportingEngineSetValue(zb_reporting_engine_t *engine, uint8_t endpoint, uint16_t cluster, uint16_t attribute,
+                                     const void *value, uint32_t nowMs);
+
+/* Fill in the next frame due at nowMs, marking its attributes as reported; false once nothing else is due */
+bool ZB_ReportingEngineNextFrame(zb_reporting_engine_t *engine, uint32_t nowMs, zb_reporting_frame_t *frame);
+
+/* Delay until a frame is next due, 0 if one is due now, ZB_REPORTING_NEVER if nothing is scheduled */
+uint32_t ZB_ReportingEngineNextDelay(const zb_reporting_engine_t *engine, uint32_t nowMs);
@@ -0,0 +1,141 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <algorithm>
+#include "nwk/esp_zigbee_nwk.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_diagnostics.h"
+#include "Zigbee/zigbee_router.h"
+
+#ifdef ZIGBEE_MODE_ZCZR
+
+typedef struct {
+    uint16_t id;
+    uint32_t zb_router_stats_t::*total;
+} router_counter_t;
+
+static const router_counter_t counters[] = {
+    {ZB_ATTR_DIAGNOSTICS_RELAYED_UCAST_ID, &zb_router_stats_t::forwarded},
+    {ZB_ATTR_DIAGNOSTICS_ROUTE_DISC_INITIATED_ID, &zb_router_stats_t::routeDiscoveries},
+    {ZB_ATTR_DIAGNOSTICS_PACKET_BUFFER_ALLOCATE_FAILURES_ID, &zb_router_stats_t::bufferFailures},
+};
+
+#define ROUTER_COUNTER_COUNT (sizeof(counters) / sizeof(counters[0]))
+
+// Only touched on the Zigbee stack task, or with the stack lock held
+static zb_router_stats_t stats;
+static uint8_t diagnosticsEndpoint = HA_ESP_SENSOR_ENDPOINT;
+static uint16_t lastCounters[ROUTER_COUNTER_COUNT];
+static uint32_t lastSampleMs = 0;
+static uint32_t lastForwarded = 0;
+
+static void onRouterAlarm(uint8_t param);
+
+void ZB_RouterConfigure() {
+    ESP_ERROR_CHECK(esp_zb_overall_network_size_set(ZB_ROUTER_NETWORK_SIZE));
+    ESP_ERROR_CHECK(esp_zb_io_buffer_size_set(ZB_ROUTER_IO_BUFFERS));
+    ESP_ERROR_CHECK(esp_zb_scheduler_queue_size_set(ZB_ROUTER_SCHEDULER_QUEUE));
+
+    log_i("Router tables: %d children, %d neighbors, %d buffers, %d scheduler entries", ZB_ROUTER_MAX_CHILDREN, ZB_ROUTER_NETWORK_SIZE,
+          ZB_ROUTER_IO_BUFFERS, ZB_ROUTER_SCHEDULER_QUEUE);
+}
+
+void ZB_RouterAddDiagnostics(uint8_t endpoint, esp_zb_attribute_list_t *diagnosticsCluster) {
+    uint16_t zero = 0;
+
+    diagnosticsEndpoint = endpoint;
+    for (size_t i = 0; i < ROUTER_COUNTER_COUNT; i++) {
+        ESP_ERROR_CHECK(esp_zb_cluster_add_attr(diagnosticsCluster, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, counters[i].id, ESP_ZB_ZCL_ATTR_TYPE_U16,
+                                                ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &zero));
+    }
+}
+
+// Fold what the stack has counted since the last sample into the totals, allowing for its counters having wrapped once
+static void sampleCounters() {
+    for (size_t i = 0; i < ROUTER_COUNTER_COUNT; i++) {
+        esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(diagnosticsEndpoint, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                                           counters[i].id);
+        if (attr == NULL) {
+            continue;
+        }
+
+        uint16_t value;
+        memcpy(&value, attr->data_p, sizeof(value));
+        stats.*counters[i].total += (uint16_t)(value - lastCounters[i]);
+        lastCounters[i] = value;
+    }
+}
+
+static void sampleTables() {
+    esp_zb_nwk_info_iterator_t iterator = ESP_ZB_NWK_INFO_ITERATOR_INIT;
+    esp_zb_nwk_neighbor_info_t neighbor;
+    esp_zb_nwk_route_info_t route;
+
+    stats.children = 0;
+    stats.neighbors = 0;
+    while (esp_zb_nwk_get_next_neighbor(&iterator, &neighbor) == ESP_OK) {
+        stats.neighbors++;
+        if (neighbor.relationship == ESP_ZB_NWK_RELATIONSHIP_CHILD) {
+            stats.children++;
+        }
+    }
+
+    iterator = ESP_ZB_NWK_INFO_ITERATOR_INIT;
+    stats.routes = 0;
+    while (esp_zb_nwk_get_next_route(&iterator, &route) == ESP_OK) {
+        if (route.flags.status == ESP_ZB_NWK_ROUTE_STATE_ACTIVE) {
+            stats.routes++;
+        }
+    }
+
+    stats.childrenPeak = std::max<uint8_t>(stats.childrenPeak, stats.children);
+    stats.neighborsPeak = std::max<uint16_t>(stats.neighborsPeak, stats.neighbors);
+    stats.routesPeak = std::max<uint16_t>(stats.routesPeak, stats.routes);
+}
+
+void ZB_RouterResume() {
+    sampleCounters();
+    sampleTables();
+    lastSampleMs = millis();
+    lastForwarded = stats.forwarded;
+
+    esp_zb_scheduler_alarm_cancel(onRouterAlarm, 0);
+    esp_zb_scheduler_alarm(onRouterAlarm, 0, ZB_ROUTER_SAMPLE_MS);
+}
+
+static void onRouterAlarm(uint8_t param) {
+    uint32_t now = millis();
+
+    sampleCounters();
+    sampleTables();
+    if (now != lastSampleMs) {
+        stats.forwardedPerMinute = (uint32_t)((uint64_t)(stats.forwarded - lastForwarded) * 60000 / (now - lastSampleMs));
+        stats.forwardedPerMinutePeak = std::max<uint32_t>(stats.forwardedPerMinutePeak, stats.forwardedPerMinute);
+    }
+    lastSampleMs = now;
+    lastForwarded = stats.forwarded;
+
+    esp_zb_scheduler_alarm(onRouterAlarm, 0, ZB_ROUTER_SAMPLE_MS);
+}
+
+void ZB_GetRouterStats(zb_router_stats_t *current) {
+    esp_zb_lock_acquire(portMAX_DELAY);
+    sampleCounters();
+    sampleTables();
+    *current = stats;
+    esp_zb_lock_release();
+}
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Router role
+ * Built with ZIGBEE_MODE_ZCZR in place of ZIGBEE_MODE_ED, as the esp32-c6-devkitc-1-router env is, the device joins as a
+ * router: it keeps its receiver on, relays frames across the mesh and parents end devices. The tables it does this
+ * with are sized below, ahead of esp_zb_init(); override them in platformio.ini to suit the network. The routing table
+ * itself is sized inside the stack library, so only its occupancy can be watched.
+ *
+ * The stack counts relayed frames, route discoveries and frame buffers it failed to allocate in 16-bit Diagnostics
+ * cluster attributes, which wrap. Every ZB_ROUTER_SAMPLE_MS they are folded into 32-bit totals and the tables are
+ * walked for their occupancy, keeping the peaks, so the tables of a device can be sized from what it has seen.
+ */
+#pragma once
+
+#include "esp_zigbee_core.h"
+
+#ifndef ZB_ROUTER_MAX_CHILDREN
+#define ZB_ROUTER_MAX_CHILDREN 10               /* end devices this router will parent */
+#endif
+
+#ifndef ZB_ROUTER_NETWORK_SIZE
+#define ZB_ROUTER_NETWORK_SIZE 64               /* devices the neighbor & address tables hold */
+#endif
+
+#ifndef ZB_ROUTER_IO_BUFFERS
+#define ZB_ROUTER_IO_BUFFERS 80                 /* frame buffers, shared by relayed and local frames */
+#endif
+
+#ifndef ZB_ROUTER_SCHEDULER_QUEUE
+#define ZB_ROUTER_SCHEDULER_QUEUE 80            /* callbacks & alarms the stack can have pending */
+#endif
+
+#define ZB_ROUTER_SAMPLE_MS 10000
+
+static_assert(ZB_ROUTER_MAX_CHILDREN > 0 && ZB_ROUTER_MAX_CHILDREN <= ZB_ROUTER_NETWORK_SIZE, "Every child takes a neighbor table entry");
+static_assert(ZB_ROUTER_NETWORK_SIZE <= UINT16_MAX && ZB_ROUTER_IO_BUFFERS <= UINT16_MAX && ZB_ROUTER_SCHEDULER_QUEUE <= UINT16_MAX,
+              "Stack sizes are 16-bit");
+
+typedef struct {
+    uint8_t children;
+    uint8_t childrenPeak;
+    uint16_t neighbors;                         /* children included */
+    uint16_t neighborsPeak;
+    uint16_t routes;                            /* active routing table entries */
+    uint16_t routesPeak;
+    uint32_t forwarded;                         /* unicast frames relayed for other devices */
+    uint32_t routeDiscoveries;                  /* started by this router */
+    uint32_t bufferFailures;                    /* frames dropped for want of a buffer */
+    uint32_t forwardedPerMinute;                /* over the last sample period */
+    uint32_t forwardedPerMinutePeak;
+} zb_router_stats_t;
+
+/* Called on the Zigbee stack task before esp_zb_init(), to size the tables */
+void ZB_RouterConfigure();
+
+/* Called from ZB_DiagnosticsAddClusters() to add the counters the stack keeps to the Diagnostics cluster */
+void ZB_RouterAddDiagnostics(uint8_t endpoint, esp_zb_attribute_list_t *diagnosticsCluster);
+
+/* Once joined, on the stack task: sample now and every ZB_ROUTER_SAMPLE_MS */
+void ZB_RouterResume();
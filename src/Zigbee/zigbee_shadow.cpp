@@ -0,0 +1,68 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_shadow.h"
+
+static zb_shadow_cache_t cache;
+static portMUX_TYPE shadowMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Changed by the stack on its own, with no attribute value callback to keep a shadow current, so never shadowed
+static const struct {
+    uint16_t cluster;
+    uint16_t attribute;
+} stackDrivenAttributes[] = {
+    {ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID},    // counted down while identifying
+};
+
+static bool isStackDriven(uint16_t cluster, uint16_t attribute) {
+    for (size_t i = 0; i < sizeof(stackDrivenAttributes) / sizeof(stackDrivenAttributes[0]); i++) {
+        if (stackDrivenAttributes[i].cluster == cluster && stackDrivenAttributes[i].attribute == attribute) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ZB_ShadowAddAttribute(uint8_t endpoint, uint16_t cluster, uint8_t role, const zb_attribute_desc_t *attribute, const void *value) {
+    if (role != ESP_ZB_ZCL_CLUSTER_SERVER_ROLE || ZbStoreTypeSize(attribute->type) == 0 || isStackDriven(cluster, attribute->id)) {
+        return;
+    }
+
+    esp_err_t err = ZB_ShadowCacheAdd(&cache, endpoint, cluster, attribute->id, attribute->type, value);
+    if (err == ESP_ERR_NO_MEM) {
+        log_w("Endpoint %d cluster 0x%04x: attribute 0x%04x not shadowed, raise ZB_SHADOW_MAX_ATTRIBUTES", endpoint, cluster, attribute->id);
+    }
+}
+
+void ZB_ShadowPublish() {
+    ZB_ShadowCacheSeal(&cache);
+    log_d("Shadowing %d attributes", cache.count);
+}
+
+void ZB_ShadowSetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value) {
+    portENTER_CRITICAL(&shadowMux);
+    ZB_ShadowCacheSet(&cache, endpoint, cluster, attribute, value);
+    portEXIT_CRITICAL(&shadowMux);
+}
+
+// External interface functions
+esp_err_t ZB_GetAttributeValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, void *value, uint8_t size, uint32_t *version) {
+    return ZB_ShadowCacheGet(&cache, endpoint, cluster, attribute, value, size, version);
+}
+
+esp_err_t ZB_BatchAttributeValue(zb_attribute_batch_t *batch, uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value) {
+    return ZB_ShadowCacheBatchAdd(&cache, batch, endpoint, cluster, attribute, value);
+}
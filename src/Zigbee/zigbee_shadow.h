@@ -0,0 +1,38 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* App-side attribute reads
+ * Every fixed-size server attribute in the device descriptor is mirrored in a zigbee_shadow_cache.h cache as the
+ * endpoints are created, and kept current from the stack: network writes through the attribute value callback, local
+ * ones through ZB_SetAttributeValue() and ZB_CommitAttributes(). ZB_GetAttributeValue() then reads it from any task
+ * without the stack lock. Each update is made in a short critical section, so a reader of higher priority than the
+ * stack task can never find it half written and spin on it.
+ * Attributes the stack changes by itself without telling the application, such as Identify Time while it counts down,
+ * are left out, as their shadow would go stale; read those from the stack under its lock.
+ */
+#pragma once
+
+#include "Zigbee/zigbee_device.h"
+#include "Zigbee/zigbee_shadow_cache.h"
+
+/* Called from ZB_CreateEndpoints() for each attribute, with the value it is created with */
+void ZB_ShadowAddAttribute(uint8_t endpoint, uint16_t cluster, uint8_t role, const zb_attribute_desc_t *attribute, const void *value);
+
+/* Called once the endpoints are registered, to let readers in */
+void ZB_ShadowPublish();
+
+/* Record a server attribute's new value; ignored for attributes that are not shadowed. On the stack task, or with the
+ * stack lock held.
+ */
+void ZB_ShadowSetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value);
@@ -0,0 +1,226 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include "Zigbee/zigbee_shadow_cache.h"
+#include "Zigbee/zigbee_store_log.h"
+
+static constexpr uint8_t WORDS = ZB_SHADOW_MAX_VALUE_SIZE / 4;
+
+static inline uint64_t keyOf(uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    return ((uint64_t)endpoint << 32) | ((uint32_t)cluster << 16) | attribute;
+}
+
+static inline uint64_t keyOf(const zb_shadow_entry_t *entry) {
+    return keyOf(entry->endpoint, entry->cluster, entry->attribute);
+}
+
+// Index of the first entry not below key
+static uint8_t lowerBound(const zb_shadow_cache_t *shadow, uint64_t key) {
+    uint8_t low = 0;
+    uint8_t high = shadow->count;
+
+    while (low < high) {
+        uint8_t middle = (low + high) / 2;
+        if (keyOf(&shadow->entries[middle]) < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static zb_shadow_entry_t *find(const zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    uint64_t key = keyOf(endpoint, cluster, attribute);
+    uint8_t index = lowerBound(shadow, key);
+
+    if (index == shadow->count || keyOf(&shadow->entries[index]) != key) {
+        return NULL;
+    }
+    return (zb_shadow_entry_t *)&shadow->entries[index];
+}
+
+// Only while unsealed, when no reader can see the entries
+static void moveEntry(zb_shadow_entry_t *to, const zb_shadow_entry_t *from) {
+    to->endpoint = from->endpoint;
+    to->cluster = from->cluster;
+    to->attribute = from->attribute;
+    to->type = from->type;
+    to->size = from->size;
+    to->sequence.store(from->sequence.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    for (uint8_t i = 0; i < WORDS; i++) {
+        to->words[i].store(from->words[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void ZB_ShadowCacheInit(zb_shadow_cache_t *shadow) {
+    shadow->count = 0;
+    shadow->writes = 0;
+    shadow->sealed.store(false, std::memory_order_relaxed);
+}
+
+esp_err_t ZB_ShadowCacheAdd(zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute, uint8_t type,
+                            const void *value) {
+    uint8_t size = ZbStoreTypeSize(type);
+    if (size == 0 || value == NULL) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (shadow->sealed.load(std::memory_order_relaxed)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint64_t key = keyOf(endpoint, cluster, attribute);
+    uint8_t index = lowerBound(shadow, key);
+    if (index < shadow->count && keyOf(&shadow->entries[index]) == key) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (shadow->count >= ZB_SHADOW_MAX_ATTRIBUTES) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint8_t i = shadow->count; i > index; i--) {
+        moveEntry(&shadow->entries[i], &shadow->entries[i - 1]);
+    }
+    shadow->count++;
+
+    zb_shadow_entry_t *entry = &shadow->entries[index];
+    entry->endpoint = endpoint;
+    entry->cluster = cluster;
+    entry->attribute = attribute;
+    entry->type = type;
+    entry->size = size;
+    entry->sequence.store(0, std::memory_order_relaxed);
+
+    uint32_t words[WORDS] = {};
+    memcpy(words, value, size);
+    for (uint8_t i = 0; i < WORDS; i++) {
+        entry->words[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    return ESP_OK;
+}
+
+void ZB_ShadowCacheSeal(zb_shadow_cache_t *shadow) {
+    shadow->sealed.store(true, std::memory_order_release);
+}
+
+const zb_shadow_entry_t *ZB_ShadowCacheFind(const zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    if (!shadow->sealed.load(std::memory_order_acquire)) {
+        return NULL;
+    }
+    return find(shadow, endpoint, cluster, attribute);
+}
+
+esp_err_t ZB_ShadowCacheSet(zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute,
+                            const void *value) {
+    zb_shadow_entry_t *entry = find(shadow, endpoint, cluster, attribute);
+    if (entry == NULL || value == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t words[WORDS] = {};
+    memcpy(words, value, entry->size);
+
+    // The writer owns the words, so comparing against them needs no ordering; an unchanged value keeps its version
+    bool changed = false;
+    for (uint8_t i = 0; i < WORDS; i++) {
+        changed |= entry->words[i].load(std::memory_order_relaxed) != words[i];
+    }
+    if (!changed) {
+        return ESP_OK;
+    }
+
+    uint32_t sequence = entry->sequence.load(std::memory_order_relaxed);
+    entry->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (uint8_t i = 0; i < WORDS; i++) {
+        entry->words[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    entry->sequence.store(sequence + 2, std::memory_order_release);
+    shadow->writes++;
+    return ESP_OK;
+}
+
+void ZB_ShadowCacheRead(const zb_shadow_entry_t *entry, void *value, uint32_t *version) {
+    uint32_t words[WORDS];
+    uint32_t before;
+
+    for (;;) {
+        before = entry->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+
+        for (uint8_t i = 0; i < WORDS; i++) {
+            words[i] = entry->words[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (entry->sequence.load(std::memory_order_relaxed) == before) {
+            break;
+        }
+    }
+
+    memcpy(value, words, entry->size);
+    if (version) {
+        *version = before / 2;
+    }
+}
+
+esp_err_t ZB_ShadowCacheGet(const zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute, void *value,
+                            uint8_t size, uint32_t *version) {
+    const zb_shadow_entry_t *entry = ZB_ShadowCacheFind(shadow, endpoint, cluster, attribute);
+    if (entry == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (size != entry->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ZB_ShadowCacheRead(entry, value, version);
+    return ESP_OK;
+}
+
+esp_err_t ZB_ShadowCacheBatchAdd(const zb_shadow_cache_t *shadow, zb_attribute_batch_t *batch, uint8_t endpoint, uint16_t cluster,
+                                 uint16_t attribute, const void *value) {
+    const zb_shadow_entry_t *entry = ZB_ShadowCacheFind(shadow, endpoint, cluster, attribute);
+    if (entry == NULL || value == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    zb_attribute_write_t *write = NULL;
+    for (uint8_t i = 0; i < batch->count; i++) {
+        if (batch->writes[i].endpoint == endpoint && batch->writes[i].cluster == cluster && batch->writes[i].attribute == attribute) {
+            write = &batch->writes[i];
+            break;
+        }
+    }
+
+    if (write == NULL) {
+        if (batch->count >= ZB_ATTRIBUTE_BATCH_SIZE) {
+            return ESP_ERR_NO_MEM;
+        }
+        write = &batch->writes[batch->count++];
+        write->endpoint = endpoint;
+        write->cluster = cluster;
+        write->attribute = attribute;
+    }
+
+    write->size = entry->size;
+    memcpy(write->value, value, entry->size);
+    return ESP_OK;
+}
@@ -0,0 +1,106 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Shadow attribute cache
+ * A copy of every fixed-size server attribute the device registers, kept up to date by the one writer at a time that
+ * holds the stack (the stack task, or a task with the stack lock), and read by any task without taking a lock.
+ * Each entry is a seqlock: the writer makes its sequence odd, stores the value and makes it even again, and a reader
+ * that saw the sequence move or land on an odd value simply reads again. Readers never write shared memory, so any
+ * number of them cost the writer nothing.
+ *
+ * Entries are added, sorted by endpoint, cluster & attribute, while the endpoints are created; sealing the table then
+ * makes it visible to readers, and nothing is added after that.
+ */
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifndef ZB_SHADOW_MAX_ATTRIBUTES
+#define ZB_SHADOW_MAX_ATTRIBUTES 48
+#endif
+
+#define ZB_SHADOW_MAX_VALUE_SIZE 8              /* bytes, the largest fixed-size ZCL type */
+
+#ifndef ZB_ATTRIBUTE_BATCH_SIZE
+#define ZB_ATTRIBUTE_BATCH_SIZE 8               /* writes committed together under one stack lock */
+#endif
+
+typedef struct {
+    uint8_t endpoint;
+    uint16_t cluster;
+    uint16_t attribute;
+    uint8_t type;                               /* esp_zb_zcl_attr_type_t */
+    uint8_t size;
+    std::atomic<uint32_t> sequence;             /* odd while the value is being written, counts up by 2 per write */
+    std::atomic<uint32_t> words[ZB_SHADOW_MAX_VALUE_SIZE / 4];
+} zb_shadow_entry_t;
+
+typedef struct {
+    zb_shadow_entry_t entries[ZB_SHADOW_MAX_ATTRIBUTES];
+    uint8_t count;
+    std::atomic<bool> sealed;
+    uint32_t writes;                            /* values that changed */
+} zb_shadow_cache_t;
+
+/* App-side writes gathered up to be committed together, see ZB_CommitAttributes() */
+typedef struct {
+    uint8_t endpoint;
+    uint16_t cluster;
+    uint16_t attribute;
+    uint8_t size;
+    uint8_t value[ZB_SHADOW_MAX_VALUE_SIZE];
+} zb_attribute_write_t;
+
+typedef struct {
+    uint8_t count;
+    zb_attribute_write_t writes[ZB_ATTRIBUTE_BATCH_SIZE];
+} zb_attribute_batch_t;
+
+void ZB_ShadowCacheInit(zb_shadow_cache_t *shadow);
+
+/* Add an attribute with its initial value, before sealing.
+ * ESP_ERR_NOT_SUPPORTED for strings and other types without a fixed size, ESP_ERR_NO_MEM when full, ESP_ERR_INVALID_STATE
+ * if added twice or already sealed.
+ */
+esp_err_t ZB_ShadowCacheAdd(zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute, uint8_t type,
+                            const void *value);
+
+/* Publish the table to readers */
+void ZB_ShadowCacheSeal(zb_shadow_cache_t *shadow);
+
+/* Entry for an attribute, or NULL if it is not shadowed or the table is not sealed yet. Entries never move once sealed. */
+const zb_shadow_entry_t *ZB_ShadowCacheFind(const zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute);
+
+/* Writer: record an attribute's new value, in its native layout. Only one writer may run at a time.
+ * ESP_ERR_NOT_FOUND if the attribute is not shadowed.
+ */
+esp_err_t ZB_ShadowCacheSet(zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute,
+                            const void *value);
+
+/* Reader, from any task: copy out a consistent value of exactly size bytes, and its version if asked for, which changes
+ * whenever the value does. ESP_ERR_NOT_FOUND if the attribute is not shadowed, ESP_ERR_INVALID_SIZE if size is not its
+ * value size.
+ */
+esp_err_t ZB_ShadowCacheGet(const zb_shadow_cache_t *shadow, uint8_t endpoint, uint16_t cluster, uint16_t attribute, void *value,
+                            uint8_t size, uint32_t *version);
+void ZB_ShadowCacheRead(const zb_shadow_entry_t *entry, void *value, uint32_t *version);
+
+/* Add a write to a batch, sized from the shadow; a second write to the same attribute replaces the first.
+ * ESP_ERR_NOT_FOUND if the attribute is not shadowed, ESP_ERR_NO_MEM once the batch is full.
+ */
+esp_err_t ZB_ShadowCacheBatchAdd(const zb_shadow_cache_t *shadow, zb_attribute_batch_t *batch, uint8_t endpoint, uint16_t cluster,
+                                 uint16_t attribute, const void *value);
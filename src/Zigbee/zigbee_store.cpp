@@ -0,0 +1,231 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "Log/deferred_log.h"
+#include "Memory/memory_pool.h"
+#include "Trace/trace.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_store.h"
+#include "Zigbee/zigbee_store_log.h"
+
+static zb_store_log_t storeLog;
+static zb_store_batch_t batch;
+static bool enabled = false;
+static TaskHandle_t storeTask = NULL;
+static portMUX_TYPE storeMux = portMUX_INITIALIZER_UNLOCKED;
+
+// The log has one writer at a time: the flush task, ZB_FlushAttributes() and the shutdown handler take turns
+static std::atomic_flag flushing = ATOMIC_FLAG_INIT;
+
+static esp_err_t partitionRead(void *context, uint32_t offset, void *data, size_t size) {
+    return esp_partition_read((const esp_partition_t *)context, offset, data, size);
+}
+
+static esp_err_t partitionWrite(void *context, uint32_t offset, const void *data, size_t size) {
+    return esp_partition_write((const esp_partition_t *)context, offset, data, size);
+}
+
+static esp_err_t partitionErase(void *context, uint32_t offset, size_t size) {
+    return esp_partition_erase_range((const esp_partition_t *)context, offset, size);
+}
+
+static void lockWriter() {
+    while (flushing.test_and_set(std::memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+}
+
+static void unlockWriter() {
+    flushing.clear(std::memory_order_release);
+}
+
+// The shadow is only held for the copy into the batch; flash is written with it released, so the stack task never waits on flash
+static esp_err_t flush() {
+    esp_err_t err = ESP_OK;
+
+    lockWriter();
+
+    for (;;) {
+        portENTER_CRITICAL(&storeMux);
+        uint8_t records = ZB_StoreLogCollect(&storeLog, &batch);
+        portEXIT_CRITICAL(&storeMux);
+
+        if (records == 0) {
+            break;
+        }
+
+        err = ZB_StoreLogWrite(&storeLog, &batch);
+        if (err != ESP_OK) {
+            portENTER_CRITICAL(&storeMux);
+            ZB_StoreLogRequeue(&storeLog, &batch, millis());
+            portEXIT_CRITICAL(&storeMux);
+
+            log_w("Failed to store %d attributes, retrying later (%s)", batch.records - batch.written, esp_err_to_name(err));
+            break;
+        }
+    }
+
+    unlockWriter();
+    return err;
+}
+
+static void taskStore(void *arg) {
+    for (;;) {
+        portENTER_CRITICAL(&storeMux);
+        uint32_t delay = ZB_StoreLogNextFlushDelay(&storeLog, millis());
+        portEXIT_CRITICAL(&storeMux);
+
+        if (delay == 0) {
+            flush();
+        } else {
+            // Woken early when the shadow first goes dirty; later changes only push the deadline back
+            ulTaskNotifyTake(pdTRUE, delay == ZB_STORE_NEVER ? portMAX_DELAY : pdMS_TO_TICKS(delay));
+        }
+    }
+}
+
+static void onShutdown() {
+    if (enabled) {
+        flush();
+    }
+}
+
+void ZB_StoreMount(const zb_device_desc_t *device) {
+    int64_t start = esp_timer_get_time();
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ZB_STORE_PARTITION_LABEL);
+    if (partition == NULL) {
+        log_w("No '%s' partition, attributes will not be stored", ZB_STORE_PARTITION_LABEL);
+        return;
+    }
+
+    uint32_t size = partition->size;
+#ifdef TRACE_RECORDER
+    // The trace recorder keeps the end of the partition
+    size -= TRACE_FLASH_SIZE;
+#endif
+
+    zb_store_flash_t flash = {
+        .read = partitionRead,
+        .write = partitionWrite,
+        .erase = partitionErase,
+        .context = (void *)partition,
+        .sectorSize = partition->erase_size,
+        .sectorCount = size / partition->erase_size,
+    };
+    ZB_StoreLogInit(&storeLog, &flash, ZB_STORE_QUIET_MS, ZB_STORE_MAX_DELAY_MS);
+
+    for (uint8_t i = 0; i < device->endpointCount; i++) {
+        const zb_endpoint_desc_t *endpoint = &device->endpoints[i];
+
+        for (uint8_t j = 0; j < endpoint->clusterCount; j++) {
+            const zb_cluster_desc_t *cluster = &endpoint->clusters[j];
+
+            for (uint8_t k = 0; k < cluster->attributeCount; k++) {
+                const zb_attribute_desc_t *attribute = &cluster->attributes[k];
+                if (!(attribute->access & ZB_ATTR_ACCESS_PERSISTENT)) {
+                    continue;
+                }
+
+                esp_err_t err = ZB_StoreLogAdd(&storeLog, endpoint->endpoint, cluster->id, attribute->id, attribute->type, attribute->value);
+                if (err != ESP_OK) {
+                    log_e("Endpoint %d cluster 0x%04x: attribute 0x%04x cannot be stored (%s)", endpoint->endpoint, cluster->id, attribute->id,
+                          esp_err_to_name(err));
+                }
+            }
+        }
+    }
+
+    if (storeLog.count == 0) {
+        return;
+    }
+
+    esp_err_t err = ZB_StoreLogMount(&storeLog);
+    if (err != ESP_OK) {
+        log_e("Attribute store could not be mounted, attributes will not be stored (%s)", esp_err_to_name(err));
+        return;
+    }
+
+    storeTask = MEM_CreateTask(taskStore, ZB_STORE_TASK_NAME, ZB_STORE_TASK_STACK_SIZE, NULL, ZB_STORE_TASK_PRIORITY);
+    if (storeTask == NULL) {
+        log_e("Attribute store task could not be created, attributes will not be stored");
+        return;
+    }
+
+    enabled = true;
+    esp_register_shutdown_handler(onShutdown);
+
+    log_i("Restored %d of %d stored attributes from %d sectors in %lu us (%lu records, %lu torn)", storeLog.stats.restored, storeLog.count,
+          storeLog.stats.liveSectors, (unsigned long)(esp_timer_get_time() - start), (unsigned long)storeLog.stats.replayed,
+          (unsigned long)storeLog.stats.torn);
+}
+
+const void *ZB_StoreGetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    return enabled ? ZB_StoreLogGet(&storeLog, endpoint, cluster, attribute) : NULL;
+}
+
+void ZB_StoreSetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value) {
+    if (value == NULL) {
+        return;
+    }
+
+    // Checked under the lock so nothing lands in the shadow once ZB_StoreErase() has begun
+    portENTER_CRITICAL(&storeMux);
+    bool wasDirty = storeLog.dirty;
+    esp_err_t err = enabled ? ZB_StoreLogSet(&storeLog, endpoint, cluster, attribute, value, millis()) : ESP_ERR_NOT_FOUND;
+    bool nowDirty = storeLog.dirty;
+    portEXIT_CRITICAL(&storeMux);
+
+    if (err == ESP_ERR_INVALID_SIZE) {
+        dlog_w("Attribute too long to store: endpoint(%d), cluster(0x%x), attribute(0x%x)", endpoint, cluster, attribute);
+    } else if (!wasDirty && nowDirty) {
+        xTaskNotifyGive(storeTask);
+    }
+}
+
+void ZB_StoreErase() {
+    portENTER_CRITICAL(&storeMux);
+    bool wasEnabled = enabled;
+    enabled = false;
+    portEXIT_CRITICAL(&storeMux);
+
+    if (!wasEnabled) {
+        return;
+    }
+
+    lockWriter();
+    esp_err_t err = ZB_StoreLogErase(&storeLog);
+    unlockWriter();
+
+    if (err != ESP_OK) {
+        log_e("Failed to erase stored attributes (%s)", esp_err_to_name(err));
+    }
+}
+
+// External interface functions
+esp_err_t ZB_FlushAttributes() {
+    return enabled ? flush() : ESP_OK;
+}
+
+void ZB_GetStoreStats(zb_store_stats_t *stats) {
+    lockWriter();
+    portENTER_CRITICAL(&storeMux);
+    *stats = storeLog.stats;
+    portEXIT_CRITICAL(&storeMux);
+    unlockWriter();
+}
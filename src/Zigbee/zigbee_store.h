@@ -0,0 +1,46 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Persistent attributes
+ * Attributes flagged ZB_ATTR_ACCESS_PERSISTENT in the device descriptor are kept in the `spiffs` partition by a
+ * zigbee_store_log.h log. Their stored values are restored in one pass before the endpoints are created, so the stack
+ * registers them with the values they had. Later writes, from the network or ZB_SetAttributeValue(), only touch a RAM
+ * shadow on the stack task; a low-priority task writes the changes out together once attributes have been left alone
+ * for ZB_STORE_QUIET_MS, and esp_restart() writes out whatever is still pending first.
+ */
+#pragma once
+
+#include "esp_zigbee_core.h"
+#include "Zigbee/zigbee_device.h"
+
+#define ZB_STORE_PARTITION_LABEL "spiffs"
+#define ZB_STORE_TASK_NAME "Zigbee_store"
+#define ZB_STORE_TASK_STACK_SIZE 2560
+#define ZB_STORE_TASK_PRIORITY 1
+
+/* Called on the Zigbee stack task before the endpoints are created: add the descriptor's persistent attributes, mount
+ * the log and start the flush task. Without the partition or any persistent attributes, nothing is stored.
+ */
+void ZB_StoreMount(const zb_device_desc_t *device);
+
+/* The value a persistent server attribute should be created with, or NULL to use the descriptor's default */
+const void *ZB_StoreGetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute);
+
+/* Record a server attribute's new value; ignored for attributes that are not persistent. On the stack task, or with the
+ * stack lock held.
+ */
+void ZB_StoreSetValue(uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value);
+
+/* Forget every stored value and stop storing, ahead of a factory reset */
+void ZB_StoreErase();
@@ -0,0 +1,513 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "Zigbee/zigbee_store_log.h"
+
+#define RECORD_HEADER_SIZE sizeof(zb_store_record_t)
+#define SECTOR_HEADER_SIZE sizeof(zb_store_sector_header_t)
+#define MAX_RECORD_SIZE (RECORD_HEADER_SIZE + ((ZB_STORE_MAX_VALUE_SIZE + 3) & ~3))
+
+static_assert(sizeof(zb_store_record_t) == 12, "zb_store_record_t is a flash format");
+static_assert(sizeof(zb_store_sector_header_t) == 16, "zb_store_sector_header_t is a flash format");
+static_assert(ZB_STORE_MAX_VALUE_SIZE < 0xff, "record lengths are one byte");
+static_assert(ZB_STORE_BATCH_SIZE >= MAX_RECORD_SIZE, "ZB_STORE_BATCH_SIZE must hold the largest record");
+// Opening a sector copies in at most one record per entry, which must leave room for new records
+static_assert(SECTOR_HEADER_SIZE + 2 * ZB_STORE_MAX_ATTRIBUTES * MAX_RECORD_SIZE <= 4096, "too many attributes for 4 KB sectors");
+
+// Wrap-safe "a is before b" for millisecond tick counts
+static inline bool isBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    crc = ~crc;
+    while (size--) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static inline uint32_t recordSize(uint8_t length) {
+    return RECORD_HEADER_SIZE + ((length + 3) & ~3);
+}
+
+static uint32_t headerCheck(const zb_store_sector_header_t *header) {
+    return crc32(0, header, offsetof(zb_store_sector_header_t, check));
+}
+
+static uint32_t recordCrc(const zb_store_record_t *record, const uint8_t *value) {
+    uint32_t crc = crc32(0, &record->cluster, RECORD_HEADER_SIZE - offsetof(zb_store_record_t, cluster));
+    return crc32(crc, value, record->length);
+}
+
+// Bytes of a value in use: a string's length prefix plus its contents, the type's size otherwise; 0 if unsupported
+static uint32_t valueLength(uint8_t type, const void *value) {
+    if (type == ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING || type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING) {
+        uint8_t length = *(const uint8_t *)value;
+        return length == 0xff ? 1 : 1 + length;       // 0xff marks an invalid string, with no contents
+    }
+    return ZbStoreTypeSize(type);
+}
+
+static zb_store_entry_t *findEntry(zb_store_log_t *log, uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    for (uint8_t i = 0; i < log->count; i++) {
+        zb_store_entry_t *entry = &log->entries[i];
+        if (entry->endpoint == endpoint && entry->cluster == cluster && entry->attribute == attribute) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static bool isBlank(const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++) {
+        if (bytes[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t flashRead(zb_store_log_t *log, uint32_t offset, void *data, size_t size) {
+    esp_err_t err = log->flash.read(log->flash.context, offset, data, size);
+    log->stats.errors += err != ESP_OK;
+    return err;
+}
+
+static esp_err_t flashWrite(zb_store_log_t *log, uint32_t offset, const void *data, size_t size) {
+    esp_err_t err = log->flash.write(log->flash.context, offset, data, size);
+    log->stats.errors += err != ESP_OK;
+    return err;
+}
+
+static bool readSectorHeader(zb_store_log_t *log, uint32_t sector, zb_store_sector_header_t *header) {
+    return flashRead(log, sector * log->flash.sectorSize, header, SECTOR_HEADER_SIZE) == ESP_OK && header->magic == ZB_STORE_MAGIC &&
+           header->check == headerCheck(header) && header->firstLive <= header->sequence && header->sequence != 0;
+}
+
+void ZB_StoreLogInit(zb_store_log_t *log, const zb_store_flash_t *flash, uint32_t quietMs, uint32_t maxDelayMs) {
+    memset(log, 0, sizeof(*log));
+    log->flash = *flash;
+    log->quietMs = quietMs;
+    log->maxDelayMs = maxDelayMs;
+}
+
+esp_err_t ZB_StoreLogAdd(zb_store_log_t *log, uint8_t endpoint, uint16_t cluster, uint16_t attribute, uint8_t type,
+                         const void *defaultValue) {
+    if (log->mounted || findEntry(log, endpoint, cluster, attribute)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!ZbStoreTypeSupported(type) || defaultValue == NULL || valueLength(type, defaultValue) > ZB_STORE_MAX_VALUE_SIZE) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (log->count >= ZB_STORE_MAX_ATTRIBUTES) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    zb_store_entry_t *entry = &log->entries[log->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->endpoint = endpoint;
+    entry->cluster = cluster;
+    entry->attribute = attribute;
+    entry->type = type;
+    entry->length = valueLength(type, defaultValue);
+    entry->location = ZB_STORE_NO_LOCATION;
+    memcpy(entry->value, defaultValue, entry->length);
+    return ESP_OK;
+}
+
+/********************* Mount **************************/
+// Apply one sector's records in order; returns the offset of its free space, or sectorSize if a torn record closed it
+static uint32_t replaySector(zb_store_log_t *log, uint32_t sector, uint32_t sequence) {
+    uint32_t base = sector * log->flash.sectorSize;
+    uint32_t offset = SECTOR_HEADER_SIZE;
+    uint8_t buffer[MAX_RECORD_SIZE];
+
+    while (offset + RECORD_HEADER_SIZE <= log->flash.sectorSize) {
+        uint32_t available = log->flash.sectorSize - offset;
+        uint32_t size = available < sizeof(buffer) ? available : sizeof(buffer);
+        if (flashRead(log, base + offset, buffer, size) != ESP_OK) {
+            return log->flash.sectorSize;
+        }
+
+        zb_store_record_t record;
+        memcpy(&record, buffer, RECORD_HEADER_SIZE);
+        if (isBlank(&record, RECORD_HEADER_SIZE)) {
+            return offset;
+        }
+
+        const uint8_t *value = buffer + RECORD_HEADER_SIZE;
+        if (record.length > ZB_STORE_MAX_VALUE_SIZE || recordSize(record.length) > available || record.crc != recordCrc(&record, value)) {
+            log->stats.torn++;
+            return log->flash.sectorSize;
+        }
+
+        // Values are checked against the entry as it is now, so an attribute whose type changed keeps its default
+        zb_store_entry_t *entry = findEntry(log, record.endpoint, record.cluster, record.attribute);
+        if (entry && entry->type == record.type && valueLength(record.type, value) == record.length) {
+            memcpy(entry->value, value, record.length);
+            entry->length = record.length;
+            entry->location = base + offset;
+            entry->sequence = sequence;
+            if (!entry->restored) {
+                entry->restored = true;
+                log->stats.restored++;
+            }
+        }
+
+        log->stats.replayed++;
+        offset += recordSize(record.length);
+    }
+
+    return offset;
+}
+
+esp_err_t ZB_StoreLogMount(zb_store_log_t *log) {
+    const uint32_t sectorCount = log->flash.sectorCount;
+    zb_store_sector_header_t header;
+    zb_store_sector_header_t newest = {};
+    uint32_t newestSector = 0;
+
+    if (log->mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (sectorCount < ZB_STORE_LIVE_SECTORS + 2 || log->flash.sectorSize < SECTOR_HEADER_SIZE + 2 * ZB_STORE_MAX_ATTRIBUTES * MAX_RECORD_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (uint32_t sector = 0; sector < sectorCount; sector++) {
+        if (readSectorHeader(log, sector, &header) && header.sequence > newest.sequence) {
+            newest = header;
+            newestSector = sector;
+        }
+    }
+
+    log->mounted = true;
+    log->appendOffset = log->flash.sectorSize;
+    if (newest.sequence == 0) {
+        return ESP_OK;
+    }
+
+    // Sectors are opened in ring order, so the live ones sit just behind the newest
+    uint32_t span = newest.sequence - newest.firstLive;
+    span = span < sectorCount ? span : sectorCount - 1;
+
+    for (uint32_t back = span + 1; back-- > 0;) {
+        uint32_t sector = (newestSector + sectorCount - back) % sectorCount;
+        uint32_t sequence = newest.sequence - back;
+
+        if (!readSectorHeader(log, sector, &header) || header.sequence != sequence) {
+            continue;
+        }
+
+        uint32_t end = replaySector(log, sector, sequence);
+        log->stats.liveSectors++;
+
+        if (back == 0) {
+            log->activeSector = sector;
+            log->activeSequence = sequence;
+            log->appendOffset = end;
+        }
+    }
+
+    // Should the newest header be unreadable now, carry on from it anyway so its sequence is never reused
+    if (log->activeSequence == 0) {
+        log->activeSector = newestSector;
+        log->activeSequence = newest.sequence;
+    }
+    return ESP_OK;
+}
+
+const void *ZB_StoreLogGet(const zb_store_log_t *log, uint8_t endpoint, uint16_t cluster, uint16_t attribute) {
+    const zb_store_entry_t *entry = findEntry((zb_store_log_t *)log, endpoint, cluster, attribute);
+    return entry ? entry->value : NULL;
+}
+
+/********************* Shadow **************************/
+esp_err_t ZB_StoreLogSet(zb_store_log_t *log, uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value,
+                         uint32_t nowMs) {
+    zb_store_entry_t *entry = findEntry(log, endpoint, cluster, attribute);
+    if (entry == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t length = valueLength(entry->type, value);
+    if (length > ZB_STORE_MAX_VALUE_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (length == entry->length && memcmp(entry->value, value, length) == 0) {
+        return ESP_OK;
+    }
+
+    memcpy(entry->value, value, length);
+    entry->length = length;
+    entry->dirty = true;
+    log->stats.changes++;
+
+    if (!log->dirty) {
+        log->dirty = true;
+        log->firstChangeMs = nowMs;
+    }
+    log->lastChangeMs = nowMs;
+    return ESP_OK;
+}
+
+uint32_t ZB_StoreLogNextFlushDelay(const zb_store_log_t *log, uint32_t nowMs) {
+    if (!log->dirty) {
+        return ZB_STORE_NEVER;
+    }
+
+    uint32_t quietDue = log->lastChangeMs + log->quietMs;
+    uint32_t maxDue = log->firstChangeMs + log->maxDelayMs;
+    uint32_t due = isBefore(quietDue, maxDue) ? quietDue : maxDue;
+
+    return isBefore(nowMs, due) ? due - nowMs : 0;
+}
+
+uint8_t ZB_StoreLogCollect(zb_store_log_t *log, zb_store_batch_t *batch) {
+    bool remaining = false;
+
+    batch->length = 0;
+    batch->records = 0;
+    batch->written = 0;
+
+    for (uint8_t i = 0; i < log->count; i++) {
+        zb_store_entry_t *entry = &log->entries[i];
+        if (!entry->dirty) {
+            continue;
+        }
+
+        uint32_t size = recordSize(entry->length);
+        if (batch->length + size > ZB_STORE_BATCH_SIZE) {
+            remaining = true;
+            continue;
+        }
+
+        zb_store_record_t record = {};
+        record.cluster = entry->cluster;
+        record.attribute = entry->attribute;
+        record.endpoint = entry->endpoint;
+        record.type = entry->type;
+        record.length = entry->length;
+        record.crc = recordCrc(&record, entry->value);
+
+        // Padding stays erased, so only the bytes that carry data are programmed
+        uint8_t *data = batch->data + batch->length;
+        memset(data, 0xff, size);
+        memcpy(data, &record, RECORD_HEADER_SIZE);
+        memcpy(data + RECORD_HEADER_SIZE, entry->value, entry->length);
+
+        batch->entries[batch->records++] = i;
+        batch->length += size;
+        entry->dirty = false;
+    }
+
+    // Anything left over is due at once, on the next round
+    log->dirty = remaining;
+    return batch->records;
+}
+
+/********************* Log **************************/
+// Carry forward a record from a retiring sector; a record that no longer checks out is dropped rather than copied
+static esp_err_t copyRecord(zb_store_log_t *log, zb_store_entry_t *entry) {
+    uint8_t buffer[MAX_RECORD_SIZE];
+    zb_store_record_t record;
+
+    uint32_t available = log->flash.sectorSize - entry->location % log->flash.sectorSize;
+    esp_err_t err = flashRead(log, entry->location, buffer, available < sizeof(buffer) ? available : sizeof(buffer));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    memcpy(&record, buffer, RECORD_HEADER_SIZE);
+    if (record.length > ZB_STORE_MAX_VALUE_SIZE || recordSize(record.length) > available || record.crc != recordCrc(&record, buffer + RECORD_HEADER_SIZE)) {
+        entry->location = ZB_STORE_NO_LOCATION;
+        entry->sequence = 0;
+        return ESP_OK;
+    }
+
+    uint32_t size = recordSize(record.length);
+    uint32_t offset = log->activeSector * log->flash.sectorSize + log->appendOffset;
+    err = flashWrite(log, offset, buffer, size);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    entry->location = offset;
+    entry->sequence = log->activeSequence;
+    log->appendOffset += size;
+    log->stats.copies++;
+    log->stats.records++;
+    log->stats.bytes += size;
+    return ESP_OK;
+}
+
+/* Erase the next sector in the ring and make it the active one. Unless starting afresh, it first takes a copy of every
+ * record that would leave the live window, and its header keeps the oldest still referenced sector live until then.
+ */
+static esp_err_t openSector(zb_store_log_t *log, bool fresh) {
+    const uint32_t sector = log->activeSequence ? (log->activeSector + 1) % log->flash.sectorCount : 0;
+    const uint32_t sequence = log->activeSequence + 1;
+    const uint32_t retireBelow = sequence > ZB_STORE_LIVE_SECTORS ? sequence - ZB_STORE_LIVE_SECTORS + 1 : 1;
+
+    zb_store_sector_header_t header = {};
+    header.magic = ZB_STORE_MAGIC;
+    header.sequence = sequence;
+    header.firstLive = fresh ? sequence : retireBelow;
+
+    for (uint8_t i = 0; i < log->count && !fresh; i++) {
+        const zb_store_entry_t *entry = &log->entries[i];
+        if (entry->location != ZB_STORE_NO_LOCATION && entry->sequence < header.firstLive) {
+            header.firstLive = entry->sequence;
+        }
+    }
+    header.check = headerCheck(&header);
+
+    // Whatever happens next, this sector is spent: a failed open moves on to the one after rather than retrying it
+    log->activeSector = sector;
+    log->activeSequence = sequence;
+    log->appendOffset = log->flash.sectorSize;
+
+    esp_err_t err = log->flash.erase(log->flash.context, sector * log->flash.sectorSize, log->flash.sectorSize);
+    log->stats.errors += err != ESP_OK;
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->stats.erases++;
+
+    err = flashWrite(log, sector * log->flash.sectorSize, &header, SECTOR_HEADER_SIZE);
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->appendOffset = SECTOR_HEADER_SIZE;
+
+    for (uint8_t i = 0; i < log->count && !fresh && err == ESP_OK; i++) {
+        zb_store_entry_t *entry = &log->entries[i];
+        if (entry->location != ZB_STORE_NO_LOCATION && entry->sequence < retireBelow) {
+            err = copyRecord(log, entry);
+        }
+    }
+
+    if (err != ESP_OK) {
+        log->appendOffset = log->flash.sectorSize;
+    }
+    return err;
+}
+
+esp_err_t ZB_StoreLogWrite(zb_store_log_t *log, zb_store_batch_t *batch) {
+    uint32_t offset = 0;
+    uint8_t record = 0;
+
+    if (!log->mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    while (record < batch->records) {
+        uint32_t first = recordSize(batch->data[offset + offsetof(zb_store_record_t, length)]);
+        if (log->appendOffset + first > log->flash.sectorSize) {
+            esp_err_t err = openSector(log, false);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+
+        // As many whole records as fit in the active sector go out in one write
+        uint32_t chunk = 0;
+        uint8_t count = 0;
+        while (record + count < batch->records) {
+            uint32_t size = recordSize(batch->data[offset + chunk + offsetof(zb_store_record_t, length)]);
+            if (log->appendOffset + chunk + size > log->flash.sectorSize) {
+                break;
+            }
+            chunk += size;
+            count++;
+        }
+
+        uint32_t base = log->activeSector * log->flash.sectorSize + log->appendOffset;
+        esp_err_t err = flashWrite(log, base, batch->data + offset, chunk);
+        if (err != ESP_OK) {
+            // Part of it may be programmed; nothing more goes into this sector
+            log->appendOffset = log->flash.sectorSize;
+            return err;
+        }
+
+        for (uint32_t position = 0, i = 0; i < count; i++) {
+            zb_store_entry_t *entry = &log->entries[batch->entries[record + i]];
+            entry->location = base + position;
+            entry->sequence = log->activeSequence;
+            position += recordSize(batch->data[offset + position + offsetof(zb_store_record_t, length)]);
+        }
+
+        record += count;
+        batch->written = record;
+        log->appendOffset += chunk;
+        offset += chunk;
+        log->stats.records += count;
+        log->stats.bytes += chunk;
+    }
+
+    log->stats.flushes++;
+    return ESP_OK;
+}
+
+void ZB_StoreLogRequeue(zb_store_log_t *log, const zb_store_batch_t *batch, uint32_t nowMs) {
+    for (uint8_t record = batch->written; record < batch->records; record++) {
+        log->entries[batch->entries[record]].dirty = true;
+    }
+
+    if (batch->written < batch->records) {
+        if (!log->dirty) {
+            log->dirty = true;
+            log->firstChangeMs = nowMs;
+        }
+        log->lastChangeMs = nowMs;
+    }
+}
+
+esp_err_t ZB_StoreLogFlush(zb_store_log_t *log, uint32_t nowMs) {
+    zb_store_batch_t batch;
+
+    while (ZB_StoreLogCollect(log, &batch)) {
+        esp_err_t err = ZB_StoreLogWrite(log, &batch);
+        if (err != ESP_OK) {
+            ZB_StoreLogRequeue(log, &batch, nowMs);
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t ZB_StoreLogErase(zb_store_log_t *log) {
+    if (!log->mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    for (uint8_t i = 0; i < log->count; i++) {
+        log->entries[i].dirty = false;
+        log->entries[i].restored = false;
+        log->entries[i].location = ZB_STORE_NO_LOCATION;
+        log->entries[i].sequence = 0;
+    }
+    log->dirty = false;
+
+    return openSector(log, true);
+}
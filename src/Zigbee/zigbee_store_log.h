@@ -0,0 +1,218 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Log-structured attribute store
+ * Pure logic over an injected flash interface, with no clock or tasks of its own. A RAM shadow holds the current value
+ * of every persistent attribute; a change marks its entry dirty, and a flush appends all the dirty entries as one batch
+ * of CRC-checked records to the active sector, so a burst of updates costs one flash write and no erase.
+ *
+ * Sectors are opened round-robin across the whole partition, which spreads erases evenly over it. Only the newest
+ * ZB_STORE_LIVE_SECTORS hold live records: opening a sector first copies in every entry whose latest record would
+ * otherwise fall out of that window. Each sector header records the oldest sector still referenced, so mounting reads
+ * the headers, then replays just those sectors oldest first, in one pass. A record torn by power loss fails its CRC
+ * and closes its sector, leaving the previous copy of that attribute as its value.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_zigbee_type.h"
+
+#ifndef ZB_STORE_MAX_ATTRIBUTES
+#define ZB_STORE_MAX_ATTRIBUTES 16
+#endif
+
+#ifndef ZB_STORE_MAX_VALUE_SIZE
+#define ZB_STORE_MAX_VALUE_SIZE 32              /* bytes, so strings of up to 31 characters */
+#endif
+
+#ifndef ZB_STORE_BATCH_SIZE
+#define ZB_STORE_BATCH_SIZE 256                 /* record bytes per flash write, larger flushes take several */
+#endif
+
+#define ZB_STORE_LIVE_SECTORS 4                 /* sectors holding live records, the oldest of which is being retired */
+#define ZB_STORE_MAGIC 0x5453425A               /* "ZBST" */
+#define ZB_STORE_NEVER UINT32_MAX
+#define ZB_STORE_NO_LOCATION UINT32_MAX
+
+/* Default timings, in milliseconds */
+#define ZB_STORE_QUIET_MS 5000                  /* flush once attributes have been left alone this long */
+#define ZB_STORE_MAX_DELAY_MS 60000             /* but never hold a change for longer than this */
+
+/* Flash access, in partition offsets. Writes may only clear bits, as on NOR flash; erases are whole sectors. */
+typedef struct {
+    esp_err_t (*read)(void *context, uint32_t offset, void *data, size_t size);
+    esp_err_t (*write)(void *context, uint32_t offset, const void *data, size_t size);
+    esp_err_t (*erase)(void *context, uint32_t offset, size_t size);
+    void *context;
+    uint32_t sectorSize;
+    uint32_t sectorCount;                       /* at least ZB_STORE_LIVE_SECTORS + 2 */
+} zb_store_flash_t;
+
+/* At the start of every sector in use, followed by records */
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;                          /* counts up from 1 as sectors are opened */
+    uint32_t firstLive;                         /* oldest sequence whose records are still current */
+    uint32_t check;                             /* CRC-32 of the fields above */
+} zb_store_sector_header_t;
+
+/* Followed by the value, padded with 0xff to a multiple of 4 bytes. An all-0xff header is free space. */
+typedef struct {
+    uint32_t crc;                               /* CRC-32 of the rest of the header and the value */
+    uint16_t cluster;
+    uint16_t attribute;
+    uint8_t endpoint;
+    uint8_t type;
+    uint8_t length;
+    uint8_t reserved;                           /* 0 */
+} zb_store_record_t;
+
+typedef struct {
+    uint8_t endpoint;
+    uint16_t cluster;
+    uint16_t attribute;
+    uint8_t type;                               /* esp_zb_zcl_attr_type_t */
+    uint8_t length;                             /* bytes of value in use, a string's length prefix included */
+    bool dirty;
+    bool restored;
+    uint32_t location;                          /* partition offset of the latest record, or ZB_STORE_NO_LOCATION */
+    uint32_t sequence;                          /* of the sector holding it */
+    uint8_t value[ZB_STORE_MAX_VALUE_SIZE];
+} zb_store_entry_t;
+
+/* Dirty entries serialised for one flush */
+typedef struct {
+    uint16_t length;
+    uint8_t records;
+    uint8_t written;                            /* records that reached flash */
+    uint8_t entries[ZB_STORE_MAX_ATTRIBUTES];   /* entry index of each record */
+    uint8_t data[ZB_STORE_BATCH_SIZE];
+} zb_store_batch_t;
+
+typedef struct {
+    uint16_t restored;                          /* entries given a value from flash at mount */
+    uint16_t liveSectors;                       /* sectors replayed at mount */
+    uint32_t replayed;                          /* records read at mount */
+    uint32_t torn;                              /* records that failed their CRC at mount */
+    uint32_t changes;                           /* values set that differed from the shadow */
+    uint32_t flushes;                           /* batches written */
+    uint32_t records;                           /* records written, copies included */
+    uint32_t bytes;
+    uint32_t erases;
+    uint32_t copies;                            /* records carried forward out of a retiring sector */
+    uint32_t errors;                            /* flash operations that failed */
+} zb_store_stats_t;
+
+typedef struct {
+    zb_store_flash_t flash;
+    zb_store_entry_t entries[ZB_STORE_MAX_ATTRIBUTES];
+    uint8_t count;
+    uint32_t quietMs;
+    uint32_t maxDelayMs;
+    bool mounted;
+    bool dirty;
+    uint32_t firstChangeMs;                     /* of the oldest change not yet collected */
+    uint32_t lastChangeMs;
+    uint32_t activeSector;
+    uint32_t activeSequence;                    /* 0 until a sector has been opened */
+    uint32_t appendOffset;                      /* within the active sector, sectorSize once it is closed */
+    zb_store_stats_t stats;
+} zb_store_log_t;
+
+/* Fixed value size of the types the store holds, 0 for strings and types it cannot */
+constexpr uint8_t ZbStoreTypeSize(uint8_t type) {
+    switch (type) {
+        case ESP_ZB_ZCL_ATTR_TYPE_BOOL:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM:
+        case ESP_ZB_ZCL_ATTR_TYPE_U8:
+        case ESP_ZB_ZCL_ATTR_TYPE_S8:
+            return 1;
+        case ESP_ZB_ZCL_ATTR_TYPE_16BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_16BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM:
+        case ESP_ZB_ZCL_ATTR_TYPE_U16:
+        case ESP_ZB_ZCL_ATTR_TYPE_S16:
+            return 2;
+        case ESP_ZB_ZCL_ATTR_TYPE_U24:
+        case ESP_ZB_ZCL_ATTR_TYPE_S24:
+            return 3;
+        case ESP_ZB_ZCL_ATTR_TYPE_32BIT:
+        case ESP_ZB_ZCL_ATTR_TYPE_32BITMAP:
+        case ESP_ZB_ZCL_ATTR_TYPE_U32:
+        case ESP_ZB_ZCL_ATTR_TYPE_S32:
+        case ESP_ZB_ZCL_ATTR_TYPE_SINGLE:
+        case ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME:
+            return 4;
+        case ESP_ZB_ZCL_ATTR_TYPE_U48:
+            return 6;
+        case ESP_ZB_ZCL_ATTR_TYPE_U64:
+        case ESP_ZB_ZCL_ATTR_TYPE_S64:
+        case ESP_ZB_ZCL_ATTR_TYPE_DOUBLE:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+constexpr bool ZbStoreTypeSupported(uint8_t type) {
+    return ZbStoreTypeSize(type) != 0 || type == ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING || type == ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING;
+}
+
+void ZB_StoreLogInit(zb_store_log_t *log, const zb_store_flash_t *flash, uint32_t quietMs, uint32_t maxDelayMs);
+
+/* Add an attribute before mounting, starting from its default value; strings are in ZCL format, length byte first.
+ * ESP_ERR_NOT_SUPPORTED for types or defaults that do not fit, ESP_ERR_NO_MEM when full, ESP_ERR_INVALID_STATE if
+ * added twice or already mounted.
+ */
+esp_err_t ZB_StoreLogAdd(zb_store_log_t *log, uint8_t endpoint, uint16_t cluster, uint16_t attribute, uint8_t type,
+                         const void *defaultValue);
+
+/* Replay the live sectors into the shadow; records for attributes that were not added are skipped, and dropped the
+ * next time their sector is retired. An empty or foreign partition mounts with nothing restored.
+ */
+esp_err_t ZB_StoreLogMount(zb_store_log_t *log);
+
+/* Current value of an added attribute, or NULL */
+const void *ZB_StoreLogGet(const zb_store_log_t *log, uint8_t endpoint, uint16_t cluster, uint16_t attribute);
+
+/* Update the shadow, marking the entry dirty if the value changed.
+ * ESP_ERR_NOT_FOUND if the attribute was not added, ESP_ERR_INVALID_SIZE for a string longer than its entry holds.
+ */
+esp_err_t ZB_StoreLogSet(zb_store_log_t *log, uint8_t endpoint, uint16_t cluster, uint16_t attribute, const void *value,
+                         uint32_t nowMs);
+
+/* Delay until a flush is due, 0 if one is due now, ZB_STORE_NEVER while nothing is dirty */
+uint32_t ZB_StoreLogNextFlushDelay(const zb_store_log_t *log, uint32_t nowMs);
+
+/* A flush is split so the shadow only needs guarding while the batch is collected, not while flash is written:
+ * Collect serialises dirty entries into the batch, marking them clean, and returns how many it took (0 when none are
+ * dirty). Write appends the batch, opening sectors as needed; should it fail, Requeue marks whatever did not reach
+ * flash dirty again. Collect & Requeue touch the shadow, Write only the log, so a Set may run alongside a Write.
+ */
+uint8_t ZB_StoreLogCollect(zb_store_log_t *log, zb_store_batch_t *batch);
+esp_err_t ZB_StoreLogWrite(zb_store_log_t *log, zb_store_batch_t *batch);
+void ZB_StoreLogRequeue(zb_store_log_t *log, const zb_store_batch_t *batch, uint32_t nowMs);
+
+/* Collect, Write & Requeue until nothing is dirty, for callers with nothing to guard against */
+esp_err_t ZB_StoreLogFlush(zb_store_log_t *log, uint32_t nowMs);
+
+/* Forget every stored value by opening a sector that marks all older ones dead; the shadow keeps its values but is
+ * left clean. Costs one erase rather than wiping the partition.
+ */
+esp_err_t ZB_StoreLogErase(zb_store_log_t *log);
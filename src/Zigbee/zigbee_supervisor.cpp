@@ -0,0 +1,147 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <Arduino.h>
+#include "Zigbee/zigbee_supervisor.h"
+
+// xorshift32; only used to spread retries out, so quality hardly matters
+static uint32_t nextRandom(zb_supervisor_t *supervisor) {
+    uint32_t x = supervisor->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    supervisor->random = x;
+    return x;
+}
+
+// Exponential backoff with equal jitter: somewhere in the upper half of base * 2^(attempts - 1), capped at the maximum
+static uint32_t backoffDelay(zb_supervisor_t *supervisor) {
+    const zb_supervisor_config_t *config = supervisor->config;
+    uint32_t delay = config->baseDelayMs;
+
+    for (uint32_t i = 1; i < supervisor->status.attempts && delay < config->maxDelayMs; i++) {
+        delay *= 2;
+    }
+    if (delay > config->maxDelayMs) {
+        delay = config->maxDelayMs;
+    }
+
+    return delay / 2 + nextRandom(supervisor) % (delay / 2 + 1);
+}
+
+static zb_supervisor_action_t backOff(zb_supervisor_t *supervisor, zb_commissioning_state_t retrying, uint32_t *delayMs) {
+    supervisor->status.state = ZB_COMMISSIONING_BACKOFF;
+    supervisor->retrying = retrying;
+    supervisor->status.lastDelayMs = backoffDelay(supervisor);
+    *delayMs = supervisor->status.lastDelayMs;
+
+    return ZB_SUPERVISOR_ACTION_WAIT;
+}
+
+static zb_supervisor_action_t startStep(zb_supervisor_t *supervisor, zb_commissioning_state_t step) {
+    supervisor->status.state = step;
+    return step == ZB_COMMISSIONING_STEERING ? ZB_SUPERVISOR_ACTION_STEER : ZB_SUPERVISOR_ACTION_INITIALISE;
+}
+
+void ZB_SupervisorInit(zb_supervisor_t *supervisor, const zb_supervisor_config_t *config, uint32_t seed) {
+    memset(supervisor, 0, sizeof(*supervisor));
+    supervisor->config = config;
+    supervisor->status.state = ZB_COMMISSIONING_IDLE;
+    supervisor->random = seed ? seed : 0x2545f491;
+}
+
+zb_supervisor_action_t ZB_SupervisorStart(zb_supervisor_t *supervisor) {
+    supervisor->status.attempts = 0;
+    return startStep(supervisor, ZB_COMMISSIONING_INITIALISING);
+}
+
+zb_supervisor_action_t ZB_SupervisorOnInitialised(zb_supervisor_t *supervisor, bool success, bool factoryNew, uint32_t *delayMs) {
+    zb_commissioning_status_t *status = &supervisor->status;
+
+    if (success) {
+        status->attempts = 0;
+
+        if (factoryNew) {
+            return startStep(supervisor, ZB_COMMISSIONING_STEERING);
+        }
+
+        status->state = ZB_COMMISSIONING_JOINED;
+        status->joins++;
+        return ZB_SUPERVISOR_ACTION_NONE;
+    }
+
+    status->initFailures++;
+    status->attempts++;
+
+    if (supervisor->config->initAttempts && status->attempts >= supervisor->config->initAttempts) {
+        status->state = ZB_COMMISSIONING_FAILED;
+        return ZB_SUPERVISOR_ACTION_RESTART;
+    }
+
+    return backOff(supervisor, ZB_COMMISSIONING_INITIALISING, delayMs);
+}
+
+zb_supervisor_action_t ZB_SupervisorOnSteered(zb_supervisor_t *supervisor, bool success, uint32_t *delayMs) {
+    zb_commissioning_status_t *status = &supervisor->status;
+
+    if (success) {
+        status->state = ZB_COMMISSIONING_JOINED;
+        status->attempts = 0;
+        status->joins++;
+        return ZB_SUPERVISOR_ACTION_NONE;
+    }
+
+    status->steeringFailures++;
+    status->attempts++;
+
+    if (supervisor->config->steeringAttempts && status->attempts >= supervisor->config->steeringAttempts) {
+        status->state = ZB_COMMISSIONING_FAILED;
+        supervisor->retrying = ZB_COMMISSIONING_STEERING;
+        return ZB_SUPERVISOR_ACTION_NONE;
+    }
+
+    return backOff(supervisor, ZB_COMMISSIONING_STEERING, delayMs);
+}
+
+zb_supervisor_action_t ZB_SupervisorOnTimer(zb_supervisor_t *supervisor) {
+    // A retry may already have cut the wait short
+    if (supervisor->status.state != ZB_COMMISSIONING_BACKOFF) {
+        return ZB_SUPERVISOR_ACTION_NONE;
+    }
+
+    return startStep(supervisor, supervisor->retrying);
+}
+
+zb_supervisor_action_t ZB_SupervisorRetry(zb_supervisor_t *supervisor) {
+    zb_commissioning_state_t state = supervisor->status.state;
+
+    if (state != ZB_COMMISSIONING_BACKOFF && state != ZB_COMMISSIONING_FAILED) {
+        return ZB_SUPERVISOR_ACTION_NONE;
+    }
+
+    supervisor->status.attempts = 0;
+    return startStep(supervisor, supervisor->retrying);
+}
+
+const char *ZB_CommissioningStateToString(zb_commissioning_state_t state) {
+    switch (state) {
+        case ZB_COMMISSIONING_IDLE: return "idle";
+        case ZB_COMMISSIONING_INITIALISING: return "initialising";
+        case ZB_COMMISSIONING_STEERING: return "steering";
+        case ZB_COMMISSIONING_BACKOFF: return "backoff";
+        case ZB_COMMISSIONING_JOINED: return "joined";
+        case ZB_COMMISSIONING_FAILED: return "failed";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,86 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Commissioning supervisor
+ * Pure logic with no stack calls or timers of its own: the caller reports the outcome of BDB initialisation and
+ * network steering, and carries out the action returned. Failures are retried after an exponential backoff with
+ * per-device jitter, so a fleet that lost its coordinator does not come back at it in lockstep, and each kind of
+ * failure has a budget of consecutive attempts.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Defaults, see zb_supervisor_config_t */
+#define ZB_COMMISSIONING_BASE_DELAY_MS 1000
+#define ZB_COMMISSIONING_MAX_DELAY_MS 300000
+#define ZB_COMMISSIONING_INIT_ATTEMPTS 5
+#define ZB_COMMISSIONING_STEERING_ATTEMPTS 0
+
+typedef enum {
+    ZB_COMMISSIONING_IDLE,              /* stack not started yet */
+    ZB_COMMISSIONING_INITIALISING,      /* BDB initialisation, or the stack rejoining a stored network */
+    ZB_COMMISSIONING_STEERING,          /* looking for a network to join */
+    ZB_COMMISSIONING_BACKOFF,           /* waiting to retry whichever of the two failed */
+    ZB_COMMISSIONING_JOINED,
+    ZB_COMMISSIONING_FAILED,            /* steering budget spent, waiting for ZB_SupervisorRetry() */
+} zb_commissioning_state_t;
+
+typedef enum {
+    ZB_SUPERVISOR_ACTION_NONE,
+    ZB_SUPERVISOR_ACTION_INITIALISE,    /* start BDB initialisation */
+    ZB_SUPERVISOR_ACTION_STEER,         /* start network steering */
+    ZB_SUPERVISOR_ACTION_WAIT,          /* arm a timer for the returned delay, then call ZB_SupervisorOnTimer() */
+    ZB_SUPERVISOR_ACTION_RESTART,       /* initialisation budget spent, restart the device as a last resort */
+} zb_supervisor_action_t;
+
+typedef struct {
+    uint32_t baseDelayMs;               /* backoff before the first retry, doubling with each failure after */
+    uint32_t maxDelayMs;
+    uint8_t initAttempts;               /* initialisation failures in a row before restarting, 0 = never restart */
+    uint8_t steeringAttempts;           /* steering failures in a row before giving up, 0 = never give up */
+} zb_supervisor_config_t;
+
+typedef struct {
+    zb_commissioning_state_t state;
+    uint32_t attempts;                  /* failures in a row of the step being retried, unbounded if its budget is 0 */
+    uint32_t initFailures;
+    uint32_t steeringFailures;
+    uint32_t joins;
+    uint32_t lastDelayMs;
+} zb_commissioning_status_t;
+
+typedef struct {
+    const zb_supervisor_config_t *config;
+    zb_commissioning_status_t status;
+    zb_commissioning_state_t retrying;  /* step to run when the backoff timer expires */
+    uint32_t random;
+} zb_supervisor_t;
+
+/* Seed the jitter with something unique to the device, such as its IEEE address, so devices spread out */
+void ZB_SupervisorInit(zb_supervisor_t *supervisor, const zb_supervisor_config_t *config, uint32_t seed);
+
+zb_supervisor_action_t ZB_SupervisorStart(zb_supervisor_t *supervisor);
+
+/* Outcome of BDB initialisation; a device that is not factory new has rejoined its stored network */
+zb_supervisor_action_t ZB_SupervisorOnInitialised(zb_supervisor_t *supervisor, bool success, bool factoryNew, uint32_t *delayMs);
+
+zb_supervisor_action_t ZB_SupervisorOnSteered(zb_supervisor_t *supervisor, bool success, uint32_t *delayMs);
+
+zb_supervisor_action_t ZB_SupervisorOnTimer(zb_supervisor_t *supervisor);
+
+/* Retry now with a fresh budget when waiting to retry or given up; anything else carries on as it is */
+zb_supervisor_action_t ZB_SupervisorRetry(zb_supervisor_t *supervisor);
+
+const char *ZB_CommissioningStateToString(zb_commissioning_state_t state);
@@ -13,20 +13,56 @@
 // limitations under the License.
 
 #include <Arduino.h>
-#include <Adafruit_NeoPixel.h>
 
 #include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_attributes.h"
+#include "Zigbee/zigbee_dispatch.h"
+#include "Zigbee/zigbee_store.h"
 #include "Switches/switches.h"
+#include "Led/led.h"
+#include "Log/deferred_log.h"
+#include "Memory/memory_pool.h"
+#include "Sensors/sensors.h"
+
+// Every task the firmware creates has to fit the pools when they are statically allocated, or the last one started
+// would be missing on the device
+#define APP_TASK_COUNT 8
+#define APP_TASK_STACK_SIZE (DLOG_TASK_STACK_SIZE + ZB_MAIN_TASK_STACK_SIZE + ZB_DISPATCH_TASK_STACK + ZB_CONTROL_TASK_STACK_SIZE + \
+                             ZB_STORE_TASK_STACK_SIZE + ZB_OTA_TASK_STACK_SIZE + LED_TASK_STACK_SIZE + SENS_TASK_STACK_SIZE)
+static_assert(MEM_MAX_TASKS >= APP_TASK_COUNT, "MEM_MAX_TASKS is short of the tasks this firmware creates");
+static_assert(MEM_STACK_POOL_SIZE >= APP_TASK_STACK_SIZE, "MEM_STACK_POOL_SIZE is short of the stacks of the tasks this firmware creates");
+
+// Effects on the onboard LED
+static const led_effect_t identifyEffect = {LED_EFFECT_RAINBOW, 0, 1600, 0, 0};
+static const led_effect_t steeringEffect = {LED_EFFECT_BREATHE, 0x0000ff, 2000, 0, 0};
+static const led_effect_t commissioningFailedEffect = {LED_EFFECT_STATUS_CODE, 0xff0000, 250, 3, 0};
+
+/********************* Zigbee Device **************************/
+// Endpoints this device registers; add clusters & attributes here, see Zigbee/zigbee_device.h. Attributes flagged
+// ZB_ATTR_ACCESS_PERSISTENT keep their value across restarts
+// The client clusters let lights be bound to this endpoint, for the control switches in Switches/switches.h to drive
+static constexpr zb_cluster_desc_t appClusters[] = {
+    ZB_CLUSTER_NO_ATTRIBUTES(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE),
+    ZB_CLUSTER_NO_ATTRIBUTES(ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE),
+    ZB_CLUSTER_NO_ATTRIBUTES(ESP_ZB_ZCL_CLUSTER_ID_SCENES, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE),
+};
+static constexpr zb_endpoint_desc_t appEndpoints[] = {
+    ZB_ENDPOINT(HA_ESP_SENSOR_ENDPOINT, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, appClusters),
+};
+static constexpr zb_device_desc_t appDevice = ZB_DEVICE(appEndpoints);
+ZB_ASSERT_DEVICE_VALID(appDevice);
+
+/********************* Zigbee Attribute Handlers **************************/
+static void onIdentifyTimeUpdated(uint16_t identifyTime) {
+    log_i("Identify time set to %d seconds", identifyTime);
+}
 
-// Onboard WS2182 LED used by identify
-#define RGB_LED_PIN GPIO_NUM_8
-static Adafruit_NeoPixel rgbLed(1, RGB_LED_PIN, NEO_GRB + NEO_KHZ800);
+// Attribute writes this device handles, decoded and type-checked before the handler sees them
+typedef ZbAttributeRegistry<
+    ZbAttributeBinding<HA_ESP_SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, uint16_t, onIdentifyTimeUpdated>
+> AppAttributes;
 
 /********************* Zigbee Callbacks **************************/
-void onCreateClusters(esp_zb_cluster_list_t *clusterList) {
-
-}
-
 esp_err_t onAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message) {
     esp_err_t ret = ESP_OK;
 
@@ -36,13 +72,14 @@ esp_err_t onAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message)
     } else if (message->info.status != ESP_ZB_ZCL_STATUS_SUCCESS) {
         log_e("Received message: error status(%d)", message->info.status);
     } else {
-        log_i("Received message: endpoint(%d), cluster(0x%x), attribute(0x%x), data size(%d)", message->info.dst_endpoint, message->info.cluster, message->attribute.id,message->attribute.data.size);
-
-/*
-    Examples of accessing attribute value data
-    ----------------------------------------------
-    uint16_t attrValue = *(uint16_t *)(message->attribute.data.value);
-*/
+        ret = AppAttributes::dispatch(message);
+
+        if (ret == ESP_ERR_NOT_FOUND) {
+            log_i("Unhandled attribute: endpoint(%d), cluster(0x%x), attribute(0x%x), data size(%d)", message->info.dst_endpoint, message->info.cluster, message->attribute.id, message->attribute.data.size);
+            ret = ESP_OK;
+        } else if (ret != ESP_OK) {
+            log_w("Rejected attribute value: endpoint(%d), cluster(0x%x), attribute(0x%x), type(0x%x), data size(%d)", message->info.dst_endpoint, message->info.cluster, message->attribute.id, message->attribute.data.type, message->attribute.data.size);
+        }
     }
 
     return ret;
@@ -51,39 +88,41 @@ esp_err_t onAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message)
 esp_err_t onCustomClusterCommand(const esp_zb_zcl_custom_cluster_command_message_t *message) {
     esp_err_t ret = ESP_OK;
 
-    // handle any logic required when receiving a command
-    log_i("Receive Custom Cluster Command: 0x%x", message->info.command);
+    // handle any logic required when receiving a command, e.g. through a ZbCommandRegistry (Zigbee/zigbee_commands.h)
+    // whose cluster is claimed before the stack starts, so the registry sends the only Default Response
+    log_i("Receive Custom Cluster Command: 0x%x", message->info.command.id);
 
     return ret;
 }
 
-// Identify thread task
-static bool isZigbeeIdentifying = false;
-static void taskZigbeeIdentify(void *arg) {
-    log_i("Identify task started");
-    int16_t hue = 0;
-
-    while (isZigbeeIdentifying) {
-        rgbLed.rainbow(hue);
-        rgbLed.show();
-
-        hue += 1000;
-
-        delay(50);
+void onCommissioningState(zb_commissioning_state_t state) {
+    // handle any logic required as the device joins, e.g. offering ZB_RetryCommissioning() once steering has given up
+    log_i("Commissioning state: %s", ZB_CommissioningStateToString(state));
+
+    switch (state) {
+        case ZB_COMMISSIONING_STEERING:
+        case ZB_COMMISSIONING_BACKOFF:
+            LED_SetEffect(LED_SLOT_STATUS, &steeringEffect);
+            break;
+        case ZB_COMMISSIONING_FAILED:
+            LED_SetEffect(LED_SLOT_STATUS, &commissioningFailedEffect);
+            break;
+        case ZB_COMMISSIONING_JOINED:
+            LED_ClearEffect(LED_SLOT_STATUS);
+            // Stack peaks from bringing the stack up and joining, the busiest stretch of a boot
+            MEM_LogBudget("after join");
+            break;
+        default:
+            LED_ClearEffect(LED_SLOT_STATUS);
+            break;
     }
-    
-    rgbLed.clear();
-    rgbLed.show();
-
-    log_i("Identify task ended");
-    vTaskDelete(NULL);
 }
 
 void onZigbeeIdentify(bool isIdentifying) {
-    isZigbeeIdentifying = isIdentifying;
-
     if (isIdentifying) {
-        xTaskCreate(taskZigbeeIdentify, "identify_task", 2048, NULL, 10, NULL);
+        LED_SetEffect(LED_SLOT_IDENTIFY, &identifyEffect);
+    } else {
+        LED_ClearEffect(LED_SLOT_IDENTIFY);
     }
 }
 
@@ -94,20 +133,23 @@ void setup() {
     // Init switches
     SW_InitSwitches();
 
-    // Init LED for identify function
-    rgbLed.begin();
-    rgbLed.setBrightness(64);
-    rgbLed.clear();
-    rgbLed.show();
+    // Init LED effects, used by identify & commissioning status
+    LED_Init();
 
-    // Set our callbacks for Zigbee events
-    ZB_SetOnCreateClustersCallback(onCreateClusters);
+    // Set our device description & callbacks for Zigbee events
+    ZB_SetDeviceDescriptor(&appDevice);
     ZB_SetOnAttributeUpdatedCallback(onAttributeUpdated);
     ZB_SetOnCustomClusterCommandCallback(onCustomClusterCommand);
     ZB_SetOnIdentifyCallback(onZigbeeIdentify);
+    ZB_SetOnCommissioningStateCallback(onCommissioningState);
 
     // Start Zigbee task
     ZB_StartMainTask();
+
+    // Sample sensors into their attributes; add channels with SENS_AddChannel() first, see Sensors/sensors.h
+    SENS_Start();
+
+    MEM_LogBudget("at boot");
 }
 
 void loop() {
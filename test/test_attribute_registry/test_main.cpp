@@ -0,0 +1,161 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Attribute registry decoding checks and lookup cost with a device-sized binding table
+#include <Arduino.h>
+#include <unity.h>
+
+#include <chrono>
+
+#include "Zigbee/zigbee_attributes.h"
+
+static uint16_t lastU16;
+static int16_t lastS16;
+static bool lastBool;
+static char lastString[32];
+static uint32_t handled;
+
+static void onU16(uint16_t value) { lastU16 = value; handled++; }
+static void onS16(int16_t value) { lastS16 = value; handled++; }
+static void onBool(bool value) { lastBool = value; handled++; }
+static void onString(zb_char_string_t value) {
+    memcpy(lastString, value.data, value.length);
+    lastString[value.length] = '\0';
+    handled++;
+}
+
+typedef ZbAttributeRegistry<
+    ZbAttributeBinding<2, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, 0x0000, bool, onBool>,
+    ZbAttributeBinding<1, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, 0x0000, int16_t, onS16>,
+    ZbAttributeBinding<1, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, 0x0000, uint16_t, onU16>,
+    ZbAttributeBinding<1, ESP_ZB_ZCL_CLUSTER_ID_BASIC, 0x0010, zb_char_string_t, onString>
+> TestAttributes;
+
+// 48 bindings spread over 8 endpoints, roughly a multi-gang device
+template <uint16_t Attribute>
+using BenchBinding = ZbAttributeBinding<1 + Attribute % 8, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, Attribute, uint16_t, onU16>;
+
+template <typename Sequence>
+struct BenchRegistryFor;
+
+template <uint16_t... Attributes>
+struct BenchRegistryFor<std::integer_sequence<uint16_t, Attributes...>> {
+    typedef ZbAttributeRegistry<BenchBinding<Attributes>...> type;
+};
+
+typedef BenchRegistryFor<std::make_integer_sequence<uint16_t, 48>>::type BenchAttributes;
+
+static esp_zb_zcl_set_attr_value_message_t makeMessage(uint8_t endpoint, uint16_t cluster, uint16_t attribute, esp_zb_zcl_attr_type_t type,
+                                                       void *value, uint16_t size) {
+    esp_zb_zcl_set_attr_value_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.dst_endpoint = endpoint;
+    message.info.cluster = cluster;
+    message.attribute.id = attribute;
+    message.attribute.data.type = type;
+    message.attribute.data.size = size;
+    message.attribute.data.value = value;
+    return message;
+}
+
+void setUp() {
+    handled = 0;
+}
+
+void tearDown() {
+}
+
+void test_dispatches_typed_values() {
+    uint16_t u16 = 0x1234;
+    int16_t s16 = -2150;
+    uint8_t on = 1;
+
+    esp_zb_zcl_set_attr_value_message_t message = makeMessage(1, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, 0x0000, ESP_ZB_ZCL_ATTR_TYPE_U16, &u16, sizeof(u16));
+    TEST_ASSERT_EQUAL(ESP_OK, TestAttributes::dispatch(&message));
+    TEST_ASSERT_EQUAL(0x1234, lastU16);
+
+    message = makeMessage(1, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, 0x0000, ESP_ZB_ZCL_ATTR_TYPE_S16, &s16, sizeof(s16));
+    TEST_ASSERT_EQUAL(ESP_OK, TestAttributes::dispatch(&message));
+    TEST_ASSERT_EQUAL(-2150, lastS16);
+
+    message = makeMessage(2, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, 0x0000, ESP_ZB_ZCL_ATTR_TYPE_BOOL, &on, sizeof(on));
+    TEST_ASSERT_EQUAL(ESP_OK, TestAttributes::dispatch(&message));
+    TEST_ASSERT_TRUE(lastBool);
+    TEST_ASSERT_EQUAL(3, handled);
+}
+
+void test_string_is_a_view_into_the_message() {
+    uint8_t raw[] = {5, 'h', 'e', 'l', 'l', 'o', 0xff};
+
+    esp_zb_zcl_set_attr_value_message_t message = makeMessage(1, ESP_ZB_ZCL_CLUSTER_ID_BASIC, 0x0010, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, raw, sizeof(raw));
+    TEST_ASSERT_EQUAL(ESP_OK, TestAttributes::dispatch(&message));
+    TEST_ASSERT_EQUAL_STRING("hello", lastString);
+
+    // Length prefix claiming more than the buffer holds
+    raw[0] = 9;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, TestAttributes::dispatch(&message));
+    TEST_ASSERT_EQUAL(1, handled);
+}
+
+void test_rejects_wrong_type_or_size() {
+    uint32_t u32 = 7;
+    uint16_t u16 = 7;
+
+    esp_zb_zcl_set_attr_value_message_t message = makeMessage(1, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, 0x0000, ESP_ZB_ZCL_ATTR_TYPE_U32, &u32, sizeof(u32));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, TestAttributes::dispatch(&message));
+
+    message = makeMessage(1, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, 0x0000, ESP_ZB_ZCL_ATTR_TYPE_U16, &u16, 1);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, TestAttributes::dispatch(&message));
+
+    message = makeMessage(1, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, 0x0000, ESP_ZB_ZCL_ATTR_TYPE_U16, NULL, sizeof(u16));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, TestAttributes::dispatch(&message));
+    TEST_ASSERT_EQUAL(0, handled);
+}
+
+void test_unbound_attribute_is_not_found() {
+    uint16_t u16 = 1;
+
+    esp_zb_zcl_set_attr_value_message_t message = makeMessage(3, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, 0x0000, ESP_ZB_ZCL_ATTR_TYPE_U16, &u16, sizeof(u16));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, TestAttributes::dispatch(&message));
+}
+
+void test_bench_lookup() {
+    const int iterations = 1000000;
+    uint16_t value = 0;
+    esp_zb_zcl_set_attr_value_message_t messages[48];
+
+    for (uint16_t i = 0; i < 48; i++) {
+        messages[i] = makeMessage(1 + i % 8, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, i, ESP_ZB_ZCL_ATTR_TYPE_U16, &value, sizeof(value));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        value = i;
+        BenchAttributes::dispatch(&messages[i % 48]);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    TEST_ASSERT_EQUAL(iterations, handled);
+    printf("[bench] %zu bindings: %.1f ns per decoded dispatch\n", BenchAttributes::size(), (double)elapsed / iterations);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_dispatches_typed_values);
+    RUN_TEST(test_string_is_a_view_into_the_message);
+    RUN_TEST(test_rejects_wrong_type_or_size);
+    RUN_TEST(test_unbound_attribute_is_not_found);
+    RUN_TEST(test_bench_lookup);
+    return UNITY_END();
+}
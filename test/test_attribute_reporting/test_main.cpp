@@ -0,0 +1,364 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Reporting engine scheduling & coalescing against a simulated clock, and the report frames the application sends
+#include <Arduino.h>
+#include <unity.h>
+
+#include <mutex>
+#include <vector>
+
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_reporting.h"
+#include "host_platform.h"
+
+#define SENSOR_ENDPOINT 1
+#define ATTR_MEASURED_VALUE 0x0000
+#define ATTR_TOLERANCE 0x0003
+
+static zb_reporting_engine_t engine;
+static uint32_t now;
+
+static zb_reporting_config_t makeConfig(uint16_t cluster, uint16_t attribute, esp_zb_zcl_attr_type_t type, uint16_t minIntervalS,
+                                        uint16_t maxIntervalS, uint32_t reportableChange) {
+    zb_reporting_config_t config = {};
+    config.endpoint = SENSOR_ENDPOINT;
+    config.cluster = cluster;
+    config.attribute = attribute;
+    config.type = type;
+    config.minIntervalS = minIntervalS;
+    config.maxIntervalS = maxIntervalS;
+    config.reportableChange.integer = reportableChange;
+    return config;
+}
+
+static void add(uint16_t cluster, uint16_t attribute, esp_zb_zcl_attr_type_t type, uint16_t minIntervalS, uint16_t maxIntervalS,
+                uint32_t reportableChange) {
+    zb_reporting_config_t config = makeConfig(cluster, attribute, type, minIntervalS, maxIntervalS, reportableChange);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ReportingEngineAdd(&engine, &config));
+}
+
+static void setS16(uint16_t cluster, uint16_t attribute, int16_t value) {
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ReportingEngineSetValue(&engine, SENSOR_ENDPOINT, cluster, attribute, &value, now));
+}
+
+// Advance the simulated clock to the engine's next deadline, as the scheduler alarm would, and collect its frames
+static std::vector<zb_reporting_frame_t> runUntil(uint32_t until) {
+    std::vector<zb_reporting_frame_t> frames;
+
+    while (true) {
+        uint32_t delay = ZB_ReportingEngineNextDelay(&engine, now);
+        if (delay == ZB_REPORTING_NEVER || now + delay > until) {
+            now = until;
+            return frames;
+        }
+
+        now += delay;
+        zb_reporting_frame_t frame;
+        while (ZB_ReportingEngineNextFrame(&engine, now, &frame)) {
+            frames.push_back(frame);
+        }
+    }
+}
+
+static int16_t recordS16(const zb_reporting_frame_t &frame, uint16_t attribute) {
+    for (uint16_t offset = 0; offset < frame.length;) {
+        uint16_t id = frame.payload[offset] | frame.payload[offset + 1] << 8;
+        if (id == attribute) {
+            return (int16_t)(frame.payload[offset + 3] | frame.payload[offset + 4] << 8);
+        }
+        offset += 5;
+    }
+
+    TEST_FAIL_MESSAGE("attribute not in frame");
+    return 0;
+}
+
+void setUp() {
+    ZB_ReportingEngineInit(&engine, ZB_REPORTING_BATCH_DELAY_MS, ZB_REPORTING_COALESCE_WINDOW_MS);
+    now = 1000;
+}
+
+void tearDown() {
+}
+
+void test_first_value_reported_after_batch_delay() {
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 50);
+    TEST_ASSERT_EQUAL_UINT32(ZB_REPORTING_NEVER, ZB_ReportingEngineNextDelay(&engine, now));
+
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2150);
+    TEST_ASSERT_EQUAL_UINT32(ZB_REPORTING_BATCH_DELAY_MS, ZB_ReportingEngineNextDelay(&engine, now));
+
+    std::vector<zb_reporting_frame_t> frames = runUntil(now + 1000);
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL(1, frames[0].recordCount);
+    TEST_ASSERT_EQUAL(2150, recordS16(frames[0], ATTR_MEASURED_VALUE));
+    TEST_ASSERT_EQUAL_UINT32(ZB_REPORTING_NEVER, ZB_ReportingEngineNextDelay(&engine, now));
+}
+
+void test_threshold_and_min_interval() {
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 10, 0, 50);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, -100);
+    TEST_ASSERT_EQUAL(1, runUntil(now + 1000).size());
+
+    // Below the reportable change: nothing, even well past the minimum interval
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, -140);
+    TEST_ASSERT_EQUAL(0, runUntil(now + 60000).size());
+
+    // A reportable change right after a report waits out the minimum interval
+    std::vector<zb_reporting_frame_t> frames;
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, -150);
+    frames = runUntil(now + 1000);
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL(-150, recordS16(frames[0], ATTR_MEASURED_VALUE));
+
+    uint32_t reportedAt = now - 1000 + ZB_REPORTING_BATCH_DELAY_MS;
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 0);
+    TEST_ASSERT_EQUAL_UINT32(reportedAt + 10000 - now, ZB_ReportingEngineNextDelay(&engine, now));
+    TEST_ASSERT_EQUAL(0, runUntil(reportedAt + 9999).size());
+    TEST_ASSERT_EQUAL(1, runUntil(reportedAt + 10000).size());
+}
+
+void test_float_threshold_below_one() {
+    zb_reporting_config_t config = makeConfig(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_SINGLE, 0, 0, 0);
+    config.reportableChange.single = 0.5f;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ReportingEngineAdd(&engine, &config));
+
+    float value = 21.0f;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ReportingEngineSetValue(&engine, SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, &value, now));
+    TEST_ASSERT_EQUAL(1, runUntil(now + 1000).size());
+
+    // A fraction of a degree under the threshold is held back, half a degree is reported
+    value = 21.3f;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ReportingEngineSetValue(&engine, SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, &value, now));
+    TEST_ASSERT_EQUAL(0, runUntil(now + 60000).size());
+
+    value = 21.5f;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ReportingEngineSetValue(&engine, SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, &value, now));
+    TEST_ASSERT_EQUAL(1, runUntil(now + 1000).size());
+}
+
+void test_drifting_back_cancels_pending_report() {
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 30, 0, 50);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2000);
+    runUntil(now + 1000);
+
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2100);
+    runUntil(now + 5000);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2010);
+    TEST_ASSERT_EQUAL(0, runUntil(now + 60000).size());
+}
+
+void test_max_interval_reports_unchanged_value() {
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 60, 50);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2000);
+
+    // The initial report after the batch delay, then one every 60s
+    std::vector<zb_reporting_frame_t> frames = runUntil(now + 600000);
+    TEST_ASSERT_EQUAL(10, frames.size());
+    TEST_ASSERT_EQUAL_UINT32(ZB_REPORTING_BATCH_DELAY_MS, ZB_ReportingEngineNextDelay(&engine, now));
+}
+
+void test_changes_in_one_cluster_share_a_frame() {
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 50);
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 0);
+    add(ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 100);
+
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2000);
+    now += 20;
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, 10);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT, ATTR_MEASURED_VALUE, 5500);
+
+    std::vector<zb_reporting_frame_t> frames = runUntil(now + 1000);
+    TEST_ASSERT_EQUAL(2, frames.size());
+    TEST_ASSERT_EQUAL(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, frames[0].cluster);
+    TEST_ASSERT_EQUAL(2, frames[0].recordCount);
+    TEST_ASSERT_EQUAL(10, recordS16(frames[0], ATTR_TOLERANCE));
+    TEST_ASSERT_EQUAL(ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT, frames[1].cluster);
+
+    // A sub-threshold change rides along with a reportable one from the same cluster
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2010);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, 20);
+    frames = runUntil(now + 1000);
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL(2010, recordS16(frames[0], ATTR_MEASURED_VALUE));
+}
+
+void test_nearly_due_periodic_report_rides_along() {
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 50);
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 60, 0);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2000);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, 10);
+    TEST_ASSERT_EQUAL(1, runUntil(now + 1000).size());
+
+    // Tolerance is due in 60s; a measured value change 57s in takes it along instead of it going out 3s later
+    runUntil(now + 56000);
+    setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, 2100);
+    std::vector<zb_reporting_frame_t> frames = runUntil(now + 10000);
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL(2, frames[0].recordCount);
+}
+
+void test_large_batches_are_split() {
+    const int count = ZB_REPORTING_MAX_ATTRIBUTES;
+    for (int i = 0; i < count; i++) {
+        add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, i, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 0);
+        setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, i, i);
+    }
+
+    std::vector<zb_reporting_frame_t> frames = runUntil(now + 1000);
+    int records = 0;
+    for (const zb_reporting_frame_t &frame : frames) {
+        TEST_ASSERT_TRUE(frame.length <= ZB_REPORTING_MAX_FRAME_SIZE);
+        records += frame.recordCount;
+    }
+
+    TEST_ASSERT_EQUAL((count * 5 + ZB_REPORTING_MAX_FRAME_SIZE - 1) / ZB_REPORTING_MAX_FRAME_SIZE, frames.size());
+    TEST_ASSERT_EQUAL(count, records);
+}
+
+void test_rejects_unreportable_attributes() {
+    zb_reporting_config_t config = makeConfig(ESP_ZB_ZCL_CLUSTER_ID_BASIC, 0x0005, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, ZB_ReportingEngineAdd(&engine, &config));
+
+    config = makeConfig(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ReportingEngineAdd(&engine, &config));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ZB_ReportingEngineAdd(&engine, &config));
+
+    int16_t value = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_ReportingEngineSetValue(&engine, SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, &value, now));
+}
+
+// A day of a temperature/humidity sensor sampled every 10s: frames sent against the one-frame-per-attribute baseline
+void test_bench_sensor_day() {
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 30, 600, 20);
+    add(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, ESP_ZB_ZCL_ATTR_TYPE_S16, 30, 600, 5);
+    add(ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 30, 600, 100);
+
+    uint32_t seed = 12345;
+    int16_t temperature = 2000, humidity = 5000;
+    for (int sample = 0; sample < 24 * 360; sample++) {
+        seed = seed * 1103515245 + 12345;
+        temperature += (int16_t)((seed >> 16) % 21) - 10;
+        humidity += (int16_t)((seed >> 8) % 41) - 20;
+
+        setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, temperature);
+        setS16(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, (int16_t)(10 + (seed >> 24) % 8));
+        setS16(ESP_ZB_ZCL_CLUSTER_ID_REL_HUMIDITY_MEASUREMENT, ATTR_MEASURED_VALUE, humidity);
+        runUntil(now + 10000);
+    }
+
+    TEST_ASSERT_TRUE(engine.frames < engine.records);
+    printf("[bench] sensor day: %u attribute reports in %u frames (%.0f%% of one frame per attribute)\n", (unsigned)engine.records,
+           (unsigned)engine.frames, 100.0 * engine.frames / engine.records);
+}
+
+/********************* Application path **************************/
+static std::mutex framesMutex;
+static std::vector<std::vector<uint8_t>> sentFrames;
+
+static constexpr int16_t zero = 0;
+static constexpr zb_attribute_desc_t temperatureAttributes[] = {
+    {ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &zero},
+    {ATTR_TOLERANCE, ESP_ZB_ZCL_ATTR_TYPE_S16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &zero},
+};
+static constexpr zb_cluster_desc_t sensorClusters[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, temperatureAttributes),
+};
+static constexpr zb_endpoint_desc_t sensorEndpoints[] = {
+    ZB_ENDPOINT(SENSOR_ENDPOINT, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, sensorClusters),
+};
+static constexpr zb_device_desc_t sensorDevice = ZB_DEVICE(sensorEndpoints);
+ZB_ASSERT_DEVICE_VALID(sensorDevice);
+
+void test_application_sends_coalesced_report() {
+    HOST_ZbSetApsDataHook([](const esp_zb_apsde_data_req_t *req) {
+        // Runs on the stack task, so only record the frame; reports to anything but the binding table are dropped
+        std::lock_guard<std::mutex> lock(framesMutex);
+        if (req->dst_addr_mode == ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT && req->src_endpoint == SENSOR_ENDPOINT &&
+            req->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT && req->profile_id == ESP_ZB_AF_HA_PROFILE_ID) {
+            sentFrames.push_back(std::vector<uint8_t>(req->asdu, req->asdu + req->asdu_length));
+        }
+    });
+
+    zb_reporting_config_t measured = makeConfig(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 50);
+    zb_reporting_config_t tolerance = makeConfig(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, ESP_ZB_ZCL_ATTR_TYPE_S16, 0, 0, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_AddReportableAttribute(&measured));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_AddReportableAttribute(&tolerance));
+
+    ZB_SetDeviceDescriptor(&sensorDevice);
+    ZB_StartMainTask();
+
+    for (int i = 0; i < 100 && !esp_zb_bdb_dev_joined(); i++) {
+        delay(10);
+    }
+    TEST_ASSERT_TRUE(esp_zb_bdb_dev_joined());
+
+    int16_t value = 2150;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_SetAttributeValue(SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_MEASURED_VALUE, &value));
+    value = 25;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_SetAttributeValue(SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ATTR_TOLERANCE, &value));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ZB_SetAttributeValue(SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, 0x0000, &value));
+
+    delay(ZB_REPORTING_BATCH_DELAY_MS + 100);
+
+    std::lock_guard<std::mutex> lock(framesMutex);
+    const uint8_t expected[] = {ZCL_FRAME_CONTROL_REPORT, 0, ZCL_CMD_REPORT_ATTRIBUTES, 0x00, 0x00, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x66, 0x08,
+                                0x03, 0x00, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x19, 0x00};
+    TEST_ASSERT_EQUAL(1, sentFrames.size());
+    TEST_ASSERT_EQUAL(sizeof(expected), sentFrames[0].size());
+    TEST_ASSERT_EQUAL_MEMORY(expected, sentFrames[0].data(), sizeof(expected));
+}
+
+// A value written over the air is reported to the bindings as an application write would be
+void test_remote_write_is_reported() {
+    int16_t value = 40;
+    esp_zb_zcl_set_attr_value_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.dst_endpoint = SENSOR_ENDPOINT;
+    message.info.cluster = ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT;
+    message.attribute.id = ATTR_TOLERANCE;
+    message.attribute.data.type = ESP_ZB_ZCL_ATTR_TYPE_S16;
+    message.attribute.data.size = sizeof(value);
+    message.attribute.data.value = &value;
+
+    HOST_ZbInvokeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &message);
+    delay(ZB_REPORTING_BATCH_DELAY_MS + 100);
+
+    std::lock_guard<std::mutex> lock(framesMutex);
+    const uint8_t expected[] = {0x03, 0x00, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x28, 0x00};
+    TEST_ASSERT_EQUAL(2, sentFrames.size());
+    TEST_ASSERT_EQUAL(3 + sizeof(expected), sentFrames[1].size());
+    TEST_ASSERT_EQUAL_HEX8(ZCL_CMD_REPORT_ATTRIBUTES, sentFrames[1][2]);
+    TEST_ASSERT_EQUAL_MEMORY(expected, sentFrames[1].data() + 3, sizeof(expected));
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_first_value_reported_after_batch_delay);
+    RUN_TEST(test_threshold_and_min_interval);
+    RUN_TEST(test_float_threshold_below_one);
+    RUN_TEST(test_drifting_back_cancels_pending_report);
+    RUN_TEST(test_max_interval_reports_unchanged_value);
+    RUN_TEST(test_changes_in_one_cluster_share_a_frame);
+    RUN_TEST(test_nearly_due_periodic_report_rides_along);
+    RUN_TEST(test_large_batches_are_split);
+    RUN_TEST(test_rejects_unreportable_attributes);
+    RUN_TEST(test_bench_sensor_day);
+    RUN_TEST(test_application_sends_coalesced_report);
+    RUN_TEST(test_remote_write_is_reported);
+    return UNITY_END();
+}
@@ -0,0 +1,385 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Shadow cache seqlock consistency under concurrent readers, and lock-free reads & batched writes on a running device
+#include <Arduino.h>
+#include <unity.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_reporting.h"
+#include "Zigbee/zigbee_shadow_cache.h"
+#include "host_platform.h"
+
+#define ENDPOINT 1
+#define CLUSTER_ID_SETTINGS 0xFC30
+#define ATTR_ON_OFF 0x0000
+#define ATTR_LEVEL 0x0000
+#define ATTR_COUNTER 0x0001
+#define ATTR_TOTAL 0x0002
+#define ATTR_LABEL 0x0003
+
+static zb_shadow_cache_t cache;
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void seal() {
+    ZB_ShadowCacheInit(&cache);
+
+    uint8_t level = 10;
+    uint32_t counter = 0;
+    uint64_t total = 0;
+    bool on = false;
+
+    // Out of order, so the table has to sort them
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheAdd(&cache, 2, CLUSTER_ID_SETTINGS, ATTR_TOTAL, ESP_ZB_ZCL_ATTR_TYPE_U64, &total));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheAdd(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, ESP_ZB_ZCL_ATTR_TYPE_U32, &counter));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheAdd(&cache, ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ATTR_ON_OFF, ESP_ZB_ZCL_ATTR_TYPE_BOOL, &on));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheAdd(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, ESP_ZB_ZCL_ATTR_TYPE_U8, &level));
+    ZB_ShadowCacheSeal(&cache);
+}
+
+void test_entries_sorted_and_checked() {
+    ZB_ShadowCacheInit(&cache);
+
+    uint16_t zero = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, ZB_ShadowCacheAdd(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, "\x00"));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, ZB_ShadowCacheAdd(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, ESP_ZB_ZCL_ATTR_TYPE_U8, NULL));
+
+    for (uint16_t i = 0; i < ZB_SHADOW_MAX_ATTRIBUTES; i++) {
+        uint16_t attribute = (uint16_t)((i * 7919) % ZB_SHADOW_MAX_ATTRIBUTES);
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheAdd(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, attribute, ESP_ZB_ZCL_ATTR_TYPE_U16, &attribute));
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ZB_ShadowCacheAdd(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, 3, ESP_ZB_ZCL_ATTR_TYPE_U16, &zero));
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, ZB_ShadowCacheAdd(&cache, 2, CLUSTER_ID_SETTINGS, 3, ESP_ZB_ZCL_ATTR_TYPE_U16, &zero));
+
+    // Nothing is visible until the table is sealed, and nothing can be added after
+    uint16_t value;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, 3, &value, sizeof(value), NULL));
+    ZB_ShadowCacheSeal(&cache);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ZB_ShadowCacheAdd(&cache, 2, CLUSTER_ID_SETTINGS, 3, ESP_ZB_ZCL_ATTR_TYPE_U16, &zero));
+
+    for (uint16_t attribute = 0; attribute < ZB_SHADOW_MAX_ATTRIBUTES; attribute++) {
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, attribute, &value, sizeof(value), NULL));
+        TEST_ASSERT_EQUAL_UINT16(attribute, value);
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ZB_SHADOW_MAX_ATTRIBUTES, &value, sizeof(value), NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, 3, &value, 1, NULL));
+}
+
+void test_version_moves_with_the_value() {
+    seal();
+
+    uint8_t level;
+    uint32_t version, before;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level, sizeof(level), &before));
+    TEST_ASSERT_EQUAL_UINT8(10, level);
+
+    // Writing the value it already has is not a change
+    level = 10;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheSet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level, sizeof(level), &version));
+    TEST_ASSERT_EQUAL_UINT32(before, version);
+    TEST_ASSERT_EQUAL_UINT32(0, cache.writes);
+
+    level = 200;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheSet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level));
+    level = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level, sizeof(level), &version));
+    TEST_ASSERT_EQUAL_UINT8(200, level);
+    TEST_ASSERT_EQUAL_UINT32(before + 1, version);
+
+    // Neighbouring entries are untouched
+    uint32_t counter = 1;
+    bool on = true;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &counter, sizeof(counter), &version));
+    TEST_ASSERT_EQUAL_UINT32(0, counter);
+    TEST_ASSERT_EQUAL_UINT32(0, version);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheGet(&cache, ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ATTR_ON_OFF, &on, sizeof(on), NULL));
+    TEST_ASSERT_FALSE(on);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_ShadowCacheSet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL, &level));
+    TEST_ASSERT_EQUAL_UINT32(1, cache.writes);
+}
+
+void test_batch_replaces_and_fills() {
+    seal();
+
+    zb_attribute_batch_t batch = {};
+    uint8_t level = 1;
+    uint32_t counter = 0x12345678;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheBatchAdd(&cache, &batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheBatchAdd(&cache, &batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &counter));
+    level = 2;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheBatchAdd(&cache, &batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_ShadowCacheBatchAdd(&cache, &batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL, &level));
+
+    TEST_ASSERT_EQUAL_UINT8(2, batch.count);
+    TEST_ASSERT_EQUAL_UINT8(1, batch.writes[0].size);
+    TEST_ASSERT_EQUAL_UINT8(2, batch.writes[0].value[0]);
+    TEST_ASSERT_EQUAL_UINT8(4, batch.writes[1].size);
+    TEST_ASSERT_EQUAL_MEMORY(&counter, batch.writes[1].value, sizeof(counter));
+
+    batch.count = ZB_ATTRIBUTE_BATCH_SIZE;
+    bool on = true;
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, ZB_ShadowCacheBatchAdd(&cache, &batch, ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ATTR_ON_OFF, &on));
+}
+
+// One writer stores values whose halves mirror each other; no reader may ever see a mix of two writes
+void test_readers_never_see_torn_values() {
+    seal();
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint32_t> torn(0);
+    std::atomic<uint64_t> reads(0);
+    std::vector<std::thread> readers;
+
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&]() {
+            const zb_shadow_entry_t *entry = ZB_ShadowCacheFind(&cache, 2, CLUSTER_ID_SETTINGS, ATTR_TOTAL);
+            uint64_t count = 0;
+            uint32_t lastVersion = 0;
+
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint64_t total;
+                uint32_t version;
+                ZB_ShadowCacheRead(entry, &total, &version);
+
+                if ((uint32_t)(total >> 32) != (uint32_t)~(uint32_t)total && total != 0) {
+                    torn++;
+                }
+                if (version < lastVersion) {
+                    torn++;
+                }
+                lastVersion = version;
+                count++;
+            }
+            reads += count;
+        });
+    }
+
+    uint32_t writes = 200000;
+    for (uint32_t i = 1; i <= writes; i++) {
+        uint64_t total = ((uint64_t)~i << 32) | i;
+        ZB_ShadowCacheSet(&cache, 2, CLUSTER_ID_SETTINGS, ATTR_TOTAL, &total);
+    }
+    stop = true;
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+
+    uint64_t total;
+    uint32_t version;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_ShadowCacheGet(&cache, 2, CLUSTER_ID_SETTINGS, ATTR_TOTAL, &total, sizeof(total), &version));
+    TEST_ASSERT_EQUAL_UINT32(writes, (uint32_t)total);
+    TEST_ASSERT_EQUAL_UINT32(writes, version);
+    TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+    TEST_ASSERT_TRUE(reads.load() > 0);
+}
+
+// A poller reading one attribute while the stack task updates it: lock-free reads against taking a lock for each
+void test_bench_polling_reads() {
+    seal();
+
+    const uint32_t polls = 1000000;
+    std::mutex lock;
+    uint32_t lockedCounter = 0;
+    std::atomic<bool> stop(false);
+
+    auto timeReads = [&](bool locked) {
+        stop = false;
+        std::thread writer([&]() {
+            for (uint32_t i = 0; !stop.load(std::memory_order_relaxed); i++) {
+                if (locked) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    lockedCounter = i;
+                } else {
+                    ZB_ShadowCacheSet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &i);
+                }
+                std::this_thread::yield();
+            }
+        });
+
+        uint32_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < polls; i++) {
+            uint32_t counter;
+            if (locked) {
+                std::lock_guard<std::mutex> guard(lock);
+                counter = lockedCounter;
+            } else {
+                ZB_ShadowCacheGet(&cache, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &counter, sizeof(counter), NULL);
+            }
+            sum += counter;
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / polls;
+
+        stop = true;
+        writer.join();
+        TEST_ASSERT_TRUE(sum != 0 || polls == 0);
+        return ns;
+    };
+
+    double lockedNs = timeReads(true);
+    double sharedNs = timeReads(false);
+    printf("[bench] polling reads against a busy writer: %.1f ns lock-free, %.1f ns taking a lock (%u reads)\n", sharedNs, lockedNs, (unsigned)polls);
+}
+
+/********************* Application path **************************/
+static std::mutex framesMutex;
+static std::vector<std::vector<uint8_t>> sentFrames;
+
+static constexpr bool off = false;
+static constexpr uint8_t levelDefault = 10;
+static constexpr uint32_t counterDefault = 0;
+static constexpr uint64_t totalDefault = 0;
+
+static constexpr zb_attribute_desc_t onOffAttributes[] = {
+    {ATTR_ON_OFF, ESP_ZB_ZCL_ATTR_TYPE_BOOL, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &off},
+};
+static constexpr zb_attribute_desc_t settingsAttributes[] = {
+    {ATTR_LEVEL, ESP_ZB_ZCL_ATTR_TYPE_U8, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &levelDefault},
+    {ATTR_COUNTER, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &counterDefault},
+    {ATTR_TOTAL, ESP_ZB_ZCL_ATTR_TYPE_U64, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &totalDefault},
+    {ATTR_LABEL, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, "\x05" "label"},
+};
+static constexpr zb_cluster_desc_t clusters[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, onOffAttributes),
+    ZB_CLUSTER(CLUSTER_ID_SETTINGS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, settingsAttributes),
+};
+static constexpr zb_endpoint_desc_t endpoints[] = {
+    ZB_ENDPOINT(ENDPOINT, ESP_ZB_HA_ON_OFF_OUTPUT_DEVICE_ID, clusters),
+};
+static constexpr zb_device_desc_t device = ZB_DEVICE(endpoints);
+ZB_ASSERT_DEVICE_VALID(device);
+
+// Runs the real device bring-up, so it must come last
+void test_device_reads_and_batched_writes() {
+    HOST_ZbSetApsDataHook([](const esp_zb_apsde_data_req_t *req) {
+        std::lock_guard<std::mutex> lock(framesMutex);
+        if (req->dst_addr_mode == ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT && req->cluster_id == CLUSTER_ID_SETTINGS) {
+            sentFrames.push_back(std::vector<uint8_t>(req->asdu, req->asdu + req->asdu_length));
+        }
+    });
+
+    zb_reporting_config_t reporting = {};
+    reporting.endpoint = ENDPOINT;
+    reporting.cluster = CLUSTER_ID_SETTINGS;
+    reporting.type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+    reporting.attribute = ATTR_LEVEL;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_AddReportableAttribute(&reporting));
+    reporting.type = ESP_ZB_ZCL_ATTR_TYPE_U32;
+    reporting.attribute = ATTR_COUNTER;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_AddReportableAttribute(&reporting));
+
+    uint8_t level;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_GetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level, sizeof(level), NULL));
+
+    ZB_SetDeviceDescriptor(&device);
+    ZB_StartMainTask();
+    for (int i = 0; i < 100 && !esp_zb_bdb_dev_joined(); i++) {
+        delay(10);
+    }
+    TEST_ASSERT_TRUE(esp_zb_bdb_dev_joined());
+
+    // Defaults; strings, and Identify Time, which the stack counts down without telling anyone, are left to the stack
+    uint16_t identifyTime = 1;
+    uint32_t version;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_GetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level, sizeof(level), &version));
+    TEST_ASSERT_EQUAL_UINT8(levelDefault, level);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_GetAttributeValue(ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID,
+                                                             &identifyTime, sizeof(identifyTime), NULL));
+    char label[8];
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_GetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL, label, sizeof(label), NULL));
+
+    // A network write lands in the shadow
+    bool on = true;
+    esp_zb_zcl_set_attr_value_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.dst_endpoint = ENDPOINT;
+    message.info.cluster = ESP_ZB_ZCL_CLUSTER_ID_ON_OFF;
+    message.attribute.id = ATTR_ON_OFF;
+    message.attribute.data = {ESP_ZB_ZCL_ATTR_TYPE_BOOL, 1, &on};
+    HOST_ZbInvokeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &message);
+    HOST_ZbSync();
+
+    on = false;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_GetAttributeValue(ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ATTR_ON_OFF, &on, sizeof(on), NULL));
+    TEST_ASSERT_TRUE(on);
+
+    // Three writes, one lock, one report
+    zb_attribute_batch_t batch = {};
+    level = 42;
+    uint32_t counter = 7;
+    uint64_t total = 0x0102030405060708ull;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BatchAttributeValue(&batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BatchAttributeValue(&batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &counter));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BatchAttributeValue(&batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_TOTAL, &total));
+
+    uint32_t locks = HOST_ZbGetLockCount();
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_CommitAttributes(&batch));
+    TEST_ASSERT_EQUAL_UINT32(locks + 1, HOST_ZbGetLockCount());
+    TEST_ASSERT_EQUAL_UINT8(0, batch.count);
+
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(ENDPOINT, CLUSTER_ID_SETTINGS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ATTR_TOTAL);
+    TEST_ASSERT_NOT_NULL(attr);
+    TEST_ASSERT_EQUAL_MEMORY(&total, attr->data_p, sizeof(total));
+
+    // Reads take no lock at all
+    uint32_t newVersion;
+    locks = HOST_ZbGetLockCount();
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_GetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level, sizeof(level), &newVersion));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_GetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &counter, sizeof(counter), NULL));
+    TEST_ASSERT_EQUAL_UINT32(locks, HOST_ZbGetLockCount());
+    TEST_ASSERT_EQUAL_UINT8(42, level);
+    TEST_ASSERT_EQUAL_UINT32(7, counter);
+    TEST_ASSERT_EQUAL_UINT32(version + 1, newVersion);
+
+    delay(ZB_REPORTING_BATCH_DELAY_MS + 100);
+    {
+        std::lock_guard<std::mutex> lock(framesMutex);
+        TEST_ASSERT_EQUAL(1, sentFrames.size());
+    }
+
+    // A failed write does not stop the rest of the batch
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_BatchAttributeValue(&batch, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL, "\x01" "x"));
+    batch.count = 2;
+    batch.writes[0] = {ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, 0x0000, 1, {5}};
+    batch.writes[1] = {ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, 1, {43}};
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ZB_CommitAttributes(&batch));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_GetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &level, sizeof(level), NULL));
+    TEST_ASSERT_EQUAL_UINT8(43, level);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_entries_sorted_and_checked);
+    RUN_TEST(test_version_moves_with_the_value);
+    RUN_TEST(test_batch_replaces_and_fills);
+    RUN_TEST(test_readers_never_see_torn_values);
+    RUN_TEST(test_bench_polling_reads);
+    RUN_TEST(test_device_reads_and_batched_writes);
+    return UNITY_END();
+}
@@ -0,0 +1,482 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Log-structured attribute store: recovery, write coalescing & wear levelling on the host flash stand-in, and values
+// restored into the device's attributes before the stack registers them
+#include <Arduino.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "esp_partition.h"
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_store.h"
+#include "Zigbee/zigbee_store_log.h"
+#include "host_platform.h"
+
+#define ENDPOINT 1
+#define CLUSTER_ID_SETTINGS 0xFC20
+#define ATTR_LEVEL 0x0000
+#define ATTR_MODE 0x0001
+#define ATTR_LABEL 0x0002
+#define ATTR_COUNTER 0x0003
+#define ATTR_VOLATILE 0x0004
+#define QUIET_MS 100
+#define MAX_DELAY_MS 1000
+
+static constexpr uint8_t defaultLevel = 10;
+static constexpr uint16_t defaultMode = 1;
+static constexpr char defaultLabel[] = "\x04" "none";
+static constexpr uint32_t defaultCounter = 0;
+
+static constexpr zb_attribute_desc_t settingsAttributes[] = {
+    {ATTR_LEVEL, ESP_ZB_ZCL_ATTR_TYPE_U8, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE | ZB_ATTR_ACCESS_PERSISTENT, &defaultLevel},
+    {ATTR_MODE, ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE | ZB_ATTR_ACCESS_PERSISTENT, &defaultMode},
+    {ATTR_LABEL, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE | ZB_ATTR_ACCESS_PERSISTENT, defaultLabel},
+    {ATTR_COUNTER, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ZB_ATTR_ACCESS_PERSISTENT, &defaultCounter},
+    {ATTR_VOLATILE, ESP_ZB_ZCL_ATTR_TYPE_U8, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &defaultLevel},
+};
+static constexpr zb_cluster_desc_t settingsClusters[] = {
+    ZB_CLUSTER(CLUSTER_ID_SETTINGS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, settingsAttributes),
+};
+static constexpr zb_endpoint_desc_t settingsEndpoints[] = {
+    ZB_ENDPOINT(ENDPOINT, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, settingsClusters),
+};
+static constexpr zb_device_desc_t settingsDevice = ZB_DEVICE(settingsEndpoints);
+ZB_ASSERT_DEVICE_VALID(settingsDevice);
+
+static const esp_partition_t *partition;
+static zb_store_log_t storeLog;
+
+static esp_err_t partitionRead(void *context, uint32_t offset, void *data, size_t size) {
+    return esp_partition_read((const esp_partition_t *)context, offset, data, size);
+}
+
+static esp_err_t partitionWrite(void *context, uint32_t offset, const void *data, size_t size) {
+    return esp_partition_write((const esp_partition_t *)context, offset, data, size);
+}
+
+static esp_err_t partitionErase(void *context, uint32_t offset, size_t size) {
+    return esp_partition_erase_range((const esp_partition_t *)context, offset, size);
+}
+
+// A fresh log over the spiffs partition with the settings attributes added, as on each boot
+static void boot(zb_store_log_t *log) {
+    zb_store_flash_t flash = {partitionRead, partitionWrite, partitionErase, (void *)partition, partition->erase_size,
+                              partition->size / partition->erase_size};
+
+    ZB_StoreLogInit(log, &flash, QUIET_MS, MAX_DELAY_MS);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogAdd(log, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, ESP_ZB_ZCL_ATTR_TYPE_U8, &defaultLevel));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogAdd(log, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_MODE, ESP_ZB_ZCL_ATTR_TYPE_16BIT_ENUM, &defaultMode));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogAdd(log, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, defaultLabel));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogAdd(log, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, ESP_ZB_ZCL_ATTR_TYPE_U32, &defaultCounter));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogMount(log));
+}
+
+static uint8_t level(const zb_store_log_t *log) {
+    return *(const uint8_t *)ZB_StoreLogGet(log, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL);
+}
+
+static uint32_t counter(const zb_store_log_t *log) {
+    uint32_t value;
+    memcpy(&value, ZB_StoreLogGet(log, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER), sizeof(value));
+    return value;
+}
+
+static void set(zb_store_log_t *log, uint16_t attribute, const void *value, uint32_t nowMs) {
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogSet(log, ENDPOINT, CLUSTER_ID_SETTINGS, attribute, value, nowMs));
+}
+
+void setUp() {
+    HOST_FlashErase();
+}
+
+void tearDown() {
+}
+
+void test_values_survive_a_restart() {
+    boot(&storeLog);
+    TEST_ASSERT_EQUAL_UINT16(0, storeLog.stats.restored);
+    TEST_ASSERT_EQUAL_UINT8(defaultLevel, level(&storeLog));
+
+    uint8_t newLevel = 200;
+    uint16_t newMode = 3;
+    uint32_t newCounter = 0xdeadbeef;
+    set(&storeLog, ATTR_LEVEL, &newLevel, 0);
+    set(&storeLog, ATTR_MODE, &newMode, 0);
+    set(&storeLog, ATTR_LABEL, "\x07" "kitchen", 0);
+    set(&storeLog, ATTR_COUNTER, &newCounter, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+
+    // Setting the value it already has is not a change
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogSet(&storeLog, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, &newLevel, 1));
+    TEST_ASSERT_EQUAL_UINT32(ZB_STORE_NEVER, ZB_StoreLogNextFlushDelay(&storeLog, 1));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ZB_StoreLogSet(&storeLog, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_VOLATILE, &newLevel, 1));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, ZB_StoreLogSet(&storeLog, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL,
+                                                           "\x28" "a label much longer than the store can hold", 1));
+
+    zb_store_log_t rebooted;
+    boot(&rebooted);
+    TEST_ASSERT_EQUAL_UINT16(4, rebooted.stats.restored);
+    TEST_ASSERT_EQUAL_UINT16(1, rebooted.stats.liveSectors);
+    TEST_ASSERT_EQUAL_UINT8(newLevel, level(&rebooted));
+    TEST_ASSERT_EQUAL_MEMORY(&newMode, ZB_StoreLogGet(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_MODE), sizeof(newMode));
+    TEST_ASSERT_EQUAL_MEMORY("\x07" "kitchen", ZB_StoreLogGet(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL), 8);
+    TEST_ASSERT_EQUAL_HEX32(newCounter, counter(&rebooted));
+
+    // Attributes added after a firmware update start from their default, ones dropped are ignored
+    zb_store_flash_t flash = rebooted.flash;
+    ZB_StoreLogInit(&rebooted, &flash, QUIET_MS, MAX_DELAY_MS);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogAdd(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, ESP_ZB_ZCL_ATTR_TYPE_U8, &defaultLevel));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogAdd(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_VOLATILE, ESP_ZB_ZCL_ATTR_TYPE_U8, &defaultLevel));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, ZB_StoreLogAdd(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LEVEL, ESP_ZB_ZCL_ATTR_TYPE_U8, &defaultLevel));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, ZB_StoreLogAdd(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, 0x10, ESP_ZB_ZCL_ATTR_TYPE_ARRAY, &defaultLevel));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogMount(&rebooted));
+    TEST_ASSERT_EQUAL_UINT8(newLevel, level(&rebooted));
+    TEST_ASSERT_EQUAL_UINT8(defaultLevel, *(const uint8_t *)ZB_StoreLogGet(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_VOLATILE));
+}
+
+void test_updates_coalesce_into_one_write() {
+    boot(&storeLog);
+
+    host_flash_stats_t before;
+    HOST_FlashGetStats(&before);
+
+    // A burst of updates 10ms apart, as a dimmer being dragged would make
+    uint32_t now = 0;
+    for (uint32_t i = 1; i <= 50; i++, now += 10) {
+        uint8_t value = i;
+        set(&storeLog, ATTR_LEVEL, &value, now);
+        set(&storeLog, ATTR_COUNTER, &i, now);
+        TEST_ASSERT_EQUAL_UINT32(QUIET_MS, ZB_StoreLogNextFlushDelay(&storeLog, now));
+    }
+
+    // Due once left alone for the quiet period
+    TEST_ASSERT_EQUAL_UINT32(QUIET_MS - 40, ZB_StoreLogNextFlushDelay(&storeLog, now + 30));
+    TEST_ASSERT_EQUAL_UINT32(0, ZB_StoreLogNextFlushDelay(&storeLog, now + QUIET_MS));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, now + QUIET_MS));
+
+    host_flash_stats_t after;
+    HOST_FlashGetStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(100, storeLog.stats.changes);
+    TEST_ASSERT_EQUAL_UINT32(1, storeLog.stats.flushes);
+    TEST_ASSERT_EQUAL_UINT32(2, storeLog.stats.records);
+    // One erase & header to open the first sector, then both records in a single write
+    TEST_ASSERT_EQUAL_UINT32(1, after.erases - before.erases);
+    TEST_ASSERT_EQUAL_UINT32(2, after.writes - before.writes);
+
+    // Updates that never pause are still written once the maximum delay is up
+    now = 10000;
+    for (uint32_t i = 0; i < MAX_DELAY_MS / 10; i++, now += 10) {
+        TEST_ASSERT_NOT_EQUAL(0, ZB_StoreLogNextFlushDelay(&storeLog, now));
+        set(&storeLog, ATTR_COUNTER, &now, now);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, ZB_StoreLogNextFlushDelay(&storeLog, now));
+}
+
+void test_power_loss_keeps_a_whole_value() {
+    boot(&storeLog);
+
+    uint8_t oldLevel = 1;
+    uint32_t oldCounter = 1111;
+    set(&storeLog, ATTR_LEVEL, &oldLevel, 0);
+    set(&storeLog, ATTR_COUNTER, &oldCounter, 0);
+    set(&storeLog, ATTR_LABEL, "\x03" "old", 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+
+    // Cut power at every byte of the next flush, then check each boot sees either the old or the new value
+    zb_store_batch_t batch;
+    uint8_t newLevel = 2;
+    uint32_t newCounter = 2222;
+    set(&storeLog, ATTR_LEVEL, &newLevel, 0);
+    set(&storeLog, ATTR_COUNTER, &newCounter, 0);
+    set(&storeLog, ATTR_LABEL, "\x05" "fresh", 0);
+    zb_store_log_t pending = storeLog;
+    TEST_ASSERT_EQUAL_UINT8(3, ZB_StoreLogCollect(&pending, &batch));
+
+    uint8_t image[4096];
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_read(partition, 0, image, sizeof(image)));
+
+    for (uint32_t cut = 1; cut < batch.length; cut++) {
+        zb_store_log_t writer = pending;
+        zb_store_batch_t torn = batch;
+
+        HOST_FlashErase();
+        TEST_ASSERT_EQUAL(ESP_OK, esp_partition_write(partition, 0, image, sizeof(image)));
+
+        HOST_FlashSetPowerCut(cut);
+        TEST_ASSERT_EQUAL(ESP_FAIL, ZB_StoreLogWrite(&writer, &torn));
+        HOST_FlashSetPowerCut(0);
+
+        zb_store_log_t rebooted;
+        boot(&rebooted);
+        uint8_t restoredLevel = level(&rebooted);
+        uint32_t restoredCounter = counter(&rebooted);
+        const uint8_t *restoredLabel = (const uint8_t *)ZB_StoreLogGet(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL);
+
+        TEST_ASSERT_TRUE(restoredLevel == oldLevel || restoredLevel == newLevel);
+        TEST_ASSERT_TRUE(restoredCounter == oldCounter || restoredCounter == newCounter);
+        TEST_ASSERT_TRUE(memcmp(restoredLabel, "\x03" "old", 4) == 0 || memcmp(restoredLabel, "\x05" "fresh", 6) == 0);
+        // Records go out in entry order, so a later one only survives if every one before it did
+        TEST_ASSERT_TRUE(restoredLevel == newLevel || restoredCounter == oldCounter);
+
+        // The torn sector is closed, and the next flush carries on past it
+        uint8_t laterLevel = 3;
+        set(&rebooted, ATTR_LEVEL, &laterLevel, 0);
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&rebooted, 0));
+
+        zb_store_log_t again;
+        boot(&again);
+        TEST_ASSERT_EQUAL_UINT8(laterLevel, level(&again));
+        TEST_ASSERT_EQUAL_UINT32(restoredCounter, counter(&again));
+    }
+}
+
+void test_power_loss_while_retiring_a_sector() {
+    const uint32_t sectorSize = partition->erase_size;
+    boot(&storeLog);
+
+    set(&storeLog, ATTR_LABEL, "\x06" "stable", 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+
+    // Fill sectors until the next record opens one that has to carry the label forward out of the first
+    uint32_t i = 0;
+    while (storeLog.activeSequence < ZB_STORE_LIVE_SECTORS || storeLog.appendOffset + 16 <= sectorSize) {
+        set(&storeLog, ATTR_COUNTER, &i, 0);
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+        i++;
+    }
+    uint32_t oldCounter = i - 1;
+
+    std::vector<uint8_t> image(ZB_STORE_LIVE_SECTORS * sectorSize);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_read(partition, 0, image.data(), image.size()));
+
+    // Sector header, the label's copy, then the new record
+    for (uint32_t cut = 1; cut < 16 + 20 + 16; cut++) {
+        zb_store_log_t writer = storeLog;
+
+        HOST_FlashErase();
+        TEST_ASSERT_EQUAL(ESP_OK, esp_partition_write(partition, 0, image.data(), image.size()));
+
+        set(&writer, ATTR_COUNTER, &i, 0);
+        HOST_FlashSetPowerCut(cut);
+        TEST_ASSERT_NOT_EQUAL(ESP_OK, ZB_StoreLogFlush(&writer, 0));
+        HOST_FlashSetPowerCut(0);
+
+        zb_store_log_t rebooted;
+        boot(&rebooted);
+        TEST_ASSERT_EQUAL_MEMORY("\x06" "stable", ZB_StoreLogGet(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL), 7);
+        TEST_ASSERT_EQUAL_UINT32(oldCounter, counter(&rebooted));
+    }
+
+    // Uninterrupted, the label is copied and the first sector drops out of the live window
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+    set(&storeLog, ATTR_COUNTER, &i, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, storeLog.stats.copies);
+}
+
+void test_failed_flush_is_retried() {
+    boot(&storeLog);
+
+    uint8_t newLevel = 42;
+    uint16_t newMode = 7;
+    set(&storeLog, ATTR_LEVEL, &newLevel, 0);
+    set(&storeLog, ATTR_MODE, &newMode, 0);
+
+    HOST_FlashSetPowerCut(20);
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 500));
+    HOST_FlashSetPowerCut(0);
+
+    // Left dirty, and due again after another quiet period
+    TEST_ASSERT_EQUAL_UINT32(QUIET_MS, ZB_StoreLogNextFlushDelay(&storeLog, 500));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 600));
+    TEST_ASSERT_TRUE(storeLog.stats.errors > 0);
+
+    zb_store_log_t rebooted;
+    boot(&rebooted);
+    TEST_ASSERT_EQUAL_UINT8(newLevel, level(&rebooted));
+}
+
+void test_sectors_wear_evenly() {
+    const uint32_t sectors = partition->size / partition->erase_size;
+    boot(&storeLog);
+
+    // The label is written once and must survive every sector being recycled around it
+    set(&storeLog, ATTR_LABEL, "\x06" "stable", 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+
+    uint32_t i = 0;
+    while (storeLog.stats.erases < 2 * sectors + 3) {
+        set(&storeLog, ATTR_COUNTER, &i, i);
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, i));
+        i++;
+    }
+
+    uint32_t least = UINT32_MAX;
+    uint32_t most = 0;
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        uint32_t erases = HOST_FlashGetSectorErases(partition->address + sector * partition->erase_size);
+        least = erases < least ? erases : least;
+        most = erases > most ? erases : most;
+    }
+    TEST_ASSERT_TRUE(least >= 2);
+    TEST_ASSERT_TRUE(most - least <= 1);
+    TEST_ASSERT_TRUE(storeLog.stats.copies >= 2 * sectors / ZB_STORE_LIVE_SECTORS);
+
+    // Mount only reads the live window, however long the log has been running
+    zb_store_log_t rebooted;
+    int64_t start = esp_timer_get_time();
+    boot(&rebooted);
+    int64_t mountUs = esp_timer_get_time() - start;
+
+    TEST_ASSERT_TRUE(rebooted.stats.liveSectors <= ZB_STORE_LIVE_SECTORS + 1);
+    TEST_ASSERT_EQUAL_HEX32(i - 1, counter(&rebooted));
+    TEST_ASSERT_EQUAL_MEMORY("\x06" "stable", ZB_StoreLogGet(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL), 7);
+
+    printf("[bench] %lu flushes over %lu sectors: erases per sector %lu-%lu, %lu records carried forward; mount %lldus over %d sectors, %lu records\n",
+           (unsigned long)i, (unsigned long)sectors, (unsigned long)least, (unsigned long)most, (unsigned long)storeLog.stats.copies,
+           (long long)mountUs, rebooted.stats.liveSectors, (unsigned long)rebooted.stats.replayed);
+}
+
+void test_erase_forgets_everything() {
+    boot(&storeLog);
+
+    uint8_t newLevel = 99;
+    set(&storeLog, ATTR_LEVEL, &newLevel, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+
+    host_flash_stats_t before;
+    HOST_FlashGetStats(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogErase(&storeLog));
+
+    host_flash_stats_t after;
+    HOST_FlashGetStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(1, after.erases - before.erases);
+
+    zb_store_log_t rebooted;
+    boot(&rebooted);
+    TEST_ASSERT_EQUAL_UINT16(0, rebooted.stats.restored);
+    TEST_ASSERT_EQUAL_UINT8(defaultLevel, level(&rebooted));
+}
+
+void test_image_file_persists() {
+    char path[] = "/tmp/host_flash_XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+    unlink(path);
+
+    HOST_FlashSetImagePath(path);
+    boot(&storeLog);
+    uint32_t value = 0x12345678;
+    set(&storeLog, ATTR_COUNTER, &value, 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+
+    // Reloading the file stands in for a fresh process
+    HOST_FlashSetImagePath(NULL);
+    zb_store_log_t blank;
+    boot(&blank);
+    TEST_ASSERT_EQUAL_UINT16(0, blank.stats.restored);
+
+    HOST_FlashSetImagePath(path);
+    zb_store_log_t rebooted;
+    boot(&rebooted);
+    TEST_ASSERT_EQUAL_HEX32(value, counter(&rebooted));
+
+    HOST_FlashSetImagePath(NULL);
+    unlink(path);
+}
+
+// Runs the real device bring-up, so it must come last: seed a stored value, boot, and change it through the stack
+void test_device_restores_before_register() {
+    boot(&storeLog);
+    uint8_t storedLevel = 77;
+    set(&storeLog, ATTR_LEVEL, &storedLevel, 0);
+    set(&storeLog, ATTR_LABEL, "\x06" "stored", 0);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_StoreLogFlush(&storeLog, 0));
+
+    ZB_SetDeviceDescriptor(&settingsDevice);
+    ZB_StartMainTask();
+    for (int i = 0; i < 100 && !esp_zb_bdb_dev_joined(); i++) {
+        delay(10);
+    }
+    HOST_ZbSync();
+
+    esp_zb_zcl_attr_t *levelAttr = esp_zb_zcl_get_attribute(ENDPOINT, CLUSTER_ID_SETTINGS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ATTR_LEVEL);
+    TEST_ASSERT_NOT_NULL(levelAttr);
+    TEST_ASSERT_EQUAL_UINT8(storedLevel, *(uint8_t *)levelAttr->data_p);
+    TEST_ASSERT_EQUAL_HEX8(ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, levelAttr->access);
+    TEST_ASSERT_EQUAL_MEMORY("\x06" "stored", esp_zb_zcl_get_attribute(ENDPOINT, CLUSTER_ID_SETTINGS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ATTR_LABEL)->data_p, 7);
+
+    // A network write, then local updates; nothing reaches flash until the quiet period is up or it is flushed
+    uint8_t written = 5;
+    esp_zb_zcl_set_attr_value_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.dst_endpoint = ENDPOINT;
+    message.info.cluster = CLUSTER_ID_SETTINGS;
+    message.attribute.id = ATTR_LEVEL;
+    message.attribute.data = {ESP_ZB_ZCL_ATTR_TYPE_U8, 1, &written};
+    HOST_ZbInvokeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &message);
+    HOST_ZbSync();
+
+    for (uint32_t i = 1; i <= 20; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_SetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &i));
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_SetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_VOLATILE, &written));
+    }
+
+    zb_store_stats_t stats;
+    ZB_GetStoreStats(&stats);
+    TEST_ASSERT_EQUAL_UINT16(2, stats.restored);
+    TEST_ASSERT_EQUAL_UINT32(21, stats.changes);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.flushes);
+
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_FlushAttributes());
+    ZB_GetStoreStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.flushes);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.records);
+
+    zb_store_log_t rebooted;
+    boot(&rebooted);
+    TEST_ASSERT_EQUAL_UINT8(written, level(&rebooted));
+    TEST_ASSERT_EQUAL_UINT32(20, counter(&rebooted));
+    TEST_ASSERT_EQUAL_MEMORY("\x06" "stored", ZB_StoreLogGet(&rebooted, ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_LABEL), 7);
+
+    // Left alone, the flush task writes the next change once the default quiet period has passed
+    uint32_t last = 21;
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_SetAttributeValue(ENDPOINT, CLUSTER_ID_SETTINGS, ATTR_COUNTER, &last));
+    delay(ZB_STORE_QUIET_MS + 200);
+    ZB_GetStoreStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.flushes);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ZB_STORE_PARTITION_LABEL);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_values_survive_a_restart);
+    RUN_TEST(test_updates_coalesce_into_one_write);
+    RUN_TEST(test_power_loss_keeps_a_whole_value);
+    RUN_TEST(test_power_loss_while_retiring_a_sector);
+    RUN_TEST(test_failed_flush_is_retried);
+    RUN_TEST(test_sectors_wear_evenly);
+    RUN_TEST(test_erase_forgets_everything);
+    RUN_TEST(test_image_file_persists);
+    RUN_TEST(test_device_restores_before_register);
+    return UNITY_END();
+}
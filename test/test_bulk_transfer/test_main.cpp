@@ -0,0 +1,645 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Bulk transfer: the windowed engine against a simulated collector on a virtual clock, then sources pulled off the
+// application end to end by the host collector
+#include <Arduino.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "esp_partition.h"
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+#define SOURCE_SIZE (10 * 1024)
+#define RAM_SOURCE_ID 0x01
+#define FILE_SOURCE_ID 0x02
+#define APP_SOURCE_SIZE (6 * 1024)
+#define APP_TIMEOUT_MS 50
+
+// Application entry point from main.cpp
+void setup();
+
+static const host_bulk_collector_config_t baseCollector = {
+    .shortAddress = 0x0000,
+    .endpoint = 1,
+    .latencyMs = 2,
+    .jitterMs = 0,
+    .lossEvery = 0,
+    .ackLossEvery = 0,
+    .ackEvery = 0,
+    .silentAfterBytes = 0,
+};
+
+static std::vector<uint8_t> appSource;
+static FILE *appFile = NULL;
+
+static std::vector<uint8_t> makeData(size_t size, uint32_t seed) {
+    std::vector<uint8_t> data(size);
+    std::mt19937 generator(seed);
+
+    for (auto &byte : data) {
+        byte = generator();
+    }
+    return data;
+}
+
+/* A RAM source that fails reads at or past failAt */
+typedef struct {
+    const std::vector<uint8_t> *data;
+    uint32_t failAt;
+    uint32_t reads;
+} sim_source_t;
+
+static esp_err_t simRead(void *context, uint32_t offset, void *data, size_t size) {
+    sim_source_t *source = (sim_source_t *)context;
+
+    source->reads++;
+    if (offset + size > source->failAt) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    memcpy(data, source->data->data() + offset, size);
+    return ESP_OK;
+}
+
+typedef struct {
+    uint32_t latencyMs = 0;             /* each way */
+    uint32_t jitterMs = 0;
+    uint32_t lossEvery = 0;             /* lose every nth Data frame */
+    uint32_t lose[4] = {};              /* ...and these, counting Data frames from 1 */
+    uint32_t ackLossEvery = 0;
+    uint32_t silentAfterBytes = 0;      /* the collector stops taking Data frames after this much */
+} sim_link_t;
+
+typedef struct {
+    uint32_t elapsedMs;
+    uint32_t sent;
+    uint32_t lost;
+} sim_result_t;
+
+static void initEngine(zb_bulk_engine_t *engine, uint8_t window, uint32_t timeoutMs = 200, uint8_t maxRetries = ZB_BULK_MAX_RETRIES) {
+    zb_bulk_config_t config = {window, ZB_BULK_MAX_CHUNK_SIZE, timeoutMs, maxRetries};
+    ZB_BulkEngineInit(engine, &config);
+}
+
+/* Run a transfer to its end in virtual time. The collector reassembles into received and acknowledges every Data frame
+ * it takes in with what it holds then, the acknowledgement arriving back a round trip after the chunk was sent.
+ */
+static sim_result_t simulate(zb_bulk_engine_t *engine, const zb_bulk_source_t *source, uint32_t offset, const sim_link_t *link,
+                             std::vector<uint8_t> *received) {
+    std::multimap<uint32_t, std::pair<uint32_t, uint32_t>> acks;       /* arrival, offset & bitmap */
+    std::vector<bool> have((source->size - offset + engine->config.chunkSize - 1) / engine->config.chunkSize, false);
+    std::mt19937 jitter(3);
+    sim_result_t result = {};
+    uint32_t now = 1000, bytes = 0, ackCount = 0;
+    zb_bulk_chunk_t chunk;
+
+    received->resize(source->size);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BulkEngineBegin(engine, source, 7, offset, 0, now));
+
+    while (engine->state == ZB_BULK_SENDING) {
+        while (ZB_BulkEngineNextChunk(engine, now, &chunk)) {
+            result.sent++;
+            if ((link->lossEvery && result.sent % link->lossEvery == 0) || std::count(link->lose, link->lose + 4, result.sent)) {
+                result.lost++;
+                continue;
+            }
+            if (link->silentAfterBytes && bytes >= link->silentAfterBytes) {
+                continue;
+            }
+
+            // Taken in as it arrives, and acknowledged from there
+            size_t index = (chunk.offset - offset) / engine->config.chunkSize;
+            if (!have[index]) {
+                have[index] = true;
+                bytes += chunk.size;
+                memcpy(received->data() + chunk.offset, chunk.data, chunk.size);
+            }
+
+            size_t first = 0;
+            while (first < have.size() && have[first]) {
+                first++;
+            }
+            uint32_t bitmap = 0;
+            for (size_t bit = 0; bit < 32 && first + bit < have.size(); bit++) {
+                bitmap |= have[first + bit] ? 1u << bit : 0;
+            }
+            uint32_t ackOffset = std::min<uint32_t>(offset + first * engine->config.chunkSize, source->size);
+
+            ackCount++;
+            if (link->ackLossEvery && ackCount % link->ackLossEvery == 0) {
+                continue;
+            }
+            uint32_t rtt = 2 * link->latencyMs + (link->jitterMs ? jitter() % (link->jitterMs + 1) : 0);
+            acks.insert({now + rtt, {ackOffset, bitmap}});
+        }
+        if (engine->state != ZB_BULK_SENDING) {
+            break;
+        }
+
+        // Jump to the next acknowledgement or chunk, whichever is due first
+        uint32_t delay = ZB_BulkEngineNextDelay(engine, now);
+        uint32_t next = delay == ZB_BULK_NEVER ? UINT32_MAX : now + delay;
+        if (!acks.empty() && acks.begin()->first < next) {
+            next = acks.begin()->first;
+        }
+        TEST_ASSERT_NOT_EQUAL(UINT32_MAX, next);
+        now = next;
+
+        while (!acks.empty() && acks.begin()->first <= now && engine->state == ZB_BULK_SENDING) {
+            ZB_BulkEngineOnAck(engine, acks.begin()->second.first, acks.begin()->second.second, now);
+            acks.erase(acks.begin());
+        }
+    }
+
+    result.elapsedMs = engine->stats.endMs - engine->stats.startMs;
+    return result;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+/********************* Engine **************************/
+void test_window_streams_source() {
+    static zb_bulk_engine_t engine;
+    std::vector<uint8_t> data = makeData(SOURCE_SIZE, 1), received;
+    zb_bulk_source_t source;
+    sim_link_t link = {.latencyMs = 20};
+
+    ZB_BulkRamSource(&source, data.data(), data.size());
+    initEngine(&engine, 8);
+    simulate(&engine, &source, 0, &link, &received);
+
+    TEST_ASSERT_EQUAL_MESSAGE(ZB_BULK_DONE, engine.state, ZB_BulkStateToString(engine.state));
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), received.data(), data.size());
+    TEST_ASSERT_EQUAL_UINT32((SOURCE_SIZE + ZB_BULK_MAX_CHUNK_SIZE - 1) / ZB_BULK_MAX_CHUNK_SIZE, engine.stats.chunks);
+    TEST_ASSERT_EQUAL_UINT32(0, engine.stats.retransmits);
+    TEST_ASSERT_EQUAL_UINT32(SOURCE_SIZE, engine.stats.bytes);
+    TEST_ASSERT_EQUAL_UINT32(SOURCE_SIZE, engine.ackedOffset);
+    TEST_ASSERT_EQUAL_UINT8(8, engine.stats.peakInFlight);
+    TEST_ASSERT_EQUAL_UINT8(0, ZB_BulkEngineInFlight(&engine));
+    TEST_ASSERT_GREATER_THAN(0, engine.stats.bytesPerSecond);
+}
+
+void test_config_and_bounds() {
+    static zb_bulk_engine_t engine;
+    std::vector<uint8_t> data = makeData(100, 2);
+    zb_bulk_source_t source;
+    zb_bulk_config_t config = {0, 255, 100, 1};
+
+    // Clamped to what fits a frame and an acknowledgement
+    ZB_BulkEngineInit(&engine, &config);
+    TEST_ASSERT_EQUAL_UINT8(1, engine.config.window);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_MAX_CHUNK_SIZE, engine.config.chunkSize);
+    config = {200, 1, 100, 1};
+    ZB_BulkEngineInit(&engine, &config);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_MAX_WINDOW, engine.config.window);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_MIN_CHUNK_SIZE, engine.config.chunkSize);
+
+    // The collector can only narrow the window
+    ZB_BulkRamSource(&source, data.data(), data.size());
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BulkEngineBegin(&engine, &source, 1, 0, 4, 0));
+    TEST_ASSERT_EQUAL_UINT8(4, engine.window);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BulkEngineBegin(&engine, &source, 1, 0, 0, 0));
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_MAX_WINDOW, engine.window);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ZB_BulkEngineBegin(&engine, &source, 1, 101, 0, 0));
+
+    // Nothing left to send is done at once
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BulkEngineBegin(&engine, &source, 1, 100, 0, 0));
+    TEST_ASSERT_EQUAL(ZB_BULK_DONE, engine.state);
+    TEST_ASSERT_EQUAL_UINT32(ZB_BULK_NEVER, ZB_BulkEngineNextDelay(&engine, 0));
+
+    // An acknowledgement past what was sent is ignored
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_BulkEngineBegin(&engine, &source, 1, 0, 2, 0));
+    zb_bulk_chunk_t chunk;
+    TEST_ASSERT_TRUE(ZB_BulkEngineNextChunk(&engine, 0, &chunk));
+    ZB_BulkEngineOnAck(&engine, 100, 0, 1);
+    TEST_ASSERT_EQUAL(ZB_BULK_SENDING, engine.state);
+    TEST_ASSERT_EQUAL_UINT32(0, engine.stats.acks);
+
+    ZB_BulkEngineAbort(&engine, 2);
+    TEST_ASSERT_EQUAL(ZB_BULK_FAILED, engine.state);
+    TEST_ASSERT_EQUAL(ESP_FAIL, engine.error);
+}
+
+void test_lost_chunks_sent_selectively() {
+    static zb_bulk_engine_t engine;
+    std::vector<uint8_t> data = makeData(SOURCE_SIZE, 3), received;
+    zb_bulk_source_t source;
+    sim_link_t link = {.latencyMs = 20, .lose = {3, 5, 40}};
+
+    ZB_BulkRamSource(&source, data.data(), data.size());
+    initEngine(&engine, 8);
+    simulate(&engine, &source, 0, &link, &received);
+
+    // Each loss is found from the chunks acknowledged after it, without waiting out a timeout
+    TEST_ASSERT_EQUAL(ZB_BULK_DONE, engine.state);
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), received.data(), data.size());
+    TEST_ASSERT_EQUAL_UINT32(3, engine.stats.retransmits);
+    TEST_ASSERT_EQUAL_UINT32(3, engine.stats.selective);
+    TEST_ASSERT_EQUAL_UINT32(0, engine.stats.timeouts);
+}
+
+void test_lossy_reordering_link() {
+    static zb_bulk_engine_t engine;
+    std::vector<uint8_t> data = makeData(SOURCE_SIZE, 4), received;
+    zb_bulk_source_t source;
+    sim_link_t link = {.latencyMs = 20, .jitterMs = 30, .lossEvery = 7, .ackLossEvery = 5};
+
+    ZB_BulkRamSource(&source, data.data(), data.size());
+    initEngine(&engine, ZB_BULK_MAX_WINDOW);
+    sim_result_t result = simulate(&engine, &source, 0, &link, &received);
+
+    TEST_ASSERT_EQUAL(ZB_BULK_DONE, engine.state);
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), received.data(), data.size());
+    TEST_ASSERT_GREATER_OR_EQUAL(result.lost, engine.stats.retransmits);
+    TEST_ASSERT_GREATER_THAN(0, engine.stats.selective);
+    TEST_ASSERT_GREATER_THAN(0, engine.stats.staleAcks);
+
+    // Retransmissions stay close to what was lost, rather than going back a window at a time
+    TEST_ASSERT_LESS_THAN(result.lost * 2, engine.stats.retransmits);
+}
+
+void test_silent_collector_times_out_and_resumes() {
+    static zb_bulk_engine_t engine;
+    std::vector<uint8_t> data = makeData(SOURCE_SIZE, 5), received, resumed;
+    zb_bulk_source_t source;
+    sim_link_t link = {.latencyMs = 20, .silentAfterBytes = 4000};
+
+    ZB_BulkRamSource(&source, data.data(), data.size());
+    initEngine(&engine, 8, 100, 3);
+    simulate(&engine, &source, 0, &link, &received);
+
+    TEST_ASSERT_EQUAL(ZB_BULK_FAILED, engine.state);
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, engine.error);
+    // The oldest chunk spent its retries first, the rest of the window no more than it
+    TEST_ASSERT_GREATER_OR_EQUAL(3, engine.stats.timeouts);
+    TEST_ASSERT_LESS_OR_EQUAL(3 * 8, engine.stats.timeouts);
+    uint32_t acked = engine.ackedOffset;
+    TEST_ASSERT_EQUAL_UINT32(0, acked % ZB_BULK_MAX_CHUNK_SIZE);
+    TEST_ASSERT_GREATER_OR_EQUAL(4000, acked);
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), received.data(), acked);
+
+    // Picked up from where the collector got to
+    link.silentAfterBytes = 0;
+    simulate(&engine, &source, acked, &link, &resumed);
+    TEST_ASSERT_EQUAL(ZB_BULK_DONE, engine.state);
+    TEST_ASSERT_EQUAL_UINT32(acked, engine.stats.resumedFrom);
+    TEST_ASSERT_EQUAL_UINT32(SOURCE_SIZE - acked, engine.stats.bytes);
+    TEST_ASSERT_EQUAL_MEMORY(data.data() + acked, resumed.data() + acked, SOURCE_SIZE - acked);
+}
+
+void test_read_failure_fails_transfer() {
+    static zb_bulk_engine_t engine;
+    std::vector<uint8_t> data = makeData(SOURCE_SIZE, 6), received;
+    sim_source_t sim = {&data, 3000, 0};
+    zb_bulk_source_t source = {simRead, &sim, SOURCE_SIZE};
+    sim_link_t link = {.latencyMs = 20};
+
+    initEngine(&engine, 4);
+    simulate(&engine, &source, 0, &link, &received);
+
+    TEST_ASSERT_EQUAL(ZB_BULK_FAILED, engine.state);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, engine.error);
+    TEST_ASSERT_LESS_OR_EQUAL(3000, engine.ackedOffset);
+    TEST_ASSERT_EQUAL_UINT8(0, ZB_BulkEngineInFlight(&engine));
+
+    // Chunks are read as they are sent, never ahead
+    TEST_ASSERT_EQUAL_UINT32(engine.stats.chunks + 1, sim.reads);
+}
+
+void test_bench_window() {
+    static zb_bulk_engine_t engine;
+    std::vector<uint8_t> data = makeData(SOURCE_SIZE, 7), received;
+    zb_bulk_source_t source;
+    uint32_t elapsed[2][ZB_BULK_MAX_WINDOW + 1] = {};
+
+    ZB_BulkRamSource(&source, data.data(), data.size());
+    for (int lossy = 0; lossy < 2; lossy++) {
+        sim_link_t link = {.latencyMs = 20, .jitterMs = 10, .lossEvery = lossy ? 20u : 0u};
+
+        for (uint8_t window = 1; window <= ZB_BULK_MAX_WINDOW; window *= 2) {
+            initEngine(&engine, window);
+            sim_result_t result = simulate(&engine, &source, 0, &link, &received);
+            TEST_ASSERT_EQUAL(ZB_BULK_DONE, engine.state);
+            TEST_ASSERT_EQUAL_MEMORY(data.data(), received.data(), data.size());
+            elapsed[lossy][window] = result.elapsedMs;
+            printf("[bench] %u bytes over a %u ms link losing %s, window %u: %u ms, %u B/s, %u of %u chunks sent again (%u timed out)\n",
+                   (unsigned)data.size(), (unsigned)link.latencyMs, lossy ? "1 in 20" : "none", window, (unsigned)result.elapsedMs,
+                   (unsigned)engine.stats.bytesPerSecond, (unsigned)engine.stats.retransmits, (unsigned)engine.stats.chunks,
+                   (unsigned)engine.stats.timeouts);
+        }
+    }
+
+    // The link is latency bound, so throughput scales close to the window, and losses found selectively cost little
+    TEST_ASSERT_TRUE(elapsed[0][8] * 4 < elapsed[0][1]);
+    TEST_ASSERT_TRUE(elapsed[1][ZB_BULK_MAX_WINDOW] < elapsed[0][ZB_BULK_MAX_WINDOW] * 2);
+}
+
+/********************* Application **************************/
+static host_bulk_collector_stats_t waitForEnd(uint32_t timeoutMs) {
+    host_bulk_collector_stats_t stats;
+    uint32_t start = millis();
+
+    do {
+        delay(5);
+        HOST_BulkCollectorGetStats(&stats);
+    } while (!stats.ended && millis() - start < timeoutMs);
+
+    return stats;
+}
+
+void test_collector_pulls_ram_and_file_sources() {
+    host_bulk_collector_stats_t stats;
+    zb_bulk_status_t status;
+
+    HOST_BulkCollectorStart(&baseCollector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    stats = waitForEnd(5000);
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_SUCCESS, stats.startStatus);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_SUCCESS, stats.endStatus);
+    TEST_ASSERT_EQUAL_UINT32(APP_SOURCE_SIZE, stats.size);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_MAX_CHUNK_SIZE, stats.chunkSize);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_MAX_WINDOW, stats.window);
+    TEST_ASSERT_EQUAL_UINT32(APP_SOURCE_SIZE, stats.endOffset);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.malformed);
+    std::vector<uint8_t> data = HOST_BulkCollectorGetData();
+    TEST_ASSERT_EQUAL_size_t(appSource.size(), data.size());
+    TEST_ASSERT_EQUAL_MEMORY(appSource.data(), data.data(), appSource.size());
+
+    ZB_GetBulkStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_BULK_DONE, status.state);
+    TEST_ASSERT_EQUAL_UINT8(RAM_SOURCE_ID, status.source);
+    TEST_ASSERT_EQUAL_UINT8(stats.transfer, status.transfer);
+    TEST_ASSERT_EQUAL_UINT32(APP_SOURCE_SIZE, status.ackedOffset);
+    TEST_ASSERT_EQUAL_HEX16(baseCollector.shortAddress, status.collectorAddress);
+    printf("[bench] %u bytes pulled from RAM over a %u ms link: %u ms, %u B/s\n", (unsigned)status.stats.bytes, (unsigned)baseCollector.latencyMs,
+           (unsigned)(status.stats.endMs - status.stats.startMs), (unsigned)status.stats.bytesPerSecond);
+
+    // The file holds the same bytes, through a narrower window the collector asked for
+    HOST_BulkCollectorStart(&baseCollector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, FILE_SOURCE_ID, 0, 4);
+    stats = waitForEnd(5000);
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_SUCCESS, stats.endStatus);
+    TEST_ASSERT_EQUAL_UINT8(4, stats.window);
+    data = HOST_BulkCollectorGetData();
+    TEST_ASSERT_EQUAL_MEMORY(appSource.data(), data.data(), appSource.size());
+
+    HOST_BulkCollectorStop();
+}
+
+void test_collector_pulls_coredump_over_lossy_link() {
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+    TEST_ASSERT_NOT_NULL(partition);
+    std::vector<uint8_t> dump = makeData(partition->size, 8);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_erase_range(partition, 0, partition->size));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_write(partition, 0, dump.data(), dump.size()));
+
+    // The dump is only served once the application asks for it
+    host_bulk_collector_config_t collector = baseCollector;
+    host_bulk_collector_stats_t stats;
+    HOST_BulkCollectorStart(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, ZB_BULK_SOURCE_COREDUMP, 0, 0);
+    delay(50);
+    HOST_BulkCollectorGetStats(&stats);
+    TEST_ASSERT_TRUE(stats.started);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_NOT_FOUND, stats.startStatus);
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_AddBulkCoredumpSource());
+    esp_zb_lock_release();
+
+    collector.jitterMs = 3;
+    collector.lossEvery = 25;
+    collector.ackLossEvery = 10;
+    collector.ackEvery = 2;
+    HOST_BulkCollectorSetConfig(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, ZB_BULK_SOURCE_COREDUMP, 0, 0);
+    stats = waitForEnd(20000);
+
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_SUCCESS, stats.endStatus);
+    TEST_ASSERT_EQUAL_UINT32(partition->size, stats.size);
+    TEST_ASSERT_GREATER_THAN(0, stats.lost);
+    std::vector<uint8_t> data = HOST_BulkCollectorGetData();
+    TEST_ASSERT_EQUAL_MEMORY(dump.data(), data.data(), dump.size());
+
+    zb_bulk_status_t status;
+    ZB_GetBulkStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_BULK_DONE, status.state);
+    TEST_ASSERT_GREATER_OR_EQUAL(stats.lost, status.stats.retransmits);
+    printf("[bench] %u byte coredump over a %u ms link losing 1 in %u: %u ms, %u B/s, %u lost, %u sent again (%u timed out)\n",
+           (unsigned)status.stats.bytes, (unsigned)collector.latencyMs, (unsigned)collector.lossEvery,
+           (unsigned)(status.stats.endMs - status.stats.startMs), (unsigned)status.stats.bytesPerSecond, (unsigned)stats.lost,
+           (unsigned)status.stats.retransmits, (unsigned)status.stats.timeouts);
+
+    HOST_BulkCollectorStop();
+}
+
+void test_stalled_transfer_resumes() {
+    host_bulk_collector_config_t collector = baseCollector;
+    collector.silentAfterBytes = 2000;
+    HOST_BulkCollectorStart(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    host_bulk_collector_stats_t stats = waitForEnd(5000);
+
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_TIMEOUT, stats.endStatus);
+    TEST_ASSERT_GREATER_OR_EQUAL(2000, stats.endOffset);
+    TEST_ASSERT_LESS_THAN(APP_SOURCE_SIZE, stats.endOffset);
+    zb_bulk_status_t status;
+    ZB_GetBulkStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_BULK_FAILED, status.state);
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, status.error);
+
+    // Asking again from where the collector got to fills in the rest
+    uint8_t transfer = stats.transfer;
+    uint32_t resumeAt = stats.endOffset;
+    collector.silentAfterBytes = 0;
+    HOST_BulkCollectorSetConfig(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, resumeAt, 0);
+    stats = waitForEnd(5000);
+
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_SUCCESS, stats.endStatus);
+    TEST_ASSERT_NOT_EQUAL(transfer, stats.transfer);
+    std::vector<uint8_t> data = HOST_BulkCollectorGetData();
+    TEST_ASSERT_EQUAL_MEMORY(appSource.data(), data.data(), appSource.size());
+    ZB_GetBulkStatus(&status);
+    TEST_ASSERT_EQUAL_UINT32(resumeAt, status.stats.resumedFrom);
+    TEST_ASSERT_EQUAL_UINT32(APP_SOURCE_SIZE - resumeAt, status.stats.bytes);
+
+    HOST_BulkCollectorStop();
+}
+
+void test_rejected_and_aborted_requests() {
+    host_bulk_collector_stats_t stats;
+    zb_bulk_status_t status;
+
+    HOST_BulkCollectorStart(&baseCollector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, 0x7f, 0, 0);
+    delay(50);
+    HOST_BulkCollectorGetStats(&stats);
+    TEST_ASSERT_TRUE(stats.started);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_NOT_FOUND, stats.startStatus);
+
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, APP_SOURCE_SIZE + 1, 0);
+    delay(50);
+    HOST_BulkCollectorGetStats(&stats);
+    TEST_ASSERT_TRUE(stats.started);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_INVALID_VALUE, stats.startStatus);
+    TEST_ASSERT_EQUAL_UINT32(APP_SOURCE_SIZE, stats.size);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.chunksReceived);
+
+    // A collector that stops acknowledging and gives up is told where the transfer got to
+    host_bulk_collector_config_t collector = baseCollector;
+    collector.silentAfterBytes = 1000;
+    HOST_BulkCollectorSetConfig(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    delay(20);
+    HOST_BulkCollectorAbort();
+    stats = waitForEnd(1000);
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_ABORT, stats.endStatus);
+    ZB_GetBulkStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_BULK_FAILED, status.state);
+    TEST_ASSERT_EQUAL(ESP_FAIL, status.error);
+    TEST_ASSERT_EQUAL_UINT32(stats.endOffset, status.ackedOffset);
+
+    HOST_BulkCollectorStop();
+}
+
+void test_only_authorised_collectors_start() {
+    host_bulk_collector_stats_t stats;
+    host_bulk_collector_config_t collector = baseCollector;
+
+    // Anyone other than the trust centre needs to be named as the collector first
+    collector.shortAddress = 0x1234;
+    HOST_BulkCollectorStart(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    delay(50);
+    HOST_BulkCollectorGetStats(&stats);
+    TEST_ASSERT_TRUE(stats.started);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_NOT_AUTHORIZED, stats.startStatus);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.chunksReceived);
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    ZB_SetBulkCollector(0x1234);
+    esp_zb_lock_release();
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    stats = waitForEnd(5000);
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_SUCCESS, stats.endStatus);
+    std::vector<uint8_t> data = HOST_BulkCollectorGetData();
+    TEST_ASSERT_EQUAL_MEMORY(appSource.data(), data.data(), appSource.size());
+
+    // While the trust centre's transfer is stalled, the other collector is told to wait rather than taking it over
+    collector.shortAddress = 0x0000;
+    collector.silentAfterBytes = 1000;
+    HOST_BulkCollectorSetConfig(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    delay(20);
+    zb_bulk_status_t status;
+    ZB_GetBulkStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_BULK_SENDING, status.state);
+    TEST_ASSERT_EQUAL_HEX16(0x0000, status.collectorAddress);
+
+    collector.shortAddress = 0x1234;
+    HOST_BulkCollectorSetConfig(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    delay(20);
+    HOST_BulkCollectorGetStats(&stats);
+    TEST_ASSERT_TRUE(stats.started);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_BUSY, stats.startStatus);
+    ZB_GetBulkStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_BULK_SENDING, status.state);
+    TEST_ASSERT_EQUAL_HEX16(0x0000, status.collectorAddress);
+
+    // ...while the collector it is serving may start over
+    collector.shortAddress = 0x0000;
+    collector.silentAfterBytes = 0;
+    HOST_BulkCollectorSetConfig(&collector);
+    HOST_BulkCollectorRequest(HA_ESP_SENSOR_ENDPOINT, RAM_SOURCE_ID, 0, 0);
+    stats = waitForEnd(5000);
+    TEST_ASSERT_TRUE(stats.ended);
+    TEST_ASSERT_EQUAL_UINT8(ZB_BULK_STATUS_SUCCESS, stats.endStatus);
+    data = HOST_BulkCollectorGetData();
+    TEST_ASSERT_EQUAL_MEMORY(appSource.data(), data.data(), appSource.size());
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    ZB_SetBulkCollector(ZB_BULK_NO_COLLECTOR);
+    esp_zb_lock_release();
+    HOST_BulkCollectorStop();
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    // Sources are added, and the config set, ahead of the stack starting; short timeouts give up on a stalled
+    // collector quickly
+    static const zb_bulk_config_t bulkConfig = {
+        .window = ZB_BULK_MAX_WINDOW,
+        .chunkSize = ZB_BULK_MAX_CHUNK_SIZE,
+        .timeoutMs = APP_TIMEOUT_MS,
+        .maxRetries = 3,
+    };
+    ZB_SetBulkConfig(&bulkConfig);
+
+    zb_bulk_source_t source;
+    appSource = makeData(APP_SOURCE_SIZE, 9);
+    ZB_BulkRamSource(&source, appSource.data(), appSource.size());
+    ZB_AddBulkSource(RAM_SOURCE_ID, &source);
+
+    appFile = tmpfile();
+    fwrite(appSource.data(), 1, appSource.size(), appFile);
+    ZB_BulkFileSource(&source, appFile);
+    ZB_AddBulkSource(FILE_SOURCE_ID, &source);
+
+    // Boot the application as the Arduino core would, then wait for the simulated join to finish
+    setup();
+    zb_diagnostics_t diagnostics;
+    do {
+        delay(10);
+        HOST_ZbSync();
+        ZB_GetDiagnostics(&diagnostics);
+    } while (diagnostics.secondsSinceJoin == ZB_DIAGNOSTICS_NOT_JOINED);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_window_streams_source);
+    RUN_TEST(test_config_and_bounds);
+    RUN_TEST(test_lost_chunks_sent_selectively);
+    RUN_TEST(test_lossy_reordering_link);
+    RUN_TEST(test_silent_collector_times_out_and_resumes);
+    RUN_TEST(test_read_failure_fails_transfer);
+    RUN_TEST(test_bench_window);
+    RUN_TEST(test_collector_pulls_ram_and_file_sources);
+    RUN_TEST(test_collector_pulls_coredump_over_lossy_link);
+    RUN_TEST(test_stalled_transfer_resumes);
+    RUN_TEST(test_rejected_and_aborted_requests);
+    RUN_TEST(test_only_authorised_collectors_start);
+    int failures = UNITY_END();
+
+    fclose(appFile);
+    return failures;
+}
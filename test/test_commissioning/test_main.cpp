@@ -0,0 +1,262 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Commissioning supervisor backoff, budgets & fleet spread, and recovery through the application without a restart
+#include <Arduino.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+#define FLEET_SIZE 200
+#define FLEET_WINDOW_MS 100
+#define STATE_TIMEOUT_MS 5000
+
+static const zb_supervisor_config_t defaultConfig = {
+    .baseDelayMs = ZB_COMMISSIONING_BASE_DELAY_MS,
+    .maxDelayMs = ZB_COMMISSIONING_MAX_DELAY_MS,
+    .initAttempts = 3,
+    .steeringAttempts = 4,
+};
+
+static zb_supervisor_t supervisor;
+
+void setUp() {
+    ZB_SupervisorInit(&supervisor, &defaultConfig, 0x1234);
+}
+
+void tearDown() {
+}
+
+/********************* Supervisor **************************/
+void test_backoff_doubles_with_jitter_up_to_the_cap() {
+    uint32_t delay = 0;
+
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_INITIALISE, ZB_SupervisorStart(&supervisor));
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_STEER, ZB_SupervisorOnInitialised(&supervisor, true, true, &delay));
+
+    zb_supervisor_config_t unlimited = defaultConfig;
+    unlimited.steeringAttempts = 0;
+    supervisor.config = &unlimited;
+
+    // Never giving up runs long past any small attempt counter, and the backoff has to stay at the cap throughout
+    uint32_t expected = ZB_COMMISSIONING_BASE_DELAY_MS;
+    for (int attempt = 1; attempt <= 300; attempt++) {
+        TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_WAIT, ZB_SupervisorOnSteered(&supervisor, false, &delay));
+        TEST_ASSERT_EQUAL(ZB_COMMISSIONING_BACKOFF, supervisor.status.state);
+        TEST_ASSERT_TRUE(delay >= expected / 2 && delay <= expected);
+
+        TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_STEER, ZB_SupervisorOnTimer(&supervisor));
+        expected = std::min<uint32_t>(expected * 2, ZB_COMMISSIONING_MAX_DELAY_MS);
+    }
+
+    TEST_ASSERT_EQUAL(300, supervisor.status.steeringFailures);
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_NONE, ZB_SupervisorOnSteered(&supervisor, true, &delay));
+    TEST_ASSERT_EQUAL(ZB_COMMISSIONING_JOINED, supervisor.status.state);
+    TEST_ASSERT_EQUAL(0, supervisor.status.attempts);
+}
+
+void test_init_budget_ends_in_restart() {
+    uint32_t delay = 0;
+
+    ZB_SupervisorStart(&supervisor);
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_WAIT, ZB_SupervisorOnInitialised(&supervisor, false, true, &delay));
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_INITIALISE, ZB_SupervisorOnTimer(&supervisor));
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_WAIT, ZB_SupervisorOnInitialised(&supervisor, false, false, &delay));
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_INITIALISE, ZB_SupervisorOnTimer(&supervisor));
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_RESTART, ZB_SupervisorOnInitialised(&supervisor, false, false, &delay));
+    TEST_ASSERT_EQUAL(3, supervisor.status.initFailures);
+}
+
+void test_rejoined_network_needs_no_steering() {
+    uint32_t delay = 0;
+
+    ZB_SupervisorStart(&supervisor);
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_NONE, ZB_SupervisorOnInitialised(&supervisor, true, false, &delay));
+    TEST_ASSERT_EQUAL(ZB_COMMISSIONING_JOINED, supervisor.status.state);
+    TEST_ASSERT_EQUAL(1, supervisor.status.joins);
+}
+
+void test_steering_budget_gives_up_until_retried() {
+    uint32_t delay = 0;
+
+    ZB_SupervisorStart(&supervisor);
+    ZB_SupervisorOnInitialised(&supervisor, true, true, &delay);
+
+    for (int attempt = 1; attempt < defaultConfig.steeringAttempts; attempt++) {
+        TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_WAIT, ZB_SupervisorOnSteered(&supervisor, false, &delay));
+        TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_STEER, ZB_SupervisorOnTimer(&supervisor));
+    }
+
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_NONE, ZB_SupervisorOnSteered(&supervisor, false, &delay));
+    TEST_ASSERT_EQUAL(ZB_COMMISSIONING_FAILED, supervisor.status.state);
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_NONE, ZB_SupervisorOnTimer(&supervisor));
+
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_STEER, ZB_SupervisorRetry(&supervisor));
+    TEST_ASSERT_EQUAL(ZB_COMMISSIONING_STEERING, supervisor.status.state);
+    TEST_ASSERT_EQUAL(0, supervisor.status.attempts);
+
+    // A retry while backing off cuts the wait short, and the stale timer is then ignored
+    ZB_SupervisorOnSteered(&supervisor, false, &delay);
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_STEER, ZB_SupervisorRetry(&supervisor));
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_NONE, ZB_SupervisorOnTimer(&supervisor));
+    TEST_ASSERT_EQUAL(ZB_SUPERVISOR_ACTION_NONE, ZB_SupervisorRetry(&supervisor));
+}
+
+// A coordinator restart makes every device's steering fail at once; count how many retry in the busiest window
+void test_bench_fleet_spread() {
+    std::vector<uint32_t> retries;
+    uint32_t delay = 0;
+
+    for (uint32_t device = 0; device < FLEET_SIZE; device++) {
+        // Sequential IEEE addresses hashed the same way the application does, less the per-boot random
+        esp_zb_ieee_addr_t address = {(uint8_t)device, (uint8_t)(device >> 8), 0x4b, 0x12, 0x00, 0x74, 0x0b, 0x00};
+        uint32_t seed = 2166136261u;
+        for (size_t i = 0; i < sizeof(address); i++) {
+            seed = (seed ^ address[i]) * 16777619u;
+        }
+
+        zb_supervisor_t device_supervisor;
+        ZB_SupervisorInit(&device_supervisor, &defaultConfig, seed);
+        ZB_SupervisorStart(&device_supervisor);
+        ZB_SupervisorOnInitialised(&device_supervisor, true, true, &delay);
+
+        uint32_t at = 0;
+        for (int attempt = 0; attempt < 3; attempt++) {
+            ZB_SupervisorOnSteered(&device_supervisor, false, &delay);
+            ZB_SupervisorOnTimer(&device_supervisor);
+            at += delay;
+            retries.push_back(at);
+        }
+    }
+
+    std::sort(retries.begin(), retries.end());
+    size_t busiest = 0;
+    for (size_t first = 0, last = 0; last < retries.size(); last++) {
+        while (retries[last] - retries[first] >= FLEET_WINDOW_MS) {
+            first++;
+        }
+        busiest = std::max(busiest, last - first + 1);
+    }
+
+    // Fixed 1s retries would put the whole fleet in one window, every time
+    TEST_ASSERT_TRUE(busiest < FLEET_SIZE / 4);
+    printf("[bench] %d devices, 3 retries each: at most %zu retries in any %dms window (fixed delay: %d)\n", FLEET_SIZE, busiest,
+           FLEET_WINDOW_MS, FLEET_SIZE);
+}
+
+/********************* Application against a fake stack **************************/
+static std::atomic<int> initFailuresLeft(2);
+static std::atomic<int> steeringFailuresLeft(2);
+static std::atomic<int> restarts(0);
+static std::mutex statesMutex;
+static std::vector<zb_commissioning_state_t> states;
+
+static void onCommissioning(uint8_t modeMask) {
+    if (modeMask == ESP_ZB_BDB_MODE_INITIALIZATION) {
+        HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START, initFailuresLeft-- > 0 ? ESP_FAIL : ESP_OK);
+    } else if (modeMask & ESP_ZB_BDB_MODE_NETWORK_STEERING) {
+        bool found = steeringFailuresLeft-- <= 0;
+        if (found) {
+            HOST_ZbSetFactoryNew(false);
+        }
+        HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_STEERING, found ? ESP_OK : ESP_FAIL);
+    }
+}
+
+static void onCommissioningState(zb_commissioning_state_t state) {
+    std::lock_guard<std::mutex> lock(statesMutex);
+    states.push_back(state);
+}
+
+static zb_commissioning_status_t waitForState(zb_commissioning_state_t state) {
+    zb_commissioning_status_t status = {};
+
+    for (int waited = 0; waited < STATE_TIMEOUT_MS; waited += 5) {
+        ZB_GetCommissioningStatus(&status);
+        if (status.state == state) {
+            break;
+        }
+        delay(5);
+    }
+
+    TEST_ASSERT_EQUAL_MESSAGE(state, status.state, ZB_CommissioningStateToString(status.state));
+    return status;
+}
+
+void test_application_recovers_without_restart() {
+    static const zb_supervisor_config_t fastConfig = {
+        .baseDelayMs = 20,
+        .maxDelayMs = 200,
+        .initAttempts = 5,
+        .steeringAttempts = 3,
+    };
+
+    HOST_SetRestartHook([] { restarts++; });
+    HOST_ZbSetCommissioningHook(onCommissioning);
+    ZB_SetCommissioningConfig(&fastConfig);
+    ZB_SetOnCommissioningStateCallback(onCommissioningState);
+    ZB_StartMainTask();
+
+    zb_commissioning_status_t status = waitForState(ZB_COMMISSIONING_JOINED);
+    TEST_ASSERT_EQUAL(0, restarts.load());
+    TEST_ASSERT_EQUAL(2, status.initFailures);
+    TEST_ASSERT_EQUAL(2, status.steeringFailures);
+    TEST_ASSERT_EQUAL(1, status.joins);
+
+    delay(50);
+    std::lock_guard<std::mutex> lock(statesMutex);
+    const zb_commissioning_state_t expected[] = {
+        ZB_COMMISSIONING_INITIALISING, ZB_COMMISSIONING_BACKOFF, ZB_COMMISSIONING_INITIALISING, ZB_COMMISSIONING_BACKOFF,
+        ZB_COMMISSIONING_INITIALISING, ZB_COMMISSIONING_STEERING, ZB_COMMISSIONING_BACKOFF, ZB_COMMISSIONING_STEERING,
+        ZB_COMMISSIONING_BACKOFF, ZB_COMMISSIONING_STEERING, ZB_COMMISSIONING_JOINED,
+    };
+    TEST_ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]), states.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected, states.data(), sizeof(expected));
+}
+
+void test_application_retry_after_giving_up() {
+    // Factory reset into a network that is not there, until the steering budget runs out
+    steeringFailuresLeft = 100;
+    HOST_ZbSetFactoryNew(true);
+    HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START, ESP_OK);
+
+    zb_commissioning_status_t status = waitForState(ZB_COMMISSIONING_FAILED);
+    TEST_ASSERT_EQUAL(5, status.steeringFailures);
+
+    steeringFailuresLeft = 0;
+    ZB_RetryCommissioning();
+    status = waitForState(ZB_COMMISSIONING_JOINED);
+    TEST_ASSERT_EQUAL(2, status.joins);
+    TEST_ASSERT_EQUAL(0, restarts.load());
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_backoff_doubles_with_jitter_up_to_the_cap);
+    RUN_TEST(test_init_budget_ends_in_restart);
+    RUN_TEST(test_rejoined_network_needs_no_steering);
+    RUN_TEST(test_steering_budget_gives_up_until_retried);
+    RUN_TEST(test_bench_fleet_spread);
+    RUN_TEST(test_application_recovers_without_restart);
+    RUN_TEST(test_application_retry_after_giving_up);
+    return UNITY_END();
+}
@@ -0,0 +1,414 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Typed command parsing, responses & dispatch, fuzzed against a hand-written reference parser and timed per command
+#include <Arduino.h>
+#include <unity.h>
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Zigbee/zigbee_commands.h"
+#include "host_platform.h"
+
+#define CLUSTER_ID_CONFIG 0xFC10
+#define MANUFACTURER_CODE 0x1234
+#define CMD_SET_CONFIG 0x00
+#define CMD_GET_CONFIG 0x01
+#define CMD_PING 0x02
+#define CMD_CONFIG_RESPONSE 0x00
+
+#define FUZZ_ITERATIONS 200000
+#define BENCH_ITERATIONS 1000000
+
+// SetConfig: slot, version, enabled, name, blob
+typedef ZbPayload<uint8_t, uint16_t, bool, zb_char_string_t, zb_bytes_t> SetConfigPayload;
+typedef ZbCommandResponse<CMD_CONFIG_RESPONSE, uint8_t, uint16_t, zb_octet_string_t> ConfigResponse;
+
+static struct {
+    int calls;
+    uint8_t slot;
+    uint16_t version;
+    bool enabled;
+    zb_char_string_t name;
+    zb_bytes_t blob;
+} lastSet;
+
+static const uint8_t storedBlob[] = {0xde, 0xad, 0xbe, 0xef};
+static std::vector<std::vector<uint8_t>> sentFrames;
+static std::vector<esp_zb_apsde_data_req_t> sentRequests;
+
+static esp_zb_zcl_status_t onSetConfig(const esp_zb_zcl_cmd_info_t &info, uint8_t slot, uint16_t version, bool enabled, zb_char_string_t name, zb_bytes_t blob) {
+    lastSet.calls++;
+    lastSet.slot = slot;
+    lastSet.version = version;
+    lastSet.enabled = enabled;
+    lastSet.name = name;
+    lastSet.blob = blob;
+    return slot < 4 ? ESP_ZB_ZCL_STATUS_SUCCESS : ESP_ZB_ZCL_STATUS_INVALID_VALUE;
+}
+
+static esp_zb_zcl_status_t onGetConfig(const esp_zb_zcl_cmd_info_t &info, uint8_t slot) {
+    zb_octet_string_t blob = {storedBlob, sizeof(storedBlob)};
+    return ConfigResponse::send(info, slot, 7, blob) == ESP_OK ? ZB_ZCL_STATUS_RESPONDED : ESP_ZB_ZCL_STATUS_FAIL;
+}
+
+static esp_zb_zcl_status_t onPing(const esp_zb_zcl_cmd_info_t &info) {
+    return ESP_ZB_ZCL_STATUS_SUCCESS;
+}
+
+typedef ZbCommandRegistry<CLUSTER_ID_CONFIG,
+    ZbCommand<CMD_PING, onPing>,
+    ZbCommand<CMD_SET_CONFIG, onSetConfig>,
+    ZbCommand<CMD_GET_CONFIG, onGetConfig>
+> ConfigCommands;
+
+static esp_zb_zcl_custom_cluster_command_message_t makeMessage(uint8_t commandId, std::vector<uint8_t> &payload) {
+    esp_zb_zcl_custom_cluster_command_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.header.fc = ZCL_FRAME_CONTROL_CLUSTER_SPECIFIC | ZCL_FRAME_CONTROL_MANUFACTURER_SPECIFIC;
+    message.info.header.manuf_code = MANUFACTURER_CODE;
+    message.info.header.tsn = 0x42;
+    message.info.src_address.addr_type = ESP_ZB_ZCL_ADDR_TYPE_SHORT;
+    message.info.src_address.u.addr_short = 0x0000;
+    message.info.src_endpoint = 1;
+    message.info.dst_endpoint = 3;
+    message.info.cluster = CLUSTER_ID_CONFIG;
+    message.info.profile = ESP_ZB_AF_HA_PROFILE_ID;
+    message.info.command.id = commandId;
+    message.info.command.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV;
+    message.data.type = ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING;
+    message.data.size = payload.size();
+    message.data.value = payload.data();
+    return message;
+}
+
+static std::vector<uint8_t> setConfigFrame(uint8_t slot, const char *name, size_t blobLength) {
+    std::vector<uint8_t> frame = {slot, 0x34, 0x12, 1, (uint8_t)strlen(name)};
+    for (const char *c = name; *c; c++) {
+        frame.push_back(*c);
+    }
+    for (size_t i = 0; i < blobLength; i++) {
+        frame.push_back((uint8_t)i);
+    }
+    return frame;
+}
+
+// The reference: the same layout walked by hand, as applications used to
+static bool referenceParse(const std::vector<uint8_t> &data, uint8_t *slot, uint16_t *version, bool *enabled, size_t *nameOffset, size_t *nameLength) {
+    size_t offset = 0;
+
+    if (data.size() < 5 || data[3] > 1) {
+        return false;
+    }
+    *slot = data[0];
+    *version = data[1] | (data[2] << 8);
+    *enabled = data[3];
+    offset = 5;
+
+    if (data[4] == 0xff) {
+        *nameOffset = 0;
+        *nameLength = 0;
+    } else {
+        if (data.size() - offset < data[4]) {
+            return false;
+        }
+        *nameOffset = offset;
+        *nameLength = data[4];
+        offset += data[4];
+    }
+    return true;
+}
+
+void setUp() {
+    sentFrames.clear();
+    sentRequests.clear();
+    lastSet = {};
+}
+
+void tearDown() {
+}
+
+void test_fields_are_views_into_the_payload() {
+    std::vector<uint8_t> frame = setConfigFrame(2, "hall", 6);
+    SetConfigPayload::values_t values;
+
+    TEST_ASSERT_TRUE(SetConfigPayload::parse(frame.data(), frame.size(), &values));
+    TEST_ASSERT_EQUAL_UINT8(2, std::get<0>(values));
+    TEST_ASSERT_EQUAL_HEX16(0x1234, std::get<1>(values));
+    TEST_ASSERT_TRUE(std::get<2>(values));
+
+    zb_char_string_t name = std::get<3>(values);
+    TEST_ASSERT_EQUAL(4, name.length);
+    TEST_ASSERT_TRUE(name.data == (const char *)&frame[5]);
+
+    zb_bytes_t blob = std::get<4>(values);
+    TEST_ASSERT_EQUAL(6, blob.length);
+    TEST_ASSERT_TRUE(blob.data == &frame[9]);
+    TEST_ASSERT_EQUAL_size_t(5, SetConfigPayload::minSize);
+
+    // Every truncation before the blob is rejected
+    for (size_t length = 0; length < 9; length++) {
+        TEST_ASSERT_FALSE(SetConfigPayload::parse(frame.data(), length, &values));
+    }
+    TEST_ASSERT_FALSE(SetConfigPayload::parse(NULL, 0, &values));
+
+    // Booleans are 0 or 1, and an invalid string carries no data
+    frame[3] = 2;
+    TEST_ASSERT_FALSE(SetConfigPayload::parse(frame.data(), frame.size(), &values));
+    std::vector<uint8_t> invalidName = {1, 0, 0, 0, 0xff, 0xaa};
+    TEST_ASSERT_TRUE(SetConfigPayload::parse(invalidName.data(), invalidName.size(), &values));
+    TEST_ASSERT_NULL(std::get<3>(values).data);
+    TEST_ASSERT_EQUAL(1, std::get<4>(values).length);
+}
+
+void test_encode_round_trip() {
+    typedef ZbPayload<int16_t, uint32_t, zb_octet_string_t> Payload;
+    const uint8_t bytes[] = {1, 2, 3};
+    zb_octet_string_t octets = {bytes, sizeof(bytes)};
+    uint8_t buffer[16];
+    size_t length;
+
+    TEST_ASSERT_TRUE(Payload::encode(buffer, sizeof(buffer), &length, -2, 0x01020304, octets));
+    const uint8_t expected[] = {0xfe, 0xff, 0x04, 0x03, 0x02, 0x01, 0x03, 1, 2, 3};
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected), length);
+    TEST_ASSERT_EQUAL_MEMORY(expected, buffer, sizeof(expected));
+
+    Payload::values_t values;
+    TEST_ASSERT_TRUE(Payload::parse(buffer, length, &values));
+    TEST_ASSERT_EQUAL_INT16(-2, std::get<0>(values));
+    TEST_ASSERT_EQUAL_HEX32(0x01020304, std::get<1>(values));
+    TEST_ASSERT_EQUAL_MEMORY(bytes, std::get<2>(values).data, sizeof(bytes));
+
+    TEST_ASSERT_FALSE(Payload::encode(buffer, sizeof(expected) - 1, &length, -2, 0x01020304, octets));
+}
+
+void test_dispatch_and_responses() {
+    HOST_ZbSetApsDataHook([](const esp_zb_apsde_data_req_t *req) {
+        sentRequests.push_back(*req);
+        sentFrames.push_back(std::vector<uint8_t>(req->asdu, req->asdu + req->asdu_length));
+    });
+
+    // A handled command is answered with a successful Default Response, unless the sender disabled it
+    std::vector<uint8_t> set = setConfigFrame(1, "x", 3);
+    esp_zb_zcl_custom_cluster_command_message_t message = makeMessage(CMD_SET_CONFIG, set);
+    TEST_ASSERT_EQUAL(ESP_OK, ConfigCommands::dispatch(&message));
+    TEST_ASSERT_EQUAL(1, lastSet.calls);
+    TEST_ASSERT_EQUAL(3, lastSet.blob.length);
+    TEST_ASSERT_EQUAL(1, sentFrames.size());
+    const uint8_t success[] = {0x1c, 0x34, 0x12, 0x42, ZCL_CMD_DEFAULT_RESPONSE, CMD_SET_CONFIG, ESP_ZB_ZCL_STATUS_SUCCESS};
+    TEST_ASSERT_EQUAL(sizeof(success), sentFrames[0].size());
+    TEST_ASSERT_EQUAL_MEMORY(success, sentFrames[0].data(), sizeof(success));
+
+    message.info.header.fc |= ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE;
+    TEST_ASSERT_EQUAL(ESP_OK, ConfigCommands::dispatch(&message));
+    TEST_ASSERT_EQUAL(2, lastSet.calls);
+    TEST_ASSERT_EQUAL(1, sentFrames.size());
+    sentFrames.clear();
+    sentRequests.clear();
+
+    // A typed response goes back to the sender, manufacturer specific like the request
+    std::vector<uint8_t> get = {2};
+    message = makeMessage(CMD_GET_CONFIG, get);
+    TEST_ASSERT_EQUAL(ESP_OK, ConfigCommands::dispatch(&message));
+    TEST_ASSERT_EQUAL(1, sentFrames.size());
+    const uint8_t response[] = {0x1d, 0x34, 0x12, 0x42, CMD_CONFIG_RESPONSE, 2, 7, 0, 4, 0xde, 0xad, 0xbe, 0xef};
+    TEST_ASSERT_EQUAL(sizeof(response), sentFrames[0].size());
+    TEST_ASSERT_EQUAL_MEMORY(response, sentFrames[0].data(), sizeof(response));
+    TEST_ASSERT_EQUAL(ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT, sentRequests[0].dst_addr_mode);
+    TEST_ASSERT_EQUAL_HEX16(0x0000, sentRequests[0].dst_addr.addr_short);
+    TEST_ASSERT_EQUAL(1, sentRequests[0].dst_endpoint);
+    TEST_ASSERT_EQUAL(3, sentRequests[0].src_endpoint);
+    TEST_ASSERT_EQUAL_HEX16(CLUSTER_ID_CONFIG, sentRequests[0].cluster_id);
+
+    // Failures are answered with a Default Response carrying the status
+    std::vector<uint8_t> truncated = {1, 0x34};
+    message = makeMessage(CMD_SET_CONFIG, truncated);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, ConfigCommands::dispatch(&message));
+
+    std::vector<uint8_t> badSlot = setConfigFrame(9, "", 0);
+    message = makeMessage(CMD_SET_CONFIG, badSlot);
+    TEST_ASSERT_EQUAL(ESP_FAIL, ConfigCommands::dispatch(&message));
+
+    std::vector<uint8_t> empty;
+    message = makeMessage(0x7f, empty);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, ConfigCommands::dispatch(&message));
+
+    TEST_ASSERT_EQUAL(4, sentFrames.size());
+    const uint8_t malformed[] = {0x1c, 0x34, 0x12, 0x42, ZCL_CMD_DEFAULT_RESPONSE, CMD_SET_CONFIG, ESP_ZB_ZCL_STATUS_MALFORMED_CMD};
+    const uint8_t invalid[] = {0x1c, 0x34, 0x12, 0x42, ZCL_CMD_DEFAULT_RESPONSE, CMD_SET_CONFIG, ESP_ZB_ZCL_STATUS_INVALID_VALUE};
+    const uint8_t unsupported[] = {0x1c, 0x34, 0x12, 0x42, ZCL_CMD_DEFAULT_RESPONSE, 0x7f, ESP_ZB_ZCL_STATUS_UNSUP_CMD};
+    TEST_ASSERT_EQUAL_MEMORY(malformed, sentFrames[1].data(), sizeof(malformed));
+    TEST_ASSERT_EQUAL_MEMORY(invalid, sentFrames[2].data(), sizeof(invalid));
+    TEST_ASSERT_EQUAL_MEMORY(unsupported, sentFrames[3].data(), sizeof(unsupported));
+
+    // Other clusters are left for the next registry
+    message = makeMessage(CMD_PING, empty);
+    message.info.cluster = CLUSTER_ID_CONFIG + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, ConfigCommands::dispatch(&message));
+    TEST_ASSERT_EQUAL(4, sentFrames.size());
+
+    HOST_ZbSetApsDataHook(NULL);
+}
+
+void test_claimed_cluster_indications() {
+    const uint8_t command[] = {0x05, 0x34, 0x12, 0x43, CMD_GET_CONFIG, 2};
+    esp_zb_apsde_data_ind_t ind = {};
+    ind.src_short_addr = 0x1a2b;
+    ind.src_endpoint = 1;
+    ind.dst_endpoint = 3;
+    ind.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    ind.cluster_id = CLUSTER_ID_CONFIG;
+    ind.asdu = (uint8_t *)command;
+    ind.asdu_length = sizeof(command);
+
+    // Left to the stack until a registry claims the cluster
+    esp_zb_zcl_custom_cluster_command_message_t message;
+    TEST_ASSERT_FALSE(ZB_CommandsParseIndication(&ind, &message));
+    TEST_ASSERT_EQUAL(ESP_OK, ConfigCommands::claim());
+    TEST_ASSERT_EQUAL(ESP_OK, ConfigCommands::claim());
+    TEST_ASSERT_TRUE(ZB_CommandsParseIndication(&ind, &message));
+
+    TEST_ASSERT_EQUAL_HEX8(0x05, message.info.header.fc);
+    TEST_ASSERT_EQUAL_HEX16(MANUFACTURER_CODE, message.info.header.manuf_code);
+    TEST_ASSERT_EQUAL_HEX8(0x43, message.info.header.tsn);
+    TEST_ASSERT_EQUAL(CMD_GET_CONFIG, message.info.command.id);
+    TEST_ASSERT_EQUAL(ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV, message.info.command.direction);
+    TEST_ASSERT_EQUAL_HEX16(0x1a2b, message.info.src_address.u.addr_short);
+    TEST_ASSERT_EQUAL(1, message.info.src_endpoint);
+    TEST_ASSERT_EQUAL(3, message.info.dst_endpoint);
+    TEST_ASSERT_EQUAL_HEX16(CLUSTER_ID_CONFIG, message.info.cluster);
+    TEST_ASSERT_EQUAL(1, message.data.size);
+    TEST_ASSERT_TRUE(message.data.value == command + 5);
+
+    // Profile wide commands & truncated headers stay with the stack
+    const uint8_t readAttributes[] = {0x04, 0x34, 0x12, 0x44, 0x00, 0x00, 0x00};
+    ind.asdu = (uint8_t *)readAttributes;
+    ind.asdu_length = sizeof(readAttributes);
+    TEST_ASSERT_FALSE(ZB_CommandsParseIndication(&ind, &message));
+    ind.asdu = (uint8_t *)command;
+    ind.asdu_length = 4;
+    TEST_ASSERT_FALSE(ZB_CommandsParseIndication(&ind, &message));
+
+    // Without a manufacturer code the header is 3 bytes
+    const uint8_t plain[] = {0x01, 0x45, CMD_PING};
+    ind.asdu = (uint8_t *)plain;
+    ind.asdu_length = sizeof(plain);
+    TEST_ASSERT_TRUE(ZB_CommandsParseIndication(&ind, &message));
+    TEST_ASSERT_EQUAL_HEX8(0x45, message.info.header.tsn);
+    TEST_ASSERT_EQUAL(CMD_PING, message.info.command.id);
+    TEST_ASSERT_EQUAL(0, message.data.size);
+
+    // Answered once, by the registry
+    HOST_ZbSetApsDataHook([](const esp_zb_apsde_data_req_t *req) { sentFrames.push_back(std::vector<uint8_t>(req->asdu, req->asdu + req->asdu_length)); });
+    sentFrames.clear();
+    TEST_ASSERT_EQUAL(ESP_OK, ConfigCommands::dispatch(&message));
+    const uint8_t answer[] = {0x18, 0x45, ZCL_CMD_DEFAULT_RESPONSE, CMD_PING, ESP_ZB_ZCL_STATUS_SUCCESS};
+    TEST_ASSERT_EQUAL(1, sentFrames.size());
+    TEST_ASSERT_EQUAL(sizeof(answer), sentFrames[0].size());
+    TEST_ASSERT_EQUAL_MEMORY(answer, sentFrames[0].data(), sizeof(answer));
+    HOST_ZbSetApsDataHook(NULL);
+}
+
+void test_fuzz_against_reference() {
+    std::mt19937 random(0x5eed);
+    SetConfigPayload::values_t values;
+    int accepted = 0;
+
+    for (int i = 0; i < FUZZ_ITERATIONS; i++) {
+        std::vector<uint8_t> frame;
+
+        // Half mutate a valid frame, half are noise of random length
+        if (i & 1) {
+            frame = setConfigFrame(random() & 7, "kitchen", random() % 24);
+            frame.resize(random() % (frame.size() + 4), 0);
+            for (int flips = random() % 3; flips > 0 && !frame.empty(); flips--) {
+                frame[random() % frame.size()] = random();
+            }
+        } else {
+            frame.resize(random() % 32);
+            for (uint8_t &byte : frame) {
+                byte = random();
+            }
+        }
+
+        // Parse out of a buffer sized exactly to the frame, so any overread trips the sanitiser in instrumented builds
+        std::unique_ptr<uint8_t[]> exact(new uint8_t[frame.size() ? frame.size() : 1]);
+        memcpy(exact.get(), frame.data(), frame.size());
+
+        uint8_t slot;
+        uint16_t version;
+        bool enabled;
+        size_t nameOffset = 0, nameLength = 0;
+        bool expected = referenceParse(frame, &slot, &version, &enabled, &nameOffset, &nameLength);
+        bool parsed = SetConfigPayload::parse(exact.get(), frame.size(), &values);
+
+        TEST_ASSERT_EQUAL(expected, parsed);
+        if (parsed) {
+            accepted++;
+            TEST_ASSERT_EQUAL_UINT8(slot, std::get<0>(values));
+            TEST_ASSERT_EQUAL_UINT16(version, std::get<1>(values));
+            TEST_ASSERT_EQUAL(enabled, std::get<2>(values));
+            TEST_ASSERT_EQUAL(nameLength, std::get<3>(values).length);
+            if (nameLength) {
+                TEST_ASSERT_TRUE(std::get<3>(values).data == (const char *)exact.get() + nameOffset);
+            }
+
+            const zb_bytes_t &blob = std::get<4>(values);
+            TEST_ASSERT_TRUE(blob.data + blob.length == exact.get() + frame.size());
+        }
+    }
+
+    printf("[bench] fuzz: %d frames, %d accepted\n", FUZZ_ITERATIONS, accepted);
+}
+
+void test_parse_throughput() {
+    std::vector<uint8_t> frame = setConfigFrame(3, "living room", 48);
+    SetConfigPayload::values_t values;
+    volatile uint32_t sink = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        SetConfigPayload::parse(frame.data(), frame.size() - (i & 1), &values);
+        sink += std::get<4>(values).length;
+    }
+    int64_t parseUs = esp_timer_get_time() - start;
+
+    esp_zb_zcl_custom_cluster_command_message_t message = makeMessage(CMD_SET_CONFIG, frame);
+    message.info.header.fc |= ZCL_FRAME_CONTROL_DISABLE_DEFAULT_RESPONSE;
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        ConfigCommands::dispatch(&message);
+    }
+    int64_t dispatchUs = esp_timer_get_time() - start;
+
+    printf("[bench] %d byte SetConfig: parse %.1fns, registry dispatch to handler %.1fns\n", (int)frame.size(), parseUs * 1000.0 / BENCH_ITERATIONS,
+           dispatchUs * 1000.0 / BENCH_ITERATIONS);
+    TEST_ASSERT_EQUAL(BENCH_ITERATIONS, lastSet.calls);
+    (void)sink;
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fields_are_views_into_the_payload);
+    RUN_TEST(test_encode_round_trip);
+    RUN_TEST(test_dispatch_and_responses);
+    RUN_TEST(test_claimed_cluster_indications);
+    RUN_TEST(test_fuzz_against_reference);
+    RUN_TEST(test_parse_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,254 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Deferred log record capture and formatting, drop accounting and multi-producer safety, and the cost of a log call
+#include <Arduino.h>
+#include <unity.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Strip debug records from this file only, as a build with CORE_DEBUG_LEVEL=3 would strip them everywhere
+#define DLOG_LEVEL ARDUHAL_LOG_LEVEL_INFO
+#include "Log/deferred_log.h"
+
+#define BENCH_ITERATIONS 200000
+#define PRODUCER_THREADS 4
+#define PRODUCER_RECORDS 20000
+
+static void drainAll() {
+    dlog_record_t record;
+    while (DLOG_Read(&record)) {
+    }
+}
+
+static void readFormatted(char *buffer, size_t size) {
+    dlog_record_t record;
+    TEST_ASSERT_TRUE_MESSAGE(DLOG_Read(&record), "no record written");
+    DLOG_FormatRecord(&record, buffer, size);
+}
+
+void setUp() {
+    drainAll();
+}
+
+void tearDown() {
+}
+
+void test_formats_like_printf() {
+    char actual[DLOG_LINE_SIZE];
+    char expected[DLOG_LINE_SIZE];
+    uint8_t byte = 0xa5;
+    uint16_t panId = 0xbeef;
+    int16_t negativeShort = -2;
+    int64_t big = -1234567890123LL;
+    const char *name = "steering";
+
+    dlog_i("int %d neg %d unsigned %u hex %02x pan 0x%04hx", 42, -7, 4000000000u, byte, panId);
+    snprintf(expected, sizeof(expected), "int %d neg %d unsigned %u hex %02x pan 0x%04hx", 42, -7, 4000000000u, byte, panId);
+    readFormatted(actual, sizeof(actual));
+    TEST_ASSERT_EQUAL_STRING(expected, actual);
+
+    dlog_i("%hd %hx %lld %llu %5.2f", negativeShort, negativeShort, (long long)big, (unsigned long long)UINT64_MAX, 3.14159);
+    snprintf(expected, sizeof(expected), "%hd %hx %lld %llu %5.2f", negativeShort, negativeShort, (long long)big, (unsigned long long)UINT64_MAX, 3.14159);
+    readFormatted(actual, sizeof(actual));
+    TEST_ASSERT_EQUAL_STRING(expected, actual);
+
+    dlog_i("|%-10s|%c %% %p|%.3s", name, 'z', (void *)name, name);
+    snprintf(expected, sizeof(expected), "|%-10s|%c %% %p|%.3s", name, 'z', (void *)name, name);
+    readFormatted(actual, sizeof(actual));
+    TEST_ASSERT_EQUAL_STRING(expected, actual);
+
+    // Truncated output still reports the full length, as snprintf does
+    dlog_i("no arguments at all, just text that is longer than the buffer");
+    dlog_record_t record;
+    TEST_ASSERT_TRUE(DLOG_Read(&record));
+    char small[8];
+    TEST_ASSERT_EQUAL_INT(61, DLOG_FormatRecord(&record, small, sizeof(small)));
+    TEST_ASSERT_EQUAL_STRING("no argu", small);
+}
+
+void test_joined_line_matches_log_i() {
+    uint8_t extendedPanId[8] = {0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe};
+    char actual[DLOG_LINE_SIZE];
+    char expected[DLOG_LINE_SIZE];
+
+    dlog_i("Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
+           extendedPanId[7], extendedPanId[6], extendedPanId[5], extendedPanId[4], extendedPanId[3], extendedPanId[2], extendedPanId[1], extendedPanId[0],
+           (uint16_t)0x1a62, 15, (uint16_t)0x4c2e);
+    snprintf(expected, sizeof(expected),
+             "Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
+             extendedPanId[7], extendedPanId[6], extendedPanId[5], extendedPanId[4], extendedPanId[3], extendedPanId[2], extendedPanId[1], extendedPanId[0],
+             (uint16_t)0x1a62, 15, (uint16_t)0x4c2e);
+
+    readFormatted(actual, sizeof(actual));
+    TEST_ASSERT_EQUAL_STRING(expected, actual);
+}
+
+void test_records_carry_call_site() {
+    uint32_t before = millis();
+    dlog_w("warning %d", 1);
+
+    dlog_record_t record;
+    TEST_ASSERT_TRUE(DLOG_Read(&record));
+    TEST_ASSERT_EQUAL_INT('W', record.level);
+    TEST_ASSERT_EQUAL_STRING("test_records_carry_call_site", record.func);
+    TEST_ASSERT_EQUAL_INT(__LINE__ - 6, record.line);
+    TEST_ASSERT_TRUE(record.timestampMs >= before && record.timestampMs <= millis());
+    TEST_ASSERT_EQUAL_STRING("warning %d", record.format);
+}
+
+void test_full_ring_drops_and_counts() {
+    dlog_stats_t before, after;
+    DLOG_GetStats(&before);
+
+    for (int i = 0; i < DLOG_RING_SIZE + 10; i++) {
+        dlog_i("record %d", i);
+    }
+
+    DLOG_GetStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(DLOG_RING_SIZE, after.written - before.written);
+    TEST_ASSERT_EQUAL_UINT32(10, after.dropped - before.dropped);
+
+    // The oldest records are kept, newer ones are the ones lost
+    char line[32];
+    for (int i = 0; i < DLOG_RING_SIZE; i++) {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "record %d", i);
+        readFormatted(line, sizeof(line));
+        TEST_ASSERT_EQUAL_STRING(expected, line);
+    }
+
+    dlog_record_t record;
+    TEST_ASSERT_FALSE(DLOG_Read(&record));
+}
+
+void test_stripped_levels_cost_nothing() {
+    static int evaluated = 0;
+    dlog_stats_t before, after;
+
+    DLOG_GetStats(&before);
+    dlog_d("debug %d", ++evaluated);
+    dlog_v("verbose %d", ++evaluated);
+    DLOG_GetStats(&after);
+
+    TEST_ASSERT_EQUAL_UINT32(before.written, after.written);
+    TEST_ASSERT_EQUAL_UINT32(before.dropped, after.dropped);
+    TEST_ASSERT_EQUAL_INT(0, evaluated);
+}
+
+void test_concurrent_producers() {
+    std::atomic<bool> started(false);
+    std::atomic<bool> done(false);
+    std::vector<int> lastSequence(PRODUCER_THREADS, -1);
+    uint32_t received = 0;
+    bool ordered = true;
+    dlog_stats_t before, after;
+
+    DLOG_GetStats(&before);
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < PRODUCER_THREADS; t++) {
+        producers.emplace_back([t, &started] {
+            while (!started.load()) {
+                std::this_thread::yield();
+            }
+
+            // Log in short bursts, as tasks do, rather than flooding the ring flat out
+            for (int i = 0; i < PRODUCER_RECORDS; i++) {
+                dlog_i("producer %d record %d", t, i);
+                if (i % 8 == 7) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    std::thread consumer([&] {
+        dlog_record_t record;
+        started = true;
+        for (;;) {
+            bool finished = done.load();
+            while (DLOG_Read(&record)) {
+                int thread = (int)record.args[0];
+                int sequence = (int)record.args[1];
+                ordered = ordered && record.argCount == 2 && sequence > lastSequence[thread];
+                lastSequence[thread] = sequence;
+                received++;
+            }
+            if (finished) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+    done = true;
+    consumer.join();
+
+    DLOG_GetStats(&after);
+    uint32_t written = after.written - before.written;
+    uint32_t dropped = after.dropped - before.dropped;
+
+    TEST_ASSERT_TRUE_MESSAGE(ordered, "records from one producer arrived out of order or corrupted");
+    TEST_ASSERT_EQUAL_UINT32(PRODUCER_THREADS * PRODUCER_RECORDS, written + dropped);
+    TEST_ASSERT_EQUAL_UINT32(written, received);
+    printf("[bench] %d producers x %d records: %u delivered, %u dropped\n", PRODUCER_THREADS, PRODUCER_RECORDS, received, dropped);
+}
+
+void test_bench_log_call() {
+    uint8_t extendedPanId[8] = {0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe};
+    char line[DLOG_LINE_SIZE];
+    int64_t deferredNs = 0;
+
+    // Drain between batches so every call lands in the ring
+    for (int i = 0; i < BENCH_ITERATIONS; i += DLOG_RING_SIZE) {
+        auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < DLOG_RING_SIZE; j++) {
+            dlog_i("Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
+                   extendedPanId[7], extendedPanId[6], extendedPanId[5], extendedPanId[4], extendedPanId[3], extendedPanId[2], extendedPanId[1], extendedPanId[0],
+                   (uint16_t)0x1a62, j, (uint16_t)0x4c2e);
+        }
+        deferredNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        drainAll();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        snprintf(line, sizeof(line),
+                 "Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
+                 extendedPanId[7], extendedPanId[6], extendedPanId[5], extendedPanId[4], extendedPanId[3], extendedPanId[2], extendedPanId[1], extendedPanId[0],
+                 (uint16_t)0x1a62, i, (uint16_t)0x4c2e);
+    }
+    int64_t inlineNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[bench] joined line, deferred record:   %6.1f ns/call\n", (double)deferredNs / BENCH_ITERATIONS);
+    printf("[bench] joined line, inline formatting: %6.1f ns/call (before any serial output)\n", (double)inlineNs / BENCH_ITERATIONS);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_formats_like_printf);
+    RUN_TEST(test_joined_line_matches_log_i);
+    RUN_TEST(test_records_carry_call_site);
+    RUN_TEST(test_full_ring_drops_and_counts);
+    RUN_TEST(test_stripped_levels_cost_nothing);
+    RUN_TEST(test_concurrent_producers);
+    RUN_TEST(test_bench_log_call);
+    return UNITY_END();
+}
@@ -0,0 +1,220 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Device descriptor checks in the compiler, and a multi-endpoint device registered through the application's stack task
+#include <Arduino.h>
+#include <unity.h>
+
+#include <atomic>
+
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+#define GANG_COUNT ZB_MAX_ENDPOINTS
+#define CLUSTER_ID_GANG_CONFIG 0xFC10
+#define ATTR_ON_OFF 0x0000
+#define ATTR_GANG_MODE 0x0000
+#define ATTR_GANG_LABEL 0x0001
+
+static constexpr bool off = false;
+static constexpr uint8_t toggleMode = 2;
+static constexpr char noLabel[] = "\x00";
+
+static constexpr zb_attribute_desc_t onOffAttributes[] = {
+    {ATTR_ON_OFF, ESP_ZB_ZCL_ATTR_TYPE_BOOL, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &off},
+};
+static constexpr zb_attribute_desc_t gangConfigAttributes[] = {
+    {ATTR_GANG_MODE, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, &toggleMode},
+    {ATTR_GANG_LABEL, ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING, ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, noLabel},
+};
+static constexpr zb_cluster_desc_t gangClusters[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, onOffAttributes),
+    ZB_CLUSTER(CLUSTER_ID_GANG_CONFIG, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, gangConfigAttributes),
+    ZB_CLUSTER_NO_ATTRIBUTES(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE),
+};
+static constexpr zb_endpoint_desc_t gangEndpoints[GANG_COUNT] = {
+    ZB_ENDPOINT(1, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(2, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(3, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(4, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(5, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(6, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(7, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(10, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+};
+static constexpr zb_device_desc_t gangDevice = ZB_DEVICE(gangEndpoints);
+ZB_ASSERT_DEVICE_VALID(gangDevice);
+
+// Descriptors each breaking one rule
+static constexpr zb_endpoint_desc_t duplicateEndpoints[] = {
+    ZB_ENDPOINT(1, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+    ZB_ENDPOINT(1, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID, gangClusters),
+};
+static constexpr zb_endpoint_desc_t reservedEndpoint[] = {
+    ZB_ENDPOINT_NO_CLUSTERS(242, ESP_ZB_HA_CUSTOM_ATTR_DEVICE_ID),
+};
+static constexpr zb_endpoint_desc_t tooManyEndpoints[ZB_MAX_ENDPOINTS + 1] = {
+    ZB_ENDPOINT_NO_CLUSTERS(1, 0), ZB_ENDPOINT_NO_CLUSTERS(2, 0), ZB_ENDPOINT_NO_CLUSTERS(3, 0), ZB_ENDPOINT_NO_CLUSTERS(4, 0),
+    ZB_ENDPOINT_NO_CLUSTERS(5, 0), ZB_ENDPOINT_NO_CLUSTERS(6, 0), ZB_ENDPOINT_NO_CLUSTERS(7, 0), ZB_ENDPOINT_NO_CLUSTERS(8, 0),
+    ZB_ENDPOINT_NO_CLUSTERS(9, 0),
+};
+static constexpr zb_cluster_desc_t frameworkCluster[] = {
+    ZB_CLUSTER_NO_ATTRIBUTES(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE),
+};
+static constexpr zb_cluster_desc_t duplicateCluster[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, onOffAttributes),
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, onOffAttributes),
+};
+static constexpr zb_attribute_desc_t duplicateAttribute[] = {
+    {ATTR_ON_OFF, ESP_ZB_ZCL_ATTR_TYPE_BOOL, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &off},
+    {ATTR_ON_OFF, ESP_ZB_ZCL_ATTR_TYPE_BOOL, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &off},
+};
+static constexpr zb_attribute_desc_t missingDefault[] = {
+    {ATTR_ON_OFF, ESP_ZB_ZCL_ATTR_TYPE_BOOL, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, NULL},
+};
+static constexpr zb_attribute_desc_t persistentAttribute[] = {
+    {ATTR_ON_OFF, ESP_ZB_ZCL_ATTR_TYPE_BOOL, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ZB_ATTR_ACCESS_PERSISTENT, &off},
+};
+static constexpr zb_cluster_desc_t clientPersistentCluster[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE, persistentAttribute),
+};
+static constexpr zb_cluster_desc_t duplicateAttributeCluster[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, duplicateAttribute),
+};
+static constexpr zb_cluster_desc_t missingDefaultCluster[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, missingDefault),
+};
+static constexpr zb_endpoint_desc_t frameworkClusterEndpoint[] = {ZB_ENDPOINT(1, 0, frameworkCluster)};
+static constexpr zb_endpoint_desc_t duplicateClusterEndpoint[] = {ZB_ENDPOINT(1, 0, duplicateCluster)};
+static constexpr zb_endpoint_desc_t duplicateAttributeEndpoint[] = {ZB_ENDPOINT(1, 0, duplicateAttributeCluster)};
+static constexpr zb_endpoint_desc_t missingDefaultEndpoint[] = {ZB_ENDPOINT(1, 0, missingDefaultCluster)};
+static constexpr zb_endpoint_desc_t clientPersistentEndpoint[] = {ZB_ENDPOINT(1, 0, clientPersistentCluster)};
+
+static_assert(!ZbDeviceEndpointsValid(ZB_DEVICE(duplicateEndpoints)), "duplicate endpoint ids");
+static_assert(!ZbDeviceEndpointsValid(ZB_DEVICE(reservedEndpoint)), "endpoint id above 240");
+static_assert(!ZbDeviceEndpointsValid(ZB_DEVICE(tooManyEndpoints)), "more than ZB_MAX_ENDPOINTS");
+static_assert(!ZbDeviceClustersValid(ZB_DEVICE(frameworkClusterEndpoint)), "framework cluster listed");
+static_assert(!ZbDeviceClustersValid(ZB_DEVICE(duplicateClusterEndpoint)), "duplicate cluster");
+static_assert(ZbDeviceClustersValid(ZB_DEVICE(duplicateAttributeEndpoint)) && !ZbDeviceAttributesValid(ZB_DEVICE(duplicateAttributeEndpoint)),
+              "duplicate attribute");
+static_assert(!ZbDeviceAttributesValid(ZB_DEVICE(missingDefaultEndpoint)), "attribute without a default");
+static_assert(!ZbDevicePersistenceValid(ZB_DEVICE(clientPersistentEndpoint)), "persistent client attribute");
+static_assert(ZbDeviceClusterCount(gangDevice) == 3 * GANG_COUNT && ZbDeviceAttributeCount(gangDevice) == 3 * GANG_COUNT, "descriptor totals");
+
+static std::atomic<int> identifyChanges(0);
+static std::atomic<bool> identifying(false);
+
+static void onIdentify(bool isIdentifying) {
+    identifying = isIdentifying;
+    identifyChanges++;
+}
+
+// Identify callbacks arrive through the dispatch worker, so give it a moment after the stack has run the change
+static void setIdentify(uint8_t endpoint, bool isIdentifying) {
+    HOST_ZbSetIdentify(endpoint, isIdentifying);
+    HOST_ZbSync();
+    delay(20);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_every_endpoint_is_registered() {
+    for (uint8_t i = 0; i < GANG_COUNT; i++) {
+        uint8_t endpoint = gangEndpoints[i].endpoint;
+
+        esp_zb_zcl_attr_t *manufacturer =
+            esp_zb_zcl_get_attribute(endpoint, ESP_ZB_ZCL_CLUSTER_ID_BASIC, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID);
+        TEST_ASSERT_NOT_NULL(manufacturer);
+        TEST_ASSERT_EQUAL_MEMORY(MANUFACTURER_NAME, manufacturer->data_p, sizeof(MANUFACTURER_NAME) - 1);
+        TEST_ASSERT_NOT_NULL(
+            esp_zb_zcl_get_attribute(endpoint, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID));
+
+        esp_zb_zcl_attr_t *onOff = esp_zb_zcl_get_attribute(endpoint, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ATTR_ON_OFF);
+        TEST_ASSERT_NOT_NULL(onOff);
+        TEST_ASSERT_EQUAL_HEX8(ESP_ZB_ZCL_ATTR_TYPE_BOOL, onOff->type);
+        TEST_ASSERT_EQUAL_UINT8(0, *(uint8_t *)onOff->data_p);
+
+        esp_zb_zcl_attr_t *mode = esp_zb_zcl_get_attribute(endpoint, CLUSTER_ID_GANG_CONFIG, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ATTR_GANG_MODE);
+        TEST_ASSERT_NOT_NULL(mode);
+        TEST_ASSERT_EQUAL_HEX8(ESP_ZB_ZCL_ATTR_ACCESS_READ_WRITE, mode->access);
+        TEST_ASSERT_EQUAL_UINT8(toggleMode, *(uint8_t *)mode->data_p);
+
+        // Diagnostics are device wide, so only the first endpoint carries them
+        esp_zb_zcl_attr_t *resets =
+            esp_zb_zcl_get_attribute(endpoint, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ZB_ATTR_DIAGNOSTICS_NUMBER_OF_RESETS_ID);
+        TEST_ASSERT_TRUE(i == 0 ? resets != NULL : resets == NULL);
+
+        // As is the OTA Upgrade client
+        esp_zb_zcl_attr_t *fileVersion =
+            esp_zb_zcl_get_attribute(endpoint, ESP_ZB_ZCL_CLUSTER_ID_OTA_UPGRADE, ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE, ZB_ATTR_OTA_CURRENT_FILE_VERSION_ID);
+        TEST_ASSERT_TRUE(i == 0 ? fileVersion != NULL : fileVersion == NULL);
+    }
+
+    // Endpoints outside the descriptor stay unregistered
+    TEST_ASSERT_NULL(esp_zb_zcl_get_attribute(8, ESP_ZB_ZCL_CLUSTER_ID_BASIC, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_BASIC_MANUFACTURER_NAME_ID));
+}
+
+void test_identify_on_any_endpoint() {
+    identifyChanges = 0;
+
+    setIdentify(2, true);
+    setIdentify(10, true);
+    TEST_ASSERT_TRUE(identifying);
+    TEST_ASSERT_EQUAL(1, identifyChanges.load());
+
+    // Still identifying while one endpoint is
+    setIdentify(2, false);
+    TEST_ASSERT_TRUE(identifying);
+    TEST_ASSERT_EQUAL(1, identifyChanges.load());
+
+    setIdentify(10, false);
+    TEST_ASSERT_FALSE(identifying);
+    TEST_ASSERT_EQUAL(2, identifyChanges.load());
+}
+
+void test_boot_stats() {
+    zb_boot_stats_t stats;
+    ZB_GetBootStats(&stats);
+
+    TEST_ASSERT_EQUAL_UINT8(GANG_COUNT, stats.endpoints);
+    TEST_ASSERT_EQUAL_UINT16(ZbDeviceClusterCount(gangDevice), stats.clusters);
+    TEST_ASSERT_EQUAL_UINT16(ZbDeviceAttributeCount(gangDevice), stats.attributes);
+    TEST_ASSERT_TRUE(stats.stackStartUs >= stats.startMainTaskUs + stats.initUs + stats.createUs + stats.registerUs);
+
+    printf("[bench] %d endpoints, %d clusters, %d attributes: created in %luus, stack started %luus after ZB_StartMainTask()\n", stats.endpoints,
+           stats.clusters, stats.attributes, (unsigned long)stats.createUs, (unsigned long)(stats.stackStartUs - stats.startMainTaskUs));
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    ZB_SetDeviceDescriptor(&gangDevice);
+    ZB_AddOnIdentifyCallback(onIdentify);
+    ZB_StartMainTask();
+
+    for (int i = 0; i < 100 && !esp_zb_bdb_dev_joined(); i++) {
+        delay(10);
+    }
+    HOST_ZbSync();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_every_endpoint_is_registered);
+    RUN_TEST(test_identify_on_any_endpoint);
+    RUN_TEST(test_boot_stats);
+    return UNITY_END();
+}
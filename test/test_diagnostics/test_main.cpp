@@ -0,0 +1,220 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runtime health counters: callback accounting through the application, and their encoding into the cluster attributes
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+// Application entry point from main.cpp
+void setup();
+
+static uint32_t readU32(uint16_t attribute) {
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(HA_ESP_SENSOR_ENDPOINT, ZB_CLUSTER_ID_PERF_COUNTERS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attribute);
+    TEST_ASSERT_NOT_NULL(attr);
+    TEST_ASSERT_EQUAL_HEX8(ESP_ZB_ZCL_ATTR_TYPE_U32, attr->type);
+
+    uint32_t value;
+    memcpy(&value, attr->data_p, sizeof(value));
+    return value;
+}
+
+static uint16_t readU16(uint16_t cluster, uint16_t attribute) {
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(HA_ESP_SENSOR_ENDPOINT, cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attribute);
+    TEST_ASSERT_NOT_NULL(attr);
+    TEST_ASSERT_EQUAL_HEX8(ESP_ZB_ZCL_ATTR_TYPE_U16, attr->type);
+
+    uint16_t value;
+    memcpy(&value, attr->data_p, sizeof(value));
+    return value;
+}
+
+static void refresh() {
+    HOST_ZbPost([] { ZB_DiagnosticsRefresh(); });
+    HOST_ZbSync();
+}
+
+static const zb_diagnostics_callback_t *findCallback(const zb_diagnostics_t *diagnostics, zb_diagnostics_kind_t kind, uint16_t id) {
+    for (uint8_t i = 0; i < diagnostics->callbackCount; i++) {
+        if (diagnostics->callbacks[i].kind == kind && diagnostics->callbacks[i].id == id) {
+            return &diagnostics->callbacks[i];
+        }
+    }
+    return NULL;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_boot_is_counted() {
+    zb_diagnostics_t diagnostics;
+    ZB_GetDiagnostics(&diagnostics);
+
+    TEST_ASSERT_EQUAL_UINT16(1, diagnostics.resets);
+    TEST_ASSERT_EQUAL_UINT16(1, readU16(ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, ZB_ATTR_DIAGNOSTICS_NUMBER_OF_RESETS_ID));
+    TEST_ASSERT_EQUAL_UINT32(1, diagnostics.steeringAttempts);
+    TEST_ASSERT_NOT_EQUAL(ZB_DIAGNOSTICS_NOT_JOINED, diagnostics.secondsSinceJoin);
+
+    // Boot signals were counted on the way up
+    TEST_ASSERT_NOT_NULL(findCallback(&diagnostics, ZB_DIAGNOSTICS_SIGNAL, ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP));
+    TEST_ASSERT_NOT_NULL(findCallback(&diagnostics, ZB_DIAGNOSTICS_SIGNAL, ESP_ZB_BDB_SIGNAL_STEERING));
+}
+
+void test_actions_are_counted_per_id() {
+    zb_diagnostics_t before, after;
+    ZB_GetDiagnostics(&before);
+    for (int i = 0; i < 5; i++) {
+        HOST_ZbInvokeAction(ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID, NULL);
+    }
+    HOST_ZbInjectSignal(ESP_ZB_NLME_STATUS_INDICATION, ESP_OK);
+    HOST_ZbSync();
+    ZB_GetDiagnostics(&after);
+
+    TEST_ASSERT_EQUAL_UINT32(before.actions + 5, after.actions);
+    TEST_ASSERT_EQUAL_UINT32(before.signals + 1, after.signals);
+
+    const zb_diagnostics_callback_t *entry = findCallback(&after, ZB_DIAGNOSTICS_ACTION, ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_UINT32(5, entry->count);
+    TEST_ASSERT_TRUE(entry->maxUs <= after.callbackMaxUs);
+    TEST_ASSERT_TRUE(entry->totalUs >= entry->maxUs);
+}
+
+void test_attributes_follow_refresh() {
+    zb_diagnostics_t diagnostics;
+
+    refresh();
+    ZB_GetDiagnostics(&diagnostics);
+
+    TEST_ASSERT_EQUAL_UINT32(diagnostics.actions, readU32(ZB_ATTR_PERF_ACTION_COUNT_ID));
+    TEST_ASSERT_EQUAL_UINT32(diagnostics.signals, readU32(ZB_ATTR_PERF_SIGNAL_COUNT_ID));
+    TEST_ASSERT_EQUAL_UINT32(diagnostics.steeringAttempts, readU32(ZB_ATTR_PERF_STEERING_ATTEMPTS_ID));
+    TEST_ASSERT_EQUAL_UINT32(diagnostics.freeHeap, readU32(ZB_ATTR_PERF_FREE_HEAP_ID));
+
+    // Both tracked tasks exist, so their stack headroom is reported
+    TEST_ASSERT_TRUE(readU16(ZB_CLUSTER_ID_PERF_COUNTERS, ZB_ATTR_PERF_ZIGBEE_STACK_FREE_ID) > 0);
+    TEST_ASSERT_TRUE(readU16(ZB_CLUSTER_ID_PERF_COUNTERS, ZB_ATTR_PERF_LED_STACK_FREE_ID) > 0);
+
+    // The octet string carries one record per tracked id, up to its limit, and loses no counts past it
+    esp_zb_zcl_attr_t *stats = esp_zb_zcl_get_attribute(HA_ESP_SENSOR_ENDPOINT, ZB_CLUSTER_ID_PERF_COUNTERS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                                        ZB_ATTR_PERF_CALLBACK_STATS_ID);
+    TEST_ASSERT_NOT_NULL(stats);
+    const uint8_t *data = (const uint8_t *)stats->data_p;
+    uint8_t records = diagnostics.callbackCount < ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS ? diagnostics.callbackCount : ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS;
+    TEST_ASSERT_EQUAL_UINT8(records * ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE, data[0]);
+
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < records; i++) {
+        const uint8_t *record = &data[1 + i * ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE];
+        total += record[3] | (record[4] << 8) | (record[5] << 16) | ((uint32_t)record[6] << 24);
+    }
+    TEST_ASSERT_EQUAL_UINT32(diagnostics.actions + diagnostics.signals, total);
+}
+
+void test_encoding_and_overflow_entry() {
+    zb_diagnostics_t diagnostics = {};
+    diagnostics.callbackCount = 2;
+    diagnostics.callbacks[0] = {ZB_DIAGNOSTICS_ACTION, 0x1005, 3, 300, 200};
+    diagnostics.callbacks[1] = {ZB_DIAGNOSTICS_SIGNAL, 0x0017, 2, 200000, 150000};
+
+    uint8_t buffer[1 + 2 * ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE];
+    const uint8_t expected[] = {
+        22,
+        0x00, 0x05, 0x10, 0x03, 0x00, 0x00, 0x00, 0x64, 0x00, 0xc8, 0x00,
+        0x01, 0x17, 0x00, 0x02, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,     // mean and max saturate at 65535us
+    };
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected), ZB_DiagnosticsEncodeCallbacks(&diagnostics, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY(expected, buffer, sizeof(expected));
+
+    // A buffer too small for every record holds as many whole records as fit
+    TEST_ASSERT_EQUAL_size_t(1 + ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE, ZB_DiagnosticsEncodeCallbacks(&diagnostics, buffer, sizeof(buffer) - 1));
+    TEST_ASSERT_EQUAL_UINT8(ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE, buffer[0]);
+
+    // Ids beyond the table share its last entry
+    for (uint16_t id = 0x3000; id < 0x3000 + ZB_DIAGNOSTICS_MAX_CALLBACK_IDS; id++) {
+        HOST_ZbInvokeAction((esp_zb_core_action_callback_id_t)id, NULL);
+    }
+    HOST_ZbSync();
+
+    zb_diagnostics_t after;
+    ZB_GetDiagnostics(&after);
+    TEST_ASSERT_EQUAL_UINT8(ZB_DIAGNOSTICS_MAX_CALLBACK_IDS, after.callbackCount);
+    TEST_ASSERT_EQUAL_HEX16(ZB_DIAGNOSTICS_OTHER_ID, after.callbacks[ZB_DIAGNOSTICS_MAX_CALLBACK_IDS - 1].id);
+    TEST_ASSERT_NULL(findCallback(&after, ZB_DIAGNOSTICS_ACTION, 0x3000 + ZB_DIAGNOSTICS_MAX_CALLBACK_IDS - 1));
+}
+
+// Past the record limit the slowest ids keep their records and the rest are folded into the last one, so the attribute
+// always fits a Read Attributes Response in one unfragmented frame
+void test_callback_stats_fit_one_frame() {
+    zb_diagnostics_t diagnostics = {};
+    diagnostics.callbackCount = ZB_DIAGNOSTICS_MAX_CALLBACK_IDS;
+    for (uint8_t i = 0; i < ZB_DIAGNOSTICS_MAX_CALLBACK_IDS; i++) {
+        // 0x2002, 0x2005, 0x2009 & 0x200c are the slowest
+        bool slow = i == 2 || i == 5 || i == 9 || i == 12;
+        diagnostics.callbacks[i] = {ZB_DIAGNOSTICS_ACTION, (uint16_t)(0x2000 + i), 1, 10, slow ? 1000u + i : 10u};
+    }
+    diagnostics.callbacks[ZB_DIAGNOSTICS_MAX_CALLBACK_IDS - 1].id = ZB_DIAGNOSTICS_OTHER_ID;
+    diagnostics.callbacks[ZB_DIAGNOSTICS_MAX_CALLBACK_IDS - 1].maxUs = 5000;
+
+    uint8_t buffer[1 + ZB_DIAGNOSTICS_MAX_CALLBACK_IDS * ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE];
+    size_t length = ZB_DiagnosticsEncodeCallbacks(&diagnostics, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_size_t(ZB_DIAGNOSTICS_CALLBACK_STATS_SIZE, length);
+    TEST_ASSERT_TRUE(length <= 60);
+
+    const uint16_t kept[] = {0x2002, 0x2005, 0x2009, 0x200c};
+    for (uint8_t i = 0; i < ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS - 1; i++) {
+        const uint8_t *record = &buffer[1 + i * ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE];
+        TEST_ASSERT_EQUAL_HEX16(kept[i], record[1] | (record[2] << 8));
+    }
+
+    // Then everything else: 11 ids and the table's own overflow entry, whose max is the largest
+    const uint8_t *other = &buffer[1 + (ZB_DIAGNOSTICS_MAX_CALLBACK_RECORDS - 1) * ZB_DIAGNOSTICS_CALLBACK_RECORD_SIZE];
+    const uint8_t expectedOther[] = {ZB_DIAGNOSTICS_OTHER_KIND, 0xff, 0xff, 12, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x88, 0x13};
+    TEST_ASSERT_EQUAL_MEMORY(expectedOther, other, sizeof(expectedOther));
+
+    // And so does the attribute, once the application has filled its table
+    refresh();
+    ZB_GetDiagnostics(&diagnostics);
+    TEST_ASSERT_EQUAL_UINT8(ZB_DIAGNOSTICS_MAX_CALLBACK_IDS, diagnostics.callbackCount);
+    esp_zb_zcl_attr_t *stats = esp_zb_zcl_get_attribute(HA_ESP_SENSOR_ENDPOINT, ZB_CLUSTER_ID_PERF_COUNTERS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+                                                        ZB_ATTR_PERF_CALLBACK_STATS_ID);
+    TEST_ASSERT_NOT_NULL(stats);
+    TEST_ASSERT_TRUE(1 + ((const uint8_t *)stats->data_p)[0] <= 60);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    // Boot the application as the Arduino core would, then wait for the simulated join to finish
+    setup();
+    zb_diagnostics_t diagnostics;
+    do {
+        delay(10);
+        HOST_ZbSync();
+        ZB_GetDiagnostics(&diagnostics);
+    } while (diagnostics.secondsSinceJoin == ZB_DIAGNOSTICS_NOT_JOINED);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_boot_is_counted);
+    RUN_TEST(test_actions_are_counted_per_id);
+    RUN_TEST(test_attributes_follow_refresh);
+    RUN_TEST(test_encoding_and_overflow_entry);
+    RUN_TEST(test_callback_stats_fit_one_frame);
+    return UNITY_END();
+}
@@ -0,0 +1,304 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Latency benchmarks for the event path from a simulated GPIO edge or injected Zigbee stack event to the application callback
+#include <Arduino.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Switches/switches.h"
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+// Application callbacks from main.cpp
+void setup();
+void loop();
+esp_err_t onAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message);
+
+#define BENCH_ITERATIONS 50
+#define BENCH_TIMEOUT_US 1000000
+
+static std::atomic<int64_t> callbackTime(0);
+static std::atomic<int> framesShown(0);
+static std::atomic<bool> lastFrameBlank(true);
+
+// Spin until the callback under test stamps callbackTime, returning the latency from start
+static int64_t waitForCallback(int64_t start) {
+    while (callbackTime.load() == 0) {
+        if (esp_timer_get_time() - start > BENCH_TIMEOUT_US) {
+            return -1;
+        }
+        std::this_thread::yield();
+    }
+
+    return callbackTime.load() - start;
+}
+
+static void report(const char *name, std::vector<int64_t> &samples) {
+    TEST_ASSERT_FALSE_MESSAGE(samples.empty(), "no samples recorded");
+    std::sort(samples.begin(), samples.end());
+
+    int64_t total = 0;
+    for (int64_t sample : samples) {
+        total += sample;
+    }
+
+    printf("[bench] %-28s n=%-4zu min=%6lldus p50=%6lldus p99=%6lldus max=%6lldus mean=%6lldus\n", name, samples.size(),
+           (long long)samples.front(), (long long)samples[samples.size() / 2], (long long)samples[(samples.size() * 99) / 100],
+           (long long)samples.back(), (long long)(total / (int64_t)samples.size()));
+}
+
+static void taskLoop(void *arg) {
+    while (true) {
+        loop();
+    }
+}
+
+static esp_err_t benchAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message) {
+    esp_err_t ret = onAttributeUpdated(message);
+    callbackTime = esp_timer_get_time();
+    return ret;
+}
+
+void setUp() {
+    callbackTime = 0;
+}
+
+void tearDown() {
+}
+
+void test_gpio_edge_to_button_handler() {
+    std::vector<int64_t> samples;
+    uint8_t pin = button_func_pair[0].pin;
+
+    for (int i = 0; i < BENCH_ITERATIONS / 5; i++) {
+        callbackTime = 0;
+        HOST_GpioSetLevel(pin, LOW);
+        delay(25);
+
+        // A button press is reported on release, so time from the releasing edge
+        int64_t start = esp_timer_get_time();
+        HOST_GpioSetLevel(pin, HIGH);
+
+        int64_t latency = waitForCallback(start);
+        TEST_ASSERT_TRUE_MESSAGE(latency >= 0, "button handler was not called");
+        samples.push_back(latency);
+    }
+
+    report("gpio release -> handler", samples);
+}
+
+void test_action_to_attribute_callback() {
+    std::vector<int64_t> samples;
+    uint16_t value = 0;
+    esp_zb_zcl_set_attr_value_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.dst_endpoint = HA_ESP_SENSOR_ENDPOINT;
+    message.info.cluster = ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY;
+    message.attribute.id = ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID;
+    message.attribute.data.type = ESP_ZB_ZCL_ATTR_TYPE_U16;
+    message.attribute.data.size = sizeof(value);
+    message.attribute.data.value = &value;
+
+    ZB_SetOnAttributeUpdatedCallback(benchAttributeUpdated);
+
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        callbackTime = 0;
+        value = i;
+
+        int64_t start = esp_timer_get_time();
+        HOST_ZbInvokeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &message);
+
+        int64_t latency = waitForCallback(start);
+        TEST_ASSERT_TRUE_MESSAGE(latency >= 0, "attribute callback was not called");
+        samples.push_back(latency);
+        HOST_ZbSync();
+    }
+
+    ZB_SetOnAttributeUpdatedCallback(onAttributeUpdated);
+    report("set attr action -> callback", samples);
+}
+
+static esp_err_t slowAttributeUpdated(const esp_zb_zcl_set_attr_value_message_t *message) {
+    delay(20);
+    return ESP_OK;
+}
+
+void test_slow_subscriber_does_not_stall_stack() {
+    std::vector<int64_t> samples;
+    uint8_t value = 0;
+    esp_zb_zcl_set_attr_value_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.dst_endpoint = HA_ESP_SENSOR_ENDPOINT;
+    message.attribute.data.type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+    message.attribute.data.size = sizeof(value);
+    message.attribute.data.value = &value;
+
+    ZB_SetOnAttributeUpdatedCallback(onAttributeUpdated);
+    TEST_ASSERT_TRUE(ZB_AddOnAttributeUpdatedCallback(slowAttributeUpdated));
+
+    // Signals handled while a slow subscriber is busy should not wait for it
+    for (int i = 0; i < BENCH_ITERATIONS / 5; i++) {
+        HOST_ZbInvokeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &message);
+        HOST_ZbSync();
+
+        int64_t start = esp_timer_get_time();
+        HOST_ZbInjectSignal(ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK);
+        HOST_ZbSync();
+        samples.push_back(esp_timer_get_time() - start);
+    }
+
+    ZB_SetOnAttributeUpdatedCallback(onAttributeUpdated);
+    report("signal during slow handler", samples);
+    TEST_ASSERT_TRUE(samples.back() < 20000);
+
+    // Let the worker catch up before the next test
+    delay(25 * BENCH_ITERATIONS / 5);
+
+    zb_dispatch_stats_t stats;
+    ZB_GetDispatchStats(&stats);
+    printf("[bench] dispatch: enqueued=%u dispatched=%u dropped=%u depth=%u hwm=%u latency min=%uus max=%uus mean=%lluus\n",
+           (unsigned)stats.enqueued, (unsigned)stats.dispatched, (unsigned)stats.dropped, stats.depth, stats.depthHighWaterMark,
+           (unsigned)stats.latencyMinUs, (unsigned)stats.latencyMaxUs,
+           (unsigned long long)(stats.dispatched ? stats.latencyTotalUs / stats.dispatched : 0));
+    TEST_ASSERT_EQUAL(stats.enqueued, stats.dispatched + stats.depth);
+}
+
+// Switch commands to bound lights go out from their own task, so a subscriber still working through its events does not
+// hold them up
+void test_control_command_during_slow_handler() {
+    std::vector<int64_t> samples;
+    uint8_t value = 0;
+    esp_zb_zcl_set_attr_value_message_t message = {};
+    message.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    message.info.dst_endpoint = HA_ESP_SENSOR_ENDPOINT;
+    message.attribute.data.type = ESP_ZB_ZCL_ATTR_TYPE_U8;
+    message.attribute.data.size = sizeof(value);
+    message.attribute.data.value = &value;
+    zb_control_command_t toggle = {ZB_CONTROL_TOGGLE, HA_ESP_SENSOR_ENDPOINT, 0, 0, 0, 0};
+
+    // The button bench ends in a factory reset, so put the device back on the network for its commands to be sent
+    HOST_ZbSetFactoryNew(false);
+    HOST_ZbSetApsDataHook([](const esp_zb_apsde_data_req_t *req) {
+        if (req->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_ON_OFF && callbackTime.load() == 0) {
+            callbackTime = esp_timer_get_time();
+        }
+    });
+    ZB_SetOnAttributeUpdatedCallback(onAttributeUpdated);
+    TEST_ASSERT_TRUE(ZB_AddOnAttributeUpdatedCallback(slowAttributeUpdated));
+
+    for (int i = 0; i < BENCH_ITERATIONS / 5; i++) {
+        // A few events in, so the worker has about 60ms of subscriber calls ahead of it
+        for (int j = 0; j < 3; j++) {
+            HOST_ZbInvokeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &message);
+        }
+        HOST_ZbSync();
+
+        callbackTime = 0;
+        int64_t start = esp_timer_get_time();
+        TEST_ASSERT_EQUAL(ESP_OK, ZB_SendControlCommand(&toggle));
+
+        int64_t latency = waitForCallback(start);
+        TEST_ASSERT_TRUE_MESSAGE(latency >= 0, "control command was not sent");
+        samples.push_back(latency);
+
+        // Let the worker catch up before the next round
+        delay(70);
+    }
+
+    HOST_ZbSetApsDataHook(NULL);
+    ZB_SetOnAttributeUpdatedCallback(onAttributeUpdated);
+    report("command during slow handler", samples);
+    TEST_ASSERT_TRUE(samples[samples.size() / 2] < 20000);
+}
+
+void test_signal_handler_dispatch() {
+    std::vector<int64_t> samples;
+
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        int64_t start = esp_timer_get_time();
+        HOST_ZbInjectSignal(ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK);
+        HOST_ZbSync();
+        samples.push_back(esp_timer_get_time() - start);
+    }
+
+    report("signal -> handler returned", samples);
+}
+
+void test_identify_to_first_frame() {
+    std::vector<int64_t> samples;
+
+    HOST_NeoPixelSetShowHook([](const uint32_t *pixels, uint16_t count) {
+        bool blank = true;
+        for (uint16_t i = 0; i < count; i++) {
+            blank = blank && pixels[i] == 0;
+        }
+
+        lastFrameBlank = blank;
+        if (!blank && callbackTime.load() == 0) {
+            callbackTime = esp_timer_get_time();
+        }
+        framesShown++;
+    });
+
+    for (int i = 0; i < BENCH_ITERATIONS / 5; i++) {
+        callbackTime = 0;
+
+        int64_t start = esp_timer_get_time();
+        HOST_ZbSetIdentify(HA_ESP_SENSOR_ENDPOINT, true);
+
+        int64_t latency = waitForCallback(start);
+        TEST_ASSERT_TRUE_MESSAGE(latency >= 0, "identify effect did not render");
+        samples.push_back(latency);
+
+        HOST_ZbSetIdentify(HA_ESP_SENSOR_ENDPOINT, false);
+        HOST_ZbSync();
+
+        // Let the identify task notice and blank the LED before the next round
+        int64_t waitStart = esp_timer_get_time();
+        while (!lastFrameBlank && esp_timer_get_time() - waitStart < BENCH_TIMEOUT_US) {
+            delay(1);
+        }
+        TEST_ASSERT_TRUE_MESSAGE(lastFrameBlank, "identify effect did not stop");
+    }
+
+    HOST_NeoPixelSetShowHook(NULL);
+    report("identify on -> first frame", samples);
+}
+
+int main(int argc, char **argv) {
+    HOST_ZbSetFactoryResetHook([] { callbackTime = esp_timer_get_time(); });
+
+    // Boot the application as the Arduino core would, then wait for the simulated join to finish
+    setup();
+    xTaskCreate(taskLoop, "loopTask", 8192, NULL, 1, NULL);
+    for (int i = 0; i < 4; i++) {
+        HOST_ZbSync();
+    }
+
+    HOST_SetLogEnabled(false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_gpio_edge_to_button_handler);
+    RUN_TEST(test_action_to_attribute_callback);
+    RUN_TEST(test_signal_handler_dispatch);
+    RUN_TEST(test_slow_subscriber_does_not_stall_stack);
+    RUN_TEST(test_control_command_during_slow_handler);
+    RUN_TEST(test_identify_to_first_frame);
+    return UNITY_END();
+}
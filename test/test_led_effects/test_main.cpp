@@ -0,0 +1,250 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// LED effect frames and timing against a simulated clock, render cost per frame, and the effects task on the host framebuffer
+#include <Arduino.h>
+#include <Adafruit_NeoPixel.h>
+#include <unity.h>
+
+#include <atomic>
+#include <chrono>
+
+#include "Led/led.h"
+#include "Led/led_effects.h"
+#include "host_platform.h"
+
+#define BENCH_FRAMES 200000
+
+static std::atomic<int> framesShown(0);
+static std::atomic<uint32_t> lastFrame(0);
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_solid_is_gamma_corrected() {
+    led_effect_t effect = {LED_EFFECT_SOLID, 0xff8000, 0, 0, 0};
+    uint32_t pixels[3];
+
+    TEST_ASSERT_EQUAL_UINT32(LED_FRAME_NEVER, LED_RenderEffect(&effect, 0, pixels, 3));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_HEX32(0xff0000 | ((uint32_t)Adafruit_NeoPixel::gamma8(0x80) << 8), pixels[i]);
+    }
+
+    effect.type = LED_EFFECT_OFF;
+    TEST_ASSERT_EQUAL_UINT32(LED_FRAME_NEVER, LED_RenderEffect(&effect, 1234, pixels, 3));
+    TEST_ASSERT_EQUAL_HEX32(0, pixels[0]);
+}
+
+void test_blink_schedules_each_toggle() {
+    led_effect_t effect = {LED_EFFECT_BLINK, 0x00ff00, 500, 0, 0};
+    uint32_t pixel;
+
+    TEST_ASSERT_EQUAL_UINT32(250, LED_RenderEffect(&effect, 0, &pixel, 1));
+    TEST_ASSERT_EQUAL_HEX32(0x00ff00, pixel);
+    TEST_ASSERT_EQUAL_UINT32(150, LED_RenderEffect(&effect, 100, &pixel, 1));
+    TEST_ASSERT_EQUAL_UINT32(250, LED_RenderEffect(&effect, 250, &pixel, 1));
+    TEST_ASSERT_EQUAL_HEX32(0, pixel);
+    TEST_ASSERT_EQUAL_UINT32(1, LED_RenderEffect(&effect, 999, &pixel, 1));
+    TEST_ASSERT_EQUAL_UINT32(250, LED_RenderEffect(&effect, 1000, &pixel, 1));
+    TEST_ASSERT_EQUAL_HEX32(0x00ff00, pixel);
+}
+
+void test_status_code_blinks_count_then_pauses() {
+    led_effect_t effect = {LED_EFFECT_STATUS_CODE, 0xff0000, 100, 3, 0};
+    uint32_t pixel;
+    int blinks = 0;
+    bool wasOn = false;
+    uint32_t wakeups = 0;
+
+    // 3 blinks on 100ms / off 100ms, then a pause, over a 900ms cycle
+    for (uint32_t t = 0; t < 900; wakeups++) {
+        t += LED_RenderEffect(&effect, t, &pixel, 1);
+        bool on = pixel != 0;
+        blinks += on && !wasOn;
+        wasOn = on;
+    }
+
+    TEST_ASSERT_EQUAL_INT(3, blinks);
+    TEST_ASSERT_EQUAL_UINT32(6, wakeups);
+
+    // The whole pause is a single sleep
+    TEST_ASSERT_EQUAL_UINT32(400, LED_RenderEffect(&effect, 500, &pixel, 1));
+    TEST_ASSERT_EQUAL_HEX32(0, pixel);
+    TEST_ASSERT_EQUAL_UINT32(100, LED_RenderEffect(&effect, 900, &pixel, 1));
+    TEST_ASSERT_EQUAL_HEX32(0xff0000, pixel);
+}
+
+void test_breathe_and_rainbow_animate_on_frame_grid() {
+    led_effect_t breathe = {LED_EFFECT_BREATHE, 0xffffff, 2000, 0, 0};
+    led_effect_t rainbow = {LED_EFFECT_RAINBOW, 0, 1600, 0, 0};
+    uint32_t pixels[4];
+
+    TEST_ASSERT_EQUAL_UINT32(LED_FRAME_INTERVAL_MS, LED_RenderEffect(&breathe, 0, pixels, 1));
+    TEST_ASSERT_EQUAL_HEX32(0, pixels[0]);
+    TEST_ASSERT_EQUAL_UINT32(LED_FRAME_INTERVAL_MS - 5, LED_RenderEffect(&breathe, 1005, pixels, 1));
+    TEST_ASSERT_EQUAL_HEX32(0xffffff, pixels[0]);
+
+    // Brightness rises monotonically through the first half of the cycle
+    uint32_t last = 0;
+    for (uint32_t t = 0; t <= 1000; t += LED_FRAME_INTERVAL_MS) {
+        LED_RenderEffect(&breathe, t, pixels, 1);
+        TEST_ASSERT_TRUE(pixels[0] >= last);
+        last = pixels[0];
+    }
+
+    // One turn of the wheel is spread along the strip, and the whole strip rotates with time
+    LED_RenderEffect(&rainbow, 0, pixels, 4);
+    TEST_ASSERT_EQUAL_HEX32(0xff0000, pixels[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x0000ff, pixels[2] & 0x0000ff);
+    uint32_t quarter[4];
+    LED_RenderEffect(&rainbow, 400, quarter, 4);
+    TEST_ASSERT_EQUAL_HEX32(pixels[1], quarter[0]);
+    TEST_ASSERT_EQUAL_HEX32(pixels[0], quarter[3]);
+}
+
+static void benchEffect(const char *name, const led_effect_t *effect, uint16_t count) {
+    uint32_t pixels[64];
+    uint32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+        LED_RenderEffect(effect, i * 7, pixels, count);
+        sink ^= pixels[i % count];
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[bench] %-12s %2d pixels: %6.1f ns/frame (%x)\n", name, count, (double)elapsed / BENCH_FRAMES, sink & 0xf);
+}
+
+void test_bench_render_cost() {
+    led_effect_t effects[] = {
+        {LED_EFFECT_BLINK, 0x00ff00, 500, 0, 0},
+        {LED_EFFECT_BREATHE, 0x2040ff, 2000, 0, 0},
+        {LED_EFFECT_RAINBOW, 0, 1600, 0, 0},
+        {LED_EFFECT_STATUS_CODE, 0xff0000, 250, 3, 0},
+    };
+
+    for (const led_effect_t &effect : effects) {
+        benchEffect(LED_EffectTypeToString(effect.type), &effect, 1);
+        benchEffect(LED_EffectTypeToString(effect.type), &effect, 64);
+    }
+
+    // The per-frame path this replaced: HSV conversion and gamma through the NeoPixel library
+    Adafruit_NeoPixel strip(64);
+    uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+        strip.rainbow((uint16_t)(i * 1000));
+        sink ^= strip.getPixelColor(i % 64);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("[bench] %-12s %2d pixels: %6.1f ns/frame (%x)\n", "ColorHSV", 64, (double)elapsed / BENCH_FRAMES, sink & 0xf);
+}
+
+// Colour the host framebuffer holds once the driver has scaled a rendered colour by the LED brightness
+static uint32_t shownColor(uint32_t color) {
+    uint32_t shown = 0;
+    for (int shift = 0; shift < 24; shift += 8) {
+        shown |= ((((color >> shift) & 0xff) * (LED_BRIGHTNESS + 1)) >> 8) << shift;
+    }
+    return shown;
+}
+
+static bool waitForFrame(uint32_t color, uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (lastFrame.load() != color) {
+        if (millis() - start > timeoutMs) {
+            return false;
+        }
+        delay(1);
+    }
+    return true;
+}
+
+void test_task_renders_highest_slot_and_sleeps_when_static() {
+    led_effect_t status = {LED_EFFECT_SOLID, 0x0000ff, 0, 0, 0};
+    led_effect_t identify = {LED_EFFECT_SOLID, 0xff0000, 0, 0, 0};
+    uint32_t statusShown = shownColor(LED_GammaColor(status.color));
+    uint32_t identifyShown = shownColor(LED_GammaColor(identify.color));
+
+    LED_SetEffect(LED_SLOT_STATUS, &status);
+    TEST_ASSERT_TRUE(waitForFrame(statusShown, 1000));
+
+    LED_SetEffect(LED_SLOT_IDENTIFY, &identify);
+    TEST_ASSERT_TRUE(waitForFrame(identifyShown, 1000));
+
+    // A static effect is latched once, then the task sleeps until the next change
+    led_stats_t before, after;
+    LED_GetStats(&before);
+    delay(200);
+    LED_GetStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.frames, after.frames);
+    TEST_ASSERT_EQUAL_UINT32(before.renders, after.renders);
+
+    LED_ClearEffect(LED_SLOT_IDENTIFY);
+    TEST_ASSERT_TRUE(waitForFrame(statusShown, 1000));
+    LED_ClearEffect(LED_SLOT_STATUS);
+    TEST_ASSERT_TRUE(waitForFrame(0, 1000));
+}
+
+void test_task_expires_timed_effect() {
+    led_effect_t flash = {LED_EFFECT_SOLID, 0xffffff, 0, 0, 150};
+
+    int before = framesShown.load();
+    LED_SetEffect(LED_SLOT_IDENTIFY, &flash);
+    delay(50);
+    TEST_ASSERT_NOT_EQUAL(0, lastFrame.load());
+    TEST_ASSERT_TRUE(waitForFrame(0, 1000));
+    TEST_ASSERT_EQUAL_INT(2, framesShown.load() - before);
+}
+
+void test_rapid_identify_toggles_end_blank() {
+    led_effect_t identify = {LED_EFFECT_RAINBOW, 0, 1600, 0, 0};
+
+    // The old identify path started a task per toggle; the effects task only ever sees the latest state
+    for (int i = 0; i < 1000; i++) {
+        LED_SetEffect(LED_SLOT_IDENTIFY, &identify);
+        LED_ClearEffect(LED_SLOT_IDENTIFY);
+    }
+    TEST_ASSERT_TRUE(waitForFrame(0, 1000));
+
+    led_stats_t before, after;
+    LED_GetStats(&before);
+    delay(100);
+    LED_GetStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.frames, after.frames);
+    TEST_ASSERT_EQUAL_UINT32(0, lastFrame.load());
+}
+
+int main(int argc, char **argv) {
+    HOST_NeoPixelSetShowHook([](const uint32_t *pixels, uint16_t count) {
+        lastFrame = pixels[0];
+        framesShown++;
+    });
+    LED_Init();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_solid_is_gamma_corrected);
+    RUN_TEST(test_blink_schedules_each_toggle);
+    RUN_TEST(test_status_code_blinks_count_then_pauses);
+    RUN_TEST(test_breathe_and_rainbow_animate_on_frame_grid);
+    RUN_TEST(test_bench_render_cost);
+    RUN_TEST(test_task_renders_highest_slot_and_sleeps_when_static);
+    RUN_TEST(test_task_expires_timed_effect);
+    RUN_TEST(test_rapid_identify_toggles_end_blank);
+    return UNITY_END();
+}
@@ -0,0 +1,202 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Steering channel plan, and time-to-join through the application against a fake stack that models scan time per channel
+#include <Arduino.h>
+#include <unity.h>
+
+#include <Preferences.h>
+
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_join.h"
+#include "host_platform.h"
+
+#define CHANNEL(n) (1UL << (n))
+#define SCAN_MS_PER_CHANNEL 10
+#define JOIN_TIMEOUT_MS 10000
+
+static zb_join_plan_t plan;
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+/********************* Channel plan **************************/
+void test_plan_without_cache_starts_on_preferred_channels() {
+    ZB_JoinPlanInit(&plan, 0, ZB_JOIN_PREFERRED_CHANNEL_MASK, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+
+    TEST_ASSERT_EQUAL_UINT32(ZB_JOIN_PREFERRED_CHANNEL_MASK, ZB_JoinPlanStart(&plan, 0));
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_PREFERRED, plan.stats.phase);
+    TEST_ASSERT_EQUAL(0, plan.stats.attempts[ZB_JOIN_PHASE_CACHED]);
+
+    TEST_ASSERT_EQUAL_UINT32(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK, ZB_JoinPlanOnFailed(&plan, 100));
+    TEST_ASSERT_EQUAL_UINT32(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK, ZB_JoinPlanOnFailed(&plan, 200));
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_FULL, plan.stats.phase);
+    TEST_ASSERT_EQUAL(2, plan.stats.attempts[ZB_JOIN_PHASE_FULL]);
+
+    // Steering keeps failing for long past any small counter
+    for (uint32_t i = 0; i < 1000; i++) {
+        ZB_JoinPlanOnFailed(&plan, 300 + i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1002, plan.stats.attempts[ZB_JOIN_PHASE_FULL]);
+}
+
+void test_plan_scans_cached_then_remaining_preferred_then_full() {
+    ZB_JoinPlanInit(&plan, 15, ZB_JOIN_PREFERRED_CHANNEL_MASK, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(15), ZB_JoinPlanStart(&plan, 1000));
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(11) | CHANNEL(20) | CHANNEL(25), ZB_JoinPlanOnFailed(&plan, 1010));
+    TEST_ASSERT_EQUAL_UINT32(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK, ZB_JoinPlanOnFailed(&plan, 1050));
+
+    ZB_JoinPlanOnJoined(&plan, 1200);
+    TEST_ASSERT_TRUE(plan.stats.joined);
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_FULL, plan.stats.phase);
+    TEST_ASSERT_EQUAL_UINT32(10, plan.stats.phaseMs[ZB_JOIN_PHASE_CACHED]);
+    TEST_ASSERT_EQUAL_UINT32(40, plan.stats.phaseMs[ZB_JOIN_PHASE_PREFERRED]);
+    TEST_ASSERT_EQUAL_UINT32(150, plan.stats.phaseMs[ZB_JOIN_PHASE_FULL]);
+    TEST_ASSERT_EQUAL_UINT32(200, plan.stats.totalMs);
+}
+
+void test_plan_ignores_cached_channel_outside_mask() {
+    ZB_JoinPlanInit(&plan, 26, ZB_JOIN_PREFERRED_CHANNEL_MASK, CHANNEL(11) | CHANNEL(12));
+
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(11), ZB_JoinPlanStart(&plan, 0));
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_PREFERRED, plan.stats.phase);
+
+    // Nothing preferred either: straight to the full mask
+    ZB_JoinPlanInit(&plan, 0, CHANNEL(13), CHANNEL(11) | CHANNEL(12));
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(11) | CHANNEL(12), ZB_JoinPlanStart(&plan, 0));
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_FULL, plan.stats.phase);
+}
+
+/********************* Application against a fake stack **************************/
+static uint8_t networkChannel = 20;
+static uint16_t networkPanId = 0x1a62;
+static const uint8_t networkExtendedPanId[8] = {0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd};
+
+static void onScanComplete(uint8_t found) {
+    if (found) {
+        HOST_ZbSetNetwork(networkPanId, networkExtendedPanId, networkChannel, 0x4f21);
+        HOST_ZbSetFactoryNew(false);
+    }
+    HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_STEERING, found ? ESP_OK : ESP_FAIL);
+}
+
+// Steering takes SCAN_MS_PER_CHANNEL for every channel in the primary mask, and finds the network if it is among them
+static void onCommissioning(uint8_t modeMask) {
+    if (modeMask == ESP_ZB_BDB_MODE_INITIALIZATION) {
+        HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START, ESP_OK);
+    } else if (modeMask & ESP_ZB_BDB_MODE_NETWORK_STEERING) {
+        uint32_t mask = HOST_ZbGetPrimaryChannelMask();
+        esp_zb_scheduler_alarm(onScanComplete, (mask & CHANNEL(networkChannel)) != 0, __builtin_popcount(mask) * SCAN_MS_PER_CHANNEL);
+    }
+}
+
+static zb_join_stats_t waitForJoin() {
+    zb_join_stats_t stats = {};
+
+    for (int waited = 0; waited < JOIN_TIMEOUT_MS; waited += 5) {
+        ZB_GetJoinStats(&stats);
+        if (stats.joined) {
+            break;
+        }
+        delay(5);
+    }
+
+    TEST_ASSERT_TRUE_MESSAGE(stats.joined, "device did not join");
+    return stats;
+}
+
+// Factory reset the device and let it steer again
+static zb_join_stats_t rejoin() {
+    HOST_ZbSetFactoryNew(true);
+    HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START, ESP_OK);
+    HOST_ZbSync();
+
+    return waitForJoin();
+}
+
+static zb_network_cache_t storedNetwork() {
+    zb_network_cache_t cache = {};
+    Preferences preferences;
+
+    TEST_ASSERT_TRUE(preferences.begin(ZB_JOIN_NVS_NAMESPACE, true));
+    TEST_ASSERT_EQUAL(sizeof(cache), preferences.getBytes(ZB_JOIN_NVS_KEY, &cache, sizeof(cache)));
+    preferences.end();
+
+    return cache;
+}
+
+void test_first_join_is_remembered() {
+    HOST_PreferencesClear();
+    HOST_ZbSetCommissioningHook(onCommissioning);
+    ZB_StartMainTask();
+
+    zb_join_stats_t stats = waitForJoin();
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_PREFERRED, stats.phase);
+    TEST_ASSERT_EQUAL(0, HOST_ZbGetSecondaryChannelMask());
+
+    zb_network_cache_t cache = storedNetwork();
+    TEST_ASSERT_EQUAL(20, cache.channel);
+    TEST_ASSERT_EQUAL_HEX16(0x1a62, cache.panId);
+    TEST_ASSERT_EQUAL_MEMORY(networkExtendedPanId, cache.extendedPanId, 8);
+
+    // The diagnostics reset counter at boot, then the network
+    TEST_ASSERT_EQUAL(2, HOST_PreferencesGetWriteCount());
+}
+
+void test_rejoin_scans_cached_channel_only() {
+    zb_join_stats_t stats = rejoin();
+
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_CACHED, stats.phase);
+    TEST_ASSERT_EQUAL(1, stats.attempts[ZB_JOIN_PHASE_CACHED]);
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(20), HOST_ZbGetPrimaryChannelMask());
+
+    // Same network again, so nothing new written to flash
+    TEST_ASSERT_EQUAL(2, HOST_PreferencesGetWriteCount());
+    printf("[bench] rejoin on cached channel: %lums, full mask scan alone: %dms\n", (unsigned long)stats.totalMs,
+           __builtin_popcount(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK) * SCAN_MS_PER_CHANNEL);
+}
+
+void test_moved_network_falls_back_to_full_mask() {
+    networkChannel = 17;
+    networkPanId = 0x2b73;
+
+    zb_join_stats_t stats = rejoin();
+    TEST_ASSERT_EQUAL(ZB_JOIN_PHASE_FULL, stats.phase);
+    TEST_ASSERT_EQUAL(1, stats.attempts[ZB_JOIN_PHASE_CACHED]);
+    TEST_ASSERT_EQUAL(1, stats.attempts[ZB_JOIN_PHASE_PREFERRED]);
+    TEST_ASSERT_EQUAL(1, stats.attempts[ZB_JOIN_PHASE_FULL]);
+    printf("[bench] moved network: cached %lums, preferred %lums, full %lums, total %lums\n", (unsigned long)stats.phaseMs[ZB_JOIN_PHASE_CACHED],
+           (unsigned long)stats.phaseMs[ZB_JOIN_PHASE_PREFERRED], (unsigned long)stats.phaseMs[ZB_JOIN_PHASE_FULL], (unsigned long)stats.totalMs);
+
+    zb_network_cache_t cache = storedNetwork();
+    TEST_ASSERT_EQUAL(17, cache.channel);
+    TEST_ASSERT_EQUAL_HEX16(0x2b73, cache.panId);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_plan_without_cache_starts_on_preferred_channels);
+    RUN_TEST(test_plan_scans_cached_then_remaining_preferred_then_full);
+    RUN_TEST(test_plan_ignores_cached_channel_outside_mask);
+    RUN_TEST(test_first_join_is_remembered);
+    RUN_TEST(test_rejoin_scans_cached_channel_only);
+    RUN_TEST(test_moved_network_falls_back_to_full_mask);
+    return UNITY_END();
+}
@@ -0,0 +1,570 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// OTA upgrade: the streaming engine over a simulated link with a virtual clock, then the client end to end against the
+// host OTA server, through to the boot partition switch and restart
+#include <Arduino.h>
+#include <unity.h>
+
+#include <atomic>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "esp_ota_ops.h"
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+#define SECTOR_SIZE 4096
+#define FLASH_SIZE (256 * 1024)
+#define IMAGE_SIZE (40 * 1024)
+#define FILE_PREFIX_SIZE (ZB_OTA_HEADER_MIN_SIZE + ZB_OTA_ELEMENT_HEADER_SIZE)
+
+// Application entry point from main.cpp
+void setup();
+
+static std::atomic<int> restarts{0};
+
+static const host_ota_server_config_t baseServer = {
+    .manufacturer = ZB_OTA_MANUFACTURER_CODE,
+    .imageType = ZB_OTA_IMAGE_TYPE,
+    .fileVersion = ZB_OTA_FILE_VERSION + 1,
+    .shortAddress = 0x0000,
+    .endpoint = 1,
+    .maxBlockSize = 0,
+    .linkMaxBlockSize = 0,
+    .latencyMs = 2,
+    .jitterMs = 0,
+    .lossEvery = 0,
+    .waitForDataS = 0,
+    .stopAfterBytes = 0,
+    .upgradeDelayS = 0,
+};
+
+/* An ESP-IDF app image with its SHA-256 appended, as the build produces */
+static std::vector<uint8_t> makeImage(size_t size, uint32_t seed, bool hashAppended = true) {
+    std::vector<uint8_t> image(size);
+    std::mt19937 generator(seed);
+
+    for (auto &byte : image) {
+        byte = generator();
+    }
+    image[0] = ZB_OTA_APP_IMAGE_MAGIC;
+    image[ZB_OTA_APP_HASH_APPENDED_OFFSET] = hashAppended ? 1 : 0;
+
+    zb_ota_sha256_t sha;
+    ZB_OtaSha256Init(&sha);
+    ZB_OtaSha256Update(&sha, image.data(), size - ZB_OTA_HASH_SIZE);
+    ZB_OtaSha256Final(&sha, &image[size - ZB_OTA_HASH_SIZE]);
+    return image;
+}
+
+static zb_ota_image_t imageOf(const host_ota_server_config_t *server, const std::vector<uint8_t> &file) {
+    return {server->manufacturer, server->imageType, server->fileVersion, (uint32_t)file.size()};
+}
+
+/********************* Simulated flash & link **************************/
+typedef struct {
+    std::vector<uint8_t> bytes = std::vector<uint8_t>(FLASH_SIZE, 0x00);
+    uint32_t erases = 0;
+} sim_flash_t;
+
+static esp_err_t simWrite(void *context, uint32_t offset, const void *data, size_t size) {
+    sim_flash_t *flash = (sim_flash_t *)context;
+    // NOR flash only clears bits, so a write into a sector not erased first leaves garbage behind
+    for (size_t i = 0; i < size; i++) {
+        flash->bytes[offset + i] &= ((const uint8_t *)data)[i];
+    }
+    return ESP_OK;
+}
+
+static esp_err_t simErase(void *context, uint32_t offset, size_t size) {
+    sim_flash_t *flash = (sim_flash_t *)context;
+    TEST_ASSERT_EQUAL_UINT32(0, offset % SECTOR_SIZE);
+    memset(&flash->bytes[offset], 0xff, size);
+    flash->erases++;
+    return ESP_OK;
+}
+
+typedef struct {
+    uint32_t latencyMs = 0;
+    uint32_t jitterMs = 0;
+    uint32_t lossEvery = 0;             /* lose every nth response */
+    uint8_t serverMaxBlockSize = 0;
+    uint8_t linkMaxBlockSize = 0;       /* larger responses are lost */
+    uint32_t stopAfterBytes = 0;        /* then the server goes quiet */
+} sim_link_t;
+
+typedef struct {
+    uint32_t elapsedMs;
+    bool haveCheckpoint;
+    zb_ota_checkpoint_t checkpoint;     /* the last one taken */
+    uint32_t firstRequestOffset;
+} sim_result_t;
+
+static void initEngine(zb_ota_engine_t *engine, sim_flash_t *flash, uint8_t window, uint8_t maxBlockSize = ZB_OTA_MAX_BLOCK_SIZE) {
+    zb_ota_flash_t access = {simWrite, simErase, flash, SECTOR_SIZE, FLASH_SIZE};
+    ZB_OtaEngineInit(engine, &access, window, maxBlockSize, ZB_OTA_BLOCK_TIMEOUT_MS);
+}
+
+/* Run a download to completion in virtual time: every request is answered latency (plus jitter) later, unless lost */
+static sim_result_t simulate(zb_ota_engine_t *engine, const std::vector<uint8_t> &file, const zb_ota_image_t *image, const sim_link_t *link,
+                             const zb_ota_checkpoint_t *checkpoint = NULL) {
+    std::multimap<uint32_t, std::pair<uint32_t, std::vector<uint8_t>>> inFlight;
+    std::mt19937 jitter(7);
+    sim_result_t result = {};
+    uint32_t now = 1000, sent = 0, bytes = 0;
+    zb_ota_block_request_t request;
+
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_OtaEngineBegin(engine, image, checkpoint, now));
+    result.firstRequestOffset = UINT32_MAX;
+
+    while (engine->state == ZB_OTA_DOWNLOADING) {
+        while (ZB_OtaEngineNextRequest(engine, now, &request)) {
+            if (result.firstRequestOffset == UINT32_MAX) {
+                result.firstRequestOffset = request.offset;
+            }
+            uint32_t size = request.size;
+            if (link->serverMaxBlockSize && size > link->serverMaxBlockSize) {
+                size = link->serverMaxBlockSize;
+            }
+            if (size > file.size() - request.offset) {
+                size = file.size() - request.offset;
+            }
+            if (link->stopAfterBytes && bytes >= link->stopAfterBytes) {
+                continue;
+            }
+            bytes += size;
+            sent++;
+            if ((link->lossEvery && sent % link->lossEvery == 0) || (link->linkMaxBlockSize && size > link->linkMaxBlockSize)) {
+                continue;
+            }
+            uint32_t arrival = now + link->latencyMs + (link->jitterMs ? jitter() % (link->jitterMs + 1) : 0);
+            inFlight.insert({arrival, {request.offset, std::vector<uint8_t>(&file[request.offset], &file[request.offset] + size)}});
+        }
+        if (engine->state != ZB_OTA_DOWNLOADING) {
+            break;
+        }
+
+        // Jump to the next response or request, whichever is due first
+        uint32_t delay = ZB_OtaEngineNextDelay(engine, now);
+        uint32_t next = delay == ZB_OTA_NEVER ? UINT32_MAX : now + delay;
+        if (!inFlight.empty() && inFlight.begin()->first < next) {
+            next = inFlight.begin()->first;
+        }
+        TEST_ASSERT_NOT_EQUAL(UINT32_MAX, next);
+        now = next;
+
+        while (!inFlight.empty() && inFlight.begin()->first <= now && engine->state == ZB_OTA_DOWNLOADING) {
+            auto &block = inFlight.begin()->second;
+            ZB_OtaEngineOnBlock(engine, block.first, block.second.data(), block.second.size(), now);
+            inFlight.erase(inFlight.begin());
+
+            if (ZB_OtaEngineTakeCheckpoint(engine, &result.checkpoint)) {
+                result.haveCheckpoint = true;
+            }
+        }
+    }
+
+    result.elapsedMs = engine->stats.endMs - engine->stats.startMs;
+    return result;
+}
+
+static void assertImageOnFlash(const sim_flash_t *flash, const std::vector<uint8_t> &image) {
+    TEST_ASSERT_EQUAL_MEMORY(image.data(), flash->bytes.data(), image.size());
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+/********************* Engine **************************/
+void test_sha256_vectors() {
+    static const uint8_t abc[] = {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+                                  0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+    static const uint8_t twoBlocks[] = {0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+                                        0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1};
+    static const uint8_t empty[] = {0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+                                    0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55};
+    const char *message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    zb_ota_sha256_t sha;
+    uint8_t digest[ZB_OTA_HASH_SIZE];
+
+    ZB_OtaSha256Init(&sha);
+    ZB_OtaSha256Update(&sha, "abc", 3);
+    ZB_OtaSha256Final(&sha, digest);
+    TEST_ASSERT_EQUAL_MEMORY(abc, digest, sizeof(digest));
+
+    // Fed a byte at a time, across the block boundary
+    ZB_OtaSha256Init(&sha);
+    for (size_t i = 0; i < strlen(message); i++) {
+        ZB_OtaSha256Update(&sha, &message[i], 1);
+    }
+    ZB_OtaSha256Final(&sha, digest);
+    TEST_ASSERT_EQUAL_MEMORY(twoBlocks, digest, sizeof(digest));
+
+    ZB_OtaSha256Init(&sha);
+    ZB_OtaSha256Final(&sha, digest);
+    TEST_ASSERT_EQUAL_MEMORY(empty, digest, sizeof(digest));
+}
+
+void test_download_streams_into_flash() {
+    static sim_flash_t flash;
+    static zb_ota_engine_t engine;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE + 100, 1);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&baseServer, image.data(), image.size());
+    zb_ota_image_t offer = imageOf(&baseServer, file);
+    sim_link_t link = {.latencyMs = 20};
+
+    initEngine(&engine, &flash, 4);
+    simulate(&engine, file, &offer, &link);
+
+    TEST_ASSERT_EQUAL_MESSAGE(ZB_OTA_VERIFIED, engine.state, ZB_OtaStateToString(engine.state));
+    assertImageOnFlash(&flash, image);
+    TEST_ASSERT_EQUAL_UINT32(file.size(), engine.consumed);
+    TEST_ASSERT_EQUAL_UINT32(file.size(), engine.stats.bytes);
+    TEST_ASSERT_EQUAL_UINT32((image.size() + SECTOR_SIZE - 1) / SECTOR_SIZE, flash.erases);
+    TEST_ASSERT_EQUAL_UINT32(0, engine.stats.retries);
+    TEST_ASSERT_EQUAL_UINT8(4, engine.stats.peakInFlight);
+    TEST_ASSERT_EQUAL_UINT32(image.size() / ZB_OTA_CHECKPOINT_SIZE, engine.stats.checkpoints);
+}
+
+void test_bench_window() {
+    static sim_flash_t flash;
+    static zb_ota_engine_t engine;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 2);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&baseServer, image.data(), image.size());
+    zb_ota_image_t offer = imageOf(&baseServer, file);
+    sim_link_t link = {.latencyMs = 40, .jitterMs = 10};
+    uint32_t elapsed[ZB_OTA_MAX_WINDOW + 1] = {};
+
+    for (uint8_t window = 1; window <= ZB_OTA_MAX_WINDOW; window *= 2) {
+        initEngine(&engine, &flash, window);
+        elapsed[window] = simulate(&engine, file, &offer, &link).elapsedMs;
+        TEST_ASSERT_EQUAL(ZB_OTA_VERIFIED, engine.state);
+        assertImageOnFlash(&flash, image);
+        printf("[bench] %u bytes over a %u ms link, window %u: %u ms, %.0f B/s\n", (unsigned)file.size(), (unsigned)link.latencyMs, window,
+               (unsigned)elapsed[window], file.size() * 1000.0 / elapsed[window]);
+    }
+
+    // The link is latency bound, so throughput scales close to the window
+    TEST_ASSERT_TRUE(elapsed[4] * 3 < elapsed[1]);
+}
+
+void test_block_size_follows_server_and_link() {
+    static sim_flash_t flash;
+    static zb_ota_engine_t engine;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 3);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&baseServer, image.data(), image.size());
+    zb_ota_image_t offer = imageOf(&baseServer, file);
+
+    // A server sending less than asked sets the block size at once
+    sim_link_t capped = {.latencyMs = 20, .serverMaxBlockSize = 40};
+    initEngine(&engine, &flash, 4);
+    simulate(&engine, file, &offer, &capped);
+    TEST_ASSERT_EQUAL(ZB_OTA_VERIFIED, engine.state);
+    TEST_ASSERT_EQUAL_UINT8(40, engine.blockSize);
+    TEST_ASSERT_EQUAL_UINT32(0, engine.stats.retries);
+
+    // A route that drops large frames costs a few timeouts, then the halved size sticks
+    sim_link_t narrow = {.latencyMs = 20, .linkMaxBlockSize = 48};
+    initEngine(&engine, &flash, 4);
+    sim_result_t result = simulate(&engine, file, &offer, &narrow);
+    TEST_ASSERT_EQUAL_MESSAGE(ZB_OTA_VERIFIED, engine.state, esp_err_to_name(engine.error));
+    assertImageOnFlash(&flash, image);
+    TEST_ASSERT_EQUAL_UINT8(32, engine.blockSize);
+    TEST_ASSERT_TRUE(engine.stats.retries <= 2 * ZB_OTA_MAX_WINDOW);
+    printf("[bench] link dropping frames over 48 bytes: %u ms, %u retries before settling on %u byte blocks\n", (unsigned)result.elapsedMs,
+           (unsigned)engine.stats.retries, engine.blockSize);
+}
+
+void test_reordered_and_lost_blocks() {
+    static sim_flash_t flash;
+    static zb_ota_engine_t engine;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 4);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&baseServer, image.data(), image.size());
+    zb_ota_image_t offer = imageOf(&baseServer, file);
+    sim_link_t link = {.latencyMs = 20, .jitterMs = 60, .lossEvery = 13};
+
+    initEngine(&engine, &flash, 4);
+    simulate(&engine, file, &offer, &link);
+
+    TEST_ASSERT_EQUAL_MESSAGE(ZB_OTA_VERIFIED, engine.state, esp_err_to_name(engine.error));
+    assertImageOnFlash(&flash, image);
+    TEST_ASSERT_TRUE(engine.stats.reordered > 0);
+    TEST_ASSERT_TRUE(engine.stats.retries > 0);
+    TEST_ASSERT_EQUAL_UINT8(ZB_OTA_MAX_BLOCK_SIZE, engine.blockSize);
+}
+
+void test_resume_from_checkpoint() {
+    static sim_flash_t flash;
+    static zb_ota_engine_t engine;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 5);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&baseServer, image.data(), image.size());
+    zb_ota_image_t offer = imageOf(&baseServer, file);
+
+    sim_link_t stalling = {.latencyMs = 20, .stopAfterBytes = 20000};
+    initEngine(&engine, &flash, 4);
+    sim_result_t stalled = simulate(&engine, file, &offer, &stalling);
+    TEST_ASSERT_EQUAL(ZB_OTA_FAILED, engine.state);
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, engine.error);
+    TEST_ASSERT_TRUE(stalled.haveCheckpoint);
+    TEST_ASSERT_EQUAL_UINT32(2 * ZB_OTA_CHECKPOINT_SIZE, stalled.checkpoint.imageOffset);
+    TEST_ASSERT_EQUAL_UINT32(FILE_PREFIX_SIZE + 2 * ZB_OTA_CHECKPOINT_SIZE, stalled.checkpoint.fileOffset);
+
+    // A fresh engine, as after a restart, picks up at the checkpoint and asks for nothing before it
+    sim_link_t good = {.latencyMs = 20};
+    initEngine(&engine, &flash, 4);
+    sim_result_t resumed = simulate(&engine, file, &offer, &good, &stalled.checkpoint);
+    TEST_ASSERT_EQUAL_MESSAGE(ZB_OTA_VERIFIED, engine.state, esp_err_to_name(engine.error));
+    TEST_ASSERT_EQUAL_UINT32(stalled.checkpoint.fileOffset, engine.stats.resumedFrom);
+    TEST_ASSERT_EQUAL_UINT32(stalled.checkpoint.fileOffset, resumed.firstRequestOffset);
+    TEST_ASSERT_EQUAL_UINT32(file.size() - stalled.checkpoint.fileOffset, engine.stats.bytes);
+    assertImageOnFlash(&flash, image);
+
+    // A checkpoint for another image is ignored
+    zb_ota_image_t other = offer;
+    other.fileVersion++;
+    std::vector<uint8_t> otherFile = file;
+    otherFile[14]++;
+    initEngine(&engine, &flash, 4);
+    simulate(&engine, otherFile, &other, &good, &stalled.checkpoint);
+    TEST_ASSERT_EQUAL(ZB_OTA_VERIFIED, engine.state);
+    TEST_ASSERT_EQUAL_UINT32(0, engine.stats.resumedFrom);
+}
+
+void test_image_errors() {
+    static sim_flash_t flash;
+    static zb_ota_engine_t engine;
+    sim_link_t link = {.latencyMs = 20};
+    const struct {
+        const char *name;
+        size_t corruptAt;               /* byte of the file to flip, SIZE_MAX for none */
+        bool hashAppended;
+        esp_err_t expected;
+    } cases[] = {
+        {"file identifier", 0, true, ESP_ERR_INVALID_RESPONSE},
+        {"header file version", 14, true, ESP_ERR_INVALID_VERSION},
+        {"app image magic", FILE_PREFIX_SIZE, true, ESP_ERR_INVALID_RESPONSE},
+        {"no appended hash", SIZE_MAX, false, ESP_ERR_NOT_SUPPORTED},
+        {"image body", FILE_PREFIX_SIZE + 10000, true, ESP_ERR_INVALID_CRC},
+        {"appended hash", FILE_PREFIX_SIZE + IMAGE_SIZE - 1, true, ESP_ERR_INVALID_CRC},
+    };
+
+    for (const auto &test : cases) {
+        std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 6, test.hashAppended);
+        std::vector<uint8_t> file = HOST_OtaBuildFile(&baseServer, image.data(), image.size());
+        zb_ota_image_t offer = imageOf(&baseServer, file);
+        if (test.corruptAt != SIZE_MAX) {
+            file[test.corruptAt] ^= 0x5a;
+        }
+
+        initEngine(&engine, &flash, 4);
+        simulate(&engine, file, &offer, &link);
+        TEST_ASSERT_EQUAL_MESSAGE(ZB_OTA_FAILED, engine.state, test.name);
+        TEST_ASSERT_EQUAL_MESSAGE(test.expected, engine.error, test.name);
+    }
+
+    // Larger than the partition is refused before anything is written
+    std::vector<uint8_t> image = makeImage(FLASH_SIZE + SECTOR_SIZE, 7);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&baseServer, image.data(), image.size());
+    zb_ota_image_t offer = imageOf(&baseServer, file);
+    initEngine(&engine, &flash, 4);
+    flash.erases = 0;
+    simulate(&engine, file, &offer, &link);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, engine.error);
+    TEST_ASSERT_EQUAL_UINT32(0, flash.erases);
+}
+
+/********************* Client **************************/
+static zb_ota_status_t waitForOta(bool (*done)(const zb_ota_status_t *status), uint32_t timeoutMs) {
+    zb_ota_status_t status;
+    uint32_t start = millis();
+
+    do {
+        delay(5);
+        ZB_GetOtaStatus(&status);
+    } while (!done(&status) && millis() - start < timeoutMs);
+
+    TEST_ASSERT_TRUE_MESSAGE(done(&status), ZB_OtaStateToString(status.state));
+    return status;
+}
+
+static bool downloadEnded(const zb_ota_status_t *status) {
+    return status->state == ZB_OTA_FAILED || status->state == ZB_OTA_VERIFIED;
+}
+
+void test_current_version_is_not_downloaded() {
+    host_ota_server_config_t server = baseServer;
+    server.fileVersion = ZB_OTA_FILE_VERSION;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 8);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&server, image.data(), image.size());
+
+    // An Image Notify sets off a query straight away
+    HOST_OtaServerStart(&server, file.data(), file.size());
+    HOST_OtaServerNotify(HA_ESP_SENSOR_ENDPOINT);
+    delay(50);
+
+    host_ota_server_stats_t stats;
+    HOST_OtaServerGetStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.queries);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.blockRequests);
+
+    zb_ota_status_t status;
+    ZB_GetOtaStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_OTA_IDLE, status.state);
+}
+
+void test_invalid_image_is_reported() {
+    host_ota_server_config_t server = baseServer;
+    server.waitForDataS = 1;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 9);
+    image[5000] ^= 1;
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&server, image.data(), image.size());
+
+    HOST_OtaServerStart(&server, file.data(), file.size());
+    ZB_QueryOtaImage();
+    zb_ota_status_t status = waitForOta(downloadEnded, 5000);
+    delay(20);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, status.error);
+    TEST_ASSERT_EQUAL_UINT32(1, status.stats.waits);
+    TEST_ASSERT_FALSE(status.upgradePending);
+
+    host_ota_server_stats_t stats;
+    HOST_OtaServerGetStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.endRequests);
+    TEST_ASSERT_EQUAL_HEX8(ZB_OTA_STATUS_INVALID_IMAGE, stats.endStatus);
+    TEST_ASSERT_EQUAL_STRING("app0", esp_ota_get_boot_partition()->label);
+}
+
+// Sector erases run on the flash task, so a slow one never keeps the stack, and its lock, from the next frame
+void test_slow_erase_does_not_hold_the_stack() {
+    host_ota_server_config_t server = baseServer;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 11);
+    image[IMAGE_SIZE - 100] ^= 1;
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&server, image.data(), image.size());
+
+    host_flash_stats_t before, after;
+    HOST_FlashGetStats(&before);
+    HOST_FlashSetEraseTime(100);
+    HOST_OtaServerStart(&server, file.data(), file.size());
+    ZB_QueryOtaImage();
+
+    zb_ota_status_t status;
+    uint32_t longestLockMs = 0;
+    uint32_t start = millis();
+    do {
+        delay(5);
+        uint32_t locked = millis();
+        ZB_GetOtaStatus(&status);
+        longestLockMs = std::max(longestLockMs, (uint32_t)(millis() - locked));
+    } while (!downloadEnded(&status) && millis() - start < 10000);
+
+    HOST_FlashSetEraseTime(0);
+    delay(20);
+    HOST_FlashGetStats(&after);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, status.error);
+    TEST_ASSERT_GREATER_OR_EQUAL(IMAGE_SIZE / SECTOR_SIZE, after.erases - before.erases);
+    TEST_ASSERT_LESS_THAN(50, longestLockMs);
+}
+
+// Runs last: the upgrade restarts the stack task
+void test_stalled_download_resumes_and_upgrades() {
+    host_ota_server_config_t server = baseServer;
+    server.stopAfterBytes = 20000;
+    std::vector<uint8_t> image = makeImage(IMAGE_SIZE, 10);
+    std::vector<uint8_t> file = HOST_OtaBuildFile(&server, image.data(), image.size());
+
+    HOST_OtaServerStart(&server, file.data(), file.size());
+    ZB_QueryOtaImage();
+    zb_ota_status_t status = waitForOta(downloadEnded, 10000);
+    TEST_ASSERT_EQUAL(ZB_OTA_FAILED, status.state);
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, status.error);
+
+    // The server comes back; the client starts from its last checkpoint rather than the top of the file
+    server.stopAfterBytes = 0;
+    HOST_OtaServerStart(&server, file.data(), file.size());
+    ZB_QueryOtaImage();
+
+    uint32_t start = millis();
+    while (restarts == 0 && millis() - start < 10000) {
+        delay(5);
+    }
+    TEST_ASSERT_EQUAL(1, restarts.load());
+
+    ZB_GetOtaStatus(&status);
+    TEST_ASSERT_EQUAL(ZB_OTA_VERIFIED, status.state);
+    TEST_ASSERT_EQUAL_UINT32(FILE_PREFIX_SIZE + 2 * ZB_OTA_CHECKPOINT_SIZE, status.stats.resumedFrom);
+
+    host_ota_server_stats_t stats;
+    HOST_OtaServerGetStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(status.stats.resumedFrom, stats.firstRequestOffset);
+    TEST_ASSERT_EQUAL_UINT32(file.size() - status.stats.resumedFrom, stats.bytesSent);
+    TEST_ASSERT_EQUAL_UINT8(ZB_OTA_MAX_WINDOW, stats.peakInFlight);
+    TEST_ASSERT_EQUAL_HEX8(ZB_OTA_STATUS_SUCCESS, stats.endStatus);
+
+    // The new image is on the update partition and boots next
+    const esp_partition_t *boot = esp_ota_get_boot_partition();
+    TEST_ASSERT_EQUAL_STRING("app1", boot->label);
+    std::vector<uint8_t> written(image.size());
+    esp_partition_read(boot, 0, written.data(), written.size());
+    TEST_ASSERT_EQUAL_MEMORY(image.data(), written.data(), image.size());
+
+    printf("[bench] resumed OTA download: %u bytes in %u ms over a %u ms link, %u requests\n", (unsigned)status.stats.bytes,
+           (unsigned)(status.stats.endMs - status.stats.startMs), (unsigned)server.latencyMs, (unsigned)status.stats.requests);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+    HOST_SetRestartHook([] { restarts++; });
+
+    // Short timeouts, so a stalled server is given up on quickly
+    static const zb_ota_config_t otaConfig = {
+        .manufacturer = ZB_OTA_MANUFACTURER_CODE,
+        .imageType = ZB_OTA_IMAGE_TYPE,
+        .fileVersion = ZB_OTA_FILE_VERSION,
+        .queryIntervalMs = 0,
+        .window = ZB_OTA_MAX_WINDOW,
+        .maxBlockSize = ZB_OTA_MAX_BLOCK_SIZE,
+        .blockTimeoutMs = 50,
+    };
+    ZB_SetOtaConfig(&otaConfig);
+
+    // Boot the application as the Arduino core would, then wait for the simulated join to finish
+    setup();
+    zb_diagnostics_t diagnostics;
+    do {
+        delay(10);
+        HOST_ZbSync();
+        ZB_GetDiagnostics(&diagnostics);
+    } while (diagnostics.secondsSinceJoin == ZB_DIAGNOSTICS_NOT_JOINED);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_sha256_vectors);
+    RUN_TEST(test_download_streams_into_flash);
+    RUN_TEST(test_bench_window);
+    RUN_TEST(test_block_size_follows_server_and_link);
+    RUN_TEST(test_reordered_and_lost_blocks);
+    RUN_TEST(test_resume_from_checkpoint);
+    RUN_TEST(test_image_errors);
+    RUN_TEST(test_current_version_is_not_downloaded);
+    RUN_TEST(test_invalid_image_is_reported);
+    RUN_TEST(test_slow_erase_does_not_hold_the_stack);
+    RUN_TEST(test_stalled_download_resumes_and_upgrades);
+    return UNITY_END();
+}
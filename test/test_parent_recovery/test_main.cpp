@@ -0,0 +1,454 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Parent-loss recovery plan, and outages through the application against a fake stack that models scan time per channel
+#include <Arduino.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "Zigbee/zigbee.h"
+#include "Zigbee/zigbee_recovery_engine.h"
+#include "host_platform.h"
+
+#define CHANNEL(n) (1UL << (n))
+#define SCAN_MS_PER_CHANNEL 10
+#define WAIT_TIMEOUT_MS 10000
+
+static const zb_recovery_config_t config = {
+    .targetedAttempts = 3,
+    .targetedDelayMs = 250,
+    .wideDelayMs = 2000,
+    .maxDelayMs = 10000,
+    .candidateTtlMs = 60000,
+    .minLqi = 40,
+};
+static zb_recovery_t recovery;
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void addCandidate(uint8_t id, uint8_t channel, uint8_t lqi, bool parent, uint32_t seenMs) {
+    uint8_t ieee[8] = {id, 0, 0, 0, 0, 0, 0, 0xaa};
+    ZB_RecoveryOnCandidate(&recovery, ieee, 0x1000 + id, channel, lqi, parent, seenMs);
+}
+
+/********************* Recovery plan **************************/
+void test_targets_best_candidate_before_lost_parent() {
+    uint32_t mask = 0;
+    uint32_t delay = 0;
+
+    ZB_RecoveryInit(&recovery, &config, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+    addCandidate(1, 15, 250, true, 1000);
+    addCandidate(2, 15, 120, false, 1000);
+    addCandidate(3, 15, 180, false, 900);
+    addCandidate(4, 15, 30, false, 1000);            // too weak
+    addCandidate(5, 15, 220, false, 1000);
+
+    // The parent has the best link, but it is the one that went away
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnParentLost(&recovery, 5000, &mask));
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(15), mask);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_STAGE_TARGETED, recovery.stage);
+    TEST_ASSERT_EQUAL_HEX16(0x1005, ZB_RecoveryTarget(&recovery)->shortAddress);
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_WAIT, ZB_RecoveryOnRejoin(&recovery, false, 5100, &mask, &delay));
+    TEST_ASSERT_EQUAL_UINT32(250, delay);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnTimer(&recovery, &mask));
+    TEST_ASSERT_EQUAL_HEX16(0x1003, ZB_RecoveryTarget(&recovery)->shortAddress);
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_WAIT, ZB_RecoveryOnRejoin(&recovery, false, 5400, &mask, &delay));
+    TEST_ASSERT_EQUAL_UINT32(500, delay);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnTimer(&recovery, &mask));
+    TEST_ASSERT_EQUAL_HEX16(0x1002, ZB_RecoveryTarget(&recovery)->shortAddress);
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_NONE, ZB_RecoveryOnRejoin(&recovery, true, 6000, &mask, &delay));
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_STAGE_IDLE, recovery.stage);
+    TEST_ASSERT_NULL(ZB_RecoveryTarget(&recovery));
+    TEST_ASSERT_EQUAL_UINT32(1, recovery.stats.targetedRejoins);
+    TEST_ASSERT_EQUAL_UINT32(3, recovery.stats.attempts);
+    TEST_ASSERT_EQUAL_UINT32(1000, recovery.stats.lastOutageMs);
+}
+
+void test_stale_candidates_widen_at_once() {
+    uint32_t mask = 0;
+    uint32_t delay = 0;
+
+    ZB_RecoveryInit(&recovery, &config, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+    addCandidate(1, 15, 200, true, 0);
+    addCandidate(2, 15, 200, false, 0);
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnParentLost(&recovery, config.candidateTtlMs + 1, &mask));
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_STAGE_WIDE, recovery.stage);
+    TEST_ASSERT_EQUAL_UINT32(ZB_JOIN_PREFERRED_CHANNEL_MASK, mask);
+    TEST_ASSERT_NULL(ZB_RecoveryTarget(&recovery));
+
+    // Then the full mask, backing off up to the cap
+    uint32_t expected[] = {2000, 4000, 8000, 10000, 10000};
+    for (uint32_t expectedDelay : expected) {
+        TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_WAIT, ZB_RecoveryOnRejoin(&recovery, false, 70000, &mask, &delay));
+        TEST_ASSERT_EQUAL_UINT32(expectedDelay, delay);
+        TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnTimer(&recovery, &mask));
+        TEST_ASSERT_EQUAL_UINT32(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK, mask);
+    }
+
+    ZB_RecoveryOnRejoin(&recovery, true, 90000, &mask, &delay);
+    TEST_ASSERT_EQUAL_UINT32(0, recovery.stats.targetedRejoins);
+    TEST_ASSERT_EQUAL_UINT32(1, recovery.stats.wideRejoins);
+    TEST_ASSERT_EQUAL_UINT32(6, recovery.stats.attempts);
+    TEST_ASSERT_TRUE(recovery.plan.stats.joined);
+}
+
+// A long outage keeps backing off at the cap rather than wrapping round to short delays
+void test_long_outage_holds_backoff_at_cap() {
+    uint32_t mask = 0;
+    uint32_t delay = 0;
+
+    ZB_RecoveryInit(&recovery, &config, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnParentLost(&recovery, 0, &mask));
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_STAGE_WIDE, recovery.stage);
+
+    for (int i = 0; i < 300; i++) {
+        ZB_RecoveryOnRejoin(&recovery, false, 1000, &mask, &delay);
+        ZB_RecoveryOnTimer(&recovery, &mask);
+    }
+    TEST_ASSERT_EQUAL_UINT32(301, recovery.attempts);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_WAIT, ZB_RecoveryOnRejoin(&recovery, false, 1000, &mask, &delay));
+    TEST_ASSERT_EQUAL_UINT32(config.maxDelayMs, delay);
+}
+
+void test_spent_targeted_attempts_widen() {
+    uint32_t mask = 0;
+    uint32_t delay = 0;
+
+    ZB_RecoveryInit(&recovery, &config, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+    addCandidate(1, 26, 200, true, 0);
+    addCandidate(2, 26, 100, false, 0);
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnParentLost(&recovery, 1000, &mask));
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(26), mask);
+
+    // Both candidates have failed once by the third attempt, so the lost parent gets its turn
+    ZB_RecoveryOnRejoin(&recovery, false, 1100, &mask, &delay);
+    ZB_RecoveryOnTimer(&recovery, &mask);
+    TEST_ASSERT_EQUAL_HEX16(0x1001, ZB_RecoveryTarget(&recovery)->shortAddress);
+    ZB_RecoveryOnRejoin(&recovery, false, 1200, &mask, &delay);
+    ZB_RecoveryOnTimer(&recovery, &mask);
+    TEST_ASSERT_EQUAL_HEX16(0x1002, ZB_RecoveryTarget(&recovery)->shortAddress);
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_WAIT, ZB_RecoveryOnRejoin(&recovery, false, 1300, &mask, &delay));
+    TEST_ASSERT_EQUAL_UINT32(1000, delay);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_STAGE_WIDE, recovery.stage);
+    TEST_ASSERT_EQUAL_UINT32(ZB_JOIN_PREFERRED_CHANNEL_MASK, mask);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnTimer(&recovery, &mask));
+    TEST_ASSERT_EQUAL_UINT32(ZB_JOIN_PREFERRED_CHANNEL_MASK, mask);
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_WAIT, ZB_RecoveryOnRejoin(&recovery, false, 2500, &mask, &delay));
+    TEST_ASSERT_EQUAL_UINT32(2000, delay);
+    TEST_ASSERT_EQUAL_UINT32(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK, mask);
+}
+
+void test_outage_stats() {
+    uint32_t mask = 0;
+    uint32_t delay = 0;
+
+    ZB_RecoveryInit(&recovery, &config, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+    addCandidate(1, 20, 200, true, 0);
+    addCandidate(2, 20, 200, false, 0);
+
+    // Nothing to do while on the network
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_NONE, ZB_RecoveryOnRejoin(&recovery, true, 0, &mask, &delay));
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_NONE, ZB_RecoveryOnTimer(&recovery, &mask));
+
+    uint32_t outages[] = {300, 100, 700};
+    uint32_t now = 1000;
+    for (uint32_t outageMs : outages) {
+        TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_REJOIN, ZB_RecoveryOnParentLost(&recovery, now, &mask));
+        TEST_ASSERT_EQUAL(ZB_RECOVERY_ACTION_NONE, ZB_RecoveryOnParentLost(&recovery, now + 10, &mask));
+        ZB_RecoveryOnRejoin(&recovery, true, now + outageMs, &mask, &delay);
+        now += 10000;
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(3, recovery.stats.outages);
+    TEST_ASSERT_EQUAL_UINT32(3, recovery.stats.targetedRejoins);
+    TEST_ASSERT_EQUAL_UINT32(700, recovery.stats.lastOutageMs);
+    TEST_ASSERT_EQUAL_UINT32(100, recovery.stats.minOutageMs);
+    TEST_ASSERT_EQUAL_UINT32(700, recovery.stats.maxOutageMs);
+    TEST_ASSERT_EQUAL_UINT64(1100, recovery.stats.totalOutageMs);
+}
+
+void test_full_table_replaces_stalest() {
+    ZB_RecoveryInit(&recovery, &config, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+
+    for (uint8_t i = 0; i < ZB_RECOVERY_MAX_CANDIDATES; i++) {
+        addCandidate(i, 20, 100, i == 0, 1000 + (i == 3 ? 0 : 100 * i + 100));
+    }
+    addCandidate(0x20, 20, 100, false, 5000);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_MAX_CANDIDATES, recovery.candidateCount);
+    TEST_ASSERT_EQUAL_HEX16(0x1020, recovery.candidates[3].shortAddress);
+
+    // Heard from again: updated in place, and reporting another parent moves the flag
+    addCandidate(5, 21, 90, true, 6000);
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_MAX_CANDIDATES, recovery.candidateCount);
+    TEST_ASSERT_EQUAL(21, recovery.candidates[5].channel);
+    TEST_ASSERT_TRUE(recovery.candidates[5].parent);
+    TEST_ASSERT_FALSE(recovery.candidates[0].parent);
+}
+
+// Outage on a simulated clock, each rejoin scanning every channel in its mask; the network answers on networkChannel
+// once failFirst rejoins have failed
+static uint32_t simulateOutage(const zb_recovery_config_t *outageConfig, uint8_t networkChannel, uint8_t failFirst) {
+    uint32_t now = 0;
+    uint32_t mask = 0;
+    uint32_t delay = 0;
+    uint8_t attempts = 0;
+
+    ZB_RecoveryInit(&recovery, outageConfig, ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK);
+    addCandidate(1, networkChannel, 200, true, 0);
+    addCandidate(2, networkChannel, 160, false, 0);
+
+    zb_recovery_action_t action = ZB_RecoveryOnParentLost(&recovery, now, &mask);
+    while (action == ZB_RECOVERY_ACTION_REJOIN) {
+        now += __builtin_popcount(mask) * SCAN_MS_PER_CHANNEL;
+        bool found = (mask & CHANNEL(networkChannel)) != 0 && ++attempts > failFirst;
+
+        action = ZB_RecoveryOnRejoin(&recovery, found, now, &mask, &delay);
+        if (action == ZB_RECOVERY_ACTION_WAIT) {
+            now += delay;
+            action = ZB_RecoveryOnTimer(&recovery, &mask);
+        }
+    }
+
+    TEST_ASSERT_EQUAL(ZB_RECOVERY_STAGE_IDLE, recovery.stage);
+    return recovery.stats.lastOutageMs;
+}
+
+void test_bench_targeted_against_wide_only() {
+    zb_recovery_config_t wideOnly = config;
+    wideOnly.targetedAttempts = 0;
+
+    // The network stayed on a channel outside the preferred ones, which is where targeting pays off most
+    uint32_t targeted = simulateOutage(&config, 13, 0);
+    uint32_t wide = simulateOutage(&wideOnly, 13, 0);
+    TEST_ASSERT_EQUAL_UINT32(SCAN_MS_PER_CHANNEL, targeted);
+    TEST_ASSERT_LESS_THAN(wide, targeted);
+    printf("[bench] outage, network on channel 13: targeted %lums, wide only %lums\n", (unsigned long)targeted, (unsigned long)wide);
+
+    // The new parent takes a couple of tries to answer
+    targeted = simulateOutage(&config, 20, 2);
+    wide = simulateOutage(&wideOnly, 20, 2);
+    TEST_ASSERT_LESS_THAN(wide, targeted);
+    printf("[bench] outage, two failed rejoins first: targeted %lums, wide only %lums\n", (unsigned long)targeted, (unsigned long)wide);
+}
+
+/********************* Application against a fake stack **************************/
+static const uint8_t networkExtendedPanId[8] = {0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd};
+static uint8_t networkChannel = 20;
+static uint8_t rejoinFailures = 0;
+static std::vector<uint32_t> rejoinMasks;
+
+static void onRejoinComplete(uint8_t found) {
+    HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT, found ? ESP_OK : ESP_FAIL);
+}
+
+static void onScanComplete(uint8_t found) {
+    HOST_ZbSetNetwork(0x1a62, networkExtendedPanId, networkChannel, 0x4f21);
+    HOST_ZbSetFactoryNew(false);
+    HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_STEERING, ESP_OK);
+}
+
+// Scans take SCAN_MS_PER_CHANNEL for every channel in the primary mask. Once on the network, initialisation is a
+// rejoin, which finds it if its channel is in the mask and rejoinFailures have been used up.
+static void onCommissioning(uint8_t modeMask) {
+    uint32_t mask = HOST_ZbGetPrimaryChannelMask();
+    uint32_t scanMs = __builtin_popcount(mask) * SCAN_MS_PER_CHANNEL;
+
+    if (modeMask == ESP_ZB_BDB_MODE_INITIALIZATION) {
+        if (esp_zb_bdb_is_factory_new()) {
+            HOST_ZbInjectSignal(ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START, ESP_OK);
+            return;
+        }
+
+        rejoinMasks.push_back(mask);
+        bool found = (mask & CHANNEL(networkChannel)) != 0;
+        if (found && rejoinFailures > 0) {
+            rejoinFailures--;
+            found = false;
+        }
+        esp_zb_scheduler_alarm(onRejoinComplete, found, scanMs);
+    } else if (modeMask & ESP_ZB_BDB_MODE_NETWORK_STEERING) {
+        esp_zb_scheduler_alarm(onScanComplete, 1, scanMs);
+    }
+}
+
+static void addNeighbor(uint16_t shortAddress, uint8_t deviceType, uint8_t relationship, uint8_t lqi, uint8_t age = 0) {
+    esp_zb_nwk_neighbor_info_t neighbor = {};
+
+    neighbor.ieee_addr[0] = shortAddress & 0xff;
+    neighbor.ieee_addr[1] = shortAddress >> 8;
+    neighbor.short_addr = shortAddress;
+    neighbor.device_type = deviceType;
+    neighbor.relationship = relationship;
+    neighbor.lqi = lqi;
+    neighbor.age = age;
+    TEST_ASSERT_TRUE(HOST_ZbAddNeighbor(&neighbor));
+}
+
+static void loseParent() {
+    esp_zb_zdo_signal_nwk_status_indication_params_t params = {};
+    params.status = ESP_ZB_NWK_COMMAND_STATUS_PARENT_LINK_FAILURE;
+    params.network_addr = 0x0001;
+
+    HOST_ZbInjectSignalParams(ESP_ZB_NLME_STATUS_INDICATION, ESP_OK, &params, sizeof(params));
+}
+
+static zb_recovery_stats_t waitForRecovery(uint32_t recovered) {
+    zb_recovery_stats_t stats = {};
+
+    for (int waited = 0; waited < WAIT_TIMEOUT_MS; waited += 5) {
+        ZB_GetRecoveryStats(&stats);
+        if (stats.targetedRejoins + stats.wideRejoins >= recovered) {
+            break;
+        }
+        delay(5);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(recovered, stats.targetedRejoins + stats.wideRejoins, "device did not rejoin");
+    return stats;
+}
+
+static void waitForJoin() {
+    zb_commissioning_status_t status = {};
+
+    for (int waited = 0; waited < WAIT_TIMEOUT_MS && status.state != ZB_COMMISSIONING_JOINED; waited += 5) {
+        delay(5);
+        ZB_GetCommissioningStatus(&status);
+    }
+    TEST_ASSERT_EQUAL(ZB_COMMISSIONING_JOINED, status.state);
+}
+
+void test_parent_link_failure_rejoins_on_candidate_channel() {
+    zb_recovery_config_t appConfig = config;
+    appConfig.targetedDelayMs = 20;
+    appConfig.wideDelayMs = 20;
+    ZB_SetRecoveryConfig(&appConfig);
+
+    addNeighbor(0x0001, ESP_ZB_DEVICE_TYPE_ROUTER, ESP_ZB_NWK_RELATIONSHIP_PARENT, 220);
+    addNeighbor(0x0002, ESP_ZB_DEVICE_TYPE_ROUTER, ESP_ZB_NWK_RELATIONSHIP_SIBLING, 150);
+    addNeighbor(0x0000, ESP_ZB_DEVICE_TYPE_COORDINATOR, ESP_ZB_NWK_RELATIONSHIP_NONE_OF_THE_ABOVE, 100);
+    addNeighbor(0x0003, ESP_ZB_DEVICE_TYPE_ED, ESP_ZB_NWK_RELATIONSHIP_NONE_OF_THE_ABOVE, 250);
+
+    HOST_ZbSetCommissioningHook(onCommissioning);
+    ZB_StartMainTask();
+    waitForJoin();
+
+    // Nobody has lost anything yet
+    zb_recovery_stats_t stats;
+    ZB_GetRecoveryStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.outages);
+
+    loseParent();
+    stats = waitForRecovery(1);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.outages);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.targetedRejoins);
+    TEST_ASSERT_EQUAL_size_t(1, rejoinMasks.size());
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(20), rejoinMasks[0]);
+
+    // The full mask is back for whatever the stack does next
+    HOST_ZbSync();
+    TEST_ASSERT_EQUAL_UINT32(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK, HOST_ZbGetPrimaryChannelMask());
+    printf("[bench] app outage, first targeted rejoin answered: %lums\n", (unsigned long)stats.lastOutageMs);
+}
+
+void test_leave_with_rejoin_widens_when_network_moved() {
+    esp_zb_zdo_signal_leave_params_t params = {ESP_ZB_NWK_LEAVE_TYPE_REJOIN};
+
+    rejoinMasks.clear();
+    networkChannel = 17;
+    rejoinFailures = 0;
+
+    HOST_ZbInjectSignalParams(ESP_ZB_ZDO_SIGNAL_LEAVE, ESP_OK, &params, sizeof(params));
+    zb_recovery_stats_t stats = waitForRecovery(2);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.outages);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.wideRejoins);
+
+    // Targeted on the old channel until the attempts ran out, then the preferred channels, then all of them
+    TEST_ASSERT_EQUAL_size_t(config.targetedAttempts + 2, rejoinMasks.size());
+    for (uint8_t i = 0; i < config.targetedAttempts; i++) {
+        TEST_ASSERT_EQUAL_UINT32(CHANNEL(20), rejoinMasks[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(ZB_JOIN_PREFERRED_CHANNEL_MASK, rejoinMasks[config.targetedAttempts]);
+    TEST_ASSERT_EQUAL_UINT32(ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK, rejoinMasks[config.targetedAttempts + 1]);
+    printf("[bench] app outage, network moved channel: %lums over %d rejoins\n", (unsigned long)stats.lastOutageMs, (int)rejoinMasks.size());
+}
+
+void test_leave_without_rejoin_is_not_an_outage() {
+    esp_zb_zdo_signal_leave_params_t params = {ESP_ZB_NWK_LEAVE_TYPE_RESET};
+
+    rejoinMasks.clear();
+    HOST_ZbInjectSignalParams(ESP_ZB_ZDO_SIGNAL_LEAVE, ESP_OK, &params, sizeof(params));
+
+    // Nor is a network status about someone else's route
+    esp_zb_zdo_signal_nwk_status_indication_params_t status = {};
+    status.status = ESP_ZB_NWK_COMMAND_STATUS_NO_ROUTE_AVAILABLE;
+    HOST_ZbInjectSignalParams(ESP_ZB_NLME_STATUS_INDICATION, ESP_OK, &status, sizeof(status));
+    HOST_ZbSync();
+
+    zb_recovery_stats_t stats;
+    ZB_GetRecoveryStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.outages);
+    TEST_ASSERT_EQUAL_size_t(0, rejoinMasks.size());
+}
+
+// Neighbors are targeted on the channel they were heard on, which after a channel change is not the same for them all
+void test_candidates_keep_the_channel_they_were_heard_on() {
+    networkChannel = 17;
+    HOST_ZbSetNetwork(0x1a62, networkExtendedPanId, networkChannel, 0x4f21);
+
+    // The strongest was last heard 30 s ago, before the move; the other is heard on the new channel
+    addNeighbor(0x0002, ESP_ZB_DEVICE_TYPE_ROUTER, ESP_ZB_NWK_RELATIONSHIP_SIBLING, 250, 2);
+    addNeighbor(0x0004, ESP_ZB_DEVICE_TYPE_ROUTER, ESP_ZB_NWK_RELATIONSHIP_SIBLING, 150);
+
+    // A rejoin refreshes the candidates, seeing the move
+    loseParent();
+    waitForRecovery(3);
+
+    rejoinMasks.clear();
+    loseParent();
+    zb_recovery_stats_t stats = waitForRecovery(4);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.targetedRejoins);
+    TEST_ASSERT_EQUAL_size_t(2, rejoinMasks.size());
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(20), rejoinMasks[0]);
+    TEST_ASSERT_EQUAL_UINT32(CHANNEL(17), rejoinMasks[1]);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_targets_best_candidate_before_lost_parent);
+    RUN_TEST(test_stale_candidates_widen_at_once);
+    RUN_TEST(test_long_outage_holds_backoff_at_cap);
+    RUN_TEST(test_spent_targeted_attempts_widen);
+    RUN_TEST(test_outage_stats);
+    RUN_TEST(test_full_table_replaces_stalest);
+    RUN_TEST(test_bench_targeted_against_wide_only);
+    RUN_TEST(test_parent_link_failure_rejoins_on_candidate_channel);
+    RUN_TEST(test_leave_with_rejoin_widens_when_network_moved);
+    RUN_TEST(test_leave_without_rejoin_is_not_an_outage);
+    RUN_TEST(test_candidates_keep_the_channel_they_were_heard_on);
+    return UNITY_END();
+}
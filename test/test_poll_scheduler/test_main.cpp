@@ -0,0 +1,506 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Adaptive polling: the poll engine's modes, holds & duty cycle accounting on a simulated clock, a day of traffic
+// against a fixed keep alive, then the application's poll interval following activity
+#include <Arduino.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "Switches/switches.h"
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+// Application entry point from main.cpp
+void setup();
+
+static const zb_poll_policy_t basePolicy = {
+    .fastIntervalMs = ZB_POLL_FAST_INTERVAL_MS,
+    .slowIntervalMs = ZB_POLL_SLOW_INTERVAL_MS,
+    .holdMs = {ZB_POLL_JOIN_HOLD_MS, ZB_POLL_COMMAND_HOLD_MS, ZB_POLL_REPORT_HOLD_MS, ZB_POLL_BUTTON_HOLD_MS, ZB_POLL_APP_HOLD_MS},
+    .radioOnMs = ZB_POLL_RADIO_ON_MS,
+};
+
+// Short enough for the application to go through every mode in a test
+static const zb_poll_policy_t appPolicy = {
+    .fastIntervalMs = ZB_POLL_MIN_INTERVAL_MS,
+    .slowIntervalMs = 400,
+    .holdMs = {100, 100, 50, 150, 80},
+    .radioOnMs = 10,
+};
+
+/* Step the engine through its timers up to nowMs, as the scheduler alarm would, returning the intervals it moved to */
+static std::vector<uint32_t> runTo(zb_poll_engine_t *engine, uint32_t *clockMs, uint32_t nowMs) {
+    std::vector<uint32_t> intervals;
+
+    for (;;) {
+        uint32_t delay = ZB_PollEngineNextDelay(engine, *clockMs);
+        if (delay == ZB_POLL_NEVER || (int32_t)(*clockMs + delay - nowMs) > 0) {
+            break;
+        }
+        *clockMs += delay;
+        if (ZB_PollEngineOnTimer(engine, *clockMs)) {
+            intervals.push_back(engine->intervalMs);
+        }
+    }
+
+    *clockMs = nowMs;
+    return intervals;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+/********************* Engine **************************/
+void test_activity_polls_fast_then_decays() {
+    zb_poll_engine_t engine;
+    uint32_t now = 0;
+
+    ZB_PollEngineInit(&engine, &basePolicy, now);
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_SLOW, engine.mode);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_SLOW_INTERVAL_MS, engine.intervalMs);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_NEVER, ZB_PollEngineNextDelay(&engine, now));
+
+    now = 1000;
+    TEST_ASSERT_TRUE(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_COMMAND, now));
+    TEST_ASSERT_EQUAL_MESSAGE(ZB_POLL_MODE_FAST, engine.mode, ZB_PollModeToString(engine.mode));
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_FAST_INTERVAL_MS, engine.intervalMs);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_COMMAND_HOLD_MS, ZB_PollEngineNextDelay(&engine, now));
+
+    // The interval doubles once per poll at each, until it is back at slow
+    std::vector<uint32_t> intervals = runTo(&engine, &now, 1000 + ZB_POLL_COMMAND_HOLD_MS + 60000);
+    const uint32_t expected[] = {500, 1000, 2000, 4000, 8000, ZB_POLL_SLOW_INTERVAL_MS};
+    TEST_ASSERT_EQUAL_size_t(sizeof(expected) / sizeof(expected[0]), intervals.size());
+    TEST_ASSERT_EQUAL_MEMORY(expected, intervals.data(), sizeof(expected));
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_SLOW, engine.mode);
+
+    zb_poll_stats_t stats;
+    ZB_PollEngineGetStats(&engine, now, &stats);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_COMMAND_HOLD_MS, stats.modes[ZB_POLL_MODE_FAST].timeMs);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_COMMAND_HOLD_MS / ZB_POLL_FAST_INTERVAL_MS, stats.modes[ZB_POLL_MODE_FAST].polls);
+    TEST_ASSERT_EQUAL_UINT32(500 + 1000 + 2000 + 4000 + 8000, stats.modes[ZB_POLL_MODE_DECAY].timeMs);
+    TEST_ASSERT_EQUAL_UINT32(5, stats.modes[ZB_POLL_MODE_DECAY].polls);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.fastEntries);
+    TEST_ASSERT_EQUAL_UINT32(7, stats.intervalChanges);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.activities[ZB_POLL_ACTIVITY_COMMAND]);
+}
+
+void test_holds_overlap_per_activity() {
+    zb_poll_engine_t engine;
+    zb_poll_policy_t policy = basePolicy;
+    uint32_t now = 0;
+
+    policy.holdMs[ZB_POLL_ACTIVITY_APP] = 0;
+    ZB_PollEngineInit(&engine, &policy, now);
+
+    // A shorter hold does not cut a longer one short, and a later one extends it
+    TEST_ASSERT_TRUE(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_BUTTON, now));
+    now = 1000;
+    TEST_ASSERT_FALSE(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_REPORT, now));
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_BUTTON_HOLD_MS - 1000, ZB_PollEngineNextDelay(&engine, now));
+    now = 4000;
+    ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_COMMAND, now);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_COMMAND_HOLD_MS, ZB_PollEngineNextDelay(&engine, now));
+
+    // Timers on the way find the hold still running
+    TEST_ASSERT_FALSE(ZB_PollEngineOnTimer(&engine, ZB_POLL_BUTTON_HOLD_MS));
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_FAST, engine.mode);
+
+    // Activity with no hold is counted and nothing more
+    TEST_ASSERT_TRUE(runTo(&engine, &now, 200000).size() > 0);
+    TEST_ASSERT_FALSE(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_APP, now));
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_SLOW, engine.mode);
+
+    // Activity while decaying goes straight back to fast
+    ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_REPORT, now);
+    runTo(&engine, &now, now + ZB_POLL_REPORT_HOLD_MS + 800);
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_DECAY, engine.mode);
+    TEST_ASSERT_TRUE(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_COMMAND, now));
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_FAST, engine.mode);
+
+    zb_poll_stats_t stats;
+    ZB_PollEngineGetStats(&engine, now, &stats);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.fastEntries);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.activities[ZB_POLL_ACTIVITY_APP]);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.activities[ZB_POLL_ACTIVITY_REPORT]);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.activities[ZB_POLL_ACTIVITY_COMMAND]);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.activities[ZB_POLL_ACTIVITY_BUTTON]);
+}
+
+void test_late_timer_and_clock_wrap() {
+    zb_poll_engine_t engine;
+    uint32_t now = UINT32_MAX - 1000;
+
+    ZB_PollEngineInit(&engine, &basePolicy, now);
+    ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_COMMAND, now);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_COMMAND_HOLD_MS, ZB_PollEngineNextDelay(&engine, now));
+
+    // Across the wrap, and late enough that every step of the decay was missed
+    now += 60000;
+    TEST_ASSERT_EQUAL_UINT32(0, ZB_PollEngineNextDelay(&engine, now));
+    TEST_ASSERT_TRUE(ZB_PollEngineOnTimer(&engine, now));
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_SLOW, engine.mode);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_SLOW_INTERVAL_MS, engine.intervalMs);
+
+    zb_poll_stats_t stats;
+    ZB_PollEngineGetStats(&engine, now, &stats);
+    TEST_ASSERT_EQUAL_UINT32(60000, stats.elapsedMs);
+    TEST_ASSERT_EQUAL_UINT32(60000, stats.modes[ZB_POLL_MODE_FAST].timeMs);
+}
+
+void test_policy_swap() {
+    zb_poll_engine_t engine;
+    zb_poll_policy_t busy = basePolicy;
+    uint32_t now = 0;
+
+    busy.fastIntervalMs = 100;
+    busy.slowIntervalMs = 1000;
+    ZB_PollEngineInit(&engine, &basePolicy, now);
+
+    // Slow takes the new slow interval, fast the new fast one
+    TEST_ASSERT_TRUE(ZB_PollEngineSetPolicy(&engine, &busy, now));
+    TEST_ASSERT_EQUAL_UINT32(1000, engine.intervalMs);
+    ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_COMMAND, now);
+    TEST_ASSERT_TRUE(ZB_PollEngineSetPolicy(&engine, &basePolicy, now));
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_FAST_INTERVAL_MS, engine.intervalMs);
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_FAST, engine.mode);
+
+    // A decay already past the new slow interval ends there
+    runTo(&engine, &now, ZB_POLL_COMMAND_HOLD_MS + 500 + 1000 + 100);
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_DECAY, engine.mode);
+    TEST_ASSERT_EQUAL_UINT32(2000, engine.intervalMs);
+    TEST_ASSERT_TRUE(ZB_PollEngineSetPolicy(&engine, &busy, now));
+    TEST_ASSERT_EQUAL(ZB_POLL_MODE_SLOW, engine.mode);
+    TEST_ASSERT_EQUAL_UINT32(1000, engine.intervalMs);
+
+    // Clamped to the fastest the stack should be asked for, and slow no faster than fast
+    busy.fastIntervalMs = 1;
+    busy.slowIntervalMs = 0;
+    ZB_PollEngineSetPolicy(&engine, &busy, now);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_MIN_INTERVAL_MS, engine.policy.fastIntervalMs);
+    TEST_ASSERT_EQUAL_UINT32(ZB_POLL_MIN_INTERVAL_MS, engine.intervalMs);
+}
+
+void test_duty_cycle_accounting() {
+    zb_poll_engine_t engine;
+    uint32_t now = 0;
+    zb_poll_stats_t stats;
+
+    // An idle hour long polls 240 times, with the radio on 10 ms for each
+    ZB_PollEngineInit(&engine, &basePolicy, now);
+    now = 3600000;
+    ZB_PollEngineGetStats(&engine, now, &stats);
+    TEST_ASSERT_EQUAL_UINT32(3600000, stats.modes[ZB_POLL_MODE_SLOW].timeMs);
+    TEST_ASSERT_EQUAL_UINT32(240, stats.modes[ZB_POLL_MODE_SLOW].polls);
+    TEST_ASSERT_EQUAL_UINT32(2400, stats.radioOnMs);
+    TEST_ASSERT_EQUAL_UINT32(666, stats.dutyPpm);
+
+    // Reading the stats does not change them
+    ZB_PollEngineGetStats(&engine, now, &stats);
+    TEST_ASSERT_EQUAL_UINT32(240, stats.modes[ZB_POLL_MODE_SLOW].polls);
+
+    // Three seconds of fast polling cost about as much as three minutes of slow
+    ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_COMMAND, now);
+    now += ZB_POLL_COMMAND_HOLD_MS;
+    ZB_PollEngineGetStats(&engine, now, &stats);
+    TEST_ASSERT_EQUAL_UINT32(12, stats.modes[ZB_POLL_MODE_FAST].polls);
+    TEST_ASSERT_EQUAL_UINT32(2520, stats.radioOnMs);
+    uint32_t total = 0;
+    for (int mode = 0; mode < ZB_POLL_MODE_COUNT; mode++) {
+        total += stats.modes[mode].timeMs;
+    }
+    TEST_ASSERT_EQUAL_UINT32(stats.elapsedMs, total);
+}
+
+/* A day of traffic against a parent holding frames until the next poll. Pressing a button or sending a report makes
+ * a reply come back a little later, and the coordinator sends the odd unsolicited command.
+ */
+typedef enum {
+    TRAFFIC_BUTTON,
+    TRAFFIC_REPORT,
+    TRAFFIC_INCOMING,
+} traffic_kind_t;
+
+typedef struct {
+    uint32_t atMs;
+    traffic_kind_t kind;
+} traffic_t;
+
+typedef struct {
+    uint32_t polls;
+    uint32_t radioOnMs;
+    uint32_t replies;
+    uint64_t replyLatencyMs;            /* from reaching the parent to being polled off it */
+    uint32_t maxReplyLatencyMs;
+    uint32_t incoming;
+    uint64_t incomingLatencyMs;
+} day_result_t;
+
+#define DAY_MS (24 * 3600 * 1000UL)
+#define BUTTON_REPLY_MS 300
+#define REPORT_REPLY_MS 100
+
+static std::vector<traffic_t> makeDay(uint32_t seed) {
+    std::vector<traffic_t> traffic;
+    std::mt19937 generator(seed);
+
+    for (uint32_t at = 0; at < DAY_MS; at += 5 * 60 * 1000) {
+        traffic.push_back({at + 1234, TRAFFIC_REPORT});
+    }
+    for (uint32_t at = generator() % 600000; at < DAY_MS; at += 20 * 60 * 1000 + generator() % 3600000) {
+        traffic.push_back({at, TRAFFIC_BUTTON});
+    }
+    for (uint32_t at = generator() % 600000; at < DAY_MS; at += 10 * 60 * 1000 + generator() % 1800000) {
+        traffic.push_back({at, TRAFFIC_INCOMING});
+    }
+
+    std::sort(traffic.begin(), traffic.end(), [](const traffic_t &a, const traffic_t &b) { return a.atMs < b.atMs; });
+    return traffic;
+}
+
+static day_result_t simulateDay(const zb_poll_policy_t *policy, const std::vector<traffic_t> &traffic) {
+    zb_poll_engine_t engine;
+    std::vector<std::pair<uint32_t, bool>> held;            /* frames waiting at the parent: arrival, solicited */
+    std::vector<uint32_t> replies;                          /* on their way to the parent, sorted */
+    day_result_t result = {};
+    size_t next = 0;
+    uint32_t now = 0;
+
+    ZB_PollEngineInit(&engine, policy, now);
+    uint32_t nextPoll = engine.intervalMs;
+
+    // A new interval takes effect at once, rather than after the poll already scheduled at the old one
+    auto onChanged = [&](bool changed) {
+        if (changed && now + engine.intervalMs < nextPoll) {
+            nextPoll = now + engine.intervalMs;
+        }
+    };
+
+    while (true) {
+        uint32_t delay = ZB_PollEngineNextDelay(&engine, now);
+        uint32_t at = nextPoll;
+        at = delay != ZB_POLL_NEVER && now + delay < at ? now + delay : at;
+        at = next < traffic.size() && traffic[next].atMs < at ? traffic[next].atMs : at;
+        at = !replies.empty() && replies.front() < at ? replies.front() : at;
+        if (at >= DAY_MS) {
+            break;
+        }
+        now = at;
+
+        if (delay != ZB_POLL_NEVER && ZB_PollEngineNextDelay(&engine, now) == 0) {
+            onChanged(ZB_PollEngineOnTimer(&engine, now));
+        }
+        while (next < traffic.size() && traffic[next].atMs == now) {
+            switch (traffic[next].kind) {
+                case TRAFFIC_BUTTON:
+                    onChanged(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_BUTTON, now));
+                    replies.insert(std::upper_bound(replies.begin(), replies.end(), now + BUTTON_REPLY_MS), now + BUTTON_REPLY_MS);
+                    break;
+                case TRAFFIC_REPORT:
+                    onChanged(ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_REPORT, now));
+                    replies.insert(std::upper_bound(replies.begin(), replies.end(), now + REPORT_REPLY_MS), now + REPORT_REPLY_MS);
+                    break;
+                case TRAFFIC_INCOMING:
+                    held.push_back({now, false});
+                    break;
+            }
+            next++;
+        }
+        while (!replies.empty() && replies.front() == now) {
+            held.push_back({now, true});
+            replies.erase(replies.begin());
+        }
+
+        if (now == nextPoll) {
+            result.polls++;
+            for (auto &frame : held) {
+                uint32_t latency = now - frame.first;
+                if (frame.second) {
+                    result.replies++;
+                    result.replyLatencyMs += latency;
+                    result.maxReplyLatencyMs = std::max(result.maxReplyLatencyMs, latency);
+                } else {
+                    result.incoming++;
+                    result.incomingLatencyMs += latency;
+                }
+            }
+            if (!held.empty()) {
+                held.clear();
+                ZB_PollEngineOnActivity(&engine, ZB_POLL_ACTIVITY_COMMAND, now);
+            }
+            nextPoll = now + engine.intervalMs;
+        }
+    }
+
+    result.radioOnMs = result.polls * policy->radioOnMs;
+    return result;
+}
+
+void test_bench_day_against_fixed_keep_alive() {
+    std::vector<traffic_t> traffic = makeDay(11);
+    zb_poll_policy_t fixed = {ED_KEEP_ALIVE, ED_KEEP_ALIVE, {}, ZB_POLL_RADIO_ON_MS};
+    day_result_t results[2];
+    const char *names[2] = {"fixed keep alive", "adaptive"};
+
+    results[0] = simulateDay(&fixed, traffic);
+    results[1] = simulateDay(&basePolicy, traffic);
+
+    for (int i = 0; i < 2; i++) {
+        const day_result_t *result = &results[i];
+        printf("[bench] %-16s a day of %u events: %u polls, radio on %u ms (%u ppm), replies %u ms mean / %u ms max, unsolicited %u ms mean\n",
+               names[i], (unsigned)traffic.size(), (unsigned)result->polls, (unsigned)result->radioOnMs,
+               (unsigned)((uint64_t)result->radioOnMs * 1000000 / DAY_MS), (unsigned)(result->replyLatencyMs / result->replies),
+               (unsigned)result->maxReplyLatencyMs, (unsigned)(result->incomingLatencyMs / result->incoming));
+    }
+
+    // Every frame is delivered either way
+    TEST_ASSERT_EQUAL_UINT32(results[0].replies, results[1].replies);
+    TEST_ASSERT_EQUAL_UINT32(results[0].incoming, results[1].incoming);
+
+    // Replies come back several times faster, for a fraction of the polls
+    TEST_ASSERT_LESS_THAN(results[0].polls / 2, results[1].polls);
+    TEST_ASSERT_LESS_THAN(results[0].replyLatencyMs / 4, results[1].replyLatencyMs);
+    TEST_ASSERT_LESS_OR_EQUAL(ZB_POLL_FAST_INTERVAL_MS, results[1].maxReplyLatencyMs);
+}
+
+/********************* Application **************************/
+static bool waitForPollInterval(uint32_t intervalMs, uint32_t timeoutMs) {
+    uint32_t start = millis();
+
+    while (HOST_ZbGetLongPollInterval(NULL) != intervalMs) {
+        if (millis() - start > timeoutMs) {
+            return false;
+        }
+        delay(2);
+    }
+    return true;
+}
+
+static void injectFrame() {
+    uint8_t asdu[] = {0x00, 0x01, 0x00, 0x00, 0x00};      /* Read Attributes of the ZCL version */
+    esp_zb_apsde_data_ind_t ind = {};
+
+    ind.dst_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    ind.dst_short_addr = esp_zb_get_short_address();
+    ind.dst_endpoint = HA_ESP_SENSOR_ENDPOINT;
+    ind.src_addr_mode = ESP_ZB_APS_ADDR_MODE_16_ENDP_PRESENT;
+    ind.src_short_addr = 0x0000;
+    ind.src_endpoint = 1;
+    ind.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    ind.cluster_id = ESP_ZB_ZCL_CLUSTER_ID_BASIC;
+    ind.asdu_length = sizeof(asdu);
+    ind.asdu = asdu;
+    HOST_ZbInjectApsData(&ind, 0);
+}
+
+void test_app_follows_activity() {
+    zb_poll_stats_t before, after;
+    uint32_t changes;
+
+    // Joining polled fast for a while, and has since settled at slow
+    TEST_ASSERT_TRUE(waitForPollInterval(appPolicy.slowIntervalMs, 2000));
+    ZB_GetPollStats(&before);
+    TEST_ASSERT_EQUAL_UINT32(1, before.activities[ZB_POLL_ACTIVITY_JOIN]);
+    TEST_ASSERT_GREATER_THAN(0, before.modes[ZB_POLL_MODE_FAST].timeMs);
+
+    // A frame arriving switches to fast, and the decay brings it back
+    HOST_ZbGetLongPollInterval(&changes);
+    injectFrame();
+    TEST_ASSERT_TRUE(waitForPollInterval(appPolicy.fastIntervalMs, 500));
+    TEST_ASSERT_TRUE(waitForPollInterval(appPolicy.slowIntervalMs, 2000));
+    uint32_t changesAfter;
+    HOST_ZbGetLongPollInterval(&changesAfter);
+    TEST_ASSERT_EQUAL_UINT32(changes + 4, changesAfter);        /* 50, 100, 200 & 400 ms */
+
+    // So does a press reaching SW_Loop()
+#ifdef GPIO_DIMMER_SWITCH
+    TEST_ASSERT_EQUAL(ESP_OK, SW_InjectEvent(GPIO_DIMMER_SWITCH, SWITCH_EVENT_SHORT_PRESS));
+    SW_Loop(pdMS_TO_TICKS(100));
+    TEST_ASSERT_TRUE(waitForPollInterval(appPolicy.fastIntervalMs, 500));
+    TEST_ASSERT_TRUE(waitForPollInterval(appPolicy.slowIntervalMs, 2000));
+#endif
+
+    // ...and the application saying it expects traffic
+    ZB_PollActivity(ZB_POLL_ACTIVITY_APP);
+    TEST_ASSERT_EQUAL_UINT32(appPolicy.fastIntervalMs, HOST_ZbGetLongPollInterval(NULL));
+    TEST_ASSERT_TRUE(waitForPollInterval(appPolicy.slowIntervalMs, 2000));
+
+    ZB_GetPollStats(&after);
+    TEST_ASSERT_GREATER_OR_EQUAL(1, after.activities[ZB_POLL_ACTIVITY_COMMAND] - before.activities[ZB_POLL_ACTIVITY_COMMAND]);
+    TEST_ASSERT_EQUAL_UINT32(1, after.activities[ZB_POLL_ACTIVITY_APP]);
+#ifdef GPIO_DIMMER_SWITCH
+    TEST_ASSERT_EQUAL_UINT32(1, after.activities[ZB_POLL_ACTIVITY_BUTTON]);
+#endif
+    TEST_ASSERT_GREATER_THAN(before.fastEntries, after.fastEntries);
+    TEST_ASSERT_GREATER_THAN(before.modes[ZB_POLL_MODE_DECAY].timeMs, after.modes[ZB_POLL_MODE_DECAY].timeMs);
+    TEST_ASSERT_GREATER_THAN(0, after.dutyPpm);
+}
+
+void test_app_policy_swap() {
+    zb_poll_policy_t busy = appPolicy;
+    busy.slowIntervalMs = 100;
+
+    // Takes effect at once, and back again
+    ZB_SetPollPolicy(&busy);
+    TEST_ASSERT_EQUAL_UINT32(100, HOST_ZbGetLongPollInterval(NULL));
+    ZB_SetPollPolicy(&appPolicy);
+    TEST_ASSERT_EQUAL_UINT32(appPolicy.slowIntervalMs, HOST_ZbGetLongPollInterval(NULL));
+
+    // A policy that ignores frames stays slow through them
+    zb_poll_policy_t quiet = appPolicy;
+    quiet.holdMs[ZB_POLL_ACTIVITY_COMMAND] = 0;
+    ZB_SetPollPolicy(&quiet);
+    uint32_t changes, changesAfter;
+    HOST_ZbGetLongPollInterval(&changes);
+    injectFrame();
+    HOST_ZbSync();
+    delay(20);
+    HOST_ZbGetLongPollInterval(&changesAfter);
+    TEST_ASSERT_EQUAL_UINT32(changes, changesAfter);
+
+    ZB_SetPollPolicy(&appPolicy);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    // Before the stack starts, the policy is kept for when the device joins
+    ZB_SetPollPolicy(&appPolicy);
+
+    // Boot the application as the Arduino core would, then wait for the simulated join to finish
+    setup();
+    zb_diagnostics_t diagnostics;
+    do {
+        delay(10);
+        HOST_ZbSync();
+        ZB_GetDiagnostics(&diagnostics);
+    } while (diagnostics.secondsSinceJoin == ZB_DIAGNOSTICS_NOT_JOINED);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_activity_polls_fast_then_decays);
+    RUN_TEST(test_holds_overlap_per_activity);
+    RUN_TEST(test_late_timer_and_clock_wrap);
+    RUN_TEST(test_policy_swap);
+    RUN_TEST(test_duty_cycle_accounting);
+    RUN_TEST(test_bench_day_against_fixed_keep_alive);
+    RUN_TEST(test_app_follows_activity);
+    RUN_TEST(test_app_policy_swap);
+    return UNITY_END();
+}
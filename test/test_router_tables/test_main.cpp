@@ -0,0 +1,209 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Router build: stack configuration ahead of esp_zb_init(), table occupancy & peaks, and forwarding counters folded
+// from the stack's wrapping Diagnostics attributes, through the application against a host stack that relays frames
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+// Application entry point from main.cpp
+void setup();
+
+#define BENCH_ITERATIONS 10000
+
+static uint16_t readDiagnostic(uint16_t attribute) {
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(HA_ESP_SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attribute);
+    TEST_ASSERT_NOT_NULL(attr);
+    TEST_ASSERT_EQUAL_HEX8(ESP_ZB_ZCL_ATTR_TYPE_U16, attr->type);
+
+    uint16_t value;
+    memcpy(&value, attr->data_p, sizeof(value));
+    return value;
+}
+
+static bool addNeighbor(uint16_t shortAddress, esp_zb_nwk_relationship_t relationship) {
+    esp_zb_nwk_neighbor_info_t neighbor = {};
+    neighbor.short_addr = shortAddress;
+    neighbor.relationship = relationship;
+    neighbor.device_type = relationship == ESP_ZB_NWK_RELATIONSHIP_CHILD ? ESP_ZB_DEVICE_TYPE_ED : ESP_ZB_DEVICE_TYPE_ROUTER;
+    neighbor.lqi = 200;
+    return HOST_ZbAddNeighbor(&neighbor);
+}
+
+static void forward(uint16_t destination, uint32_t frames, uint16_t burst) {
+    HOST_ZbForward(destination, frames, burst);
+    HOST_ZbSync();
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_configured_as_router() {
+    host_zb_config_t config;
+    HOST_ZbGetConfig(&config);
+
+    TEST_ASSERT_EQUAL(ESP_ZB_DEVICE_TYPE_ROUTER, config.role);
+    TEST_ASSERT_EQUAL_UINT8(ZB_ROUTER_MAX_CHILDREN, config.maxChildren);
+    TEST_ASSERT_EQUAL_UINT16(ZB_ROUTER_NETWORK_SIZE, config.networkSize);
+    TEST_ASSERT_EQUAL_UINT16(ZB_ROUTER_IO_BUFFERS, config.ioBufferSize);
+    TEST_ASSERT_EQUAL_UINT16(ZB_ROUTER_SCHEDULER_QUEUE, config.schedulerQueueSize);
+
+    // Too late once the stack is up
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_zb_io_buffer_size_set(ZB_ROUTER_IO_BUFFERS * 2));
+
+    esp_zb_zcl_attr_t *powerSource =
+        esp_zb_zcl_get_attribute(HA_ESP_SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_BASIC, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_BASIC_POWER_SOURCE_ID);
+    TEST_ASSERT_NOT_NULL(powerSource);
+    TEST_ASSERT_EQUAL_HEX8(ESP_ZB_ZCL_BASIC_POWER_SOURCE_MAINS_SINGLE_PHASE, *(uint8_t *)powerSource->data_p);
+}
+
+// Runs first, so the first sample period after joining holds only these frames
+void test_forwarding_rate() {
+    uint32_t start = millis();
+    forward(0x1001, 600, 10);
+
+    zb_router_stats_t stats;
+    delay(ZB_ROUTER_SAMPLE_MS - (millis() - start) + 500);
+    ZB_GetRouterStats(&stats);
+
+    // 600 frames over one ZB_ROUTER_SAMPLE_MS period, give or take how long after joining they were sent
+    uint32_t expected = 600 * 60000 / ZB_ROUTER_SAMPLE_MS;
+    TEST_ASSERT_UINT32_WITHIN(expected / 10, expected, stats.forwardedPerMinute);
+    TEST_ASSERT_EQUAL_UINT32(stats.forwardedPerMinute, stats.forwardedPerMinutePeak);
+}
+
+void test_tables_and_peaks() {
+    HOST_ZbClearNetworkTables();
+    for (uint16_t i = 0; i < ZB_ROUTER_MAX_CHILDREN; i++) {
+        TEST_ASSERT_TRUE(addNeighbor(0x2000 + i, ESP_ZB_NWK_RELATIONSHIP_CHILD));
+    }
+    TEST_ASSERT_FALSE(addNeighbor(0x2100, ESP_ZB_NWK_RELATIONSHIP_CHILD));
+    TEST_ASSERT_TRUE(addNeighbor(0x0000, ESP_ZB_NWK_RELATIONSHIP_PARENT));
+    TEST_ASSERT_TRUE(addNeighbor(0x3000, ESP_ZB_NWK_RELATIONSHIP_SIBLING));
+    forward(0x4000, 1, 1);
+    forward(0x4001, 1, 1);
+
+    zb_router_stats_t stats;
+    ZB_GetRouterStats(&stats);
+    TEST_ASSERT_EQUAL_UINT8(ZB_ROUTER_MAX_CHILDREN, stats.children);
+    TEST_ASSERT_EQUAL_UINT16(ZB_ROUTER_MAX_CHILDREN + 2, stats.neighbors);
+    TEST_ASSERT_EQUAL_UINT16(2, stats.routes);
+
+    // Occupancy follows the tables down, the peaks stay
+    HOST_ZbClearNetworkTables();
+    TEST_ASSERT_TRUE(addNeighbor(0x0000, ESP_ZB_NWK_RELATIONSHIP_PARENT));
+    ZB_GetRouterStats(&stats);
+    TEST_ASSERT_EQUAL_UINT8(0, stats.children);
+    TEST_ASSERT_EQUAL_UINT16(1, stats.neighbors);
+    TEST_ASSERT_EQUAL_UINT16(0, stats.routes);
+    TEST_ASSERT_EQUAL_UINT8(ZB_ROUTER_MAX_CHILDREN, stats.childrenPeak);
+    TEST_ASSERT_EQUAL_UINT16(ZB_ROUTER_MAX_CHILDREN + 2, stats.neighborsPeak);
+    TEST_ASSERT_TRUE(stats.routesPeak >= 2);
+
+    // The neighbor table holds ZB_ROUTER_NETWORK_SIZE entries
+    for (uint16_t i = 1; i < ZB_ROUTER_NETWORK_SIZE; i++) {
+        TEST_ASSERT_TRUE(addNeighbor(0x5000 + i, ESP_ZB_NWK_RELATIONSHIP_SIBLING));
+    }
+    TEST_ASSERT_FALSE(addNeighbor(0x6000, ESP_ZB_NWK_RELATIONSHIP_SIBLING));
+    ZB_GetRouterStats(&stats);
+    TEST_ASSERT_EQUAL_UINT16(ZB_ROUTER_NETWORK_SIZE, stats.neighborsPeak);
+}
+
+void test_forwarding_counters() {
+    zb_router_stats_t before, after;
+    ZB_GetRouterStats(&before);
+
+    // A new destination costs one route discovery, a known one none
+    forward(0x7000, 50, 5);
+    forward(0x7000, 50, 5);
+    ZB_GetRouterStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(100, after.forwarded - before.forwarded);
+    TEST_ASSERT_EQUAL_UINT32(1, after.routeDiscoveries - before.routeDiscoveries);
+    TEST_ASSERT_EQUAL_UINT32(0, after.bufferFailures - before.bufferFailures);
+
+    // A burst larger than the buffer pool loses the excess
+    before = after;
+    forward(0x7000, ZB_ROUTER_IO_BUFFERS + 20, ZB_ROUTER_IO_BUFFERS + 20);
+    ZB_GetRouterStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(ZB_ROUTER_IO_BUFFERS, after.forwarded - before.forwarded);
+    TEST_ASSERT_EQUAL_UINT32(20, after.bufferFailures - before.bufferFailures);
+
+    // A full routing table discovers again for every destination it has to evict for
+    before = after;
+    for (uint16_t i = 0; i < HOST_ZB_ROUTING_TABLE_SIZE + 8; i++) {
+        forward(0x8000 + i, 1, 1);
+    }
+    ZB_GetRouterStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(HOST_ZB_ROUTING_TABLE_SIZE + 8, after.routeDiscoveries - before.routeDiscoveries);
+    TEST_ASSERT_EQUAL_UINT16(HOST_ZB_ROUTING_TABLE_SIZE, after.routes);
+    TEST_ASSERT_EQUAL_UINT16(HOST_ZB_ROUTING_TABLE_SIZE, after.routesPeak);
+}
+
+// The stack's counters are 16-bit; totals carry on past their wrap as long as each sample sees less than one wrap
+void test_counters_wrap() {
+    zb_router_stats_t before, after;
+    ZB_GetRouterStats(&before);
+
+    for (int i = 0; i < 3; i++) {
+        forward(0x7000, 40000, ZB_ROUTER_IO_BUFFERS);
+        ZB_GetRouterStats(&after);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(120000, after.forwarded - before.forwarded);
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)after.forwarded, readDiagnostic(ZB_ATTR_DIAGNOSTICS_RELAYED_UCAST_ID));
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)after.routeDiscoveries, readDiagnostic(ZB_ATTR_DIAGNOSTICS_ROUTE_DISC_INITIATED_ID));
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)after.bufferFailures, readDiagnostic(ZB_ATTR_DIAGNOSTICS_PACKET_BUFFER_ALLOCATE_FAILURES_ID));
+}
+
+void test_bench_sample_full_tables() {
+    zb_router_stats_t stats;
+    ZB_GetRouterStats(&stats);
+    TEST_ASSERT_EQUAL_UINT16(ZB_ROUTER_NETWORK_SIZE, stats.neighbors);
+    TEST_ASSERT_EQUAL_UINT16(HOST_ZB_ROUTING_TABLE_SIZE, stats.routes);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        ZB_GetRouterStats(&stats);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    printf("[bench] router stats over %d neighbors & %d routes: %.2fus per sample\n", stats.neighbors, stats.routes,
+           (double)elapsed / BENCH_ITERATIONS);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    // Boot the application as the Arduino core would, then wait for the simulated join to finish
+    setup();
+    do {
+        delay(10);
+        HOST_ZbSync();
+    } while (!esp_zb_bdb_dev_joined());
+
+    UNITY_BEGIN();
+    RUN_TEST(test_configured_as_router);
+    RUN_TEST(test_forwarding_rate);
+    RUN_TEST(test_tables_and_peaks);
+    RUN_TEST(test_forwarding_counters);
+    RUN_TEST(test_counters_wrap);
+    RUN_TEST(test_bench_sample_full_tables);
+    return UNITY_END();
+}
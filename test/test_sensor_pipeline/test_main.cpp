@@ -0,0 +1,473 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Sensor sampling: the fixed-point filter stages against reference implementations and sample streams shaped like real
+// sensors, their cost, and channels sampled by the sensors task into Zigbee attributes
+#include <Arduino.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <random>
+#include <vector>
+
+#include "Sensors/sensors.h"
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+#define CLUSTER_ID_SUPPLY 0xFC20
+#define ATTR_SUPPLY_MILLIVOLTS 0x0000
+#define ATTR_SUPPLY_PULSES 0x0001
+#define ADC_PIN 2
+#define COUNTER_PIN 4
+
+static constexpr int16_t noTemperature = (int16_t)0x8000;
+static constexpr uint16_t noMillivolts = 0;
+static constexpr uint32_t noPulses = 0;
+
+static constexpr zb_attribute_desc_t temperatureAttributes[] = {
+    {ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID, ESP_ZB_ZCL_ATTR_TYPE_S16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &noTemperature},
+};
+static constexpr zb_attribute_desc_t supplyAttributes[] = {
+    {ATTR_SUPPLY_MILLIVOLTS, ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &noMillivolts},
+    {ATTR_SUPPLY_PULSES, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &noPulses},
+};
+static constexpr zb_cluster_desc_t sensorClusters[] = {
+    ZB_CLUSTER(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, temperatureAttributes),
+    ZB_CLUSTER(CLUSTER_ID_SUPPLY, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, supplyAttributes),
+};
+static constexpr zb_endpoint_desc_t sensorEndpoints[] = {
+    ZB_ENDPOINT(HA_ESP_SENSOR_ENDPOINT, ESP_ZB_HA_TEMPERATURE_SENSOR_DEVICE_ID, sensorClusters),
+};
+static constexpr zb_device_desc_t sensorDevice = ZB_DEVICE(sensorEndpoints);
+ZB_ASSERT_DEVICE_VALID(sensorDevice);
+
+static std::atomic<int32_t> temperatureReading{2150};
+static std::atomic<bool> temperatureReadFails{false};
+static uint8_t temperatureChannel, adcChannel, counterChannel;
+
+/********************* Sample streams **************************/
+/* A thermistor divider on the ADC, in millivolts: slow drift, a few millivolts of noise and the odd wild conversion.
+ * Synthesised rather than recorded, as no captures from a device are kept in the tree; seeded, so every run filters the
+ * same samples.
+ */
+static std::vector<int32_t> thermistorStream(size_t count, uint32_t seed) {
+    std::mt19937 generator(seed);
+    std::normal_distribution<double> noise(0.0, 4.0);
+    std::vector<int32_t> samples(count);
+
+    for (size_t i = 0; i < count; i++) {
+        double drift = 120.0 * sin(2 * M_PI * i / 20000.0);
+        samples[i] = (int32_t)lround(1650.0 + drift + noise(generator));
+        if (generator() % 500 == 0) {
+            samples[i] += generator() % 2 ? 900 : -900;
+        }
+    }
+    return samples;
+}
+
+static int32_t referenceMedian(const std::vector<int32_t> &samples, size_t end, size_t length) {
+    size_t start = end + 1 >= length ? end + 1 - length : 0;
+    std::vector<int32_t> window(samples.begin() + start, samples.begin() + end + 1);
+    std::sort(window.begin(), window.end());
+
+    size_t n = window.size();
+    return n & 1 ? window[n / 2] : (int32_t)(((int64_t)window[n / 2 - 1] + window[n / 2]) / 2);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+/********************* Filters **************************/
+void test_invalid_stages_are_rejected() {
+    sens_pipeline_t pipeline;
+    const sens_stage_t badStages[][1] = {
+        {SENS_EMA(0)}, {SENS_EMA(SENS_EMA_MAX_SHIFT + 1)}, {SENS_MEDIAN(4)}, {SENS_MEDIAN(SENS_MEDIAN_MAX + 2)}, {SENS_DECIMATE(1)},
+    };
+    const sens_stage_t tooMany[SENS_MAX_STAGES + 1] = {SENS_EMA(1), SENS_EMA(1), SENS_EMA(1), SENS_EMA(1), SENS_EMA(1)};
+
+    for (const auto &stage : badStages) {
+        TEST_ASSERT_EQUAL_MESSAGE(ESP_ERR_INVALID_ARG, SENS_PipelineInit(&pipeline, stage, 1, 0), SENS_FilterTypeToString(stage[0].type));
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, SENS_PipelineInit(&pipeline, tooMany, SENS_MAX_STAGES + 1, 0));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, SENS_PipelineInit(&pipeline, tooMany, 1, -1));
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, tooMany, SENS_MAX_STAGES, 0));
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, NULL, 0, 0));
+}
+
+void test_ema_tracks_a_step_without_bias() {
+    const sens_stage_t stages[] = {SENS_EMA(3)};
+    sens_pipeline_t pipeline;
+    int32_t output = 0;
+
+    for (int32_t level : {1000, -1000}) {
+        TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, stages, 1, 0));
+        SENS_PipelineFilter(&pipeline, 0, &output);
+
+        // Each step closes 1/8 of the remaining gap, as the floating point filter would
+        double expected = 0;
+        for (int i = 0; i < 20; i++) {
+            SENS_PipelineFilter(&pipeline, level, &output);
+            expected += (level - expected) / 8;
+            TEST_ASSERT_INT32_WITHIN(1, lround(expected), output);
+        }
+
+        // and settles exactly on the input rather than a few counts short of it
+        for (int i = 0; i < 200; i++) {
+            SENS_PipelineFilter(&pipeline, level, &output);
+        }
+        TEST_ASSERT_EQUAL_INT32(level, output);
+    }
+}
+
+void test_median_matches_reference() {
+    std::mt19937 generator(3);
+    std::vector<int32_t> samples(5000);
+    for (auto &sample : samples) {
+        sample = (int32_t)(generator() % 2001) - 1000;
+    }
+
+    for (uint8_t length = 1; length <= SENS_MEDIAN_MAX; length += 2) {
+        const sens_stage_t stages[] = {SENS_MEDIAN(length)};
+        sens_pipeline_t pipeline;
+        TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, stages, 1, 0));
+
+        for (size_t i = 0; i < samples.size(); i++) {
+            int32_t output;
+            TEST_ASSERT_TRUE(SENS_PipelineFilter(&pipeline, samples[i], &output));
+            TEST_ASSERT_EQUAL_INT32(referenceMedian(samples, i, length), output);
+        }
+    }
+}
+
+void test_median_drops_spikes() {
+    const sens_stage_t stages[] = {SENS_MEDIAN(5)};
+    std::vector<int32_t> samples = thermistorStream(20000, 1);
+    sens_pipeline_t pipeline;
+    int32_t output, worst = 0;
+
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, stages, 1, 0));
+    for (size_t i = 0; i < samples.size(); i++) {
+        SENS_PipelineFilter(&pipeline, samples[i], &output);
+        int32_t error = abs(output - (int32_t)lround(1650.0 + 120.0 * sin(2 * M_PI * i / 20000.0)));
+        worst = std::max(worst, error);
+    }
+
+    // Raw samples stray by 900 mV; no single wild one gets through the median
+    TEST_ASSERT_TRUE(worst < 50);
+}
+
+void test_decimate_and_scale() {
+    const sens_stage_t stages[] = {SENS_DECIMATE(4), SENS_SCALE(SENS_Q16(0.1), -50)};
+    sens_pipeline_t pipeline;
+    int32_t output;
+
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, stages, 2, 0));
+
+    // One output per 4 samples, their rounded mean, then scaled
+    const int32_t run[] = {1000, 1001, 1003, 1004};
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_FALSE(SENS_PipelineFilter(&pipeline, run[i], &output));
+    }
+    TEST_ASSERT_TRUE(SENS_PipelineFilter(&pipeline, run[3], &output));
+    TEST_ASSERT_EQUAL_INT32(1002 / 10 - 50, output);
+
+    // Negative means round away from zero too
+    const int32_t negative[] = {-1, -2, -2, -2};
+    for (int32_t sample : negative) {
+        SENS_PipelineFilter(&pipeline, sample * 10, &output);
+    }
+    TEST_ASSERT_EQUAL_INT32(-2 - 50, output);
+
+    TEST_ASSERT_EQUAL_UINT32(8, pipeline.stats.samples);
+    TEST_ASSERT_EQUAL_UINT32(2, pipeline.stats.outputs);
+}
+
+void test_gate_publishes_on_delta() {
+    const sens_stage_t stages[] = {SENS_EMA(2)};
+    sens_pipeline_t pipeline;
+    int32_t value;
+
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, stages, 1, 10));
+
+    // The first output is always published
+    TEST_ASSERT_TRUE(SENS_PipelinePush(&pipeline, 500, &value));
+    TEST_ASSERT_EQUAL_INT32(500, value);
+
+    // Not committed, so it is offered again
+    TEST_ASSERT_TRUE(SENS_PipelinePush(&pipeline, 500, &value));
+    SENS_PipelineCommit(&pipeline, value);
+
+    for (int i = 0; i < 50; i++) {
+        TEST_ASSERT_FALSE(SENS_PipelinePush(&pipeline, 500 + (i % 3) * 4, &value));
+    }
+
+    // A step gets through once the filtered value has moved far enough
+    int pushes = 0;
+    while (!SENS_PipelinePush(&pipeline, 600, &value)) {
+        pushes++;
+    }
+    TEST_ASSERT_TRUE(value >= 510);
+    TEST_ASSERT_TRUE(pushes <= 2);
+    TEST_ASSERT_EQUAL_UINT32(1, pipeline.stats.published);
+}
+
+void test_bench_pipeline() {
+    const size_t count = 200000;
+    std::vector<int32_t> samples = thermistorStream(count, 2);
+    const struct {
+        const char *name;
+        sens_stage_t stages[SENS_MAX_STAGES];
+        uint8_t stageCount;
+    } chains[] = {
+        {"raw", {}, 0},
+        {"EMA(4)", {SENS_EMA(4)}, 1},
+        {"MEDIAN(5)", {SENS_MEDIAN(5)}, 1},
+        {"MEDIAN(5) DECIMATE(16) EMA(2) SCALE", {SENS_MEDIAN(5), SENS_DECIMATE(16), SENS_EMA(2), SENS_SCALE(SENS_Q16(0.5), 0)}, 4},
+    };
+    uint32_t published[4];
+
+    for (size_t c = 0; c < sizeof(chains) / sizeof(chains[0]); c++) {
+        sens_pipeline_t pipeline;
+        TEST_ASSERT_EQUAL(ESP_OK, SENS_PipelineInit(&pipeline, chains[c].stages, chains[c].stageCount, 5));
+
+        int64_t start = esp_timer_get_time();
+        for (int32_t sample : samples) {
+            int32_t value;
+            if (SENS_PipelinePush(&pipeline, sample, &value)) {
+                SENS_PipelineCommit(&pipeline, value);
+            }
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+
+        published[c] = pipeline.stats.published;
+        printf("[bench] %-36s %5.1f ns/sample, %6u of %u samples published with a 5 mV delta\n", chains[c].name, elapsed * 1000.0 / count,
+               (unsigned)pipeline.stats.published, (unsigned)count);
+    }
+
+    // Noise alone crosses the delta on raw samples; filtered, only the drift does
+    TEST_ASSERT_TRUE(published[3] * 20 < published[0]);
+    TEST_ASSERT_TRUE(published[2] < published[0]);
+}
+
+/********************* Channels **************************/
+static sens_channel_stats_t channelStats(uint8_t channel) {
+    sens_channel_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_GetChannelStats(channel, &stats));
+    return stats;
+}
+
+static bool waitForPublished(uint8_t channel, uint32_t published) {
+    for (int i = 0; i < 200; i++) {
+        if (channelStats(channel).pipeline.published >= published) {
+            return true;
+        }
+        delay(5);
+    }
+    return false;
+}
+
+template <typename T>
+static T readAttribute(uint16_t cluster, uint16_t attribute) {
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(HA_ESP_SENSOR_ENDPOINT, cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attribute);
+    TEST_ASSERT_NOT_NULL(attr);
+
+    T value;
+    memcpy(&value, attr->data_p, sizeof(value));
+    return value;
+}
+
+static esp_err_t readTemperature(void *context, int32_t *value) {
+    *value = temperatureReading;
+    return temperatureReadFails ? ESP_FAIL : ESP_OK;
+}
+
+void test_read_channel_writes_on_delta() {
+    TEST_ASSERT_TRUE(waitForPublished(temperatureChannel, 1));
+    TEST_ASSERT_EQUAL_INT16(2150, readAttribute<int16_t>(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID));
+
+    // Changes under the delta are sampled but never written
+    uint32_t samples = channelStats(temperatureChannel).pipeline.samples;
+    temperatureReading = 2170;
+    delay(60);
+    sens_channel_stats_t stats = channelStats(temperatureChannel);
+    TEST_ASSERT_TRUE(stats.pipeline.samples >= samples + 3);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.pipeline.published);
+
+    // Failed reads are skipped, then a reading past the delta is written
+    sens_stats_t before;
+    SENS_GetStats(&before);
+    temperatureReadFails = true;
+    delay(30);
+    temperatureReadFails = false;
+    temperatureReading = 2300;
+    TEST_ASSERT_TRUE(waitForPublished(temperatureChannel, 2));
+    TEST_ASSERT_EQUAL_INT16(2300, readAttribute<int16_t>(ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT, ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID));
+
+    sens_stats_t after;
+    SENS_GetStats(&after);
+    TEST_ASSERT_TRUE(after.readFailures > before.readFailures);
+}
+
+static void convertAdcFrame(int millivolts) {
+    sens_stats_t before, after;
+
+    SENS_GetStats(&before);
+    HOST_AdcSetMillivolts(ADC_PIN, millivolts);
+    TEST_ASSERT_TRUE(HOST_AdcConvert());
+    for (int i = 0; i < 200; i++) {
+        SENS_GetStats(&after);
+        if (after.adcFrames > before.adcFrames) {
+            return;
+        }
+        delay(1);
+    }
+    TEST_FAIL_MESSAGE("ADC frame not taken");
+}
+
+void test_adc_channel_decimates_frames() {
+    // Four frames make one output
+    for (int i = 0; i < 4; i++) {
+        convertAdcFrame(3000);
+    }
+    TEST_ASSERT_TRUE(waitForPublished(adcChannel, 1));
+    TEST_ASSERT_EQUAL_UINT16(3000, readAttribute<uint16_t>(CLUSTER_ID_SUPPLY, ATTR_SUPPLY_MILLIVOLTS));
+
+    for (int i = 0; i < 4; i++) {
+        convertAdcFrame(i < 2 ? 3010 : 3000);
+    }
+    delay(20);
+    sens_channel_stats_t stats = channelStats(adcChannel);
+    TEST_ASSERT_EQUAL_UINT32(8, stats.pipeline.samples);
+    TEST_ASSERT_EQUAL_INT32(3005, stats.lastOutput);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.pipeline.published);
+
+    for (int i = 0; i < 4; i++) {
+        convertAdcFrame(2500);
+    }
+    TEST_ASSERT_TRUE(waitForPublished(adcChannel, 2));
+    TEST_ASSERT_EQUAL_UINT16(2500, readAttribute<uint16_t>(CLUSTER_ID_SUPPLY, ATTR_SUPPLY_MILLIVOLTS));
+}
+
+void test_counter_channel_counts_edges_per_period() {
+    // Line the edges up just after a sample, so they all land in the next period
+    uint32_t samples = channelStats(counterChannel).pipeline.samples;
+    while (channelStats(counterChannel).pipeline.samples == samples) {
+        delay(1);
+    }
+    for (int i = 0; i < 25; i++) {
+        HOST_GpioSetLevel(COUNTER_PIN, HIGH);
+        HOST_GpioSetLevel(COUNTER_PIN, LOW);
+    }
+
+    TEST_ASSERT_TRUE(waitForPublished(counterChannel, 2));
+    TEST_ASSERT_EQUAL_UINT32(25, readAttribute<uint32_t>(CLUSTER_ID_SUPPLY, ATTR_SUPPLY_PULSES));
+
+    // Back to zero once the edges stop
+    TEST_ASSERT_TRUE(waitForPublished(counterChannel, 3));
+    TEST_ASSERT_EQUAL_UINT32(0, readAttribute<uint32_t>(CLUSTER_ID_SUPPLY, ATTR_SUPPLY_PULSES));
+}
+
+void test_channels_are_validated() {
+    sens_channel_config_t config = {};
+    config.source = SENS_SOURCE_READ;
+    config.periodMs = 10;
+    config.attributeType = ESP_ZB_ZCL_ATTR_TYPE_U16;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, SENS_AddChannel(&config, NULL));
+
+    sens_stats_t stats;
+    SENS_GetStats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writeFailures);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, SENS_GetChannelStats(SENS_MAX_CHANNELS, NULL));
+}
+
+static void addChannels() {
+    static const sens_stage_t decimate[] = {SENS_DECIMATE(4)};
+
+    sens_channel_config_t temperature = {};
+    temperature.source = SENS_SOURCE_READ;
+    temperature.periodMs = 10;
+    temperature.read = readTemperature;
+    temperature.delta = 50;
+    temperature.endpoint = HA_ESP_SENSOR_ENDPOINT;
+    temperature.cluster = ESP_ZB_ZCL_CLUSTER_ID_TEMP_MEASUREMENT;
+    temperature.attribute = ESP_ZB_ZCL_ATTR_TEMP_MEASUREMENT_VALUE_ID;
+    temperature.attributeType = ESP_ZB_ZCL_ATTR_TYPE_S16;
+
+    sens_channel_config_t supply = {};
+    supply.source = SENS_SOURCE_ADC;
+    supply.pin = ADC_PIN;
+    supply.stages = decimate;
+    supply.stageCount = 1;
+    supply.delta = 10;
+    supply.endpoint = HA_ESP_SENSOR_ENDPOINT;
+    supply.cluster = CLUSTER_ID_SUPPLY;
+    supply.attribute = ATTR_SUPPLY_MILLIVOLTS;
+    supply.attributeType = ESP_ZB_ZCL_ATTR_TYPE_U16;
+
+    sens_channel_config_t pulses = {};
+    pulses.source = SENS_SOURCE_COUNTER;
+    pulses.pin = COUNTER_PIN;
+    pulses.periodMs = 100;
+    pulses.delta = 1;
+    pulses.endpoint = HA_ESP_SENSOR_ENDPOINT;
+    pulses.cluster = CLUSTER_ID_SUPPLY;
+    pulses.attribute = ATTR_SUPPLY_PULSES;
+    pulses.attributeType = ESP_ZB_ZCL_ATTR_TYPE_U32;
+
+    // Bad configs first, none of which take a channel
+    sens_channel_config_t bad = temperature;
+    bad.read = NULL;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, SENS_AddChannel(&bad, NULL));
+    bad = temperature;
+    bad.attributeType = ESP_ZB_ZCL_ATTR_TYPE_BOOL;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, SENS_AddChannel(&bad, NULL));
+
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_AddChannel(&temperature, &temperatureChannel));
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_AddChannel(&supply, &adcChannel));
+    TEST_ASSERT_EQUAL(ESP_OK, SENS_AddChannel(&pulses, &counterChannel));
+    TEST_ASSERT_EQUAL_UINT8(0, temperatureChannel);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    ZB_SetDeviceDescriptor(&sensorDevice);
+    ZB_StartMainTask();
+    for (int i = 0; i < 100 && !esp_zb_bdb_dev_joined(); i++) {
+        delay(10);
+    }
+    HOST_ZbSync();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_invalid_stages_are_rejected);
+    RUN_TEST(test_ema_tracks_a_step_without_bias);
+    RUN_TEST(test_median_matches_reference);
+    RUN_TEST(test_median_drops_spikes);
+    RUN_TEST(test_decimate_and_scale);
+    RUN_TEST(test_gate_publishes_on_delta);
+    RUN_TEST(test_bench_pipeline);
+
+    RUN_TEST(addChannels);
+    SENS_Start();
+    RUN_TEST(test_read_channel_writes_on_delta);
+    RUN_TEST(test_adc_channel_decimates_frames);
+    RUN_TEST(test_counter_channel_counts_edges_per_period);
+    RUN_TEST(test_channels_are_validated);
+    return UNITY_END();
+}
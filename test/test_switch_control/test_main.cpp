@@ -0,0 +1,310 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Control command frames, their routing to bindings & groups, and switch gestures sent from the switch timer, with
+// press-to-transmit latency measured from the simulated GPIO edge
+#include <Arduino.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Switches/switches.h"
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+// Application entry point from main.cpp
+void setup();
+
+#define BENCH_PRESSES 20
+#define SEND_TIMEOUT_MS 1000
+
+typedef struct {
+    uint8_t addrMode;
+    uint16_t group;
+    uint8_t srcEndpoint;
+    uint16_t cluster;
+    int64_t sentUs;
+    std::vector<uint8_t> asdu;
+} sent_frame_t;
+
+static std::mutex framesMutex;
+static std::vector<sent_frame_t> sentFrames;
+
+static void clearFrames() {
+    std::lock_guard<std::mutex> lock(framesMutex);
+    sentFrames.clear();
+}
+
+// Wait for count frames to have been sent, and return a copy of them
+static std::vector<sent_frame_t> waitForFrames(size_t count) {
+    for (int i = 0; i < SEND_TIMEOUT_MS; i++) {
+        {
+            std::lock_guard<std::mutex> lock(framesMutex);
+            if (sentFrames.size() >= count) {
+                return sentFrames;
+            }
+        }
+        delay(1);
+    }
+
+    std::lock_guard<std::mutex> lock(framesMutex);
+    return sentFrames;
+}
+
+static const switch_func_pair_t *dimmer() {
+    for (size_t i = 0; i < button_func_pair_count; i++) {
+        const switch_func_pair_t &button = button_func_pair[i];
+        if (button.func == SWITCH_LEVEL_CONTROL) {
+            return &button;
+        }
+    }
+    return NULL;
+}
+
+void setUp() {
+    clearFrames();
+}
+
+void tearDown() {
+}
+
+static void assertEncodes(zb_control_action_t action, uint8_t amount, uint16_t expectedCluster, const uint8_t *expected, size_t length) {
+    zb_control_command_t command = {action, 1, 0x1234, 7, amount, 0};
+    uint8_t frame[ZB_CONTROL_MAX_FRAME_SIZE];
+    uint16_t cluster = 0;
+
+    TEST_ASSERT_EQUAL(length, ZB_ControlEncode(&command, 0x42, &cluster, frame));
+    TEST_ASSERT_EQUAL_HEX16(expectedCluster, cluster);
+    TEST_ASSERT_EQUAL_MEMORY(expected, frame, length);
+}
+
+void test_encodes_commands() {
+    const uint8_t toggle[] = {0x11, 0x42, 0x02};
+    const uint8_t off[] = {0x11, 0x42, 0x00};
+    const uint8_t stepUp[] = {0x11, 0x42, 0x06, 0x00, ZB_CONTROL_LEVEL_STEP, 0x00, 0x00};
+    const uint8_t stepDown[] = {0x11, 0x42, 0x06, 0x01, 10, 0x00, 0x00};
+    const uint8_t moveDown[] = {0x11, 0x42, 0x05, 0x01, ZB_CONTROL_LEVEL_RATE};
+    const uint8_t stop[] = {0x11, 0x42, 0x07};
+    const uint8_t recall[] = {0x11, 0x42, 0x05, 0x34, 0x12, 7};
+
+    assertEncodes(ZB_CONTROL_TOGGLE, 0, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, toggle, sizeof(toggle));
+    assertEncodes(ZB_CONTROL_OFF, 0, ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, off, sizeof(off));
+    assertEncodes(ZB_CONTROL_LEVEL_STEP_UP, 0, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, stepUp, sizeof(stepUp));
+    assertEncodes(ZB_CONTROL_LEVEL_STEP_DOWN, 10, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, stepDown, sizeof(stepDown));
+    assertEncodes(ZB_CONTROL_LEVEL_MOVE_DOWN, 0, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, moveDown, sizeof(moveDown));
+    assertEncodes(ZB_CONTROL_LEVEL_STOP, 0, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, stop, sizeof(stop));
+    assertEncodes(ZB_CONTROL_SCENE_RECALL, 0, ESP_ZB_ZCL_CLUSTER_ID_SCENES, recall, sizeof(recall));
+
+    zb_control_command_t unknown = {(zb_control_action_t)(ZB_CONTROL_SCENE_RECALL + 1), 1, 0, 0, 0, 0};
+    uint8_t frame[ZB_CONTROL_MAX_FRAME_SIZE];
+    uint16_t cluster;
+    TEST_ASSERT_EQUAL(0, ZB_ControlEncode(&unknown, 0, &cluster, frame));
+}
+
+void test_sends_to_bindings_and_groups() {
+    zb_control_command_t toggle = {ZB_CONTROL_TOGGLE, HA_ESP_SENSOR_ENDPOINT, 0, 0, 0, 0};
+    zb_control_command_t recall = {ZB_CONTROL_SCENE_RECALL, HA_ESP_SENSOR_ENDPOINT, 0x0010, 3, 0, 0};
+
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_SendControlCommand(&toggle));
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_SendControlCommand(&recall));
+
+    std::vector<sent_frame_t> frames = waitForFrames(2);
+    TEST_ASSERT_EQUAL(2, frames.size());
+
+    TEST_ASSERT_EQUAL(ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT, frames[0].addrMode);
+    TEST_ASSERT_EQUAL_HEX16(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, frames[0].cluster);
+    TEST_ASSERT_EQUAL_UINT8(HA_ESP_SENSOR_ENDPOINT, frames[0].srcEndpoint);
+    TEST_ASSERT_EQUAL_HEX8(ZCL_CMD_ON_OFF_TOGGLE, frames[0].asdu[2]);
+
+    TEST_ASSERT_EQUAL(ESP_ZB_APS_ADDR_MODE_16_GROUP_ENDP_NOT_PRESENT, frames[1].addrMode);
+    TEST_ASSERT_EQUAL_HEX16(0x0010, frames[1].group);
+    TEST_ASSERT_EQUAL_HEX16(ESP_ZB_ZCL_CLUSTER_ID_SCENES, frames[1].cluster);
+    const uint8_t recallPayload[] = {ZCL_CMD_SCENES_RECALL_SCENE, 0x10, 0x00, 3};
+    TEST_ASSERT_EQUAL_MEMORY(recallPayload, &frames[1].asdu[2], sizeof(recallPayload));
+
+    // Each command takes the next transaction sequence number
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)(frames[0].asdu[1] + 1), frames[1].asdu[1]);
+}
+
+void test_dimmer_gestures() {
+    const switch_func_pair_t *button = dimmer();
+    TEST_ASSERT_NOT_NULL(button);
+
+    // Tap, then two holds, which dim up then down, each stopped by its release
+    HOST_GpioSetLevel(button->pin, LOW);
+    delay(40);
+    HOST_GpioSetLevel(button->pin, HIGH);
+    delay(60);
+    for (int hold = 0; hold < 2; hold++) {
+        HOST_GpioSetLevel(button->pin, LOW);
+        delay(SWITCH_LONG_PRESS_MS / 2 + 100);
+        HOST_GpioSetLevel(button->pin, HIGH);
+        delay(60);
+    }
+
+    std::vector<sent_frame_t> frames = waitForFrames(5);
+    TEST_ASSERT_EQUAL(5, frames.size());
+
+    const uint16_t clusters[] = {ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,
+                                 ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL};
+    const uint8_t commands[] = {ZCL_CMD_ON_OFF_TOGGLE, ZCL_CMD_LEVEL_MOVE_WITH_ON_OFF, ZCL_CMD_LEVEL_STOP_WITH_ON_OFF,
+                                ZCL_CMD_LEVEL_MOVE_WITH_ON_OFF, ZCL_CMD_LEVEL_STOP_WITH_ON_OFF};
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL_HEX16(clusters[i], frames[i].cluster);
+        TEST_ASSERT_EQUAL_HEX8(commands[i], frames[i].asdu[2]);
+        TEST_ASSERT_EQUAL(ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT, frames[i].addrMode);
+    }
+    TEST_ASSERT_EQUAL_HEX8(0x00, frames[1].asdu[3]);
+    TEST_ASSERT_EQUAL_HEX8(0x01, frames[3].asdu[3]);
+}
+
+// Senders never wait on a busy stack; what they queued goes out under one lock once it is free
+void test_queued_commands_share_a_lock() {
+    zb_control_stats_t before, after;
+    ZB_GetControlStats(&before);
+
+    std::vector<std::thread> senders;
+    std::atomic<int> overflowed(0);
+
+    esp_zb_lock_acquire(portMAX_DELAY);
+    uint32_t locks = HOST_ZbGetLockCount();
+    for (int i = 0; i < ZB_CONTROL_QUEUE_LENGTH + 1; i++) {
+        senders.emplace_back([&overflowed]() {
+            zb_control_command_t command = {ZB_CONTROL_LEVEL_STEP_UP, HA_ESP_SENSOR_ENDPOINT, 0, 0, 0, 0};
+            if (ZB_SendControlCommand(&command) == ESP_ERR_NO_MEM) {
+                overflowed++;
+            }
+        });
+    }
+
+    // Every sender returns while the lock is still held, the one that found the queue full included
+    for (std::thread &sender : senders) {
+        sender.join();
+    }
+    TEST_ASSERT_EQUAL(1, overflowed.load());
+    TEST_ASSERT_EQUAL(0, waitForFrames(0).size());
+    esp_zb_lock_release();
+
+    std::vector<sent_frame_t> frames = waitForFrames(ZB_CONTROL_QUEUE_LENGTH);
+    TEST_ASSERT_EQUAL(ZB_CONTROL_QUEUE_LENGTH, frames.size());
+
+    ZB_GetControlStats(&after);
+    TEST_ASSERT_EQUAL_UINT32(ZB_CONTROL_QUEUE_LENGTH, after.queued - before.queued);
+    TEST_ASSERT_EQUAL_UINT32(ZB_CONTROL_QUEUE_LENGTH, after.sent - before.sent);
+    TEST_ASSERT_EQUAL_UINT32(1, after.dropped - before.dropped);
+    TEST_ASSERT_TRUE(HOST_ZbGetLockCount() - locks < ZB_CONTROL_QUEUE_LENGTH);
+}
+
+void test_bench_press_to_transmit() {
+    const switch_func_pair_t *button = dimmer();
+    std::vector<int64_t> samples;
+
+    for (int i = 0; i < BENCH_PRESSES; i++) {
+        clearFrames();
+        HOST_GpioSetLevel(button->pin, LOW);
+        delay(30);
+
+        int64_t release = esp_timer_get_time();
+        HOST_GpioSetLevel(button->pin, HIGH);
+
+        std::vector<sent_frame_t> frames = waitForFrames(1);
+        TEST_ASSERT_EQUAL(1, frames.size());
+        samples.push_back(frames[0].sentUs - release);
+        delay(10);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    zb_control_stats_t stats;
+    ZB_GetControlStats(&stats);
+
+    // The debounce settle time is most of it; the rest is the Zigbee event worker handing the frame to the APS layer
+    TEST_ASSERT_TRUE(samples.front() >= SWITCH_DEBOUNCE_MS * 1000);
+    TEST_ASSERT_TRUE(stats.latencyMaxUs > 0 && stats.latencyMinUs <= stats.latencyMaxUs);
+    printf("[bench] release -> APS request n=%d min=%lldus p50=%lldus max=%lldus (debounce %dms); device counted last=%luus min=%luus max=%luus\n",
+           BENCH_PRESSES, (long long)samples.front(), (long long)samples[samples.size() / 2], (long long)samples.back(), SWITCH_DEBOUNCE_MS,
+           (unsigned long)stats.latencyLastUs, (unsigned long)stats.latencyMinUs, (unsigned long)stats.latencyMaxUs);
+}
+
+// A press whose timer command the ISR could not queue is still debounced, once SW_Loop() has armed the timer
+void test_dropped_timer_command_is_rearmed() {
+    const switch_func_pair_t *button = dimmer();
+
+    // Nothing runs loop() here, so take the events earlier tests left waiting
+    for (int i = 0; i < 20; i++) {
+        SW_Loop(0);
+    }
+    clearFrames();
+
+    HOST_TimerFailFromISR(1);
+    HOST_GpioSetLevel(button->pin, LOW);
+    SW_Loop(pdMS_TO_TICKS(100));
+    delay(40);
+    HOST_GpioSetLevel(button->pin, HIGH);
+
+    std::vector<sent_frame_t> frames = waitForFrames(1);
+    TEST_ASSERT_EQUAL(1, frames.size());
+    TEST_ASSERT_EQUAL_HEX8(ZCL_CMD_ON_OFF_TOGGLE, frames[0].asdu[2]);
+}
+
+// Leaves the device off the network, so it must come last
+void test_dropped_off_network() {
+    zb_control_stats_t before, after;
+    ZB_GetControlStats(&before);
+
+    HOST_ZbSetFactoryNew(true);
+    zb_control_command_t toggle = {ZB_CONTROL_TOGGLE, HA_ESP_SENSOR_ENDPOINT, 0, 0, 0, 0};
+    TEST_ASSERT_EQUAL(ESP_OK, ZB_SendControlCommand(&toggle));
+
+    for (int i = 0; i < SEND_TIMEOUT_MS; i++) {
+        ZB_GetControlStats(&after);
+        if (after.dropped != before.dropped) {
+            break;
+        }
+        delay(1);
+    }
+    TEST_ASSERT_EQUAL_UINT32(before.sent, after.sent);
+    TEST_ASSERT_EQUAL_UINT32(before.dropped + 1, after.dropped);
+    TEST_ASSERT_EQUAL(0, waitForFrames(1).size());
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+    HOST_ZbSetApsDataHook([](const esp_zb_apsde_data_req_t *req) {
+        std::lock_guard<std::mutex> lock(framesMutex);
+        if (req->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_ON_OFF || req->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL ||
+            req->cluster_id == ESP_ZB_ZCL_CLUSTER_ID_SCENES) {
+            sentFrames.push_back({req->dst_addr_mode, req->dst_addr.addr_short, req->src_endpoint, req->cluster_id, esp_timer_get_time(),
+                                  std::vector<uint8_t>(req->asdu, req->asdu + req->asdu_length)});
+        }
+    });
+
+    // Boot the application, with its client clusters and switches, and wait for the simulated join
+    setup();
+    for (int i = 0; i < 100 && !esp_zb_bdb_dev_joined(); i++) {
+        delay(10);
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_encodes_commands);
+    RUN_TEST(test_sends_to_bindings_and_groups);
+    RUN_TEST(test_dimmer_gestures);
+    RUN_TEST(test_queued_commands_share_a_lock);
+    RUN_TEST(test_bench_press_to_transmit);
+    RUN_TEST(test_dropped_timer_command_is_rearmed);
+    RUN_TEST(test_dropped_off_network);
+    return UNITY_END();
+}
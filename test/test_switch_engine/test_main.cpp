@@ -0,0 +1,274 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Switch engine correctness and cost against simulated GPIO timelines, with no timers or threads involved
+#include <Arduino.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <chrono>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "Switches/switch_engine.h"
+
+typedef struct {
+    uint32_t timeMs;
+    uint8_t pin;
+    int level;
+} sim_edge_t;
+
+typedef struct {
+    uint32_t timeMs;
+    uint8_t pin;
+    switch_event_t event;
+} sim_event_t;
+
+// Drives a set of engine pins from a list of edges, standing in for the ISR and one one-shot timer per pin
+class SwitchSim {
+public:
+    SwitchSim(size_t pinCount, const switch_timing_t *timing) : engines(pinCount), levels(pinCount, HIGH), timerDue(pinCount, 0), timerArmed(pinCount, false) {
+        for (switch_engine_pin_t &engine : engines) {
+            SW_EngineInit(&engine, timing);
+        }
+    }
+
+    std::vector<sim_event_t> run(std::vector<sim_edge_t> edges, uint32_t endMs) {
+        std::vector<sim_event_t> events;
+        std::sort(edges.begin(), edges.end(), [](const sim_edge_t &a, const sim_edge_t &b) { return a.timeMs < b.timeMs; });
+        size_t nextEdge = 0;
+
+        while (true) {
+            uint32_t edgeTime = nextEdge < edges.size() ? edges[nextEdge].timeMs : UINT32_MAX;
+
+            // Lazy min-heap of timer expiries; stale entries are skipped when popped
+            while (!timers.empty() && (!timerArmed[timers.top().second] || timerDue[timers.top().second] != timers.top().first)) {
+                timers.pop();
+            }
+            uint32_t timerTime = timers.empty() ? UINT32_MAX : timers.top().first;
+
+            if (edgeTime == UINT32_MAX && timerTime == UINT32_MAX) {
+                break;
+            }
+            if (std::min(edgeTime, timerTime) > endMs) {
+                break;
+            }
+
+            if (edgeTime <= timerTime) {
+                const sim_edge_t &edge = edges[nextEdge++];
+                if (levels[edge.pin] != edge.level) {
+                    levels[edge.pin] = edge.level;
+                    arm(edge.pin, edge.timeMs, SW_EngineOnEdge(&engines[edge.pin], edge.timeMs));
+                    steps++;
+                }
+            } else {
+                uint8_t pin = timers.top().second;
+                timers.pop();
+                timerArmed[pin] = false;
+
+                switch_event_t fired[SWITCH_ENGINE_MAX_EVENTS];
+                uint8_t firedCount;
+                uint32_t delayMs = SW_EngineOnTimer(&engines[pin], levels[pin], timerTime, fired, &firedCount);
+                steps++;
+
+                for (uint8_t i = 0; i < firedCount; i++) {
+                    events.push_back({timerTime, pin, fired[i]});
+                }
+                if (delayMs) {
+                    arm(pin, timerTime, delayMs);
+                }
+            }
+        }
+
+        return events;
+    }
+
+    const switch_engine_pin_t &engine(uint8_t pin) const { return engines[pin]; }
+
+    uint64_t steps = 0;
+
+private:
+    void arm(uint8_t pin, uint32_t nowMs, uint32_t delayMs) {
+        timerArmed[pin] = true;
+        timerDue[pin] = nowMs + delayMs;
+        timers.push({timerDue[pin], pin});
+    }
+
+    std::vector<switch_engine_pin_t> engines;
+    std::vector<int> levels;
+    std::vector<uint32_t> timerDue;
+    std::vector<bool> timerArmed;
+    std::priority_queue<std::pair<uint32_t, uint8_t>, std::vector<std::pair<uint32_t, uint8_t>>, std::greater<std::pair<uint32_t, uint8_t>>> timers;
+};
+
+static const switch_timing_t timing = {SWITCH_DEBOUNCE_MS, SWITCH_LONG_PRESS_MS, SWITCH_DOUBLE_CLICK_MS, SWITCH_REPEAT_MS};
+static const switch_timing_t noDoubleClick = {SWITCH_DEBOUNCE_MS, SWITCH_LONG_PRESS_MS, 0, 0};
+
+// A press or release with a few milliseconds of contact bounce ahead of the final level
+static void addBouncyEdge(std::vector<sim_edge_t> &edges, uint8_t pin, uint32_t timeMs, int level, int bounces) {
+    for (int i = 0; i < bounces; i++) {
+        edges.push_back({timeMs + i * 2, pin, level});
+        edges.push_back({timeMs + i * 2 + 1, pin, !level});
+    }
+    edges.push_back({timeMs + bounces * 2, pin, level});
+}
+
+static void addClick(std::vector<sim_edge_t> &edges, uint8_t pin, uint32_t pressMs, uint32_t holdMs) {
+    addBouncyEdge(edges, pin, pressMs, LOW, 3);
+    addBouncyEdge(edges, pin, pressMs + holdMs, HIGH, 3);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_bouncy_click_reports_one_short_press() {
+    SwitchSim sim(1, &noDoubleClick);
+    std::vector<sim_edge_t> edges;
+    addClick(edges, 0, 100, 150);
+
+    std::vector<sim_event_t> events = sim.run(edges, 5000);
+
+    TEST_ASSERT_EQUAL(1, events.size());
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_SHORT_PRESS, events[0].event);
+    // Reported one debounce period after the last release bounce
+    TEST_ASSERT_EQUAL(100 + 150 + 6 + SWITCH_DEBOUNCE_MS, events[0].timeMs);
+    TEST_ASSERT_EQUAL(SWITCH_IDLE, sim.engine(0).state);
+}
+
+void test_glitch_is_rejected() {
+    SwitchSim sim(1, &timing);
+    std::vector<sim_edge_t> edges = {{100, 0, LOW}, {105, 0, HIGH}};
+
+    std::vector<sim_event_t> events = sim.run(edges, 5000);
+
+    TEST_ASSERT_EQUAL(0, events.size());
+    TEST_ASSERT_EQUAL(SWITCH_IDLE, sim.engine(0).state);
+}
+
+void test_short_press_waits_for_double_click_window() {
+    SwitchSim sim(1, &timing);
+    std::vector<sim_edge_t> edges;
+    addClick(edges, 0, 100, 100);
+
+    std::vector<sim_event_t> events = sim.run(edges, 5000);
+
+    TEST_ASSERT_EQUAL(1, events.size());
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_SHORT_PRESS, events[0].event);
+    TEST_ASSERT_EQUAL(100 + 100 + 6 + SWITCH_DEBOUNCE_MS + SWITCH_DOUBLE_CLICK_MS, events[0].timeMs);
+}
+
+void test_double_click() {
+    SwitchSim sim(1, &timing);
+    std::vector<sim_edge_t> edges;
+    addClick(edges, 0, 100, 80);
+    addClick(edges, 0, 300, 80);
+
+    std::vector<sim_event_t> events = sim.run(edges, 5000);
+
+    TEST_ASSERT_EQUAL(1, events.size());
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_DOUBLE_CLICK, events[0].event);
+}
+
+void test_long_press_repeats_and_release() {
+    SwitchSim sim(1, &timing);
+    std::vector<sim_edge_t> edges;
+    addClick(edges, 0, 100, SWITCH_LONG_PRESS_MS + 3 * SWITCH_REPEAT_MS + 100);
+
+    std::vector<sim_event_t> events = sim.run(edges, 10000);
+
+    TEST_ASSERT_EQUAL(5, events.size());
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_LONG_PRESS, events[0].event);
+    TEST_ASSERT_EQUAL(100 + 6 + SWITCH_DEBOUNCE_MS + SWITCH_LONG_PRESS_MS, events[0].timeMs);
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_HOLD_REPEAT, events[1].event);
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_HOLD_REPEAT, events[2].event);
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_HOLD_REPEAT, events[3].event);
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_HOLD_RELEASE, events[4].event);
+}
+
+void test_no_long_press_reports_any_hold_on_release() {
+    const switch_timing_t noLongPress = {SWITCH_DEBOUNCE_MS, 0, 0, 0};
+    SwitchSim sim(1, &noLongPress);
+    std::vector<sim_edge_t> edges;
+    addClick(edges, 0, 100, 5 * SWITCH_LONG_PRESS_MS);
+
+    std::vector<sim_event_t> events = sim.run(edges, 10000);
+
+    TEST_ASSERT_EQUAL(1, events.size());
+    TEST_ASSERT_EQUAL(SWITCH_EVENT_SHORT_PRESS, events[0].event);
+    TEST_ASSERT_EQUAL(100 + 5 * SWITCH_LONG_PRESS_MS + 6 + SWITCH_DEBOUNCE_MS, events[0].timeMs);
+}
+
+void test_held_pin_does_not_deafen_others() {
+    SwitchSim sim(2, &noDoubleClick);
+    std::vector<sim_edge_t> edges;
+    addClick(edges, 0, 100, 3000);
+    addClick(edges, 1, 500, 100);
+
+    std::vector<sim_event_t> events = sim.run(edges, 10000);
+
+    bool sawOther = false;
+    for (const sim_event_t &event : events) {
+        if (event.pin == 1) {
+            TEST_ASSERT_EQUAL(SWITCH_EVENT_SHORT_PRESS, event.event);
+            TEST_ASSERT_TRUE(event.timeMs < 700);
+            sawOther = true;
+        }
+    }
+    TEST_ASSERT_TRUE(sawOther);
+}
+
+void test_bench_many_pins() {
+    const int pinCount = 64;
+    const uint32_t durationMs = 10 * 60 * 1000;
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<uint32_t> gap(200, 4000);
+    std::uniform_int_distribution<uint32_t> hold(40, 2500);
+    std::uniform_int_distribution<int> bounces(0, 6);
+
+    std::vector<sim_edge_t> edges;
+    for (int pin = 0; pin < pinCount; pin++) {
+        for (uint32_t t = gap(rng); t < durationMs; t += gap(rng)) {
+            uint32_t held = hold(rng);
+            addBouncyEdge(edges, pin, t, LOW, bounces(rng));
+            addBouncyEdge(edges, pin, t + held, HIGH, bounces(rng));
+            t += held + 20;
+        }
+    }
+
+    SwitchSim sim(pinCount, &timing);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<sim_event_t> events = sim.run(edges, durationMs + 10000);
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    TEST_ASSERT_TRUE(events.size() > 0);
+    printf("[bench] %d pins, %zu edges, %llu engine steps, %zu events: %.1f ns/step (incl. simulator)\n", pinCount, edges.size(),
+           (unsigned long long)sim.steps, events.size(), (double)elapsed / (double)sim.steps);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_bouncy_click_reports_one_short_press);
+    RUN_TEST(test_glitch_is_rejected);
+    RUN_TEST(test_short_press_waits_for_double_click_window);
+    RUN_TEST(test_double_click);
+    RUN_TEST(test_long_press_repeats_and_release);
+    RUN_TEST(test_no_long_press_reports_any_hold_on_release);
+    RUN_TEST(test_held_pin_does_not_deafen_others);
+    RUN_TEST(test_bench_many_pins);
+    return UNITY_END();
+}
@@ -0,0 +1,664 @@
+// Copyright 2024 Skye Harris
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Trace format, round-robin sectors & torn records on a RAM flash, and the recorder capturing the application's
+// signals, actions & switch events on the host flash stand-in, then replaying them back into the same callbacks
+#include <Arduino.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "esp_partition.h"
+#include "Switches/switches.h"
+#include "Trace/trace.h"
+#include "Trace/trace_log.h"
+#include "Trace/trace_replay.h"
+#include "Zigbee/zigbee.h"
+#include "host_platform.h"
+
+// Application entry point from main.cpp
+void setup();
+
+#define SECTOR_SIZE 512
+#define BENCH_RECORDS 2000
+#define BENCH_HOOK_ROUNDS 200
+
+/********************* RAM flash **************************/
+// Writes clear bits only, as NOR flash does
+static esp_err_t ramRead(void *context, uint32_t offset, void *data, size_t size) {
+    std::vector<uint8_t> *flash = (std::vector<uint8_t> *)context;
+    if (offset + size > flash->size()) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(data, flash->data() + offset, size);
+    return ESP_OK;
+}
+
+static esp_err_t ramWrite(void *context, uint32_t offset, const void *data, size_t size) {
+    std::vector<uint8_t> *flash = (std::vector<uint8_t> *)context;
+    if (offset + size > flash->size()) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        (*flash)[offset + i] &= ((const uint8_t *)data)[i];
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ramErase(void *context, uint32_t offset, size_t size) {
+    std::vector<uint8_t> *flash = (std::vector<uint8_t> *)context;
+    if (offset + size > flash->size()) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(flash->data() + offset, 0xff, size);
+    return ESP_OK;
+}
+
+static trace_flash_t ramFlash(std::vector<uint8_t> *data, uint32_t sectorSize, uint32_t sectorCount) {
+    data->assign(sectorSize * sectorCount, 0xff);
+    return {ramRead, ramWrite, ramErase, data, sectorSize, sectorCount};
+}
+
+// A copy of the recorder's region, so a replay reads a still trace while the recorder goes on writing
+static trace_flash_t copyRecorderRegion(std::vector<uint8_t> *data) {
+    TRACE_Flush();
+    const trace_flash_t *region = TRACE_GetFlash();
+    TEST_ASSERT_NOT_NULL(region);
+
+    trace_flash_t flash = ramFlash(data, region->sectorSize, region->sectorCount);
+    TEST_ASSERT_EQUAL(ESP_OK, region->read(region->context, 0, data->data(), data->size()));
+    return flash;
+}
+
+static void writeRecord(trace_log_t *log, uint8_t type, int64_t timestampUs, uint32_t id, int32_t value) {
+    trace_record_t record = {type, 0, timestampUs, id, value, {}};
+    uint8_t encoded[TRACE_MAX_RECORD_SIZE];
+
+    size_t size = TRACE_LogEncode(log, &record, encoded);
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogWrite(log, encoded, size));
+}
+
+/********************* Application target **************************/
+typedef struct {
+    uint32_t waitedUs;
+    uint32_t waits;
+} replay_context_t;
+
+static void replaySignal(void *context, uint32_t signal, esp_err_t status, const void *params, size_t size) {
+    if (params != NULL) {
+        HOST_ZbInjectSignalParams((esp_zb_app_signal_type_t)signal, status, params, size);
+    } else {
+        HOST_ZbInjectSignal((esp_zb_app_signal_type_t)signal, status);
+    }
+}
+
+// The message only lives as long as the call, so wait for the stack task to have handled it
+static void replayAction(void *context, uint32_t callbackId, const void *message) {
+    HOST_ZbInvokeAction((esp_zb_core_action_callback_id_t)callbackId, message);
+    HOST_ZbSync();
+}
+
+static void replaySwitchEvent(void *context, uint8_t pin, uint8_t event) {
+    SW_InjectEvent(pin, (switch_event_t)event);
+}
+
+static void countWait(void *context, uint32_t us) {
+    replay_context_t *replay = (replay_context_t *)context;
+    replay->waitedUs += us;
+    replay->waits++;
+}
+
+static const trace_replay_target_t appTarget = {replaySignal, replayAction, replaySwitchEvent, NULL, NULL};
+
+static uint8_t dimmerPin() {
+    for (size_t i = 0; i < button_func_pair_count; i++) {
+        const switch_func_pair_t &button = button_func_pair[i];
+        if (button.func == SWITCH_LEVEL_CONTROL) {
+            return button.pin;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    uint32_t signals;
+    uint32_t actions;
+    uint32_t sent;
+} app_counts_t;
+
+static app_counts_t appCounts() {
+    zb_diagnostics_t diagnostics;
+    zb_control_stats_t control;
+
+    HOST_ZbSync();
+    ZB_GetDiagnostics(&diagnostics);
+    ZB_GetControlStats(&control);
+    return {diagnostics.signals, diagnostics.actions, control.sent};
+}
+
+// Switch presses reach the network through the switch and control tasks, after the stack has gone idle
+static app_counts_t appCountsOnceSent(uint32_t sent) {
+    app_counts_t counts = appCounts();
+    uint32_t start = millis();
+
+    while (counts.sent < sent && millis() - start < 1000) {
+        delay(2);
+        counts = appCounts();
+    }
+    return counts;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+/********************* Format **************************/
+void test_encodes_records() {
+    std::vector<uint8_t> data;
+    trace_flash_t flash = ramFlash(&data, SECTOR_SIZE, 2);
+    trace_log_t log;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogMount(&log, &flash));
+
+    const trace_record_t records[] = {
+        {TRACE_RECORD_BOOT, 0, 250000, 0, 0, {}},
+        {TRACE_RECORD_SIGNAL, 0, 250100, ESP_ZB_BDB_SIGNAL_STEERING, ESP_FAIL, {}},
+        {TRACE_RECORD_SWITCH, 0, 9000000000LL, 9, SWITCH_EVENT_LONG_PRESS, {}},
+        {TRACE_RECORD_BOOT, 0, 1000, 0, 0, {}},
+    };
+    uint8_t encoded[4][TRACE_MAX_RECORD_SIZE];
+    size_t sizes[4];
+    int64_t previousUs = 0;
+
+    for (int i = 0; i < 4; i++) {
+        sizes[i] = TRACE_LogEncode(&log, &records[i], encoded[i]);
+
+        trace_record_t decoded;
+        TEST_ASSERT_EQUAL(sizes[i], TRACE_Decode(encoded[i], sizes[i], previousUs, &decoded));
+        TEST_ASSERT_EQUAL_UINT8(records[i].type, decoded.type);
+        TEST_ASSERT_EQUAL_INT64(records[i].timestampUs, decoded.timestampUs);
+        TEST_ASSERT_EQUAL_UINT32(records[i].id, decoded.id);
+        TEST_ASSERT_EQUAL_INT32(records[i].value, decoded.value);
+        TEST_ASSERT_EQUAL_UINT8(0, decoded.length);
+        previousUs = decoded.timestampUs;
+    }
+
+    // A signal close after the one before takes a handful of bytes
+    TEST_ASSERT_EQUAL(6, sizes[1]);
+
+    // Anything short or damaged decodes as nothing
+    trace_record_t decoded;
+    TEST_ASSERT_EQUAL(0, TRACE_Decode(encoded[1], sizes[1] - 1, 0, &decoded));
+    encoded[1][3] ^= 0x10;
+    TEST_ASSERT_EQUAL(0, TRACE_Decode(encoded[1], sizes[1], 0, &decoded));
+    TEST_ASSERT_EQUAL_STRING("signal", TRACE_RecordTypeToString(TRACE_RECORD_SIGNAL));
+    TEST_ASSERT_EQUAL_STRING("unknown", TRACE_RecordTypeToString(TRACE_FREE));
+}
+
+void test_action_messages_round_trip() {
+    trace_action_message_t storage;
+    uint8_t data[TRACE_MAX_DATA_SIZE];
+
+    uint16_t identifyTime = 30;
+    esp_zb_zcl_set_attr_value_message_t write = {};
+    write.info = {ESP_ZB_ZCL_STATUS_SUCCESS, HA_ESP_SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY};
+    write.attribute = {ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, {ESP_ZB_ZCL_ATTR_TYPE_U16, sizeof(identifyTime), &identifyTime}};
+
+    uint8_t length = TRACE_EncodeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &write, data);
+    const esp_zb_zcl_set_attr_value_message_t *decodedWrite =
+        (const esp_zb_zcl_set_attr_value_message_t *)TRACE_DecodeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, data, length, &storage);
+    TEST_ASSERT_NOT_NULL(decodedWrite);
+    TEST_ASSERT_EQUAL_UINT8(HA_ESP_SENSOR_ENDPOINT, decodedWrite->info.dst_endpoint);
+    TEST_ASSERT_EQUAL_HEX16(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY, decodedWrite->info.cluster);
+    TEST_ASSERT_EQUAL_HEX16(ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, decodedWrite->attribute.id);
+    TEST_ASSERT_EQUAL(ESP_ZB_ZCL_ATTR_TYPE_U16, decodedWrite->attribute.data.type);
+    TEST_ASSERT_EQUAL_UINT16(sizeof(identifyTime), decodedWrite->attribute.data.size);
+    TEST_ASSERT_EQUAL_MEMORY(&identifyTime, decodedWrite->attribute.data.value, sizeof(identifyTime));
+
+    // A payload longer than a record holds is cut short, and its size says what was kept
+    uint8_t payload[64];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t)i;
+    }
+    esp_zb_zcl_custom_cluster_command_message_t command = {};
+    command.info.status = ESP_ZB_ZCL_STATUS_SUCCESS;
+    command.info.header = {0x05, 0x131b, 0x42, -61};
+    command.info.src_address.addr_type = ESP_ZB_ZCL_ADDR_TYPE_SHORT;
+    command.info.src_address.u.addr_short = 0x1234;
+    command.info.src_endpoint = 3;
+    command.info.dst_endpoint = HA_ESP_SENSOR_ENDPOINT;
+    command.info.cluster = 0xFC20;
+    command.info.profile = ESP_ZB_AF_HA_PROFILE_ID;
+    command.info.command = {0x07, ESP_ZB_ZCL_CMD_DIRECTION_TO_SRV, 0};
+    command.data.type = ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING;
+    command.data.size = sizeof(payload);
+    command.data.value = payload;
+
+    length = TRACE_EncodeAction(ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID, &command, data);
+    TEST_ASSERT_EQUAL(TRACE_MAX_DATA_SIZE, length);
+    const esp_zb_zcl_custom_cluster_command_message_t *decodedCommand =
+        (const esp_zb_zcl_custom_cluster_command_message_t *)TRACE_DecodeAction(ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID, data, length, &storage);
+    TEST_ASSERT_NOT_NULL(decodedCommand);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, decodedCommand->info.src_address.u.addr_short);
+    TEST_ASSERT_EQUAL_HEX16(0xFC20, decodedCommand->info.cluster);
+    TEST_ASSERT_EQUAL_HEX16(0x131b, decodedCommand->info.header.manuf_code);
+    TEST_ASSERT_EQUAL_INT8(-61, decodedCommand->info.header.rssi);
+    TEST_ASSERT_EQUAL_HEX8(0x07, decodedCommand->info.command.id);
+    TEST_ASSERT_EQUAL_UINT16(TRACE_MAX_DATA_SIZE - 21, decodedCommand->data.size);
+    TEST_ASSERT_EQUAL_MEMORY(payload, decodedCommand->data.value, decodedCommand->data.size);
+
+    uint8_t reported = 1;
+    esp_zb_zcl_report_attr_message_t report = {};
+    report.src_address.u.addr_short = 0x0000;
+    report.src_endpoint = 1;
+    report.dst_endpoint = HA_ESP_SENSOR_ENDPOINT;
+    report.cluster = ESP_ZB_ZCL_CLUSTER_ID_ON_OFF;
+    report.attribute = {0x0000, {ESP_ZB_ZCL_ATTR_TYPE_BOOL, sizeof(reported), &reported}};
+
+    length = TRACE_EncodeAction(ESP_ZB_CORE_REPORT_ATTR_CB_ID, &report, data);
+    const esp_zb_zcl_report_attr_message_t *decodedReport =
+        (const esp_zb_zcl_report_attr_message_t *)TRACE_DecodeAction(ESP_ZB_CORE_REPORT_ATTR_CB_ID, data, length, &storage);
+    TEST_ASSERT_NOT_NULL(decodedReport);
+    TEST_ASSERT_EQUAL_HEX16(ESP_ZB_ZCL_CLUSTER_ID_ON_OFF, decodedReport->cluster);
+    TEST_ASSERT_EQUAL_UINT8(1, *(const uint8_t *)decodedReport->attribute.data.value);
+
+    // Others are recorded by callback id alone, and a truncated message does not decode
+    TEST_ASSERT_EQUAL(0, TRACE_EncodeAction(ESP_ZB_CORE_CMD_READ_ATTR_RESP_CB_ID, &report, data));
+    TEST_ASSERT_NULL(TRACE_DecodeAction(ESP_ZB_CORE_REPORT_ATTR_CB_ID, data, 5, &storage));
+}
+
+void test_signal_params_round_trip() {
+    trace_signal_params_t storage;
+    uint8_t data[TRACE_MAX_DATA_SIZE];
+    size_t size = 0;
+
+    esp_zb_zdo_signal_nwk_status_indication_params_t status = {ESP_ZB_NWK_COMMAND_STATUS_PARENT_LINK_FAILURE, 0x1a2b, 0x07};
+    uint8_t length = TRACE_EncodeSignal(ESP_ZB_NLME_STATUS_INDICATION, &status, data);
+    const esp_zb_zdo_signal_nwk_status_indication_params_t *decodedStatus =
+        (const esp_zb_zdo_signal_nwk_status_indication_params_t *)TRACE_DecodeSignal(ESP_ZB_NLME_STATUS_INDICATION, data, length, &storage, &size);
+    TEST_ASSERT_NOT_NULL(decodedStatus);
+    TEST_ASSERT_EQUAL(sizeof(status), size);
+    TEST_ASSERT_EQUAL_HEX8(ESP_ZB_NWK_COMMAND_STATUS_PARENT_LINK_FAILURE, decodedStatus->status);
+    TEST_ASSERT_EQUAL_HEX16(0x1a2b, decodedStatus->network_addr);
+    TEST_ASSERT_EQUAL_HEX8(0x07, decodedStatus->unknown_command_id);
+
+    esp_zb_zdo_signal_leave_params_t leave = {ESP_ZB_NWK_LEAVE_TYPE_REJOIN};
+    length = TRACE_EncodeSignal(ESP_ZB_ZDO_SIGNAL_LEAVE, &leave, data);
+    const esp_zb_zdo_signal_leave_params_t *decodedLeave =
+        (const esp_zb_zdo_signal_leave_params_t *)TRACE_DecodeSignal(ESP_ZB_ZDO_SIGNAL_LEAVE, data, length, &storage, &size);
+    TEST_ASSERT_NOT_NULL(decodedLeave);
+    TEST_ASSERT_EQUAL(sizeof(leave), size);
+    TEST_ASSERT_EQUAL_UINT8(ESP_ZB_NWK_LEAVE_TYPE_REJOIN, decodedLeave->leave_type);
+
+    // Signals the application reads no params for are recorded without them, and truncated params do not decode
+    TEST_ASSERT_EQUAL(0, TRACE_EncodeSignal(ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, &leave, data));
+    TEST_ASSERT_EQUAL(0, TRACE_EncodeSignal(ESP_ZB_ZDO_SIGNAL_LEAVE, NULL, data));
+    TEST_ASSERT_NULL(TRACE_DecodeSignal(ESP_ZB_NLME_STATUS_INDICATION, data, 2, &storage, &size));
+}
+
+/********************* Log **************************/
+void test_wraps_round_robin() {
+    std::vector<uint8_t> data;
+    trace_flash_t flash = ramFlash(&data, SECTOR_SIZE, 4);
+    trace_log_t log;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogMount(&log, &flash));
+
+    // Far more than the region holds, in small writes
+    const uint32_t count = 1000;
+    writeRecord(&log, TRACE_RECORD_BOOT, 1000, 0, 0);
+    for (uint32_t i = 1; i < count; i++) {
+        writeRecord(&log, TRACE_RECORD_SWITCH, 1000 + i * 10, i, SWITCH_EVENT_SHORT_PRESS);
+    }
+    TEST_ASSERT_TRUE(log.stats.erases > 4);
+    TEST_ASSERT_EQUAL_UINT32(0, log.stats.errors);
+
+    // The newest records survive, oldest first with no gaps
+    trace_reader_t reader;
+    trace_record_t record;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_ReaderOpen(&reader, &flash));
+    TEST_ASSERT_EQUAL(4, reader.sectors);
+
+    uint32_t read = 0;
+    uint32_t next = 0;
+    while (TRACE_ReaderNext(&reader, &record) == ESP_OK) {
+        if (read > 0) {
+            TEST_ASSERT_EQUAL_UINT32(next, record.id);
+        }
+        next = record.id + 1;
+        read++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(count, next);
+    TEST_ASSERT_TRUE(read > 100 && read < count);
+    TEST_ASSERT_EQUAL_UINT32(0, reader.torn);
+
+    // Remounting finds the end of the trace and carries on from it
+    trace_log_t remounted;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogMount(&remounted, &flash));
+    TEST_ASSERT_EQUAL_UINT32(log.activeSector, remounted.activeSector);
+    TEST_ASSERT_EQUAL_UINT32(log.appendOffset, remounted.appendOffset);
+
+    writeRecord(&remounted, TRACE_RECORD_BOOT, 500, 0, 0);
+    writeRecord(&remounted, TRACE_RECORD_SIGNAL, 700, ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK);
+
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_ReaderOpen(&reader, &flash));
+    trace_record_t last[2];
+    while (TRACE_ReaderNext(&reader, &record) == ESP_OK) {
+        last[0] = last[1];
+        last[1] = record;
+    }
+    TEST_ASSERT_EQUAL_UINT8(TRACE_RECORD_BOOT, last[0].type);
+    TEST_ASSERT_EQUAL_INT64(500, last[0].timestampUs);
+    TEST_ASSERT_EQUAL_INT64(700, last[1].timestampUs);
+}
+
+void test_torn_record_ends_sector() {
+    std::vector<uint8_t> data;
+    trace_flash_t flash = ramFlash(&data, SECTOR_SIZE, 4);
+    trace_log_t log;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogMount(&log, &flash));
+
+    writeRecord(&log, TRACE_RECORD_BOOT, 1000, 0, 0);
+    writeRecord(&log, TRACE_RECORD_SIGNAL, 2000, ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK);
+
+    // Power lost part way through the next record: only its first bytes reach flash
+    trace_record_t torn = {TRACE_RECORD_SIGNAL, 0, 3000, ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS, ESP_OK, {}};
+    uint8_t encoded[TRACE_MAX_RECORD_SIZE];
+    TRACE_LogEncode(&log, &torn, encoded);
+    TEST_ASSERT_EQUAL(ESP_OK, flash.write(flash.context, log.activeSector * SECTOR_SIZE + log.appendOffset, encoded, 4));
+
+    trace_log_t remounted;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogMount(&remounted, &flash));
+    TEST_ASSERT_EQUAL_UINT32(1, remounted.stats.torn);
+    TEST_ASSERT_EQUAL_UINT32(SECTOR_SIZE, remounted.appendOffset);
+
+    // The next boot starts a new sector rather than appending behind the torn record
+    writeRecord(&remounted, TRACE_RECORD_BOOT, 400, 0, 0);
+    TEST_ASSERT_EQUAL_UINT32((log.activeSector + 1) % 4, remounted.activeSector);
+
+    trace_replay_stats_t stats;
+    trace_replay_target_t target = {};
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &target, &stats));
+    TEST_ASSERT_EQUAL_UINT32(3, stats.records);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.boots);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.signals);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.torn);
+
+    // A region too small for the format is refused
+    trace_flash_t tiny = flash;
+    tiny.sectorSize = 64;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, TRACE_LogMount(&remounted, &tiny));
+}
+
+void test_paces_replay() {
+    std::vector<uint8_t> data;
+    trace_flash_t flash = ramFlash(&data, SECTOR_SIZE, 2);
+    trace_log_t log;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogMount(&log, &flash));
+
+    // Two boots, 30 ms of trace in each
+    for (int boot = 0; boot < 2; boot++) {
+        writeRecord(&log, TRACE_RECORD_BOOT, 500000, 0, 0);
+        writeRecord(&log, TRACE_RECORD_SIGNAL, 510000, ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK);
+        writeRecord(&log, TRACE_RECORD_SIGNAL, 530000, ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK);
+    }
+
+    replay_context_t context = {};
+    trace_replay_target_t target = {NULL, NULL, NULL, countWait, &context};
+    trace_replay_stats_t stats;
+
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 1, &target, &stats));
+    TEST_ASSERT_EQUAL_UINT64(60000, stats.traceUs);
+    TEST_ASSERT_EQUAL_UINT32(60000, context.waitedUs);
+    TEST_ASSERT_EQUAL_UINT32(4, context.waits);
+
+    context = {};
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 2, &target, &stats));
+    TEST_ASSERT_EQUAL_UINT32(30000, context.waitedUs);
+
+    context = {};
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &target, &stats));
+    TEST_ASSERT_EQUAL_UINT32(0, context.waits);
+}
+
+/********************* Recorder & replay **************************/
+void test_replays_app_traffic() {
+    const uint8_t pin = dimmerPin();
+    const int rounds = 5;
+    uint16_t identifyTimes[rounds];
+    esp_zb_zcl_set_attr_value_message_t writes[rounds];
+    uint8_t reported = 1;
+    esp_zb_zcl_report_attr_message_t report = {};
+    report.dst_endpoint = HA_ESP_SENSOR_ENDPOINT;
+    report.cluster = ESP_ZB_ZCL_CLUSTER_ID_ON_OFF;
+    report.attribute = {0x0000, {ESP_ZB_ZCL_ATTR_TYPE_BOOL, sizeof(reported), &reported}};
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, SW_InjectEvent(0xff, SWITCH_EVENT_SHORT_PRESS));
+
+    // Start from an empty trace, then drive the application as the network and a user would
+    TRACE_Flush();
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Erase());
+    app_counts_t before = appCounts();
+
+    for (int i = 0; i < rounds; i++) {
+        identifyTimes[i] = (uint16_t)(i * 10);
+        writes[i] = {};
+        writes[i].info = {ESP_ZB_ZCL_STATUS_SUCCESS, HA_ESP_SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY};
+        writes[i].attribute = {ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, {ESP_ZB_ZCL_ATTR_TYPE_U16, sizeof(uint16_t), &identifyTimes[i]}};
+
+        HOST_ZbInjectSignal(ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK);
+        HOST_ZbInjectSignal(ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS, ESP_FAIL);
+        HOST_ZbInvokeAction(ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, &writes[i]);
+        HOST_ZbInvokeAction(ESP_ZB_CORE_REPORT_ATTR_CB_ID, &report);
+        HOST_ZbSync();
+        TEST_ASSERT_EQUAL(ESP_OK, SW_InjectEvent(pin, SWITCH_EVENT_SHORT_PRESS));
+        delay(2);
+    }
+
+    app_counts_t live = appCountsOnceSent(before.sent + rounds);
+    std::vector<uint8_t> data;
+    trace_flash_t flash = copyRecorderRegion(&data);
+
+    trace_stats_t recorder;
+    TRACE_GetStats(&recorder);
+    TEST_ASSERT_EQUAL_UINT32(0, recorder.dropped);
+    TEST_ASSERT_EQUAL_UINT32(0, recorder.log.errors);
+    TEST_ASSERT_TRUE(recorder.size == TRACE_FLASH_SIZE && recorder.address != 0);
+
+    // The trace holds what happened, in order, with the messages' contents
+    trace_reader_t reader;
+    trace_record_t record;
+    trace_action_message_t storage;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_ReaderOpen(&reader, &flash));
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_ReaderNext(&reader, &record));
+    TEST_ASSERT_EQUAL_UINT8(TRACE_RECORD_SIGNAL, record.type);
+    TEST_ASSERT_EQUAL_UINT32(ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, record.id);
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_ReaderNext(&reader, &record));
+    TEST_ASSERT_EQUAL_INT32(ESP_FAIL, record.value);
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_ReaderNext(&reader, &record));
+    TEST_ASSERT_EQUAL_UINT8(TRACE_RECORD_ACTION, record.type);
+    const esp_zb_zcl_set_attr_value_message_t *write =
+        (const esp_zb_zcl_set_attr_value_message_t *)TRACE_DecodeAction(record.id, record.data, record.length, &storage);
+    TEST_ASSERT_NOT_NULL(write);
+    TEST_ASSERT_EQUAL_HEX16(ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, write->attribute.id);
+
+    // Replayed twice, the application sees the same traffic each time as it did live
+    for (int replay = 0; replay < 2; replay++) {
+        trace_replay_stats_t stats;
+        app_counts_t start = appCounts();
+        TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &appTarget, &stats));
+        app_counts_t end = appCountsOnceSent(start.sent + live.sent - before.sent);
+
+        TEST_ASSERT_EQUAL_UINT32(rounds * 2, stats.signals);
+        TEST_ASSERT_EQUAL_UINT32(rounds * 2, stats.actions);
+        TEST_ASSERT_EQUAL_UINT32(rounds, stats.switchEvents);
+        TEST_ASSERT_EQUAL_UINT32(0, stats.skipped);
+        TEST_ASSERT_EQUAL_UINT32(live.signals - before.signals, end.signals - start.signals);
+        TEST_ASSERT_EQUAL_UINT32(live.actions - before.actions, end.actions - start.actions);
+        TEST_ASSERT_EQUAL_UINT32(live.sent - before.sent, end.sent - start.sent);
+    }
+    TEST_ASSERT_EQUAL_UINT32(rounds, live.sent - before.sent);
+}
+
+typedef struct {
+    int calls;
+    esp_zb_zdo_signal_nwk_status_indication_params_t nwkStatus;
+} signal_capture_t;
+
+static void captureSignal(void *context, uint32_t signal, esp_err_t status, const void *params, size_t size) {
+    signal_capture_t *capture = (signal_capture_t *)context;
+    if (signal == ESP_ZB_NLME_STATUS_INDICATION && params != NULL && size == sizeof(capture->nwkStatus)) {
+        memcpy(&capture->nwkStatus, params, size);
+        capture->calls++;
+    }
+}
+
+// Signals whose params the handler reads are recorded with them, and replayed with them
+void test_replays_signal_params() {
+    TRACE_Flush();
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Erase());
+
+    esp_zb_zdo_signal_nwk_status_indication_params_t status = {ESP_ZB_NWK_COMMAND_STATUS_NO_ROUTE_AVAILABLE, 0x1a2b, 0};
+    HOST_ZbInjectSignalParams(ESP_ZB_NLME_STATUS_INDICATION, ESP_OK, &status, sizeof(status));
+    HOST_ZbSync();
+
+    std::vector<uint8_t> data;
+    trace_flash_t flash = copyRecorderRegion(&data);
+
+    signal_capture_t capture = {};
+    trace_replay_target_t target = {captureSignal, NULL, NULL, NULL, &capture};
+    trace_replay_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &target, &stats));
+    TEST_ASSERT_EQUAL_UINT32(0, stats.skipped);
+    TEST_ASSERT_EQUAL(1, capture.calls);
+    TEST_ASSERT_EQUAL_HEX8(ESP_ZB_NWK_COMMAND_STATUS_NO_ROUTE_AVAILABLE, capture.nwkStatus.status);
+    TEST_ASSERT_EQUAL_HEX16(0x1a2b, capture.nwkStatus.network_addr);
+
+    // And the application takes them as it did live
+    app_counts_t before = appCounts();
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &appTarget, &stats));
+    HOST_ZbSync();
+    TEST_ASSERT_EQUAL_UINT32(before.signals + stats.signals, appCounts().signals);
+}
+
+void test_replays_trace_file() {
+    const char *path = getenv("TRACE_REPLAY_FILE");
+    if (path == NULL) {
+        TEST_IGNORE_MESSAGE("set TRACE_REPLAY_FILE to a region read back with esptool to replay it");
+    }
+
+    FILE *file = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL_MESSAGE(file, path);
+    std::vector<uint8_t> data(TRACE_FLASH_SIZE);
+    size_t size = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+
+    trace_flash_t flash = {ramRead, ramWrite, ramErase, &data, SPI_FLASH_SEC_SIZE, (uint32_t)(size / SPI_FLASH_SEC_SIZE)};
+    trace_replay_stats_t stats;
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &appTarget, &stats));
+    HOST_ZbSync();
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    printf("[bench] %s: %lu records (%lu signals, %lu actions, %lu switch events, %lu boots, %lu dropped, %lu torn) covering %llu ms "
+           "replayed in %lld us\n",
+           path, (unsigned long)stats.records, (unsigned long)stats.signals, (unsigned long)stats.actions, (unsigned long)stats.switchEvents,
+           (unsigned long)stats.boots, (unsigned long)stats.dropped, (unsigned long)stats.torn, (unsigned long long)(stats.traceUs / 1000),
+           (long long)elapsed);
+}
+
+void test_bench_record_and_replay() {
+    // Hook cost on the recording task, with the ring emptied between rounds so none are dropped
+    int64_t hookUs = 0;
+    for (int round = 0; round < BENCH_HOOK_ROUNDS; round++) {
+        TRACE_Flush();
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < TRACE_RING_SIZE / 2; i++) {
+            TRACE_RecordSignal(ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK, NULL);
+        }
+        hookUs += esp_timer_get_time() - start;
+    }
+    TRACE_Flush();
+
+    // A trace of attribute writes & signals 1 ms apart
+    std::vector<uint8_t> data;
+    trace_flash_t flash = ramFlash(&data, SPI_FLASH_SEC_SIZE, TRACE_MAX_SECTORS);
+    trace_log_t log;
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogMount(&log, &flash));
+
+    uint16_t identifyTime = 0;
+    esp_zb_zcl_set_attr_value_message_t write = {};
+    write.info = {ESP_ZB_ZCL_STATUS_SUCCESS, HA_ESP_SENSOR_ENDPOINT, ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY};
+    write.attribute = {ESP_ZB_ZCL_ATTR_IDENTIFY_IDENTIFY_TIME_ID, {ESP_ZB_ZCL_ATTR_TYPE_U16, sizeof(identifyTime), &identifyTime}};
+
+    writeRecord(&log, TRACE_RECORD_BOOT, 0, 0, 0);
+    for (int i = 0; i < BENCH_RECORDS; i++) {
+        trace_record_t record = {TRACE_RECORD_ACTION, 0, (i + 1) * 1000LL, ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID, 0, {}};
+        if (i % 2) {
+            record = {TRACE_RECORD_SIGNAL, 0, (i + 1) * 1000LL, ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE, ESP_OK, {}};
+        } else {
+            identifyTime = (uint16_t)i;
+            record.length = TRACE_EncodeAction(record.id, &write, record.data);
+        }
+
+        uint8_t encoded[TRACE_MAX_RECORD_SIZE];
+        size_t size = TRACE_LogEncode(&log, &record, encoded);
+        TEST_ASSERT_EQUAL(ESP_OK, TRACE_LogWrite(&log, encoded, size));
+    }
+
+    trace_replay_stats_t stats;
+    trace_replay_target_t decodeOnly = {};
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &decodeOnly, &stats));
+    int64_t decodeUs = esp_timer_get_time() - start;
+    TEST_ASSERT_EQUAL_UINT32(BENCH_RECORDS + 1, stats.records);
+
+    start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, TRACE_Replay(&flash, 0, &appTarget, &stats));
+    HOST_ZbSync();
+    int64_t appUs = esp_timer_get_time() - start;
+    TEST_ASSERT_EQUAL_UINT32(BENCH_RECORDS / 2, stats.actions);
+
+    printf("[bench] record hook %.0f ns/record; trace of %d records (%lu bytes, %llu ms): read & decode %.2f us/record, "
+           "replayed into the application at full speed in %lld us (%.1fx real time, %.1f us/record)\n",
+           hookUs * 1000.0 / (BENCH_HOOK_ROUNDS * (TRACE_RING_SIZE / 2)), BENCH_RECORDS, (unsigned long)log.stats.bytes,
+           (unsigned long long)(stats.traceUs / 1000), (double)decodeUs / BENCH_RECORDS, (long long)appUs, (double)stats.traceUs / appUs,
+           (double)appUs / BENCH_RECORDS);
+}
+
+int main(int argc, char **argv) {
+    HOST_SetLogEnabled(false);
+
+    // Boot the application with the recorder built in, and wait for the simulated join
+    setup();
+    for (int i = 0; i < 100 && !esp_zb_bdb_dev_joined(); i++) {
+        delay(10);
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_encodes_records);
+    RUN_TEST(test_action_messages_round_trip);
+    RUN_TEST(test_signal_params_round_trip);
+    RUN_TEST(test_wraps_round_robin);
+    RUN_TEST(test_torn_record_ends_sector);
+    RUN_TEST(test_paces_replay);
+    RUN_TEST(test_replays_app_traffic);
+    RUN_TEST(test_replays_signal_params);
+    RUN_TEST(test_replays_trace_file);
+    RUN_TEST(test_bench_record_and_replay);
+    return UNITY_END();
+}